@@ -0,0 +1,1911 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <alliedcam.h>
+#include <alliedcam_copy.h>
+#include <alliedcam_unpack.h>
+#include <alliedcam_cpu.h>
+#include <alliedcam_image.h>
+#include <alliedcam_transform.h>
+#include <alliedcam_debayer.h>
+#include <alliedcam_stats.h>
+#include <alliedcam_bin.h>
+#include <alliedcam_calib.h>
+#include <alliedcam_defects.h>
+#include <alliedcam_coadd.h>
+#include <alliedcam_stack.h>
+#include <alliedcam_ptc.h>
+#include <alliedcam_register.h>
+#include <alliedcam_focus.h>
+#include <alliedcam_track.h>
+#include <alliedcam_beam.h>
+#include <alliedcam_photometry.h>
+#include <alliedcam_change.h>
+#include <math.h>
+#include <VmbImageTransform/VmbTransform.h>
+#include "../src/alliedcam_numa.h"
+
+#define BENCH_MIN_SECS 0.2 // minimum run time per measurement
+#define BENCH_WSET KIB(256) // working set used to measure cache pollution
+
+static inline double now_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+static void *bench_alloc(size_t size)
+{
+    void *ptr = aligned_alloc(64, (size + 63) & ~(size_t)63);
+    if (ptr == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(ptr, 0x5a, size);
+    return ptr;
+}
+
+/**
+ * @brief Time to read a small working set after a copy, to show how much of it the copy evicted.
+ *
+ */
+static double touch_working_set(const volatile unsigned char *wset)
+{
+    double start = now_secs();
+    unsigned sum = 0;
+    for (size_t i = 0; i < BENCH_WSET; i += 64)
+    {
+        sum += wset[i];
+    }
+    (void)sum;
+    return now_secs() - start;
+}
+
+typedef enum
+{
+    COPY_MEMCPY,
+    COPY_ALLIED,
+} copy_kind_t;
+
+static void bench_copy(const char *name, copy_kind_t kind, size_t size, const AlliedCopyOptions_t *opts)
+{
+    unsigned char *src = bench_alloc(size);
+    unsigned char *dst = bench_alloc(size);
+    unsigned char *wset = bench_alloc(BENCH_WSET);
+    size_t iters = 0;
+    double elapsed = 0, touch = 0;
+    while (elapsed < BENCH_MIN_SECS)
+    {
+        touch_working_set(wset);
+        double start = now_secs();
+        if (kind == COPY_MEMCPY)
+        {
+            memcpy(dst, src, size);
+        }
+        else
+        {
+            allied_copy_buffer(dst, src, size, opts);
+        }
+        elapsed += now_secs() - start;
+        touch += touch_working_set(wset);
+        iters++;
+    }
+    printf("%-24s %10zu KiB %9.2f GB/s %9.2f us/working set\n", name, size / 1024,
+           (double)size * iters / elapsed / 1e9, touch / iters * 1e6);
+    free(src);
+    free(dst);
+    free(wset);
+}
+
+static void bench_roi(const char *name, VmbUint32_t width, VmbUint32_t height, VmbUint32_t roi, bool naive, const AlliedCopyOptions_t *opts)
+{
+    VmbFrame_t frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.bufferSize = width * height * 2;
+    frame.buffer = bench_alloc(frame.bufferSize);
+    frame.width = width;
+    frame.height = height;
+    frame.pixelFormat = VmbPixelFormatMono16;
+    size_t row = (size_t)roi * 2;
+    unsigned char *dst = bench_alloc(row * roi);
+    VmbUint32_t x = (width - roi) / 2 + 1, y = (height - roi) / 2;
+    size_t iters = 0;
+    double elapsed = 0;
+    while (elapsed < BENCH_MIN_SECS)
+    {
+        double start = now_secs();
+        if (naive)
+        {
+            const unsigned char *src = (const unsigned char *)frame.buffer + ((size_t)y * width + x) * 2;
+            for (VmbUint32_t r = 0; r < roi; r++)
+            {
+                memcpy(dst + r * row, src + (size_t)r * width * 2, row);
+            }
+        }
+        else
+        {
+            allied_copy_frame_roi(&frame, x, y, roi, roi, dst, 0, opts);
+        }
+        elapsed += now_secs() - start;
+        iters++;
+    }
+    printf("%-24s %5ux%-5u ROI %9.2f GB/s\n", name, roi, roi, (double)row * roi * iters / elapsed / 1e9);
+    free(frame.buffer);
+    free(dst);
+}
+
+#define BENCH_NUMA_FRAMES 8 // frames in the simulated frame pool, larger than the last level cache
+
+/**
+ * @brief Number of online NUMA nodes, 1 if it can not be determined.
+ *
+ */
+static int bench_numa_nodes(void)
+{
+    int nodes = 1;
+    FILE *fp = fopen("/sys/devices/system/node/online", "r");
+    if (fp != NULL)
+    {
+        char buf[256];
+        if (fgets(buf, sizeof(buf), fp) != NULL)
+        {
+            const char *last = strrchr(buf, '-');
+            const char *comma = strrchr(buf, ',');
+            if (comma != NULL && (last == NULL || comma > last))
+            {
+                last = comma;
+            }
+            nodes = atoi(last != NULL ? last + 1 : buf) + 1;
+        }
+        fclose(fp);
+    }
+    return nodes;
+}
+
+typedef struct
+{
+    unsigned char *pool; // frame pool
+    size_t size;         // size of a frame
+    int node;            // NUMA node the thread runs on
+    VmbUint64_t pattern; // word the frames are filled with
+    double elapsed;      // time taken to read the pool
+    bool ok;             // every frame read back the pattern
+} numa_job_t;
+
+/**
+ * @brief Simulated camera: fill every frame of the pool from a CPU of the camera's node, as the NIC or USB controller would.
+ *
+ */
+static void *bench_numa_camera(void *arg)
+{
+    numa_job_t *job = (numa_job_t *)arg;
+    allied_numa_pin_thread(job->node);
+    VmbUint64_t *words = (VmbUint64_t *)job->pool;
+    size_t count = job->size * BENCH_NUMA_FRAMES / sizeof(VmbUint64_t);
+    for (size_t i = 0; i < count; i++)
+    {
+        words[i] = job->pattern;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Frame processing thread: read every frame of the pool once, as a statistics pass would.
+ *
+ */
+static void *bench_numa_worker(void *arg)
+{
+    numa_job_t *job = (numa_job_t *)arg;
+    allied_numa_pin_thread(job->node);
+    size_t count = job->size / sizeof(VmbUint64_t);
+    job->ok = true;
+    double start = now_secs();
+    for (VmbUint32_t f = 0; f < BENCH_NUMA_FRAMES; f++)
+    {
+        const VmbUint64_t *words = (const VmbUint64_t *)(job->pool + f * job->size);
+        VmbUint64_t sum = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            sum += words[i];
+        }
+        job->ok &= sum == job->pattern * count;
+    }
+    job->elapsed = now_secs() - start;
+    return NULL;
+}
+
+/**
+ * @brief Frame pool placement: the pool is allocated on `buffer_node` (-1 for `aligned_alloc` wherever the caller runs) and filled by a
+ * simulated camera on that node, then read by a worker pinned to `worker_node`.
+ *
+ */
+static void bench_numa(const char *name, size_t size, int buffer_node, int worker_node)
+{
+    bool mapped;
+    unsigned char *pool = (unsigned char *)allied_numa_alloc(64, size * BENCH_NUMA_FRAMES, buffer_node, &mapped);
+    if (pool == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    numa_job_t job = {.pool = pool, .size = size, .ok = true};
+    size_t iters = 0;
+    double elapsed = 0;
+    bool ok = true;
+    while (elapsed < BENCH_MIN_SECS)
+    {
+        pthread_t thread;
+        job.pattern = 0x0101010101010101ULL * ((iters & 0x7f) + 1);
+        job.node = buffer_node;
+        pthread_create(&thread, NULL, bench_numa_camera, &job);
+        pthread_join(thread, NULL);
+        job.node = worker_node;
+        pthread_create(&thread, NULL, bench_numa_worker, &job);
+        pthread_join(thread, NULL);
+        elapsed += job.elapsed;
+        ok &= job.ok;
+        iters++;
+    }
+    printf("%-24s %10zu KiB %9.2f GB/s %s\n", name, size / 1024,
+           (double)size * BENCH_NUMA_FRAMES * iters / elapsed / 1e9, ok ? "ok" : "MISMATCH");
+    allied_numa_free(pool, size * BENCH_NUMA_FRAMES, mapped);
+}
+
+/**
+ * @brief Reference packer, used to check that unpacking round-trips.
+ *
+ */
+static void pack_reference(VmbPixelFormat_t format, const VmbUint16_t *pixels, size_t count, unsigned char *out)
+{
+    size_t bits = format == VmbPixelFormatMono10p ? 10 : 12;
+    memset(out, 0, (count * bits + 7) / 8);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (format == VmbPixelFormatMono12Packed)
+        {
+            unsigned char *b = out + i / 2 * 3;
+            b[i % 2 ? 2 : 0] = pixels[i] >> 4;
+            b[1] |= (pixels[i] & 0xf) << (i % 2 ? 4 : 0);
+            continue;
+        }
+        for (size_t k = 0; k < bits; k++)
+        {
+            size_t bit = i * bits + k;
+            out[bit / 8] |= ((pixels[i] >> k) & 1) << (bit % 8);
+        }
+    }
+}
+
+static void bench_unpack(const char *name, VmbPixelFormat_t format, size_t count, AlliedUnpackAlign_t align)
+{
+    size_t bits = format == VmbPixelFormatMono10p ? 10 : 12;
+    VmbUint16_t *pixels = bench_alloc(count * 2);
+    VmbUint16_t *out = bench_alloc(count * 2);
+    unsigned char *packed = bench_alloc((count * bits + 7) / 8);
+    for (size_t i = 0; i < count; i++)
+    {
+        pixels[i] = rand() & ((1 << bits) - 1);
+    }
+    pack_reference(format, pixels, count, packed);
+    size_t iters = 0, errors = 0;
+    double elapsed = 0;
+    while (elapsed < BENCH_MIN_SECS)
+    {
+        double start = now_secs();
+        allied_unpack(format, packed, (count * bits + 7) / 8, out, count, align, 0);
+        elapsed += now_secs() - start;
+        iters++;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        errors += out[i] != (VmbUint16_t)(pixels[i] << (align == AlliedUnpackMsb ? 16 - bits : 0));
+    }
+    printf("%-24s %10zu px %9.2f GB/s out %9.0f Mpx/s %s\n", name, count,
+           (double)count * 2 * iters / elapsed / 1e9, (double)count * iters / elapsed / 1e6,
+           errors ? "ROUND TRIP FAILED" : "round trip ok");
+    free(pixels);
+    free(out);
+    free(packed);
+}
+
+/**
+ * @brief Generic pixel access, switching on the pixel format for every pixel.
+ *
+ */
+static VmbUint32_t generic_pixel(const AlliedImage_t *img, VmbUint32_t x, VmbUint32_t y)
+{
+    const VmbUchar_t *row = (const VmbUchar_t *)img->data + (size_t)y * img->stride;
+    switch (img->format)
+    {
+    case VmbPixelFormatMono8:
+        return row[x];
+    case VmbPixelFormatMono10:
+        return ((const VmbUint16_t *)row)[x] & 0x3ff;
+    case VmbPixelFormatMono12:
+        return ((const VmbUint16_t *)row)[x] & 0xfff;
+    case VmbPixelFormatMono14:
+        return ((const VmbUint16_t *)row)[x] & 0x3fff;
+    default:
+        return ((const VmbUint16_t *)row)[x];
+    }
+}
+
+static void generic_store(AlliedImage_t *img, VmbUint32_t x, VmbUint32_t y, VmbUint32_t value)
+{
+    VmbUchar_t *row = (VmbUchar_t *)img->data + (size_t)y * img->stride;
+    if (img->format == VmbPixelFormatMono8)
+    {
+        row[x] = value > 0xff ? 0xff : value;
+    }
+    else
+    {
+        VmbUint32_t bits = allied_image_bits(img->format);
+        VmbUint32_t maxval = (1u << bits) - 1;
+        ((VmbUint16_t *)row)[x] = value > maxval ? maxval : value;
+    }
+}
+
+typedef enum
+{
+    KERNEL_STATS,
+    KERNEL_LUT,
+    KERNEL_BIN,
+    KERNEL_ACCUMULATE,
+} kernel_kind_t;
+
+static void generic_kernel(kernel_kind_t kind, const AlliedImage_t *src, const VmbUint16_t *lut, AlliedImage_t *dst, VmbUint32_t *acc, AlliedImageStats_t *stats)
+{
+    switch (kind)
+    {
+    case KERNEL_STATS:
+        memset(stats, 0, sizeof(*stats));
+        stats->min = UINT32_MAX;
+        for (VmbUint32_t y = 0; y < src->height; y++)
+        {
+            for (VmbUint32_t x = 0; x < src->width; x++)
+            {
+                VmbUint32_t v = generic_pixel(src, x, y);
+                stats->min = v < stats->min ? v : stats->min;
+                stats->max = v > stats->max ? v : stats->max;
+                stats->sum += v;
+                stats->sumsq += (VmbUint64_t)v * v;
+            }
+        }
+        break;
+    case KERNEL_LUT:
+        for (VmbUint32_t y = 0; y < src->height; y++)
+        {
+            for (VmbUint32_t x = 0; x < src->width; x++)
+            {
+                generic_store(dst, x, y, lut[generic_pixel(src, x, y)]);
+            }
+        }
+        break;
+    case KERNEL_BIN:
+        for (VmbUint32_t y = 0; y < src->height / 2; y++)
+        {
+            for (VmbUint32_t x = 0; x < src->width / 2; x++)
+            {
+                VmbUint32_t s = generic_pixel(src, 2 * x, 2 * y) + generic_pixel(src, 2 * x + 1, 2 * y) +
+                                generic_pixel(src, 2 * x, 2 * y + 1) + generic_pixel(src, 2 * x + 1, 2 * y + 1);
+                generic_store(dst, x, y, s);
+            }
+        }
+        break;
+    case KERNEL_ACCUMULATE:
+        for (VmbUint32_t y = 0; y < src->height; y++)
+        {
+            for (VmbUint32_t x = 0; x < src->width; x++)
+            {
+                acc[(size_t)y * src->width + x] += generic_pixel(src, x, y);
+            }
+        }
+        break;
+    }
+}
+
+static void bench_kernel(const char *name, kernel_kind_t kind, VmbPixelFormat_t format, VmbUint32_t width, VmbUint32_t height, bool generic)
+{
+    size_t pixel = format == VmbPixelFormatMono8 ? 1 : 2;
+    VmbUint32_t bits = allied_image_bits(format);
+    AlliedImage_t src = {.data = bench_alloc((size_t)width * height * pixel), .width = width, .height = height, .stride = width * pixel, .format = format};
+    AlliedImage_t dst = {.data = bench_alloc((size_t)width * height * pixel), .width = width, .height = height, .stride = width * pixel, .format = format};
+    VmbUint32_t *acc = bench_alloc((size_t)width * height * sizeof(VmbUint32_t));
+    VmbUint16_t *lut = bench_alloc(sizeof(VmbUint16_t) << bits);
+    for (size_t i = 0; i < (size_t)width * height; i++)
+    {
+        VmbUint32_t v = rand() & ((1u << bits) - 1);
+        if (pixel == 1)
+            ((VmbUint8_t *)src.data)[i] = v;
+        else
+            ((VmbUint16_t *)src.data)[i] = v;
+    }
+    for (size_t i = 0; i < ((size_t)1 << bits); i++)
+    {
+        lut[i] = (VmbUint16_t)(((1u << bits) - 1) - i);
+    }
+    AlliedImageStats_t stats;
+    size_t iters = 0;
+    double elapsed = 0;
+    while (elapsed < BENCH_MIN_SECS)
+    {
+        double start = now_secs();
+        if (generic)
+        {
+            generic_kernel(kind, &src, lut, &dst, acc, &stats);
+        }
+        else if (kind == KERNEL_STATS)
+        {
+            allied_image_stats(&src, &stats);
+        }
+        else if (kind == KERNEL_LUT)
+        {
+            allied_image_lut(&src, lut, (size_t)1 << bits, &dst);
+        }
+        else if (kind == KERNEL_BIN)
+        {
+            dst.stride = 0;
+            allied_image_bin(&src, 2, 2, AlliedBinSum, &dst);
+        }
+        else
+        {
+            allied_image_accumulate(&src, acc, 0);
+        }
+        elapsed += now_secs() - start;
+        iters++;
+    }
+    printf("%-24s %-8s %9.0f Mpx/s %9.3f ms/frame\n", name, generic ? "generic" : "special",
+           (double)width * height * iters / elapsed / 1e6, elapsed / iters * 1e3);
+    free(src.data);
+    free(dst.data);
+    free(acc);
+    free(lut);
+}
+
+/**
+ * @brief Convert a frame the naive way: set up the descriptors and allocate the output for every frame.
+ *
+ */
+static VmbError_t transform_naive(const VmbFrame_t *frame, VmbPixelFormat_t format, VmbDebayerMode_t debayer)
+{
+    VmbImage src = {.Size = sizeof(VmbImage)};
+    VmbImage dst = {.Size = sizeof(VmbImage)};
+    VmbTransformInfo info;
+    VmbError_t err = VmbSetImageInfoFromPixelFormat(frame->pixelFormat, frame->width, frame->height, &src);
+    err = err ? err : VmbSetImageInfoFromPixelFormat(format, frame->width, frame->height, &dst);
+    err = err ? err : VmbSetDebayerMode(debayer, &info);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    src.Data = frame->buffer;
+    dst.Data = malloc((size_t)frame->width * frame->height * ((format >> 16) & 0xff) / 8);
+    VmbUint32_t count = src.ImageInfo.PixelInfo.PixelLayout == VmbPixelLayoutRaw ? 1 : 0;
+    err = VmbImageTransform(&src, &dst, &info, count);
+    free(dst.Data);
+    return err;
+}
+
+static void bench_transform(const char *name, VmbPixelFormat_t in, VmbPixelFormat_t out, VmbUint32_t width, VmbUint32_t height, VmbUint32_t threads)
+{
+    VmbFrame_t frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.bufferSize = width * height * 2;
+    frame.buffer = bench_alloc(frame.bufferSize);
+    frame.width = width;
+    frame.height = height;
+    frame.pixelFormat = in;
+    AlliedTransform_t transform = NULL;
+    AlliedTransformOptions_t opts = {.format = out, .debayer = VmbDebayerMode2x2, .threads = threads};
+    if (threads > 0)
+    {
+        allied_transform_create(&transform, &opts);
+    }
+    size_t iters = 0;
+    double elapsed = 0;
+    VmbError_t err = VmbErrorSuccess;
+    while (elapsed < BENCH_MIN_SECS && err == VmbErrorSuccess)
+    {
+        double start = now_secs();
+        if (transform == NULL)
+        {
+            err = transform_naive(&frame, out, VmbDebayerMode2x2);
+        }
+        else
+        {
+            AlliedTransformOutput_t output;
+            err = allied_transform_frame(transform, &frame, &output);
+            allied_transform_release(transform, &output);
+        }
+        elapsed += now_secs() - start;
+        iters++;
+    }
+    char label[32];
+    snprintf(label, sizeof(label), threads == 0 ? "naive" : "cached, %u thr", threads);
+    if (err != VmbErrorSuccess)
+    {
+        printf("%-24s %-16s %4ux%-4u failed: %d\n", name, label, width, height, err);
+    }
+    else
+    {
+        printf("%-24s %-16s %4ux%-4u %9.3f ms/frame %9.0f Mpx/s\n", name, label, width, height,
+               elapsed / iters * 1e3, (double)width * height * iters / elapsed / 1e6);
+    }
+    if (transform != NULL)
+    {
+        allied_transform_destroy(&transform);
+    }
+    free(frame.buffer);
+}
+
+/**
+ * @brief Synthetic RGB8 scene with smooth shading, sharp color edges and fine stripes.
+ *
+ */
+static void debayer_scene(unsigned char *rgb, VmbUint32_t width, VmbUint32_t height)
+{
+    for (VmbUint32_t y = 0; y < height; y++)
+    {
+        for (VmbUint32_t x = 0; x < width; x++)
+        {
+            unsigned char *px = rgb + ((size_t)y * width + x) * 3;
+            double r = 128 + 100 * sin(x * 0.013) * cos(y * 0.007);
+            double g = 128 + 90 * sin((x + y) * 0.004);
+            double b = 128 + 80 * cos(x * 0.002 - y * 0.011);
+            if ((x / 97 + y / 131) & 1) // color blocks with sharp edges
+            {
+                r = 255 - r;
+                b = b * 0.5;
+            }
+            if (x > width / 2 && y > height / 2) // stripes near the resolution limit
+            {
+                double s = 0.5 + 0.5 * sin((x + 0.3 * y) * 0.9);
+                r *= s;
+                g *= s;
+                b *= s;
+            }
+            px[0] = (unsigned char)r;
+            px[1] = (unsigned char)g;
+            px[2] = (unsigned char)b;
+        }
+    }
+}
+
+/**
+ * @brief Peak signal to noise ratio of an RGB8 image against the scene, away from the borders.
+ *
+ */
+static double debayer_psnr(const unsigned char *rgb, const unsigned char *truth, VmbUint32_t width, VmbUint32_t height)
+{
+    double sse = 0;
+    size_t count = 0;
+    for (VmbUint32_t y = 4; y < height - 4; y++)
+    {
+        for (VmbUint32_t x = 4 * 3; x < (width - 4) * 3; x++)
+        {
+            double d = (double)rgb[(size_t)y * width * 3 + x] - truth[(size_t)y * width * 3 + x];
+            sse += d * d;
+            count++;
+        }
+    }
+    return sse == 0 ? INFINITY : 10 * log10(255.0 * 255.0 * count / sse);
+}
+
+static void bench_debayer(const char *name, const AlliedImage_t *raw, const unsigned char *truth, const AlliedDebayerOptions_t *opts, VmbDebayerMode_t mode)
+{
+    size_t size = (size_t)raw->width * raw->height * 3;
+    unsigned char *rgb = bench_alloc(size);
+    AlliedImage_t dst = {.data = rgb};
+    VmbImage src = {.Size = sizeof(VmbImage)};
+    VmbImage out = {.Size = sizeof(VmbImage)};
+    VmbTransformInfo info;
+    void *input = NULL;
+    if (opts == NULL)
+    {
+        // repeated LCAA/LCAAV transforms write into their source, so they get a copy of the mosaic
+        input = bench_alloc((size_t)raw->width * raw->height);
+        memcpy(input, raw->data, (size_t)raw->width * raw->height);
+        VmbSetImageInfoFromPixelFormat(raw->format, raw->width, raw->height, &src);
+        VmbSetImageInfoFromPixelFormat(VmbPixelFormatRgb8, raw->width, raw->height, &out);
+        VmbSetDebayerMode(mode, &info);
+        src.Data = input;
+        out.Data = rgb;
+    }
+    // quality of the first conversion, before the source has been touched
+    VmbError_t err = opts == NULL ? VmbImageTransform(&src, &out, &info, 1) : allied_debayer(raw, &dst, opts);
+    double psnr = debayer_psnr(rgb, truth, raw->width, raw->height);
+    size_t iters = 0;
+    double elapsed = 0;
+    while (elapsed < BENCH_MIN_SECS && err == VmbErrorSuccess)
+    {
+        double start = now_secs();
+        err = opts == NULL ? VmbImageTransform(&src, &out, &info, 1) : allied_debayer(raw, &dst, opts);
+        elapsed += now_secs() - start;
+        iters++;
+    }
+    if (err != VmbErrorSuccess)
+    {
+        printf("%-28s failed: %d\n", name, err);
+    }
+    else
+    {
+        printf("%-28s %9.3f ms/frame %9.0f Mpx/s %7.2f dB\n", name, elapsed / iters * 1e3,
+               (double)raw->width * raw->height * iters / elapsed / 1e6, psnr);
+    }
+    free(input);
+    free(rgb);
+}
+
+/**
+ * @brief Time the statistics of a Mono12 frame, either computed once by the statistics stage, or by every consumer with a statistics pass and a separate histogram pass.
+ *
+ */
+static void bench_stats(const char *name, const AlliedImage_t *img, const AlliedStatsConfig_t *config, VmbUint32_t consumers, bool shared)
+{
+    static AlliedFrameStats_t stats;
+    static VmbUint32_t hist[4096];
+    size_t iters = 0;
+    double elapsed = 0;
+    while (elapsed < BENCH_MIN_SECS)
+    {
+        double start = now_secs();
+        if (shared)
+        {
+            allied_stats_compute(img, config, &stats);
+        }
+        else
+        {
+            for (VmbUint32_t c = 0; c < consumers; c++)
+            {
+                AlliedImageStats_t basic;
+                allied_image_stats(img, &basic);
+                memset(hist, 0, sizeof(hist));
+                for (VmbUint32_t y = 0; y < img->height; y++)
+                {
+                    const VmbUint16_t *row = (const VmbUint16_t *)((const unsigned char *)img->data + (size_t)y * img->stride);
+                    for (VmbUint32_t x = 0; x < img->width; x++)
+                    {
+                        hist[row[x] & 0xfff]++;
+                    }
+                }
+            }
+        }
+        elapsed += now_secs() - start;
+        iters++;
+    }
+    printf("%-32s %2u consumer(s) %9.3f ms/frame\n", name, consumers, elapsed / iters * 1e3);
+}
+
+/**
+ * @brief Time binning (or decimation, if `step` is not 0) of a frame, against a generic per-pixel loop that switches on the pixel format.
+ *
+ */
+static void bench_bin(const char *name, const AlliedImage_t *img, const AlliedBinOptions_t *opts, VmbUint32_t step, bool generic)
+{
+    VmbUint32_t bx = step ? step : opts->bin_x, by = step ? step : opts->bin_y;
+    AlliedImage_t dst = {.data = bench_alloc((size_t)img->width * img->height * 2), .stride = 0};
+    dst.width = (img->width + bx - 1) / bx;
+    dst.height = (img->height + by - 1) / by;
+    dst.format = opts->depth == AlliedBinWiden16 ? VmbPixelFormatMono16 : img->format;
+    dst.stride = dst.width * (dst.format == VmbPixelFormatMono8 ? 1 : 2);
+    size_t iters = 0;
+    double elapsed = 0;
+    while (elapsed < BENCH_MIN_SECS)
+    {
+        double start = now_secs();
+        if (!generic)
+        {
+            if (step)
+                allied_decimate(img, step, step, opts->threads, &dst);
+            else
+                allied_bin(img, opts, &dst);
+        }
+        else if (step)
+        {
+            for (VmbUint32_t y = 0; y < dst.height; y++)
+            {
+                for (VmbUint32_t x = 0; x < dst.width; x++)
+                {
+                    generic_store(&dst, x, y, generic_pixel(img, x * step, y * step));
+                }
+            }
+        }
+        else
+        {
+            for (VmbUint32_t y = 0; y < img->height / by; y++)
+            {
+                for (VmbUint32_t x = 0; x < img->width / bx; x++)
+                {
+                    VmbUint32_t s = 0;
+                    for (VmbUint32_t j = 0; j < by; j++)
+                    {
+                        for (VmbUint32_t i = 0; i < bx; i++)
+                        {
+                            s += generic_pixel(img, x * bx + i, y * by + j);
+                        }
+                    }
+                    generic_store(&dst, x, y, opts->mode == AlliedBinMean ? s / (bx * by) : s);
+                }
+            }
+        }
+        elapsed += now_secs() - start;
+        iters++;
+    }
+    printf("%-28s %-8s %2u thread(s) %9.3f ms/frame\n", name, generic ? "generic" : "special", opts->threads ? opts->threads : 1, elapsed / iters * 1e3);
+    free(dst.data);
+}
+
+/**
+ * @brief Time dark and flat correction of a frame, against a per-pixel loop over float dark and flat images that switches on the pixel format.
+ *
+ */
+static void bench_calib(const char *name, const AlliedImage_t *img, const AlliedMaster_t *dark, const AlliedMaster_t *flat, const AlliedCalibConfig_t *config)
+{
+    AlliedCalibration_t calib = NULL;
+    if (config != NULL && allied_calib_create(&calib, config) != VmbErrorSuccess)
+    {
+        printf("%-36s failed\n", name);
+        return;
+    }
+    AlliedImage_t dst = {.data = bench_alloc((size_t)img->width * img->height * sizeof(float))};
+    size_t iters = 0;
+    double elapsed = 0;
+    while (elapsed < BENCH_MIN_SECS)
+    {
+        double start = now_secs();
+        if (calib != NULL)
+        {
+            allied_calib_apply(calib, img, &dst);
+        }
+        else
+        {
+            float *out = (float *)dst.data;
+            for (VmbUint32_t y = 0; y < img->height; y++)
+            {
+                for (VmbUint32_t x = 0; x < img->width; x++)
+                {
+                    size_t i = (size_t)y * img->width + x;
+                    out[i] = ((float)generic_pixel(img, x, y) - dark->data[i]) / flat->data[i];
+                }
+            }
+        }
+        elapsed += now_secs() - start;
+        iters++;
+    }
+    printf("%-36s %2u thread(s) %9.3f ms/frame\n", name, config != NULL && config->threads ? config->threads : 1, elapsed / iters * 1e3);
+    allied_calib_destroy(&calib);
+    free(dst.data);
+}
+
+static int bench_cmp_u32(const void *a, const void *b)
+{
+    VmbUint32_t x = *(const VmbUint32_t *)a, y = *(const VmbUint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void bench_defects(const char *name, AlliedImage_t *img, const AlliedDefect_t *defects, VmbUint32_t count, AlliedDefectMap_t map)
+{
+    size_t iters = 0;
+    double elapsed = 0;
+    while (elapsed < BENCH_MIN_SECS)
+    {
+        double start = now_secs();
+        if (map != NULL)
+        {
+            allied_defect_map_correct(map, img);
+        }
+        else
+        {
+            VmbUint16_t *px = (VmbUint16_t *)img->data;
+            for (VmbUint32_t i = 0; i < count; i++)
+            {
+                VmbUint32_t nb[8], n = 0;
+                for (int dy = -1; dy <= 1; dy++)
+                {
+                    for (int dx = -1; dx <= 1; dx++)
+                    {
+                        VmbInt32_t x = (VmbInt32_t)defects[i].x + dx, y = (VmbInt32_t)defects[i].y + dy;
+                        if ((dx || dy) && x >= 0 && y >= 0 && x < (VmbInt32_t)img->width && y < (VmbInt32_t)img->height)
+                        {
+                            nb[n++] = px[(size_t)y * img->width + x];
+                        }
+                    }
+                }
+                qsort(nb, n, sizeof(nb[0]), bench_cmp_u32);
+                px[(size_t)defects[i].y * img->width + defects[i].x] = (VmbUint16_t)nb[n / 2];
+            }
+        }
+        elapsed += now_secs() - start;
+        iters++;
+    }
+    printf("%-36s %2u thread(s) %9.3f ms/frame\n", name, 1, elapsed / iters * 1e3);
+}
+
+static void bench_defect_detector(const char *name, const AlliedImage_t *img, const AlliedDefectDetection_t *detection)
+{
+    AlliedCalibGeometry_t geometry = {.width = img->width, .height = img->height, .binning = 1, .format = img->format};
+    AlliedDefectDetector_t detector;
+    if (allied_defect_detector_create(&detector, &geometry, detection) != VmbErrorSuccess)
+    {
+        printf("%-36s failed\n", name);
+        return;
+    }
+    size_t iters = 0;
+    double elapsed = 0;
+    while (elapsed < BENCH_MIN_SECS)
+    {
+        double start = now_secs();
+        allied_defect_detector_add(detector, img, NULL);
+        elapsed += now_secs() - start;
+        iters++;
+    }
+    printf("%-36s %2u thread(s) %9.3f ms/frame\n", name, 1, elapsed / iters * 1e3);
+    allied_defect_detector_destroy(&detector);
+}
+
+/**
+ * @brief Render a flat field with uniform noise of ±32 ADU, and hot and cold pixels at known places. `frame` seeds the noise.
+ *
+ */
+static void defect_scene(AlliedImage_t *img, const AlliedDefect_t *defects, VmbUint32_t count, unsigned int frame)
+{
+    unsigned int seed = 2654435761u * (frame + 1);
+    for (VmbUint32_t y = 0; y < img->height; y++)
+    {
+        VmbUint16_t *row = (VmbUint16_t *)((unsigned char *)img->data + (size_t)y * img->stride);
+        for (VmbUint32_t x = 0; x < img->width; x++)
+        {
+            seed = seed * 1103515245u + 12345u;
+            row[x] = (VmbUint16_t)(1000 + ((seed >> 8) & 0x3f) - 32);
+        }
+    }
+    for (VmbUint32_t i = 0; i < count; i++)
+    {
+        ((VmbUint16_t *)((unsigned char *)img->data + (size_t)defects[i].y * img->stride))[defects[i].x] = defects[i].kind == AlliedDefectHot ? 3500 : 100;
+    }
+}
+
+/**
+ * @brief Check the detector and the map on known defects: the defects found and falsely flagged by detection, and the largest difference
+ * between a corrected pixel and the mean of the middle two of its neighbours. The defects must be at least two pixels apart and from the edges.
+ *
+ */
+static void check_defects(const char *name, AlliedImage_t *img, const AlliedDefect_t *defects, VmbUint32_t count)
+{
+    AlliedCalibGeometry_t geometry = {.width = img->width, .height = img->height, .binning = 1, .format = img->format};
+    AlliedDefectDetection_t detection = {.sample_interval = 1, .rows_per_sample = img->height};
+    AlliedDefectDetector_t detector;
+    AlliedDefectMap_t detected = NULL, map = NULL;
+    if (allied_defect_detector_create(&detector, &geometry, &detection) != VmbErrorSuccess)
+    {
+        printf("%-36s failed\n", name);
+        return;
+    }
+    bool updated = false;
+    unsigned int frame = 0;
+    while (!updated && frame < 64)
+    {
+        defect_scene(img, defects, count, frame++);
+        allied_defect_detector_add(detector, img, &updated);
+    }
+    if (allied_defect_detector_map(detector, &detected) != VmbErrorSuccess || allied_defect_map_create(&map, &geometry, defects, count) != VmbErrorSuccess)
+    {
+        printf("%-36s failed\n", name);
+        allied_defect_detector_destroy(&detector);
+        allied_defect_map_destroy(&detected);
+        return;
+    }
+    unsigned char *planted = (unsigned char *)calloc((size_t)img->width * img->height, 1);
+    for (VmbUint32_t i = 0; i < count; i++)
+    {
+        planted[(size_t)defects[i].y * img->width + defects[i].x] = (unsigned char)(defects[i].kind + 1);
+    }
+    VmbUint32_t found = 0, spurious = 0;
+    for (VmbUint32_t i = 0; i < allied_defect_map_count(detected); i++)
+    {
+        AlliedDefect_t d;
+        allied_defect_map_get(detected, i, &d);
+        if (planted[(size_t)d.y * img->width + d.x] == d.kind + 1)
+        {
+            found++;
+        }
+        else
+        {
+            spurious++;
+        }
+    }
+    defect_scene(img, defects, count, frame);
+    VmbUint16_t *before = (VmbUint16_t *)bench_alloc((size_t)img->stride * img->height);
+    memcpy(before, img->data, (size_t)img->stride * img->height);
+    allied_defect_map_correct(map, img);
+    VmbUint32_t error = 0, touched = 0;
+    for (VmbUint32_t y = 0; y < img->height; y++)
+    {
+        const VmbUint16_t *src = before + (size_t)y * img->stride / 2;
+        const VmbUint16_t *dst = (const VmbUint16_t *)((unsigned char *)img->data + (size_t)y * img->stride);
+        for (VmbUint32_t x = 0; x < img->width; x++)
+        {
+            if (!planted[(size_t)y * img->width + x])
+            {
+                touched += dst[x] != src[x];
+                continue;
+            }
+            VmbUint32_t nb[8], n = 0;
+            for (int dy = -1; dy <= 1; dy++)
+            {
+                for (int dx = -1; dx <= 1; dx++)
+                {
+                    if (dx || dy)
+                    {
+                        nb[n++] = before[(size_t)(y + dy) * img->stride / 2 + x + dx];
+                    }
+                }
+            }
+            qsort(nb, n, sizeof(nb[0]), bench_cmp_u32);
+            VmbUint32_t expected = (nb[3] + nb[4] + 1) >> 1;
+            VmbUint32_t diff = dst[x] > expected ? dst[x] - expected : expected - dst[x];
+            error = diff > error ? diff : error;
+        }
+    }
+    printf("%-36s found %u/%u in %u frames, %u false, correction error %u ADU, %u other pixels changed\n", name, found, count, frame,
+           spurious, error, touched);
+    free(before);
+    free(planted);
+    allied_defect_map_destroy(&map);
+    allied_defect_map_destroy(&detected);
+    allied_defect_detector_destroy(&detector);
+}
+
+static void bench_coadd(const char *name, const AlliedImage_t *img, const AlliedCoaddConfig_t *config)
+{
+    AlliedCalibGeometry_t geometry = {.width = img->width, .height = img->height, .binning = 1, .format = img->format};
+    AlliedCoadd_t acc = NULL;
+    float *naive = NULL;
+    if (config != NULL && allied_coadd_create(&acc, &geometry, config) != VmbErrorSuccess)
+    {
+        printf("%-36s failed\n", name);
+        return;
+    }
+    if (config == NULL)
+    {
+        naive = (float *)bench_alloc((size_t)img->width * img->height * sizeof(float));
+    }
+    for (VmbUint32_t i = 0; acc != NULL && i < config->window; i++)
+    {
+        // fill the window, so that every frame rolls a pane
+        allied_coadd_add(acc, img);
+    }
+    size_t iters = 0;
+    double elapsed = 0;
+    while (elapsed < BENCH_MIN_SECS)
+    {
+        double start = now_secs();
+        if (acc != NULL)
+        {
+            allied_coadd_add(acc, img);
+        }
+        else
+        {
+            for (VmbUint32_t y = 0; y < img->height; y++)
+            {
+                for (VmbUint32_t x = 0; x < img->width; x++)
+                {
+                    naive[(size_t)y * img->width + x] += (float)generic_pixel(img, x, y);
+                }
+            }
+        }
+        elapsed += now_secs() - start;
+        iters++;
+    }
+    printf("%-36s %2u thread(s) %9.3f ms/frame\n", name, config != NULL && config->threads ? config->threads : 1, elapsed / iters * 1e3);
+    allied_coadd_destroy(&acc);
+    free(naive);
+}
+
+static void bench_stack(const char *name, const AlliedImage_t *imgs, VmbUint32_t nimgs, const AlliedStackConfig_t *config, VmbUint32_t frames)
+{
+    AlliedCalibGeometry_t geometry = {.width = imgs[0].width, .height = imgs[0].height, .binning = 1, .format = imgs[0].format};
+    AlliedStack_t stack;
+    if (allied_stack_create(&stack, &geometry, config) != VmbErrorSuccess)
+    {
+        printf("%-36s failed\n", name);
+        return;
+    }
+    float *out = (float *)bench_alloc((size_t)geometry.width * geometry.height * sizeof(float));
+    double start = now_secs();
+    for (VmbUint32_t i = 0; i < frames; i++)
+    {
+        allied_stack_add(stack, &imgs[i % nimgs]);
+    }
+    double added = now_secs();
+    allied_stack_result(stack, 50, out, 0);
+    double done = now_secs();
+    printf("%-36s %2u thread(s) %6u frames %9.3f ms/frame %8.3f ms result %8.2f MiB\n", name, config->threads ? config->threads : 1, frames,
+           (added - start) / frames * 1e3, (done - added) * 1e3, allied_stack_memory(&geometry, config) / 1048576.0);
+    allied_stack_destroy(&stack);
+    free(out);
+}
+
+static void bench_moments(const char *name, const AlliedImage_t *img, VmbUint32_t threads, bool naive)
+{
+    size_t pixels = (size_t)img->width * img->height;
+    AlliedMoments_t moments = NULL;
+    double *sum = NULL, *sumsq = NULL;
+    if (naive)
+    {
+        sum = (double *)bench_alloc(pixels * sizeof(double));
+        sumsq = (double *)bench_alloc(pixels * sizeof(double));
+    }
+    else if (allied_moments_create(&moments, img->width, img->height, img->format, threads) != VmbErrorSuccess)
+    {
+        printf("%-36s failed\n", name);
+        return;
+    }
+    size_t iters = 0;
+    double elapsed = 0;
+    while (elapsed < BENCH_MIN_SECS)
+    {
+        double start = now_secs();
+        if (moments != NULL)
+        {
+            allied_moments_add(moments, img);
+        }
+        else
+        {
+            for (VmbUint32_t y = 0; y < img->height; y++)
+            {
+                for (VmbUint32_t x = 0; x < img->width; x++)
+                {
+                    double v = (double)generic_pixel(img, x, y);
+                    sum[(size_t)y * img->width + x] += v;
+                    sumsq[(size_t)y * img->width + x] += v * v;
+                }
+            }
+        }
+        elapsed += now_secs() - start;
+        iters++;
+    }
+    printf("%-36s %2u thread(s) %9.3f ms/frame\n", name, threads ? threads : 1, elapsed / iters * 1e3);
+    allied_moments_destroy(&moments);
+    free(sum);
+    free(sumsq);
+}
+
+/**
+ * @brief Synthetic Mono12 scene for registration, moved by (dx, dy): a field of Gaussian blobs one to four pixels wide, or a single spot
+ * eight pixels wide at (cx, cy).
+ *
+ */
+static void register_scene(AlliedImage_t *img, double dx, double dy, bool spot, double cx, double cy)
+{
+    double *acc = (double *)bench_alloc(sizeof(double) * img->width * img->height);
+    for (size_t i = 0; i < (size_t)img->width * img->height; i++)
+    {
+        acc[i] = 200;
+    }
+    unsigned int seed = 12345;
+    VmbUint32_t blobs = spot ? 1 : img->width * img->height / 256;
+    for (VmbUint32_t i = 0; i < blobs; i++)
+    {
+        // the same blobs whatever the shift
+        seed = seed * 1103515245u + 12345u;
+        double bx = spot ? cx : (seed >> 8) % img->width;
+        seed = seed * 1103515245u + 12345u;
+        double by = spot ? cy : (seed >> 8) % img->height;
+        seed = seed * 1103515245u + 12345u;
+        double amp = spot ? 3000 : 200 + (seed >> 8) % 1000;
+        seed = seed * 1103515245u + 12345u;
+        double sigma = spot ? 8 : 1 + (seed >> 8) % 300 / 100.0;
+        bx += dx;
+        by += dy;
+        VmbInt32_t r = (VmbInt32_t)ceil(5 * sigma);
+        for (VmbInt32_t y = (VmbInt32_t)by - r; y <= (VmbInt32_t)by + r; y++)
+        {
+            for (VmbInt32_t x = (VmbInt32_t)bx - r; x <= (VmbInt32_t)bx + r; x++)
+            {
+                if (x >= 0 && y >= 0 && x < (VmbInt32_t)img->width && y < (VmbInt32_t)img->height)
+                {
+                    acc[(size_t)y * img->width + x] += amp * exp(-((x - bx) * (x - bx) + (y - by) * (y - by)) / (2 * sigma * sigma));
+                }
+            }
+        }
+    }
+    for (VmbUint32_t y = 0; y < img->height; y++)
+    {
+        for (VmbUint32_t x = 0; x < img->width; x++)
+        {
+            double v = acc[(size_t)y * img->width + x];
+            ((VmbUint16_t *)((unsigned char *)img->data + (size_t)y * img->stride))[x] = (VmbUint16_t)(v > 4095 ? 4095 : v);
+        }
+    }
+    free(acc);
+}
+
+/**
+ * @brief Time the registration of a frame moved by a known shift against the reference, and report the error of the measured shift.
+ *
+ */
+static void bench_register(const char *name, const AlliedImage_t *ref, const AlliedImage_t *img, double dx, double dy, const AlliedRegisterConfig_t *config)
+{
+    AlliedCalibGeometry_t geometry = {.width = img->width, .height = img->height, .binning = 1, .format = img->format};
+    AlliedRegister_t reg;
+    if (allied_register_create(&reg, &geometry, config) != VmbErrorSuccess || allied_register_set_reference(reg, ref) != VmbErrorSuccess)
+    {
+        printf("%-36s failed\n", name);
+        allied_register_destroy(&reg);
+        return;
+    }
+    AlliedShift_t shift = {0};
+    size_t iters = 0;
+    double elapsed = 0;
+    while (elapsed < BENCH_MIN_SECS)
+    {
+        double start = now_secs();
+        allied_register_measure(reg, img, &shift);
+        elapsed += now_secs() - start;
+        iters++;
+    }
+    printf("%-36s %2u thread(s) %9.3f ms/frame, error %.3f px\n", name, config->threads ? config->threads : 1, elapsed / iters * 1e3,
+           hypot(shift.dx - dx, shift.dy - dy));
+    allied_register_destroy(&reg);
+}
+
+static void bench_shiftadd(const char *name, const AlliedImage_t *img, const AlliedShiftAddConfig_t *config)
+{
+    AlliedCalibGeometry_t geometry = {.width = img->width, .height = img->height, .binning = 1, .format = img->format};
+    AlliedShiftAdd_t sa;
+    if (allied_shiftadd_create(&sa, &geometry, config) != VmbErrorSuccess)
+    {
+        printf("%-36s failed\n", name);
+        return;
+    }
+    size_t iters = 0;
+    double elapsed = 0;
+    while (elapsed < BENCH_MIN_SECS)
+    {
+        AlliedShift_t shift = {.dx = 0.37 * (iters % 7), .dy = -0.29 * (iters % 5), .quality = 1};
+        double start = now_secs();
+        allied_shiftadd_add(sa, img, &shift);
+        elapsed += now_secs() - start;
+        iters++;
+    }
+    printf("%-36s %2u thread(s) %9.3f ms/frame\n", name, config->threads ? config->threads : 1, elapsed / iters * 1e3);
+    allied_shiftadd_destroy(&sa);
+}
+
+static void bench_focus(const char *name, const AlliedImage_t *img, const AlliedFocusConfig_t *config)
+{
+    size_t iters = 0;
+    double elapsed = 0;
+    double score = 0;
+    while (elapsed < BENCH_MIN_SECS)
+    {
+        double start = now_secs();
+        if (config != NULL)
+        {
+            allied_focus_score(img, config, &score);
+        }
+        else
+        {
+            double sum = 0, sumsq = 0;
+            for (VmbUint32_t y = 1; y + 1 < img->height; y++)
+            {
+                for (VmbUint32_t x = 1; x + 1 < img->width; x++)
+                {
+                    double l = (double)generic_pixel(img, x, y - 1) + (double)generic_pixel(img, x, y + 1) + (double)generic_pixel(img, x - 1, y) +
+                               (double)generic_pixel(img, x + 1, y) - 4.0 * (double)generic_pixel(img, x, y);
+                    sum += l;
+                    sumsq += l * l;
+                }
+            }
+            double n = (double)(img->width - 2) * (img->height - 2);
+            score = sumsq / n - (sum / n) * (sum / n);
+        }
+        elapsed += now_secs() - start;
+        iters++;
+    }
+    printf("%-36s %2u thread(s) %9.3f ms/frame\n", name, config != NULL && config->threads ? config->threads : 1, elapsed / iters * 1e3);
+    (void)score;
+}
+
+static void bench_spots(const char *name, const AlliedImage_t *img, const AlliedSpotConfig_t *config)
+{
+    AlliedSpotFinder_t finder = NULL;
+    AlliedSpot_t spots[ALLIED_TRACK_MAX_SPOTS];
+    VmbUint32_t count = 0;
+    if (config != NULL && allied_spot_finder_create(&finder, config) != VmbErrorSuccess)
+    {
+        return;
+    }
+    size_t iters = 0;
+    double elapsed = 0;
+    while (elapsed < BENCH_MIN_SECS)
+    {
+        double start = now_secs();
+        if (finder != NULL)
+        {
+            allied_spot_find(finder, img, 0, 0, spots, ALLIED_TRACK_MAX_SPOTS, &count);
+        }
+        else
+        {
+            double s0 = 0, sx = 0, sy = 0;
+            for (VmbUint32_t y = 0; y < img->height; y++)
+            {
+                for (VmbUint32_t x = 0; x < img->width; x++)
+                {
+                    double w = (double)generic_pixel(img, x, y) - 1000.0;
+                    w = w > 0 ? w : 0;
+                    s0 += w;
+                    sx += w * x;
+                    sy += w * y;
+                }
+            }
+            spots[0].x = sx / s0;
+            spots[0].y = sy / s0;
+            count = 1;
+        }
+        elapsed += now_secs() - start;
+        iters++;
+    }
+    printf("%-36s %2u thread(s) %9.3f ms/frame, %u spots\n", name, 1, elapsed / iters * 1e3, count);
+    allied_spot_finder_destroy(&finder);
+}
+
+static void bench_beam(const char *name, const AlliedImage_t *img, const AlliedBeamConfig_t *config)
+{
+    size_t iters = 0;
+    double elapsed = 0;
+    AlliedBeamProfile_t profile;
+    double *projections = (double *)bench_alloc(sizeof(double) * ((size_t)img->width + img->height));
+    while (elapsed < BENCH_MIN_SECS)
+    {
+        double start = now_secs();
+        if (config != NULL)
+        {
+            allied_beam_profile(img, config, &profile, projections, projections + img->width);
+        }
+        else
+        {
+            double s0 = 0, sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0;
+            memset(projections, 0, sizeof(double) * ((size_t)img->width + img->height));
+            for (VmbUint32_t y = 0; y < img->height; y++)
+            {
+                for (VmbUint32_t x = 0; x < img->width; x++)
+                {
+                    double w = (double)generic_pixel(img, x, y) - 100.0;
+                    w = w > 0 ? w : 0;
+                    s0 += w;
+                    sx += w * x;
+                    sy += w * y;
+                    sxx += w * x * x;
+                    syy += w * y * y;
+                    sxy += w * x * y;
+                    projections[x] += w;
+                    projections[img->width + y] += w;
+                }
+            }
+            profile.centroid_x = sx / s0;
+            profile.var_x = sxx / s0 - profile.centroid_x * profile.centroid_x;
+            profile.centroid_y = sy / s0;
+            profile.var_y = syy / s0 - profile.centroid_y * profile.centroid_y;
+            profile.cov_xy = sxy / s0 - profile.centroid_x * profile.centroid_y;
+        }
+        elapsed += now_secs() - start;
+        iters++;
+    }
+    printf("%-36s %2u thread(s) %9.3f ms/frame\n", name, 1, elapsed / iters * 1e3);
+    free(projections);
+}
+
+/**
+ * @brief Check the beam profile on an elliptical Gaussian beam of known centroid, widths and orientation, and report the errors.
+ *
+ */
+static void check_beam(const char *name, VmbUint32_t width, VmbUint32_t height, const AlliedBeamConfig_t *config)
+{
+    const double cx = width * 0.47 + 0.3, cy = height * 0.53 - 0.2, angle = 0.4;
+    const double major = width / 16.0, minor = major * 0.6; // standard deviations along the principal axes
+    AlliedImage_t img = {.data = bench_alloc((size_t)width * height * 2), .width = width, .height = height, .stride = width * 2, .format = VmbPixelFormatMono12};
+    for (VmbUint32_t y = 0; y < height; y++)
+    {
+        for (VmbUint32_t x = 0; x < width; x++)
+        {
+            double u = (x - cx) * cos(angle) + (y - cy) * sin(angle), w = (y - cy) * cos(angle) - (x - cx) * sin(angle);
+            ((VmbUint16_t *)img.data)[(size_t)y * width + x] = (VmbUint16_t)(100.5 + 3000 * exp(-0.5 * (u * u / (major * major) + w * w / (minor * minor))));
+        }
+    }
+    double *projections = (double *)bench_alloc(sizeof(double) * ((size_t)width + height));
+    AlliedBeamProfile_t profile;
+    if (allied_beam_profile(&img, config, &profile, projections, projections + width) != VmbErrorSuccess)
+    {
+        printf("%-36s failed\n", name);
+    }
+    else
+    {
+        printf("%-36s centroid error %.3f px, D4s error %.2f%% major %.2f%% minor, orientation error %.2f deg\n", name,
+               hypot(profile.centroid_x - cx, profile.centroid_y - cy), (profile.d4s_major / (4 * major) - 1) * 100,
+               (profile.d4s_minor / (4 * minor) - 1) * 100, (profile.orientation - angle) * 180 / M_PI);
+    }
+    free(projections);
+    free(img.data);
+}
+
+static void bench_photometry(const char *name, const AlliedImage_t *img, const AlliedAperture_t *apertures, VmbUint32_t count,
+                             const AlliedPhotometryConfig_t *config)
+{
+    size_t iters = 0;
+    double elapsed = 0;
+    AlliedApertureFlux_t *fluxes = (AlliedApertureFlux_t *)bench_alloc(sizeof(AlliedApertureFlux_t) * count);
+    AlliedPhotometry_t phot = NULL;
+    if (config != NULL)
+    {
+        allied_photometry_create(&phot, apertures, count, config);
+    }
+    while (elapsed < BENCH_MIN_SECS)
+    {
+        double start = now_secs();
+        if (phot != NULL)
+        {
+            allied_photometry_measure(phot, img, 0, 0, 1, fluxes);
+        }
+        else
+        {
+            // one aperture at a time, weighing the pixels of its bounding box on every frame
+            for (VmbUint32_t k = 0; k < count; k++)
+            {
+                const AlliedAperture_t *a = &(apertures[k]);
+                double sum = 0, area = 0, sky = 0, nsky = 0;
+                for (int y = (int)floor(a->y - a->sky_outer); y <= (int)ceil(a->y + a->sky_outer); y++)
+                {
+                    for (int x = (int)floor(a->x - a->sky_outer); x <= (int)ceil(a->x + a->sky_outer); x++)
+                    {
+                        if (x < 0 || y < 0 || x >= (int)img->width || y >= (int)img->height)
+                        {
+                            continue;
+                        }
+                        double v = generic_pixel(img, x, y), dx = x - a->x, dy = y - a->y, d2 = dx * dx + dy * dy;
+                        double w = 0;
+                        for (int j = 0; j < 5; j++)
+                        {
+                            for (int i = 0; i < 5; i++)
+                            {
+                                double sx = dx - 0.4 + 0.2 * i, sy = dy - 0.4 + 0.2 * j;
+                                w += sx * sx + sy * sy < a->radius * a->radius ? 0.04 : 0;
+                            }
+                        }
+                        sum += w * v;
+                        area += w;
+                        if (d2 >= a->sky_inner * a->sky_inner && d2 < a->sky_outer * a->sky_outer)
+                        {
+                            sky += v;
+                            nsky++;
+                        }
+                    }
+                }
+                fluxes[k].flux = sum - sky / nsky * area;
+            }
+        }
+        elapsed += now_secs() - start;
+        iters++;
+    }
+    printf("%-36s %2u thread(s) %9.3f ms/frame\n", name, config != NULL && config->threads > 1 ? config->threads : 1, elapsed / iters * 1e3);
+    allied_photometry_destroy(&phot);
+    free(fluxes);
+}
+
+static void bench_change(const char *name, const AlliedImage_t *img, const AlliedChangeConfig_t *config)
+{
+    size_t iters = 0;
+    double elapsed = 0;
+    AlliedChangeDetector_t det = NULL;
+    double *model = NULL;
+    VmbUint32_t blocks_x = (img->width + 31) / 32, blocks_y = (img->height + 31) / 32;
+    VmbUint32_t *counts = (VmbUint32_t *)bench_alloc(sizeof(VmbUint32_t) * blocks_x * blocks_y);
+    if (config != NULL)
+    {
+        allied_change_create(&det, config);
+    }
+    else
+    {
+        model = (double *)bench_alloc(sizeof(double) * img->width * img->height);
+        for (VmbUint32_t y = 0; y < img->height; y++)
+        {
+            for (VmbUint32_t x = 0; x < img->width; x++)
+            {
+                model[(size_t)y * img->width + x] = generic_pixel(img, x, y);
+            }
+        }
+    }
+    VmbUint64_t changed = 0;
+    while (elapsed < BENCH_MIN_SECS)
+    {
+        double start = now_secs();
+        if (det != NULL)
+        {
+            AlliedChangeResult_t result;
+            allied_change_detect(det, img, &result);
+            changed += result.changed;
+        }
+        else
+        {
+            // every pixel against a double precision average, counted into 32x32 blocks
+            memset(counts, 0, sizeof(VmbUint32_t) * blocks_x * blocks_y);
+            for (VmbUint32_t y = 0; y < img->height; y++)
+            {
+                for (VmbUint32_t x = 0; x < img->width; x++)
+                {
+                    double *m = &(model[(size_t)y * img->width + x]);
+                    double d = generic_pixel(img, x, y) - *m;
+                    *m += d / 16;
+                    counts[(y / 32) * blocks_x + x / 32] += fabs(d) > 128;
+                }
+            }
+            for (VmbUint32_t b = 0; b < blocks_x * blocks_y; b++)
+            {
+                changed += counts[b] > 102;
+            }
+        }
+        elapsed += now_secs() - start;
+        iters++;
+    }
+    printf("%-36s %9.3f ms/frame (%llu changed)\n", name, elapsed / iters * 1e3, (unsigned long long)changed);
+    allied_change_destroy(&det);
+    free(model);
+    free(counts);
+}
+
+int main(int argc, char *argv[])
+{
+    VmbUint32_t threads = argc > 1 ? (VmbUint32_t)atoi(argv[1]) : 4;
+    AlliedCopyOptions_t autoopts = {.mode = AlliedCopyAuto};
+    AlliedCopyOptions_t cached = {.mode = AlliedCopyCached};
+    AlliedCopyOptions_t streaming = {.mode = AlliedCopyStreaming};
+    AlliedCopyOptions_t parallel = {.mode = AlliedCopyAuto, .threads = threads};
+    const size_t sizes[] = {KIB(64), KIB(512), MIB(2), MIB(8), MIB(32)};
+
+    printf("Kernel level: %s (features 0x%x)\n\n", allied_cpu_level_name(allied_cpu_detected_level()), allied_cpu_features());
+    printf("Frame copy\n");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        bench_copy("memcpy", COPY_MEMCPY, sizes[i], NULL);
+        bench_copy("allied_copy cached", COPY_ALLIED, sizes[i], &cached);
+        bench_copy("allied_copy streaming", COPY_ALLIED, sizes[i], &streaming);
+        bench_copy("allied_copy auto", COPY_ALLIED, sizes[i], &autoopts);
+        bench_copy("allied_copy auto (MT)", COPY_ALLIED, sizes[i], &parallel);
+    }
+
+    printf("\nROI copy (Mono16, 4096x3000)\n");
+    const VmbUint32_t rois[] = {16, 64, 256, 1024, 2048};
+    for (size_t i = 0; i < sizeof(rois) / sizeof(rois[0]); i++)
+    {
+        bench_roi("memcpy per row", 4096, 3000, rois[i], true, NULL);
+        bench_roi("allied_copy_frame_roi", 4096, 3000, rois[i], false, &cached);
+        bench_roi("allied_copy_frame_roi MT", 4096, 3000, rois[i], false, &parallel);
+    }
+
+    int nodes = bench_numa_nodes();
+    printf("\nFrame pool placement, %d frames (%d NUMA nodes)\n", BENCH_NUMA_FRAMES, nodes);
+    const size_t fsizes[] = {MIB(5), MIB(24)};
+    for (size_t i = 0; i < sizeof(fsizes) / sizeof(fsizes[0]); i++)
+    {
+        bench_numa("unplaced", fsizes[i], -1, -1);
+        bench_numa("node-local", fsizes[i], 0, 0);
+        if (nodes > 1)
+        {
+            bench_numa("cross-node", fsizes[i], 1, 0);
+        }
+    }
+    if (nodes < 2)
+    {
+        printf("Single NUMA node: cross-node placement not measured\n");
+    }
+
+    const size_t pixels[] = {640 * 480, 2464 * 2056};
+    AlliedCpuLevel_t detected = allied_cpu_detected_level();
+    for (int level = AlliedCpuScalar; level <= (int)detected; level++)
+    {
+        allied_set_cpu_level((AlliedCpuLevel_t)level);
+        printf("\nUnpacking to 16 bits (%s)\n", allied_cpu_level_name(allied_cpu_level()));
+        for (size_t i = 0; i < sizeof(pixels) / sizeof(pixels[0]); i++)
+        {
+            bench_unpack("Mono10p LSB", VmbPixelFormatMono10p, pixels[i], AlliedUnpackLsb);
+            bench_unpack("Mono10p MSB", VmbPixelFormatMono10p, pixels[i], AlliedUnpackMsb);
+            bench_unpack("Mono12p LSB", VmbPixelFormatMono12p, pixels[i], AlliedUnpackLsb);
+            bench_unpack("Mono12p MSB", VmbPixelFormatMono12p, pixels[i], AlliedUnpackMsb);
+            bench_unpack("Mono12Packed LSB", VmbPixelFormatMono12Packed, pixels[i], AlliedUnpackLsb);
+            bench_unpack("Mono12Packed MSB", VmbPixelFormatMono12Packed, pixels[i], AlliedUnpackMsb);
+        }
+    }
+    allied_set_cpu_level(detected);
+
+    const struct
+    {
+        const char *name;
+        kernel_kind_t kind;
+        VmbPixelFormat_t format;
+    } kernels[] = {
+        {"stats Mono8", KERNEL_STATS, VmbPixelFormatMono8},
+        {"stats Mono12", KERNEL_STATS, VmbPixelFormatMono12},
+        {"LUT Mono8", KERNEL_LUT, VmbPixelFormatMono8},
+        {"LUT Mono12", KERNEL_LUT, VmbPixelFormatMono12},
+        {"bin 2x2 Mono8", KERNEL_BIN, VmbPixelFormatMono8},
+        {"bin 2x2 Mono12", KERNEL_BIN, VmbPixelFormatMono12},
+        {"accumulate Mono8", KERNEL_ACCUMULATE, VmbPixelFormatMono8},
+        {"accumulate Mono12", KERNEL_ACCUMULATE, VmbPixelFormatMono12},
+    };
+    printf("\nImage kernels, 2464x2056: generic per-pixel format switch against specialized (%s)\n", allied_cpu_level_name(allied_cpu_level()));
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++)
+    {
+        bench_kernel(kernels[i].name, kernels[i].kind, kernels[i].format, 2464, 2056, true);
+        bench_kernel(kernels[i].name, kernels[i].kind, kernels[i].format, 2464, 2056, false);
+    }
+
+    const struct
+    {
+        const char *name;
+        VmbPixelFormat_t in;
+        VmbPixelFormat_t out;
+    } transforms[] = {
+        {"BayerRG8 to RGB8", VmbPixelFormatBayerRG8, VmbPixelFormatRgb8},
+        {"BayerRG12 to RGB8", VmbPixelFormatBayerRG12, VmbPixelFormatRgb8},
+        {"Mono12 to Mono8", VmbPixelFormatMono12, VmbPixelFormatMono8},
+    };
+    const VmbUint32_t tsizes[][2] = {{256, 256}, {2464, 2056}};
+    printf("\nVmbImageTransform: naive per-frame setup against cached plans\n");
+    for (size_t i = 0; i < sizeof(transforms) / sizeof(transforms[0]); i++)
+    {
+        for (size_t j = 0; j < sizeof(tsizes) / sizeof(tsizes[0]); j++)
+        {
+            bench_transform(transforms[i].name, transforms[i].in, transforms[i].out, tsizes[j][0], tsizes[j][1], 0);
+            bench_transform(transforms[i].name, transforms[i].in, transforms[i].out, tsizes[j][0], tsizes[j][1], 1);
+            if (threads > 1)
+            {
+                bench_transform(transforms[i].name, transforms[i].in, transforms[i].out, tsizes[j][0], tsizes[j][1], threads);
+            }
+        }
+    }
+
+    const VmbUint32_t dwidth = 2464, dheight = 2056;
+    unsigned char *truth = bench_alloc((size_t)dwidth * dheight * 3);
+    unsigned char *mosaic = bench_alloc((size_t)dwidth * dheight);
+    debayer_scene(truth, dwidth, dheight);
+    for (VmbUint32_t y = 0; y < dheight; y++)
+    {
+        for (VmbUint32_t x = 0; x < dwidth; x++)
+        {
+            VmbUint32_t c = (y & 1) + (x & 1); // RGGB: 0 red, 1 green, 2 blue
+            mosaic[(size_t)y * dwidth + x] = truth[((size_t)y * dwidth + x) * 3 + c];
+        }
+    }
+    AlliedImage_t raw = {.data = mosaic, .width = dwidth, .height = dheight, .format = VmbPixelFormatBayerRG8};
+    AlliedDebayerOptions_t bilinear = {.method = AlliedDebayerBilinear};
+    AlliedDebayerOptions_t edge = {.method = AlliedDebayerEdgeAware};
+    AlliedDebayerOptions_t edge_mt = {.method = AlliedDebayerEdgeAware, .threads = threads};
+    AlliedDebayerOptions_t corrected = {.method = AlliedDebayerEdgeAware, .color_correction = true, .white_balance = {1, 1, 1}, .matrix = {1, 0, 0, 0, 1, 0, 0, 0, 1}};
+    printf("\nDebayering BayerRG8 to RGB8, 2464x2056: native against VmbImageTransform (%s)\n", allied_cpu_level_name(allied_cpu_level()));
+    bench_debayer("VmbDebayerMode2x2", &raw, truth, NULL, VmbDebayerMode2x2);
+    bench_debayer("VmbDebayerMode3x3", &raw, truth, NULL, VmbDebayerMode3x3);
+    bench_debayer("VmbDebayerModeLCAA", &raw, truth, NULL, VmbDebayerModeLCAA);
+    bench_debayer("VmbDebayerModeLCAAV", &raw, truth, NULL, VmbDebayerModeLCAAV);
+    bench_debayer("native bilinear", &raw, truth, &bilinear, 0);
+    bench_debayer("native edge-aware", &raw, truth, &edge, 0);
+    bench_debayer("native edge-aware + CCM", &raw, truth, &corrected, 0);
+    if (threads > 1)
+    {
+        bench_debayer("native edge-aware MT", &raw, truth, &edge_mt, 0);
+    }
+    free(truth);
+    free(mosaic);
+
+    const VmbUint32_t swidth = 2592, sheight = 1944;
+    AlliedImage_t mono = {.data = bench_alloc((size_t)swidth * sheight * 2), .width = swidth, .height = sheight, .stride = swidth * 2, .format = VmbPixelFormatMono12};
+    for (size_t i = 0; i < (size_t)swidth * sheight; i++)
+    {
+        ((VmbUint16_t *)mono.data)[i] = rand() & 0xfff;
+    }
+    AlliedStatsConfig_t sampled = {.num_percentiles = 3, .percentiles = {1, 50, 99}};
+    AlliedStatsConfig_t full = sampled, sub2 = sampled;
+    full.step_x = full.step_y = 1;
+    sub2.step_x = sub2.step_y = 2;
+    printf("\nFrame statistics, Mono12 2592x1944 (%s)\n", allied_cpu_level_name(allied_cpu_level()));
+    bench_stats("per consumer", &mono, NULL, 1, false);
+    bench_stats("per consumer", &mono, NULL, 3, false);
+    bench_stats("statistics stage, every pixel", &mono, &full, 3, true);
+    bench_stats("statistics stage, 2x2 steps", &mono, &sub2, 3, true);
+    bench_stats("statistics stage, default steps", &mono, &sampled, 3, true);
+
+    const struct
+    {
+        const char *name;
+        AlliedBinOptions_t opts;
+        VmbUint32_t step;
+    } bins[] = {
+        {"bin 2x2 sum", {.bin_x = 2, .bin_y = 2, .mode = AlliedBinSum}, 0},
+        {"bin 2x2 sum, 16 bits", {.bin_x = 2, .bin_y = 2, .mode = AlliedBinSum, .depth = AlliedBinWiden16}, 0},
+        {"bin 2x2 mean", {.bin_x = 2, .bin_y = 2, .mode = AlliedBinMean}, 0},
+        {"bin 4x4 mean", {.bin_x = 4, .bin_y = 4, .mode = AlliedBinMean}, 0},
+        {"bin 3x3 mean", {.bin_x = 3, .bin_y = 3, .mode = AlliedBinMean}, 0},
+        {"decimate 2x2", {0}, 2},
+        {"decimate 4x4", {0}, 4},
+    };
+    printf("\nBinning and decimation, Mono12 2592x1944 (%s)\n", allied_cpu_level_name(allied_cpu_level()));
+    for (size_t i = 0; i < sizeof(bins) / sizeof(bins[0]); i++)
+    {
+        AlliedBinOptions_t opts = bins[i].opts;
+        bench_bin(bins[i].name, &mono, &opts, bins[i].step, true);
+        bench_bin(bins[i].name, &mono, &opts, bins[i].step, false);
+        if (threads > 1)
+        {
+            opts.threads = threads;
+            bench_bin(bins[i].name, &mono, &opts, bins[i].step, false);
+        }
+    }
+
+    AlliedCalibGeometry_t geometry = {.width = swidth, .height = sheight, .binning = 1, .format = VmbPixelFormatMono12};
+    AlliedMaster_t dark = {.kind = AlliedMasterDark, .geometry = geometry, .data = bench_alloc((size_t)swidth * sheight * sizeof(float))};
+    AlliedMaster_t flat = {.kind = AlliedMasterFlat, .geometry = geometry, .data = bench_alloc((size_t)swidth * sheight * sizeof(float))};
+    for (size_t i = 0; i < (size_t)swidth * sheight; i++)
+    {
+        dark.data[i] = 100.0f + (rand() & 0xf);
+        flat.data[i] = 0.8f + (rand() & 0xff) / 640.0f;
+    }
+    const struct
+    {
+        const char *name;
+        AlliedCalibOutput_t output;
+        AlliedCalibMaps_t maps;
+        bool flat;
+    } calibs[] = {
+        {"dark, fixed maps, 16-bit", AlliedCalibOutput16, AlliedCalibMapsFixed, false},
+        {"dark + flat, fixed maps, 16-bit", AlliedCalibOutput16, AlliedCalibMapsFixed, true},
+        {"dark + flat, float maps, 16-bit", AlliedCalibOutput16, AlliedCalibMapsFloat, true},
+        {"dark + flat, fixed maps, float", AlliedCalibOutputFloat, AlliedCalibMapsFixed, true},
+        {"dark + flat, float maps, float", AlliedCalibOutputFloat, AlliedCalibMapsFloat, true},
+    };
+    printf("\nCalibration, Mono12 2592x1944 (%s)\n", allied_cpu_level_name(allied_cpu_level()));
+    bench_calib("per-pixel float loop", &mono, &dark, &flat, NULL);
+    for (size_t i = 0; i < sizeof(calibs) / sizeof(calibs[0]); i++)
+    {
+        AlliedCalibConfig_t config = {.dark = &dark, .flat = calibs[i].flat ? &flat : NULL, .output = calibs[i].output, .maps = calibs[i].maps};
+        bench_calib(calibs[i].name, &mono, &dark, &flat, &config);
+        if (threads > 1)
+        {
+            config.threads = threads;
+            bench_calib(calibs[i].name, &mono, &dark, &flat, &config);
+        }
+    }
+    free(dark.data);
+    free(flat.data);
+
+    const VmbUint32_t ndefects = swidth * sheight / 1000;
+    AlliedDefect_t *defects = (AlliedDefect_t *)bench_alloc(ndefects * sizeof(AlliedDefect_t));
+    for (VmbUint32_t i = 0; i < ndefects; i++)
+    {
+        defects[i] = (AlliedDefect_t){.x = (VmbUint32_t)rand() % swidth, .y = (VmbUint32_t)rand() % sheight, .kind = AlliedDefectHot};
+    }
+    AlliedDefectMap_t map;
+    allied_defect_map_create(&map, &geometry, defects, ndefects);
+    AlliedDefectDetection_t every = {.sample_interval = 1, .rows_per_sample = sheight, .passes = 1};
+    AlliedDefectDetection_t schedule = {0};
+    printf("\nDefect correction, Mono12 2592x1944, %u defects (%s)\n", ndefects, allied_cpu_level_name(allied_cpu_level()));
+    bench_defects("per-defect qsort median", &mono, defects, ndefects, NULL);
+    bench_defects("defect map", &mono, defects, ndefects, map);
+    bench_defect_detector("detection, every frame and row", &mono, &every);
+    bench_defect_detector("detection, default schedule", &mono, &schedule);
+    AlliedDefect_t planted[1600];
+    VmbUint32_t nplanted = 0;
+    for (VmbUint32_t y = 10; y + 10 < sheight && nplanted < 1600; y += 48)
+    {
+        for (VmbUint32_t x = 10; x + 10 < swidth && nplanted < 1600; x += 64)
+        {
+            planted[nplanted] = (AlliedDefect_t){.x = x, .y = y, .kind = nplanted % 2 ? AlliedDefectCold : AlliedDefectHot};
+            nplanted++;
+        }
+    }
+    AlliedImage_t scene = mono;
+    scene.data = bench_alloc((size_t)scene.stride * scene.height);
+    check_defects("known hot and cold pixels", &scene, planted, nplanted);
+    free(scene.data);
+    allied_defect_map_destroy(&map);
+    free(defects);
+
+    const VmbUint32_t kwidth = 256, kheight = 256, nstack = 8;
+    AlliedImage_t stackimgs[8];
+    for (VmbUint32_t i = 0; i < nstack; i++)
+    {
+        stackimgs[i] = (AlliedImage_t){.data = bench_alloc((size_t)kwidth * kheight * 2), .width = kwidth, .height = kheight, .format = VmbPixelFormatMono12};
+        for (size_t j = 0; j < (size_t)kwidth * kheight; j++)
+        {
+            // noise around a flat level, with a cosmic ray every few hundred pixels
+            ((VmbUint16_t *)stackimgs[i].data)[j] = rand() % 389 == 0 ? 4095 : 1000 + (rand() & 0x1f);
+        }
+    }
+    const VmbUint32_t stack_frames[] = {100, 1000, 10000};
+    printf("\nRobust stacking, Mono12 256x256 (%s)\n", allied_cpu_level_name(allied_cpu_level()));
+    for (int mode = AlliedStackSigmaClip; mode <= AlliedStackPercentile; mode++)
+    {
+        for (size_t i = 0; i < sizeof(stack_frames) / sizeof(stack_frames[0]); i++)
+        {
+            AlliedStackConfig_t config = {.mode = (AlliedStackMode_t)mode, .threads = threads};
+            bench_stack(mode == AlliedStackSigmaClip ? "sigma-clipped mean" : "median, 64 bins per pixel", stackimgs, nstack, &config, stack_frames[i]);
+        }
+    }
+    for (VmbUint32_t i = 0; i < nstack; i++)
+    {
+        free(stackimgs[i].data);
+    }
+
+    const struct
+    {
+        const char *name;
+        AlliedCoaddType_t type;
+        VmbUint32_t window;
+        VmbUint32_t pane;
+    } coadds[] = {
+        {"running sum, 32-bit integer", AlliedCoaddUint32, 0, 1},
+        {"running sum, float", AlliedCoaddFloat, 0, 1},
+        {"window of 16 frames, 32-bit integer", AlliedCoaddUint32, 16, 1},
+        {"window of 64 frames in 4 panes", AlliedCoaddUint32, 64, 16},
+    };
+    printf("\nCo-adding, Mono12 2592x1944 (%s)\n", allied_cpu_level_name(allied_cpu_level()));
+    bench_coadd("per-pixel float loop", &mono, NULL);
+    for (size_t i = 0; i < sizeof(coadds) / sizeof(coadds[0]); i++)
+    {
+        AlliedCoaddConfig_t config = {.type = coadds[i].type, .window = coadds[i].window, .pane = coadds[i].pane};
+        bench_coadd(coadds[i].name, &mono, &config);
+        if (threads > 1)
+        {
+            config.threads = threads;
+            bench_coadd(coadds[i].name, &mono, &config);
+        }
+    }
+    printf("\nTemporal mean and variance, Mono12 2592x1944 (%s)\n", allied_cpu_level_name(allied_cpu_level()));
+    bench_moments("per-pixel double sums", &mono, 1, true);
+    bench_moments("Welford moments", &mono, 1, false);
+    if (threads > 1)
+    {
+        bench_moments("Welford moments", &mono, threads, false);
+    }
+    // a typical lucky imaging region of interest, inside the full frame
+    AlliedImage_t roi = {.data = mono.data, .width = 640, .height = 480, .stride = mono.stride, .format = mono.format};
+    // registration is timed on a textured scene and on a spot, moved by a known sub-pixel shift
+    const double shift_x = 1.25, shift_y = -0.5;
+    AlliedImage_t scenes[4];
+    for (int i = 0; i < 4; i++)
+    {
+        scenes[i] = (AlliedImage_t){.data = bench_alloc((size_t)640 * 480 * 2), .width = 640, .height = 480, .stride = 640 * 2, .format = mono.format};
+        register_scene(&scenes[i], i % 2 ? shift_x : 0, i % 2 ? shift_y : 0, i >= 2, 160, 160);
+    }
+    printf("\nRegistration, Mono12 640x480, shift (%.2f, %.2f) (%s)\n", shift_x, shift_y, allied_cpu_level_name(allied_cpu_level()));
+    for (VmbUint32_t side = 64; side <= 256; side *= 2)
+    {
+        char name[64];
+        AlliedRegisterConfig_t config = {.method = AlliedRegisterPhase, .x = 32, .y = 32, .width = side, .height = side};
+        snprintf(name, sizeof(name), "phase correlation, %ux%u", side, side);
+        bench_register(name, &scenes[0], &scenes[1], shift_x, shift_y, &config);
+        if (threads > 1)
+        {
+            config.threads = threads;
+            bench_register(name, &scenes[0], &scenes[1], shift_x, shift_y, &config);
+        }
+    }
+    AlliedRegisterConfig_t spot = {.method = AlliedRegisterPhase, .x = 32, .y = 32, .width = 256, .height = 256};
+    bench_register("phase correlation, spot, 256x256", &scenes[2], &scenes[3], shift_x, shift_y, &spot);
+    AlliedRegisterConfig_t centroid = {.method = AlliedRegisterCentroid, .x = 32, .y = 32, .width = 256, .height = 256};
+    bench_register("centroid, spot, 256x256", &scenes[2], &scenes[3], shift_x, shift_y, &centroid);
+    for (int i = 0; i < 4; i++)
+    {
+        free(scenes[i].data);
+    }
+    const struct
+    {
+        const char *name;
+        AlliedShiftAddKernel_t kernel;
+        VmbUint32_t scale;
+        double pixfrac;
+    } shiftadds[] = {
+        {"shift-and-add, bilinear", AlliedShiftAddBilinear, 1, 1},
+        {"shift-and-add, bilinear, 2x", AlliedShiftAddBilinear, 2, 1},
+        {"shift-and-add, drizzle", AlliedShiftAddDrizzle, 1, 1},
+        {"shift-and-add, drizzle 0.6, 2x", AlliedShiftAddDrizzle, 2, 0.6},
+    };
+    for (size_t i = 0; i < sizeof(shiftadds) / sizeof(shiftadds[0]); i++)
+    {
+        AlliedShiftAddConfig_t config = {.kernel = shiftadds[i].kernel, .scale = shiftadds[i].scale, .pixfrac = shiftadds[i].pixfrac};
+        bench_shiftadd(shiftadds[i].name, &roi, &config);
+        if (threads > 1)
+        {
+            config.threads = threads;
+            bench_shiftadd(shiftadds[i].name, &roi, &config);
+        }
+    }
+    printf("\nSharpness metrics, Mono12 2592x1944 (%s)\n", allied_cpu_level_name(allied_cpu_level()));
+    bench_focus("per-pixel double Laplacian", &mono, NULL);
+    const struct
+    {
+        const char *name;
+        AlliedFocusMetric_t metric;
+    } metrics[] = {
+        {"Laplacian variance", AlliedFocusLaplacian},
+        {"Tenengrad", AlliedFocusTenengrad},
+        {"Brenner", AlliedFocusBrenner},
+    };
+    for (size_t i = 0; i < sizeof(metrics) / sizeof(metrics[0]); i++)
+    {
+        AlliedFocusConfig_t config = {.metric = metrics[i].metric};
+        bench_focus(metrics[i].name, &mono, &config);
+        if (threads > 1)
+        {
+            config.threads = threads;
+            bench_focus(metrics[i].name, &mono, &config);
+        }
+    }
+    AlliedFocusConfig_t focus_roi = {.metric = AlliedFocusLaplacian, .width = 640, .height = 480};
+    bench_focus("Laplacian variance, 640x480 region", &mono, &focus_roi);
+    printf("\nSpot finding, Mono12 2592x1944, 12 spots (%s)\n", allied_cpu_level_name(allied_cpu_level()));
+    AlliedImage_t field = {.data = bench_alloc((size_t)swidth * sheight * 2), .width = swidth, .height = sheight, .stride = swidth * 2, .format = VmbPixelFormatMono12};
+    for (VmbUint32_t y = 0; y < sheight; y++)
+    {
+        for (VmbUint32_t x = 0; x < swidth; x++)
+        {
+            double v = 100 + (rand() & 0xf);
+            for (int i = 0; i < 12; i++)
+            {
+                double dx = x - (150.3 + 190.7 * i), dy = y - (120.6 + 150.2 * i);
+                v += dx * dx + dy * dy < 100 ? 3000 * exp(-(dx * dx + dy * dy) / 4.5) : 0;
+            }
+            ((VmbUint16_t *)field.data)[(size_t)y * swidth + x] = v > 4095 ? 4095 : (VmbUint16_t)v;
+        }
+    }
+    bench_spots("per-pixel double centroid", &field, NULL);
+    AlliedSpotConfig_t components = {.method = AlliedSpotComponents};
+    bench_spots("connected components", &field, &components);
+    AlliedSpotConfig_t components_roi = {.method = AlliedSpotComponents, .x = 640, .y = 480, .width = 640, .height = 480};
+    bench_spots("connected components, 640x480 region", &field, &components_roi);
+    AlliedSpotConfig_t window = {.method = AlliedSpotWindow};
+    bench_spots("windowed center of mass, 16x16", &field, &window);
+    printf("\nBeam profile, Mono12, projections and moments (%s)\n", allied_cpu_level_name(allied_cpu_level()));
+    const VmbUint32_t beam_sizes[] = {64, 128, 256, 640};
+    for (size_t i = 0; i < sizeof(beam_sizes) / sizeof(beam_sizes[0]); i++)
+    {
+        char name[64];
+        AlliedImage_t beam = {.data = field.data, .width = beam_sizes[i], .height = beam_sizes[i] * 3 / 4, .stride = field.stride, .format = field.format};
+        snprintf(name, sizeof(name), "per-pixel double, %ux%u", beam.width, beam.height);
+        bench_beam(name, &beam, NULL);
+        AlliedBeamConfig_t config = {.background = AlliedBeamBackgroundBorder, .sigma = 4};
+        snprintf(name, sizeof(name), "beam profile, %ux%u", beam.width, beam.height);
+        bench_beam(name, &beam, &config);
+    }
+    bench_beam("per-pixel double, 2592x1944", &field, NULL);
+    AlliedBeamConfig_t beam_full = {.background = AlliedBeamBackgroundBorder, .sigma = 4};
+    bench_beam("beam profile, 2592x1944", &field, &beam_full);
+    check_beam("known beam, 640x480", 640, 480, &beam_full);
+    printf("\nAperture photometry, Mono12 2592x1944, 400 apertures r=4 with 6-10 annuli (%s)\n", allied_cpu_level_name(allied_cpu_level()));
+    AlliedAperture_t apertures[400];
+    for (VmbUint32_t i = 0; i < 400; i++)
+    {
+        apertures[i] = (AlliedAperture_t){.x = 60.3 + 123.1 * (i % 20), .y = 45.7 + 92.4 * (i / 20), .radius = 4, .sky_inner = 6, .sky_outer = 10};
+    }
+    bench_photometry("per-aperture loop, weights per frame", &field, apertures, 400, NULL);
+    AlliedPhotometryConfig_t phot_config = {.sky_clip = 3};
+    bench_photometry("precomputed tables", &field, apertures, 400, &phot_config);
+    phot_config.threads = threads;
+    bench_photometry("precomputed tables", &field, apertures, 400, &phot_config);
+    printf("\nChange detection, Mono12 2592x1944, 32x32 blocks (%s)\n", allied_cpu_level_name(allied_cpu_level()));
+    bench_change("per-pixel double average", &field, NULL);
+    const VmbUint32_t change_steps[] = {1, 2, 4, 8};
+    for (size_t i = 0; i < sizeof(change_steps) / sizeof(change_steps[0]); i++)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "fixed point model, step %u", change_steps[i]);
+        bench_change(name, &field, &(AlliedChangeConfig_t){.step = change_steps[i]});
+    }
+    free(field.data);
+    free(mono.data);
+    return 0;
+}
@@ -90,10 +90,23 @@ extern "C"
  */
 typedef void *AlliedCameraHandle_t;
 
+/**
+ * @brief Host topology of a camera connection.
+ *
+ */
+typedef struct
+{
+    char interface_id[64];                  // Transport layer interface ID string.
+    VmbTransportLayerType_t interface_type; // Transport layer interface type.
+    char pci_address[16];                   // PCI address of the NIC or USB host controller (`dddd:bb:dd.f`), empty if unknown.
+    int numa_node;                          // NUMA node of the PCI device, -1 if unknown.
+    char cpulist[256];                      // CPUs local to the NUMA node, in Linux cpulist format (e.g. `0-7,16-23`).
+} AlliedTopology_t;
+
 /**
  * @brief Callback function for camera image capture events.
  *
- * @details This function is called when an image is captured by the camera. The user must copy the image data from the frame buffer to a separate buffer if the image data is to be used after the callback returns. DO NOT modify the `frame->context` pointers as they are used internally by the library.
+ * @details This function is called when an image is captured by the camera. The user must copy the image data from the frame buffer to a separate buffer if the image data is to be used after the callback returns, or take a reference with {@link allied_frame_retain}. DO NOT modify the `frame->context` pointers as they are used internally by the library.
  *
  * @param handle Handle to the camera.
  * @param stream Handle to capture stream.
@@ -102,6 +115,107 @@ typedef void *AlliedCameraHandle_t;
  */
 typedef void (*AlliedCaptureCallback)(const AlliedCameraHandle_t, const VmbHandle_t, VmbFrame_t *_Nonnull, void *_Nullable);
 
+/**
+ * @brief Host-side frame decimation modes.
+ *
+ */
+typedef enum
+{
+    AlliedDecimationNone = 0,    // Deliver every frame.
+    AlliedDecimationEveryN,      // Deliver one frame out of every `every_n` frames.
+    AlliedDecimationInterval,    // Deliver at most one frame every `interval_ms` milliseconds.
+    AlliedDecimationLeakyBucket, // Deliver frames at a sustained `rate_hz`, allowing bursts of up to `burst` frames.
+} AlliedDecimationMode_t;
+
+/**
+ * @brief Host-side frame decimation configuration.
+ *
+ */
+typedef struct
+{
+    AlliedDecimationMode_t mode; // Decimation mode.
+    VmbUint32_t every_n;         // Deliver one in N frames, for `AlliedDecimationEveryN`.
+    double interval_ms;          // Minimum time between delivered frames in milliseconds, for `AlliedDecimationInterval`.
+    double rate_hz;              // Sustained delivery rate in Hz, for `AlliedDecimationLeakyBucket`.
+    VmbUint32_t burst;           // Maximum burst size in frames, for `AlliedDecimationLeakyBucket`.
+} AlliedDecimation_t;
+
+/**
+ * @brief Handle to a frame subscription, see {@link allied_subscribe}.
+ *
+ */
+typedef struct allied_subscriber_s *AlliedSubscriber_t;
+
+/**
+ * @brief Zero-copy view into a captured frame, optionally cropped to a region of interest.
+ *
+ */
+typedef struct
+{
+    VmbFrame_t *frame;       // Underlying frame. DO NOT requeue or modify the context pointers.
+    VmbUchar_t *data;        // First pixel of the view.
+    VmbUint32_t width;       // Width of the view in pixels.
+    VmbUint32_t height;      // Height of the view in pixels.
+    VmbUint32_t stride;      // Bytes between the starts of consecutive rows.
+    VmbUint32_t offset_x;    // Horizontal offset of the view inside the frame, in pixels.
+    VmbUint32_t offset_y;    // Vertical offset of the view inside the frame, in pixels.
+    VmbPixelFormat_t format; // Pixel format of the frame.
+    VmbUint32_t generation;  // Generation of the frame when the view was made. Together with `frame`, forms an {@link AlliedFrameRef_t}.
+} AlliedFrameView_t;
+
+/**
+ * @brief Generation-stamped reference to a frame, see {@link allied_frame_ref}.
+ *
+ * @details The generation of a frame is advanced every time its last reference is released and the frame is handed back to the driver.
+ * A reference whose generation no longer matches the frame is stale: the frame memory may be overwritten by the driver at any time.
+ *
+ */
+typedef struct
+{
+    VmbFrame_t *frame;      // Referenced frame.
+    VmbUint32_t generation; // Generation of the frame when the reference was made.
+} AlliedFrameRef_t;
+
+/**
+ * @brief Callback function for frame subscriptions.
+ *
+ * @details This function is called on the frame delivery thread. The frame is requeued after the callback returns, unless a reference is taken with {@link allied_frame_retain}.
+ *
+ * @param sub Handle to the subscription.
+ * @param view View of the frame.
+ * @param user_data User data passed to {@link allied_subscribe}.
+ */
+typedef void (*AlliedFrameCallback)(AlliedSubscriber_t, const AlliedFrameView_t *_Nonnull, void *_Nullable);
+
+/**
+ * @brief Behavior of a queued subscription when its queue is full.
+ *
+ */
+typedef enum
+{
+    AlliedBackpressureDropNewest = 0, // Skip the new frame for this subscriber.
+    AlliedBackpressureDropOldest,     // Release the oldest queued frame and queue the new frame.
+    AlliedBackpressureBlock,          // Block the frame delivery thread until the subscriber makes room. This stalls all subscribers of the camera.
+} AlliedBackpressure_t;
+
+/**
+ * @brief Frame subscription configuration.
+ *
+ */
+typedef struct
+{
+    AlliedFrameCallback callback;  // Callback executed on the delivery thread. If NULL, frames are queued and retrieved with {@link allied_subscriber_pop}.
+    void *user_data;               // User data passed to the callback.
+    VmbUint32_t queue_depth;       // Maximum number of frames held in the queue, for queued subscriptions.
+    AlliedBackpressure_t policy;   // Behavior when the queue is full, for queued subscriptions.
+    AlliedDecimation_t decimation; // Decimation applied to this subscriber only.
+    VmbUint32_t roi_x;             // Horizontal offset of the crop view, in pixels. Must start on a byte boundary for packed pixel formats.
+    VmbUint32_t roi_y;             // Vertical offset of the crop view, in pixels.
+    VmbUint32_t roi_width;         // Width of the crop view in pixels. 0 to use the full frame.
+    VmbUint32_t roi_height;        // Height of the crop view in pixels. 0 to use the full frame.
+    bool changes_only;             // Receive only the frames forwarded by the change detection stage, see {@link allied_set_change_detection}.
+} AlliedSubscription_t;
+
 /**
  * @brief Start the Allied Vision Camera API. This function MUST be called before any other function in this library.
  * This function registers an {@link atexit} handler to stop the API when the program exits.
@@ -164,12 +278,130 @@ uint32_t allied_get_num_frames(AlliedCameraHandle_t handle);
  * @brief Queue a capture event for the camera. This function must be called after the camera is opened and before starting image acquisition.
  * 
  * @param handle Handle to Allied Vision camera.
- * @param callback A callback function to be called when an image is captured.
+ * @param callback A callback function to be called when an image is captured. Can be NULL if frames are consumed through {@link allied_subscribe}.
  * @param user_data Pointer to custom user data to be passed to the callback.
  * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
  */
 VmbError_t allied_queue_capture(AlliedCameraHandle_t handle, AlliedCaptureCallback callback, void *user_data);
 
+/**
+ * @brief Set host-side frame decimation for the capture callback and the subscribers. Decimation is evaluated after the processing stages
+ * (defect correction, statistics, metering, tracking, calibration and the like), which see every frame, and before the callback is executed;
+ * skipped frames are requeued immediately.
+ * This function can be called while the camera is capturing.
+ *
+ * @param handle Handle to Allied Vision camera.
+ * @param config Decimation configuration. Pass NULL to deliver every frame.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_set_decimation(AlliedCameraHandle_t handle, const AlliedDecimation_t *_Nullable config);
+
+/**
+ * @brief Get the host-side frame decimation configuration.
+ *
+ * @param handle Handle to Allied Vision camera.
+ * @param config Pointer to store the decimation configuration.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_get_decimation(AlliedCameraHandle_t handle, AlliedDecimation_t *_Nonnull config);
+
+/**
+ * @brief Get the number of frames delivered to and skipped before the capture callback since the camera was opened.
+ *
+ * @param handle Handle to Allied Vision camera.
+ * @param delivered Pointer to store the number of delivered frames. Can be NULL.
+ * @param skipped Pointer to store the number of frames skipped by decimation. Can be NULL.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_get_frame_counts(AlliedCameraHandle_t handle, VmbUint64_t *_Nullable delivered, VmbUint64_t *_Nullable skipped);
+
+/**
+ * @brief Subscribe to the frames of a camera. Any number of subscribers can read the same frames; frames are reference counted and requeued when the last subscriber releases them, without copying pixels.
+ * Subscribers receive frames after the capture callback set by {@link allied_queue_capture}, which must still be called to queue the frames. Subscriptions can be added and removed while the camera is capturing, and are closed when the camera is closed.
+ *
+ * @param handle Handle to Allied Vision camera.
+ * @param config Subscription configuration.
+ * @param sub Pointer to store the subscription handle.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the crop view of a packed pixel format does not start on a byte boundary, otherwise an error code.
+ */
+VmbError_t allied_subscribe(AlliedCameraHandle_t handle, const AlliedSubscription_t *_Nonnull config, AlliedSubscriber_t *_Nonnull sub);
+
+/**
+ * @brief Remove a subscription. Frames still queued for the subscriber are released. Frames retained by the subscriber must be released before this call.
+ * This function can be called from a subscription callback, also for its own subscription: the subscriber then receives no more frames, and
+ * is freed once the frame delivery thread is done with the current frame.
+ *
+ * @param sub Pointer to the subscription handle. The handle is set to NULL.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_unsubscribe(AlliedSubscriber_t *_Nonnull sub);
+
+/**
+ * @brief Change the decimation of a subscriber. This function can be called while the camera is capturing.
+ *
+ * @param sub Handle to the subscription.
+ * @param config Decimation configuration. Pass NULL to deliver every frame.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_subscriber_set_decimation(AlliedSubscriber_t sub, const AlliedDecimation_t *_Nullable config);
+
+/**
+ * @brief Retrieve the next frame of a queued subscription. The frame must be released with {@link allied_frame_release} when done.
+ *
+ * @param sub Handle to the subscription.
+ * @param view Pointer to store the frame view.
+ * @param timeout_ms Time to wait for a frame in milliseconds. 0 returns immediately, negative values wait forever.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorTimeout` if no frame is available, otherwise an error code.
+ */
+VmbError_t allied_subscriber_pop(AlliedSubscriber_t sub, AlliedFrameView_t *_Nonnull view, int timeout_ms);
+
+/**
+ * @brief Get the frame counters of a subscription.
+ *
+ * @param sub Handle to the subscription.
+ * @param delivered Pointer to store the number of frames delivered to the subscriber. Can be NULL.
+ * @param skipped Pointer to store the number of frames skipped by the subscriber's decimation. Can be NULL.
+ * @param dropped Pointer to store the number of frames dropped because the subscriber's queue was full. Can be NULL.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_subscriber_counts(AlliedSubscriber_t sub, VmbUint64_t *_Nullable delivered, VmbUint64_t *_Nullable skipped, VmbUint64_t *_Nullable dropped);
+
+/**
+ * @brief Take a reference to a frame, so that it is not requeued when the callback returns. Valid only inside a capture or subscription callback, or while holding a reference.
+ *
+ * @param frame Frame to retain.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_frame_retain(VmbFrame_t *_Nonnull frame);
+
+/**
+ * @brief Release a reference to a frame. The frame is requeued for capture when the last reference is released.
+ *
+ * @param frame Frame to release.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_frame_release(VmbFrame_t *_Nonnull frame);
+
+/**
+ * @brief Stamp a reference to a frame with its current generation. Valid only inside a capture or subscription callback, or while holding a reference.
+ * The stamp does not keep the frame alive, use {@link allied_frame_retain} for that.
+ *
+ * @param frame Frame to reference.
+ * @param ref Pointer to store the reference.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorInvalidCall` if the frame is not currently held.
+ */
+VmbError_t allied_frame_ref(VmbFrame_t *_Nonnull frame, AlliedFrameRef_t *_Nonnull ref);
+
+/**
+ * @brief Check whether a frame reference is still valid, i.e. the frame has not been released to the driver since the reference was made.
+ * References are invalidated by {@link allied_dequeue_capture}, and must not be checked after the frame buffer is reallocated (e.g. after a change in image size or pixel format).
+ *
+ * @param ref Frame reference.
+ * @return true The frame contents are the ones the reference was made for.
+ * @return false The frame was released, and may be overwritten.
+ */
+bool allied_frame_ref_valid(const AlliedFrameRef_t *_Nonnull ref);
+
 /**
  * @brief Start image acquisition.
  *
@@ -229,6 +461,67 @@ bool allied_camera_streaming(AlliedCameraHandle_t handle);
  */
 bool allied_camera_acquiring(AlliedCameraHandle_t handle);
 
+/**
+ * @brief Get the host topology of the camera connection. The topology is discovered when the camera is opened.
+ *
+ * @param handle Handle to Allied Vision camera.
+ * @param topo Pointer to store the topology.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_get_camera_topology(AlliedCameraHandle_t handle, AlliedTopology_t *_Nonnull topo);
+
+/**
+ * @brief Get the NUMA node the frame buffer and the frame delivery thread are placed on.
+ *
+ * @param handle Handle to Allied Vision camera.
+ * @param node Pointer to store the NUMA node, -1 if placement is disabled.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_get_numa_node(AlliedCameraHandle_t handle, int *_Nonnull node);
+
+/**
+ * @brief Set the NUMA node the frame buffer and the frame delivery thread are placed on. By default, the node local to the camera's NIC or USB host controller is used.
+ * The frame buffer is reallocated on the new node. The camera must not be capturing when this function is called. The controller threads
+ * of the stages are pinned to the node when they start, and the worker threads of the multithreaded stages run on the node of the thread
+ * that submits their work.
+ *
+ * @param handle Handle to Allied Vision camera.
+ * @param node NUMA node. Pass -1 to disable placement; the delivery thread then gets back the CPUs it ran on before it was pinned.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_set_numa_node(AlliedCameraHandle_t handle, int node);
+
+/**
+ * @brief Pin the calling thread to the CPUs local to the camera. Use this for threads that process frames from this camera.
+ *
+ * @param handle Handle to Allied Vision camera.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_pin_thread(AlliedCameraHandle_t handle);
+
+/**
+ * @brief Enable the frame guard, a debugging aid for use-after-release bugs.
+ *
+ * @details With the guard on, every frame is placed on its own pages. When the last reference to a frame is released, the frame is
+ * protected with `mprotect(PROT_NONE)` and held back from the driver until `depth` newer frames have been released, so that any access
+ * through a stale pointer faults immediately instead of reading data that is being overwritten. At most half of the frame buffer is
+ * held back. The frame buffer is reallocated, and the camera must not be capturing when this function is called.
+ *
+ * @param handle Handle to Allied Vision camera.
+ * @param depth Number of released frames to hold back. 0 disables the guard.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_set_frame_guard(AlliedCameraHandle_t handle, VmbUint32_t depth);
+
+/**
+ * @brief Get the depth of the frame guard, see {@link allied_set_frame_guard}.
+ *
+ * @param handle Handle to Allied Vision camera.
+ * @param depth Pointer to store the depth, 0 if the guard is off.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_get_frame_guard(AlliedCameraHandle_t handle, VmbUint32_t *_Nonnull depth);
+
 /**
  * @brief Select the camera temperature source, measured using {@link allied_get_temperature}.
  *
@@ -0,0 +1,134 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_beam.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Laser beam profiling for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details A beam profile is computed over a region of an image in a single pass: the background-subtracted pixel values are summed into
+ * the row and column projections and into the zeroth, first and second image moments, from which follow the centroid, the second-moment
+ * (D4σ, ISO 11146) widths along the image axes and along the principal axes, the ellipticity and the orientation of the beam.
+ *
+ * The background is a constant level, or the mean of the outermost pixels of the region, measured on every image. Pixels at or below the
+ * background plus a threshold weigh nothing, so that the noise of the wings does not inflate the widths. The background is subtracted in
+ * fixed point with 8 fractional bits. The pass accumulates the projections and the first moment of every row, exactly, vectorized for every
+ * CPU level (see {@link alliedcam_cpu.h}); the other moments follow from the projections.
+ *
+ * The profile stage profiles every delivered frame on the frame delivery thread, before the capture callback and the subscribers run, and
+ * stores the profile with the frame (see {@link allied_frame_beam}). The stage does not use the worker pool, and allocates only when the
+ * region grows, so its time per frame depends only on the size of the region, for steady feedback to beam steering loops.
+ *
+ */
+
+#ifndef ALLIEDCAM_BEAM_H_
+#define ALLIEDCAM_BEAM_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "alliedcam_image.h"
+
+/**
+ * @brief Background estimate.
+ *
+ */
+typedef enum
+{
+    AlliedBeamBackgroundNone = 0, // No background subtraction.
+    AlliedBeamBackgroundLevel,    // Constant level, `level`.
+    AlliedBeamBackgroundBorder,   // Mean of the `border` outermost rows and columns of the region, measured on every image.
+} AlliedBeamBackground_t;
+
+/**
+ * @brief Beam profile configuration.
+ *
+ */
+typedef struct
+{
+    VmbUint32_t x;                     // Horizontal offset of the region.
+    VmbUint32_t y;                     // Vertical offset of the region.
+    VmbUint32_t width;                 // Width of the region. 0 for the rest of the image.
+    VmbUint32_t height;                // Height of the region. 0 for the rest of the image.
+    AlliedBeamBackground_t background; // Background estimate.
+    double level;                      // Background level of `AlliedBeamBackgroundLevel`, in ADU.
+    VmbUint32_t border;                // Width of the border of `AlliedBeamBackgroundBorder`, in pixels. 0 for 4.
+    double threshold;                  // Pixels at or below the background plus this value weigh nothing, in ADU.
+    double sigma;                      // With `AlliedBeamBackgroundBorder`, standard deviations of the border pixels added to the threshold.
+} AlliedBeamConfig_t;
+
+/**
+ * @brief Beam profile. Positions are in pixels of the image, with pixel centers at integer coordinates.
+ *
+ */
+typedef struct
+{
+    VmbUint64_t frame_id;  // Frame ID of the frame, for profiles of the profile stage.
+    VmbUint32_t x;         // Horizontal offset of the region profiled.
+    VmbUint32_t y;         // Vertical offset of the region profiled.
+    VmbUint32_t width;     // Width of the region profiled, and length of `columns`.
+    VmbUint32_t height;    // Height of the region profiled, and length of `rows`.
+    double background;     // Background subtracted, in ADU.
+    double threshold;      // Pixels at or below this value weigh nothing, in ADU.
+    VmbUint32_t peak;      // Highest pixel value of the region, in ADU.
+    double total;          // Sum of the background-subtracted pixel values, in ADU.
+    double centroid_x;     // Horizontal position of the centroid. NaN if the region holds no signal.
+    double centroid_y;     // Vertical position of the centroid. NaN if the region holds no signal.
+    double var_x;          // Second central moment along the rows, in pixels².
+    double var_y;          // Second central moment along the columns, in pixels².
+    double cov_xy;         // Mixed second central moment, in pixels².
+    double d4s_x;          // D4σ width along the rows, in pixels.
+    double d4s_y;          // D4σ width along the columns, in pixels.
+    double d4s_major;      // D4σ width along the major principal axis, in pixels.
+    double d4s_minor;      // D4σ width along the minor principal axis, in pixels.
+    double ellipticity;    // Ratio of the minor to the major width, 1 for a round beam.
+    double orientation;    // Angle of the major axis from the rows, towards increasing rows, in radians, in (-π/2, π/2].
+    const double *columns; // Column projection: sum of the background-subtracted values of every column of the region.
+    const double *rows;    // Row projection: sum of the background-subtracted values of every row of the region.
+    double elapsed_us;     // Time taken to compute the profile, in microseconds.
+} AlliedBeamProfile_t;
+
+/**
+ * @brief Profile a beam.
+ *
+ * @param image Image, of a pixel format supported by the image kernels (see {@link allied_image_supported}).
+ * @param config Configuration. NULL for the whole image without background subtraction.
+ * @param profile Pointer to store the profile.
+ * @param columns Destination of the column projection, of the width of the region.
+ * @param rows Destination of the row projection, of the height of the region.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the configuration is out of range or the region is out of the image, `VmbErrorNotSupported` if the pixel format is not supported, otherwise an error code.
+ */
+VmbError_t allied_beam_profile(const AlliedImage_t *_Nonnull image, const AlliedBeamConfig_t *_Nullable config, AlliedBeamProfile_t *_Nonnull profile,
+                               double *_Nonnull columns, double *_Nonnull rows);
+
+/**
+ * @brief Enable the beam profile stage of a camera. This function can be called while the camera is capturing; the configuration applies
+ * from the next delivered frame. The region is clamped to every frame. The profiles of the frames are allocated when the stage is enabled,
+ * and with the frames from then on, for the projections of the whole sensor, so that frame delivery does not allocate them.
+ *
+ * @param handle Handle to Allied Vision camera.
+ * @param config Beam profile configuration. Pass NULL to disable the stage.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the configuration is out of range, `VmbErrorResources` if the profiles could not be allocated, otherwise an error code.
+ */
+VmbError_t allied_set_beam_profile(AlliedCameraHandle_t handle, const AlliedBeamConfig_t *_Nullable config);
+
+/**
+ * @brief Get the beam profile of a frame. Valid only inside a capture or subscription callback, or while holding a reference.
+ * The profile and its projections live with the frame, and are overwritten when the frame is captured again.
+ *
+ * @param frame Frame.
+ * @param profile Pointer to store the address of the profile.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorNotAvailable` if the frame was not profiled (or it was incomplete), `VmbErrorInvalidCall` if the frame is not currently held.
+ */
+VmbError_t allied_frame_beam(const VmbFrame_t *_Nonnull frame, const AlliedBeamProfile_t *_Nullable *_Nonnull profile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALLIEDCAM_BEAM_H_ */
@@ -0,0 +1,89 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_bin.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Software binning and decimation for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details Monochrome images at 8, 10, 12, 14 or 16 bits are binned by any horizontal and vertical factor, or decimated by keeping every n-th
+ * pixel and row, without changing the camera configuration. Bins are summed in 32 bits, and stored either at the bit depth of the source
+ * (saturated), as 16-bit pixels (saturated at 65535), or as 32-bit sums. The kernels are vectorized for every CPU level (see {@link alliedcam_cpu.h}),
+ * with the common bin widths unrolled, and the output rows are split across the worker pool.
+ *
+ */
+
+#ifndef ALLIEDCAM_BIN_H_
+#define ALLIEDCAM_BIN_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "alliedcam_image.h"
+
+/**
+ * @brief Pixel container of the binned image.
+ *
+ */
+typedef enum
+{
+    AlliedBinSameDepth = 0, // Same format as the source. Sums are saturated to the maximum value of the bit depth.
+    AlliedBinWiden16,       // `Mono16`. Sums are saturated to 65535, so that a 2x2 sum of 12-bit pixels (or a 4x4 sum of 8-bit pixels) is kept whole.
+} AlliedBinDepth_t;
+
+/**
+ * @brief Binning options.
+ *
+ */
+typedef struct
+{
+    VmbUint32_t bin_x;      // Horizontal bin size.
+    VmbUint32_t bin_y;      // Vertical bin size.
+    AlliedBinMode_t mode;   // Combination of the pixels of a bin.
+    AlliedBinDepth_t depth; // Pixel container of the binned image.
+    VmbUint32_t threads;    // Maximum number of threads to use. 0 or 1 bins on the calling thread.
+} AlliedBinOptions_t;
+
+/**
+ * @brief Bin a monochrome image. Trailing pixels that do not fill a bin are dropped.
+ *
+ * @param src Source image, monochrome.
+ * @param opts Binning options.
+ * @param dst Destination image of `width / bin_x` by `height / bin_y` pixels. `data` and `stride` must be set, the size and format are set by this function.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorNotSupported` if the source is not monochrome, otherwise an error code.
+ */
+VmbError_t allied_bin(const AlliedImage_t *_Nonnull src, const AlliedBinOptions_t *_Nonnull opts, AlliedImage_t *_Nonnull dst);
+
+/**
+ * @brief Bin a monochrome image into 32-bit sums, without saturation. `opts->mode` and `opts->depth` are ignored.
+ *
+ * @param src Source image, monochrome.
+ * @param opts Binning options.
+ * @param dst Destination, at least `height / bin_y` rows of `width / bin_x` sums.
+ * @param dst_stride Values between the starts of consecutive rows of the destination. 0 if the rows are packed.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorNotSupported` if the source is not monochrome, otherwise an error code.
+ */
+VmbError_t allied_bin_sum32(const AlliedImage_t *_Nonnull src, const AlliedBinOptions_t *_Nonnull opts, VmbUint32_t *_Nonnull dst, size_t dst_stride);
+
+/**
+ * @brief Decimate a monochrome image: keep the first pixel of every `step_x` pixels of every `step_y`-th row.
+ *
+ * @param src Source image, monochrome.
+ * @param step_x Horizontal step.
+ * @param step_y Vertical step.
+ * @param threads Maximum number of threads to use. 0 or 1 decimates on the calling thread.
+ * @param dst Destination image of `ceil(width / step_x)` by `ceil(height / step_y)` pixels. `data` and `stride` must be set, the size and format are set by this function.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorNotSupported` if the source is not monochrome, otherwise an error code.
+ */
+VmbError_t allied_decimate(const AlliedImage_t *_Nonnull src, VmbUint32_t step_x, VmbUint32_t step_y, VmbUint32_t threads, AlliedImage_t *_Nonnull dst);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALLIEDCAM_BIN_H_ */
@@ -0,0 +1,295 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_calib.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Dark, bias and flat-field calibration for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details Master bias, dark and flat frames are built as streaming averages of captured frames, for one region of interest, binning
+ * factor and pixel format (the calibration geometry). A calibration combines the masters into an offset map and a gain map, and corrects
+ * frames as `(raw - offset) * gain + pedestal` in one pass, where the offset is the bias plus the dark current scaled to the exposure
+ * time of the frames, and the gain is the inverse of the normalized flat. The maps are kept either in 16-bit fixed point, which halves
+ * the memory read per pixel, or in float; the arithmetic is done in float in both cases, vectorized for every CPU level
+ * (see {@link alliedcam_cpu.h}), with the rows split across the worker pool. Calibrated frames are stored as 16-bit or float pixels.
+ *
+ * A calibration can be installed as a stage of the frame delivery thread with {@link allied_set_calibration}, so that every frame
+ * is calibrated once before the capture callback, and the result is read with {@link allied_frame_calibrated}.
+ *
+ */
+
+#ifndef ALLIEDCAM_CALIB_H_
+#define ALLIEDCAM_CALIB_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "alliedcam_image.h"
+
+#ifndef ALLIED_CALIB_FLAT_MIN
+/**
+ * @brief Lowest normalized flat response that is corrected. Pixels below this are treated as dead, and are not scaled.
+ *
+ */
+#define ALLIED_CALIB_FLAT_MIN 0.05
+#endif
+
+/**
+ * @brief Kind of a master calibration frame.
+ *
+ */
+typedef enum
+{
+    AlliedMasterBias = 0, // Mean of zero (or shortest) exposure dark frames: the read-out offset.
+    AlliedMasterDark,     // Mean of dark frames at an exposure time: the offset plus the dark current.
+    AlliedMasterFlat,     // Mean of evenly illuminated frames, offset subtracted and normalized to a mean of 1 (per color for Bayer formats).
+} AlliedMasterKind_t;
+
+/**
+ * @brief Region of interest, binning and pixel format that calibration frames are valid for.
+ *
+ */
+typedef struct
+{
+    VmbUint32_t offset_x;    // Horizontal offset of the region of interest, in pixels.
+    VmbUint32_t offset_y;    // Vertical offset of the region of interest, in pixels.
+    VmbUint32_t width;       // Width in pixels.
+    VmbUint32_t height;      // Height in pixels.
+    VmbUint32_t binning;     // Binning factor.
+    VmbPixelFormat_t format; // Pixel format.
+} AlliedCalibGeometry_t;
+
+/**
+ * @brief Master calibration frame. Masters made by this library are freed with {@link allied_master_free}.
+ *
+ */
+typedef struct
+{
+    AlliedMasterKind_t kind;        // Kind of the master.
+    AlliedCalibGeometry_t geometry; // Geometry of the frames the master was built from.
+    double exposure_us;             // Exposure time of the frames, in us.
+    double gain_db;                 // Gain of the frames, in dB.
+    double temperature;             // Sensor temperature while the frames were captured, in degrees C.
+    VmbUint32_t frames;             // Number of frames averaged.
+    float *data;                    // `width * height` values, row major. Mean pixel value for bias and dark masters, relative response for flats.
+} AlliedMaster_t;
+
+/**
+ * @brief Handle to a master frame being built, see {@link allied_master_builder_create}.
+ *
+ */
+typedef struct allied_master_builder_s *AlliedMasterBuilder_t;
+
+/**
+ * @brief Handle to a calibration, see {@link allied_calib_create}.
+ *
+ */
+typedef struct allied_calib_s *AlliedCalibration_t;
+
+/**
+ * @brief Pixel type of calibrated images.
+ *
+ */
+typedef enum
+{
+    AlliedCalibOutput16 = 0, // 16-bit pixels scaled to the full 16-bit range, i.e. by 2^(16 - bits), rounded and saturated to [0, 65535]. Mono sources give `Mono16`, Bayer sources the 16-bit format of the same pattern.
+    AlliedCalibOutputFloat,  // 32-bit float pixels. The image format is that of the source.
+} AlliedCalibOutput_t;
+
+/**
+ * @brief Storage of the offset and gain maps of a calibration.
+ *
+ */
+typedef enum
+{
+    AlliedCalibMapsAuto = 0, // Fixed point for sources of up to 12 bits and flats that need gains of up to 4, float otherwise.
+    AlliedCalibMapsFixed,    // Offsets in 1/2^(16 - bits) ADU, and gains in 1/16384 up to 4, in 16 bits. Flats that need larger gains are rejected.
+    AlliedCalibMapsFloat,    // Offsets and gains in float.
+} AlliedCalibMaps_t;
+
+/**
+ * @brief Calibration configuration.
+ *
+ */
+typedef struct
+{
+    const AlliedMaster_t *bias; // Master bias. Can be NULL.
+    const AlliedMaster_t *dark; // Master dark. Can be NULL.
+    const AlliedMaster_t *flat; // Master flat. Can be NULL.
+    double exposure_us;         // Exposure time of the frames to calibrate. 0 to subtract the dark as is; otherwise the dark current (dark minus bias) is scaled to this exposure time, which needs a bias.
+    float pedestal;             // Added to every calibrated pixel, in ADU of the source, so that noise below the offset is not clipped in 16-bit outputs.
+    AlliedCalibOutput_t output; // Pixel type of calibrated images.
+    AlliedCalibMaps_t maps;     // Storage of the offset and gain maps.
+    VmbUint32_t threads;        // Maximum number of threads to use. 0 or 1 calibrates on the calling thread.
+} AlliedCalibConfig_t;
+
+/**
+ * @brief Get the calibration geometry of the current camera configuration, from the image size, image offset, binning factor and pixel format.
+ *
+ * @param handle Handle to Allied Vision camera.
+ * @param geometry Pointer to store the geometry.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_calib_geometry(AlliedCameraHandle_t handle, AlliedCalibGeometry_t *_Nonnull geometry);
+
+/**
+ * @brief Start building a master frame.
+ *
+ * @param builder Pointer to store the builder handle.
+ * @param kind Kind of the master.
+ * @param geometry Geometry of the frames that will be added. The pixel format must be supported by the image kernels (see {@link allied_image_supported}).
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorNotSupported` if the pixel format is not supported, otherwise an error code.
+ */
+VmbError_t allied_master_builder_create(AlliedMasterBuilder_t *_Nonnull builder, AlliedMasterKind_t kind, const AlliedCalibGeometry_t *_Nonnull geometry);
+
+/**
+ * @brief Destroy a master frame builder.
+ *
+ * @param builder Builder handle, set to NULL on return.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_master_builder_destroy(AlliedMasterBuilder_t *_Nonnull builder);
+
+/**
+ * @brief Add an image to the average of a master frame.
+ *
+ * @param builder Builder handle.
+ * @param image Image of the size and pixel format of the builder geometry.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the image does not match the geometry, otherwise an error code.
+ */
+VmbError_t allied_master_builder_add(AlliedMasterBuilder_t _Nonnull builder, const AlliedImage_t *_Nonnull image);
+
+/**
+ * @brief Add a captured frame to the average of a master frame. The offset of the frame is checked as well.
+ *
+ * @param builder Builder handle.
+ * @param frame Frame of the builder geometry.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the frame does not match the geometry, otherwise an error code.
+ */
+VmbError_t allied_master_builder_add_frame(AlliedMasterBuilder_t _Nonnull builder, const VmbFrame_t *_Nonnull frame);
+
+/**
+ * @brief Get the master frame from the frames added so far. More frames can be added afterwards, and the master taken again.
+ *
+ * @param builder Builder handle.
+ * @param offset Master bias or dark subtracted from flats before they are normalized. Ignored for bias and dark masters. Can be NULL.
+ * @param master Master frame. The kind, geometry, frame count and data are set; the exposure time, gain and temperature are left to the caller. Free with {@link allied_master_free}.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorInvalidCall` if no frame was added, `VmbErrorBadParameter` if the offset does not match the geometry, otherwise an error code.
+ */
+VmbError_t allied_master_builder_finish(AlliedMasterBuilder_t _Nonnull builder, const AlliedMaster_t *_Nullable offset, AlliedMaster_t *_Nonnull master);
+
+/**
+ * @brief Build a master frame from the next frames of a camera, for its current geometry, exposure time, gain and temperature.
+ * The camera must be capturing; the frames are taken through a queued subscription (see {@link allied_subscribe}), so the capture callback and other subscribers are not affected.
+ *
+ * @param handle Handle to Allied Vision camera.
+ * @param kind Kind of the master.
+ * @param frames Number of frames to average.
+ * @param offset Master bias or dark subtracted from flats, see {@link allied_master_builder_finish}. Can be NULL.
+ * @param timeout_ms Time to wait for each frame in milliseconds. Negative values wait forever.
+ * @param master Master frame. Free with {@link allied_master_free}.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorTimeout` if a frame did not arrive in time, otherwise an error code.
+ */
+VmbError_t allied_master_capture(AlliedCameraHandle_t handle, AlliedMasterKind_t kind, VmbUint32_t frames, const AlliedMaster_t *_Nullable offset, int timeout_ms, AlliedMaster_t *_Nonnull master);
+
+/**
+ * @brief Free the data of a master frame.
+ *
+ * @param master Master frame, cleared on return.
+ */
+void allied_master_free(AlliedMaster_t *_Nonnull master);
+
+/**
+ * @brief Save a master frame to a file. The file is in the byte order of the host.
+ *
+ * @param master Master frame.
+ * @param path File path.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorIO` if the file could not be written, otherwise an error code.
+ */
+VmbError_t allied_master_save(const AlliedMaster_t *_Nonnull master, const char *_Nonnull path);
+
+/**
+ * @brief Load a master frame saved with {@link allied_master_save}.
+ *
+ * @param path File path.
+ * @param master Master frame. Free with {@link allied_master_free}.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorIO` if the file could not be read, `VmbErrorInvalidValue` if it is not a master frame or its size does not match its header, otherwise an error code.
+ */
+VmbError_t allied_master_load(const char *_Nonnull path, AlliedMaster_t *_Nonnull master);
+
+/**
+ * @brief Create a calibration from master frames. The masters are copied into the maps of the calibration, and can be freed afterwards.
+ *
+ * @param calib Pointer to store the calibration handle.
+ * @param config Calibration configuration. At least one master must be set, and all masters must have the same geometry.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the masters do not match, the configuration is out of range, or the flat needs gains beyond fixed point maps of `AlliedCalibMapsFixed`, otherwise an error code.
+ */
+VmbError_t allied_calib_create(AlliedCalibration_t *_Nonnull calib, const AlliedCalibConfig_t *_Nonnull config);
+
+/**
+ * @brief Destroy a calibration. The calibration must not be installed on a camera.
+ *
+ * @param calib Calibration handle, set to NULL on return.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_calib_destroy(AlliedCalibration_t *_Nonnull calib);
+
+/**
+ * @brief Get the geometry a calibration applies to.
+ *
+ * @param calib Calibration handle.
+ * @param geometry Pointer to store the geometry.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_calib_get_geometry(AlliedCalibration_t _Nonnull calib, AlliedCalibGeometry_t *_Nonnull geometry);
+
+/**
+ * @brief Calibrate an image. Calibrations can be applied from several threads at once.
+ *
+ * @param calib Calibration handle.
+ * @param src Source image, of the size and pixel format of the calibration geometry.
+ * @param dst Destination image of the same size. `data` and `stride` must be set, the size and format are set by this function.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the image does not match the calibration, otherwise an error code.
+ */
+VmbError_t allied_calib_apply(AlliedCalibration_t _Nonnull calib, const AlliedImage_t *_Nonnull src, AlliedImage_t *_Nonnull dst);
+
+/**
+ * @brief Get the size in bytes of a calibrated image.
+ *
+ * @param calib Calibration handle.
+ * @return size_t Bytes of a packed calibrated image.
+ */
+size_t allied_calib_output_size(AlliedCalibration_t _Nonnull calib);
+
+/**
+ * @brief Install a calibration as a stage of the frame delivery thread. Frames whose size, offset, pixel format and binning factor (see
+ * {@link allied_set_binning_factor}) match the calibration geometry are calibrated once, before the capture callback. The buffers of the
+ * calibrated frames are allocated here, not on the frame delivery thread.
+ * This function can be called while the camera is capturing; once it returns, the previous calibration is no longer used and can be destroyed.
+ *
+ * @param handle Handle to Allied Vision camera.
+ * @param calib Calibration to install, which must outlive its installation. Pass NULL to remove the stage.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the binning factor of the camera does not match the calibration, otherwise an error code.
+ */
+VmbError_t allied_set_calibration(AlliedCameraHandle_t handle, AlliedCalibration_t _Nullable calib);
+
+/**
+ * @brief Get the calibrated image of a frame. Valid only inside a capture or subscription callback, or while holding a reference to the frame.
+ * The image is owned by the frame, and is overwritten when the frame is captured again.
+ *
+ * @param frame Frame.
+ * @param image Pointer to store the calibrated image.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorNotAvailable` if the frame was not calibrated, otherwise an error code.
+ */
+VmbError_t allied_frame_calibrated(const VmbFrame_t *_Nonnull frame, const AlliedImage_t *_Nullable *_Nonnull image);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALLIEDCAM_CALIB_H_ */
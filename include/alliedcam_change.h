@@ -0,0 +1,171 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_change.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Change detection and motion-triggered delivery for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details A change detector keeps a background model of the scene, the exponential moving average of the images, on a grid that samples
+ * every `step`-th pixel of every `step`-th row. Every image is compared to the model sample by sample, then the model takes a step of
+ * 2^-`adapt` towards the image. A sample changed when it differs from the model by more than `threshold`, and a block of `block` x `block`
+ * pixels changed when more than `fraction` of the samples of a whole block changed, so that isolated noisy pixels, and partial blocks on the
+ * edges of the image, do not trip the detector. An image changed when at least `min_blocks` blocks changed. The model is kept in fixed
+ * point with 8 fractional bits; the comparison and the update are a single pass over the samples, vectorized for every CPU level (see
+ * {@link alliedcam_cpu.h}). The model is rebuilt from the first image after a change of size or pixel format, and that image never changed.
+ *
+ * The change detection stage runs the detector on every delivered frame, on the frame delivery thread before the capture callback and the
+ * subscribers run, and stores the result with the frame (see {@link allied_frame_change}). Subscribers created with `changes_only` (see
+ * {@link AlliedSubscription_t}) then receive only the changed frames, together with up to `pre` frames preceding and `post` frames
+ * following every run of changed frames: a recorder subscribed this way writes the events with their context, and nothing in between.
+ * The preceding frames are held back from the driver until the next change shows whether they are needed, so that `pre` is at most half
+ * of the frame buffer. Frames that were not received in full are not compared, leave the model untouched, and go only to the subscribers
+ * of every frame.
+ *
+ */
+
+#ifndef ALLIEDCAM_CHANGE_H_
+#define ALLIEDCAM_CHANGE_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "alliedcam_image.h"
+
+/**
+ * @brief Handle to a change detector, see {@link allied_change_create}.
+ *
+ */
+typedef struct allied_change_s *AlliedChangeDetector_t;
+
+/**
+ * @brief Change detector configuration.
+ *
+ */
+typedef struct
+{
+    VmbUint32_t step;       // Distance between samples, in pixels, along the rows and the columns: 1, 2, 4 or 8. 0 for 4.
+    VmbUint32_t block;      // Side of the blocks, in pixels, rounded up to a multiple of `step`. 0 for 32.
+    VmbUint32_t adapt;      // The model moves by 2^-`adapt` of the difference on every image, at most 8. 0 for 4, i.e. 1/16.
+    double threshold;       // Difference from the model above which a sample changed, in ADU. 0 for 1/32 of the full scale.
+    double fraction;        // Fraction of the samples of a whole block above which the block changed, in (0, 1). 0 for 0.1.
+    VmbUint32_t min_blocks; // Changed blocks for an image to change. 0 for 1.
+} AlliedChangeConfig_t;
+
+/**
+ * @brief Outcome of the comparison of an image to the background model.
+ *
+ */
+typedef struct
+{
+    VmbUint64_t frame_id; // Frame ID of the frame, for results of the change detection stage.
+    bool changed;         // The image changed.
+    bool forwarded;       // The frame was handed to the `changes_only` subscribers, for results of the change detection stage.
+    VmbUint32_t blocks;   // Changed blocks.
+    VmbUint32_t total;    // Blocks of the image.
+    double score;         // Fraction of the samples of the image that changed.
+    VmbUint32_t x;        // Horizontal offset of the bounding box of the changed blocks, in pixels of the image.
+    VmbUint32_t y;        // Vertical offset of the bounding box of the changed blocks.
+    VmbUint32_t width;    // Width of the bounding box of the changed blocks, 0 if no block changed.
+    VmbUint32_t height;   // Height of the bounding box of the changed blocks, 0 if no block changed.
+    double elapsed_us;    // Time taken to compare the image, in microseconds.
+} AlliedChangeResult_t;
+
+/**
+ * @brief Create a change detector.
+ *
+ * @param det Pointer to store the detector handle.
+ * @param config Configuration. NULL for the defaults.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the configuration is out of range, otherwise an error code.
+ */
+VmbError_t allied_change_create(AlliedChangeDetector_t *_Nonnull det, const AlliedChangeConfig_t *_Nullable config);
+
+/**
+ * @brief Destroy a change detector.
+ *
+ * @param det Detector handle, set to NULL on return.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_change_destroy(AlliedChangeDetector_t *_Nonnull det);
+
+/**
+ * @brief Drop the background model of a change detector. The next image rebuilds it.
+ *
+ * @param det Detector handle.
+ */
+void allied_change_reset(AlliedChangeDetector_t _Nonnull det);
+
+/**
+ * @brief Compare an image to the background model, and update the model.
+ *
+ * @param det Detector handle.
+ * @param image Image, of a pixel format supported by the image kernels (see {@link allied_image_supported}).
+ * @param result Pointer to store the outcome.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the image is invalid, `VmbErrorNotSupported` if the pixel format is not supported, otherwise an error code.
+ */
+VmbError_t allied_change_detect(AlliedChangeDetector_t _Nonnull det, const AlliedImage_t *_Nonnull image, AlliedChangeResult_t *_Nonnull result);
+
+/**
+ * @brief Change detection stage configuration.
+ *
+ */
+typedef struct
+{
+    AlliedChangeConfig_t detector; // Detector configuration.
+    VmbUint32_t pre;               // Frames preceding a run of changed frames handed to the `changes_only` subscribers.
+    VmbUint32_t post;              // Frames following a run of changed frames handed to the `changes_only` subscribers.
+} AlliedChangeTrigger_t;
+
+/**
+ * @brief Counters of the change detection stage, see {@link allied_get_change_status}.
+ *
+ */
+typedef struct
+{
+    bool enabled;           // The stage is enabled.
+    VmbUint64_t frames;     // Frames compared.
+    VmbUint64_t changed;    // Frames that changed.
+    VmbUint64_t forwarded;  // Frames handed to the `changes_only` subscribers, including the frames of the windows.
+    VmbUint64_t events;     // Runs of forwarded frames.
+    VmbUint64_t incomplete; // Frames not compared because they were not received in full.
+} AlliedChangeStatus_t;
+
+/**
+ * @brief Enable the change detection stage of a camera. This function can be called while the camera is capturing; the configuration
+ * applies from the next delivered frame, with a new background model, and the frames held for the preceding window are released.
+ *
+ * @param handle Handle to Allied Vision camera.
+ * @param config Stage configuration. Pass NULL to disable the stage; the `changes_only` subscribers then receive every frame.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the configuration is out of range, otherwise an error code.
+ */
+VmbError_t allied_set_change_detection(AlliedCameraHandle_t handle, const AlliedChangeTrigger_t *_Nullable config);
+
+/**
+ * @brief Get the counters of the change detection stage of a camera. The counters restart when the stage is configured.
+ *
+ * @param handle Handle to Allied Vision camera.
+ * @param status Pointer to store the counters.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_get_change_status(AlliedCameraHandle_t handle, AlliedChangeStatus_t *_Nonnull status);
+
+/**
+ * @brief Get the change detection result of a frame. Valid only inside a capture or subscription callback, or while holding a reference.
+ * The result lives with the frame, and is overwritten when the frame is captured again.
+ *
+ * @param frame Frame.
+ * @param result Pointer to store the address of the result.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorNotAvailable` if the frame was not compared, `VmbErrorInvalidCall` if the frame is not currently held.
+ */
+VmbError_t allied_frame_change(const VmbFrame_t *_Nonnull frame, const AlliedChangeResult_t *_Nullable *_Nonnull result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALLIEDCAM_CHANGE_H_ */
@@ -0,0 +1,196 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_coadd.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Multi-threaded frame co-adding for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details An accumulator sums frames of one geometry into a 32-bit integer or float image. Every frame is added in one pass of widening
+ * adds, vectorized for every CPU level (see {@link alliedcam_cpu.h}), with the rows split in bands across the worker pool.
+ *
+ * The sum is either a running sum of every frame since the last reset, or a sliding window over the last `window` frames. The window is kept
+ * as a ring of partial sums (panes) of `pane` frames each: when a pane starts, the oldest pane leaves the sum in the same pass that adds the
+ * frame, so a window costs one more read and write per pixel, and `window / pane` sums of memory. With `pane` set to 1 the window is exact;
+ * larger panes trade the granularity of the window for memory.
+ *
+ * An accumulator can be fed from a camera with {@link allied_coadd_attach}: a thread takes the frames from a queued subscription, adds
+ * each frame and releases it at once, so that it is requeued without waiting for the sum to be read. Sums can be emitted to a callback
+ * every `emit_every` frames, optionally starting a new sum, e.g. to write one co-added frame per second.
+ *
+ */
+
+#ifndef ALLIEDCAM_COADD_H_
+#define ALLIEDCAM_COADD_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "alliedcam_calib.h"
+
+/**
+ * @brief Handle to an accumulator, see {@link allied_coadd_create}.
+ *
+ */
+typedef struct allied_coadd_s *AlliedCoadd_t;
+
+/**
+ * @brief Value type of the sums.
+ *
+ */
+typedef enum
+{
+    AlliedCoaddUint32 = 0, // 32-bit unsigned integers. Exact, up to `2^32 / 2^bits` frames for the bit depth of the format.
+    AlliedCoaddFloat,      // 32-bit floats. Exact up to 2^24 per pixel, rounded beyond.
+} AlliedCoaddType_t;
+
+/**
+ * @brief Sum of an accumulator.
+ *
+ */
+typedef struct
+{
+    const void *data;       // `width * height` sums, packed rows, of `type`.
+    VmbUint32_t width;      // Width in pixels.
+    VmbUint32_t height;     // Height in pixels.
+    AlliedCoaddType_t type; // Value type.
+    VmbUint32_t frames;     // Number of frames in the sum.
+    VmbUint64_t first_id;   // Frame ID of the first frame in the sum, counted from the reset for images added without a frame.
+    VmbUint64_t last_id;    // Frame ID of the last frame in the sum.
+} AlliedCoaddSum_t;
+
+/**
+ * @brief Callback function for emitted sums.
+ *
+ * @details This function is called on the thread that added the frame, with the accumulator locked: the sum can be read, but no function of
+ * the accumulator may be called.
+ *
+ * @param acc Handle to the accumulator.
+ * @param sum Sum. The data is valid until the callback returns.
+ * @param user_data User data of the configuration.
+ */
+typedef void (*AlliedCoaddCallback)(AlliedCoadd_t, const AlliedCoaddSum_t *_Nonnull, void *_Nullable);
+
+/**
+ * @brief Accumulator configuration.
+ *
+ */
+typedef struct
+{
+    AlliedCoaddType_t type;       // Value type of the sums.
+    VmbUint32_t window;           // Frames in the sliding window. 0 for a running sum until reset.
+    VmbUint32_t pane;             // Frames per partial sum of the window. 0 for 1, which makes the window exact. `window` must be a multiple.
+    VmbUint32_t emit_every;       // Frames between calls to `callback`. 0 to not emit.
+    bool reset_on_emit;           // Start a new sum after every emission, so that the emitted sums are of disjoint frames.
+    AlliedCoaddCallback callback; // Callback for emitted sums. Can be NULL.
+    void *user_data;              // User data passed to the callback.
+    VmbUint32_t threads;          // Maximum number of threads used to add a frame. 0 or 1 adds on the calling thread.
+} AlliedCoaddConfig_t;
+
+/**
+ * @brief Accumulator state.
+ *
+ */
+typedef struct
+{
+    VmbUint32_t frames;  // Frames in the sum.
+    VmbUint64_t added;   // Frames added since the accumulator was created.
+    VmbUint64_t emitted; // Sums emitted.
+    VmbUint64_t dropped; // Frames of an attached camera dropped because the subscription queue was full.
+    bool attached;       // The accumulator is fed from a camera.
+    VmbError_t error;    // Result of the last frame added from the camera.
+} AlliedCoaddStatus_t;
+
+/**
+ * @brief Create an accumulator.
+ *
+ * @param acc Pointer to store the accumulator handle.
+ * @param geometry Geometry of the frames. The pixel format must be supported by the image kernels (see {@link allied_image_supported}).
+ * @param config Configuration. NULL for a running 32-bit integer sum on the calling thread.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the configuration is out of range or the window can overflow the sums, `VmbErrorNotSupported` if the pixel format is not supported, otherwise an error code.
+ */
+VmbError_t allied_coadd_create(AlliedCoadd_t *_Nonnull acc, const AlliedCalibGeometry_t *_Nonnull geometry, const AlliedCoaddConfig_t *_Nullable config);
+
+/**
+ * @brief Destroy an accumulator. The accumulator is detached from its camera first.
+ *
+ * @param acc Accumulator handle, set to NULL on return.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_coadd_destroy(AlliedCoadd_t *_Nonnull acc);
+
+/**
+ * @brief Add an image to the sum.
+ *
+ * @param acc Accumulator handle.
+ * @param image Image of the size and pixel format of the accumulator geometry.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the image does not match the geometry, `VmbErrorInvalidCall` if a running integer sum is full and must be reset, otherwise an error code.
+ */
+VmbError_t allied_coadd_add(AlliedCoadd_t _Nonnull acc, const AlliedImage_t *_Nonnull image);
+
+/**
+ * @brief Add a captured frame to the sum. The offset of the frame is checked as well, and its frame ID is recorded.
+ *
+ * @param acc Accumulator handle.
+ * @param frame Frame of the accumulator geometry.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code (see {@link allied_coadd_add}).
+ */
+VmbError_t allied_coadd_add_frame(AlliedCoadd_t _Nonnull acc, const VmbFrame_t *_Nonnull frame);
+
+/**
+ * @brief Copy the current sum.
+ *
+ * @param acc Accumulator handle.
+ * @param dst Destination of `height` rows of `width` values of the accumulator type.
+ * @param stride Bytes between the starts of consecutive rows of the destination. 0 if the rows are packed.
+ * @param sum Pointer to store the description of the sum, with `data` set to `dst`. Can be NULL.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the stride is too small, otherwise an error code.
+ */
+VmbError_t allied_coadd_read(AlliedCoadd_t _Nonnull acc, void *_Nonnull dst, size_t stride, AlliedCoaddSum_t *_Nullable sum);
+
+/**
+ * @brief Clear the sum and the partial sums of the window.
+ *
+ * @param acc Accumulator handle.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_coadd_reset(AlliedCoadd_t _Nonnull acc);
+
+/**
+ * @brief Get the state of an accumulator.
+ *
+ * @param acc Accumulator handle.
+ * @param status Pointer to store the state.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_coadd_status(AlliedCoadd_t _Nonnull acc, AlliedCoaddStatus_t *_Nonnull status);
+
+/**
+ * @brief Feed an accumulator from a camera. Frames are taken through a queued subscription (see {@link allied_subscribe}) by a thread
+ * of the accumulator, added and released at once. Frames that do not match the geometry are skipped, and the error is kept in the status.
+ *
+ * @param acc Accumulator handle, not attached.
+ * @param handle Handle to Allied Vision camera.
+ * @param subscription Subscription configuration. The callback is ignored. NULL for a queue of 4 frames that drops the newest frame when full.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorInvalidCall` if the accumulator is already attached, otherwise an error code.
+ */
+VmbError_t allied_coadd_attach(AlliedCoadd_t _Nonnull acc, AlliedCameraHandle_t handle, const AlliedSubscription_t *_Nullable subscription);
+
+/**
+ * @brief Stop feeding an accumulator from its camera. Frames still queued are released without being added. Must be called before the camera is closed.
+ *
+ * @param acc Accumulator handle.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_coadd_detach(AlliedCoadd_t _Nonnull acc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALLIEDCAM_COADD_H_ */
@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_copy.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Frame copy-out functions for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef ALLIEDCAM_COPY_H_
+#define ALLIEDCAM_COPY_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "alliedcam.h"
+#include <stddef.h>
+
+#ifndef ALLIED_COPY_STREAMING_THRESHOLD
+/**
+ * @brief Copies of at least this many bytes use non-temporal (streaming) stores in {@link AlliedCopyAuto} mode.
+ * Streaming stores bypass the cache, so that copying a large frame does not evict the working set of the application.
+ *
+ */
+#define ALLIED_COPY_STREAMING_THRESHOLD MIB(1)
+#endif
+
+#ifndef ALLIED_COPY_THREAD_CHUNK
+/**
+ * @brief Minimum number of bytes copied by each thread of a multi-threaded copy.
+ *
+ */
+#define ALLIED_COPY_THREAD_CHUNK KIB(256)
+#endif
+
+/**
+ * @brief Store strategy of a copy.
+ *
+ */
+typedef enum
+{
+    AlliedCopyAuto = 0,  // Streaming stores for copies of at least `ALLIED_COPY_STREAMING_THRESHOLD` bytes, regular stores otherwise.
+    AlliedCopyCached,    // Regular stores, the destination ends up in the cache.
+    AlliedCopyStreaming, // Non-temporal stores, the destination bypasses the cache.
+} AlliedCopyMode_t;
+
+/**
+ * @brief Frame copy options.
+ *
+ */
+typedef struct
+{
+    AlliedCopyMode_t mode; // Store strategy.
+    VmbUint32_t threads;   // Maximum number of threads to use. 0 or 1 copies on the calling thread.
+} AlliedCopyOptions_t;
+
+/**
+ * @brief Get the size of the image data in a frame, in bytes.
+ *
+ * @param frame Frame.
+ * @return size_t Size of the image data, 0 if the frame is invalid.
+ */
+size_t allied_frame_image_size(const VmbFrame_t *_Nonnull frame);
+
+/**
+ * @brief Copy a block of memory with the given store strategy.
+ *
+ * @param dst Destination.
+ * @param src Source. Must not overlap with the destination.
+ * @param size Number of bytes to copy.
+ * @param opts Copy options. NULL for single-threaded {@link AlliedCopyAuto}.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_copy_buffer(void *_Nonnull dst, const void *_Nonnull src, size_t size, const AlliedCopyOptions_t *_Nullable opts);
+
+/**
+ * @brief Copy the image data of a frame. Use this in the capture callback to keep the image after the callback returns.
+ *
+ * @param frame Frame to copy.
+ * @param dst Destination.
+ * @param size Size of the destination, at least {@link allied_frame_image_size} bytes.
+ * @param opts Copy options. NULL for single-threaded {@link AlliedCopyAuto}.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorMoreData` if the destination is too small, otherwise an error code.
+ */
+VmbError_t allied_copy_frame(const VmbFrame_t *_Nonnull frame, void *_Nonnull dst, size_t size, const AlliedCopyOptions_t *_Nullable opts);
+
+/**
+ * @brief Copy a region of interest of a frame.
+ *
+ * @details Rows of the region are copied to the destination `dst_stride` bytes apart. For packed pixel formats, the horizontal offset and the width of the
+ * region must fall on byte boundaries (e.g. even pixels for Mono12p).
+ *
+ * @param frame Frame to copy.
+ * @param x Horizontal offset of the region, in pixels.
+ * @param y Vertical offset of the region, in pixels.
+ * @param width Width of the region, in pixels.
+ * @param height Height of the region, in pixels.
+ * @param dst Destination, at least `height * dst_stride` bytes.
+ * @param dst_stride Bytes between the starts of consecutive rows in the destination. 0 to pack the rows.
+ * @param opts Copy options. NULL for single-threaded {@link AlliedCopyAuto}.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorInvalidValue` if the region does not fit in the frame, otherwise an error code.
+ */
+VmbError_t allied_copy_frame_roi(const VmbFrame_t *_Nonnull frame, VmbUint32_t x, VmbUint32_t y, VmbUint32_t width, VmbUint32_t height, void *_Nonnull dst, size_t dst_stride, const AlliedCopyOptions_t *_Nullable opts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALLIEDCAM_COPY_H_ */
@@ -0,0 +1,106 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_cpu.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief CPU feature detection and kernel selection for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef ALLIEDCAM_CPU_H_
+#define ALLIEDCAM_CPU_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "alliedcam.h"
+
+/**
+ * @brief Instruction set level of the pixel processing kernels.
+ *
+ * @details The CPU features are detected once, when {@link allied_init_api} is called (or on first use of a processing function),
+ * and every kernel family is bound to the best variant the CPU supports. The environment variable `ALLIED_CPU_LEVEL` (`scalar`,
+ * `sse4.1`, `avx2` or `avx512`) caps the level at startup.
+ *
+ * The frame copy and unpacking kernels are written with intrinsics. The image processing kernels are plain C, written once and
+ * compiled for every level with that level's instruction set enabled, so that the compiler vectorizes them.
+ *
+ */
+typedef enum
+{
+    AlliedCpuScalar = 0, // Portable C.
+    AlliedCpuSse41,      // SSE2, SSSE3 and SSE4.1.
+    AlliedCpuAvx2,       // AVX2, FMA, F16C and BMI2 (x86-64-v3).
+    AlliedCpuAvx512,     // AVX-512 F, BW, DQ and VL (x86-64-v4).
+    AlliedCpuLevelCount, // Number of levels.
+} AlliedCpuLevel_t;
+
+/**
+ * @brief CPU feature flags, see {@link allied_cpu_features}.
+ *
+ */
+typedef enum
+{
+    AlliedCpuFeatureSse2 = 1 << 0,
+    AlliedCpuFeatureSsse3 = 1 << 1,
+    AlliedCpuFeatureSse41 = 1 << 2,
+    AlliedCpuFeatureAvx = 1 << 3,
+    AlliedCpuFeatureAvx2 = 1 << 4,
+    AlliedCpuFeatureFma = 1 << 5,
+    AlliedCpuFeatureF16c = 1 << 6,
+    AlliedCpuFeatureBmi2 = 1 << 7,
+    AlliedCpuFeatureAvx512f = 1 << 8,
+    AlliedCpuFeatureAvx512bw = 1 << 9,
+    AlliedCpuFeatureAvx512dq = 1 << 10,
+    AlliedCpuFeatureAvx512vl = 1 << 11,
+} AlliedCpuFeature_t;
+
+/**
+ * @brief Get the CPU features detected on this host.
+ *
+ * @return VmbUint32_t Bitwise OR of {@link AlliedCpuFeature_t} flags.
+ */
+VmbUint32_t allied_cpu_features(void);
+
+/**
+ * @brief Get the highest kernel level supported by this host.
+ *
+ * @return AlliedCpuLevel_t
+ */
+AlliedCpuLevel_t allied_cpu_detected_level(void);
+
+/**
+ * @brief Get the kernel level currently in use.
+ *
+ * @return AlliedCpuLevel_t
+ */
+AlliedCpuLevel_t allied_cpu_level(void);
+
+/**
+ * @brief Rebind all kernel families to the given level. Kernel families without a variant at this level use the best lower variant.
+ * Intended for testing and benchmarking the kernel variants. Must not be called while frames are being processed.
+ *
+ * @param level Kernel level.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorNotSupported` if the host does not support the level.
+ */
+VmbError_t allied_set_cpu_level(AlliedCpuLevel_t level);
+
+/**
+ * @brief Get the name of a kernel level, as accepted by the `ALLIED_CPU_LEVEL` environment variable.
+ *
+ * @param level Kernel level.
+ * @return const char* Name of the level.
+ */
+const char *allied_cpu_level_name(AlliedCpuLevel_t level);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALLIEDCAM_CPU_H_ */
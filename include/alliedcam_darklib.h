@@ -0,0 +1,229 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_darklib.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Temperature- and exposure-indexed dark library for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @details A dark library holds master bias and dark frames (see {@link alliedcam_calib.h}) for any number of sensor temperatures,
+ * exposure times, gains and geometries, and makes the dark for given conditions:
+ * - Only entries of the same geometry (region of interest, binning and pixel format) and gain are used. Dark current and black level
+ *   both change with gain, so darks are not scaled across gains.
+ * - A dark within the tolerances of the temperature and exposure time is used as is.
+ * - Otherwise the two darks closest in temperature on either side are blended, with weights that follow an exponential dark current
+ *   (doubling every `doubling_temperature` degrees). Outside the temperatures of the library, the dark is extrapolated along the same law:
+ *   with a bias, the dark current of the nearest dark is scaled; without one, the two nearest darks are blended with weights past [0, 1],
+ *   which keeps their offset. A single dark without a bias can not be extrapolated, and is used as is.
+ * - With a bias of the same geometry and gain in the library, the dark current (dark minus bias) of darks at any exposure time is scaled to
+ *   the requested exposure time. Without a bias, only darks at the requested exposure time are used.
+ *
+ * Selecting the darks only reads the entry headers, so it is cheap enough to do for every frame; making the dark is a pass over the pixels
+ * of at most three masters. A library can be installed on a camera with {@link allied_set_dark_library}: a telemetry thread follows the
+ * temperature, exposure time, gain and geometry of the camera, and installs a new calibration whenever they move past the tolerances.
+ *
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef ALLIEDCAM_DARKLIB_H_
+#define ALLIEDCAM_DARKLIB_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "alliedcam_calib.h"
+
+/**
+ * @brief Handle to a dark library, see {@link allied_dark_library_create}.
+ *
+ */
+typedef struct allied_dark_library_s *AlliedDarkLibrary_t;
+
+/**
+ * @brief Dark library options.
+ *
+ */
+typedef struct
+{
+    double temperature_tolerance; // Temperature difference in degrees C within which a dark is used as is. 0 for 0.5.
+    double exposure_tolerance;    // Relative exposure time difference within which a dark is used as is. 0 for 0.01.
+    double gain_tolerance;        // Gain difference in dB within which entries are of the same gain. 0 for 0.05.
+    double doubling_temperature;  // Temperature increase in degrees C that doubles the dark current. 0 for 6.3.
+} AlliedDarkLibraryOptions_t;
+
+/**
+ * @brief Conditions to make a dark for.
+ *
+ */
+typedef struct
+{
+    AlliedCalibGeometry_t geometry; // Geometry of the frames.
+    double exposure_us;             // Exposure time, in us.
+    double gain_db;                 // Gain, in dB.
+    double temperature;             // Sensor temperature, in degrees C.
+} AlliedDarkQuery_t;
+
+/**
+ * @brief Library entries and coefficients that make a dark: `bias_coeff * bias + coeff[0] * dark[0] + coeff[1] * dark[1]`.
+ *
+ */
+typedef struct
+{
+    VmbInt32_t dark[2]; // Library indices of the darks, -1 if unused.
+    double coeff[2];    // Coefficients of the darks.
+    VmbInt32_t bias;    // Library index of the bias, -1 if unused.
+    double bias_coeff;  // Coefficient of the bias.
+    bool exact;         // A single dark matches the conditions within the tolerances, and is used as is.
+    bool extrapolated;  // The temperature is outside the temperatures of the darks.
+} AlliedDarkSelection_t;
+
+/**
+ * @brief Create an empty dark library.
+ *
+ * @param library Pointer to store the library handle.
+ * @param opts Options. NULL for the defaults.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if an option is out of range, otherwise an error code.
+ */
+VmbError_t allied_dark_library_create(AlliedDarkLibrary_t *_Nonnull library, const AlliedDarkLibraryOptions_t *_Nullable opts);
+
+/**
+ * @brief Destroy a dark library and its entries. The library must not be installed on a camera.
+ *
+ * @param library Library handle, set to NULL on return.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_dark_library_destroy(AlliedDarkLibrary_t *_Nonnull library);
+
+/**
+ * @brief Add a copy of a master bias or dark to a library. Entries can be added while the library is installed on a camera.
+ *
+ * @param library Library handle.
+ * @param master Master bias or dark, with its exposure time, gain and temperature set.
+ * @param index Pointer to store the index of the entry. Can be NULL.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the master is a flat or has no data, otherwise an error code.
+ */
+VmbError_t allied_dark_library_add(AlliedDarkLibrary_t _Nonnull library, const AlliedMaster_t *_Nonnull master, VmbUint32_t *_Nullable index);
+
+/**
+ * @brief Add a master bias or dark saved with {@link allied_master_save} to a library.
+ *
+ * @param library Library handle.
+ * @param path File path.
+ * @param index Pointer to store the index of the entry. Can be NULL.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code (see {@link allied_master_load}).
+ */
+VmbError_t allied_dark_library_add_file(AlliedDarkLibrary_t _Nonnull library, const char *_Nonnull path, VmbUint32_t *_Nullable index);
+
+/**
+ * @brief Get the number of entries of a library.
+ *
+ * @param library Library handle.
+ * @return VmbUint32_t Number of entries.
+ */
+VmbUint32_t allied_dark_library_count(AlliedDarkLibrary_t _Nonnull library);
+
+/**
+ * @brief Get an entry of a library. The entry stays valid until the library is destroyed.
+ *
+ * @param library Library handle.
+ * @param index Index of the entry.
+ * @param master Pointer to store the entry.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the index is out of range.
+ */
+VmbError_t allied_dark_library_entry(AlliedDarkLibrary_t _Nonnull library, VmbUint32_t index, const AlliedMaster_t *_Nullable *_Nonnull master);
+
+/**
+ * @brief Select the entries that make the dark for some conditions. Only the entry headers are read.
+ *
+ * @param library Library handle.
+ * @param query Conditions.
+ * @param selection Pointer to store the selection.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorNotFound` if the library has no usable dark for the conditions.
+ */
+VmbError_t allied_dark_library_select(AlliedDarkLibrary_t _Nonnull library, const AlliedDarkQuery_t *_Nonnull query, AlliedDarkSelection_t *_Nonnull selection);
+
+/**
+ * @brief Make the master dark of a selection.
+ *
+ * @param library Library handle.
+ * @param query Conditions the selection was made for. The exposure time, gain and temperature of the dark are set from these.
+ * @param selection Selection made by {@link allied_dark_library_select}.
+ * @param dark Master dark. Free with {@link allied_master_free}.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the selection does not belong to the library, otherwise an error code.
+ */
+VmbError_t allied_dark_library_build(AlliedDarkLibrary_t _Nonnull library, const AlliedDarkQuery_t *_Nonnull query, const AlliedDarkSelection_t *_Nonnull selection, AlliedMaster_t *_Nonnull dark);
+
+/**
+ * @brief Check whether two sets of conditions are within the tolerances of a library of each other, i.e. whether the dark made for one serves the other.
+ *
+ * @param library Library handle.
+ * @param a Conditions.
+ * @param b Conditions.
+ * @return true The same dark serves both.
+ * @return false The conditions differ in geometry, or by more than a tolerance.
+ */
+bool allied_dark_library_equivalent(AlliedDarkLibrary_t _Nonnull library, const AlliedDarkQuery_t *_Nonnull a, const AlliedDarkQuery_t *_Nonnull b);
+
+/**
+ * @brief Dark tracking configuration, see {@link allied_set_dark_library}.
+ *
+ */
+typedef struct
+{
+    const AlliedMaster_t *flat; // Master flat applied with the dark. Copied by {@link allied_set_dark_library}. Can be NULL.
+    float pedestal;             // Added to every calibrated pixel, see {@link AlliedCalibConfig_t}.
+    AlliedCalibOutput_t output; // Pixel type of calibrated images.
+    AlliedCalibMaps_t maps;     // Storage of the offset and gain maps.
+    VmbUint32_t threads;        // Maximum number of threads used to calibrate a frame.
+    VmbUint32_t poll_ms;        // Interval between telemetry reads, in ms. 0 for 1000.
+} AlliedDarkTracking_t;
+
+/**
+ * @brief Dark tracking state.
+ *
+ */
+typedef struct
+{
+    bool enabled;                    // Dark tracking is running.
+    bool active;                     // A calibration made from the library is installed.
+    AlliedDarkQuery_t query;         // Conditions the installed dark was made for.
+    AlliedDarkSelection_t selection; // Entries the installed dark was made from.
+    VmbUint64_t switches;            // Calibrations installed since tracking was enabled.
+    double build_ms;                 // Time taken to make the last dark and calibration.
+    VmbError_t error;                // Result of the last attempt to make a dark, `VmbErrorNotFound` if the library has no dark for the conditions.
+} AlliedDarkTrackingStatus_t;
+
+/**
+ * @brief Calibrate frames with darks from a library, following the camera telemetry. The dark for the current conditions is installed
+ * before this returns, if the library has one; a telemetry thread then reads the sensor temperature, exposure time, gain and geometry every
+ * `poll_ms`, and when they move past the tolerances of the library, or entries are added to it, makes a new dark and installs it with
+ * {@link allied_set_calibration}. This replaces any calibration installed by the caller.
+ *
+ * @param handle Handle to Allied Vision camera.
+ * @param library Dark library, which must outlive its installation. Pass NULL to stop tracking and remove the calibration.
+ * @param config Tracking configuration. Ignored if `library` is NULL. Can be NULL for the defaults.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_set_dark_library(AlliedCameraHandle_t handle, AlliedDarkLibrary_t _Nullable library, const AlliedDarkTracking_t *_Nullable config);
+
+/**
+ * @brief Get the state of dark tracking.
+ *
+ * @param handle Handle to Allied Vision camera.
+ * @param status Dark tracking state.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_get_dark_library_status(AlliedCameraHandle_t handle, AlliedDarkTrackingStatus_t *_Nonnull status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALLIEDCAM_DARKLIB_H_ */
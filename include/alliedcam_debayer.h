@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_debayer.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Native debayering of Bayer images for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details Bayer images in any of the four phases (`BayerGR`, `BayerRG`, `BayerGB`, `BayerBG`) at 8, 10, 12 or 16 bits are interpolated
+ * to RGB (or BGR) at the same bit depth. The kernels are vectorized for every CPU level (see {@link alliedcam_cpu.h}), and the image is
+ * split into horizontal bands that are interpolated on the worker pool. Bands read the rows around them from the source, so the result does not
+ * depend on the number of threads. Image borders are mirrored.
+ *
+ */
+
+#ifndef ALLIEDCAM_DEBAYER_H_
+#define ALLIEDCAM_DEBAYER_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "alliedcam_image.h"
+
+#ifndef ALLIED_DEBAYER_BAND_ROWS
+/**
+ * @brief Rows interpolated at a time by each thread of a multi-threaded debayer.
+ *
+ */
+#define ALLIED_DEBAYER_BAND_ROWS 64
+#endif
+
+/**
+ * @brief Interpolation method.
+ *
+ */
+typedef enum
+{
+    AlliedDebayerBilinear = 0, // Bilinear interpolation of every color plane.
+    AlliedDebayerEdgeAware,    // Green interpolated along the direction of the weaker gradient (Hamilton-Adams), red and blue interpolated on the color differences.
+} AlliedDebayerMethod_t;
+
+/**
+ * @brief Debayering options.
+ *
+ */
+typedef struct
+{
+    AlliedDebayerMethod_t method; // Interpolation method.
+    bool bgr;                     // Store BGR instead of RGB.
+    bool color_correction;        // Apply `white_balance`, then `matrix`, in the same pass.
+    float white_balance[3];       // Red, green and blue gains.
+    float matrix[9];              // Color correction matrix, row major, applied to the white balanced RGB values.
+    VmbUint32_t threads;          // Maximum number of threads to use. 0 or 1 interpolates on the calling thread.
+} AlliedDebayerOptions_t;
+
+/**
+ * @brief Get the output pixel format of a Bayer pixel format.
+ *
+ * @param format Bayer pixel format.
+ * @param bgr Output in BGR order.
+ * @return VmbPixelFormat_t RGB (or BGR) format of the same bit depth, 0 if `format` is not a supported Bayer format.
+ */
+VmbPixelFormat_t allied_debayer_format(VmbPixelFormat_t format, bool bgr);
+
+/**
+ * @brief Interpolate a Bayer image to RGB or BGR.
+ *
+ * @param src Source image in a Bayer pixel format. Width and height must be even, and at least 4.
+ * @param dst Destination image, at least `width * 3` pixels per row. `data` and `stride` must be set, the size and format are set by this function.
+ * @param opts Debayering options. NULL for single-threaded bilinear interpolation to RGB.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorNotSupported` if the source is not a Bayer image, otherwise an error code.
+ */
+VmbError_t allied_debayer(const AlliedImage_t *_Nonnull src, AlliedImage_t *_Nonnull dst, const AlliedDebayerOptions_t *_Nullable opts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALLIEDCAM_DEBAYER_H_ */
@@ -0,0 +1,260 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_defects.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Streaming hot, cold and stuck pixel detection and correction for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @details A defect map is a sorted list of defective pixels of one geometry (region of interest, binning and pixel format). Correcting an
+ * image replaces every defect, in place, with the median of its eight nearest neighbours of the same color (two pixels apart in Bayer images),
+ * leaving out neighbours that are defects themselves. The neighbours of every defect are found when the map is made, so correction is a
+ * gather and a sorting network over blocks of defects.
+ *
+ * A defect detector follows every pixel's temporal median and median absolute deviation (MAD), with a running estimate that takes one sample
+ * at a time in 16 bits per statistic. Samples are taken from one band of rows every few frames, so the cost per frame is a small fraction of
+ * a pass over the image. Once the statistics have settled, each pass compares the median of each pixel with the median of its neighbours:
+ * - hot and cold pixels deviate from their neighbours by more than `sigma` times the noise of the neighbours, by at least `min_delta`, and by
+ *   more than twice the spread of the neighbours, so that steep gradients are not flagged;
+ * - stuck pixels have not changed for several samples in a row while their neighbours do.
+ *
+ * Point-like features that do not move in the scene can not be told from hot pixels, so detection is best run on dark frames or on scenes
+ * that move.
+ *
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef ALLIEDCAM_DEFECTS_H_
+#define ALLIEDCAM_DEFECTS_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "alliedcam_calib.h"
+
+/**
+ * @brief Kind of a defective pixel.
+ *
+ */
+typedef enum
+{
+    AlliedDefectHot = 0, // Brighter than its neighbours.
+    AlliedDefectCold,    // Darker than its neighbours.
+    AlliedDefectStuck,   // Does not change while its neighbours do.
+} AlliedDefectKind_t;
+
+/**
+ * @brief Defective pixel.
+ *
+ */
+typedef struct
+{
+    VmbUint32_t x;           // Column, in the region of interest.
+    VmbUint32_t y;           // Row, in the region of interest.
+    AlliedDefectKind_t kind; // Kind of defect.
+} AlliedDefect_t;
+
+/**
+ * @brief Handle to a defect map, see {@link allied_defect_map_create}.
+ *
+ */
+typedef struct allied_defect_map_s *AlliedDefectMap_t;
+
+/**
+ * @brief Handle to a defect detector, see {@link allied_defect_detector_create}.
+ *
+ */
+typedef struct allied_defect_detector_s *AlliedDefectDetector_t;
+
+/**
+ * @brief Defect detection configuration.
+ *
+ */
+typedef struct
+{
+    VmbUint32_t sample_interval; // Frames between samples. 0 for 4.
+    VmbUint32_t rows_per_sample; // Rows sampled at a time. 0 for 64, at least 4.
+    VmbUint32_t passes;          // Passes over the image before the first detection. 0 for 8.
+    double sigma;                // Deviation from the neighbours, in standard deviations of their noise, above which a pixel is hot or cold. 0 for 6.
+    VmbUint32_t min_delta;       // Smallest deviation from the neighbours, in ADU, flagged as hot or cold. 0 for 1/256 of full scale.
+    VmbUint32_t stuck_mad;       // Median absolute deviation of the neighbours, in ADU, above which a pixel that does not change is stuck. 0 to not detect stuck pixels.
+    VmbUint32_t max_defects;     // Largest number of defects of a map. 0 for 65536.
+} AlliedDefectDetection_t;
+
+/**
+ * @brief Make a defect map from a list of defects.
+ *
+ * @param map Pointer to store the map handle.
+ * @param geometry Geometry of the images the map applies to. Width and height must be below 65536.
+ * @param defects Defects, in any order. Duplicates are merged. Can be NULL if `count` is 0.
+ * @param count Number of defects.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if a defect is outside the geometry, `VmbErrorNotSupported` if the pixel format is not supported, otherwise an error code.
+ */
+VmbError_t allied_defect_map_create(AlliedDefectMap_t *_Nonnull map, const AlliedCalibGeometry_t *_Nonnull geometry, const AlliedDefect_t *_Nullable defects, VmbUint32_t count);
+
+/**
+ * @brief Copy a defect map.
+ *
+ * @param map Map handle.
+ * @param copy Pointer to store the handle of the copy.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_defect_map_copy(AlliedDefectMap_t _Nonnull map, AlliedDefectMap_t *_Nonnull copy);
+
+/**
+ * @brief Destroy a defect map.
+ *
+ * @param map Map handle, set to NULL on return.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_defect_map_destroy(AlliedDefectMap_t *_Nonnull map);
+
+/**
+ * @brief Get the number of defects of a map.
+ *
+ * @param map Map handle.
+ * @return VmbUint32_t Number of defects.
+ */
+VmbUint32_t allied_defect_map_count(AlliedDefectMap_t _Nonnull map);
+
+/**
+ * @brief Get a defect of a map. Defects are sorted by row, then by column.
+ *
+ * @param map Map handle.
+ * @param index Index of the defect.
+ * @param defect Pointer to store the defect.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the index is out of range.
+ */
+VmbError_t allied_defect_map_get(AlliedDefectMap_t _Nonnull map, VmbUint32_t index, AlliedDefect_t *_Nonnull defect);
+
+/**
+ * @brief Get the geometry of the images a map applies to.
+ *
+ * @param map Map handle.
+ * @param geometry Pointer to store the geometry.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_defect_map_geometry(AlliedDefectMap_t _Nonnull map, AlliedCalibGeometry_t *_Nonnull geometry);
+
+/**
+ * @brief Correct the defects of an image in place.
+ *
+ * @param map Map handle.
+ * @param image Image, of the size and pixel format of the map.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the image does not match the map, otherwise an error code.
+ */
+VmbError_t allied_defect_map_correct(AlliedDefectMap_t _Nonnull map, AlliedImage_t *_Nonnull image);
+
+/**
+ * @brief Write the defects of a map to a text file, one defect per line as `x y kind`, in unbinned sensor coordinates, for upload to the
+ * defect correction of the camera. A binned defect is written as the first sensor pixel of its bin.
+ *
+ * @param map Map handle.
+ * @param path File path.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorIO` if the file could not be written.
+ */
+VmbError_t allied_defect_map_export(AlliedDefectMap_t _Nonnull map, const char *_Nonnull path);
+
+/**
+ * @brief Create a defect detector.
+ *
+ * @param detector Pointer to store the detector handle.
+ * @param geometry Geometry of the images. Width and height must be below 65536.
+ * @param detection Detection configuration. NULL for the defaults.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the configuration is out of range, `VmbErrorNotSupported` if the pixel format is not supported, otherwise an error code.
+ */
+VmbError_t allied_defect_detector_create(AlliedDefectDetector_t *_Nonnull detector, const AlliedCalibGeometry_t *_Nonnull geometry, const AlliedDefectDetection_t *_Nullable detection);
+
+/**
+ * @brief Destroy a defect detector.
+ *
+ * @param detector Detector handle, set to NULL on return.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_defect_detector_destroy(AlliedDefectDetector_t *_Nonnull detector);
+
+/**
+ * @brief Hand a frame to a defect detector. Only every `sample_interval`-th frame is sampled.
+ *
+ * @param detector Detector handle.
+ * @param image Image, of the size and pixel format of the detector.
+ * @param updated Set to true if a detection pass completed, and a new map is available from {@link allied_defect_detector_map}. Can be NULL.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the image does not match the detector.
+ */
+VmbError_t allied_defect_detector_add(AlliedDefectDetector_t _Nonnull detector, const AlliedImage_t *_Nonnull image, bool *_Nullable updated);
+
+/**
+ * @brief Make a defect map from the last completed detection pass.
+ *
+ * @param detector Detector handle.
+ * @param map Pointer to store the map handle.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorNotAvailable` if no detection pass has completed yet, otherwise an error code.
+ */
+VmbError_t allied_defect_detector_map(AlliedDefectDetector_t _Nonnull detector, AlliedDefectMap_t *_Nonnull map);
+
+/**
+ * @brief Get the number of passes a detector has made over the image.
+ *
+ * @param detector Detector handle.
+ * @return VmbUint32_t Number of completed passes.
+ */
+VmbUint32_t allied_defect_detector_passes(AlliedDefectDetector_t _Nonnull detector);
+
+/**
+ * @brief Defect correction state of a camera.
+ *
+ */
+typedef struct
+{
+    bool enabled;           // Defect correction is enabled.
+    bool detecting;         // Defects are detected from the frames.
+    VmbUint32_t passes;     // Detection passes over the current region of interest.
+    VmbUint32_t defects;    // Defects of the map in use.
+    VmbUint64_t corrected;  // Frames corrected.
+    VmbUint64_t incomplete; // Frames not sampled for detection because they were not received in full.
+} AlliedDefectStatus_t;
+
+/**
+ * @brief Correct defective pixels of every frame in place, ahead of every other stage and consumer. Frames are corrected with `map` until
+ * detection completes a pass, and with the detected map from then on; detection starts over when the region of interest or pixel format
+ * changes. Master frames captured while correction is enabled are corrected too. The detector of every region of interest, and the map of
+ * every completed pass, are made by a worker thread, so that frame delivery does not allocate them; frames delivered while the worker uses
+ * the detector, and frames that were not received in full, are corrected but not sampled.
+ *
+ * @param handle Handle to Allied Vision camera.
+ * @param detection Detection configuration. NULL to only correct with `map`.
+ * @param map Defect map to correct with, copied. Can be NULL. If both `detection` and `map` are NULL, defect correction is disabled.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the configuration is out of range, otherwise an error code.
+ */
+VmbError_t allied_set_defect_correction(AlliedCameraHandle_t handle, const AlliedDefectDetection_t *_Nullable detection, AlliedDefectMap_t _Nullable map);
+
+/**
+ * @brief Get a copy of the defect map in use.
+ *
+ * @param handle Handle to Allied Vision camera.
+ * @param map Pointer to store the handle of the copy. Destroy with {@link allied_defect_map_destroy}.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorNotAvailable` if there is no map yet, otherwise an error code.
+ */
+VmbError_t allied_get_defect_map(AlliedCameraHandle_t handle, AlliedDefectMap_t *_Nonnull map);
+
+/**
+ * @brief Get the defect correction state.
+ *
+ * @param handle Handle to Allied Vision camera.
+ * @param status Defect correction state.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_get_defect_status(AlliedCameraHandle_t handle, AlliedDefectStatus_t *_Nonnull status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALLIEDCAM_DEFECTS_H_ */
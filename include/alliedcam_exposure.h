@@ -0,0 +1,101 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_exposure.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Host-side auto-exposure for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details The auto-exposure stage measures a percentile of a sub-sampled region of every delivered frame on the frame delivery
+ * thread, before the capture callback runs. The measurement is handed to a controller thread, which computes the new exposure time
+ * and gain and writes them to the camera, so that frame delivery never waits on the camera. Exposure time is raised first and
+ * gain only once the exposure time is at its limit; gain is lowered first. After every update, the frames that were delivered
+ * before the write completed, and the next `settle_frames` frames, are treated as stale and not measured. Frames that were not received in
+ * full are not measured either: missing packets would read as a dark frame.
+ *
+ */
+
+#ifndef ALLIEDCAM_EXPOSURE_H_
+#define ALLIEDCAM_EXPOSURE_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "alliedcam.h"
+
+/**
+ * @brief Auto-exposure configuration.
+ *
+ */
+typedef struct
+{
+    VmbUint32_t roi_x;         // Horizontal offset of the metering region, in pixels.
+    VmbUint32_t roi_y;         // Vertical offset of the metering region, in pixels.
+    VmbUint32_t roi_width;     // Width of the metering region in pixels. 0 to use the full frame.
+    VmbUint32_t roi_height;    // Height of the metering region in pixels. 0 to use the full frame.
+    VmbUint32_t step;          // Use every `step`-th pixel of every `step`-th row. 0 for 4.
+    double percentile;         // Percentile of the region that is controlled, in [0, 100].
+    double target;             // Target value of the percentile, as a fraction of full scale, in (0, 1].
+    double tolerance;          // Relative error of the percentile at which the loop is converged. 0 for 0.05.
+    double saturation_limit;   // Largest fraction of saturated pixels in the region. Above this, the exposure is cut regardless of the percentile.
+    double damping;            // Exponent applied to the correction ratio, in (0, 1]. 0 for 1, i.e. the full correction in one update.
+    double max_ratio;          // Largest change of exposure time times gain in one update. 0 for 4.
+    double exposure_min_us;    // Shortest exposure time. 0 for the camera minimum.
+    double exposure_max_us;    // Longest exposure time. 0 for the camera maximum.
+    bool use_gain;             // Raise the gain once the exposure time is at its maximum. Otherwise the gain is not changed.
+    double gain_max_db;        // Highest gain, in dB. 0 for the camera maximum.
+    VmbUint32_t settle_frames; // Frames delivered after an update is written that may still have been exposed with the previous settings. Typically 1 to 3, depending on the camera.
+} AlliedAutoExposure_t;
+
+/**
+ * @brief Auto-exposure state.
+ *
+ */
+typedef struct
+{
+    bool enabled;                   // Auto-exposure is running.
+    bool converged;                 // The last measured percentile was within tolerance of the target, or the settings are at their limits.
+    VmbUint64_t frame_id;           // Frame ID of the last measured frame.
+    double level;                   // Last measured percentile, as a fraction of full scale.
+    double saturated;               // Fraction of saturated pixels in the last measured frame.
+    double exposure_us;             // Exposure time applied by the camera on the last update.
+    double gain_db;                 // Gain applied by the camera on the last update.
+    VmbUint64_t measured;           // Frames measured.
+    VmbUint64_t stale;              // Frames not measured because they may have been exposed with outdated settings.
+    VmbUint64_t incomplete;         // Frames not measured because they were not received in full.
+    VmbUint64_t updates;            // Exposure and gain updates written to the camera.
+    VmbUint32_t convergence_frames; // Frames delivered between the last loss of convergence (or the start) and the following convergence.
+    double convergence_ms;          // Time between the last loss of convergence (or the start) and the following convergence.
+    double update_ms;               // Time taken by the last camera update.
+    VmbError_t error;               // Result of the last camera update. The exposure time and gain are read back from the camera after every update.
+} AlliedAutoExposureStatus_t;
+
+/**
+ * @brief Enable or reconfigure host-side auto-exposure. The camera auto-exposure and auto-gain should be off. This function can be
+ * called while the camera is capturing; the configuration applies from the next delivered frame.
+ *
+ * @param handle Handle to Allied Vision camera.
+ * @param config Auto-exposure configuration. Pass NULL to disable auto-exposure.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the configuration is out of range, otherwise an error code.
+ */
+VmbError_t allied_set_auto_exposure(AlliedCameraHandle_t handle, const AlliedAutoExposure_t *_Nullable config);
+
+/**
+ * @brief Get the state of host-side auto-exposure.
+ *
+ * @param handle Handle to Allied Vision camera.
+ * @param status Auto-exposure state.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_get_auto_exposure_status(AlliedCameraHandle_t handle, AlliedAutoExposureStatus_t *_Nonnull status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALLIEDCAM_EXPOSURE_H_ */
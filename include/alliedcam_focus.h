@@ -0,0 +1,243 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_focus.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Sharpness metrics and best-frame selection for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details Sharpness metrics score a region of a frame for autofocus and lucky imaging; larger is sharper:
+ * - Laplacian variance: the variance of the 4-neighbour Laplacian.
+ * - Tenengrad: the mean squared magnitude of the Sobel gradient, counting only gradients above a threshold.
+ * - Brenner: the mean squared difference between pixels two apart along the rows.
+ *
+ * Bayer pixels are compared with the nearest pixels of the same color, i.e. neighbours are taken two pixels apart. The differences are exact
+ * integers summed in 64 bits, vectorized for every CPU level (see {@link alliedcam_cpu.h}), with the rows split in bands across the worker
+ * pool. Only the inside of the region is scored, so that the metrics do not depend on the pixels around it.
+ *
+ * A best-frame selector keeps the `count` highest-scoring frames of a run in a min-heap: a frame is taken only if it beats the lowest score
+ * held, which it evicts. Selected frames are either retained, i.e. held out of the capture pool without a copy (see
+ * {@link allied_frame_retain}), or copied when they are selected, into buffers reused from the evicted frames. The held frames are handed
+ * to any writer through a callback, best first (see {@link allied_best_foreach}). A selector can be fed from a camera with
+ * {@link allied_best_attach}.
+ *
+ */
+
+#ifndef ALLIEDCAM_FOCUS_H_
+#define ALLIEDCAM_FOCUS_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "alliedcam_image.h"
+
+#ifndef ALLIED_BEST_MAX_COUNT
+/**
+ * @brief Largest number of frames a best-frame selector holds.
+ *
+ */
+#define ALLIED_BEST_MAX_COUNT 4096
+#endif
+
+/**
+ * @brief Sharpness metric.
+ *
+ */
+typedef enum
+{
+    AlliedFocusLaplacian = 0, // Variance of the Laplacian, in ADU^2.
+    AlliedFocusTenengrad,     // Mean squared Sobel gradient magnitude above the threshold, in ADU^2.
+    AlliedFocusBrenner,       // Mean squared difference of pixels two neighbours apart along the rows, in ADU^2.
+} AlliedFocusMetric_t;
+
+/**
+ * @brief Sharpness metric configuration.
+ *
+ */
+typedef struct
+{
+    AlliedFocusMetric_t metric; // Metric.
+    VmbUint32_t x;              // Horizontal offset of the scored region.
+    VmbUint32_t y;              // Vertical offset of the scored region.
+    VmbUint32_t width;          // Width of the scored region. 0 for the rest of the image.
+    VmbUint32_t height;         // Height of the scored region. 0 for the rest of the image.
+    double threshold;           // Smallest Sobel gradient magnitude counted by Tenengrad, in ADU. 0 counts every pixel.
+    VmbUint32_t threads;        // Maximum number of threads used to score an image. 0 or 1 scores on the calling thread.
+} AlliedFocusConfig_t;
+
+/**
+ * @brief Score the sharpness of an image.
+ *
+ * @param image Image, of a pixel format supported by the image kernels (see {@link allied_image_supported}).
+ * @param config Configuration. NULL for the Laplacian variance of the whole image.
+ * @param score Pointer to store the score.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the region is out of the image or too small for the metric, `VmbErrorNotSupported` if the pixel format is not supported, otherwise an error code.
+ */
+VmbError_t allied_focus_score(const AlliedImage_t *_Nonnull image, const AlliedFocusConfig_t *_Nullable config, double *_Nonnull score);
+
+/**
+ * @brief Handle to a best-frame selector, see {@link allied_best_create}.
+ *
+ */
+typedef struct allied_best_s *AlliedBest_t;
+
+/**
+ * @brief Storage of the selected frames.
+ *
+ */
+typedef enum
+{
+    AlliedBestRetain = 0, // Hold the frames out of the capture pool. The pool must have more frames than `count` plus the frames queued elsewhere.
+    AlliedBestCopy,       // Copy the frames when they are selected, and release them at once.
+} AlliedBestMode_t;
+
+/**
+ * @brief Best-frame selector configuration.
+ *
+ */
+typedef struct
+{
+    VmbUint32_t count;         // Frames held. Required, at most `ALLIED_BEST_MAX_COUNT`.
+    AlliedBestMode_t mode;     // Storage of the selected frames.
+    AlliedFocusConfig_t focus; // Metric of {@link allied_best_add} and of attached cameras. The region is relative to each frame.
+} AlliedBestConfig_t;
+
+/**
+ * @brief Frame held by a best-frame selector.
+ *
+ */
+typedef struct
+{
+    AlliedImage_t image;   // Pixels, in the frame buffer or in a copy with packed rows.
+    double score;          // Sharpness score.
+    VmbUint64_t frame_id;  // Frame ID.
+    VmbUint64_t timestamp; // Frame timestamp.
+    VmbUint32_t offset_x;  // Horizontal offset of the image on the sensor.
+    VmbUint32_t offset_y;  // Vertical offset of the image on the sensor.
+    VmbUint32_t rank;      // Rank of the frame, 0 for the best.
+} AlliedBestFrame_t;
+
+/**
+ * @brief Callback function for the held frames, e.g. a writer.
+ *
+ * @details This function is called with the selector locked: no function of the selector may be called from it. The image data is valid
+ * until the callback returns; a writer that keeps it must copy it.
+ *
+ * @param frame Held frame.
+ * @param user_data User data.
+ * @return VmbError_t `VmbErrorSuccess` to continue with the next frame, otherwise an error code that stops the iteration.
+ */
+typedef VmbError_t (*AlliedBestCallback)(const AlliedBestFrame_t *_Nonnull frame, void *_Nullable user_data);
+
+/**
+ * @brief Best-frame selector state.
+ *
+ */
+typedef struct
+{
+    VmbUint32_t held;     // Frames held.
+    double lowest;        // Lowest score held, which a frame must beat once the selector is full.
+    VmbUint64_t offered;  // Frames offered since the last reset.
+    VmbUint64_t selected; // Frames selected since the last reset, including those evicted since.
+    VmbUint64_t dropped;  // Frames of an attached camera dropped because the subscription queue was full.
+    bool attached;        // The selector is fed from a camera.
+    VmbError_t error;     // Result of the last frame from the camera.
+} AlliedBestStatus_t;
+
+/**
+ * @brief Create a best-frame selector.
+ *
+ * @param best Pointer to store the selector handle.
+ * @param config Configuration.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the configuration is out of range, otherwise an error code.
+ */
+VmbError_t allied_best_create(AlliedBest_t *_Nonnull best, const AlliedBestConfig_t *_Nonnull config);
+
+/**
+ * @brief Destroy a best-frame selector. The selector is detached from its camera, and the held frames are released.
+ *
+ * @param best Selector handle, set to NULL on return.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_best_destroy(AlliedBest_t *_Nonnull best);
+
+/**
+ * @brief Offer a scored frame. The caller must hold the frame, e.g. in a capture or subscription callback or from {@link allied_subscriber_pop};
+ * the selector takes its own reference or copy if the frame is selected.
+ *
+ * @param best Selector handle.
+ * @param view View of the frame.
+ * @param score Sharpness score of the frame.
+ * @param selected Pointer to store whether the frame was selected. Can be NULL.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorNotSupported` if the pixel format is not supported, otherwise an error code.
+ */
+VmbError_t allied_best_offer(AlliedBest_t _Nonnull best, const AlliedFrameView_t *_Nonnull view, double score, bool *_Nullable selected);
+
+/**
+ * @brief Score a frame with the configured metric, and offer it (see {@link allied_best_offer}).
+ *
+ * @param best Selector handle.
+ * @param view View of the frame.
+ * @param score Pointer to store the score. Can be NULL.
+ * @param selected Pointer to store whether the frame was selected. Can be NULL.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code (see {@link allied_focus_score}).
+ */
+VmbError_t allied_best_add(AlliedBest_t _Nonnull best, const AlliedFrameView_t *_Nonnull view, double *_Nullable score, bool *_Nullable selected);
+
+/**
+ * @brief Call a function for every held frame, best first. The frames stay held.
+ *
+ * @param best Selector handle.
+ * @param callback Function to call.
+ * @param user_data User data passed to the callback.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise the error returned by the callback.
+ */
+VmbError_t allied_best_foreach(AlliedBest_t _Nonnull best, AlliedBestCallback _Nonnull callback, void *_Nullable user_data);
+
+/**
+ * @brief Release the held frames and clear the counters, to start a new run.
+ *
+ * @param best Selector handle.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_best_reset(AlliedBest_t _Nonnull best);
+
+/**
+ * @brief Get the state of a best-frame selector.
+ *
+ * @param best Selector handle.
+ * @param status Pointer to store the state.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_best_status(AlliedBest_t _Nonnull best, AlliedBestStatus_t *_Nonnull status);
+
+/**
+ * @brief Score and offer the frames of a camera. Frames are taken through a queued subscription (see {@link allied_subscribe}) by a
+ * thread of the selector, scored with the configured metric, offered and released.
+ *
+ * @param best Selector handle, not attached.
+ * @param handle Handle to Allied Vision camera.
+ * @param subscription Subscription configuration. The callback is ignored. NULL for a queue of 4 frames that drops the newest frame when full.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorInvalidCall` if the selector is already attached, `VmbErrorBadParameter`
+ * if the selector retains frames and `count` plus the queue depth leaves no frame of the camera's frame buffer to the driver, otherwise an error code.
+ */
+VmbError_t allied_best_attach(AlliedBest_t _Nonnull best, AlliedCameraHandle_t handle, const AlliedSubscription_t *_Nullable subscription);
+
+/**
+ * @brief Stop feeding a best-frame selector from its camera. The held frames stay held. Must be called before the camera is closed.
+ *
+ * @param best Selector handle.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_best_detach(AlliedBest_t _Nonnull best);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALLIEDCAM_FOCUS_H_ */
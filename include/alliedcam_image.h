@@ -0,0 +1,175 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_image.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Image processing kernels for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details Every kernel is compiled once per pixel container and bit depth, and once per CPU level (see {@link alliedcam_cpu.h}).
+ * The pixel format of an image is looked up once per call, and selects the specialized kernel; no kernel inspects the pixel format per pixel.
+ * Supported formats are the unpacked monochrome formats (`Mono8`, `Mono10`, `Mono12`, `Mono14`, `Mono16`) and the unpacked Bayer formats
+ * (`Bayer*8`, `Bayer*10`, `Bayer*12`, `Bayer*16`). Packed formats can be converted with {@link allied_unpack} first.
+ *
+ */
+
+#ifndef ALLIEDCAM_IMAGE_H_
+#define ALLIEDCAM_IMAGE_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "alliedcam.h"
+#include <stddef.h>
+
+/**
+ * @brief View of an image in memory. Images do not own their data.
+ *
+ */
+typedef struct
+{
+    void *data;              // First pixel of the image.
+    VmbUint32_t width;       // Width in pixels.
+    VmbUint32_t height;      // Height in pixels.
+    size_t stride;           // Bytes between the starts of consecutive rows. 0 if the rows are packed.
+    VmbPixelFormat_t format; // Pixel format.
+} AlliedImage_t;
+
+/**
+ * @brief Pixel statistics of an image, see {@link allied_image_stats}.
+ *
+ */
+typedef struct
+{
+    VmbUint64_t count; // Number of pixels.
+    VmbUint32_t min;   // Minimum pixel value.
+    VmbUint32_t max;   // Maximum pixel value.
+    VmbUint64_t sum;   // Sum of the pixel values.
+    VmbUint64_t sumsq; // Sum of the squared pixel values.
+    double mean;       // Mean pixel value.
+    double stddev;     // Standard deviation of the pixel values.
+} AlliedImageStats_t;
+
+/**
+ * @brief Combination of the pixels of a bin, see {@link allied_image_bin}.
+ *
+ */
+typedef enum
+{
+    AlliedBinSum = 0, // Sum of the pixels, saturated to the maximum value of the bit depth.
+    AlliedBinMean,    // Mean of the pixels, rounded down.
+} AlliedBinMode_t;
+
+/**
+ * @brief Check if a pixel format is supported by the image kernels.
+ *
+ * @param format Pixel format.
+ * @return true
+ * @return false
+ */
+bool allied_image_supported(VmbPixelFormat_t format);
+
+/**
+ * @brief Get the size of one pixel of a supported pixel format.
+ *
+ * @param format Pixel format.
+ * @return size_t Bytes per pixel, 0 if the format is not supported.
+ */
+size_t allied_image_pixel_size(VmbPixelFormat_t format);
+
+/**
+ * @brief Get the number of significant bits per pixel of a supported pixel format, e.g. 12 for `VmbPixelFormatMono12`.
+ *
+ * @param format Pixel format.
+ * @return VmbUint32_t Significant bits per pixel, 0 if the format is not supported.
+ */
+VmbUint32_t allied_image_bits(VmbPixelFormat_t format);
+
+/**
+ * @brief Make an image from the image data of a frame.
+ *
+ * @param frame Frame.
+ * @param image Image to fill.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorNotSupported` if the pixel format is not supported, otherwise an error code.
+ */
+VmbError_t allied_image_from_frame(const VmbFrame_t *_Nonnull frame, AlliedImage_t *_Nonnull image);
+
+/**
+ * @brief Make an image from a frame view.
+ *
+ * @param view Frame view, see {@link allied_subscribe}.
+ * @param image Image to fill.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorNotSupported` if the pixel format is not supported, otherwise an error code.
+ */
+VmbError_t allied_image_from_view(const AlliedFrameView_t *_Nonnull view, AlliedImage_t *_Nonnull image);
+
+/**
+ * @brief Compute the pixel statistics of an image.
+ *
+ * @param image Image.
+ * @param stats Statistics.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_image_stats(const AlliedImage_t *_Nonnull image, AlliedImageStats_t *_Nonnull stats);
+
+/**
+ * @brief Map every pixel of an image through a lookup table.
+ *
+ * @details The source pixel value, masked to the bit depth of the format, indexes the table. The table entry is saturated to the bit depth
+ * of the format. The destination may be the source image.
+ *
+ * @param src Source image.
+ * @param lut Lookup table.
+ * @param lut_size Number of entries in the table, at least `1 << bits` for the bit depth of the format.
+ * @param dst Destination image. `data` and `stride` must be set, the size and format are set by this function.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorMoreData` if the table is too small, otherwise an error code.
+ */
+VmbError_t allied_image_lut(const AlliedImage_t *_Nonnull src, const VmbUint16_t *_Nonnull lut, size_t lut_size, AlliedImage_t *_Nonnull dst);
+
+/**
+ * @brief Copy a region of an image.
+ *
+ * @details Bayer images must be cropped at even offsets, so that the destination keeps the color filter phase of the source.
+ *
+ * @param src Source image.
+ * @param x Horizontal offset of the region, in pixels.
+ * @param y Vertical offset of the region, in pixels.
+ * @param width Width of the region, in pixels.
+ * @param height Height of the region, in pixels.
+ * @param dst Destination image. `data` and `stride` must be set, the size and format are set by this function.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorInvalidValue` if the region does not fit in the image, otherwise an error code.
+ */
+VmbError_t allied_image_crop(const AlliedImage_t *_Nonnull src, VmbUint32_t x, VmbUint32_t y, VmbUint32_t width, VmbUint32_t height, AlliedImage_t *_Nonnull dst);
+
+/**
+ * @brief Bin an image in software. Trailing pixels that do not fill a bin are dropped.
+ *
+ * @param src Source image, monochrome.
+ * @param bin_x Horizontal bin size.
+ * @param bin_y Vertical bin size.
+ * @param mode Combination of the pixels of a bin.
+ * @param dst Destination image of `width / bin_x` by `height / bin_y` pixels. `data` and `stride` must be set, the size and format are set by this function.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorNotSupported` for Bayer images, otherwise an error code.
+ */
+VmbError_t allied_image_bin(const AlliedImage_t *_Nonnull src, VmbUint32_t bin_x, VmbUint32_t bin_y, AlliedBinMode_t mode, AlliedImage_t *_Nonnull dst);
+
+/**
+ * @brief Add the pixels of an image to a 32-bit accumulator.
+ *
+ * @param src Source image.
+ * @param acc Accumulator, at least `height` rows of `width` values.
+ * @param acc_stride Values between the starts of consecutive rows of the accumulator. 0 if the rows are packed.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_image_accumulate(const AlliedImage_t *_Nonnull src, VmbUint32_t *_Nonnull acc, size_t acc_stride);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALLIEDCAM_IMAGE_H_ */
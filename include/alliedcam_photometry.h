@@ -0,0 +1,199 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_photometry.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Multi-aperture photometry for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details A photometry engine measures the flux of a list of circular apertures on every image, each with an optional sky annulus.
+ * Apertures are placed in unbinned sensor pixels, so that one list serves every region of interest and binning. The first image of a
+ * region of interest, binning and pixel format builds the tables of the engine: the byte offsets of the pixels of every aperture and
+ * annulus, and the weight of every aperture pixel, i.e. the fraction of the pixel inside the circle, sampled on a `subsample` x
+ * `subsample` grid. Later images of the same geometry only read the pixels through the tables.
+ *
+ * The flux of an aperture is the weighted sum of its pixels less the sky level times its area. The sky level is the mean of the annulus
+ * pixels, iteratively clipped at `sky_clip` standard deviations. Weights are integers out of `subsample`², so that the sums are exact;
+ * the reads are gathers, vectorized for every CPU level that has them (see {@link alliedcam_cpu.h}). The apertures are split across the
+ * worker pool in runs of about equal numbers of pixels.
+ *
+ * The photometry stage measures every delivered frame on the frame delivery thread, before the capture callback and the subscribers run,
+ * and stores the fluxes with the frame (see {@link allied_frame_photometry}), next to its statistics and beam profile.
+ *
+ */
+
+#ifndef ALLIEDCAM_PHOTOMETRY_H_
+#define ALLIEDCAM_PHOTOMETRY_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "alliedcam_image.h"
+
+#ifndef ALLIED_PHOTOMETRY_MAX_APERTURES
+/**
+ * @brief Largest number of apertures of a photometry engine.
+ *
+ */
+#define ALLIED_PHOTOMETRY_MAX_APERTURES 65536
+#endif
+
+/**
+ * @brief Handle to a photometry engine, see {@link allied_photometry_create}.
+ *
+ */
+typedef struct allied_photometry_s *AlliedPhotometry_t;
+
+/**
+ * @brief Circular aperture with an optional sky annulus. Positions and radii are in unbinned sensor pixels, with pixel centers at integer
+ * coordinates.
+ *
+ */
+typedef struct
+{
+    double x;         // Horizontal position of the center on the sensor.
+    double y;         // Vertical position of the center on the sensor.
+    double radius;    // Radius of the aperture.
+    double sky_inner; // Inner radius of the sky annulus, at least `radius`.
+    double sky_outer; // Outer radius of the sky annulus. 0 for no sky subtraction.
+} AlliedAperture_t;
+
+/**
+ * @brief Photometry configuration.
+ *
+ */
+typedef struct
+{
+    VmbUint32_t subsample; // Samples per pixel side used to weigh the pixels on the edge of an aperture. 0 for 5, at most 16.
+    double sky_clip;       // Sky pixels farther than this many standard deviations from the sky level are dropped, iteratively. 0 keeps every pixel.
+    double gain;           // Gain, in electrons per ADU, for the photon noise of the source in the flux error. 0 leaves it out.
+    VmbUint32_t threads;   // Maximum number of threads used to measure an image. 0 or 1 measures on the calling thread.
+} AlliedPhotometryConfig_t;
+
+/**
+ * @brief Aperture flags.
+ *
+ */
+typedef enum
+{
+    AlliedApertureClipped = 1 << 0,   // The aperture extends past the image; only the pixels inside were summed.
+    AlliedApertureOutside = 1 << 1,   // The aperture holds no pixel of the image; the flux is NaN.
+    AlliedApertureSaturated = 1 << 2, // A pixel of the aperture is at the largest value of the pixel format.
+    AlliedApertureNoSky = 1 << 3,     // The annulus holds no pixel of the image, or none was kept; the sky is 0.
+} AlliedApertureFlags_t;
+
+/**
+ * @brief Flux of an aperture.
+ *
+ */
+typedef struct
+{
+    double flux;            // Weighted sum of the aperture pixels less the sky, in ADU.
+    double error;           // Standard error of the flux from the sky scatter, and from the photon noise of the source with a gain, in ADU.
+    double sum;             // Weighted sum of the aperture pixels, in ADU.
+    double area;            // Area of the aperture inside the image, in image pixels.
+    double sky;             // Sky level, in ADU per image pixel.
+    double sky_stddev;      // Standard deviation of the sky pixels kept, in ADU.
+    VmbUint32_t sky_pixels; // Sky pixels kept.
+    VmbUint32_t peak;       // Highest pixel value of the aperture, in ADU.
+    VmbUint32_t flags;      // Flags, see {@link AlliedApertureFlags_t}.
+} AlliedApertureFlux_t;
+
+/**
+ * @brief Create a photometry engine. The apertures are copied.
+ *
+ * @param phot Pointer to store the engine handle.
+ * @param apertures Apertures.
+ * @param count Number of apertures, at least 1 and at most `ALLIED_PHOTOMETRY_MAX_APERTURES`.
+ * @param config Configuration. NULL for the defaults.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if an aperture or the configuration is out of range, otherwise an error code.
+ */
+VmbError_t allied_photometry_create(AlliedPhotometry_t *_Nonnull phot, const AlliedAperture_t *_Nonnull apertures, VmbUint32_t count,
+                                    const AlliedPhotometryConfig_t *_Nullable config);
+
+/**
+ * @brief Destroy a photometry engine.
+ *
+ * @param phot Engine handle, set to NULL on return.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_photometry_destroy(AlliedPhotometry_t *_Nonnull phot);
+
+/**
+ * @brief Get the number of apertures of a photometry engine.
+ *
+ * @param phot Engine handle.
+ * @return VmbUint32_t Number of apertures.
+ */
+VmbUint32_t allied_photometry_count(AlliedPhotometry_t _Nonnull phot);
+
+/**
+ * @brief Measure the apertures on an image. The tables are built again if the geometry differs from the previous image.
+ *
+ * @param phot Engine handle.
+ * @param image Image, of a pixel format supported by the image kernels (see {@link allied_image_supported}).
+ * @param offset_x Horizontal offset of the image on the sensor, in binned pixels, e.g. the frame offset.
+ * @param offset_y Vertical offset of the image on the sensor, in binned pixels.
+ * @param binning Binning factor of the image. 0 for 1.
+ * @param fluxes Destination of the fluxes, one per aperture, in the order of the apertures.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the image is invalid, `VmbErrorNotSupported` if the pixel format is not supported, otherwise an error code.
+ */
+VmbError_t allied_photometry_measure(AlliedPhotometry_t _Nonnull phot, const AlliedImage_t *_Nonnull image, VmbUint32_t offset_x, VmbUint32_t offset_y,
+                                     VmbUint32_t binning, AlliedApertureFlux_t *_Nonnull fluxes);
+
+/**
+ * @brief Get the number of times the tables of a photometry engine were built, i.e. the number of geometry changes it has seen.
+ *
+ * @param phot Engine handle.
+ * @return VmbUint64_t Number of table builds.
+ */
+VmbUint64_t allied_photometry_builds(AlliedPhotometry_t _Nonnull phot);
+
+/**
+ * @brief Photometry of a frame, see {@link allied_frame_photometry}.
+ *
+ */
+typedef struct
+{
+    VmbUint64_t frame_id;               // Frame ID of the frame.
+    VmbUint64_t timestamp;              // Timestamp of the frame.
+    VmbUint32_t count;                  // Number of apertures, and length of `fluxes`.
+    const AlliedApertureFlux_t *fluxes; // Fluxes, in the order of the apertures.
+    double elapsed_us;                  // Time taken to measure the frame, in microseconds.
+} AlliedPhotometryRecord_t;
+
+/**
+ * @brief Enable the photometry stage of a camera. This function can be called while the camera is capturing; the apertures apply from
+ * the next delivered frame. The stage follows the binning factor set with {@link allied_set_binning_factor}, and builds its tables again
+ * after a change. The records of the frames are allocated here, and the previous apertures are freed here, so that frame delivery does
+ * neither.
+ *
+ * @param handle Handle to Allied Vision camera.
+ * @param apertures Apertures, copied. Pass NULL to disable the stage.
+ * @param count Number of apertures.
+ * @param config Photometry configuration. NULL for the defaults.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if an aperture or the configuration is out of range, `VmbErrorResources` if the records could not be allocated, otherwise an error code.
+ */
+VmbError_t allied_set_photometry(AlliedCameraHandle_t handle, const AlliedAperture_t *_Nullable apertures, VmbUint32_t count,
+                                 const AlliedPhotometryConfig_t *_Nullable config);
+
+/**
+ * @brief Get the photometry of a frame. Valid only inside a capture or subscription callback, or while holding a reference.
+ * The record and its fluxes live with the frame, and are overwritten when the frame is captured again.
+ *
+ * @param frame Frame.
+ * @param record Pointer to store the address of the record.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorNotAvailable` if the frame was not measured (or it was incomplete), `VmbErrorInvalidCall` if the frame is not currently held.
+ */
+VmbError_t allied_frame_photometry(const VmbFrame_t *_Nonnull frame, const AlliedPhotometryRecord_t *_Nullable *_Nonnull record);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALLIEDCAM_PHOTOMETRY_H_ */
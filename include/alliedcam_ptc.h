@@ -0,0 +1,186 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_ptc.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Per-pixel temporal mean and variance maps, and photon transfer characterization for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details Temporal moments follow the mean and variance of every pixel over a series of frames with Welford's update, in float. All pixels
+ * of a series have the same number of samples, so the update of a row needs no division, and is vectorized for every CPU level
+ * (see {@link alliedcam_cpu.h}), with the rows split in bands across the worker pool.
+ *
+ * A photon transfer sweep ({@link allied_ptc_sweep}) steps the exposure time of an evenly and steadily illuminated camera over a range,
+ * measures the temporal moments of a region at every step, and derives:
+ * - the offset and the read noise, from the shortest exposure time;
+ * - the system gain in e-/ADU, from the slope of the shot noise variance against the signal (the photon transfer curve), below saturation;
+ * - the full well, as the signal at which the temporal variance peaks before it collapses at saturation;
+ * - the linearity curve, as the deviation of the signal from a straight line fitted against the exposure time below saturation.
+ * Averaging the per-pixel temporal variance over the region keeps fixed pattern noise out of the curve. The sweep takes `steps * (frames +
+ * settle_frames)` frames, i.e. seconds to minutes at the usual frame rates.
+ *
+ */
+
+#ifndef ALLIEDCAM_PTC_H_
+#define ALLIEDCAM_PTC_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "alliedcam_calib.h"
+
+#ifndef ALLIED_PTC_MAX_STEPS
+/**
+ * @brief Largest number of exposure steps of a photon transfer sweep.
+ *
+ */
+#define ALLIED_PTC_MAX_STEPS 64
+#endif
+
+/**
+ * @brief Handle to temporal moments, see {@link allied_moments_create}.
+ *
+ */
+typedef struct allied_moments_s *AlliedMoments_t;
+
+/**
+ * @brief Spatial averages of temporal moments.
+ *
+ */
+typedef struct
+{
+    VmbUint32_t frames; // Frames in the series.
+    double mean;        // Mean of the per-pixel temporal means, in ADU.
+    double variance;    // Mean of the per-pixel temporal variances, in ADU^2.
+    double fpn;         // Standard deviation of the per-pixel temporal means across the region (fixed pattern noise), in ADU.
+} AlliedMomentsSummary_t;
+
+/**
+ * @brief Create temporal moments.
+ *
+ * @param moments Pointer to store the handle.
+ * @param width Width of the images, in pixels.
+ * @param height Height of the images, in pixels.
+ * @param format Pixel format of the images, supported by the image kernels (see {@link allied_image_supported}).
+ * @param threads Maximum number of threads used to add an image. 0 or 1 adds on the calling thread.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorNotSupported` if the pixel format is not supported, otherwise an error code.
+ */
+VmbError_t allied_moments_create(AlliedMoments_t *_Nonnull moments, VmbUint32_t width, VmbUint32_t height, VmbPixelFormat_t format, VmbUint32_t threads);
+
+/**
+ * @brief Destroy temporal moments.
+ *
+ * @param moments Handle, set to NULL on return.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_moments_destroy(AlliedMoments_t *_Nonnull moments);
+
+/**
+ * @brief Add an image to the series.
+ *
+ * @param moments Handle.
+ * @param image Image of the size and pixel format of the moments. Can be a region of a larger image, through its stride.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the image does not match, otherwise an error code.
+ */
+VmbError_t allied_moments_add(AlliedMoments_t _Nonnull moments, const AlliedImage_t *_Nonnull image);
+
+/**
+ * @brief Start a new series.
+ *
+ * @param moments Handle.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_moments_reset(AlliedMoments_t _Nonnull moments);
+
+/**
+ * @brief Copy the per-pixel temporal mean and variance maps. The variance is the unbiased sample variance.
+ *
+ * @param moments Handle.
+ * @param mean Destination of `height` rows of `width` floats. Can be NULL.
+ * @param variance Destination of `height` rows of `width` floats. Can be NULL.
+ * @param stride Bytes between the starts of consecutive rows of the destinations. 0 if the rows are packed.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorInvalidCall` if fewer than two images were added, `VmbErrorBadParameter` if the stride is too small.
+ */
+VmbError_t allied_moments_maps(AlliedMoments_t _Nonnull moments, float *_Nullable mean, float *_Nullable variance, size_t stride);
+
+/**
+ * @brief Get the spatial averages of the temporal moments.
+ *
+ * @param moments Handle.
+ * @param summary Pointer to store the averages.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorInvalidCall` if fewer than two images were added.
+ */
+VmbError_t allied_moments_summary(AlliedMoments_t _Nonnull moments, AlliedMomentsSummary_t *_Nonnull summary);
+
+/**
+ * @brief Photon transfer sweep configuration.
+ *
+ */
+typedef struct
+{
+    double exposure_min_us;    // Shortest exposure time, which gives the offset and read noise. 0 for the camera minimum.
+    double exposure_max_us;    // Longest exposure time, which should saturate the sensor. Required.
+    VmbUint32_t steps;         // Exposure times, spaced evenly in logarithm. 0 for 24, at least 4 and at most `ALLIED_PTC_MAX_STEPS`.
+    VmbUint32_t frames;        // Frames measured at every step. 0 for 32, at least 2.
+    VmbUint32_t settle_frames; // Frames skipped after every exposure change, past the frames delivered before it. 0 for 3.
+    VmbUint32_t x;             // Horizontal offset of the measured region in the frames.
+    VmbUint32_t y;             // Vertical offset of the measured region in the frames.
+    VmbUint32_t width;         // Width of the measured region. 0 for the rest of the frame.
+    VmbUint32_t height;        // Height of the measured region. 0 for the rest of the frame.
+    VmbUint32_t threads;       // Maximum number of threads used to add a frame.
+    int timeout_ms;            // Time to wait for each frame in milliseconds. Negative values wait forever.
+} AlliedPtcConfig_t;
+
+/**
+ * @brief Measurement at one exposure time of a photon transfer sweep.
+ *
+ */
+typedef struct
+{
+    double exposure_us; // Exposure time, in us.
+    double mean;        // Mean level, in ADU.
+    double signal;      // Mean level above the offset, in ADU.
+    double variance;    // Temporal variance, in ADU^2.
+    double linearity;   // Deviation of the signal from the linear fit, in percent of the fit. 0 at and above saturation.
+    bool saturated;     // The step is at or above the full well, and is left out of the fits.
+} AlliedPtcPoint_t;
+
+/**
+ * @brief Photon transfer characterization.
+ *
+ */
+typedef struct
+{
+    VmbUint32_t count;                            // Number of steps measured.
+    AlliedPtcPoint_t points[ALLIED_PTC_MAX_STEPS]; // Measurements, by increasing exposure time.
+    double offset_adu;                            // Mean level at the shortest exposure time, in ADU.
+    double read_noise_adu;                        // Temporal noise at the shortest exposure time, in ADU.
+    double gain_e_per_adu;                        // System gain, in electrons per ADU.
+    double read_noise_e;                          // Read noise, in electrons.
+    double full_well_adu;                         // Signal at the peak of the temporal variance, in ADU.
+    double full_well_e;                           // Full well, in electrons.
+    double linearity_error;                       // Largest deviation from the linear fit below saturation, in percent.
+    double elapsed_s;                             // Duration of the sweep, in seconds.
+} AlliedPtcResult_t;
+
+/**
+ * @brief Run a photon transfer sweep. The camera must be capturing, under even and steady illumination, with auto-exposure off; the
+ * frames are taken through a queued subscription (see {@link allied_subscribe}). The exposure time is restored on return.
+ *
+ * @param handle Handle to Allied Vision camera.
+ * @param config Sweep configuration.
+ * @param result Pointer to store the characterization.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the configuration is out of range, `VmbErrorInvalidCall` if host-side auto-exposure is running, `VmbErrorTimeout` if a frame did not arrive in time, `VmbErrorNotAvailable` if the curve does not rise with the exposure time, otherwise an error code.
+ */
+VmbError_t allied_ptc_sweep(AlliedCameraHandle_t handle, const AlliedPtcConfig_t *_Nonnull config, AlliedPtcResult_t *_Nonnull result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALLIEDCAM_PTC_H_ */
@@ -0,0 +1,255 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_register.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Sub-pixel frame registration and shift-and-add stacking for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details Registration measures the shift of a frame against a reference frame over a reference region, e.g. around a star or a planet
+ * imaged through turbulence:
+ * - Phase correlation windows the region (Hann), transforms it with a radix-2 FFT whose plan (twiddles and bit reversal) is built once
+ *   with the registration, and locates the peak of the inverse transform of the normalized cross-power spectrum against the stored
+ *   spectrum of the reference. The spectrum is low-passed so that the peak is a Gaussian about one pixel wide, which a parabola through the
+ *   logarithms of its neighbours locates to a small fraction of a pixel on each axis. The frame is then measured again with its window
+ *   moved by the shift, so that the window does not pull the peak towards zero shift; each measurement is a pair of transforms of the
+ *   region. Frequencies where the regions hold little power are weighed down, so that smooth objects such as a defocused spot are located
+ *   without bias. The region must be a power of two on each side. Phase correlation works on any texture, and is insensitive to the
+ *   brightness of the frame.
+ * - Centroiding takes the center of mass of the region above its mean. It is cheaper and suits a single bright, compact object.
+ *
+ * The row transforms are split in bands and the column transforms in tiles of columns across the worker pool.
+ *
+ * A shift-and-add accumulator adds frames at their measured shifts into a float sum and a weight map, on a grid finer than the frames
+ * by an integer `scale`:
+ * - Bilinear interpolation samples each output pixel from the four nearest input pixels of the shifted frame.
+ * - Drizzle drops each input pixel, shrunk to `pixfrac` of its size, onto the output grid with weights equal to the overlap areas. The
+ *   weights are separable and the same for every pixel of a frame, so that they are computed once per frame.
+ *
+ * The result is the weighted mean of the frames that cover each output pixel. Rows are split in bands across the worker pool, and the row
+ * kernels are vectorized for every CPU level (see {@link alliedcam_cpu.h}). An accumulator can be fed from a camera with
+ * {@link allied_shiftadd_attach}, which registers and adds every frame on a thread of the accumulator.
+ *
+ * Shifts are in pixels of the frames, and are positive when the content of the frame moved right or down from the reference.
+ *
+ */
+
+#ifndef ALLIEDCAM_REGISTER_H_
+#define ALLIEDCAM_REGISTER_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "alliedcam_calib.h"
+
+/**
+ * @brief Handle to a registration, see {@link allied_register_create}.
+ *
+ */
+typedef struct allied_register_s *AlliedRegister_t;
+
+/**
+ * @brief Handle to a shift-and-add accumulator, see {@link allied_shiftadd_create}.
+ *
+ */
+typedef struct allied_shiftadd_s *AlliedShiftAdd_t;
+
+/**
+ * @brief Registration method.
+ *
+ */
+typedef enum
+{
+    AlliedRegisterPhase = 0, // Phase correlation. The region must be a power of two between 8 and 1024 on each side.
+    AlliedRegisterCentroid,  // Center of mass above the mean of the region.
+} AlliedRegisterMethod_t;
+
+/**
+ * @brief Registration configuration.
+ *
+ */
+typedef struct
+{
+    AlliedRegisterMethod_t method; // Registration method.
+    VmbUint32_t x;                 // Horizontal offset of the reference region in the frames.
+    VmbUint32_t y;                 // Vertical offset of the reference region in the frames.
+    VmbUint32_t width;             // Width of the reference region. 0 for the largest power of two (phase correlation) or the rest of the frame.
+    VmbUint32_t height;            // Height of the reference region. 0 for the largest power of two (phase correlation) or the rest of the frame.
+    double max_shift;              // Largest shift searched by phase correlation, in pixels. 0 for a quarter of the region.
+    VmbUint32_t threads;           // Maximum number of threads used to register a frame. 0 or 1 registers on the calling thread.
+} AlliedRegisterConfig_t;
+
+/**
+ * @brief Measured shift of a frame.
+ *
+ */
+typedef struct
+{
+    double dx;      // Horizontal shift, in pixels.
+    double dy;      // Vertical shift, in pixels.
+    double quality; // Height of the correlation peak between 0 and 1 for phase correlation, or contrast of the region (peak above mean over peak) for centroids.
+} AlliedShift_t;
+
+/**
+ * @brief Create a registration.
+ *
+ * @param reg Pointer to store the registration handle.
+ * @param geometry Geometry of the frames. The pixel format must be supported by the image kernels (see {@link allied_image_supported}).
+ * @param config Configuration. NULL for phase correlation over the largest centered power-of-two region.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the region is out of the frames or not a power of two, `VmbErrorNotSupported` if the pixel format is not supported, otherwise an error code.
+ */
+VmbError_t allied_register_create(AlliedRegister_t *_Nonnull reg, const AlliedCalibGeometry_t *_Nonnull geometry, const AlliedRegisterConfig_t *_Nullable config);
+
+/**
+ * @brief Destroy a registration.
+ *
+ * @param reg Registration handle, set to NULL on return.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_register_destroy(AlliedRegister_t *_Nonnull reg);
+
+/**
+ * @brief Set the reference frame.
+ *
+ * @param reg Registration handle.
+ * @param image Image of the frame geometry.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the image does not match the geometry, otherwise an error code.
+ */
+VmbError_t allied_register_set_reference(AlliedRegister_t _Nonnull reg, const AlliedImage_t *_Nonnull image);
+
+/**
+ * @brief Measure the shift of a frame against the reference.
+ *
+ * @param reg Registration handle.
+ * @param image Image of the frame geometry.
+ * @param shift Pointer to store the shift.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorInvalidCall` if no reference was set, `VmbErrorBadParameter` if the image does not match the geometry, `VmbErrorNotAvailable` if the region is flat, otherwise an error code.
+ */
+VmbError_t allied_register_measure(AlliedRegister_t _Nonnull reg, const AlliedImage_t *_Nonnull image, AlliedShift_t *_Nonnull shift);
+
+/**
+ * @brief Shift-and-add interpolation.
+ *
+ */
+typedef enum
+{
+    AlliedShiftAddBilinear = 0, // Bilinear interpolation of the shifted frame at every output pixel.
+    AlliedShiftAddDrizzle,      // Drizzle drops of `pixfrac` input pixels, weighted by their overlap with the output pixels.
+} AlliedShiftAddKernel_t;
+
+/**
+ * @brief Shift-and-add accumulator configuration.
+ *
+ */
+typedef struct
+{
+    AlliedShiftAddKernel_t kernel; // Interpolation.
+    VmbUint32_t scale;             // Output pixels per input pixel on each axis. 0 for 1, at most 4.
+    double pixfrac;                // Size of the drizzle drops, as a fraction of an input pixel. 0 for 1, at most 1.
+    double min_quality;            // Frames of an attached camera registered with a lower quality are not added. 0 to add every frame.
+    VmbUint32_t threads;           // Maximum number of threads used to add a frame. 0 or 1 adds on the calling thread.
+} AlliedShiftAddConfig_t;
+
+/**
+ * @brief Shift-and-add accumulator state.
+ *
+ */
+typedef struct
+{
+    VmbUint32_t width;   // Width of the result, in pixels.
+    VmbUint32_t height;  // Height of the result, in pixels.
+    VmbUint64_t frames;  // Frames added since the last reset.
+    VmbUint64_t skipped; // Frames of an attached camera not added because of their registration quality.
+    VmbUint64_t dropped; // Frames of an attached camera dropped because the subscription queue was full.
+    AlliedShift_t last;  // Shift of the last frame of an attached camera.
+    bool attached;       // The accumulator is fed from a camera.
+    VmbError_t error;    // Result of the last frame from the camera.
+} AlliedShiftAddStatus_t;
+
+/**
+ * @brief Create a shift-and-add accumulator.
+ *
+ * @param sa Pointer to store the accumulator handle.
+ * @param geometry Geometry of the frames. The pixel format must be supported by the image kernels (see {@link allied_image_supported}).
+ * @param config Configuration. NULL for bilinear interpolation at the frame resolution on the calling thread.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the configuration is out of range, `VmbErrorNotSupported` if the pixel format is not supported, otherwise an error code.
+ */
+VmbError_t allied_shiftadd_create(AlliedShiftAdd_t *_Nonnull sa, const AlliedCalibGeometry_t *_Nonnull geometry, const AlliedShiftAddConfig_t *_Nullable config);
+
+/**
+ * @brief Destroy a shift-and-add accumulator. The accumulator is detached from its camera first.
+ *
+ * @param sa Accumulator handle, set to NULL on return.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_shiftadd_destroy(AlliedShiftAdd_t *_Nonnull sa);
+
+/**
+ * @brief Add a frame at a shift.
+ *
+ * @param sa Accumulator handle.
+ * @param image Image of the frame geometry.
+ * @param shift Shift of the frame, e.g. from {@link allied_register_measure}.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the image does not match the geometry, otherwise an error code.
+ */
+VmbError_t allied_shiftadd_add(AlliedShiftAdd_t _Nonnull sa, const AlliedImage_t *_Nonnull image, const AlliedShift_t *_Nonnull shift);
+
+/**
+ * @brief Get the stacked image, `scale` times the frame size on each axis. Pixels not covered by any frame are 0.
+ *
+ * @param sa Accumulator handle.
+ * @param dst Destination of the weighted means. Can be NULL.
+ * @param weight Destination of the weight map, in frames for bilinear interpolation. Can be NULL.
+ * @param stride Bytes between the starts of consecutive rows of the destinations. 0 if the rows are packed.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the stride is too small, otherwise an error code.
+ */
+VmbError_t allied_shiftadd_result(AlliedShiftAdd_t _Nonnull sa, float *_Nullable dst, float *_Nullable weight, size_t stride);
+
+/**
+ * @brief Get the state of a shift-and-add accumulator.
+ *
+ * @param sa Accumulator handle.
+ * @param status Pointer to store the state.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_shiftadd_status(AlliedShiftAdd_t _Nonnull sa, AlliedShiftAddStatus_t *_Nonnull status);
+
+/**
+ * @brief Clear a shift-and-add accumulator.
+ *
+ * @param sa Accumulator handle.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_shiftadd_reset(AlliedShiftAdd_t _Nonnull sa);
+
+/**
+ * @brief Register and add the frames of a camera. Frames are taken through a queued subscription (see {@link allied_subscribe}) by a
+ * thread of the accumulator, registered, added and released. If the registration has no reference, the first frame becomes the
+ * reference. The registration must not be used otherwise until the accumulator is detached.
+ *
+ * @param sa Accumulator handle, not attached.
+ * @param reg Registration of the frame geometry.
+ * @param handle Handle to Allied Vision camera.
+ * @param subscription Subscription configuration. The callback is ignored. NULL for a queue of 4 frames that drops the newest frame when full.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorInvalidCall` if the accumulator is already attached, otherwise an error code.
+ */
+VmbError_t allied_shiftadd_attach(AlliedShiftAdd_t _Nonnull sa, AlliedRegister_t _Nonnull reg, AlliedCameraHandle_t handle, const AlliedSubscription_t *_Nullable subscription);
+
+/**
+ * @brief Stop feeding a shift-and-add accumulator from its camera. Must be called before the camera is closed.
+ *
+ * @param sa Accumulator handle.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_shiftadd_detach(AlliedShiftAdd_t _Nonnull sa);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALLIEDCAM_REGISTER_H_ */
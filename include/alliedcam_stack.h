@@ -0,0 +1,159 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_stack.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Sigma-clipped and percentile stacking with bounded memory for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details A robust stack combines any number of frames of one geometry into a float image that ignores cosmic rays, satellite trails and
+ * bad frames, in memory that does not grow with the number of frames (see {@link allied_stack_memory}):
+ * - The first `seed` frames are buffered. Each pixel is then sigma-clipped over the buffer, starting from the median and the MAD of its
+ *   samples, so that the first estimates are not pulled by outliers.
+ * - Sigma clipping keeps the running mean and variance (Welford) of the accepted samples of every pixel. Every later sample is accepted if it
+ *   is within `kappa` standard deviations of the running mean, and the result is the mean of the accepted samples.
+ * - Percentile stacking keeps a histogram of every pixel, centered on the median of the seed frames and `2 * range` seed standard deviations
+ *   wide (but no narrower than one ADU per bin); samples outside the range are counted in the end bins. Medians and other percentiles are
+ *   interpolated within their bin, so their error is at most half a bin width, unless the percentile falls in an end bin.
+ *
+ * Frames are added in one pass, with the rows split in bands across the worker pool. Sigma clipping is vectorized for every CPU level
+ * (see {@link alliedcam_cpu.h}); the histogram updates are scattered, one counter per pixel and frame.
+ *
+ */
+
+#ifndef ALLIEDCAM_STACK_H_
+#define ALLIEDCAM_STACK_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "alliedcam_calib.h"
+
+/**
+ * @brief Handle to a robust stack, see {@link allied_stack_create}.
+ *
+ */
+typedef struct allied_stack_s *AlliedStack_t;
+
+/**
+ * @brief Combination of the frames of a stack.
+ *
+ */
+typedef enum
+{
+    AlliedStackSigmaClip = 0, // Mean of the samples within `kappa` standard deviations of the running mean.
+    AlliedStackPercentile,    // Per-pixel histograms, from which any percentile (e.g. the median) is read.
+} AlliedStackMode_t;
+
+/**
+ * @brief Robust stack configuration.
+ *
+ */
+typedef struct
+{
+    AlliedStackMode_t mode; // Combination of the frames.
+    VmbUint32_t seed;       // Frames buffered to seed the per-pixel estimates. 0 for 16, at least 3.
+    double kappa;           // Clipping threshold, in standard deviations. 0 for 3.
+    VmbUint32_t iterations; // Clipping iterations over the seed frames. 0 for 3.
+    double min_sigma;       // Smallest standard deviation used for clipping, in ADU, so that noiseless pixels are not all rejected. 0 for 1.
+    VmbUint32_t bins;       // Histogram bins per pixel, for percentile stacking. 0 for 64, at least 4 and at most 1024.
+    double range;           // Half width of the histograms, in standard deviations of the seed frames. 0 for 6.
+    VmbUint32_t threads;    // Maximum number of threads used to add a frame. 0 or 1 adds on the calling thread.
+} AlliedStackConfig_t;
+
+/**
+ * @brief Robust stack state.
+ *
+ */
+typedef struct
+{
+    VmbUint32_t frames;   // Frames added.
+    bool seeded;          // The seed frames have been processed.
+    VmbUint64_t rejected; // Samples rejected by sigma clipping, or counted in the end bins of the histograms.
+    size_t memory;        // Bytes held by the stack.
+} AlliedStackStatus_t;
+
+/**
+ * @brief Get the memory a stack holds, whatever the number of frames.
+ *
+ * @param geometry Geometry of the frames.
+ * @param config Configuration. NULL for the defaults.
+ * @return size_t Bytes, 0 if the pixel format is not supported.
+ */
+size_t allied_stack_memory(const AlliedCalibGeometry_t *_Nonnull geometry, const AlliedStackConfig_t *_Nullable config);
+
+/**
+ * @brief Create a robust stack.
+ *
+ * @param stack Pointer to store the stack handle.
+ * @param geometry Geometry of the frames. The pixel format must be supported by the image kernels (see {@link allied_image_supported}).
+ * @param config Configuration. NULL for the defaults.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the configuration is out of range, `VmbErrorNotSupported` if the pixel format is not supported, otherwise an error code.
+ */
+VmbError_t allied_stack_create(AlliedStack_t *_Nonnull stack, const AlliedCalibGeometry_t *_Nonnull geometry, const AlliedStackConfig_t *_Nullable config);
+
+/**
+ * @brief Destroy a robust stack.
+ *
+ * @param stack Stack handle, set to NULL on return.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_stack_destroy(AlliedStack_t *_Nonnull stack);
+
+/**
+ * @brief Add an image to a stack.
+ *
+ * @param stack Stack handle.
+ * @param image Image of the size and pixel format of the stack geometry.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the image does not match the geometry, `VmbErrorInvalidCall` if a percentile stack holds 65535 frames, otherwise an error code.
+ */
+VmbError_t allied_stack_add(AlliedStack_t _Nonnull stack, const AlliedImage_t *_Nonnull image);
+
+/**
+ * @brief Add a captured frame to a stack. The offset of the frame is checked as well.
+ *
+ * @param stack Stack handle.
+ * @param frame Frame of the stack geometry.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code (see {@link allied_stack_add}).
+ */
+VmbError_t allied_stack_add_frame(AlliedStack_t _Nonnull stack, const VmbFrame_t *_Nonnull frame);
+
+/**
+ * @brief Get the stacked image. If fewer than `seed` frames were added, the buffered frames seed the estimates now, and frames added later
+ * are clipped or binned against them.
+ *
+ * @param stack Stack handle.
+ * @param percentile Percentile to read, between 0 and 100, for percentile stacks (50 for the median). Ignored for sigma clipping.
+ * @param dst Destination of `height` rows of `width` floats.
+ * @param stride Bytes between the starts of consecutive rows of the destination. 0 if the rows are packed.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorInvalidCall` if no frame was added, `VmbErrorBadParameter` if the percentile or stride is out of range, otherwise an error code.
+ */
+VmbError_t allied_stack_result(AlliedStack_t _Nonnull stack, double percentile, float *_Nonnull dst, size_t stride);
+
+/**
+ * @brief Get the state of a stack.
+ *
+ * @param stack Stack handle.
+ * @param status Pointer to store the state.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_stack_status(AlliedStack_t _Nonnull stack, AlliedStackStatus_t *_Nonnull status);
+
+/**
+ * @brief Clear a stack, to start over with the next frame.
+ *
+ * @param stack Stack handle.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_stack_reset(AlliedStack_t _Nonnull stack);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALLIEDCAM_STACK_H_ */
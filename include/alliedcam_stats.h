@@ -0,0 +1,138 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_stats.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Per-frame image statistics for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details The statistics stage computes the histogram, minimum, maximum, mean, standard deviation, percentiles and saturated pixel count
+ * of every delivered frame in a single pass over the image data, on the frame delivery thread, before the capture callback and the
+ * subscribers run. The results are stored with the frame, and every consumer of the frame reads them with {@link allied_frame_stats}
+ * instead of computing them again. The pass can be restricted to a region of interest, and is sub-sampled on a regular grid of
+ * `ALLIED_STATS_STEP` pixels by default: on a 2592x1944 Mono12 frame it takes about 0.9 ms, against 3.8 ms with 2x2 steps and
+ * 9 to 13 ms over every pixel (see `examples/benchmark.c`). Set the steps to 1 for exact statistics.
+ * Supported formats are the unpacked formats of {@link alliedcam_image.h}; other formats are delivered without statistics.
+ *
+ */
+
+#ifndef ALLIEDCAM_STATS_H_
+#define ALLIEDCAM_STATS_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "alliedcam_image.h"
+
+#ifndef ALLIED_STATS_BINS
+/**
+ * @brief Maximum number of histogram bins. Formats with more values than bins are histogrammed with the low bits dropped.
+ *
+ */
+#define ALLIED_STATS_BINS 4096
+#endif
+
+#ifndef ALLIED_STATS_STEP
+/**
+ * @brief Default sampling step, in both directions, of the statistics pass. Keeps the pass of a 5 MP frame under 1 ms.
+ *
+ */
+#define ALLIED_STATS_STEP 4
+#endif
+
+#ifndef ALLIED_STATS_PERCENTILES
+/**
+ * @brief Maximum number of percentiles computed per frame.
+ *
+ */
+#define ALLIED_STATS_PERCENTILES 8
+#endif
+
+/**
+ * @brief Statistics stage configuration.
+ *
+ */
+typedef struct
+{
+    VmbUint32_t roi_x;                            // Horizontal offset of the region, in pixels.
+    VmbUint32_t roi_y;                            // Vertical offset of the region, in pixels.
+    VmbUint32_t roi_width;                        // Width of the region in pixels. 0 to use the full frame.
+    VmbUint32_t roi_height;                       // Height of the region in pixels. 0 to use the full frame.
+    VmbUint32_t step_x;                           // Use every `step_x`-th pixel of a row. 0 for `ALLIED_STATS_STEP`, 1 to use every pixel.
+    VmbUint32_t step_y;                           // Use every `step_y`-th row. 0 for `ALLIED_STATS_STEP`, 1 to use every row.
+    VmbUint32_t saturation;                       // Pixels at or above this value are counted as saturated. 0 for the maximum value of the bit depth.
+    VmbUint32_t num_percentiles;                  // Number of entries in `percentiles`.
+    double percentiles[ALLIED_STATS_PERCENTILES]; // Percentiles to compute, in [0, 100].
+} AlliedStatsConfig_t;
+
+/**
+ * @brief Statistics of a frame. `histogram[i]` counts the pixels with `value >> shift == i`.
+ *
+ */
+typedef struct
+{
+    VmbUint64_t frame_id;                              // Frame ID of the frame.
+    VmbPixelFormat_t format;                           // Pixel format of the frame.
+    VmbUint32_t bits;                                  // Significant bits per pixel.
+    VmbUint64_t count;                                 // Number of pixels sampled.
+    VmbUint32_t min;                                   // Minimum pixel value.
+    VmbUint32_t max;                                   // Maximum pixel value.
+    double mean;                                       // Mean pixel value.
+    double stddev;                                     // Standard deviation of the pixel values.
+    VmbUint64_t saturated;                             // Number of sampled pixels at or above the saturation level.
+    VmbUint32_t num_percentiles;                       // Number of valid entries in `percentiles`.
+    VmbUint32_t percentiles[ALLIED_STATS_PERCENTILES]; // Pixel values at the configured percentiles, to the resolution of the histogram.
+    VmbUint32_t shift;                                 // Low bits dropped from the pixel values in the histogram.
+    VmbUint32_t bins;                                  // Number of histogram bins, `1 << (bits - shift)`.
+    VmbUint32_t histogram[ALLIED_STATS_BINS];          // Histogram of the sampled pixels.
+} AlliedFrameStats_t;
+
+/**
+ * @brief Compute the statistics of an image.
+ *
+ * @param image Image.
+ * @param config Region, sub-sampling and percentiles. NULL for the whole image at the default step and no percentiles.
+ * @param stats Statistics. `frame_id` is set to 0.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorNotSupported` if the pixel format is not supported, `VmbErrorInvalidValue` if the region does not fit in the image, otherwise an error code.
+ */
+VmbError_t allied_stats_compute(const AlliedImage_t *_Nonnull image, const AlliedStatsConfig_t *_Nullable config, AlliedFrameStats_t *_Nonnull stats);
+
+/**
+ * @brief Get a percentile from the histogram of a statistics record.
+ *
+ * @param stats Statistics.
+ * @param percentile Percentile, in [0, 100].
+ * @return VmbUint32_t Smallest pixel value (to the resolution of the histogram) with at least `percentile` percent of the sampled pixels at or below it.
+ */
+VmbUint32_t allied_stats_percentile(const AlliedFrameStats_t *_Nonnull stats, double percentile);
+
+/**
+ * @brief Enable the statistics stage of a camera. This function can be called while the camera is capturing; the configuration
+ * applies from the next delivered frame.
+ *
+ * @param handle Handle to Allied Vision camera.
+ * @param config Statistics configuration. Pass NULL to disable the stage.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_set_frame_stats(AlliedCameraHandle_t handle, const AlliedStatsConfig_t *_Nullable config);
+
+/**
+ * @brief Get the statistics of a frame. Valid only inside a capture or subscription callback, or while holding a reference.
+ * The statistics live with the frame, and are overwritten when the frame is captured again.
+ *
+ * @param frame Frame.
+ * @param stats Pointer to store the address of the statistics.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorNotAvailable` if no statistics were computed for the frame (or it was incomplete), `VmbErrorInvalidCall` if the frame is not currently held.
+ */
+VmbError_t allied_frame_stats(const VmbFrame_t *_Nonnull frame, const AlliedFrameStats_t *_Nullable *_Nonnull stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALLIEDCAM_STATS_H_ */
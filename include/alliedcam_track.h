@@ -0,0 +1,218 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_track.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Spot finding, and region of interest tracking for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details A spot finder locates bright spots, e.g. laser beams or stars, in a search region of an image, with sub-pixel centroids:
+ * - Connected components: pixels above a threshold are grouped in runs along the rows, and runs that touch (8-connectivity) are merged
+ *   with a union-find. Rows without any pixel above the threshold are skipped by a vectorized count (see {@link alliedcam_cpu.h}).
+ * - Windowed center of mass: every spot of the previous image is followed in a square window around its last position. The spots are
+ *   acquired with connected components when there are none to follow, and a spot is lost when its window holds no pixel above the
+ *   threshold it was acquired with. This touches only the windows.
+ * In both, the centroid weights every pixel by its value above the threshold; pixel centers are at integer coordinates.
+ *
+ * The tracking stage finds the spots of every delivered frame on the frame delivery thread, ahead of the capture callback, and moves the
+ * region of interest (`OffsetX` and `OffsetY`) so that the followed spot stays at a target position in the frame. The offsets are written by a
+ * controller thread, so that frame delivery never waits on the camera. Changing the offsets keeps the payload size, so the frames are not
+ * reallocated. Spots are measured in sensor coordinates, from the offsets each frame was exposed with, so frames delivered before an
+ * update took effect remain valid measurements. The stage reports the end-to-end latency of every update in frames: from the frame the
+ * update was computed from to the first frame delivered with the new offsets. Cameras that do not report the offsets of each frame
+ * (`VmbFrameFlagsOffset`) are measured with the offsets last written instead: frames delivered while an update is written, and the next
+ * `settle_frames` frames, are treated as stale and not measured, and the update completes with the first frame after them. Frames that were
+ * not received in full are not measured either.
+ *
+ * Stages and consumers bound to a region of interest (calibrations, defect maps, accumulators) no longer match frames once the region
+ * moves.
+ *
+ */
+
+#ifndef ALLIEDCAM_TRACK_H_
+#define ALLIEDCAM_TRACK_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "alliedcam_image.h"
+
+#ifndef ALLIED_TRACK_MAX_SPOTS
+/**
+ * @brief Largest number of spots reported by the tracking stage.
+ *
+ */
+#define ALLIED_TRACK_MAX_SPOTS 16
+#endif
+
+/**
+ * @brief Handle to a spot finder, see {@link allied_spot_finder_create}.
+ *
+ */
+typedef struct allied_spot_finder_s *AlliedSpotFinder_t;
+
+/**
+ * @brief Spot finding method.
+ *
+ */
+typedef enum
+{
+    AlliedSpotComponents = 0, // Threshold and connected components over the search region.
+    AlliedSpotWindow,         // Windowed center of mass around the spots of the previous image.
+} AlliedSpotMethod_t;
+
+/**
+ * @brief Spot finder configuration.
+ *
+ */
+typedef struct
+{
+    AlliedSpotMethod_t method; // Spot finding method.
+    VmbUint32_t x;             // Horizontal offset of the search region in the images.
+    VmbUint32_t y;             // Vertical offset of the search region in the images.
+    VmbUint32_t width;         // Width of the search region. 0 for the rest of the image.
+    VmbUint32_t height;        // Height of the search region. 0 for the rest of the image.
+    double threshold;          // Pixels above this value belong to spots, in ADU. 0 for automatic: `sigma` standard deviations above the mean of the region, or half way between the mean and the peak of each window.
+    double sigma;              // Automatic threshold of connected components, in standard deviations. 0 for 5.
+    VmbUint32_t min_pixels;    // Smallest spot, in pixels above the threshold. 0 for 3.
+    VmbUint32_t window;        // Side of the windows of the windowed center of mass, in pixels. 0 for 16.
+} AlliedSpotConfig_t;
+
+/**
+ * @brief Spot.
+ *
+ */
+typedef struct
+{
+    double x;           // Horizontal position of the centroid, in pixels.
+    double y;           // Vertical position of the centroid, in pixels.
+    double flux;        // Sum of the pixel values above the threshold, in ADU.
+    VmbUint32_t peak;   // Highest pixel value, in ADU.
+    VmbUint32_t pixels; // Pixels above the threshold.
+} AlliedSpot_t;
+
+/**
+ * @brief Create a spot finder.
+ *
+ * @param finder Pointer to store the finder handle.
+ * @param config Configuration. NULL for connected components over the whole image with an automatic threshold.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the configuration is out of range, otherwise an error code.
+ */
+VmbError_t allied_spot_finder_create(AlliedSpotFinder_t *_Nonnull finder, const AlliedSpotConfig_t *_Nullable config);
+
+/**
+ * @brief Destroy a spot finder.
+ *
+ * @param finder Finder handle, set to NULL on return.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_spot_finder_destroy(AlliedSpotFinder_t *_Nonnull finder);
+
+/**
+ * @brief Find the spots of an image, brightest (largest flux) first. The windowed center of mass follows the spots found by the previous call.
+ *
+ * @param finder Finder handle.
+ * @param image Image, of a pixel format supported by the image kernels (see {@link allied_image_supported}).
+ * @param offset_x Horizontal position of the image, added to the spot positions, e.g. the frame offset on the sensor.
+ * @param offset_y Vertical position of the image, added to the spot positions.
+ * @param spots Destination of the spots.
+ * @param capacity Largest number of spots to store, and to follow with the windowed center of mass.
+ * @param count Pointer to store the number of spots stored.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the search region is out of the image, `VmbErrorNotSupported` if the pixel format is not supported, otherwise an error code.
+ */
+VmbError_t allied_spot_find(AlliedSpotFinder_t _Nonnull finder, const AlliedImage_t *_Nonnull image, VmbUint32_t offset_x, VmbUint32_t offset_y,
+                            AlliedSpot_t *_Nonnull spots, VmbUint32_t capacity, VmbUint32_t *_Nonnull count);
+
+/**
+ * @brief Forget the spots followed by the windowed center of mass, so that the next call acquires them again.
+ *
+ * @param finder Finder handle.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_spot_finder_reset(AlliedSpotFinder_t _Nonnull finder);
+
+/**
+ * @brief Point of the spots held at the target.
+ *
+ */
+typedef enum
+{
+    AlliedTrackBrightest = 0, // The brightest spot.
+    AlliedTrackMean,          // The flux-weighted mean position of the spots.
+} AlliedTrackFollow_t;
+
+/**
+ * @brief Tracking configuration.
+ *
+ */
+typedef struct
+{
+    AlliedSpotConfig_t spots;   // Spot finder configuration. The search region is relative to the frames, and moves with them.
+    VmbUint32_t max_spots;      // Largest number of spots found per frame. 0 for 1, at most `ALLIED_TRACK_MAX_SPOTS`.
+    AlliedTrackFollow_t follow; // Point held at the target.
+    double target_x;            // Horizontal position in the frame at which the point is held, in pixels. Negative for the center of the frame.
+    double target_y;            // Vertical position in the frame at which the point is held, in pixels. Negative for the center of the frame.
+    double deadband;            // Distance of the point from the target below which the region is not moved, in pixels. 0 for 1.
+    double damping;             // Fraction of the distance corrected in one update, in (0, 1]. 0 for 1.
+    bool measure_only;          // Find and report the spots, without moving the region.
+    VmbUint32_t settle_frames;  // Frames delivered after an update is written that may still have been exposed with the previous offsets. Only used if the camera does not report the offsets of each frame. Typically 1 to 3, depending on the camera.
+} AlliedTracking_t;
+
+/**
+ * @brief Tracking state.
+ *
+ */
+typedef struct
+{
+    bool enabled;                               // Tracking is running.
+    bool locked;                                // Spots were found in the last measured frame.
+    VmbUint64_t frame_id;                       // Frame ID of the last measured frame.
+    VmbUint32_t count;                          // Spots found in the last measured frame.
+    AlliedSpot_t spots[ALLIED_TRACK_MAX_SPOTS]; // Spots of the last measured frame, in sensor coordinates (after binning).
+    double x;                                   // Horizontal position of the followed point, in sensor coordinates.
+    double y;                                   // Vertical position of the followed point, in sensor coordinates.
+    VmbUint32_t offset_x;                       // Horizontal offset last written by the stage.
+    VmbUint32_t offset_y;                       // Vertical offset last written by the stage.
+    VmbUint64_t measured;                       // Frames measured.
+    VmbUint64_t lost;                           // Frames measured without any spot.
+    VmbUint64_t stale;                          // Frames not measured because their offsets were not known, see `settle_frames`.
+    VmbUint64_t incomplete;                     // Frames not measured because they were not received in full.
+    VmbUint64_t updates;                        // Offset updates written to the camera.
+    VmbUint32_t latency_frames;                 // Frames from the frame the last completed update was computed from to the first frame delivered with its offsets.
+    double mean_latency_frames;                 // Mean of `latency_frames` over the completed updates.
+    double latency_ms;                          // Time from the delivery of the frame the last completed update was computed from to the delivery of the first frame with its offsets.
+    double update_ms;                           // Time taken by the last offset write.
+    double measure_ms;                          // Time taken to find the spots of the last measured frame, on the delivery thread.
+    VmbError_t error;                           // Result of the last offset write.
+} AlliedTrackingStatus_t;
+
+/**
+ * @brief Enable or reconfigure tracking. This function can be called while the camera is capturing. The offset range and increment are
+ * read when tracking is enabled; call it again after changing the binning. Offsets must be writable while the camera is capturing for the
+ * region to move; otherwise the write errors are reported in the status.
+ *
+ * @param handle Handle to Allied Vision camera.
+ * @param config Tracking configuration. Pass NULL to disable tracking.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBadParameter` if the configuration is out of range, otherwise an error code.
+ */
+VmbError_t allied_set_tracking(AlliedCameraHandle_t handle, const AlliedTracking_t *_Nullable config);
+
+/**
+ * @brief Get the tracking state.
+ *
+ * @param handle Handle to Allied Vision camera.
+ * @param status Tracking state.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_get_tracking_status(AlliedCameraHandle_t handle, AlliedTrackingStatus_t *_Nonnull status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALLIEDCAM_TRACK_H_ */
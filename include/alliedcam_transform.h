@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_transform.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Pixel format conversion with VmbImageTransform for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details A transform converts frames to one output pixel format, with optional debayering mode, color correction matrix and gamma.
+ * The `VmbImage` descriptors and the `VmbTransformInfo` parameters are built once for every input format and frame size (the transform plan),
+ * and reused for every frame of that format and size. Converted images are written to a pool of output buffers owned by the transform.
+ * Programs using a transform must link with `-lVmbImageTransform`.
+ *
+ */
+
+#ifndef ALLIEDCAM_TRANSFORM_H_
+#define ALLIEDCAM_TRANSFORM_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "alliedcam.h"
+#include <stddef.h>
+#include <VmbImageTransform/VmbTransformTypes.h>
+
+#ifndef ALLIED_TRANSFORM_PLANS
+/**
+ * @brief Number of transform plans cached by a transform. The least recently used plan is rebuilt when a new format or size arrives.
+ *
+ */
+#define ALLIED_TRANSFORM_PLANS 8
+#endif
+
+#ifndef ALLIED_TRANSFORM_BAND_ROWS
+/**
+ * @brief Rows converted at a time by each thread of a multi-threaded conversion.
+ *
+ */
+#define ALLIED_TRANSFORM_BAND_ROWS 128
+#endif
+
+#ifndef ALLIED_TRANSFORM_BUFFERS
+/**
+ * @brief Default number of output buffers of a transform.
+ *
+ */
+#define ALLIED_TRANSFORM_BUFFERS 4
+#endif
+
+/**
+ * @brief Handle to a pixel format transform, see {@link allied_transform_create}.
+ *
+ */
+typedef struct allied_transform_s *AlliedTransform_t;
+
+/**
+ * @brief Transform options.
+ *
+ */
+typedef struct
+{
+    VmbPixelFormat_t format;  // Output pixel format, e.g. `VmbPixelFormatRgb8`.
+    VmbDebayerMode_t debayer; // Debayering mode for Bayer inputs.
+    bool color_matrix;        // Apply `matrix`.
+    VmbFloat_t matrix[9];     // Color correction matrix, row major.
+    VmbFloat_t gamma;         // Gamma correction. 0 to disable.
+    VmbUint32_t buffers;      // Number of output buffers. 0 for `ALLIED_TRANSFORM_BUFFERS`.
+    VmbUint32_t threads;      // Maximum number of threads to use. 0 or 1 converts on the calling thread.
+} AlliedTransformOptions_t;
+
+/**
+ * @brief Converted image. The image data belongs to the transform until it is handed back with {@link allied_transform_release}.
+ *
+ */
+typedef struct
+{
+    void *data;              // Converted image data.
+    size_t size;             // Size of the image data in bytes.
+    VmbUint32_t width;       // Width in pixels.
+    VmbUint32_t height;      // Height in pixels.
+    VmbPixelFormat_t format; // Pixel format.
+    VmbUint64_t frame_id;    // Frame ID of the source frame.
+    VmbUint64_t timestamp;   // Timestamp of the source frame.
+    VmbUint32_t buffer;      // Index of the output buffer. DO NOT modify.
+} AlliedTransformOutput_t;
+
+/**
+ * @brief Create a transform.
+ *
+ * @param transform Pointer to store the transform handle.
+ * @param opts Transform options.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_transform_create(AlliedTransform_t *_Nonnull transform, const AlliedTransformOptions_t *_Nonnull opts);
+
+/**
+ * @brief Destroy a transform and free its output buffers. All outputs must have been released.
+ *
+ * @param transform Transform handle, set to NULL on return.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBusy` if an output is still held, otherwise an error code.
+ */
+VmbError_t allied_transform_destroy(AlliedTransform_t *_Nonnull transform);
+
+/**
+ * @brief Convert the image data of a frame to the output format of the transform.
+ *
+ * @details Conversions on the same transform are serialized. Bayer inputs converted on several threads are split into bands that overlap
+ * by a few rows, so the result matches a single-threaded conversion for `VmbDebayerMode2x2` and `VmbDebayerMode3x3`.
+ *
+ * @param transform Transform handle.
+ * @param frame Frame to convert.
+ * @param output Converted image. Must be released with {@link allied_transform_release}.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorBusy` if all output buffers are held, `VmbErrorNotImplemented` if the conversion is not available, otherwise an error code.
+ */
+VmbError_t allied_transform_frame(AlliedTransform_t _Nonnull transform, const VmbFrame_t *_Nonnull frame, AlliedTransformOutput_t *_Nonnull output);
+
+/**
+ * @brief Hand a converted image back to the transform.
+ *
+ * @param transform Transform handle.
+ * @param output Converted image, cleared on return.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_transform_release(AlliedTransform_t _Nonnull transform, AlliedTransformOutput_t *_Nonnull output);
+
+/**
+ * @brief Get the number of transform plans built so far. Every plan is a full `VmbImage`/`VmbTransformInfo` setup.
+ *
+ * @param transform Transform handle.
+ * @return VmbUint64_t Number of plans built.
+ */
+VmbUint64_t allied_transform_plans_built(AlliedTransform_t _Nonnull transform);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALLIEDCAM_TRANSFORM_H_ */
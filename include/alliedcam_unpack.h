@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_unpack.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Unpacking of packed monochrome pixel formats for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef ALLIEDCAM_UNPACK_H_
+#define ALLIEDCAM_UNPACK_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "alliedcam.h"
+#include <stddef.h>
+
+/**
+ * @brief Placement of the unpacked pixel value in the 16-bit output.
+ *
+ */
+typedef enum
+{
+    AlliedUnpackLsb = 0, // Value in the low bits, e.g. 0..4095 for 12-bit pixels.
+    AlliedUnpackMsb,     // Value in the high bits, e.g. 0..65520 for 12-bit pixels.
+} AlliedUnpackAlign_t;
+
+/**
+ * @brief Check if a pixel format can be unpacked with {@link allied_unpack}.
+ * Supported formats are `VmbPixelFormatMono10p`, `VmbPixelFormatMono12p` and `VmbPixelFormatMono12Packed`.
+ *
+ * @param format Pixel format.
+ * @return true
+ * @return false
+ */
+bool allied_unpack_supported(VmbPixelFormat_t format);
+
+/**
+ * @brief Unpack packed monochrome pixels into 16-bit pixels.
+ *
+ * @details The shift is applied on top of the alignment, in the same pass: the output is the aligned value shifted left by `shift` bits,
+ * or right by `-shift` bits if `shift` is negative. For example, {@link AlliedUnpackLsb} with a shift of -4 reduces 12-bit pixels to 8 significant bits.
+ *
+ * @param format Pixel format of the source.
+ * @param src Packed pixels.
+ * @param src_size Size of the source, in bytes. Must hold at least `count` pixels.
+ * @param dst Destination, at least `count` pixels.
+ * @param count Number of pixels to unpack.
+ * @param align Placement of the value in the 16-bit output.
+ * @param shift Additional shift. The shifted value must fit in 16 bits.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorNotSupported` for unsupported formats, otherwise an error code.
+ */
+VmbError_t allied_unpack(VmbPixelFormat_t format, const void *_Nonnull src, size_t src_size, VmbUint16_t *_Nonnull dst, size_t count, AlliedUnpackAlign_t align, int shift);
+
+/**
+ * @brief Unpack the image data of a frame into 16-bit pixels. See {@link allied_unpack}.
+ *
+ * @param frame Frame in a packed monochrome pixel format.
+ * @param dst Destination.
+ * @param count Size of the destination in pixels, at least `width * height`.
+ * @param align Placement of the value in the 16-bit output.
+ * @param shift Additional shift. The shifted value must fit in 16 bits.
+ * @return VmbError_t `VmbErrorSuccess` if successful, `VmbErrorMoreData` if the destination is too small, otherwise an error code.
+ */
+VmbError_t allied_unpack_frame(const VmbFrame_t *_Nonnull frame, VmbUint16_t *_Nonnull dst, size_t count, AlliedUnpackAlign_t align, int shift);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALLIEDCAM_UNPACK_H_ */
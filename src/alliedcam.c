@@ -12,12 +12,28 @@
  */
 
 #include "alliedcam.h"
+#include "alliedcam_numa.h"
+#include "alliedcam_dispatch.h"
+#include "alliedcam_histogram.h"
+#include "alliedcam_exposure.h"
+#include "alliedcam_calib.h"
+#include "alliedcam_darklib.h"
+#include "alliedcam_defects.h"
+#include "alliedcam_track.h"
+#include "alliedcam_beam.h"
+#include "alliedcam_photometry.h"
+#include "alliedcam_change.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <assert.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include <VmbC/VmbC.h>
 
@@ -37,6 +53,10 @@
 #define CONTEXT_CB_HANDLE 2
 #endif // !CONTEXT_CB_HANDLE
 
+#ifndef CONTEXT_SLOT_HANDLE
+#define CONTEXT_SLOT_HANDLE 3
+#endif // !CONTEXT_SLOT_HANDLE
+
 // Turn off assert checking in release mode
 #if (!defined(ALLIED_DEBUG) || ALLIED_DEBUG == 0)
 #define NDEBUG
@@ -121,27 +141,322 @@ static void shutdown_atexit()
     })
 #endif
 
+typedef struct frame_slot_s
+{
+    atomic_uint refs;               // references held on the frame, requeued when this drops to 0
+    atomic_uint generation;         // bumped when the last reference is dropped, invalidates AlliedFrameRef_t
+    AlliedFrameStats_t *stats;      // statistics of the frame, allocated with the frame slots
+    atomic_bool stats_valid;        // statistics were computed for the current capture, published after them
+    AlliedImage_t calib;            // calibrated image, its buffer is allocated with the calibration, see allied_calib_reserve
+    size_t calib_alloc;             // size of the calibrated image buffer
+    bool calib_valid;               // the frame was calibrated for the current capture
+    AlliedBeamProfile_t *beam;      // beam profile of the frame, followed by its projections, allocated with the stage, see allied_beam_reserve
+    size_t beam_alloc;              // size of the beam profile allocation
+    bool beam_valid;                // the frame was profiled for the current capture
+    AlliedPhotometryRecord_t *phot; // photometry of the frame, followed by its fluxes, allocated with the stage, see allied_phot_reserve
+    size_t phot_alloc;              // size of the photometry allocation
+    bool phot_valid;                // the frame was measured for the current capture
+    AlliedChangeResult_t change;    // change detection result of the frame
+    bool change_valid;              // the frame was compared to the background for the current capture
+} AlliedFrameSlot_s;
+
 typedef struct framebuffer_s
 {
-    size_t alloc_size;  // how much memory is allocated, used for hard realloc
-    size_t alignment;   // realloc on alignment change
-    size_t num_frames;  // changes with bpp or size change
-    VmbUchar_t *buffer; // the actual buffer that is split into frames
-    VmbFrame_t *frames; // vmb frames
-    bool announced;     // if the frames are announced
-    bool queued;        // if the frames are queued for capture, this is set to true after all the frames are queued
+    size_t alloc_size;        // how much memory is allocated, used for hard realloc
+    size_t alignment;         // realloc on alignment change
+    size_t num_frames;        // changes with bpp or size change
+    size_t stride;            // bytes between frames, page rounded when the frame guard is on
+    VmbUchar_t *buffer;       // the actual buffer that is split into frames
+    VmbFrame_t *frames;       // vmb frames
+    AlliedFrameSlot_s *slots; // per-frame bookkeeping
+    bool announced;           // if the frames are announced
+    bool queued;              // if the frames are queued for capture, this is set to true after all the frames are queued
+    bool mapped;              // if the buffer was mapped on a NUMA node
+    int numa_node;            // NUMA node the buffer was allocated on, realloc on node change
 } AlliedFrameBuffer_s;
 
 typedef AlliedFrameBuffer_s *AlliedFrameBuffer_t;
 
+typedef struct frame_gate_s
+{
+    AlliedDecimation_t config; // decimation configuration
+    VmbUint64_t count;         // frames seen since the configuration was applied
+    double last_ms;            // time of the last delivered frame
+    double tokens;             // leaky bucket fill
+} AlliedFrameGate_s;
+
+typedef struct
+{
+    AlliedFrameGate_s gate;         // owned by the delivery thread
+    AlliedDecimation_t next;        // configuration to apply, protected by lock
+    atomic_bool dirty;              // next has to be applied
+    pthread_mutex_t lock;           // protects next
+    atomic_uint_fast64_t delivered; // frames passed to the callback
+    atomic_uint_fast64_t skipped;   // frames dropped by the gate
+} AlliedDecimator_s;
+
+typedef struct
+{
+    VmbUint32_t depth;    // released frames held back from the driver, 0 to disable the guard
+    size_t page;          // page size, frames are page aligned when the guard is on
+    VmbFrame_t **ring;    // protected frames, oldest first
+    VmbUint32_t head;     // index of the oldest protected frame
+    VmbUint32_t count;    // number of protected frames
+    pthread_mutex_t lock; // protects the ring
+} AlliedFrameGuard_s;
+
+typedef struct
+{
+    AlliedStatsConfig_t config; // owned by the delivery thread
+    bool enabled;               // owned by the delivery thread
+    VmbUint32_t *scratch;       // per-lane histograms, allocated when the stage is first enabled, owned by the delivery thread
+    AlliedStatsConfig_t next;   // configuration to apply, protected by lock
+    bool next_enabled;          // stage state to apply, protected by lock
+    atomic_bool dirty;          // next has to be applied
+    pthread_mutex_t lock;       // protects next
+} AlliedStatsStage_s;
+
+typedef struct
+{
+    AlliedBeamConfig_t config; // owned by the delivery thread
+    bool enabled;              // owned by the delivery thread
+    AlliedBeamConfig_t next;   // configuration to apply, protected by lock
+    bool next_enabled;         // stage state to apply, protected by lock
+    atomic_bool dirty;         // next has to be applied
+    pthread_mutex_t lock;      // protects next
+} AlliedBeamStage_s;
+
+typedef struct
+{
+    AlliedPhotometry_t phot;          // engine, owned by the delivery thread
+    AlliedPhotometry_t next;          // engine to apply, then the engine it replaced until the next configuration, protected by lock
+    size_t size;                      // bytes of a record of the last configured engine, protected by lock
+    AlliedPhotometryRecord_t **spare; // records of `size` bytes by frame slot, swapped in by the delivery thread, protected by lock
+    VmbUint32_t spares;               // length of spare, protected by lock
+    atomic_bool dirty;                // next has to be applied
+    pthread_mutex_t lock;             // protects next
+} AlliedPhotStage_s;
+
+typedef struct
+{
+    AlliedChangeDetector_t det;      // detector, owned by the delivery thread
+    VmbUint32_t pre;                 // frames of the preceding window, owned by the delivery thread
+    VmbUint32_t post;                // frames of the following window, owned by the delivery thread
+    VmbFrame_t **held;               // frames held back for the preceding window, `pre` entries, owned by the delivery thread
+    VmbUint32_t head;                // index of the oldest held frame
+    VmbUint32_t count;               // number of held frames
+    VmbUint32_t remaining;           // frames left in the following window
+    bool forwarding;                 // the previous frame was forwarded
+    VmbUint32_t offset[2];           // offsets of the modeled frames, the model is dropped when they move
+    AlliedChangeDetector_t next;     // detector to apply, protected by lock
+    VmbUint32_t next_pre;            // preceding window to apply, protected by lock
+    VmbUint32_t next_post;           // following window to apply, protected by lock
+    VmbFrame_t **next_held;          // held frame ring to apply, protected by lock
+    atomic_bool dirty;               // next has to be applied
+    atomic_bool enabled;             // change detection is enabled
+    atomic_uint_fast64_t frames;     // frames compared
+    atomic_uint_fast64_t changed;    // frames that changed
+    atomic_uint_fast64_t forwarded;  // frames handed to the change subscribers
+    atomic_uint_fast64_t events;     // runs of forwarded frames
+    atomic_uint_fast64_t incomplete; // frames not compared because they were not received in full
+    pthread_mutex_t lock;            // protects next
+} AlliedChangeStage_s;
+
+typedef struct
+{
+    double exposure_min; // shortest exposure time, in us
+    double exposure_max; // longest exposure time, in us
+    double gain_min;     // lowest gain, in dB
+    double gain_max;     // highest gain, in dB
+} AlliedExposureLimits_s;
+
+typedef struct
+{
+    VmbUint64_t frame_id; // frame the measurement was taken on
+    double level;         // percentile, as a fraction of full scale
+    double saturated;     // fraction of saturated pixels
+} AlliedExposureMeasure_s;
+
+typedef struct
+{
+    AlliedAutoExposure_t config;       // owned by the delivery thread
+    bool enabled;                      // owned by the delivery thread
+    VmbUint32_t *scratch;              // per-lane histograms, allocated when the stage is first enabled, owned by the delivery thread
+    AlliedFrameStats_t *stats;         // metering statistics, allocated with scratch, owned by the delivery thread
+    AlliedAutoExposure_t next;         // configuration to apply, protected by lock
+    bool next_enabled;                 // stage state to apply, protected by lock
+    atomic_bool dirty;                 // next has to be applied
+    AlliedExposureLimits_s limits;     // resolved exposure and gain limits, protected by lock
+    AlliedExposureMeasure_s measure;   // measurement handed to the controller, protected by lock
+    bool measured;                     // measure has not been taken by the controller, protected by lock
+    atomic_bool pending;               // a measurement is queued or being acted on, frames are not measured
+    atomic_uint_fast64_t last_id;      // frame ID of the last delivered frame
+    atomic_uint_fast64_t stale_until;  // frames up to this ID may have been exposed with outdated settings
+    atomic_uint_fast64_t stale;        // frames not measured because they may be outdated
+    atomic_uint_fast64_t incomplete;   // frames not measured because they are incomplete
+    atomic_uint_fast64_t count;        // frames measured
+    AlliedAutoExposureStatus_t status; // controller state, protected by lock
+    VmbUint64_t since_id;              // frame ID at the last loss of convergence, protected by lock
+    double since_ms;                   // time of the last loss of convergence, protected by lock
+    pthread_t thread;                  // controller thread
+    bool running;                      // controller thread is running
+    bool quit;                         // controller thread has to exit, protected by lock
+    pthread_cond_t wake;               // signaled when a measurement is queued or the controller has to exit
+    pthread_mutex_t lock;              // protects the controller state
+} AlliedExposureStage_s;
+
+typedef struct
+{
+    AlliedCalibration_t calib;      // installed calibration, protected by lock
+    AlliedCalibGeometry_t geometry; // geometry of the calibration, protected by lock
+    size_t size;                    // bytes of a calibrated frame, protected by lock
+    VmbUchar_t **spare;             // calibrated image buffers of `size` bytes by frame slot, swapped in by the delivery thread, protected by lock
+    VmbUint32_t spares;             // length of spare, protected by lock
+    bool busy;                      // the delivery thread is calibrating a frame, protected by lock
+    atomic_bool enabled;            // a calibration is installed
+    pthread_cond_t idle;            // signaled when the delivery thread is done with a frame
+    pthread_mutex_t lock;           // protects the installed calibration
+} AlliedCalibStage_s;
+
+typedef struct
+{
+    AlliedDarkLibrary_t library;       // library the darks are made from
+    AlliedDarkTracking_t config;       // tracking configuration, flat points to the copy below
+    AlliedMaster_t flat;               // copy of the master flat, owned
+    AlliedCalibration_t calib;         // calibration made from the library, owned by the telemetry thread
+    AlliedDarkQuery_t tried;           // conditions of the last attempt to make a dark, owned by the telemetry thread
+    bool attempted;                    // tried is set, owned by the telemetry thread
+    VmbUint32_t entries;               // library entries at the last attempt, owned by the telemetry thread
+    AlliedDarkTrackingStatus_t status; // tracking state, protected by lock
+    pthread_t thread;                  // telemetry thread
+    bool running;                      // telemetry thread is running
+    bool quit;                         // telemetry thread has to exit, protected by lock
+    pthread_cond_t wake;               // signaled when the telemetry thread has to exit
+    pthread_mutex_t lock;              // protects the tracking state
+} AlliedDarkStage_s;
+
+typedef struct
+{
+    AlliedDefectDetector_t detector;   // detector of the current geometry, protected by detector_lock
+    AlliedCalibGeometry_t geometry;    // geometry of the detector, protected by detector_lock
+    AlliedDefectDetection_t detection; // detection configuration, protected by lock
+    atomic_bool detect;                // defects are detected
+    VmbUint64_t config_id;             // incremented when the configuration changes, protected by lock
+    AlliedCalibGeometry_t want;        // geometry the worker has to make a detector for, protected by lock
+    bool wanted;                       // a detector has to be made for want, protected by lock
+    bool build;                        // a detection pass completed and its map has to be made, protected by lock
+    atomic_bool enabled;               // defect correction is enabled
+    AlliedDefectMap_t map;             // map frames are corrected with, protected by lock
+    atomic_uint_fast32_t passes;       // detection passes over the current geometry
+    atomic_uint_fast64_t corrected;    // frames corrected
+    atomic_uint_fast64_t incomplete;   // frames not sampled because they were not received in full
+    pthread_t thread;                  // worker thread, which makes the detectors and maps
+    bool running;                      // worker thread is running
+    bool quit;                         // worker thread has to exit, protected by lock
+    pthread_cond_t wake;               // signaled when the worker has work or has to exit
+    pthread_mutex_t detector_lock;     // held while the detector is used, only tried by the delivery thread, taken before lock
+    pthread_mutex_t lock;              // held while a frame is corrected, so that the map is not swapped under the delivery thread
+} AlliedDefectStage_s;
+
+typedef struct
+{
+    VmbInt64_t min[2];       // smallest offsets, horizontal and vertical
+    VmbInt64_t max[2];       // largest offsets at the frame size, aligned to the increments
+    VmbInt64_t increment[2]; // offset increments
+    VmbInt64_t size[2];      // frame width and height
+} AlliedTrackLimits_s;
+
+typedef struct
+{
+    VmbUint64_t frame_id; // frame the measurement was taken on
+    double time_ms;       // delivery time of the frame
+    double x;             // horizontal position of the followed point, in sensor coordinates
+    double y;             // vertical position of the followed point, in sensor coordinates
+} AlliedTrackMeasure_s;
+
+typedef struct
+{
+    AlliedTracking_t config;           // owned by the delivery thread
+    bool enabled;                      // owned by the delivery thread
+    AlliedSpotFinder_t finder;         // finder of the current configuration, owned by the delivery thread
+    AlliedTracking_t next;             // configuration to apply, protected by lock
+    AlliedSpotFinder_t next_finder;    // finder to apply, protected by lock
+    bool next_enabled;                 // stage state to apply, protected by lock
+    atomic_bool dirty;                 // next has to be applied
+    AlliedTrackLimits_s limits;        // offset limits, protected by lock
+    AlliedTrackMeasure_s measure;      // measurement handed to the controller, protected by lock
+    bool measured;                     // measure has not been taken by the controller, protected by lock
+    VmbInt64_t await[2];               // offsets of the last update, protected by lock
+    AlliedTrackMeasure_s await_from;   // measurement the last update was computed from, protected by lock
+    atomic_bool awaiting;              // no frame with the offsets of the last update was delivered yet
+    atomic_bool writing;               // the controller is writing offsets to the camera
+    atomic_uint_fast64_t last_id;      // ID of the last delivered frame
+    atomic_uint_fast64_t settle_until; // frames up to this ID may have been exposed with the offsets before the last update
+    double latency_sum;                // sum of the update latencies in frames, protected by lock
+    VmbUint64_t latencies;             // completed updates, protected by lock
+    AlliedTrackingStatus_t status;     // tracking state, protected by lock
+    pthread_t thread;                  // controller thread
+    bool running;                      // controller thread is running
+    bool quit;                         // controller thread has to exit, protected by lock
+    pthread_cond_t wake;               // signaled when a measurement is queued or the controller has to exit
+    pthread_mutex_t lock;              // protects the controller state
+} AlliedTrackStage_s;
+
+struct allied_subscriber_s
+{
+    struct camera_handle_s *camera; // camera the subscription belongs to
+    AlliedFrameCallback callback;   // callback, NULL for queued subscriptions
+    void *user_data;                // user data for the callback
+    AlliedBackpressure_t policy;    // behavior on a full queue
+    VmbUint32_t roi[4];             // crop view: x, y, width, height
+    AlliedDecimator_s decimator;    // per-subscriber decimation
+    bool changes_only;              // receives the frames forwarded by the change detection stage only
+    AlliedFrameView_t *queue;       // ring buffer of frame views
+    VmbUint32_t depth;              // ring buffer size
+    VmbUint32_t head;               // index of the oldest queued frame
+    VmbUint32_t count;              // number of queued frames
+    pthread_mutex_t qlock;          // protects the queue
+    pthread_cond_t nonempty;        // signaled when a frame is queued
+    pthread_cond_t nonfull;         // signaled when a frame is popped
+    pthread_cond_t idle;            // signaled when the last fan-out lets go of the subscriber
+    VmbUint32_t pins;               // fan-outs delivering to the subscriber, protected by qlock
+    bool reap;                      // unsubscribed from a callback, freed when the fan-out lets go of it, protected by qlock
+    atomic_bool closing;            // unsubscribe in progress
+    atomic_uint_fast64_t dropped;   // frames dropped on a full queue
+    struct allied_subscriber_s *next;
+    struct allied_subscriber_s *fan_next; // next subscriber of the running fan-out, owned by the frame delivery thread
+};
+
 typedef struct camera_handle_s
 {
     VmbHandle_t handle;
     bool acquiring;
     bool streaming;
     AlliedFrameBuffer_t framebuf;
+    AlliedTopology_t topo;            // host topology of the camera connection
+    int numa_node;                    // NUMA node for the frame buffer and delivery thread, -1 to disable placement
+    atomic_uint_fast32_t binning;     // binning factor of the frames, kept by allied_set_binning_factor
+    AlliedDecimator_s decimator;      // host-side decimation ahead of the capture callback
+    pthread_rwlock_t subs_lock;       // protects the subscriber list
+    struct allied_subscriber_s *subs; // frame subscribers
+    AlliedFrameGuard_s guard;         // use-after-release detection
+    AlliedStatsStage_s stats;         // per-frame statistics ahead of the capture callback
+    AlliedBeamStage_s beam;           // per-frame beam profile ahead of the capture callback
+    AlliedPhotStage_s photometry;     // per-frame aperture photometry ahead of the capture callback
+    AlliedChangeStage_s change;       // change detection gating the change subscribers
+    AlliedExposureStage_s exposure;   // host-side auto-exposure
+    AlliedCalibStage_s calib;         // dark, bias and flat-field calibration ahead of the capture callback
+    AlliedDarkStage_s dark;           // dark library tracking the camera telemetry
+    AlliedDefectStage_s defects;      // defective pixel detection and correction ahead of every other stage
+    AlliedTrackStage_s tracking;      // spot tracking driving the region of interest
 } _AlliedCameraHandle_s;
 
+/**
+ * @brief Camera whose subscribers the current thread is delivering a frame to.
+ *
+ */
+static _Thread_local struct camera_handle_s *fanout_camera = NULL;
+
 /**
  * @brief Adjust the packet size of the camera.
  *
@@ -157,6 +472,15 @@ static VmbError_t VmbAdjustPktSz(const char *id);
  * @return VmbError_t
  */
 static VmbError_t VmbGetBufferAlignmentByHandle(VmbHandle_t handle, VmbInt64_t *alignment);
+/**
+ * @brief Get the alignment of the frames in the frame buffer.
+ * Frames are page aligned when the frame guard is on, so that they can be protected individually.
+ *
+ * @param handle Camera handle
+ * @param alignment Pointer to store the alignment
+ * @return VmbError_t
+ */
+static VmbError_t allied_frame_alignment(AlliedCameraHandle_t handle, VmbInt64_t *alignment);
 /**
  * @brief Allocate a frame buffer for the camera.
  *
@@ -181,6 +505,261 @@ static void allied_free_framebuf(AlliedFrameBuffer_t framebuf, bool frame_only);
  */
 static VmbError_t allied_realloc_framebuffer(AlliedCameraHandle_t handle);
 
+/**
+ * @brief Validate a decimation configuration.
+ *
+ * @param config Decimation configuration
+ * @return VmbError_t
+ */
+static VmbError_t allied_check_decimation(const AlliedDecimation_t *config);
+
+/**
+ * @brief Reset a frame gate to a new configuration.
+ *
+ * @param gate Frame gate
+ * @param config Decimation configuration, NULL to pass every frame
+ */
+static void allied_gate_reset(AlliedFrameGate_s *gate, const AlliedDecimation_t *config);
+
+/**
+ * @brief Decide if a frame passes the gate.
+ *
+ * @param gate Frame gate
+ * @param now_ms Current time in milliseconds
+ * @return true if the frame should be delivered
+ */
+static bool allied_gate_pass(AlliedFrameGate_s *gate, double now_ms);
+
+/**
+ * @brief Apply pending configuration changes and decide if a frame passes a decimator.
+ *
+ * @param decimator Decimator
+ * @return true if the frame should be delivered
+ */
+static bool allied_decimator_pass(AlliedDecimator_s *decimator);
+
+/**
+ * @brief Drop a reference to a frame, and requeue it if this was the last reference.
+ *
+ * @param ihandle Camera handle
+ * @param frame Frame
+ */
+static void allied_frame_put(struct camera_handle_s *ihandle, VmbFrame_t *frame);
+
+/**
+ * @brief Protect a released frame, and hand back the oldest protected frame once the guard is full.
+ *
+ * @param ihandle Camera handle
+ * @param frame Released frame
+ * @return VmbFrame_t* Frame to requeue, NULL if the guard still holds all frames
+ */
+static VmbFrame_t *allied_guard_swap(struct camera_handle_s *ihandle, VmbFrame_t *frame);
+
+/**
+ * @brief Unprotect all frames held by the frame guard.
+ *
+ * @param ihandle Camera handle
+ */
+static void allied_guard_flush(struct camera_handle_s *ihandle);
+
+/**
+ * @brief Deliver a frame to the subscribers of a camera.
+ *
+ * @param ihandle Camera handle
+ * @param frame Frame
+ * @param all Deliver to the subscribers that receive every frame
+ * @param changes Deliver to the subscribers that receive the frames forwarded by the change detection stage only
+ */
+static void allied_fanout(struct camera_handle_s *ihandle, VmbFrame_t *frame, bool all, bool changes);
+
+/**
+ * @brief Deliver a frame to the subscribers of a camera, and to the change subscribers if the change detection stage forwarded it, after
+ * the frames held for its preceding window. A frame that was not forwarded is held for the next event.
+ *
+ * @param ihandle Camera handle
+ * @param frame Frame
+ * @param slot Bookkeeping of the frame
+ */
+static void allied_change_fanout(struct camera_handle_s *ihandle, VmbFrame_t *frame, AlliedFrameSlot_s *slot);
+
+/**
+ * @brief Release the frames held for the preceding window of the change detection stage.
+ *
+ * @param ihandle Camera handle
+ * @param requeue Requeue frames whose last reference is released
+ */
+static void allied_change_release(struct camera_handle_s *ihandle, bool requeue);
+
+/**
+ * @brief Release all frames queued for a subscriber.
+ *
+ * @param sub Subscriber
+ * @param requeue Requeue frames whose last reference is released
+ */
+static void allied_subscriber_flush(struct allied_subscriber_s *sub, bool requeue);
+static void allied_subscriber_free(struct allied_subscriber_s *isub);
+static void allied_calib_spares_free(AlliedCalibStage_s *stage);
+static VmbError_t allied_calib_reserve(struct camera_handle_s *ihandle);
+static VmbError_t allied_beam_reserve(struct camera_handle_s *ihandle);
+static void allied_phot_spares_free(AlliedPhotStage_s *stage);
+static VmbError_t allied_phot_reserve(struct camera_handle_s *ihandle);
+
+/**
+ * @brief Correct the defective pixels of a frame in place, and hand the frame to the defect detector, if defect correction is enabled.
+ *
+ * @param ihandle Camera handle
+ * @param frame Frame
+ */
+static void allied_defect_stage(struct camera_handle_s *ihandle, VmbFrame_t *frame);
+
+/**
+ * @brief Compute the statistics of a frame into its slot, if the statistics stage is enabled.
+ *
+ * @param ihandle Camera handle
+ * @param frame Frame
+ * @param slot Bookkeeping of the frame
+ */
+static void allied_stats_stage(struct camera_handle_s *ihandle, const VmbFrame_t *frame, AlliedFrameSlot_s *slot);
+
+/**
+ * @brief Clamp a statistics region to an image. The region follows the frame size, which can change between configurations.
+ *
+ * @param config Statistics configuration
+ * @param image Image
+ */
+static void allied_stats_clamp(AlliedStatsConfig_t *config, const AlliedImage_t *image);
+
+/**
+ * @brief Profile the beam of a frame into its slot, if the beam profile stage is enabled.
+ *
+ * @param ihandle Camera handle
+ * @param frame Frame
+ * @param slot Bookkeeping of the frame
+ */
+static void allied_beam_stage(struct camera_handle_s *ihandle, const VmbFrame_t *frame, AlliedFrameSlot_s *slot);
+
+/**
+ * @brief Measure the apertures of a frame into its slot, if the photometry stage is enabled.
+ *
+ * @param ihandle Camera handle
+ * @param frame Frame
+ * @param slot Bookkeeping of the frame
+ */
+static void allied_photometry_stage(struct camera_handle_s *ihandle, const VmbFrame_t *frame, AlliedFrameSlot_s *slot);
+
+/**
+ * @brief Compare a frame to the background into its slot, and decide if it is forwarded to the change subscribers, if the change
+ * detection stage is enabled.
+ *
+ * @param ihandle Camera handle
+ * @param frame Frame
+ * @param slot Bookkeeping of the frame
+ */
+static void allied_change_stage(struct camera_handle_s *ihandle, const VmbFrame_t *frame, AlliedFrameSlot_s *slot);
+
+/**
+ * @brief Meter a frame for the auto-exposure controller, if auto-exposure is enabled and the controller is waiting for a fresh frame.
+ *
+ * @param ihandle Camera handle
+ * @param frame Frame
+ */
+static void allied_exposure_stage(struct camera_handle_s *ihandle, const VmbFrame_t *frame);
+
+/**
+ * @brief Find the spots of a frame for the tracking controller, if tracking is enabled, and complete the last offset update once a frame
+ * carries its offsets.
+ *
+ * @param ihandle Camera handle
+ * @param frame Frame
+ */
+static void allied_track_stage(struct camera_handle_s *ihandle, const VmbFrame_t *frame);
+
+/**
+ * @brief Calibrate a frame into its slot, if a calibration is installed and matches the frame.
+ *
+ * @param ihandle Camera handle
+ * @param frame Frame
+ * @param slot Bookkeeping of the frame
+ */
+static void allied_calib_stage(struct camera_handle_s *ihandle, const VmbFrame_t *frame, AlliedFrameSlot_s *slot);
+
+/**
+ * @brief Stop the auto-exposure controller thread.
+ *
+ * @param ihandle Camera handle
+ */
+static void allied_exposure_stop(struct camera_handle_s *ihandle);
+
+/**
+ * @brief Stop the tracking controller thread.
+ *
+ * @param ihandle Camera handle
+ */
+static void allied_track_stop(struct camera_handle_s *ihandle);
+
+/**
+ * @brief Stop the dark library telemetry thread, and remove its calibration.
+ *
+ * @param ihandle Camera handle
+ */
+static void allied_dark_stop(struct camera_handle_s *ihandle);
+
+/**
+ * @brief Stop the defect detection worker thread.
+ *
+ * @param ihandle Camera handle
+ */
+static void allied_defect_stop(struct camera_handle_s *ihandle);
+
+/**
+ * @brief Stop the controller and worker threads of a camera, and destroy its subscribers. Called before the camera is reset or closed.
+ *
+ * @param ihandle Camera handle
+ */
+static void allied_stop_stages(struct camera_handle_s *ihandle);
+
+/**
+ * @brief Free the frame buffer, the state of every stage and the handle of a camera. Called once the camera is closed, or when opening it fails.
+ *
+ * @param ihandle Camera handle
+ */
+static void allied_free_handle(struct camera_handle_s *ihandle);
+
+/**
+ * @brief Capture callback used when frames are only consumed by subscribers.
+ *
+ */
+static void allied_noop_callback(const AlliedCameraHandle_t handle, const VmbHandle_t stream, VmbFrame_t *frame, void *user_data)
+{
+    (void)handle;
+    (void)stream;
+    (void)frame;
+    (void)user_data;
+}
+
+/**
+ * @brief Check whether a frame was received in full. Missing packets leave stale or zeroed rows, so incomplete frames are not analysed.
+ *
+ * @param frame Frame
+ * @return true if the frame is complete
+ */
+static inline bool allied_frame_complete(const VmbFrame_t *frame)
+{
+    return frame->receiveStatus == VmbFrameStatusComplete;
+}
+
+/**
+ * @brief Get the monotonic clock time in milliseconds.
+ *
+ * @return double
+ */
+static inline double allied_now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
 VmbError_t allied_init_api(const char *config_path)
 {
     VmbError_t err = VmbErrorSuccess;
@@ -192,6 +771,7 @@ VmbError_t allied_init_api(const char *config_path)
             return err;
         }
         atexit(shutdown_atexit);
+        allied_dispatch_init(); // bind the processing kernels once, before any frame arrives
         atomic_store(&is_init, true);
     }
     return err;
@@ -304,6 +884,26 @@ VmbError_t allied_open_camera_generic(AlliedCameraHandle_t *handle, const char *
         goto cleanup;
     }
     memset(ihandle, 0, sizeof(_AlliedCameraHandle_s));
+    pthread_mutex_init(&(ihandle->decimator.lock), NULL);
+    allied_gate_reset(&(ihandle->decimator.gate), NULL);
+    pthread_rwlock_init(&(ihandle->subs_lock), NULL);
+    pthread_mutex_init(&(ihandle->guard.lock), NULL);
+    pthread_mutex_init(&(ihandle->stats.lock), NULL);
+    pthread_mutex_init(&(ihandle->beam.lock), NULL);
+    pthread_mutex_init(&(ihandle->photometry.lock), NULL);
+    pthread_mutex_init(&(ihandle->change.lock), NULL);
+    pthread_mutex_init(&(ihandle->exposure.lock), NULL);
+    pthread_cond_init(&(ihandle->exposure.wake), NULL);
+    pthread_mutex_init(&(ihandle->calib.lock), NULL);
+    pthread_cond_init(&(ihandle->calib.idle), NULL);
+    pthread_mutex_init(&(ihandle->dark.lock), NULL);
+    pthread_cond_init(&(ihandle->dark.wake), NULL);
+    pthread_mutex_init(&(ihandle->defects.lock), NULL);
+    pthread_mutex_init(&(ihandle->defects.detector_lock), NULL);
+    pthread_cond_init(&(ihandle->defects.wake), NULL);
+    pthread_mutex_init(&(ihandle->tracking.lock), NULL);
+    pthread_cond_init(&(ihandle->tracking.wake), NULL);
+    ihandle->guard.page = (size_t)sysconf(_SC_PAGESIZE);
     AlliedFrameBuffer_t framebuf = (AlliedFrameBuffer_t)malloc(sizeof(AlliedFrameBuffer_s));
     if (framebuf == NULL)
     {
@@ -322,6 +922,20 @@ VmbError_t allied_open_camera_generic(AlliedCameraHandle_t *handle, const char *
     {
         goto cleanup_close;
     }
+    // topology is best-effort, placement is disabled if it can not be determined
+    if (allied_numa_discover(ihandle->handle, &(ihandle->topo)) != VmbErrorSuccess)
+    {
+        eprintlf("Could not determine camera topology");
+    }
+    ihandle->numa_node = ihandle->topo.numa_node;
+    eprintlf("Camera interface %s, PCI %s, NUMA node %d", ihandle->topo.interface_id, ihandle->topo.pci_address, ihandle->numa_node);
+    // the stages place sensor coordinates in binned frames without reading the camera
+    VmbInt64_t binning = 1;
+    if (allied_get_binning_factor(ihandle, &binning) != VmbErrorSuccess || binning < 1)
+    {
+        binning = 1;
+    }
+    atomic_init(&(ihandle->binning), (uint_fast32_t)binning);
     ihandle->acquiring = false;
     ihandle->streaming = false;
     ihandle->framebuf = framebuf;
@@ -342,9 +956,9 @@ VmbError_t allied_open_camera_generic(AlliedCameraHandle_t *handle, const char *
 cleanup_close:
     ALLIEDCALL(VmbCameraClose, ihandle->handle);
 cleanup_framebuf:
-    free(framebuf);
+    ihandle->framebuf = framebuf;
 cleanup_handle:
-    free(ihandle);
+    allied_free_handle(ihandle);
 cleanup:
     if (id_null)
     {
@@ -409,6 +1023,18 @@ static VmbError_t VmbGetBufferAlignmentByHandle(VmbHandle_t handle, VmbInt64_t *
     return VmbErrorSuccess;
 }
 
+static VmbError_t allied_frame_alignment(AlliedCameraHandle_t handle, VmbInt64_t *alignment)
+{
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    ALLIEDEXIT(VmbGetBufferAlignmentByHandle, ihandle->handle, alignment);
+    if (ihandle->guard.depth > 0 && ihandle->guard.page > 0)
+    {
+        VmbInt64_t page = (VmbInt64_t)ihandle->guard.page;
+        *alignment = ((*alignment + page - 1) / page) * page; // page size and stream alignment are powers of two
+    }
+    return VmbErrorSuccess;
+}
+
 static VmbError_t allied_alloc_framebuf(AlliedCameraHandle_t handle, uint32_t bufsize)
 {
     assert(handle);
@@ -423,10 +1049,11 @@ static VmbError_t allied_alloc_framebuf(AlliedCameraHandle_t handle, uint32_t bu
     assert(handle);
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
     VmbInt64_t alignment = 0;
-    ALLIEDEXIT(VmbGetBufferAlignmentByHandle, ihandle->handle, &alignment);
+    ALLIEDEXIT(allied_frame_alignment, handle, &alignment);
     eprintlf("Alignment: %llu", alignment);
     bufsize = (bufsize / alignment) * alignment;
-    VmbUchar_t *ibuffer = (VmbUchar_t *)aligned_alloc(alignment, bufsize);
+    bool mapped = false;
+    VmbUchar_t *ibuffer = (VmbUchar_t *)allied_numa_alloc(alignment, bufsize, ihandle->numa_node, &mapped);
     if (ibuffer == NULL)
     {
         return VmbErrorResources;
@@ -434,6 +1061,8 @@ static VmbError_t allied_alloc_framebuf(AlliedCameraHandle_t handle, uint32_t bu
     ihandle->framebuf->buffer = ibuffer;
     ihandle->framebuf->alloc_size = bufsize;
     ihandle->framebuf->alignment = alignment;
+    ihandle->framebuf->mapped = mapped;
+    ihandle->framebuf->numa_node = ihandle->numa_node;
     return VmbErrorSuccess;
 }
 
@@ -448,11 +1077,25 @@ VmbError_t allied_realloc_framebuffer(AlliedCameraHandle_t handle)
     ALLIEDEXIT(VmbGetBufferAlignmentByHandle, ihandle->handle, &alignment);
     ALLIEDEXIT(VmbPayloadSizeGet, ihandle->handle, &payloadSize);
     assert(payloadSize % alignment == 0);
+    ALLIEDEXIT(allied_frame_alignment, handle, &alignment);
+    size_t stride = (((size_t)payloadSize + alignment - 1) / alignment) * alignment; // frames start on page boundaries when guarded
     ALLIEDEXIT(allied_stop_capture, handle);
     ALLIEDEXIT(allied_dequeue_capture, handle);
+    AlliedCaptureCallback callback = NULL;
+    void *user_data = NULL;
+    // previous frames exist, copy the callback and user data
+    if (framebuf->frames != NULL)
+    {
+        callback = (AlliedCaptureCallback)framebuf->frames->context[CONTEXT_CB_HANDLE];
+        user_data = framebuf->frames->context[CONTEXT_DATA_HANDLE];
+    }
     // check if we need reallocation of the buffer
     bool need_realloc = false;
-    if (framebuf->alignment != alignment || framebuf->alloc_size < payloadSize) // if alignment is different, we need to realloc
+    if (framebuf->alignment != alignment || framebuf->alloc_size < stride) // if alignment is different, we need to realloc
+    {
+        need_realloc = true;
+    }
+    if (framebuf->numa_node != ihandle->numa_node) // placement changed
     {
         need_realloc = true;
     }
@@ -464,7 +1107,7 @@ VmbError_t allied_realloc_framebuffer(AlliedCameraHandle_t handle)
                  ihandle->framebuf->alloc_size,
                  ihandle->framebuf->alignment);
         alloc_size = (alloc_size / alignment) * alignment;                // re-align the size
-        alloc_size = alloc_size > payloadSize ? alloc_size : payloadSize; // make sure we have enough space
+        alloc_size = alloc_size > stride ? alloc_size : stride;           // make sure we have enough space
         allied_free_framebuf(ihandle->framebuf, false);
         ALLIEDEXIT(allied_alloc_framebuf, handle, alloc_size);
         eprintlf("Current buffer: %p (%lu, %lu)",
@@ -474,36 +1117,87 @@ VmbError_t allied_realloc_framebuffer(AlliedCameraHandle_t handle)
     }
     if (
         framebuf->frames == NULL ||                  // if we have no frames, first time setup
-        framebuf->frames->bufferSize != payloadSize) // if payload size has changed, we need to recreate the frames
+        framebuf->frames->bufferSize != payloadSize || // if payload size has changed, we need to recreate the frames
+        framebuf->stride != stride)                    // if the frame guard was toggled, frames move
     {
-        AlliedCaptureCallback callback = NULL;
-        void *user_data = NULL;
-        // previous frames exist, copy the callback and user data
-        if (framebuf->frames != NULL)
-        {
-            callback = (AlliedCaptureCallback)framebuf->frames->context[CONTEXT_CB_HANDLE];
-            user_data = framebuf->frames->context[CONTEXT_DATA_HANDLE];
-        }
         // payload size has changed, but alignment has not - we need to recreate the frames
         allied_free_framebuf(framebuf, true);
-        size_t num_frames = (framebuf->alloc_size / payloadSize) % (ALLIED_MAX_FRAMES + 1);
+        size_t num_frames = (framebuf->alloc_size / stride) % (ALLIED_MAX_FRAMES + 1);
         assert(num_frames > 0);
-        assert(payloadSize <= framebuf->alloc_size);
+        assert(stride <= framebuf->alloc_size);
         VmbFrame_t *iframebuf = (VmbFrame_t *)malloc(num_frames * sizeof(VmbFrame_t));
         if (iframebuf == NULL)
         {
             return VmbErrorResources;
         }
         memset(iframebuf, 0, num_frames * sizeof(VmbFrame_t));
+        AlliedFrameSlot_s *islots = (AlliedFrameSlot_s *)malloc(num_frames * sizeof(AlliedFrameSlot_s));
+        if (islots == NULL)
+        {
+            free(iframebuf);
+            return VmbErrorResources;
+        }
         for (VmbUint32_t i = 0; i < num_frames; i++)
         {
-            iframebuf[i].buffer = ihandle->framebuf->buffer + i * payloadSize;
+            // statistics are computed on the delivery thread, which must not allocate
+            islots[i].stats = (AlliedFrameStats_t *)malloc(sizeof(AlliedFrameStats_t));
+            if (islots[i].stats == NULL)
+            {
+                while (i-- > 0)
+                {
+                    free(islots[i].stats);
+                }
+                free(islots);
+                free(iframebuf);
+                return VmbErrorResources;
+            }
+        }
+        for (VmbUint32_t i = 0; i < num_frames; i++)
+        {
+            atomic_init(&(islots[i].refs), 0);
+            atomic_init(&(islots[i].generation), 0);
+            atomic_init(&(islots[i].stats_valid), false);
+            memset(&(islots[i].calib), 0, sizeof(AlliedImage_t));
+            islots[i].calib_alloc = 0;
+            islots[i].calib_valid = false;
+            islots[i].beam = NULL;
+            islots[i].beam_alloc = 0;
+            islots[i].beam_valid = false;
+            islots[i].phot = NULL;
+            islots[i].phot_alloc = 0;
+            islots[i].phot_valid = false;
+            islots[i].change_valid = false;
+            iframebuf[i].buffer = ihandle->framebuf->buffer + i * stride;
             iframebuf[i].bufferSize = payloadSize;
-            iframebuf[i].context[CONTEXT_IDX_HANDLE] = ihandle; // store the handle in the context
+            iframebuf[i].context[CONTEXT_IDX_HANDLE] = ihandle;      // store the handle in the context
+            iframebuf[i].context[CONTEXT_SLOT_HANDLE] = &(islots[i]); // store the bookkeeping in the context
         }
+        framebuf->slots = islots;
         framebuf->frames = iframebuf;
         framebuf->num_frames = num_frames;
+        framebuf->stride = stride;
         framebuf->announced = false;
+        pthread_mutex_lock(&(ihandle->calib.lock));
+        VmbError_t err = allied_calib_reserve(ihandle);
+        pthread_mutex_unlock(&(ihandle->calib.lock));
+        if (err != VmbErrorSuccess)
+        {
+            return err;
+        }
+        pthread_mutex_lock(&(ihandle->beam.lock));
+        err = allied_beam_reserve(ihandle);
+        pthread_mutex_unlock(&(ihandle->beam.lock));
+        if (err != VmbErrorSuccess)
+        {
+            return err;
+        }
+        pthread_mutex_lock(&(ihandle->photometry.lock));
+        err = allied_phot_reserve(ihandle);
+        pthread_mutex_unlock(&(ihandle->photometry.lock));
+        if (err != VmbErrorSuccess)
+        {
+            return err;
+        }
         if (callback != NULL)
         {
             VmbError_t err = allied_queue_capture(handle, callback, user_data);
@@ -522,415 +1216,2553 @@ static void FrameCaptureCallback(const VmbHandle_t handle, const VmbHandle_t str
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)frame->context[CONTEXT_IDX_HANDLE];
     void *user_data = frame->context[CONTEXT_DATA_HANDLE];
     AlliedCaptureCallback callback_handle = frame->context[CONTEXT_CB_HANDLE];
+    // keep the delivery thread next to the frame buffer, and give it back its CPUs once placement is disabled
+    if (allied_numa_thread_node() != ihandle->numa_node)
+    {
+        allied_numa_pin_thread(ihandle->numa_node);
+    }
+    AlliedFrameSlot_s *slot = (AlliedFrameSlot_s *)frame->context[CONTEXT_SLOT_HANDLE];
+    atomic_store_explicit(&(slot->refs), 1, memory_order_relaxed); // reference held by the delivery thread
+    // defective pixels are replaced before any stage or consumer reads the frame
+    allied_defect_stage(ihandle, frame);
+    // statistics are computed once, before any consumer reads the frame
+    allied_stats_stage(ihandle, frame, slot);
+    // so is the beam profile, for feedback with a fixed latency
+    allied_beam_stage(ihandle, frame, slot);
+    // and the aperture fluxes
+    allied_photometry_stage(ihandle, frame, slot);
+    // and the change against the background, which decides what the change subscribers receive
+    allied_change_stage(ihandle, frame, slot);
+    // metering only hands the measurement over, the controller writes to the camera on its own thread
+    allied_exposure_stage(ihandle, frame);
+    // so does tracking, the offsets are written on the controller thread
+    allied_track_stage(ihandle, frame);
+    // calibration is applied once, and read by every consumer
+    allied_calib_stage(ihandle, frame, slot);
+    // decimation only thins what the callback and the subscribers receive, the stages above see every frame
+    if (!allied_decimator_pass(&(ihandle->decimator)))
+    {
+        allied_frame_put(ihandle, frame);
+        return;
+    }
     // execute the user callback
     (*callback_handle)(ihandle, stream, frame, user_data);
     // make sure user can not mistakenly destroy the callback mechanism
     frame->context[CONTEXT_IDX_HANDLE] = ihandle;
     frame->context[CONTEXT_DATA_HANDLE] = user_data;
     frame->context[CONTEXT_CB_HANDLE] = callback_handle;
-    // requeue the frame
-    VmbCaptureFrameQueue(handle, frame, &FrameCaptureCallback);
+    frame->context[CONTEXT_SLOT_HANDLE] = slot;
+    // hand the frame to the subscribers
+    allied_change_fanout(ihandle, frame, slot);
+    // requeue the frame, unless a subscriber still holds it
+    allied_frame_put(ihandle, frame);
 }
 
-VmbError_t allied_queue_capture(AlliedCameraHandle_t handle, AlliedCaptureCallback callback, void *user_data)
+static bool allied_decimator_pass(AlliedDecimator_s *decimator)
 {
-    assert(handle);
-    assert(callback);
-    if (atomic_load(&is_init) == false)
+    if (atomic_load_explicit(&(decimator->dirty), memory_order_acquire))
     {
-        return VmbErrorNotInitialized;
+        pthread_mutex_lock(&(decimator->lock));
+        allied_gate_reset(&(decimator->gate), &(decimator->next));
+        atomic_store(&(decimator->dirty), false);
+        pthread_mutex_unlock(&(decimator->lock));
     }
-    eprintlf("Queueing capture: %p", handle);
-    VmbError_t err;
-    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    AlliedFrameBuffer_t framebuf = ihandle->framebuf;
-    if (framebuf == NULL)
+    if (!allied_gate_pass(&(decimator->gate), decimator->gate.config.mode < AlliedDecimationInterval ? 0 : allied_now_ms()))
     {
-        return VmbErrorResources;
+        atomic_fetch_add_explicit(&(decimator->skipped), 1, memory_order_relaxed);
+        return false;
     }
-    if (framebuf->queued) // already queued, so dequeue first
+    atomic_fetch_add_explicit(&(decimator->delivered), 1, memory_order_relaxed);
+    return true;
+}
+
+static void allied_stats_stage(struct camera_handle_s *ihandle, const VmbFrame_t *frame, AlliedFrameSlot_s *slot)
+{
+    AlliedStatsStage_s *stage = &(ihandle->stats);
+    if (atomic_load_explicit(&(stage->dirty), memory_order_acquire))
     {
-        ALLIEDEXIT(allied_dequeue_capture, handle);
+        pthread_mutex_lock(&(stage->lock));
+        stage->config = stage->next;
+        stage->enabled = stage->next_enabled;
+        atomic_store(&(stage->dirty), false);
+        pthread_mutex_unlock(&(stage->lock));
     }
-    // announce the buffers
-    for (VmbUint32_t i = 0; i < framebuf->num_frames; i++)
+    atomic_store_explicit(&(slot->stats_valid), false, memory_order_relaxed);
+    AlliedImage_t image;
+    if (!stage->enabled || !allied_frame_complete(frame) || allied_image_from_frame(frame, &image) != VmbErrorSuccess)
     {
-        err = ALLIEDCALL(VmbFrameAnnounce, ihandle->handle, &(framebuf->frames[i]), sizeof(VmbFrame_t));
-        if (err != VmbErrorSuccess)
-        {
-            goto err_cleanup;
-        }
-        framebuf->announced = true;
+        return;
     }
-    // start the capture engine
-    err = ALLIEDCALL(VmbCaptureStart, ihandle->handle);
-    if (err != VmbErrorSuccess)
+    AlliedStatsConfig_t config = stage->config;
+    allied_stats_clamp(&config, &image);
+    if (allied_stats_run(&image, &config, slot->stats, stage->scratch) == VmbErrorSuccess)
     {
-        goto err_cleanup;
+        slot->stats->frame_id = frame->frameID;
+        atomic_store_explicit(&(slot->stats_valid), true, memory_order_release);
     }
-    eprintlf("Started capture");
-    ihandle->streaming = true;
-    // store callback ptr
-    for (VmbUint32_t i = 0; i < framebuf->num_frames; i++)
+}
+
+static void allied_stats_clamp(AlliedStatsConfig_t *config, const AlliedImage_t *image)
+{
+    if (config->roi_width != 0 && config->roi_height != 0)
     {
-        framebuf->frames[i].context[CONTEXT_CB_HANDLE] = callback;
-        framebuf->frames[i].context[CONTEXT_DATA_HANDLE] = user_data;
+        config->roi_x = config->roi_x < image->width ? config->roi_x : image->width;
+        config->roi_y = config->roi_y < image->height ? config->roi_y : image->height;
+        config->roi_width = (image->width - config->roi_x) < config->roi_width ? (image->width - config->roi_x) : config->roi_width;
+        config->roi_height = (image->height - config->roi_y) < config->roi_height ? (image->height - config->roi_y) : config->roi_height;
     }
-    // queue up the frames
-    VmbUint32_t frames_unqueued = framebuf->num_frames;
-    while (--frames_unqueued)
+}
+
+/**
+ * @brief Allocate the beam profiles of the frames that have none, for the projections of a whole sensor, if the beam profile stage is to
+ * run. The delivery thread must not allocate, and the profiles are allocated once with the frames, so that no profile is replaced while it
+ * can be in use. Called with the stage lock held.
+ *
+ * @param ihandle Camera handle
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+static VmbError_t allied_beam_reserve(struct camera_handle_s *ihandle)
+{
+    AlliedFrameBuffer_t framebuf = ihandle->framebuf;
+    if (!ihandle->beam.next_enabled || framebuf == NULL || framebuf->slots == NULL)
     {
-        uint32_t frame_index = framebuf->num_frames - frames_unqueued - 1;
-        err = ALLIEDCALL(VmbCaptureFrameQueue, ihandle->handle, &(framebuf->frames[frame_index]), &FrameCaptureCallback);
-        if (err != VmbErrorSuccess)
+        return VmbErrorSuccess;
+    }
+    // binned frames and regions of interest are never larger than the sensor
+    VmbInt64_t width = 0, height = 0;
+    ALLIEDEXIT(allied_get_sensor_size, (AlliedCameraHandle_t)ihandle, &width, &height);
+    size_t size = sizeof(AlliedBeamProfile_t) + sizeof(double) * ((size_t)width + (size_t)height);
+    for (size_t i = 0; i < framebuf->num_frames; i++)
+    {
+        AlliedFrameSlot_s *slot = &(framebuf->slots[i]);
+        if (slot->beam != NULL)
         {
-            break;
+            continue;
         }
-        eprintlf("Queued frame %u", frame_index);
+        slot->beam = (AlliedBeamProfile_t *)malloc(size);
+        if (slot->beam == NULL)
+        {
+            return VmbErrorResources;
+        }
+        slot->beam_alloc = size;
     }
-    if (!frames_unqueued)
+    return VmbErrorSuccess;
+}
+
+static void allied_beam_stage(struct camera_handle_s *ihandle, const VmbFrame_t *frame, AlliedFrameSlot_s *slot)
+{
+    AlliedBeamStage_s *stage = &(ihandle->beam);
+    if (atomic_load_explicit(&(stage->dirty), memory_order_acquire))
+    {
+        pthread_mutex_lock(&(stage->lock));
+        stage->config = stage->next;
+        stage->enabled = stage->next_enabled;
+        atomic_store(&(stage->dirty), false);
+        pthread_mutex_unlock(&(stage->lock));
+    }
+    slot->beam_valid = false;
+    if (!stage->enabled || !allied_frame_complete(frame))
+    {
+        return;
+    }
+    AlliedImage_t image;
+    if (allied_image_from_frame(frame, &image) != VmbErrorSuccess)
+    {
+        return;
+    }
+    // the region follows the frame size, which can change between configurations
+    AlliedBeamConfig_t config = stage->config;
+    if (config.x >= image.width || config.y >= image.height)
+    {
+        return;
+    }
+    config.width = config.width > image.width - config.x ? image.width - config.x : config.width;
+    config.height = config.height > image.height - config.y ? image.height - config.y : config.height;
+    VmbUint32_t width = config.width == 0 ? image.width - config.x : config.width;
+    VmbUint32_t height = config.height == 0 ? image.height - config.y : config.height;
+    // the profiles are sized for the sensor, see allied_beam_reserve
+    if (slot->beam_alloc < sizeof(AlliedBeamProfile_t) + sizeof(double) * ((size_t)width + height))
+    {
+        return;
+    }
+    double *columns = (double *)(slot->beam + 1);
+    if (allied_beam_profile(&image, &config, slot->beam, columns, columns + width) == VmbErrorSuccess)
+    {
+        slot->beam->frame_id = frame->frameID;
+        slot->beam_valid = true;
+    }
+}
+
+/**
+ * @brief Free the spare photometry records. Called with the stage lock held, or once the camera is closed.
+ *
+ * @param stage Photometry stage
+ */
+static void allied_phot_spares_free(AlliedPhotStage_s *stage)
+{
+    for (VmbUint32_t i = 0; i < stage->spares; i++)
+    {
+        free(stage->spare[i]);
+    }
+    free(stage->spare);
+    stage->spare = NULL;
+    stage->spares = 0;
+}
+
+/**
+ * @brief Allocate photometry records for the frame slots that are too small for the configured apertures. A slot may be in use until the
+ * delivery thread next measures its frame, so the records are swapped in then. Called with the stage lock held.
+ *
+ * @param ihandle Camera handle
+ * @return VmbError_t
+ */
+static VmbError_t allied_phot_reserve(struct camera_handle_s *ihandle)
+{
+    AlliedPhotStage_s *stage = &(ihandle->photometry);
+    AlliedFrameBuffer_t framebuf = ihandle->framebuf;
+    allied_phot_spares_free(stage);
+    if (stage->size == 0 || framebuf == NULL || framebuf->slots == NULL)
     {
-        framebuf->queued = true;
         return VmbErrorSuccess;
     }
-    // if we reach here, something went wrong
-err_cleanup:
-    allied_stop_capture(handle);
-    allied_dequeue_capture(handle);
-    return err;
+    stage->spare = (AlliedPhotometryRecord_t **)calloc(framebuf->num_frames, sizeof(AlliedPhotometryRecord_t *));
+    if (stage->spare == NULL)
+    {
+        return VmbErrorResources;
+    }
+    stage->spares = (VmbUint32_t)framebuf->num_frames;
+    for (VmbUint32_t i = 0; i < stage->spares; i++)
+    {
+        if (framebuf->slots[i].phot_alloc >= stage->size)
+        {
+            continue;
+        }
+        stage->spare[i] = (AlliedPhotometryRecord_t *)malloc(stage->size);
+        if (stage->spare[i] == NULL)
+        {
+            allied_phot_spares_free(stage);
+            return VmbErrorResources;
+        }
+    }
+    return VmbErrorSuccess;
+}
+
+static void allied_photometry_stage(struct camera_handle_s *ihandle, const VmbFrame_t *frame, AlliedFrameSlot_s *slot)
+{
+    AlliedPhotStage_s *stage = &(ihandle->photometry);
+    if (atomic_load_explicit(&(stage->dirty), memory_order_acquire))
+    {
+        pthread_mutex_lock(&(stage->lock));
+        AlliedPhotometry_t old = stage->phot;
+        stage->phot = stage->next;
+        stage->next = old; // freed by the next allied_set_photometry, off the delivery thread
+        atomic_store(&(stage->dirty), false);
+        pthread_mutex_unlock(&(stage->lock));
+    }
+    slot->phot_valid = false;
+    if (stage->phot == NULL || !allied_frame_complete(frame))
+    {
+        return;
+    }
+    AlliedImage_t image;
+    if (allied_image_from_frame(frame, &image) != VmbErrorSuccess)
+    {
+        return;
+    }
+    double start = allied_now_ms();
+    VmbUint32_t count = allied_photometry_count(stage->phot);
+    size_t size = sizeof(AlliedPhotometryRecord_t) + sizeof(AlliedApertureFlux_t) * count;
+    if (slot->phot_alloc < size)
+    {
+        // nobody else holds the frame, so its record is swapped for the one allocated with the apertures
+        pthread_mutex_lock(&(stage->lock));
+        VmbUint32_t index = (VmbUint32_t)(slot - ihandle->framebuf->slots);
+        if (index >= stage->spares || stage->spare[index] == NULL || stage->size < size)
+        {
+            pthread_mutex_unlock(&(stage->lock));
+            return;
+        }
+        AlliedPhotometryRecord_t *old = slot->phot;
+        slot->phot = stage->spare[index];
+        slot->phot_alloc = stage->size;
+        stage->spare[index] = old; // freed by the next allied_phot_reserve
+        pthread_mutex_unlock(&(stage->lock));
+    }
+    AlliedApertureFlux_t *fluxes = (AlliedApertureFlux_t *)(slot->phot + 1);
+    // the tables are built again only when the region of interest or the binning changes
+    VmbUint32_t binning = (VmbUint32_t)atomic_load_explicit(&(ihandle->binning), memory_order_relaxed);
+    if (allied_photometry_measure(stage->phot, &image, frame->offsetX, frame->offsetY, binning, fluxes) == VmbErrorSuccess)
+    {
+        slot->phot->frame_id = frame->frameID;
+        slot->phot->timestamp = frame->timestamp;
+        slot->phot->count = count;
+        slot->phot->fluxes = fluxes;
+        slot->phot->elapsed_us = (allied_now_ms() - start) * 1e3;
+        slot->phot_valid = true;
+    }
+}
+
+static void allied_change_stage(struct camera_handle_s *ihandle, const VmbFrame_t *frame, AlliedFrameSlot_s *slot)
+{
+    AlliedChangeStage_s *stage = &(ihandle->change);
+    if (atomic_load_explicit(&(stage->dirty), memory_order_acquire))
+    {
+        pthread_mutex_lock(&(stage->lock));
+        allied_change_release(ihandle, true);
+        allied_change_destroy(&(stage->det));
+        free(stage->held);
+        stage->det = stage->next;
+        stage->pre = stage->next_pre;
+        stage->post = stage->next_post;
+        stage->held = stage->next_held;
+        stage->next = NULL;
+        stage->next_held = NULL;
+        stage->remaining = 0;
+        stage->forwarding = false;
+        stage->offset[0] = frame->offsetX;
+        stage->offset[1] = frame->offsetY;
+        atomic_store(&(stage->frames), 0);
+        atomic_store(&(stage->changed), 0);
+        atomic_store(&(stage->forwarded), 0);
+        atomic_store(&(stage->events), 0);
+        atomic_store(&(stage->incomplete), 0);
+        atomic_store(&(stage->enabled), stage->det != NULL);
+        atomic_store(&(stage->dirty), false);
+        pthread_mutex_unlock(&(stage->lock));
+    }
+    slot->change_valid = false;
+    if (stage->det == NULL)
+    {
+        return;
+    }
+    // a truncated frame would both pollute the model and trip a change
+    if (!allied_frame_complete(frame))
+    {
+        atomic_fetch_add_explicit(&(stage->incomplete), 1, memory_order_relaxed);
+        return;
+    }
+    AlliedImage_t image;
+    if (allied_image_from_frame(frame, &image) != VmbErrorSuccess)
+    {
+        return;
+    }
+    // a moved region of interest is a new scene
+    if (frame->offsetX != stage->offset[0] || frame->offsetY != stage->offset[1])
+    {
+        allied_change_reset(stage->det);
+        stage->offset[0] = frame->offsetX;
+        stage->offset[1] = frame->offsetY;
+    }
+    if (allied_change_detect(stage->det, &image, &(slot->change)) != VmbErrorSuccess)
+    {
+        return;
+    }
+    slot->change.frame_id = frame->frameID;
+    if (slot->change.changed)
+    {
+        stage->remaining = stage->post;
+        slot->change.forwarded = true;
+        atomic_fetch_add_explicit(&(stage->changed), 1, memory_order_relaxed);
+    }
+    else if (stage->remaining > 0)
+    {
+        stage->remaining--;
+        slot->change.forwarded = true;
+    }
+    if (slot->change.forwarded)
+    {
+        atomic_fetch_add_explicit(&(stage->forwarded), 1, memory_order_relaxed);
+        if (!stage->forwarding)
+        {
+            atomic_fetch_add_explicit(&(stage->events), 1, memory_order_relaxed);
+        }
+    }
+    stage->forwarding = slot->change.forwarded;
+    atomic_fetch_add_explicit(&(stage->frames), 1, memory_order_relaxed);
+    slot->change_valid = true;
+}
+
+static void allied_exposure_stage(struct camera_handle_s *ihandle, const VmbFrame_t *frame)
+{
+    AlliedExposureStage_s *ae = &(ihandle->exposure);
+    if (atomic_load_explicit(&(ae->dirty), memory_order_acquire))
+    {
+        pthread_mutex_lock(&(ae->lock));
+        ae->config = ae->next;
+        ae->enabled = ae->next_enabled;
+        atomic_store(&(ae->dirty), false);
+        pthread_mutex_unlock(&(ae->lock));
+    }
+    if (!ae->enabled)
+    {
+        return;
+    }
+    // frame IDs restart with the acquisition
+    if (frame->frameID < atomic_load_explicit(&(ae->last_id), memory_order_relaxed))
+    {
+        atomic_store(&(ae->stale_until), 0);
+    }
+    atomic_store_explicit(&(ae->last_id), frame->frameID, memory_order_release);
+    // a frame with missing packets would read dark, and drive the exposure up
+    if (!allied_frame_complete(frame))
+    {
+        atomic_fetch_add_explicit(&(ae->incomplete), 1, memory_order_relaxed);
+        return;
+    }
+    // a frame delivered while the controller is busy, or soon after an update, may not reflect the latest settings
+    if (atomic_load_explicit(&(ae->pending), memory_order_acquire) ||
+        frame->frameID <= atomic_load_explicit(&(ae->stale_until), memory_order_acquire))
+    {
+        atomic_fetch_add_explicit(&(ae->stale), 1, memory_order_relaxed);
+        return;
+    }
+    AlliedImage_t image;
+    if (allied_image_from_frame(frame, &image) != VmbErrorSuccess)
+    {
+        return;
+    }
+    AlliedStatsConfig_t config = {
+        .roi_x = ae->config.roi_x,
+        .roi_y = ae->config.roi_y,
+        .roi_width = ae->config.roi_width,
+        .roi_height = ae->config.roi_height,
+        .step_x = ae->config.step > 0 ? ae->config.step : 4,
+        .step_y = ae->config.step > 0 ? ae->config.step : 4,
+    };
+    allied_stats_clamp(&config, &image);
+    if (allied_stats_run(&image, &config, ae->stats, ae->scratch) != VmbErrorSuccess || ae->stats->count == 0)
+    {
+        return;
+    }
+    double full_scale = (double)((1u << ae->stats->bits) - 1);
+    atomic_fetch_add_explicit(&(ae->count), 1, memory_order_relaxed);
+    atomic_store_explicit(&(ae->pending), true, memory_order_relaxed);
+    pthread_mutex_lock(&(ae->lock));
+    ae->measure.frame_id = frame->frameID;
+    ae->measure.level = allied_stats_percentile(ae->stats, ae->config.percentile) / full_scale;
+    ae->measure.saturated = (double)ae->stats->saturated / ae->stats->count;
+    ae->measured = true;
+    pthread_cond_signal(&(ae->wake));
+    pthread_mutex_unlock(&(ae->lock));
+}
+
+static void allied_track_stage(struct camera_handle_s *ihandle, const VmbFrame_t *frame)
+{
+    AlliedTrackStage_s *ts = &(ihandle->tracking);
+    if (atomic_load_explicit(&(ts->dirty), memory_order_acquire))
+    {
+        pthread_mutex_lock(&(ts->lock));
+        ts->config = ts->next;
+        ts->enabled = ts->next_enabled;
+        allied_spot_finder_destroy(&(ts->finder));
+        ts->finder = ts->next_finder;
+        ts->next_finder = NULL;
+        atomic_store(&(ts->dirty), false);
+        pthread_mutex_unlock(&(ts->lock));
+    }
+    if (!ts->enabled || ts->finder == NULL)
+    {
+        return;
+    }
+    double now = allied_now_ms();
+    // frame IDs restart with the acquisition
+    if (frame->frameID < atomic_load_explicit(&(ts->last_id), memory_order_relaxed))
+    {
+        atomic_store(&(ts->settle_until), 0);
+    }
+    atomic_store_explicit(&(ts->last_id), frame->frameID, memory_order_release);
+    VmbUint32_t offset[2] = {frame->offsetX, frame->offsetY};
+    bool reported = (frame->receiveFlags & VmbFrameFlagsOffset) != 0;
+    if (!reported)
+    {
+        // without the offsets of the frame, the last written ones are used once no frame can have been exposed with the previous ones
+        if (atomic_load_explicit(&(ts->writing), memory_order_acquire) ||
+            frame->frameID <= atomic_load_explicit(&(ts->settle_until), memory_order_acquire))
+        {
+            pthread_mutex_lock(&(ts->lock));
+            ts->status.stale++;
+            pthread_mutex_unlock(&(ts->lock));
+            return;
+        }
+        pthread_mutex_lock(&(ts->lock));
+        offset[0] = ts->status.offset_x;
+        offset[1] = ts->status.offset_y;
+        pthread_mutex_unlock(&(ts->lock));
+    }
+    // the first frame exposed with the offsets of the last update completes it
+    if (atomic_load_explicit(&(ts->awaiting), memory_order_acquire))
+    {
+        pthread_mutex_lock(&(ts->lock));
+        if (offset[0] == ts->await[0] && offset[1] == ts->await[1] && frame->frameID >= ts->await_from.frame_id)
+        {
+            AlliedTrackingStatus_t *status = &(ts->status);
+            status->latency_frames = (VmbUint32_t)(frame->frameID - ts->await_from.frame_id);
+            status->latency_ms = now - ts->await_from.time_ms;
+            ts->latency_sum += status->latency_frames;
+            ts->latencies++;
+            status->mean_latency_frames = ts->latency_sum / ts->latencies;
+            atomic_store(&(ts->awaiting), false);
+        }
+        pthread_mutex_unlock(&(ts->lock));
+    }
+    // a truncated frame still completes an update, but its spots would be cut off or missing
+    if (!allied_frame_complete(frame))
+    {
+        pthread_mutex_lock(&(ts->lock));
+        ts->status.incomplete++;
+        pthread_mutex_unlock(&(ts->lock));
+        return;
+    }
+    AlliedImage_t image;
+    if (allied_image_from_frame(frame, &image) != VmbErrorSuccess)
+    {
+        return;
+    }
+    // spots are found in sensor coordinates, from the offsets the frame was exposed with
+    AlliedSpot_t spots[ALLIED_TRACK_MAX_SPOTS];
+    VmbUint32_t count = 0;
+    if (allied_spot_find(ts->finder, &image, offset[0], offset[1], spots, ts->config.max_spots, &count) != VmbErrorSuccess)
+    {
+        return;
+    }
+    double measure_ms = allied_now_ms() - now;
+    double x = 0, y = 0;
+    if (count > 0 && ts->config.follow == AlliedTrackMean)
+    {
+        double flux = 0;
+        for (VmbUint32_t i = 0; i < count; i++)
+        {
+            x += spots[i].flux * spots[i].x;
+            y += spots[i].flux * spots[i].y;
+            flux += spots[i].flux;
+        }
+        x /= flux;
+        y /= flux;
+    }
+    else if (count > 0)
+    {
+        x = spots[0].x;
+        y = spots[0].y;
+    }
+    pthread_mutex_lock(&(ts->lock));
+    AlliedTrackingStatus_t *status = &(ts->status);
+    status->locked = count > 0;
+    status->frame_id = frame->frameID;
+    status->count = count;
+    memcpy(status->spots, spots, count * sizeof(AlliedSpot_t));
+    status->measured++;
+    status->measure_ms = measure_ms;
+    if (count == 0)
+    {
+        status->lost++;
+    }
+    else
+    {
+        status->x = x;
+        status->y = y;
+        ts->measure.frame_id = frame->frameID;
+        ts->measure.time_ms = now;
+        ts->measure.x = x;
+        ts->measure.y = y;
+        ts->measured = true;
+        pthread_cond_signal(&(ts->wake));
+    }
+    pthread_mutex_unlock(&(ts->lock));
+}
+
+/**
+ * @brief Free the spare calibrated image buffers. Called with the stage lock held, or once the camera is closed.
+ *
+ * @param stage Calibration stage
+ */
+static void allied_calib_spares_free(AlliedCalibStage_s *stage)
+{
+    for (VmbUint32_t i = 0; i < stage->spares; i++)
+    {
+        free(stage->spare[i]);
+    }
+    free(stage->spare);
+    stage->spare = NULL;
+    stage->spares = 0;
+}
+
+/**
+ * @brief Allocate calibrated image buffers for the frame slots that are too small for the installed calibration. A slot may be in use
+ * until the delivery thread next calibrates its frame, so the buffers are swapped in then. Called with the stage lock held.
+ *
+ * @param ihandle Camera handle
+ * @return VmbError_t
+ */
+static VmbError_t allied_calib_reserve(struct camera_handle_s *ihandle)
+{
+    AlliedCalibStage_s *stage = &(ihandle->calib);
+    AlliedFrameBuffer_t framebuf = ihandle->framebuf;
+    allied_calib_spares_free(stage);
+    if (stage->calib == NULL || framebuf == NULL || framebuf->slots == NULL)
+    {
+        return VmbErrorSuccess;
+    }
+    size_t size = (stage->size + 63) / 64 * 64; // aligned_alloc requires a multiple of alignment
+    stage->spare = (VmbUchar_t **)calloc(framebuf->num_frames, sizeof(VmbUchar_t *));
+    if (stage->spare == NULL)
+    {
+        return VmbErrorResources;
+    }
+    stage->spares = (VmbUint32_t)framebuf->num_frames;
+    for (VmbUint32_t i = 0; i < stage->spares; i++)
+    {
+        if (framebuf->slots[i].calib_alloc >= stage->size)
+        {
+            continue;
+        }
+        stage->spare[i] = (VmbUchar_t *)aligned_alloc(64, size);
+        if (stage->spare[i] == NULL)
+        {
+            allied_calib_spares_free(stage);
+            return VmbErrorResources;
+        }
+    }
+    return VmbErrorSuccess;
+}
+
+static void allied_calib_stage(struct camera_handle_s *ihandle, const VmbFrame_t *frame, AlliedFrameSlot_s *slot)
+{
+    AlliedCalibStage_s *stage = &(ihandle->calib);
+    slot->calib_valid = false;
+    if (!atomic_load_explicit(&(stage->enabled), memory_order_acquire))
+    {
+        return;
+    }
+    pthread_mutex_lock(&(stage->lock));
+    const AlliedCalibGeometry_t *geometry = &(stage->geometry);
+    AlliedCalibration_t calib = stage->calib;
+    AlliedImage_t image;
+    if (calib == NULL || frame->width != geometry->width || frame->height != geometry->height || frame->offsetX != geometry->offset_x ||
+        frame->offsetY != geometry->offset_y || frame->pixelFormat != geometry->format ||
+        atomic_load_explicit(&(ihandle->binning), memory_order_relaxed) != geometry->binning || allied_image_from_frame(frame, &image) != VmbErrorSuccess)
+    {
+        pthread_mutex_unlock(&(stage->lock));
+        return;
+    }
+    if (slot->calib_alloc < stage->size)
+    {
+        // nobody else holds the frame, so its buffer is swapped for the one allocated with the calibration
+        VmbUint32_t index = (VmbUint32_t)(slot - ihandle->framebuf->slots);
+        if (index >= stage->spares || stage->spare[index] == NULL)
+        {
+            pthread_mutex_unlock(&(stage->lock));
+            return;
+        }
+        VmbUchar_t *old = (VmbUchar_t *)slot->calib.data;
+        slot->calib.data = stage->spare[index];
+        slot->calib_alloc = (stage->size + 63) / 64 * 64;
+        stage->spare[index] = old; // freed by the next allied_calib_reserve
+    }
+    // the frame is calibrated without the lock; allied_set_calibration waits for it before returning
+    stage->busy = true;
+    pthread_mutex_unlock(&(stage->lock));
+    slot->calib.stride = 0;
+    bool valid = allied_calib_apply(calib, &image, &(slot->calib)) == VmbErrorSuccess;
+    pthread_mutex_lock(&(stage->lock));
+    stage->busy = false;
+    pthread_cond_broadcast(&(stage->idle));
+    pthread_mutex_unlock(&(stage->lock));
+    slot->calib_valid = valid;
+}
+
+static void allied_defect_stage(struct camera_handle_s *ihandle, VmbFrame_t *frame)
+{
+    AlliedDefectStage_s *stage = &(ihandle->defects);
+    AlliedImage_t image;
+    if (!atomic_load_explicit(&(stage->enabled), memory_order_acquire) || allied_image_from_frame(frame, &image) != VmbErrorSuccess)
+    {
+        return;
+    }
+    AlliedCalibGeometry_t geometry = {frame->offsetX, frame->offsetY, frame->width, frame->height,
+                                      (VmbUint32_t)atomic_load_explicit(&(ihandle->binning), memory_order_relaxed), frame->pixelFormat};
+    // the missing rows of a truncated frame would read as defects, it is corrected but not sampled
+    bool detect = atomic_load_explicit(&(stage->detect), memory_order_acquire);
+    if (detect && !allied_frame_complete(frame))
+    {
+        atomic_fetch_add_explicit(&(stage->incomplete), 1, memory_order_relaxed);
+        detect = false;
+    }
+    // the worker holds the detector while it replaces it or makes a map, frames delivered meanwhile are not sampled
+    if (detect && pthread_mutex_trylock(&(stage->detector_lock)) == 0)
+    {
+        // the geometry is kept if the detector could not be made for it, so that it is not attempted again
+        const AlliedCalibGeometry_t *g = &(stage->geometry);
+        bool updated = false, same = g->offset_x == geometry.offset_x && g->offset_y == geometry.offset_y && g->width == geometry.width &&
+                                     g->height == geometry.height && g->binning == geometry.binning && g->format == geometry.format;
+        if (same && stage->detector != NULL && allied_defect_detector_add(stage->detector, &image, &updated) == VmbErrorSuccess)
+        {
+            atomic_store(&(stage->passes), allied_defect_detector_passes(stage->detector));
+        }
+        pthread_mutex_unlock(&(stage->detector_lock));
+        // defects are detected per region of interest, the detectors and their maps are made by the worker
+        if (!same || updated)
+        {
+            pthread_mutex_lock(&(stage->lock));
+            if (!same && !stage->wanted)
+            {
+                stage->want = geometry;
+                stage->wanted = true;
+            }
+            stage->build = stage->build || updated;
+            pthread_cond_signal(&(stage->wake));
+            pthread_mutex_unlock(&(stage->lock));
+        }
+    }
+    pthread_mutex_lock(&(stage->lock));
+    if (stage->map != NULL)
+    {
+        AlliedCalibGeometry_t g;
+        allied_defect_map_geometry(stage->map, &g);
+        if (g.offset_x == geometry.offset_x && g.offset_y == geometry.offset_y && allied_defect_map_correct(stage->map, &image) == VmbErrorSuccess)
+        {
+            atomic_fetch_add_explicit(&(stage->corrected), 1, memory_order_relaxed);
+        }
+    }
+    pthread_mutex_unlock(&(stage->lock));
+}
+
+static void allied_frame_put(struct camera_handle_s *ihandle, VmbFrame_t *frame)
+{
+    AlliedFrameSlot_s *slot = (AlliedFrameSlot_s *)frame->context[CONTEXT_SLOT_HANDLE];
+    unsigned int refs = atomic_load_explicit(&(slot->refs), memory_order_relaxed);
+    do
+    {
+        if (refs == 0) // stale release after the frames were requeued
+        {
+            return;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&(slot->refs), &refs, refs - 1, memory_order_acq_rel, memory_order_relaxed));
+    if (refs != 1)
+    {
+        return;
+    }
+    atomic_fetch_add_explicit(&(slot->generation), 1, memory_order_release); // outstanding references are now stale
+    if (ihandle->streaming && ihandle->guard.depth > 0)
+    {
+        frame = allied_guard_swap(ihandle, frame);
+    }
+    if (frame != NULL && ihandle->streaming)
+    {
+        VmbCaptureFrameQueue(ihandle->handle, frame, &FrameCaptureCallback);
+    }
+}
+
+static VmbFrame_t *allied_guard_swap(struct camera_handle_s *ihandle, VmbFrame_t *frame)
+{
+    AlliedFrameGuard_s *guard = &(ihandle->guard);
+    size_t len = ihandle->framebuf->stride;
+    // keep enough frames with the driver to not stall the stream
+    VmbUint32_t limit = ihandle->framebuf->num_frames / 2;
+    limit = guard->depth < limit ? guard->depth : limit;
+    if (limit == 0)
+    {
+        return frame;
+    }
+    pthread_mutex_lock(&(guard->lock));
+    if (mprotect(frame->buffer, len, PROT_NONE) != 0)
+    {
+        pthread_mutex_unlock(&(guard->lock));
+        return frame; // not page aligned, requeue unprotected
+    }
+    VmbFrame_t *oldest = NULL;
+    if (guard->count >= limit)
+    {
+        oldest = guard->ring[guard->head];
+        guard->head = (guard->head + 1) % guard->depth;
+        guard->count--;
+        mprotect(oldest->buffer, len, PROT_READ | PROT_WRITE);
+    }
+    guard->ring[(guard->head + guard->count) % guard->depth] = frame;
+    guard->count++;
+    pthread_mutex_unlock(&(guard->lock));
+    return oldest;
+}
+
+static void allied_guard_flush(struct camera_handle_s *ihandle)
+{
+    AlliedFrameGuard_s *guard = &(ihandle->guard);
+    pthread_mutex_lock(&(guard->lock));
+    while (guard->count > 0)
+    {
+        VmbFrame_t *frame = guard->ring[guard->head];
+        guard->head = (guard->head + 1) % guard->depth;
+        guard->count--;
+        mprotect(frame->buffer, ihandle->framebuf->stride, PROT_READ | PROT_WRITE);
+    }
+    guard->head = 0;
+    pthread_mutex_unlock(&(guard->lock));
+}
+
+/**
+ * @brief Build the (cropped) view of a frame for a subscriber.
+ *
+ * @param sub Subscriber
+ * @param frame Frame
+ * @param view View to fill
+ */
+static void allied_frame_view(const struct allied_subscriber_s *sub, VmbFrame_t *frame, AlliedFrameView_t *view)
+{
+    VmbUint32_t bits = (frame->pixelFormat >> 16) & 0xff; // effective bits per pixel
+    VmbUchar_t *data = frame->imageData != NULL ? frame->imageData : (VmbUchar_t *)frame->buffer;
+    view->frame = frame;
+    view->data = data;
+    view->width = frame->width;
+    view->height = frame->height;
+    view->stride = (VmbUint32_t)(((VmbUint64_t)frame->width * bits + 7) / 8);
+    view->offset_x = 0;
+    view->offset_y = 0;
+    view->format = frame->pixelFormat;
+    view->generation = atomic_load_explicit(&(((AlliedFrameSlot_s *)frame->context[CONTEXT_SLOT_HANDLE])->generation), memory_order_acquire);
+    if (sub->roi[2] == 0 || sub->roi[3] == 0)
+    {
+        return;
+    }
+    // crops must start on a byte boundary, packed rows must be byte aligned; the pixel format can have changed since the subscription was checked
+    if (((VmbUint64_t)frame->width * bits) % 8 != 0 || ((VmbUint64_t)sub->roi[0] * bits) % 8 != 0)
+    {
+        return;
+    }
+    VmbUint32_t x = sub->roi[0] < frame->width ? sub->roi[0] : frame->width;
+    VmbUint32_t y = sub->roi[1] < frame->height ? sub->roi[1] : frame->height;
+    view->width = (frame->width - x) < sub->roi[2] ? (frame->width - x) : sub->roi[2];
+    view->height = (frame->height - y) < sub->roi[3] ? (frame->height - y) : sub->roi[3];
+    view->offset_x = x;
+    view->offset_y = y;
+    view->data = data + (VmbUint64_t)y * view->stride + ((VmbUint64_t)x * bits) / 8;
+}
+
+/**
+ * @brief Hand a frame to a subscriber: run its callback, or queue the frame following its backpressure policy.
+ *
+ * @param ihandle Camera handle
+ * @param sub Subscriber, pinned by the fan-out
+ * @param frame Frame
+ * @param slot Frame slot
+ */
+static void allied_deliver(struct camera_handle_s *ihandle, struct allied_subscriber_s *sub, VmbFrame_t *frame, AlliedFrameSlot_s *slot)
+{
+    if (atomic_load_explicit(&(sub->closing), memory_order_relaxed) || !allied_decimator_pass(&(sub->decimator)))
+    {
+        return;
+    }
+    AlliedFrameView_t view;
+    allied_frame_view(sub, frame, &view);
+    if (sub->callback != NULL)
+    {
+        sub->callback(sub, &view, sub->user_data);
+        return;
+    }
+    pthread_mutex_lock(&(sub->qlock));
+    if (sub->count == sub->depth)
+    {
+        switch (sub->policy)
+        {
+        case AlliedBackpressureDropOldest:
+        {
+            VmbFrame_t *oldest = sub->queue[sub->head].frame;
+            sub->head = (sub->head + 1) % sub->depth;
+            sub->count--;
+            atomic_fetch_add_explicit(&(sub->dropped), 1, memory_order_relaxed);
+            allied_frame_put(ihandle, oldest);
+            break;
+        }
+        case AlliedBackpressureBlock:
+            while (sub->count == sub->depth && !atomic_load(&(sub->closing)))
+            {
+                pthread_cond_wait(&(sub->nonfull), &(sub->qlock));
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    if (sub->count < sub->depth && !atomic_load(&(sub->closing)))
+    {
+        atomic_fetch_add_explicit(&(slot->refs), 1, memory_order_relaxed);
+        sub->queue[(sub->head + sub->count) % sub->depth] = view;
+        sub->count++;
+        pthread_cond_signal(&(sub->nonempty));
+    }
+    else
+    {
+        atomic_fetch_add_explicit(&(sub->dropped), 1, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&(sub->qlock));
+}
+
+static void allied_fanout(struct camera_handle_s *ihandle, VmbFrame_t *frame, bool all, bool changes)
+{
+    AlliedFrameSlot_s *slot = (AlliedFrameSlot_s *)frame->context[CONTEXT_SLOT_HANDLE];
+    // pin the subscribers under the list lock, then deliver without it, so that callbacks can subscribe and unsubscribe,
+    // and a blocking subscriber does not hold up (un)subscribing
+    struct allied_subscriber_s *first = NULL, **link = &first;
+    pthread_rwlock_rdlock(&(ihandle->subs_lock));
+    for (struct allied_subscriber_s *sub = ihandle->subs; sub != NULL; sub = sub->next)
+    {
+        if (!(sub->changes_only ? changes : all))
+        {
+            continue;
+        }
+        pthread_mutex_lock(&(sub->qlock));
+        sub->pins++;
+        pthread_mutex_unlock(&(sub->qlock));
+        *link = sub;
+        link = &(sub->fan_next);
+    }
+    *link = NULL;
+    pthread_rwlock_unlock(&(ihandle->subs_lock));
+    struct camera_handle_s *outer = fanout_camera;
+    fanout_camera = ihandle;
+    struct allied_subscriber_s *next = NULL;
+    for (struct allied_subscriber_s *sub = first; sub != NULL; sub = next)
+    {
+        next = sub->fan_next;
+        allied_deliver(ihandle, sub, frame, slot);
+        pthread_mutex_lock(&(sub->qlock));
+        bool reap = --sub->pins == 0 && sub->reap;
+        if (sub->pins == 0)
+        {
+            pthread_cond_broadcast(&(sub->idle));
+        }
+        pthread_mutex_unlock(&(sub->qlock));
+        if (reap)
+        {
+            allied_subscriber_free(sub);
+        }
+    }
+    fanout_camera = outer;
+}
+
+static void allied_change_fanout(struct camera_handle_s *ihandle, VmbFrame_t *frame, AlliedFrameSlot_s *slot)
+{
+    AlliedChangeStage_s *stage = &(ihandle->change);
+    // an incomplete frame was not compared, only the subscribers of every frame receive it
+    if (!slot->change_valid && stage->det != NULL && !allied_frame_complete(frame))
+    {
+        if (ihandle->subs != NULL)
+        {
+            allied_fanout(ihandle, frame, true, false);
+        }
+        return;
+    }
+    // without change detection, every subscriber receives every frame
+    if (!slot->change_valid)
+    {
+        allied_change_release(ihandle, true);
+        if (ihandle->subs != NULL)
+        {
+            allied_fanout(ihandle, frame, true, true);
+        }
+        return;
+    }
+    if (slot->change.forwarded)
+    {
+        // the preceding window goes out first, oldest first
+        while (stage->count > 0)
+        {
+            VmbFrame_t *held = stage->held[stage->head];
+            stage->head = (stage->head + 1) % stage->pre;
+            stage->count--;
+            ((AlliedFrameSlot_s *)held->context[CONTEXT_SLOT_HANDLE])->change.forwarded = true;
+            atomic_fetch_add_explicit(&(stage->forwarded), 1, memory_order_relaxed);
+            if (ihandle->subs != NULL)
+            {
+                allied_fanout(ihandle, held, false, true);
+            }
+            allied_frame_put(ihandle, held);
+        }
+        if (ihandle->subs != NULL)
+        {
+            allied_fanout(ihandle, frame, true, true);
+        }
+        return;
+    }
+    if (ihandle->subs != NULL)
+    {
+        allied_fanout(ihandle, frame, true, false);
+    }
+    // keep enough frames with the driver to not stall the stream
+    VmbUint32_t limit = ihandle->framebuf->num_frames / 2;
+    limit = stage->pre < limit ? stage->pre : limit;
+    if (limit == 0 || ihandle->subs == NULL)
+    {
+        allied_change_release(ihandle, true);
+        return;
+    }
+    // hold the frame for the preceding window of the next event, in place of the oldest held frame
+    while (stage->count >= limit)
+    {
+        VmbFrame_t *oldest = stage->held[stage->head];
+        stage->head = (stage->head + 1) % stage->pre;
+        stage->count--;
+        allied_frame_put(ihandle, oldest);
+    }
+    atomic_fetch_add_explicit(&(slot->refs), 1, memory_order_relaxed);
+    stage->held[(stage->head + stage->count) % stage->pre] = frame;
+    stage->count++;
+}
+
+static void allied_change_release(struct camera_handle_s *ihandle, bool requeue)
+{
+    AlliedChangeStage_s *stage = &(ihandle->change);
+    while (stage->count > 0)
+    {
+        VmbFrame_t *frame = stage->held[stage->head];
+        stage->head = (stage->head + 1) % stage->pre;
+        stage->count--;
+        if (requeue)
+        {
+            allied_frame_put(ihandle, frame);
+        }
+    }
+    stage->head = 0;
+}
+
+static void allied_subscriber_flush(struct allied_subscriber_s *sub, bool requeue)
+{
+    pthread_mutex_lock(&(sub->qlock));
+    while (sub->count > 0)
+    {
+        VmbFrame_t *frame = sub->queue[sub->head].frame;
+        sub->head = (sub->head + 1) % sub->depth;
+        sub->count--;
+        if (requeue)
+        {
+            allied_frame_put(sub->camera, frame);
+        }
+    }
+    pthread_cond_broadcast(&(sub->nonfull));
+    pthread_mutex_unlock(&(sub->qlock));
+}
+
+VmbError_t allied_subscribe(AlliedCameraHandle_t handle, const AlliedSubscription_t *config, AlliedSubscriber_t *sub)
+{
+    assert(handle);
+    assert(config);
+    assert(sub);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    if (config->callback == NULL && config->queue_depth == 0)
+    {
+        return VmbErrorBadParameter;
+    }
+    if (config->policy > AlliedBackpressureBlock)
+    {
+        return VmbErrorBadParameter;
+    }
+    ALLIEDEXIT(allied_check_decimation, &(config->decimation));
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    if (config->roi_width != 0 && config->roi_height != 0)
+    {
+        // crops of packed formats must start on a byte boundary
+        const char *name = NULL;
+        VmbInt64_t format = 0;
+        ALLIEDEXIT(VmbFeatureEnumGet, ihandle->handle, "PixelFormat", &name);
+        ALLIEDEXIT(VmbFeatureEnumAsInt, ihandle->handle, "PixelFormat", name, &format);
+        if (((VmbUint64_t)config->roi_x * ((format >> 16) & 0xff)) % 8 != 0)
+        {
+            return VmbErrorBadParameter;
+        }
+    }
+    struct allied_subscriber_s *isub = (struct allied_subscriber_s *)malloc(sizeof(struct allied_subscriber_s));
+    if (isub == NULL)
+    {
+        return VmbErrorResources;
+    }
+    memset(isub, 0, sizeof(struct allied_subscriber_s));
+    if (config->callback == NULL)
+    {
+        isub->queue = (AlliedFrameView_t *)malloc(config->queue_depth * sizeof(AlliedFrameView_t));
+        if (isub->queue == NULL)
+        {
+            free(isub);
+            return VmbErrorResources;
+        }
+        isub->depth = config->queue_depth;
+    }
+    isub->camera = ihandle;
+    isub->callback = config->callback;
+    isub->user_data = config->user_data;
+    isub->policy = config->policy;
+    isub->roi[0] = config->roi_x;
+    isub->roi[1] = config->roi_y;
+    isub->roi[2] = config->roi_width;
+    isub->roi[3] = config->roi_height;
+    isub->changes_only = config->changes_only;
+    pthread_mutex_init(&(isub->decimator.lock), NULL);
+    allied_gate_reset(&(isub->decimator.gate), &(config->decimation));
+    pthread_mutex_init(&(isub->qlock), NULL);
+    pthread_cond_init(&(isub->nonempty), NULL);
+    pthread_cond_init(&(isub->nonfull), NULL);
+    pthread_cond_init(&(isub->idle), NULL);
+    // append, so that frames are delivered in subscription order
+    pthread_rwlock_wrlock(&(ihandle->subs_lock));
+    struct allied_subscriber_s **tail = &(ihandle->subs);
+    while (*tail != NULL)
+    {
+        tail = &((*tail)->next);
+    }
+    *tail = isub;
+    pthread_rwlock_unlock(&(ihandle->subs_lock));
+    *sub = isub;
+    return VmbErrorSuccess;
+}
+
+/**
+ * @brief Release the frames queued for a subscriber and free it.
+ *
+ * @param isub Subscriber, no longer listed nor pinned
+ */
+static void allied_subscriber_free(struct allied_subscriber_s *isub)
+{
+    allied_subscriber_flush(isub, true);
+    pthread_cond_destroy(&(isub->nonempty));
+    pthread_cond_destroy(&(isub->nonfull));
+    pthread_cond_destroy(&(isub->idle));
+    pthread_mutex_destroy(&(isub->qlock));
+    pthread_mutex_destroy(&(isub->decimator.lock));
+    free(isub->queue);
+    free(isub);
+}
+
+/**
+ * @brief Remove a subscriber from its camera and free it. Called from a subscription callback, the subscriber is freed by the fan-out
+ * once it lets go of it; otherwise, this waits for the fan-outs delivering to the subscriber to finish.
+ *
+ * @param isub Subscriber
+ */
+static void allied_subscriber_destroy(struct allied_subscriber_s *isub)
+{
+    _AlliedCameraHandle_s *ihandle = isub->camera;
+    // wake up the delivery thread if it is blocked on this subscriber
+    atomic_store(&(isub->closing), true);
+    pthread_mutex_lock(&(isub->qlock));
+    pthread_cond_broadcast(&(isub->nonfull));
+    pthread_cond_broadcast(&(isub->nonempty));
+    pthread_mutex_unlock(&(isub->qlock));
+    pthread_rwlock_wrlock(&(ihandle->subs_lock));
+    for (struct allied_subscriber_s **it = &(ihandle->subs); *it != NULL; it = &((*it)->next))
+    {
+        if (*it == isub)
+        {
+            *it = isub->next;
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&(ihandle->subs_lock));
+    pthread_mutex_lock(&(isub->qlock));
+    if (isub->pins > 0 && fanout_camera == ihandle)
+    {
+        // inside a callback of this camera: the running fan-out reaps the subscriber
+        isub->reap = true;
+        pthread_mutex_unlock(&(isub->qlock));
+        allied_subscriber_flush(isub, true);
+        return;
+    }
+    while (isub->pins > 0)
+    {
+        pthread_cond_wait(&(isub->idle), &(isub->qlock));
+    }
+    pthread_mutex_unlock(&(isub->qlock));
+    allied_subscriber_free(isub);
+}
+
+VmbError_t allied_unsubscribe(AlliedSubscriber_t *sub)
+{
+    assert(sub);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    if (*sub == NULL)
+    {
+        return VmbErrorBadHandle;
+    }
+    allied_subscriber_destroy(*sub);
+    *sub = NULL;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_subscriber_set_decimation(AlliedSubscriber_t sub, const AlliedDecimation_t *config)
+{
+    assert(sub);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    ALLIEDEXIT(allied_check_decimation, config);
+    AlliedDecimator_s *decimator = &(sub->decimator);
+    pthread_mutex_lock(&(decimator->lock));
+    memset(&(decimator->next), 0, sizeof(AlliedDecimation_t));
+    if (config != NULL)
+    {
+        decimator->next = *config;
+    }
+    atomic_store_explicit(&(decimator->dirty), true, memory_order_release); // applied by the delivery thread
+    pthread_mutex_unlock(&(decimator->lock));
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_subscriber_pop(AlliedSubscriber_t sub, AlliedFrameView_t *view, int timeout_ms)
+{
+    assert(sub);
+    assert(view);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    if (sub->callback != NULL)
+    {
+        return VmbErrorInvalidCall;
+    }
+    VmbError_t err = VmbErrorSuccess;
+    struct timespec deadline;
+    if (timeout_ms > 0)
+    {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+    pthread_mutex_lock(&(sub->qlock));
+    while (sub->count == 0 && err == VmbErrorSuccess)
+    {
+        if (atomic_load(&(sub->closing)) || timeout_ms == 0)
+        {
+            err = VmbErrorTimeout;
+        }
+        else if (timeout_ms < 0)
+        {
+            pthread_cond_wait(&(sub->nonempty), &(sub->qlock));
+        }
+        else if (pthread_cond_timedwait(&(sub->nonempty), &(sub->qlock), &deadline) != 0)
+        {
+            err = sub->count > 0 ? VmbErrorSuccess : VmbErrorTimeout;
+        }
+    }
+    if (err == VmbErrorSuccess)
+    {
+        *view = sub->queue[sub->head];
+        sub->head = (sub->head + 1) % sub->depth;
+        sub->count--;
+        pthread_cond_signal(&(sub->nonfull));
+    }
+    pthread_mutex_unlock(&(sub->qlock));
+    return err;
+}
+
+VmbError_t allied_subscriber_counts(AlliedSubscriber_t sub, VmbUint64_t *delivered, VmbUint64_t *skipped, VmbUint64_t *dropped)
+{
+    assert(sub);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    if (delivered != NULL)
+    {
+        *delivered = atomic_load(&(sub->decimator.delivered));
+    }
+    if (skipped != NULL)
+    {
+        *skipped = atomic_load(&(sub->decimator.skipped));
+    }
+    if (dropped != NULL)
+    {
+        *dropped = atomic_load(&(sub->dropped));
+    }
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_frame_retain(VmbFrame_t *frame)
+{
+    assert(frame);
+    AlliedFrameSlot_s *slot = (AlliedFrameSlot_s *)frame->context[CONTEXT_SLOT_HANDLE];
+    if (slot == NULL || atomic_load(&(slot->refs)) == 0)
+    {
+        return VmbErrorInvalidCall;
+    }
+    atomic_fetch_add_explicit(&(slot->refs), 1, memory_order_relaxed);
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_frame_release(VmbFrame_t *frame)
+{
+    assert(frame);
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)frame->context[CONTEXT_IDX_HANDLE];
+    if (ihandle == NULL || frame->context[CONTEXT_SLOT_HANDLE] == NULL)
+    {
+        return VmbErrorBadParameter;
+    }
+    allied_frame_put(ihandle, frame);
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_frame_ref(VmbFrame_t *frame, AlliedFrameRef_t *ref)
+{
+    assert(frame);
+    assert(ref);
+    AlliedFrameSlot_s *slot = (AlliedFrameSlot_s *)frame->context[CONTEXT_SLOT_HANDLE];
+    if (slot == NULL || atomic_load(&(slot->refs)) == 0)
+    {
+        return VmbErrorInvalidCall;
+    }
+    ref->frame = frame;
+    ref->generation = atomic_load_explicit(&(slot->generation), memory_order_acquire);
+    return VmbErrorSuccess;
+}
+
+bool allied_frame_ref_valid(const AlliedFrameRef_t *ref)
+{
+    assert(ref);
+    if (ref->frame == NULL)
+    {
+        return false;
+    }
+    AlliedFrameSlot_s *slot = (AlliedFrameSlot_s *)ref->frame->context[CONTEXT_SLOT_HANDLE];
+    return slot != NULL && atomic_load_explicit(&(slot->generation), memory_order_acquire) == ref->generation;
+}
+
+VmbError_t allied_queue_capture(AlliedCameraHandle_t handle, AlliedCaptureCallback callback, void *user_data)
+{
+    assert(handle);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    if (callback == NULL) // frames are consumed by subscribers only
+    {
+        callback = &allied_noop_callback;
+    }
+    eprintlf("Queueing capture: %p", handle);
+    VmbError_t err;
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    AlliedFrameBuffer_t framebuf = ihandle->framebuf;
+    if (framebuf == NULL)
+    {
+        return VmbErrorResources;
+    }
+    if (framebuf->queued) // already queued, so dequeue first
+    {
+        ALLIEDEXIT(allied_dequeue_capture, handle);
+    }
+    // announce the buffers
+    for (VmbUint32_t i = 0; i < framebuf->num_frames; i++)
+    {
+        err = ALLIEDCALL(VmbFrameAnnounce, ihandle->handle, &(framebuf->frames[i]), sizeof(VmbFrame_t));
+        if (err != VmbErrorSuccess)
+        {
+            goto err_cleanup;
+        }
+        framebuf->announced = true;
+    }
+    // start the capture engine
+    err = ALLIEDCALL(VmbCaptureStart, ihandle->handle);
+    if (err != VmbErrorSuccess)
+    {
+        goto err_cleanup;
+    }
+    eprintlf("Started capture");
+    ihandle->streaming = true;
+    // store callback ptr
+    for (VmbUint32_t i = 0; i < framebuf->num_frames; i++)
+    {
+        framebuf->frames[i].context[CONTEXT_CB_HANDLE] = callback;
+        framebuf->frames[i].context[CONTEXT_DATA_HANDLE] = user_data;
+        atomic_store(&(framebuf->slots[i].refs), 0);
+    }
+    // queue up the frames
+    VmbUint32_t frames_unqueued = framebuf->num_frames;
+    while (--frames_unqueued)
+    {
+        uint32_t frame_index = framebuf->num_frames - frames_unqueued - 1;
+        err = ALLIEDCALL(VmbCaptureFrameQueue, ihandle->handle, &(framebuf->frames[frame_index]), &FrameCaptureCallback);
+        if (err != VmbErrorSuccess)
+        {
+            break;
+        }
+        eprintlf("Queued frame %u", frame_index);
+    }
+    if (!frames_unqueued)
+    {
+        framebuf->queued = true;
+        return VmbErrorSuccess;
+    }
+    // if we reach here, something went wrong
+err_cleanup:
+    allied_stop_capture(handle);
+    allied_dequeue_capture(handle);
+    return err;
+}
+
+static VmbError_t allied_check_decimation(const AlliedDecimation_t *config)
+{
+    if (config == NULL)
+    {
+        return VmbErrorSuccess;
+    }
+    switch (config->mode)
+    {
+    case AlliedDecimationNone:
+        return VmbErrorSuccess;
+    case AlliedDecimationEveryN:
+        return config->every_n > 0 ? VmbErrorSuccess : VmbErrorBadParameter;
+    case AlliedDecimationInterval:
+        return config->interval_ms >= 0.0 ? VmbErrorSuccess : VmbErrorBadParameter;
+    case AlliedDecimationLeakyBucket:
+        return (config->rate_hz > 0.0 && config->burst > 0) ? VmbErrorSuccess : VmbErrorBadParameter;
+    default:
+        return VmbErrorBadParameter;
+    }
+}
+
+static void allied_gate_reset(AlliedFrameGate_s *gate, const AlliedDecimation_t *config)
+{
+    assert(gate);
+    memset(gate, 0, sizeof(AlliedFrameGate_s));
+    if (config != NULL)
+    {
+        gate->config = *config;
+    }
+    gate->last_ms = -1;
+    gate->tokens = gate->config.burst; // start with a full bucket
+}
+
+static bool allied_gate_pass(AlliedFrameGate_s *gate, double now_ms)
+{
+    switch (gate->config.mode)
+    {
+    case AlliedDecimationEveryN:
+        return (gate->count++ % gate->config.every_n) == 0;
+    case AlliedDecimationInterval:
+        if (gate->last_ms >= 0 && (now_ms - gate->last_ms) < gate->config.interval_ms)
+        {
+            return false;
+        }
+        gate->last_ms = now_ms;
+        return true;
+    case AlliedDecimationLeakyBucket:
+        if (gate->last_ms >= 0)
+        {
+            gate->tokens += (now_ms - gate->last_ms) * 1e-3 * gate->config.rate_hz;
+            if (gate->tokens > gate->config.burst)
+            {
+                gate->tokens = gate->config.burst;
+            }
+        }
+        gate->last_ms = now_ms;
+        if (gate->tokens < 1.0)
+        {
+            return false;
+        }
+        gate->tokens -= 1.0;
+        return true;
+    default:
+        return true;
+    }
+}
+
+VmbError_t allied_set_decimation(AlliedCameraHandle_t handle, const AlliedDecimation_t *config)
+{
+    assert(handle);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    ALLIEDEXIT(allied_check_decimation, config);
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    AlliedDecimator_s *decimator = &(ihandle->decimator);
+    pthread_mutex_lock(&(decimator->lock));
+    memset(&(decimator->next), 0, sizeof(AlliedDecimation_t));
+    if (config != NULL)
+    {
+        decimator->next = *config;
+    }
+    atomic_store_explicit(&(decimator->dirty), true, memory_order_release); // applied by the delivery thread
+    pthread_mutex_unlock(&(decimator->lock));
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_get_decimation(AlliedCameraHandle_t handle, AlliedDecimation_t *config)
+{
+    assert(handle);
+    assert(config);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    AlliedDecimator_s *decimator = &(ihandle->decimator);
+    pthread_mutex_lock(&(decimator->lock));
+    *config = atomic_load(&(decimator->dirty)) ? decimator->next : decimator->gate.config;
+    pthread_mutex_unlock(&(decimator->lock));
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_get_frame_counts(AlliedCameraHandle_t handle, VmbUint64_t *delivered, VmbUint64_t *skipped)
+{
+    assert(handle);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    if (delivered != NULL)
+    {
+        *delivered = atomic_load(&(ihandle->decimator.delivered));
+    }
+    if (skipped != NULL)
+    {
+        *skipped = atomic_load(&(ihandle->decimator.skipped));
+    }
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_start_capture(AlliedCameraHandle_t handle)
+{
+    assert(handle);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    if (!ihandle->streaming)
+    {
+        return VmbErrorInvalidAccess;
+    }
+    if (!ihandle->framebuf->queued)
+    {
+        return VmbErrorInvalidAccess;
+    }
+    VmbError_t err = ALLIEDCALL(VmbFeatureCommandRun, ihandle->handle, "AcquisitionStart");
+    if (err == VmbErrorSuccess)
+    {
+        ihandle->acquiring = true;
+        eprintlf("Started acquisition");
+        return VmbErrorSuccess;
+    }
+
+    ihandle->acquiring = false;
+    eprintlf("Error starting acquisition: %s", allied_strerr(err));
+    return err;
+}
+
+VmbError_t allied_stop_capture(AlliedCameraHandle_t handle)
+{
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    assert(handle);
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    if (!ihandle->acquiring)
+    {
+        return VmbErrorSuccess;
+    }
+    if (ihandle->acquiring)
+    {
+        ALLIEDEXIT(VmbFeatureCommandRun, ihandle->handle, "AcquisitionStop");
+        ihandle->acquiring = false;
+    }
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_dequeue_capture(AlliedCameraHandle_t handle)
+{
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    assert(handle);
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    if (ihandle->streaming)
+    {
+        ALLIEDEXIT(VmbCaptureEnd, ihandle->handle);
+        ihandle->streaming = false;
+    }
+    VmbCaptureQueueFlush(ihandle->handle);
+    // frames queued for subscribers are no longer valid
+    pthread_rwlock_rdlock(&(ihandle->subs_lock));
+    for (struct allied_subscriber_s *sub = ihandle->subs; sub != NULL; sub = sub->next)
+    {
+        allied_subscriber_flush(sub, false);
+    }
+    pthread_rwlock_unlock(&(ihandle->subs_lock));
+    allied_change_release(ihandle, false);
+    allied_guard_flush(ihandle);
+    // frames are revoked, every outstanding reference is stale
+    for (VmbUint32_t i = 0; ihandle->framebuf->slots != NULL && i < ihandle->framebuf->num_frames; i++)
+    {
+        atomic_store(&(ihandle->framebuf->slots[i].refs), 0);
+        atomic_fetch_add(&(ihandle->framebuf->slots[i].generation), 1);
+    }
+    ihandle->framebuf->queued = false;
+    while (ihandle->framebuf->announced && (VmbErrorSuccess != VmbFrameRevokeAll(ihandle->handle)))
+    {
+    }
+    ihandle->framebuf->announced = false;
+    return VmbErrorSuccess;
+}
+
+void allied_free_framebuf(AlliedFrameBuffer_t framebuf, bool frame_only)
+{
+    assert(framebuf);
+    if (framebuf->frames != NULL)
+    {
+        free(framebuf->frames);
+        framebuf->frames = NULL;
+    }
+    if (framebuf->slots != NULL)
+    {
+        for (size_t i = 0; i < framebuf->num_frames; i++)
+        {
+            free(framebuf->slots[i].stats);
+            free(framebuf->slots[i].calib.data);
+            free(framebuf->slots[i].beam);
+            free(framebuf->slots[i].phot);
+        }
+        free(framebuf->slots);
+        framebuf->slots = NULL;
+    }
+    if (frame_only)
+    {
+        return;
+    }
+    // clean up the buffer allocation
+    if (framebuf->buffer != NULL)
+    {
+        allied_numa_free(framebuf->buffer, framebuf->alloc_size, framebuf->mapped);
+        framebuf->buffer = NULL;
+    }
+    memset(framebuf, 0, sizeof(AlliedFrameBuffer_s));
+    return;
+}
+
+static void allied_stop_stages(struct camera_handle_s *ihandle)
+{
+    allied_exposure_stop(ihandle);
+    allied_track_stop(ihandle);
+    allied_dark_stop(ihandle);
+    allied_defect_stop(ihandle);
+    while (ihandle->subs != NULL)
+    {
+        allied_subscriber_destroy(ihandle->subs);
+    }
+}
+
+static void allied_free_handle(struct camera_handle_s *ihandle)
+{
+    if (ihandle->framebuf != NULL)
+    {
+        allied_guard_flush(ihandle);
+        allied_free_framebuf(ihandle->framebuf, false);
+        free(ihandle->framebuf);
+    }
+    pthread_mutex_destroy(&(ihandle->decimator.lock));
+    pthread_rwlock_destroy(&(ihandle->subs_lock));
+    pthread_mutex_destroy(&(ihandle->guard.lock));
+    pthread_mutex_destroy(&(ihandle->stats.lock));
+    pthread_mutex_destroy(&(ihandle->beam.lock));
+    pthread_mutex_destroy(&(ihandle->photometry.lock));
+    pthread_mutex_destroy(&(ihandle->change.lock));
+    pthread_mutex_destroy(&(ihandle->exposure.lock));
+    pthread_cond_destroy(&(ihandle->exposure.wake));
+    pthread_mutex_destroy(&(ihandle->calib.lock));
+    pthread_cond_destroy(&(ihandle->calib.idle));
+    pthread_mutex_destroy(&(ihandle->dark.lock));
+    pthread_cond_destroy(&(ihandle->dark.wake));
+    pthread_mutex_destroy(&(ihandle->defects.lock));
+    pthread_mutex_destroy(&(ihandle->defects.detector_lock));
+    pthread_cond_destroy(&(ihandle->defects.wake));
+    pthread_mutex_destroy(&(ihandle->tracking.lock));
+    pthread_cond_destroy(&(ihandle->tracking.wake));
+    free(ihandle->guard.ring);
+    free(ihandle->stats.scratch);
+    free(ihandle->exposure.scratch);
+    free(ihandle->exposure.stats);
+    allied_defect_detector_destroy(&(ihandle->defects.detector));
+    allied_defect_map_destroy(&(ihandle->defects.map));
+    allied_spot_finder_destroy(&(ihandle->tracking.finder));
+    allied_spot_finder_destroy(&(ihandle->tracking.next_finder));
+    allied_photometry_destroy(&(ihandle->photometry.phot));
+    allied_photometry_destroy(&(ihandle->photometry.next));
+    allied_change_destroy(&(ihandle->change.det));
+    allied_change_destroy(&(ihandle->change.next));
+    free(ihandle->change.held);
+    free(ihandle->change.next_held);
+    allied_calib_spares_free(&(ihandle->calib));
+    allied_phot_spares_free(&(ihandle->photometry));
+    free(ihandle);
+}
+
+VmbError_t allied_reset_camera(AlliedCameraHandle_t *handle)
+{
+    assert(handle);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    VmbError_t err;
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)(*handle);
+    allied_stop_stages(ihandle);
+    err = ALLIEDCALL(VmbFeatureCommandRun, ihandle->handle, "DeviceReset");
+    VmbCameraClose(ihandle->handle);
+    allied_free_handle(ihandle);
+    *handle = NULL;
+    return err;
+}
+
+VmbError_t allied_close_camera(AlliedCameraHandle_t *handle)
+{
+    assert(handle);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)(*handle);
+    ALLIEDEXIT(allied_stop_capture, *handle);
+    ALLIEDEXIT(allied_dequeue_capture, *handle);
+    allied_stop_stages(ihandle);
+    ALLIEDEXIT(VmbCameraClose, ihandle->handle);
+    allied_free_handle(ihandle);
+    *handle = NULL;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_set_temperature_src(AlliedCameraHandle_t handle, const char *src)
+{
+    assert(handle);
+    assert(src);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    return ALLIEDCALL(VmbFeatureEnumSet, ihandle->handle, "DeviceTemperatureSelector", src);
+}
+
+VmbError_t allied_get_temperature_src(AlliedCameraHandle_t handle, const char **src)
+{
+    assert(handle);
+    assert(src);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    return ALLIEDCALL(VmbFeatureEnumGet, ihandle->handle, "DeviceTemperatureSelector", src);
+}
+
+VmbError_t allied_get_temperature(AlliedCameraHandle_t handle, double *temp)
+{
+    assert(handle);
+    assert(temp);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    return ALLIEDCALL(VmbFeatureFloatGet, ihandle->handle, "DeviceTemperature", temp);
+}
+
+VmbError_t allied_get_sensor_size(AlliedCameraHandle_t handle, VmbInt64_t *width, VmbInt64_t *height)
+{
+    assert(handle);
+    assert(width);
+    assert(height);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    ALLIEDEXIT(VmbFeatureIntGet, ihandle->handle, "SensorWidth", width);
+    return ALLIEDCALL(VmbFeatureIntGet, ihandle->handle, "SensorHeight", height);
+}
+
+VmbError_t allied_get_image_size(AlliedCameraHandle_t handle, VmbInt64_t *width, VmbInt64_t *height)
+{
+    assert(handle);
+    assert(width);
+    assert(height);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    *width = 0;
+    *height = 0;
+    ALLIEDEXIT(VmbFeatureIntGet, ihandle->handle, "Width", width);
+    return ALLIEDCALL(VmbFeatureIntGet, ihandle->handle, "Height", height);
+}
+
+VmbError_t allied_set_image_size(AlliedCameraHandle_t handle, VmbUint32_t width, VmbUint32_t height)
+{
+    assert(handle);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    if (width == 0 || height == 0)
+    {
+        return VmbErrorBadParameter;
+    }
+    if (ihandle->acquiring)
+    {
+        return VmbErrorBusy;
+    }
+    if (ihandle->streaming)
+    {
+        ALLIEDEXIT(allied_dequeue_capture, handle);
+    }
+    ALLIEDEXIT(VmbFeatureIntSet, ihandle->handle, "Width", width);
+    ALLIEDEXIT(VmbFeatureIntSet, ihandle->handle, "Height", height);
+    return ALLIEDCALL(allied_realloc_framebuffer, handle);
+}
+
+VmbError_t allied_get_image_ofst(AlliedCameraHandle_t handle, VmbInt64_t *ofst_x, VmbInt64_t *ofst_y)
+{
+    assert(handle);
+    assert(ofst_x);
+    assert(ofst_y);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    *ofst_x = 0;
+    *ofst_y = 0;
+    ALLIEDEXIT(VmbFeatureIntGet, ihandle->handle, "OffsetX", ofst_x);
+    return ALLIEDCALL(VmbFeatureIntGet, ihandle->handle, "OffsetY", ofst_y);
+}
+
+VmbError_t allied_set_image_ofst(AlliedCameraHandle_t handle, VmbUint32_t ofst_x, VmbUint32_t ofst_y)
+{
+    assert(handle);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    ALLIEDEXIT(VmbFeatureIntSet, ihandle->handle, "OffsetX", ofst_x);
+    return ALLIEDCALL(VmbFeatureIntSet, ihandle->handle, "OffsetY", ofst_y);
+}
+
+VmbError_t allied_set_binning_mode(AlliedCameraHandle_t handle, const char *mode)
+{
+    assert(handle);
+    assert(mode);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    ALLIEDEXIT(VmbFeatureEnumSet, ihandle->handle, "BinningVerticalMode", mode);
+    return ALLIEDCALL(VmbFeatureEnumSet, ihandle->handle, "BinningHorizontalMode", mode);
+}
+
+VmbError_t allied_get_binning_mode(AlliedCameraHandle_t handle, const char **mode)
+{
+    assert(handle);
+    assert(mode);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    return ALLIEDCALL(VmbFeatureEnumGet, ihandle->handle, "BinningVerticalMode", mode);
+}
+
+VmbError_t allied_set_binning_factor(AlliedCameraHandle_t handle, VmbUint32_t factor)
+{
+    assert(handle);
+    assert(factor > 0);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    if (ihandle->acquiring)
+    {
+        return VmbErrorBusy;
+    }
+    if (ihandle->streaming)
+    {
+        ALLIEDEXIT(allied_dequeue_capture, handle);
+    }
+    ALLIEDEXIT(VmbFeatureIntSet, ihandle->handle, "BinningVertical", factor);
+    ALLIEDEXIT(VmbFeatureIntSet, ihandle->handle, "BinningHorizontal", factor);
+    atomic_store_explicit(&(ihandle->binning), factor, memory_order_relaxed); // no frame is in flight
+    return ALLIEDCALL(allied_realloc_framebuffer, handle);
+}
+
+VmbError_t allied_get_binning_factor(AlliedCameraHandle_t handle, VmbInt64_t *factor)
+{
+    assert(handle);
+    assert(factor);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    *factor = 0;
+    VmbInt64_t hx = 0, hy = 0;
+    ALLIEDEXIT(VmbFeatureIntGet, ihandle->handle, "BinningHorizontal", &hx);
+    ALLIEDEXIT(VmbFeatureIntGet, ihandle->handle, "BinningVertical", &hy);
+    if (hx != hy)
+    {
+        return VmbErrorInternalFault;
+    }
+    *factor = hx;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_get_image_flip(AlliedCameraHandle_t handle, VmbBool_t *flipx, VmbBool_t *flipy)
+{
+    assert(handle);
+    assert(flipx);
+    assert(flipy);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    *flipx = VmbBoolFalse;
+    *flipy = VmbBoolFalse;
+    ALLIEDEXIT(VmbFeatureBoolGet, ihandle->handle, "ReverseX", flipx);
+    return ALLIEDCALL(VmbFeatureBoolGet, ihandle->handle, "ReverseY", flipy);
+}
+
+VmbError_t allied_set_image_flip(AlliedCameraHandle_t handle, VmbBool_t flipx, VmbBool_t flipy)
+{
+    assert(handle);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    ALLIEDEXIT(VmbFeatureBoolSet, ihandle->handle, "ReverseX", flipx);
+    return ALLIEDCALL(VmbFeatureBoolSet, ihandle->handle, "ReverseY", flipy);
+}
+
+VmbError_t allied_set_image_format(AlliedCameraHandle_t handle, const char *format)
+{
+    assert(handle);
+    assert(format);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    if (ihandle->streaming)
+    {
+        ALLIEDEXIT(allied_dequeue_capture, handle);
+    }
+    ALLIEDEXIT(VmbFeatureEnumSet, ihandle->handle, "PixelFormat", format);
+    return ALLIEDCALL(allied_realloc_framebuffer, handle);
+}
+
+VmbError_t allied_get_image_format(AlliedCameraHandle_t handle, const char **format)
+{
+    assert(handle);
+    assert(format);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    return ALLIEDCALL(VmbFeatureEnumGet, ihandle->handle, "PixelFormat", format);
+}
+
+VmbError_t allied_get_features_list(AlliedCameraHandle_t handle, VmbFeatureInfo_t **features, VmbUint32_t *count)
+{
+    assert(handle);
+    assert(features);
+    assert(count);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    VmbUint32_t list_len = 0;
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    VmbHandle_t moduleHandle = ihandle->handle;
+    // get the length of the list
+    ALLIEDEXIT(VmbFeaturesList, moduleHandle, NULL, 0, &list_len, sizeof(VmbFeatureInfo_t));
+    // allocate space
+    VmbFeatureInfo_t *_features = (VmbFeatureInfo_t *)malloc(list_len * sizeof(VmbFeatureInfo_t));
+    if (_features == NULL)
+    {
+        return VmbErrorResources;
+    }
+    memset(_features, 0, list_len * sizeof(VmbFeatureInfo_t));
+    // get the list
+    VmbError_t err = ALLIEDCALL(VmbFeaturesList, moduleHandle, _features, list_len, NULL, sizeof(VmbFeatureInfo_t));
+    if (err != VmbErrorSuccess)
+    {
+        free(_features);
+        return err;
+    }
+    // return vals
+    *features = _features;
+    *count = list_len;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_get_feature_info(AlliedCameraHandle_t handle, const char *name, VmbFeatureInfo_t *info)
+{
+    assert(handle);
+    assert(name);
+    assert(info);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    VmbHandle_t moduleHandle = ihandle->handle;
+    return ALLIEDCALL(VmbFeatureInfoQuery, moduleHandle, name, info, sizeof(VmbFeatureInfo_t));
+}
+
+VmbError_t allied_get_feature_int(AlliedCameraHandle_t handle, const char *name, VmbInt64_t *value)
+{
+    assert(handle);
+    assert(name);
+    assert(value);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    VmbHandle_t moduleHandle = ihandle->handle;
+    return ALLIEDCALL(VmbFeatureIntGet, moduleHandle, name, value);
+}
+
+VmbError_t allied_set_feature_int(AlliedCameraHandle_t handle, const char *name, VmbInt64_t value)
+{
+    assert(handle);
+    assert(name);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    VmbHandle_t moduleHandle = ihandle->handle;
+    return ALLIEDCALL(VmbFeatureIntSet, moduleHandle, name, value);
+}
+
+VmbError_t allied_get_feature_int_range(AlliedCameraHandle_t handle, const char *name, VmbInt64_t *minval, VmbInt64_t *maxval, VmbInt64_t *step)
+{
+    assert(handle);
+    assert(name);
+    assert(minval);
+    assert(maxval);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    VmbInt64_t _step = 0;
+    *minval = 0;
+    *maxval = 0;
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    VmbHandle_t moduleHandle = ihandle->handle;
+    ALLIEDEXIT(VmbFeatureIntRangeQuery, moduleHandle, name, minval, maxval);
+    if (step == NULL)
+    {
+        return VmbErrorSuccess;
+    }
+    ALLIEDEXIT(VmbFeatureIntIncrementQuery, moduleHandle, name, &_step);
+    *step = _step;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_get_feature_int_valset(AlliedCameraHandle_t handle, const char *name, VmbInt64_t **buffer, VmbUint32_t *count)
+{
+    assert(handle);
+    assert(name);
+    assert(buffer);
+    assert(count);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    *buffer = NULL;
+    *count = 0;
+
+    VmbUint32_t list_len = 0;
+    VmbInt64_t *list = NULL;
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    VmbHandle_t moduleHandle = ihandle->handle;
+    // get the length of the list
+    ALLIEDEXIT(VmbFeatureIntValidValueSetQuery, moduleHandle, name, NULL, 0, &list_len);
+    // allocate space
+    list = (VmbInt64_t *)malloc(list_len * sizeof(VmbInt64_t));
+    if (list == NULL)
+    {
+        return VmbErrorResources;
+    }
+    memset(list, 0, list_len * sizeof(VmbInt64_t));
+    // get the list
+    VmbError_t err = ALLIEDCALL(VmbFeatureIntValidValueSetQuery, moduleHandle, name, list, list_len, NULL);
+    if (err != VmbErrorSuccess)
+    {
+        free(list);
+        return err;
+    }
+    // return vals
+    *buffer = list;
+    *count = list_len;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_get_feature_float(AlliedCameraHandle_t handle, const char *name, double *value)
+{
+    assert(handle);
+    assert(name);
+    assert(value);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    VmbHandle_t moduleHandle = ihandle->handle;
+    *value = 0;
+    return ALLIEDCALL(VmbFeatureFloatGet, moduleHandle, name, value);
+}
+
+VmbError_t allied_set_feature_float(AlliedCameraHandle_t handle, const char *name, double value)
+{
+    assert(handle);
+    assert(name);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    VmbHandle_t moduleHandle = ihandle->handle;
+    return ALLIEDCALL(VmbFeatureFloatSet, moduleHandle, name, value);
+}
+
+VmbError_t allied_get_feature_float_range(AlliedCameraHandle_t handle, const char *name, double *minval, double *maxval, double *step)
+{
+    assert(handle);
+    assert(name);
+    assert(minval);
+    assert(maxval);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    *minval = 0;
+    *maxval = 0;
+    if (step != NULL)
+    {
+        *step = 0;
+    }
+
+    double _step = 0;
+    VmbBool_t _unused = VmbBoolFalse;
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    VmbHandle_t moduleHandle = ihandle->handle;
+
+    ALLIEDEXIT(VmbFeatureFloatRangeQuery, moduleHandle, name, minval, maxval);
+    if (step == NULL)
+    {
+        return VmbErrorSuccess;
+    }
+    ALLIEDEXIT(VmbFeatureFloatIncrementQuery, moduleHandle, name, &_unused, &_step);
+    *step = _step;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_get_feature_enum(AlliedCameraHandle_t handle, const char *name, char **const value)
+{
+    static char *empty = "";
+    assert(handle);
+    assert(name);
+    assert(value);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
+    *value = empty;
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    VmbHandle_t moduleHandle = ihandle->handle;
+
+    return ALLIEDCALL(VmbFeatureEnumGet, moduleHandle, name, (const char **)value);
 }
 
-VmbError_t allied_start_capture(AlliedCameraHandle_t handle)
+VmbError_t allied_set_feature_enum(AlliedCameraHandle_t handle, const char *name, const char *value)
 {
     assert(handle);
+    assert(name);
+    assert(value);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    if (!ihandle->streaming)
+    return ALLIEDCALL(VmbFeatureEnumSet, ihandle->handle, name, value);
+}
+
+VmbError_t allied_get_feature_enum_list(AlliedCameraHandle_t handle, const char *name, char ***list, VmbBool_t **available, VmbUint32_t *count)
+{
+    assert(handle);
+    assert(name);
+    assert(list);
+    assert(count);
+    if (atomic_load(&is_init) == false)
     {
-        return VmbErrorInvalidAccess;
+        return VmbErrorNotInitialized;
     }
-    if (!ihandle->framebuf->queued)
+    VmbError_t err;
+    VmbUint32_t list_len = 0;
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    VmbHandle_t moduleHandle = ihandle->handle;
+    err = ALLIEDCALL(VmbFeatureEnumRangeQuery, moduleHandle, name, NULL, 0, &list_len);
+    if (err == VmbErrorSuccess && list_len > 0)
     {
-        return VmbErrorInvalidAccess;
+        // 1. Allocate space
+        char **_formats = (char **)malloc(list_len * sizeof(char **));
+        if (_formats == NULL)
+        {
+            return VmbErrorResources;
+        }
+        VmbBool_t *_available = (VmbBool_t *)malloc(list_len * sizeof(VmbBool_t));
+        if (_available == NULL)
+        {
+            free(_formats);
+            return VmbErrorResources;
+        }
+        memset(_available, 0, list_len * sizeof(VmbBool_t));
+        memset(_formats, 0, list_len * sizeof(char **));
+        // 2. Get the features
+        err = ALLIEDCALL(VmbFeatureEnumRangeQuery, moduleHandle, name, (const char **)_formats, list_len, NULL);
+        if (err == VmbErrorSuccess && list != NULL)
+        {
+            for (int i = 0; i < list_len; i++)
+            {
+                err = ALLIEDCALL(VmbFeatureEnumIsAvailable, moduleHandle, name, _formats[i], &(_available[i]));
+            }
+        }
+        else
+        {
+            free(_formats);
+            free(_available);
+            *list = NULL;
+            if (available != NULL)
+            {
+                *available = NULL;
+            }
+        }
+        *list = _formats;
+        if (available != NULL)
+        {
+            *available = _available;
+        }
+        else
+        {
+            free(_available);
+        }
     }
-    VmbError_t err = ALLIEDCALL(VmbFeatureCommandRun, ihandle->handle, "AcquisitionStart");
-    if (err == VmbErrorSuccess)
+    *count = list_len;
+    return VmbErrorSuccess;
+}
+
+void allied_free_list(char ***list)
+{
+    assert(list);
+    char **_list = *list;
+    if (_list == NULL)
     {
-        ihandle->acquiring = true;
-        eprintlf("Started acquisition");
-        return VmbErrorSuccess;
+        return;
     }
-
-    ihandle->acquiring = false;
-    eprintlf("Error starting acquisition: %s", allied_strerr(err));
-    return err;
+    free(_list);
+    *list = NULL;
+    return;
 }
 
-VmbError_t allied_stop_capture(AlliedCameraHandle_t handle)
+VmbError_t allied_get_trigline(AlliedCameraHandle_t handle, const char **line)
 {
+    assert(handle);
+    assert(line);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
-    assert(handle);
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    if (!ihandle->acquiring)
-    {
-        return VmbErrorSuccess;
-    }
-    if (ihandle->acquiring)
+    return ALLIEDCALL(VmbFeatureEnumGet, ihandle->handle, "LineSelector", line);
+}
+
+VmbError_t allied_set_trigline(AlliedCameraHandle_t handle, const char *line)
+{
+    assert(handle);
+    assert(line);
+    if (atomic_load(&is_init) == false)
     {
-        ALLIEDEXIT(VmbFeatureCommandRun, ihandle->handle, "AcquisitionStop");
-        ihandle->acquiring = false;
+        return VmbErrorNotInitialized;
     }
-    return VmbErrorSuccess;
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    return ALLIEDCALL(VmbFeatureEnumSet, ihandle->handle, "LineSelector", line);
 }
 
-VmbError_t allied_dequeue_capture(AlliedCameraHandle_t handle)
+VmbError_t allied_get_trigline_mode(AlliedCameraHandle_t handle, const char **mode)
 {
+    assert(handle);
+    assert(mode);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
-    assert(handle);
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    if (ihandle->streaming)
+    return ALLIEDCALL(VmbFeatureEnumGet, ihandle->handle, "LineMode", mode);
+}
+
+VmbError_t allied_set_trigline_mode(AlliedCameraHandle_t handle, const char *mode)
+{
+    assert(handle);
+    assert(mode);
+    if (atomic_load(&is_init) == false)
     {
-        ALLIEDEXIT(VmbCaptureEnd, ihandle->handle);
-        ihandle->streaming = false;
+        return VmbErrorNotInitialized;
     }
-    VmbCaptureQueueFlush(ihandle->handle);
-    ihandle->framebuf->queued = false;
-    while (ihandle->framebuf->announced && (VmbErrorSuccess != VmbFrameRevokeAll(ihandle->handle)))
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    return ALLIEDCALL(VmbFeatureEnumSet, ihandle->handle, "LineMode", mode);
+}
+
+VmbError_t allied_get_trigline_src(AlliedCameraHandle_t handle, const char **src)
+{
+    assert(handle);
+    assert(src);
+    if (atomic_load(&is_init) == false)
     {
+        return VmbErrorNotInitialized;
     }
-    ihandle->framebuf->announced = false;
-    return VmbErrorSuccess;
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    return ALLIEDCALL(VmbFeatureEnumGet, ihandle->handle, "LineSource", src);
 }
 
-void allied_free_framebuf(AlliedFrameBuffer_t framebuf, bool frame_only)
+VmbError_t allied_set_trigline_src(AlliedCameraHandle_t handle, const char *src)
 {
-    assert(framebuf);
-    if (framebuf->frames != NULL)
+    assert(handle);
+    assert(src);
+    if (atomic_load(&is_init) == false)
     {
-        free(framebuf->frames);
-        framebuf->frames = NULL;
+        return VmbErrorNotInitialized;
     }
-    if (frame_only)
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    return ALLIEDCALL(VmbFeatureEnumSet, ihandle->handle, "LineSource", src);
+}
+
+VmbError_t allied_get_trigline_src_list(AlliedCameraHandle_t handle, char ***srcs, VmbBool_t **available, VmbUint32_t *count)
+{
+    assert(handle);
+    if (atomic_load(&is_init) == false)
     {
-        return;
+        return VmbErrorNotInitialized;
     }
-    // clean up the buffer allocation
-    if (framebuf->buffer != NULL)
+    return allied_get_feature_enum_list(handle, "LineSource", srcs, available, count);
+}
+
+VmbError_t allied_get_trigline_mode_list(AlliedCameraHandle_t handle, char ***modes, VmbBool_t **available, VmbUint32_t *count)
+{
+    assert(handle);
+
+    if (atomic_load(&is_init) == false)
     {
-        free(framebuf->buffer);
-        framebuf->buffer = NULL;
+        return VmbErrorNotInitialized;
     }
-    memset(framebuf, 0, sizeof(AlliedFrameBuffer_s));
-    return;
+    return allied_get_feature_enum_list(handle, "LineMode", modes, available, count);
 }
 
-VmbError_t allied_reset_camera(AlliedCameraHandle_t *handle)
+VmbError_t allied_get_trigline_polarity(AlliedCameraHandle_t handle, VmbBool_t *polarity)
 {
     assert(handle);
+    assert(polarity);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
-    VmbError_t err;
-    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)(*handle);
-    err = ALLIEDCALL(VmbFeatureCommandRun, ihandle->handle, "DeviceReset");
-    VmbCameraClose(ihandle->handle);
-    allied_free_framebuf(ihandle->framebuf, false);
-    free(ihandle);
-    *handle = NULL;
-    return err;
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    return ALLIEDCALL(VmbFeatureBoolGet, ihandle->handle, "LineInverter", polarity);
 }
 
-VmbError_t allied_close_camera(AlliedCameraHandle_t *handle)
+VmbError_t allied_set_trigline_polarity(AlliedCameraHandle_t handle, VmbBool_t polarity)
 {
     assert(handle);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
-    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)(*handle);
-    ALLIEDEXIT(allied_stop_capture, *handle);
-    ALLIEDEXIT(allied_dequeue_capture, *handle);
-    allied_free_framebuf(ihandle->framebuf, false);
-    ALLIEDEXIT(VmbCameraClose, ihandle->handle);
-    free(ihandle);
-    *handle = NULL;
-    return VmbErrorSuccess;
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    return ALLIEDCALL(VmbFeatureBoolSet, ihandle->handle, "LineInverter", polarity);
 }
 
-VmbError_t allied_set_temperature_src(AlliedCameraHandle_t handle, const char *src)
+VmbError_t allied_get_trigline_debounce_mode(AlliedCameraHandle_t handle, char **mode)
 {
     assert(handle);
-    assert(src);
+    assert(mode);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ALLIEDCALL(VmbFeatureEnumSet, ihandle->handle, "DeviceTemperatureSelector", src);
+    return ALLIEDCALL(VmbFeatureEnumGet, ihandle->handle, "LineDebouncerMode", (const char **)mode);
 }
 
-VmbError_t allied_get_temperature_src(AlliedCameraHandle_t handle, const char **src)
+VmbError_t allied_set_trigline_debounce_mode(AlliedCameraHandle_t handle, const char *mode)
 {
     assert(handle);
-    assert(src);
+    assert(mode);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ALLIEDCALL(VmbFeatureEnumGet, ihandle->handle, "DeviceTemperatureSelector", src);
+    return ALLIEDCALL(VmbFeatureEnumSet, ihandle->handle, "LineDebouncerMode", mode);
 }
 
-VmbError_t allied_get_temperature(AlliedCameraHandle_t handle, double *temp)
+VmbError_t allied_get_trigline_debounce_mode_list(AlliedCameraHandle_t handle, char ***modes, VmbBool_t **available, VmbUint32_t *count)
 {
     assert(handle);
-    assert(temp);
+
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
-    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ALLIEDCALL(VmbFeatureFloatGet, ihandle->handle, "DeviceTemperature", temp);
+    return allied_get_feature_enum_list(handle, "LineDebouncerMode", modes, available, count);
 }
 
-VmbError_t allied_get_sensor_size(AlliedCameraHandle_t handle, VmbInt64_t *width, VmbInt64_t *height)
+VmbError_t allied_get_trigline_debounce_time(AlliedCameraHandle_t handle, double *time)
 {
     assert(handle);
-    assert(width);
-    assert(height);
+    assert(time);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    ALLIEDEXIT(VmbFeatureIntGet, ihandle->handle, "SensorWidth", width);
-    return ALLIEDCALL(VmbFeatureIntGet, ihandle->handle, "SensorHeight", height);
+    return ALLIEDCALL(VmbFeatureFloatGet, ihandle->handle, "LineDebounceDuration", time);
 }
 
-VmbError_t allied_get_image_size(AlliedCameraHandle_t handle, VmbInt64_t *width, VmbInt64_t *height)
+VmbError_t allied_set_trigline_debounce_time(AlliedCameraHandle_t handle, double time)
 {
     assert(handle);
-    assert(width);
-    assert(height);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    *width = 0;
-    *height = 0;
-    ALLIEDEXIT(VmbFeatureIntGet, ihandle->handle, "Width", width);
-    return ALLIEDCALL(VmbFeatureIntGet, ihandle->handle, "Height", height);
+    return ALLIEDCALL(VmbFeatureFloatSet, ihandle->handle, "LineDebounceDuration", time);
+}
+
+VmbError_t allied_get_trigline_debounce_time_range(AlliedCameraHandle_t handle, double *minval, double *maxval, double *step)
+{
+    return allied_get_feature_float_range(handle, "LineDebounceDuration", minval, maxval, step);
 }
 
-VmbError_t allied_set_image_size(AlliedCameraHandle_t handle, VmbUint32_t width, VmbUint32_t height)
+VmbError_t allied_get_image_format_list(AlliedCameraHandle_t handle, char ***formats, VmbBool_t **available, VmbUint32_t *count)
 {
     assert(handle);
+
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
-    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    if (width == 0 || height == 0)
-    {
-        return VmbErrorBadParameter;
-    }
-    if (ihandle->acquiring)
-    {
-        return VmbErrorBusy;
-    }
-    if (ihandle->streaming)
-    {
-        ALLIEDEXIT(allied_dequeue_capture, handle);
-    }
-    ALLIEDEXIT(VmbFeatureIntSet, ihandle->handle, "Width", width);
-    ALLIEDEXIT(VmbFeatureIntSet, ihandle->handle, "Height", height);
-    return ALLIEDCALL(allied_realloc_framebuffer, handle);
+    return allied_get_feature_enum_list(handle, "PixelFormat", formats, available, count);
 }
 
-VmbError_t allied_get_image_ofst(AlliedCameraHandle_t handle, VmbInt64_t *ofst_x, VmbInt64_t *ofst_y)
+VmbError_t allied_get_sensor_bit_depth_list(AlliedCameraHandle_t handle, char ***depths, VmbBool_t **available, VmbUint32_t *count)
 {
     assert(handle);
-    assert(ofst_x);
-    assert(ofst_y);
+
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
-    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    *ofst_x = 0;
-    *ofst_y = 0;
-    ALLIEDEXIT(VmbFeatureIntGet, ihandle->handle, "OffsetX", ofst_x);
-    return ALLIEDCALL(VmbFeatureIntGet, ihandle->handle, "OffsetY", ofst_y);
+    return allied_get_feature_enum_list(handle, "SensorBitDepth", depths, available, count);
 }
 
-VmbError_t allied_set_image_ofst(AlliedCameraHandle_t handle, VmbUint32_t ofst_x, VmbUint32_t ofst_y)
+VmbError_t allied_get_temperature_src_list(AlliedCameraHandle_t handle, char ***srcs, VmbBool_t **available, VmbUint32_t *count)
 {
     assert(handle);
+
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
-    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    ALLIEDEXIT(VmbFeatureIntSet, ihandle->handle, "OffsetX", ofst_x);
-    return ALLIEDCALL(VmbFeatureIntSet, ihandle->handle, "OffsetY", ofst_y);
+    return allied_get_feature_enum_list(handle, "DeviceTemperatureSelector", srcs, available, count);
 }
 
-VmbError_t allied_set_binning_mode(AlliedCameraHandle_t handle, const char *mode)
+VmbError_t allied_get_triglines_list(AlliedCameraHandle_t handle, char ***lines, VmbBool_t **available, VmbUint32_t *count)
 {
     assert(handle);
-    assert(mode);
+    assert(lines);
+
+    assert(count);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
-    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    ALLIEDEXIT(VmbFeatureEnumSet, ihandle->handle, "BinningVerticalMode", mode);
-    return ALLIEDCALL(VmbFeatureEnumSet, ihandle->handle, "BinningHorizontalMode", mode);
+    return allied_get_feature_enum_list(handle, "LineSelector", lines, available, count);
 }
 
-VmbError_t allied_get_binning_mode(AlliedCameraHandle_t handle, const char **mode)
+VmbError_t allied_get_indicator_mode_list(AlliedCameraHandle_t handle, char ***modes, VmbBool_t **available, VmbUint32_t *count)
 {
     assert(handle);
-    assert(mode);
+
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
-    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ALLIEDCALL(VmbFeatureEnumGet, ihandle->handle, "BinningVerticalMode", mode);
+    return allied_get_feature_enum_list(handle, "DeviceIndicatorMode", modes, available, count);
 }
 
-VmbError_t allied_set_binning_factor(AlliedCameraHandle_t handle, VmbUint32_t factor)
+VmbError_t allied_get_indicator_mode(AlliedCameraHandle_t handle, const char **mode)
 {
     assert(handle);
-    assert(factor > 0);
+    assert(mode);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    if (ihandle->acquiring)
-    {
-        return VmbErrorBusy;
-    }
-    if (ihandle->streaming)
-    {
-        ALLIEDEXIT(allied_dequeue_capture, handle);
-    }
-    ALLIEDEXIT(VmbFeatureIntSet, ihandle->handle, "BinningVertical", factor);
-    ALLIEDEXIT(VmbFeatureIntSet, ihandle->handle, "BinningHorizontal", factor);
-    return ALLIEDCALL(allied_realloc_framebuffer, handle);
+    return ALLIEDCALL(VmbFeatureEnumGet, ihandle->handle, "DeviceIndicatorMode", mode);
 }
 
-VmbError_t allied_get_binning_factor(AlliedCameraHandle_t handle, VmbInt64_t *factor)
+VmbError_t allied_set_indicator_mode(AlliedCameraHandle_t handle, const char *mode)
 {
     assert(handle);
-    assert(factor);
+    assert(mode);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    *factor = 0;
-    VmbInt64_t hx = 0, hy = 0;
-    ALLIEDEXIT(VmbFeatureIntGet, ihandle->handle, "BinningHorizontal", &hx);
-    ALLIEDEXIT(VmbFeatureIntGet, ihandle->handle, "BinningVertical", &hy);
-    if (hx != hy)
-    {
-        return VmbErrorInternalFault;
-    }
-    *factor = hx;
-    return VmbErrorSuccess;
+    return ALLIEDCALL(VmbFeatureEnumSet, ihandle->handle, "DeviceIndicatorMode", mode);
 }
 
-VmbError_t allied_get_image_flip(AlliedCameraHandle_t handle, VmbBool_t *flipx, VmbBool_t *flipy)
+VmbError_t allied_get_indicator_luma(AlliedCameraHandle_t handle, VmbInt64_t *luma)
 {
     assert(handle);
-    assert(flipx);
-    assert(flipy);
+    assert(luma);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    *flipx = VmbBoolFalse;
-    *flipy = VmbBoolFalse;
-    ALLIEDEXIT(VmbFeatureBoolGet, ihandle->handle, "ReverseX", flipx);
-    return ALLIEDCALL(VmbFeatureBoolGet, ihandle->handle, "ReverseY", flipy);
+    return ALLIEDCALL(VmbFeatureIntGet, ihandle->handle, "DeviceIndicatorLuminance", luma);
 }
 
-VmbError_t allied_set_image_flip(AlliedCameraHandle_t handle, VmbBool_t flipx, VmbBool_t flipy)
+VmbError_t allied_set_indicator_luma(AlliedCameraHandle_t handle, VmbInt64_t luma)
 {
     assert(handle);
     if (atomic_load(&is_init) == false)
@@ -938,509 +3770,642 @@ VmbError_t allied_set_image_flip(AlliedCameraHandle_t handle, VmbBool_t flipx, V
         return VmbErrorNotInitialized;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    ALLIEDEXIT(VmbFeatureBoolSet, ihandle->handle, "ReverseX", flipx);
-    return ALLIEDCALL(VmbFeatureBoolSet, ihandle->handle, "ReverseY", flipy);
+    return ALLIEDCALL(VmbFeatureIntSet, ihandle->handle, "DeviceIndicatorLuminance", luma);
 }
 
-VmbError_t allied_set_image_format(AlliedCameraHandle_t handle, const char *format)
+VmbError_t allied_get_indicator_luma_range(AlliedCameraHandle_t handle, VmbInt64_t *minval, VmbInt64_t *maxval, VmbInt64_t *step)
+{
+    return allied_get_feature_int_range(handle, "DeviceIndicatorLuminance", minval, maxval, step);
+}
+
+VmbError_t allied_set_sensor_bit_depth(AlliedCameraHandle_t handle, const char *depth)
 {
     assert(handle);
-    assert(format);
+    assert(depth);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    if (ihandle->streaming)
+    if (ihandle->acquiring)
     {
-        ALLIEDEXIT(allied_dequeue_capture, handle);
+        return VmbErrorBusy;
     }
-    ALLIEDEXIT(VmbFeatureEnumSet, ihandle->handle, "PixelFormat", format);
-    return ALLIEDCALL(allied_realloc_framebuffer, handle);
+    return ALLIEDCALL(VmbFeatureEnumSet, ihandle->handle, "SensorBitDepth", depth);
 }
 
-VmbError_t allied_get_image_format(AlliedCameraHandle_t handle, const char **format)
+VmbError_t allied_get_sensor_bit_depth(AlliedCameraHandle_t handle, const char **depth)
 {
     assert(handle);
-    assert(format);
+    assert(depth);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ALLIEDCALL(VmbFeatureEnumGet, ihandle->handle, "PixelFormat", format);
+    return ALLIEDCALL(VmbFeatureEnumGet, ihandle->handle, "SensorBitDepth", depth);
 }
 
-VmbError_t allied_get_features_list(AlliedCameraHandle_t handle, VmbFeatureInfo_t **features, VmbUint32_t *count)
+VmbError_t allied_get_exposure_range_us(AlliedCameraHandle_t handle, double *minval, double *maxval, double *step)
+{
+    return allied_get_feature_float_range(handle, "ExposureTime", minval, maxval, step);
+}
+
+VmbError_t allied_set_exposure_us(AlliedCameraHandle_t handle, double value)
 {
     assert(handle);
-    assert(features);
-    assert(count);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
-    VmbUint32_t list_len = 0;
-    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    VmbHandle_t moduleHandle = ihandle->handle;
-    // get the length of the list
-    ALLIEDEXIT(VmbFeaturesList, moduleHandle, NULL, 0, &list_len, sizeof(VmbFeatureInfo_t));
-    // allocate space
-    VmbFeatureInfo_t *_features = (VmbFeatureInfo_t *)malloc(list_len * sizeof(VmbFeatureInfo_t));
-    if (_features == NULL)
-    {
-        return VmbErrorResources;
-    }
-    memset(_features, 0, list_len * sizeof(VmbFeatureInfo_t));
-    // get the list
-    VmbError_t err = ALLIEDCALL(VmbFeaturesList, moduleHandle, _features, list_len, NULL, sizeof(VmbFeatureInfo_t));
-    if (err != VmbErrorSuccess)
+    if (value <= 0.0)
     {
-        free(_features);
-        return err;
+        return VmbErrorInvalidValue;
     }
-    // return vals
-    *features = _features;
-    *count = list_len;
-    return VmbErrorSuccess;
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    return ALLIEDCALL(VmbFeatureFloatSet, ihandle->handle, "ExposureTime", value);
 }
 
-VmbError_t allied_get_feature_info(AlliedCameraHandle_t handle, const char *name, VmbFeatureInfo_t *info)
+VmbError_t allied_get_exposure_us(AlliedCameraHandle_t handle, double *value)
 {
     assert(handle);
-    assert(name);
-    assert(info);
+    assert(value);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    VmbHandle_t moduleHandle = ihandle->handle;
-    return ALLIEDCALL(VmbFeatureInfoQuery, moduleHandle, name, info, sizeof(VmbFeatureInfo_t));
+    *value = 0;
+    return ALLIEDCALL(VmbFeatureFloatGet, ihandle->handle, "ExposureTime", value);
 }
 
-VmbError_t allied_get_feature_int(AlliedCameraHandle_t handle, const char *name, VmbInt64_t *value)
+VmbError_t allied_get_gain_range(AlliedCameraHandle_t handle, double *minval, double *maxval, double *step)
+{
+    return allied_get_feature_float_range(handle, "Gain", minval, maxval, step);
+}
+
+VmbError_t allied_get_gain(AlliedCameraHandle_t handle, double *value)
 {
     assert(handle);
-    assert(name);
     assert(value);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    VmbHandle_t moduleHandle = ihandle->handle;
-    return ALLIEDCALL(VmbFeatureIntGet, moduleHandle, name, value);
+    *value = 0;
+    return ALLIEDCALL(VmbFeatureFloatGet, ihandle->handle, "Gain", value);
 }
 
-VmbError_t allied_set_feature_int(AlliedCameraHandle_t handle, const char *name, VmbInt64_t value)
+VmbError_t allied_set_gain(AlliedCameraHandle_t handle, double value)
 {
     assert(handle);
-    assert(name);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
+    if (value <= 0.0)
+    {
+        return VmbErrorInvalidValue;
+    }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    VmbHandle_t moduleHandle = ihandle->handle;
-    return ALLIEDCALL(VmbFeatureIntSet, moduleHandle, name, value);
+    return ALLIEDCALL(VmbFeatureFloatSet, ihandle->handle, "Gain", value);
 }
 
-VmbError_t allied_get_feature_int_range(AlliedCameraHandle_t handle, const char *name, VmbInt64_t *minval, VmbInt64_t *maxval, VmbInt64_t *step)
+VmbError_t allied_get_acq_framerate_auto(AlliedCameraHandle_t handle, bool *auto_on)
 {
     assert(handle);
-    assert(name);
-    assert(minval);
-    assert(maxval);
+    assert(auto_on);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
-    VmbInt64_t _step = 0;
-    *minval = 0;
-    *maxval = 0;
+    VmbError_t err;
+    VmbBool_t _auto_on = VmbBoolFalse;
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    VmbHandle_t moduleHandle = ihandle->handle;
-    ALLIEDEXIT(VmbFeatureIntRangeQuery, moduleHandle, name, minval, maxval);
-    if (step == NULL)
+    err = ALLIEDCALL(VmbFeatureBoolGet, ihandle->handle, "AcquisitionFrameRateEnable", &_auto_on);
+    if (err != VmbErrorSuccess)
     {
-        return VmbErrorSuccess;
+        *auto_on = true;
+        return err;
     }
-    ALLIEDEXIT(VmbFeatureIntIncrementQuery, moduleHandle, name, &_step);
-    *step = _step;
+    *auto_on = !(_auto_on == VmbBoolTrue);
     return VmbErrorSuccess;
 }
 
-VmbError_t allied_get_feature_int_valset(AlliedCameraHandle_t handle, const char *name, VmbInt64_t **buffer, VmbUint32_t *count)
+VmbError_t allied_set_acq_framerate_auto(AlliedCameraHandle_t handle, bool auto_on)
 {
     assert(handle);
-    assert(name);
-    assert(buffer);
-    assert(count);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
-    *buffer = NULL;
-    *count = 0;
-
-    VmbUint32_t list_len = 0;
-    VmbInt64_t *list = NULL;
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    VmbHandle_t moduleHandle = ihandle->handle;
-    // get the length of the list
-    ALLIEDEXIT(VmbFeatureIntValidValueSetQuery, moduleHandle, name, NULL, 0, &list_len);
-    // allocate space
-    list = (VmbInt64_t *)malloc(list_len * sizeof(VmbInt64_t));
-    if (list == NULL)
-    {
-        return VmbErrorResources;
-    }
-    memset(list, 0, list_len * sizeof(VmbInt64_t));
-    // get the list
-    VmbError_t err = ALLIEDCALL(VmbFeatureIntValidValueSetQuery, moduleHandle, name, list, list_len, NULL);
-    if (err != VmbErrorSuccess)
+    return ALLIEDCALL(VmbFeatureBoolSet, ihandle->handle, "AcquisitionFrameRateEnable", !auto_on ? VmbBoolTrue : VmbBoolFalse);
+}
+
+VmbError_t allied_get_acq_framerate(AlliedCameraHandle_t handle, double *framerate)
+{
+    assert(handle);
+    assert(framerate);
+    if (atomic_load(&is_init) == false)
     {
-        free(list);
-        return err;
+        return VmbErrorNotInitialized;
     }
-    // return vals
-    *buffer = list;
-    *count = list_len;
-    return VmbErrorSuccess;
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    *framerate = 0;
+    return ALLIEDCALL(VmbFeatureFloatGet, ihandle->handle, "AcquisitionFrameRate", framerate);
 }
 
-VmbError_t allied_get_feature_float(AlliedCameraHandle_t handle, const char *name, double *value)
+VmbError_t allied_set_acq_framerate(AlliedCameraHandle_t handle, double framerate)
 {
-    assert(handle);
-    assert(name);
-    assert(value);
+    assert(handle);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
+    if (framerate <= 0.0)
+    {
+        return VmbErrorInvalidValue;
+    }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    VmbHandle_t moduleHandle = ihandle->handle;
-    *value = 0;
-    return ALLIEDCALL(VmbFeatureFloatGet, moduleHandle, name, value);
+    return ALLIEDCALL(VmbFeatureFloatSet, ihandle->handle, "AcquisitionFrameRate", framerate);
 }
 
-VmbError_t allied_set_feature_float(AlliedCameraHandle_t handle, const char *name, double value)
+VmbError_t allied_get_acq_framerate_range(AlliedCameraHandle_t handle, double *minval, double *maxval, double *step)
+{
+    return allied_get_feature_float_range(handle, "AcquisitionFrameRate", minval, maxval, step);
+}
+
+VmbError_t allied_get_camera_id(AlliedCameraHandle_t handle, char **id)
 {
     assert(handle);
-    assert(name);
+    assert(id);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    VmbHandle_t moduleHandle = ihandle->handle;
-    return ALLIEDCALL(VmbFeatureFloatSet, moduleHandle, name, value);
+    VmbCameraInfo_t info;
+    ALLIEDEXIT(VmbCameraInfoQueryByHandle, ihandle->handle, &info, sizeof(info));
+    *id = strdup(info.cameraIdString);
+    return VmbErrorSuccess;
 }
 
-VmbError_t allied_get_feature_float_range(AlliedCameraHandle_t handle, const char *name, double *minval, double *maxval, double *step)
+VmbError_t allied_get_link_speed(AlliedCameraHandle_t handle, VmbInt64_t *speed)
 {
     assert(handle);
-    assert(name);
-    assert(minval);
-    assert(maxval);
+    assert(speed);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
-    *minval = 0;
-    *maxval = 0;
-    if (step != NULL)
-    {
-        *step = 0;
-    }
-
-    double _step = 0;
-    VmbBool_t _unused = VmbBoolFalse;
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    VmbHandle_t moduleHandle = ihandle->handle;
-
-    ALLIEDEXIT(VmbFeatureFloatRangeQuery, moduleHandle, name, minval, maxval);
-    if (step == NULL)
-    {
-        return VmbErrorSuccess;
-    }
-    ALLIEDEXIT(VmbFeatureFloatIncrementQuery, moduleHandle, name, &_unused, &_step);
-    *step = _step;
-    return VmbErrorSuccess;
+    return ALLIEDCALL(VmbFeatureIntGet, ihandle->handle, "DeviceLinkSpeed", speed);
 }
 
-VmbError_t allied_get_feature_enum(AlliedCameraHandle_t handle, const char *name, char **const value)
+VmbError_t allied_get_throughput_limit(AlliedCameraHandle_t handle, VmbInt64_t *speed)
 {
-    static char *empty = "";
     assert(handle);
-    assert(name);
-    assert(value);
+    assert(speed);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
-    *value = empty;
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    VmbHandle_t moduleHandle = ihandle->handle;
-
-    return ALLIEDCALL(VmbFeatureEnumGet, moduleHandle, name, (const char **)value);
+    return ALLIEDCALL(VmbFeatureIntGet, ihandle->handle, "DeviceLinkThroughputLimit", speed);
 }
 
-VmbError_t allied_set_feature_enum(AlliedCameraHandle_t handle, const char *name, const char *value)
+VmbError_t allied_set_throughput_limit(AlliedCameraHandle_t handle, VmbInt64_t speed)
 {
     assert(handle);
-    assert(name);
-    assert(value);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
+    if (speed <= 0)
+    {
+        return VmbErrorInvalidValue;
+    }
+    VmbError_t err;
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ALLIEDCALL(VmbFeatureEnumSet, ihandle->handle, name, value);
+    VmbInt64_t minval = 0, maxval = 0;
+    err = allied_get_throughput_limit_range(handle, &minval, &maxval, NULL);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    if ((speed > maxval) || (speed < minval))
+    {
+        return VmbErrorInvalidValue;
+    }
+    return ALLIEDCALL(VmbFeatureIntSet, ihandle->handle, "DeviceLinkThroughputLimit", speed);
 }
 
-VmbError_t allied_get_feature_enum_list(AlliedCameraHandle_t handle, const char *name, char ***list, VmbBool_t **available, VmbUint32_t *count)
+VmbError_t allied_get_throughput_limit_range(AlliedCameraHandle_t handle, VmbInt64_t *_Nonnull minval, VmbInt64_t *_Nonnull maxval, VmbInt64_t *_Nullable step)
 {
     assert(handle);
-    assert(name);
-    assert(list);
-    assert(count);
+    assert(minval);
+    assert(maxval);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
-    VmbError_t err;
-    VmbUint32_t list_len = 0;
+    VmbInt64_t _step = 0;
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    VmbHandle_t moduleHandle = ihandle->handle;
-    err = ALLIEDCALL(VmbFeatureEnumRangeQuery, moduleHandle, name, NULL, 0, &list_len);
-    if (err == VmbErrorSuccess && list_len > 0)
+    ALLIEDEXIT(VmbFeatureIntRangeQuery, ihandle->handle, "DeviceLinkThroughputLimit", minval, maxval);
+    if (step == NULL)
     {
-        // 1. Allocate space
-        char **_formats = (char **)malloc(list_len * sizeof(char **));
-        if (_formats == NULL)
-        {
-            return VmbErrorResources;
-        }
-        VmbBool_t *_available = (VmbBool_t *)malloc(list_len * sizeof(VmbBool_t));
-        if (_available == NULL)
-        {
-            free(_formats);
-            return VmbErrorResources;
-        }
-        memset(_available, 0, list_len * sizeof(VmbBool_t));
-        memset(_formats, 0, list_len * sizeof(char **));
-        // 2. Get the features
-        err = ALLIEDCALL(VmbFeatureEnumRangeQuery, moduleHandle, name, (const char **)_formats, list_len, NULL);
-        if (err == VmbErrorSuccess && list != NULL)
-        {
-            for (int i = 0; i < list_len; i++)
-            {
-                err = ALLIEDCALL(VmbFeatureEnumIsAvailable, moduleHandle, name, _formats[i], &(_available[i]));
-            }
-        }
-        else
-        {
-            free(_formats);
-            free(_available);
-            *list = NULL;
-            if (available != NULL)
-            {
-                *available = NULL;
-            }
-        }
-        *list = _formats;
-        if (available != NULL)
-        {
-            *available = _available;
-        }
-        else
-        {
-            free(_available);
-        }
+        return VmbErrorSuccess;
     }
-    *count = list_len;
+    ALLIEDEXIT(VmbFeatureIntIncrementQuery, ihandle->handle, "DeviceLinkThroughputLimit", &_step);
+    *step = _step;
     return VmbErrorSuccess;
 }
 
-void allied_free_list(char ***list)
+bool allied_camera_streaming(AlliedCameraHandle_t handle)
 {
-    assert(list);
-    char **_list = *list;
-    if (_list == NULL)
-    {
-        return;
-    }
-    free(_list);
-    *list = NULL;
-    return;
+    assert(handle);
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    return ihandle->streaming;
 }
 
-VmbError_t allied_get_trigline(AlliedCameraHandle_t handle, const char **line)
+bool allied_camera_acquiring(AlliedCameraHandle_t handle)
 {
     assert(handle);
-    assert(line);
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    return ihandle->acquiring;
+}
+
+VmbError_t allied_get_camera_topology(AlliedCameraHandle_t handle, AlliedTopology_t *topo)
+{
+    assert(handle);
+    assert(topo);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ALLIEDCALL(VmbFeatureEnumGet, ihandle->handle, "LineSelector", line);
+    *topo = ihandle->topo;
+    return VmbErrorSuccess;
 }
 
-VmbError_t allied_set_trigline(AlliedCameraHandle_t handle, const char *line)
+VmbError_t allied_get_numa_node(AlliedCameraHandle_t handle, int *node)
 {
     assert(handle);
-    assert(line);
+    assert(node);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ALLIEDCALL(VmbFeatureEnumSet, ihandle->handle, "LineSelector", line);
+    *node = ihandle->numa_node;
+    return VmbErrorSuccess;
 }
 
-VmbError_t allied_get_trigline_mode(AlliedCameraHandle_t handle, const char **mode)
+VmbError_t allied_set_numa_node(AlliedCameraHandle_t handle, int node)
 {
     assert(handle);
-    assert(mode);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ALLIEDCALL(VmbFeatureEnumGet, ihandle->handle, "LineMode", mode);
+    if (ihandle->acquiring)
+    {
+        return VmbErrorBusy;
+    }
+    if (node < 0)
+    {
+        node = -1;
+    }
+    if (node == ihandle->numa_node)
+    {
+        return VmbErrorSuccess;
+    }
+    if (ihandle->streaming)
+    {
+        ALLIEDEXIT(allied_dequeue_capture, handle);
+    }
+    ihandle->numa_node = node;
+    return ALLIEDCALL(allied_realloc_framebuffer, handle);
 }
 
-VmbError_t allied_set_trigline_mode(AlliedCameraHandle_t handle, const char *mode)
+VmbError_t allied_set_frame_guard(AlliedCameraHandle_t handle, VmbUint32_t depth)
 {
     assert(handle);
-    assert(mode);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ALLIEDCALL(VmbFeatureEnumSet, ihandle->handle, "LineMode", mode);
+    if (ihandle->acquiring)
+    {
+        return VmbErrorBusy;
+    }
+    if (depth == ihandle->guard.depth)
+    {
+        return VmbErrorSuccess;
+    }
+    VmbFrame_t **ring = NULL;
+    if (depth > 0)
+    {
+        ring = (VmbFrame_t **)malloc(depth * sizeof(VmbFrame_t *));
+        if (ring == NULL)
+        {
+            return VmbErrorResources;
+        }
+    }
+    if (ihandle->streaming)
+    {
+        VmbError_t err = ALLIEDCALL(allied_dequeue_capture, handle);
+        if (err != VmbErrorSuccess)
+        {
+            free(ring);
+            return err;
+        }
+    }
+    allied_guard_flush(ihandle);
+    free(ihandle->guard.ring);
+    ihandle->guard.ring = ring;
+    ihandle->guard.depth = depth;
+    return ALLIEDCALL(allied_realloc_framebuffer, handle);
 }
 
-VmbError_t allied_get_trigline_src(AlliedCameraHandle_t handle, const char **src)
+VmbError_t allied_get_frame_guard(AlliedCameraHandle_t handle, VmbUint32_t *depth)
 {
     assert(handle);
-    assert(src);
+    assert(depth);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ALLIEDCALL(VmbFeatureEnumGet, ihandle->handle, "LineSource", src);
+    *depth = ihandle->guard.depth;
+    return VmbErrorSuccess;
 }
 
-VmbError_t allied_set_trigline_src(AlliedCameraHandle_t handle, const char *src)
+VmbError_t allied_set_frame_stats(AlliedCameraHandle_t handle, const AlliedStatsConfig_t *config)
 {
     assert(handle);
-    assert(src);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
+    if (config != NULL && config->num_percentiles > ALLIED_STATS_PERCENTILES)
+    {
+        return VmbErrorBadParameter;
+    }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ALLIEDCALL(VmbFeatureEnumSet, ihandle->handle, "LineSource", src);
+    pthread_mutex_lock(&(ihandle->stats.lock));
+    // the stage is disabled until the scratch is allocated, so the delivery thread does not use it meanwhile
+    if (config != NULL && ihandle->stats.scratch == NULL)
+    {
+        ihandle->stats.scratch = (VmbUint32_t *)malloc(sizeof(VmbUint32_t) * ALLIED_STATS_SCRATCH);
+        if (ihandle->stats.scratch == NULL)
+        {
+            pthread_mutex_unlock(&(ihandle->stats.lock));
+            return VmbErrorResources;
+        }
+    }
+    if (config != NULL)
+    {
+        ihandle->stats.next = *config;
+    }
+    ihandle->stats.next_enabled = config != NULL;
+    atomic_store_explicit(&(ihandle->stats.dirty), true, memory_order_release);
+    pthread_mutex_unlock(&(ihandle->stats.lock));
+    return VmbErrorSuccess;
 }
 
-VmbError_t allied_get_trigline_src_list(AlliedCameraHandle_t handle, char ***srcs, VmbBool_t **available, VmbUint32_t *count)
+VmbError_t allied_frame_stats(const VmbFrame_t *frame, const AlliedFrameStats_t **stats)
+{
+    assert(frame);
+    assert(stats);
+    AlliedFrameSlot_s *slot = (AlliedFrameSlot_s *)frame->context[CONTEXT_SLOT_HANDLE];
+    *stats = NULL;
+    if (slot == NULL || atomic_load(&(slot->refs)) == 0)
+    {
+        return VmbErrorInvalidCall;
+    }
+    if (!atomic_load_explicit(&(slot->stats_valid), memory_order_acquire))
+    {
+        return VmbErrorNotAvailable;
+    }
+    *stats = slot->stats;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_set_beam_profile(AlliedCameraHandle_t handle, const AlliedBeamConfig_t *config)
 {
     assert(handle);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
-    return allied_get_feature_enum_list(handle, "LineSource", srcs, available, count);
+    if (config != NULL && (config->background > AlliedBeamBackgroundBorder || !(config->level >= 0 && config->level <= 65535) ||
+                           !(config->threshold >= 0) || !(config->sigma >= 0)))
+    {
+        return VmbErrorBadParameter;
+    }
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    pthread_mutex_lock(&(ihandle->beam.lock));
+    bool enabled = ihandle->beam.next_enabled;
+    ihandle->beam.next_enabled = config != NULL;
+    // the profiles are published to the delivery thread with the configuration
+    VmbError_t err = allied_beam_reserve(ihandle);
+    if (err != VmbErrorSuccess)
+    {
+        ihandle->beam.next_enabled = enabled;
+        pthread_mutex_unlock(&(ihandle->beam.lock));
+        return err;
+    }
+    if (config != NULL)
+    {
+        ihandle->beam.next = *config;
+    }
+    atomic_store_explicit(&(ihandle->beam.dirty), true, memory_order_release);
+    pthread_mutex_unlock(&(ihandle->beam.lock));
+    return VmbErrorSuccess;
 }
 
-VmbError_t allied_get_trigline_mode_list(AlliedCameraHandle_t handle, char ***modes, VmbBool_t **available, VmbUint32_t *count)
+VmbError_t allied_frame_beam(const VmbFrame_t *frame, const AlliedBeamProfile_t **profile)
 {
-    assert(handle);
-
-    if (atomic_load(&is_init) == false)
+    assert(frame);
+    assert(profile);
+    AlliedFrameSlot_s *slot = (AlliedFrameSlot_s *)frame->context[CONTEXT_SLOT_HANDLE];
+    *profile = NULL;
+    if (slot == NULL || atomic_load(&(slot->refs)) == 0)
     {
-        return VmbErrorNotInitialized;
+        return VmbErrorInvalidCall;
     }
-    return allied_get_feature_enum_list(handle, "LineMode", modes, available, count);
+    if (!slot->beam_valid)
+    {
+        return VmbErrorNotAvailable;
+    }
+    *profile = slot->beam;
+    return VmbErrorSuccess;
 }
 
-VmbError_t allied_get_trigline_polarity(AlliedCameraHandle_t handle, VmbBool_t *polarity)
+VmbError_t allied_set_photometry(AlliedCameraHandle_t handle, const AlliedAperture_t *apertures, VmbUint32_t count, const AlliedPhotometryConfig_t *config)
 {
     assert(handle);
-    assert(polarity);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ALLIEDCALL(VmbFeatureBoolGet, ihandle->handle, "LineInverter", polarity);
+    AlliedPhotometry_t phot = NULL;
+    if (apertures != NULL)
+    {
+        VmbError_t err = allied_photometry_create(&phot, apertures, count, config);
+        if (err != VmbErrorSuccess)
+        {
+            return err;
+        }
+    }
+    AlliedPhotStage_s *stage = &(ihandle->photometry);
+    pthread_mutex_lock(&(stage->lock));
+    size_t old_size = stage->size;
+    stage->size = phot == NULL ? 0 : sizeof(AlliedPhotometryRecord_t) + sizeof(AlliedApertureFlux_t) * allied_photometry_count(phot);
+    // the records are allocated here rather than on the delivery thread
+    VmbError_t err = allied_phot_reserve(ihandle);
+    if (err != VmbErrorSuccess)
+    {
+        stage->size = old_size;
+        pthread_mutex_unlock(&(stage->lock));
+        allied_photometry_destroy(&phot);
+        return err;
+    }
+    // either a configuration that was never applied, or the engine the delivery thread replaced
+    allied_photometry_destroy(&(stage->next));
+    stage->next = phot;
+    atomic_store_explicit(&(stage->dirty), true, memory_order_release);
+    pthread_mutex_unlock(&(stage->lock));
+    return VmbErrorSuccess;
 }
 
-VmbError_t allied_set_trigline_polarity(AlliedCameraHandle_t handle, VmbBool_t polarity)
+VmbError_t allied_frame_photometry(const VmbFrame_t *frame, const AlliedPhotometryRecord_t **record)
 {
-    assert(handle);
-    if (atomic_load(&is_init) == false)
+    assert(frame);
+    assert(record);
+    AlliedFrameSlot_s *slot = (AlliedFrameSlot_s *)frame->context[CONTEXT_SLOT_HANDLE];
+    *record = NULL;
+    if (slot == NULL || atomic_load(&(slot->refs)) == 0)
     {
-        return VmbErrorNotInitialized;
+        return VmbErrorInvalidCall;
     }
-    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ALLIEDCALL(VmbFeatureBoolSet, ihandle->handle, "LineInverter", polarity);
+    if (!slot->phot_valid)
+    {
+        return VmbErrorNotAvailable;
+    }
+    *record = slot->phot;
+    return VmbErrorSuccess;
 }
 
-VmbError_t allied_get_trigline_debounce_mode(AlliedCameraHandle_t handle, char **mode)
+VmbError_t allied_set_change_detection(AlliedCameraHandle_t handle, const AlliedChangeTrigger_t *config)
 {
     assert(handle);
-    assert(mode);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ALLIEDCALL(VmbFeatureEnumGet, ihandle->handle, "LineDebouncerMode", (const char **)mode);
+    AlliedChangeDetector_t det = NULL;
+    VmbFrame_t **held = NULL;
+    if (config != NULL)
+    {
+        VmbError_t err = allied_change_create(&det, &(config->detector));
+        if (err != VmbErrorSuccess)
+        {
+            return err;
+        }
+        if (config->pre > 0)
+        {
+            held = (VmbFrame_t **)malloc(sizeof(VmbFrame_t *) * config->pre);
+            if (held == NULL)
+            {
+                allied_change_destroy(&det);
+                return VmbErrorResources;
+            }
+        }
+    }
+    pthread_mutex_lock(&(ihandle->change.lock));
+    allied_change_destroy(&(ihandle->change.next));
+    free(ihandle->change.next_held);
+    ihandle->change.next = det;
+    ihandle->change.next_held = held;
+    ihandle->change.next_pre = config == NULL ? 0 : config->pre;
+    ihandle->change.next_post = config == NULL ? 0 : config->post;
+    atomic_store_explicit(&(ihandle->change.dirty), true, memory_order_release);
+    pthread_mutex_unlock(&(ihandle->change.lock));
+    return VmbErrorSuccess;
 }
 
-VmbError_t allied_set_trigline_debounce_mode(AlliedCameraHandle_t handle, const char *mode)
+VmbError_t allied_get_change_status(AlliedCameraHandle_t handle, AlliedChangeStatus_t *status)
 {
     assert(handle);
-    assert(mode);
+    assert(status);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ALLIEDCALL(VmbFeatureEnumSet, ihandle->handle, "LineDebouncerMode", mode);
+    AlliedChangeStage_s *stage = &(ihandle->change);
+    memset(status, 0, sizeof(*status));
+    status->enabled = atomic_load(&(stage->enabled));
+    status->frames = atomic_load(&(stage->frames));
+    status->changed = atomic_load(&(stage->changed));
+    status->forwarded = atomic_load(&(stage->forwarded));
+    status->events = atomic_load(&(stage->events));
+    status->incomplete = atomic_load(&(stage->incomplete));
+    return VmbErrorSuccess;
 }
 
-VmbError_t allied_get_trigline_debounce_mode_list(AlliedCameraHandle_t handle, char ***modes, VmbBool_t **available, VmbUint32_t *count)
+VmbError_t allied_frame_change(const VmbFrame_t *frame, const AlliedChangeResult_t **result)
 {
-    assert(handle);
-
-    if (atomic_load(&is_init) == false)
+    assert(frame);
+    assert(result);
+    AlliedFrameSlot_s *slot = (AlliedFrameSlot_s *)frame->context[CONTEXT_SLOT_HANDLE];
+    *result = NULL;
+    if (slot == NULL || atomic_load(&(slot->refs)) == 0)
     {
-        return VmbErrorNotInitialized;
+        return VmbErrorInvalidCall;
     }
-    return allied_get_feature_enum_list(handle, "LineDebouncerMode", modes, available, count);
+    if (!slot->change_valid)
+    {
+        return VmbErrorNotAvailable;
+    }
+    *result = &(slot->change);
+    return VmbErrorSuccess;
 }
 
-VmbError_t allied_get_trigline_debounce_time(AlliedCameraHandle_t handle, double *time)
+VmbError_t allied_calib_geometry(AlliedCameraHandle_t handle, AlliedCalibGeometry_t *geometry)
 {
     assert(handle);
-    assert(time);
+    assert(geometry);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ALLIEDCALL(VmbFeatureFloatGet, ihandle->handle, "LineDebounceDuration", time);
+    VmbInt64_t x = 0, y = 0, width = 0, height = 0, binning = 0, format = 0;
+    const char *name = NULL;
+    ALLIEDEXIT(allied_get_image_ofst, handle, &x, &y);
+    ALLIEDEXIT(allied_get_image_size, handle, &width, &height);
+    ALLIEDEXIT(allied_get_binning_factor, handle, &binning);
+    ALLIEDEXIT(VmbFeatureEnumGet, ihandle->handle, "PixelFormat", &name);
+    ALLIEDEXIT(VmbFeatureEnumAsInt, ihandle->handle, "PixelFormat", name, &format);
+    geometry->offset_x = (VmbUint32_t)x;
+    geometry->offset_y = (VmbUint32_t)y;
+    geometry->width = (VmbUint32_t)width;
+    geometry->height = (VmbUint32_t)height;
+    geometry->binning = (VmbUint32_t)binning;
+    geometry->format = (VmbPixelFormat_t)format;
+    return VmbErrorSuccess;
 }
 
-VmbError_t allied_set_trigline_debounce_time(AlliedCameraHandle_t handle, double time)
+VmbError_t allied_set_calibration(AlliedCameraHandle_t handle, AlliedCalibration_t calib)
 {
     assert(handle);
     if (atomic_load(&is_init) == false)
@@ -1448,380 +4413,1041 @@ VmbError_t allied_set_trigline_debounce_time(AlliedCameraHandle_t handle, double
         return VmbErrorNotInitialized;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ALLIEDCALL(VmbFeatureFloatSet, ihandle->handle, "LineDebounceDuration", time);
+    AlliedCalibStage_s *stage = &(ihandle->calib);
+    AlliedCalibGeometry_t geometry = {0};
+    if (calib != NULL)
+    {
+        allied_calib_get_geometry(calib, &geometry);
+        if (geometry.binning != atomic_load_explicit(&(ihandle->binning), memory_order_relaxed))
+        {
+            return VmbErrorBadParameter;
+        }
+    }
+    pthread_mutex_lock(&(stage->lock));
+    AlliedCalibration_t old = stage->calib;
+    AlliedCalibGeometry_t old_geometry = stage->geometry;
+    size_t old_size = stage->size;
+    stage->calib = calib;
+    stage->geometry = geometry;
+    stage->size = calib == NULL ? 0 : allied_calib_output_size(calib);
+    // the buffers are allocated here rather than on the delivery thread
+    VmbError_t err = allied_calib_reserve(ihandle);
+    if (err != VmbErrorSuccess)
+    {
+        stage->calib = old;
+        stage->geometry = old_geometry;
+        stage->size = old_size;
+    }
+    else
+    {
+        atomic_store_explicit(&(stage->enabled), calib != NULL, memory_order_release);
+    }
+    // a frame calibrated with the previous calibration is finished before it can be destroyed
+    while (stage->busy)
+    {
+        pthread_cond_wait(&(stage->idle), &(stage->lock));
+    }
+    pthread_mutex_unlock(&(stage->lock));
+    return err;
 }
 
-VmbError_t allied_get_trigline_debounce_time_range(AlliedCameraHandle_t handle, double *minval, double *maxval, double *step)
+VmbError_t allied_frame_calibrated(const VmbFrame_t *frame, const AlliedImage_t **image)
 {
-    return allied_get_feature_float_range(handle, "LineDebounceDuration", minval, maxval, step);
+    assert(frame);
+    assert(image);
+    AlliedFrameSlot_s *slot = (AlliedFrameSlot_s *)frame->context[CONTEXT_SLOT_HANDLE];
+    *image = NULL;
+    if (slot == NULL || atomic_load(&(slot->refs)) == 0)
+    {
+        return VmbErrorInvalidCall;
+    }
+    if (!slot->calib_valid)
+    {
+        return VmbErrorNotAvailable;
+    }
+    *image = &(slot->calib);
+    return VmbErrorSuccess;
 }
 
-VmbError_t allied_get_image_format_list(AlliedCameraHandle_t handle, char ***formats, VmbBool_t **available, VmbUint32_t *count)
+/**
+ * @brief Compute the exposure time and gain that bring the metered percentile to the target.
+ *
+ * @param config Auto-exposure configuration
+ * @param limits Exposure and gain limits
+ * @param measure Measurement
+ * @param exposure Exposure time in us, updated
+ * @param gain Gain in dB, updated
+ * @return bool The loop is converged, and the settings are unchanged
+ */
+static bool allied_exposure_control(const AlliedAutoExposure_t *config, const AlliedExposureLimits_s *limits, const AlliedExposureMeasure_s *measure, double *exposure, double *gain)
 {
-    assert(handle);
-
-    if (atomic_load(&is_init) == false)
+    double tolerance = config->tolerance > 0 ? config->tolerance : 0.05;
+    double damping = config->damping > 0 ? config->damping : 1;
+    double max_ratio = config->max_ratio > 0 ? config->max_ratio : 4;
+    bool saturating = measure->saturated > config->saturation_limit;
+    // settings left outside new limits are moved in, even when the level is on target
+    bool in_limits = *exposure >= limits->exposure_min && *exposure <= limits->exposure_max &&
+                     (!config->use_gain || (*gain >= limits->gain_min && *gain <= limits->gain_max));
+    double ratio = measure->level > 0 ? pow(config->target / measure->level, damping) : max_ratio;
+    if (!saturating && fabs(measure->level / config->target - 1) <= tolerance)
+    {
+        if (in_limits)
+        {
+            return true;
+        }
+        ratio = 1;
+    }
+    if (saturating)
     {
-        return VmbErrorNotInitialized;
+        ratio = fmin(ratio, pow(0.5, damping));
     }
-    return allied_get_feature_enum_list(handle, "PixelFormat", formats, available, count);
+    ratio = fmin(fmax(ratio, 1 / max_ratio), max_ratio);
+    double new_exposure, new_gain = *gain;
+    if (config->use_gain)
+    {
+        // exposure time is used up before gain is added, and gain is removed before exposure time
+        double total = *exposure * pow(10, *gain / 20) * ratio;
+        new_exposure = fmin(fmax(total / pow(10, limits->gain_min / 20), limits->exposure_min), limits->exposure_max);
+        new_gain = fmin(fmax(20 * log10(total / new_exposure), limits->gain_min), limits->gain_max);
+    }
+    else
+    {
+        new_exposure = fmin(fmax(*exposure * ratio, limits->exposure_min), limits->exposure_max);
+    }
+    // nothing left to change at the limits
+    if (fabs(new_exposure - *exposure) <= 1e-6 * *exposure && fabs(new_gain - *gain) <= 1e-6)
+    {
+        return true;
+    }
+    *exposure = new_exposure;
+    *gain = new_gain;
+    return false;
 }
 
-VmbError_t allied_get_sensor_bit_depth_list(AlliedCameraHandle_t handle, char ***depths, VmbBool_t **available, VmbUint32_t *count)
+/**
+ * @brief Auto-exposure controller thread. Acts on one measurement at a time, and writes the new settings to the camera.
+ *
+ * @param arg Camera handle
+ * @return void* NULL
+ */
+static void *allied_exposure_thread(void *arg)
 {
-    assert(handle);
-
-    if (atomic_load(&is_init) == false)
-    {
-        return VmbErrorNotInitialized;
+    struct camera_handle_s *ihandle = (struct camera_handle_s *)arg;
+    AlliedExposureStage_s *ae = &(ihandle->exposure);
+    // controllers run next to the camera, like the delivery thread
+    allied_numa_pin_thread(ihandle->numa_node);
+    pthread_mutex_lock(&(ae->lock));
+    while (true)
+    {
+        while (!ae->quit && !ae->measured)
+        {
+            pthread_cond_wait(&(ae->wake), &(ae->lock));
+        }
+        if (ae->quit)
+        {
+            break;
+        }
+        AlliedExposureMeasure_s measure = ae->measure;
+        AlliedAutoExposure_t config = ae->next;
+        AlliedExposureLimits_s limits = ae->limits;
+        double exposure = ae->status.exposure_us;
+        double gain = ae->status.gain_db;
+        ae->measured = false;
+        pthread_mutex_unlock(&(ae->lock));
+        double previous_exposure = exposure, previous_gain = gain;
+        bool converged = allied_exposure_control(&config, &limits, &measure, &exposure, &gain);
+        double update_ms = 0;
+        VmbError_t err = VmbErrorSuccess;
+        if (!converged)
+        {
+            double start = allied_now_ms();
+            err = ALLIEDCALL(VmbFeatureFloatSet, ihandle->handle, "ExposureTime", exposure);
+            if (err == VmbErrorSuccess && config.use_gain)
+            {
+                err = ALLIEDCALL(VmbFeatureFloatSet, ihandle->handle, "Gain", gain);
+            }
+            // the camera rounds the settings to its steps, or keeps the previous ones if a write failed: continue from what it applied
+            double applied = 0;
+            if (ALLIEDCALL(VmbFeatureFloatGet, ihandle->handle, "ExposureTime", &applied) == VmbErrorSuccess)
+            {
+                exposure = applied;
+            }
+            else if (err != VmbErrorSuccess)
+            {
+                exposure = previous_exposure;
+            }
+            if (config.use_gain && ALLIEDCALL(VmbFeatureFloatGet, ihandle->handle, "Gain", &applied) == VmbErrorSuccess)
+            {
+                gain = applied;
+            }
+            else if (err != VmbErrorSuccess)
+            {
+                gain = previous_gain;
+            }
+            update_ms = allied_now_ms() - start;
+            // frames delivered up to now were exposed before the write completed
+            atomic_store_explicit(&(ae->stale_until), atomic_load(&(ae->last_id)) + config.settle_frames, memory_order_release);
+        }
+        double now = allied_now_ms();
+        pthread_mutex_lock(&(ae->lock));
+        AlliedAutoExposureStatus_t *status = &(ae->status);
+        if (converged && !status->converged)
+        {
+            status->convergence_frames = (VmbUint32_t)(measure.frame_id - ae->since_id);
+            status->convergence_ms = now - ae->since_ms;
+        }
+        else if (!converged && status->converged)
+        {
+            ae->since_id = measure.frame_id;
+            ae->since_ms = now;
+        }
+        status->converged = converged;
+        status->frame_id = measure.frame_id;
+        status->level = measure.level;
+        status->saturated = measure.saturated;
+        status->exposure_us = exposure;
+        status->gain_db = gain;
+        if (!converged)
+        {
+            status->updates++;
+            status->update_ms = update_ms;
+            status->error = err;
+        }
+        atomic_store_explicit(&(ae->pending), false, memory_order_release);
     }
-    return allied_get_feature_enum_list(handle, "SensorBitDepth", depths, available, count);
+    pthread_mutex_unlock(&(ae->lock));
+    return NULL;
 }
 
-VmbError_t allied_get_temperature_src_list(AlliedCameraHandle_t handle, char ***srcs, VmbBool_t **available, VmbUint32_t *count)
+static void allied_exposure_stop(struct camera_handle_s *ihandle)
 {
-    assert(handle);
-
-    if (atomic_load(&is_init) == false)
+    AlliedExposureStage_s *ae = &(ihandle->exposure);
+    if (!ae->running)
     {
-        return VmbErrorNotInitialized;
+        return;
     }
-    return allied_get_feature_enum_list(handle, "DeviceTemperatureSelector", srcs, available, count);
+    pthread_mutex_lock(&(ae->lock));
+    ae->quit = true;
+    ae->next_enabled = false;
+    atomic_store_explicit(&(ae->dirty), true, memory_order_release);
+    pthread_cond_signal(&(ae->wake));
+    pthread_mutex_unlock(&(ae->lock));
+    pthread_join(ae->thread, NULL);
+    ae->running = false;
+    ae->quit = false;
+    ae->measured = false;
+    atomic_store(&(ae->pending), false);
 }
 
-VmbError_t allied_get_triglines_list(AlliedCameraHandle_t handle, char ***lines, VmbBool_t **available, VmbUint32_t *count)
+VmbError_t allied_set_auto_exposure(AlliedCameraHandle_t handle, const AlliedAutoExposure_t *config)
 {
     assert(handle);
-    assert(lines);
-
-    assert(count);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
-    return allied_get_feature_enum_list(handle, "LineSelector", lines, available, count);
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    AlliedExposureStage_s *ae = &(ihandle->exposure);
+    if (config == NULL)
+    {
+        allied_exposure_stop(ihandle);
+        return VmbErrorSuccess;
+    }
+    if (config->percentile < 0 || config->percentile > 100 || config->target <= 0 || config->target > 1 ||
+        config->tolerance < 0 || config->saturation_limit < 0 || config->damping < 0 || config->damping > 1 ||
+        (config->max_ratio != 0 && config->max_ratio < 1))
+    {
+        return VmbErrorBadParameter;
+    }
+    // resolve the limits and read the starting point on the calling thread
+    AlliedExposureLimits_s limits = {0};
+    double exposure = 0, gain = 0;
+    VmbError_t err = allied_get_exposure_range_us(handle, &(limits.exposure_min), &(limits.exposure_max), NULL);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    limits.exposure_min = config->exposure_min_us > limits.exposure_min ? config->exposure_min_us : limits.exposure_min;
+    limits.exposure_max = config->exposure_max_us > 0 && config->exposure_max_us < limits.exposure_max ? config->exposure_max_us : limits.exposure_max;
+    if (limits.exposure_min > limits.exposure_max)
+    {
+        return VmbErrorBadParameter;
+    }
+    err = allied_get_exposure_us(handle, &exposure);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    if (config->use_gain)
+    {
+        err = allied_get_gain_range(handle, &(limits.gain_min), &(limits.gain_max), NULL);
+        if (err == VmbErrorSuccess)
+        {
+            err = allied_get_gain(handle, &gain);
+        }
+        if (err != VmbErrorSuccess)
+        {
+            return err;
+        }
+        limits.gain_max = config->gain_max_db > 0 && config->gain_max_db < limits.gain_max ? config->gain_max_db : limits.gain_max;
+    }
+    pthread_mutex_lock(&(ae->lock));
+    // the stage is disabled until its buffers are allocated, so the delivery thread does not use them meanwhile
+    if (ae->scratch == NULL)
+    {
+        ae->scratch = (VmbUint32_t *)malloc(sizeof(VmbUint32_t) * ALLIED_STATS_SCRATCH);
+    }
+    if (ae->stats == NULL)
+    {
+        ae->stats = (AlliedFrameStats_t *)malloc(sizeof(AlliedFrameStats_t));
+    }
+    if (ae->scratch == NULL || ae->stats == NULL)
+    {
+        pthread_mutex_unlock(&(ae->lock));
+        return VmbErrorResources;
+    }
+    ae->next = *config;
+    ae->next_enabled = true;
+    ae->limits = limits;
+    ae->status.exposure_us = exposure;
+    ae->status.gain_db = gain;
+    ae->status.converged = false;
+    ae->since_id = atomic_load(&(ae->last_id));
+    ae->since_ms = allied_now_ms();
+    atomic_store_explicit(&(ae->dirty), true, memory_order_release);
+    pthread_mutex_unlock(&(ae->lock));
+    if (!ae->running)
+    {
+        if (pthread_create(&(ae->thread), NULL, &allied_exposure_thread, ihandle) != 0)
+        {
+            pthread_mutex_lock(&(ae->lock));
+            ae->next_enabled = false;
+            pthread_mutex_unlock(&(ae->lock));
+            return VmbErrorResources;
+        }
+        ae->running = true;
+    }
+    return VmbErrorSuccess;
 }
 
-VmbError_t allied_get_indicator_mode_list(AlliedCameraHandle_t handle, char ***modes, VmbBool_t **available, VmbUint32_t *count)
+VmbError_t allied_get_auto_exposure_status(AlliedCameraHandle_t handle, AlliedAutoExposureStatus_t *status)
 {
     assert(handle);
-
+    assert(status);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
-    return allied_get_feature_enum_list(handle, "DeviceIndicatorMode", modes, available, count);
+    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
+    AlliedExposureStage_s *ae = &(ihandle->exposure);
+    pthread_mutex_lock(&(ae->lock));
+    *status = ae->status;
+    pthread_mutex_unlock(&(ae->lock));
+    status->enabled = ae->running;
+    status->measured = atomic_load(&(ae->count));
+    status->stale = atomic_load(&(ae->stale));
+    status->incomplete = atomic_load(&(ae->incomplete));
+    return VmbErrorSuccess;
 }
 
-VmbError_t allied_get_indicator_mode(AlliedCameraHandle_t handle, const char **mode)
+/**
+ * @brief Read the conditions to make a dark for from the camera.
+ *
+ * @param handle Camera handle
+ * @param query Conditions. The gain is 0 if the camera has none, and the temperature NaN if it can not be read.
+ * @return VmbError_t
+ */
+static VmbError_t allied_dark_query(AlliedCameraHandle_t handle, AlliedDarkQuery_t *query)
 {
-    assert(handle);
-    assert(mode);
-    if (atomic_load(&is_init) == false)
+    VmbError_t err = allied_calib_geometry(handle, &(query->geometry));
+    if (err != VmbErrorSuccess)
     {
-        return VmbErrorNotInitialized;
+        return err;
     }
-    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ALLIEDCALL(VmbFeatureEnumGet, ihandle->handle, "DeviceIndicatorMode", mode);
+    err = allied_get_exposure_us(handle, &(query->exposure_us));
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    if (allied_get_gain(handle, &(query->gain_db)) != VmbErrorSuccess)
+    {
+        query->gain_db = 0;
+    }
+    if (allied_get_temperature(handle, &(query->temperature)) != VmbErrorSuccess)
+    {
+        query->temperature = NAN;
+    }
+    return VmbErrorSuccess;
 }
 
-VmbError_t allied_set_indicator_mode(AlliedCameraHandle_t handle, const char *mode)
+/**
+ * @brief Remove the calibration made by the dark library, unless the caller has replaced it, and destroy it.
+ *
+ * @param ihandle Camera handle
+ */
+static void allied_dark_uninstall(struct camera_handle_s *ihandle)
 {
-    assert(handle);
-    assert(mode);
-    if (atomic_load(&is_init) == false)
+    AlliedDarkStage_s *ds = &(ihandle->dark);
+    if (ds->calib == NULL)
     {
-        return VmbErrorNotInitialized;
+        return;
     }
-    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ALLIEDCALL(VmbFeatureEnumSet, ihandle->handle, "DeviceIndicatorMode", mode);
+    pthread_mutex_lock(&(ihandle->calib.lock));
+    if (ihandle->calib.calib == ds->calib)
+    {
+        ihandle->calib.calib = NULL;
+        ihandle->calib.size = 0;
+        atomic_store_explicit(&(ihandle->calib.enabled), false, memory_order_release);
+    }
+    while (ihandle->calib.busy)
+    {
+        pthread_cond_wait(&(ihandle->calib.idle), &(ihandle->calib.lock));
+    }
+    pthread_mutex_unlock(&(ihandle->calib.lock));
+    allied_calib_destroy(&(ds->calib));
 }
 
-VmbError_t allied_get_indicator_luma(AlliedCameraHandle_t handle, VmbInt64_t *luma)
+/**
+ * @brief Read the camera telemetry, and install a new dark if the conditions have moved past the tolerances of the library.
+ * Called on the telemetry thread, or on the calling thread before it is started.
+ *
+ * @param ihandle Camera handle
+ */
+static void allied_dark_update(struct camera_handle_s *ihandle)
 {
-    assert(handle);
-    assert(luma);
-    if (atomic_load(&is_init) == false)
+    AlliedDarkStage_s *ds = &(ihandle->dark);
+    AlliedDarkQuery_t query;
+    VmbError_t err = allied_dark_query(ihandle, &query);
+    if (err != VmbErrorSuccess)
     {
-        return VmbErrorNotInitialized;
+        pthread_mutex_lock(&(ds->lock));
+        ds->status.error = err;
+        pthread_mutex_unlock(&(ds->lock));
+        return;
+    }
+    VmbUint32_t entries = allied_dark_library_count(ds->library);
+    if (ds->attempted && entries == ds->entries && allied_dark_library_equivalent(ds->library, &query, &(ds->tried)))
+    {
+        return;
+    }
+    ds->attempted = true;
+    ds->tried = query;
+    ds->entries = entries;
+    double start = allied_now_ms();
+    AlliedDarkSelection_t selection;
+    AlliedCalibration_t calib = NULL;
+    err = allied_dark_library_select(ds->library, &query, &selection);
+    if (err == VmbErrorSuccess)
+    {
+        AlliedMaster_t dark;
+        err = allied_dark_library_build(ds->library, &query, &selection, &dark);
+        if (err == VmbErrorSuccess)
+        {
+            AlliedCalibConfig_t config = {
+                .dark = &dark,
+                .flat = ds->config.flat,
+                .pedestal = ds->config.pedestal,
+                .output = ds->config.output,
+                .maps = ds->config.maps,
+                .threads = ds->config.threads,
+            };
+            err = allied_calib_create(&calib, &config);
+            allied_master_free(&dark);
+        }
+    }
+    if (err == VmbErrorSuccess)
+    {
+        err = allied_set_calibration(ihandle, calib);
+        if (err != VmbErrorSuccess)
+        {
+            allied_calib_destroy(&calib);
+        }
+    }
+    if (err == VmbErrorSuccess)
+    {
+        // the old calibration is no longer used once the new one is swapped in
+        allied_calib_destroy(&(ds->calib));
+        ds->calib = calib;
+    }
+    else
+    {
+        // a dark made for other conditions would be wrong for these
+        allied_dark_uninstall(ihandle);
+    }
+    pthread_mutex_lock(&(ds->lock));
+    ds->status.error = err;
+    ds->status.active = ds->calib != NULL;
+    if (err == VmbErrorSuccess)
+    {
+        ds->status.query = query;
+        ds->status.selection = selection;
+        ds->status.switches++;
+        ds->status.build_ms = allied_now_ms() - start;
     }
-    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ALLIEDCALL(VmbFeatureIntGet, ihandle->handle, "DeviceIndicatorLuminance", luma);
+    pthread_mutex_unlock(&(ds->lock));
 }
 
-VmbError_t allied_set_indicator_luma(AlliedCameraHandle_t handle, VmbInt64_t luma)
+/**
+ * @brief Dark library telemetry thread. Reads the camera telemetry every poll interval.
+ *
+ * @param arg Camera handle
+ * @return void* NULL
+ */
+static void *allied_dark_thread(void *arg)
 {
-    assert(handle);
-    if (atomic_load(&is_init) == false)
-    {
-        return VmbErrorNotInitialized;
+    struct camera_handle_s *ihandle = (struct camera_handle_s *)arg;
+    AlliedDarkStage_s *ds = &(ihandle->dark);
+    allied_numa_pin_thread(ihandle->numa_node);
+    VmbUint32_t poll_ms = ds->config.poll_ms > 0 ? ds->config.poll_ms : 1000;
+    pthread_mutex_lock(&(ds->lock));
+    while (true)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += poll_ms / 1000;
+        deadline.tv_nsec += (long)(poll_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (!ds->quit && pthread_cond_timedwait(&(ds->wake), &(ds->lock), &deadline) == 0)
+        {
+        }
+        if (ds->quit)
+        {
+            break;
+        }
+        pthread_mutex_unlock(&(ds->lock));
+        allied_dark_update(ihandle);
+        pthread_mutex_lock(&(ds->lock));
     }
-    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ALLIEDCALL(VmbFeatureIntSet, ihandle->handle, "DeviceIndicatorLuminance", luma);
+    pthread_mutex_unlock(&(ds->lock));
+    return NULL;
 }
 
-VmbError_t allied_get_indicator_luma_range(AlliedCameraHandle_t handle, VmbInt64_t *minval, VmbInt64_t *maxval, VmbInt64_t *step)
+static void allied_dark_stop(struct camera_handle_s *ihandle)
 {
-    return allied_get_feature_int_range(handle, "DeviceIndicatorLuminance", minval, maxval, step);
+    AlliedDarkStage_s *ds = &(ihandle->dark);
+    if (!ds->running)
+    {
+        return;
+    }
+    pthread_mutex_lock(&(ds->lock));
+    ds->quit = true;
+    pthread_cond_signal(&(ds->wake));
+    pthread_mutex_unlock(&(ds->lock));
+    pthread_join(ds->thread, NULL);
+    allied_dark_uninstall(ihandle);
+    allied_master_free(&(ds->flat));
+    ds->running = false;
+    ds->quit = false;
+    ds->attempted = false;
+    ds->library = NULL;
+    pthread_mutex_lock(&(ds->lock));
+    ds->status.active = false;
+    pthread_mutex_unlock(&(ds->lock));
 }
 
-VmbError_t allied_set_sensor_bit_depth(AlliedCameraHandle_t handle, const char *depth)
+VmbError_t allied_set_dark_library(AlliedCameraHandle_t handle, AlliedDarkLibrary_t library, const AlliedDarkTracking_t *config)
 {
     assert(handle);
-    assert(depth);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    if (ihandle->acquiring)
+    AlliedDarkStage_s *ds = &(ihandle->dark);
+    AlliedDarkTracking_t tracking = {0};
+    if (library != NULL && config != NULL)
     {
-        return VmbErrorBusy;
+        tracking = *config;
     }
-    return ALLIEDCALL(VmbFeatureEnumSet, ihandle->handle, "SensorBitDepth", depth);
-}
-
-VmbError_t allied_get_sensor_bit_depth(AlliedCameraHandle_t handle, const char **depth)
-{
-    assert(handle);
-    assert(depth);
-    if (atomic_load(&is_init) == false)
+    const AlliedMaster_t *flat = tracking.flat;
+    if (tracking.output > AlliedCalibOutputFloat || tracking.maps > AlliedCalibMapsFloat || !isfinite(tracking.pedestal) ||
+        (flat != NULL && (flat->kind != AlliedMasterFlat || flat->data == NULL)))
     {
-        return VmbErrorNotInitialized;
+        return VmbErrorBadParameter;
     }
-    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ALLIEDCALL(VmbFeatureEnumGet, ihandle->handle, "SensorBitDepth", depth);
-}
-
-VmbError_t allied_get_exposure_range_us(AlliedCameraHandle_t handle, double *minval, double *maxval, double *step)
-{
-    return allied_get_feature_float_range(handle, "ExposureTime", minval, maxval, step);
-}
-
-VmbError_t allied_set_exposure_us(AlliedCameraHandle_t handle, double value)
-{
-    assert(handle);
-    if (atomic_load(&is_init) == false)
+    allied_dark_stop(ihandle);
+    if (library == NULL)
     {
-        return VmbErrorNotInitialized;
+        return VmbErrorSuccess;
     }
-    if (value <= 0.0)
+    if (flat != NULL)
     {
-        return VmbErrorInvalidValue;
+        size_t size = (size_t)flat->geometry.width * flat->geometry.height * sizeof(float);
+        ds->flat = *flat;
+        ds->flat.data = (float *)malloc(size);
+        if (ds->flat.data == NULL)
+        {
+            return VmbErrorResources;
+        }
+        memcpy(ds->flat.data, flat->data, size);
+        tracking.flat = &(ds->flat);
+    }
+    ds->library = library;
+    ds->config = tracking;
+    pthread_mutex_lock(&(ds->lock));
+    memset(&(ds->status), 0, sizeof(ds->status));
+    pthread_mutex_unlock(&(ds->lock));
+    // the dark for the current conditions is in place before frames are expected to be calibrated
+    allied_dark_update(ihandle);
+    if (pthread_create(&(ds->thread), NULL, &allied_dark_thread, ihandle) != 0)
+    {
+        allied_dark_uninstall(ihandle);
+        allied_master_free(&(ds->flat));
+        ds->attempted = false;
+        ds->library = NULL;
+        return VmbErrorResources;
     }
-    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ALLIEDCALL(VmbFeatureFloatSet, ihandle->handle, "ExposureTime", value);
+    ds->running = true;
+    return VmbErrorSuccess;
 }
 
-VmbError_t allied_get_exposure_us(AlliedCameraHandle_t handle, double *value)
+VmbError_t allied_get_dark_library_status(AlliedCameraHandle_t handle, AlliedDarkTrackingStatus_t *status)
 {
     assert(handle);
-    assert(value);
+    assert(status);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    *value = 0;
-    return ALLIEDCALL(VmbFeatureFloatGet, ihandle->handle, "ExposureTime", value);
+    AlliedDarkStage_s *ds = &(ihandle->dark);
+    pthread_mutex_lock(&(ds->lock));
+    *status = ds->status;
+    pthread_mutex_unlock(&(ds->lock));
+    status->enabled = ds->running;
+    return VmbErrorSuccess;
 }
 
-VmbError_t allied_get_gain_range(AlliedCameraHandle_t handle, double *minval, double *maxval, double *step)
+/**
+ * @brief Defect detection worker thread. Makes the detector for the geometry of the frames, and the map of every completed detection pass, so
+ * that the delivery thread never allocates them.
+ *
+ * @param arg Camera handle
+ * @return void* NULL
+ */
+static void *allied_defect_thread(void *arg)
 {
-    return allied_get_feature_float_range(handle, "Gain", minval, maxval, step);
+    struct camera_handle_s *ihandle = (struct camera_handle_s *)arg;
+    AlliedDefectStage_s *stage = &(ihandle->defects);
+    allied_numa_pin_thread(ihandle->numa_node);
+    pthread_mutex_lock(&(stage->lock));
+    while (true)
+    {
+        while (!stage->quit && !stage->wanted && !stage->build)
+        {
+            pthread_cond_wait(&(stage->wake), &(stage->lock));
+        }
+        if (stage->quit)
+        {
+            break;
+        }
+        VmbUint64_t id = stage->config_id;
+        if (stage->wanted)
+        {
+            AlliedCalibGeometry_t geometry = stage->want;
+            AlliedDefectDetection_t detection = stage->detection;
+            stage->build = false; // a pass of the replaced detector
+            pthread_mutex_unlock(&(stage->lock));
+            AlliedDefectDetector_t detector = NULL;
+            allied_defect_detector_create(&detector, &geometry, &detection);
+            pthread_mutex_lock(&(stage->detector_lock));
+            pthread_mutex_lock(&(stage->lock));
+            stage->wanted = false;
+            if (id == stage->config_id)
+            {
+                AlliedDefectDetector_t old = stage->detector;
+                stage->detector = detector;
+                stage->geometry = geometry;
+                detector = old;
+                atomic_store(&(stage->passes), 0);
+            }
+            pthread_mutex_unlock(&(stage->lock));
+            pthread_mutex_unlock(&(stage->detector_lock));
+            allied_defect_detector_destroy(&detector);
+        }
+        else
+        {
+            stage->build = false;
+            pthread_mutex_unlock(&(stage->lock));
+            AlliedDefectMap_t map = NULL;
+            pthread_mutex_lock(&(stage->detector_lock));
+            if (stage->detector != NULL)
+            {
+                allied_defect_detector_map(stage->detector, &map);
+            }
+            pthread_mutex_unlock(&(stage->detector_lock));
+            pthread_mutex_lock(&(stage->lock));
+            if (map != NULL && id == stage->config_id)
+            {
+                AlliedDefectMap_t old = stage->map;
+                stage->map = map;
+                map = old;
+            }
+            pthread_mutex_unlock(&(stage->lock));
+            allied_defect_map_destroy(&map);
+        }
+        pthread_mutex_lock(&(stage->lock));
+    }
+    pthread_mutex_unlock(&(stage->lock));
+    return NULL;
 }
 
-VmbError_t allied_get_gain(AlliedCameraHandle_t handle, double *value)
+static void allied_defect_stop(struct camera_handle_s *ihandle)
 {
-    assert(handle);
-    assert(value);
-    if (atomic_load(&is_init) == false)
+    AlliedDefectStage_s *stage = &(ihandle->defects);
+    if (!stage->running)
     {
-        return VmbErrorNotInitialized;
+        return;
     }
-    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    *value = 0;
-    return ALLIEDCALL(VmbFeatureFloatGet, ihandle->handle, "Gain", value);
+    atomic_store(&(stage->detect), false);
+    pthread_mutex_lock(&(stage->lock));
+    stage->quit = true;
+    pthread_cond_signal(&(stage->wake));
+    pthread_mutex_unlock(&(stage->lock));
+    pthread_join(stage->thread, NULL);
+    stage->running = false;
+    stage->quit = false;
+    stage->wanted = false;
+    stage->build = false;
 }
 
-VmbError_t allied_set_gain(AlliedCameraHandle_t handle, double value)
+VmbError_t allied_set_defect_correction(AlliedCameraHandle_t handle, const AlliedDefectDetection_t *detection, AlliedDefectMap_t map)
 {
     assert(handle);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
-    if (value <= 0.0)
+    if (detection != NULL && !(detection->sigma >= 0))
     {
-        return VmbErrorInvalidValue;
+        return VmbErrorBadParameter;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ALLIEDCALL(VmbFeatureFloatSet, ihandle->handle, "Gain", value);
-}
-
-VmbError_t allied_get_acq_framerate_auto(AlliedCameraHandle_t handle, bool *auto_on)
-{
-    assert(handle);
-    assert(auto_on);
-    if (atomic_load(&is_init) == false)
+    AlliedDefectStage_s *stage = &(ihandle->defects);
+    AlliedDefectMap_t copy = NULL;
+    if (map != NULL)
     {
-        return VmbErrorNotInitialized;
+        VmbError_t err = allied_defect_map_copy(map, &copy);
+        if (err != VmbErrorSuccess)
+        {
+            return err;
+        }
     }
-    VmbError_t err;
-    VmbBool_t _auto_on = VmbBoolFalse;
-    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    err = ALLIEDCALL(VmbFeatureBoolGet, ihandle->handle, "AcquisitionFrameRateEnable", &_auto_on);
-    if (err != VmbErrorSuccess)
+    if (detection != NULL && !stage->running)
     {
-        *auto_on = true;
-        return err;
-    }
-    *auto_on = !(_auto_on == VmbBoolTrue);
+        if (pthread_create(&(stage->thread), NULL, &allied_defect_thread, ihandle) != 0)
+        {
+            allied_defect_map_destroy(&copy);
+            return VmbErrorResources;
+        }
+        stage->running = true;
+    }
+    // detection starts over with the new configuration, on a detector made by the worker for the next frame
+    pthread_mutex_lock(&(stage->detector_lock));
+    AlliedDefectDetector_t detector = stage->detector;
+    stage->detector = NULL;
+    memset(&(stage->geometry), 0, sizeof(stage->geometry));
+    atomic_store(&(stage->passes), 0);
+    pthread_mutex_lock(&(stage->lock));
+    AlliedDefectMap_t old = stage->map;
+    stage->map = copy;
+    if (detection != NULL)
+    {
+        stage->detection = *detection;
+    }
+    stage->config_id++;
+    stage->wanted = false;
+    stage->build = false;
+    atomic_store_explicit(&(stage->detect), detection != NULL, memory_order_release);
+    atomic_store_explicit(&(stage->enabled), detection != NULL || map != NULL, memory_order_release);
+    pthread_mutex_unlock(&(stage->lock));
+    pthread_mutex_unlock(&(stage->detector_lock));
+    allied_defect_detector_destroy(&detector);
+    allied_defect_map_destroy(&old);
     return VmbErrorSuccess;
 }
 
-VmbError_t allied_set_acq_framerate_auto(AlliedCameraHandle_t handle, bool auto_on)
+VmbError_t allied_get_defect_map(AlliedCameraHandle_t handle, AlliedDefectMap_t *map)
 {
     assert(handle);
+    assert(map);
+    *map = NULL;
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ALLIEDCALL(VmbFeatureBoolSet, ihandle->handle, "AcquisitionFrameRateEnable", !auto_on ? VmbBoolTrue : VmbBoolFalse);
+    AlliedDefectStage_s *stage = &(ihandle->defects);
+    pthread_mutex_lock(&(stage->lock));
+    VmbError_t err = stage->map == NULL ? VmbErrorNotAvailable : allied_defect_map_copy(stage->map, map);
+    pthread_mutex_unlock(&(stage->lock));
+    return err;
 }
 
-VmbError_t allied_get_acq_framerate(AlliedCameraHandle_t handle, double *framerate)
+VmbError_t allied_get_defect_status(AlliedCameraHandle_t handle, AlliedDefectStatus_t *status)
 {
     assert(handle);
-    assert(framerate);
+    assert(status);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    *framerate = 0;
-    return ALLIEDCALL(VmbFeatureFloatGet, ihandle->handle, "AcquisitionFrameRate", framerate);
+    AlliedDefectStage_s *stage = &(ihandle->defects);
+    memset(status, 0, sizeof(*status));
+    pthread_mutex_lock(&(stage->lock));
+    status->detecting = atomic_load(&(stage->detect));
+    status->defects = stage->map == NULL ? 0 : allied_defect_map_count(stage->map);
+    pthread_mutex_unlock(&(stage->lock));
+    status->enabled = atomic_load(&(stage->enabled));
+    status->passes = (VmbUint32_t)atomic_load(&(stage->passes));
+    status->corrected = atomic_load(&(stage->corrected));
+    status->incomplete = atomic_load(&(stage->incomplete));
+    return VmbErrorSuccess;
 }
 
-VmbError_t allied_set_acq_framerate(AlliedCameraHandle_t handle, double framerate)
+/**
+ * @brief Align an offset to the increment, within the limits.
+ *
+ * @param offset Offset
+ * @param limits Offset limits
+ * @param axis 0 for horizontal, 1 for vertical
+ * @return VmbInt64_t Aligned offset
+ */
+static VmbInt64_t allied_track_align(double offset, const AlliedTrackLimits_s *limits, int axis)
 {
-    assert(handle);
-    if (atomic_load(&is_init) == false)
-    {
-        return VmbErrorNotInitialized;
-    }
-    if (framerate <= 0.0)
+    double steps = floor((offset - limits->min[axis]) / limits->increment[axis] + 0.5);
+    if (steps <= 0)
     {
-        return VmbErrorInvalidValue;
+        return limits->min[axis];
     }
-    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ALLIEDCALL(VmbFeatureFloatSet, ihandle->handle, "AcquisitionFrameRate", framerate);
+    double value = limits->min[axis] + steps * limits->increment[axis];
+    return value >= limits->max[axis] ? limits->max[axis] : (VmbInt64_t)value;
 }
 
-VmbError_t allied_get_acq_framerate_range(AlliedCameraHandle_t handle, double *minval, double *maxval, double *step)
+/**
+ * @brief Tracking controller thread. Acts on the latest measurement, and writes the offsets that changed to the camera.
+ *
+ * @param arg Camera handle
+ * @return void* NULL
+ */
+static void *allied_track_thread(void *arg)
 {
-    return allied_get_feature_float_range(handle, "AcquisitionFrameRate", minval, maxval, step);
+    static const char *const features[2] = {"OffsetX", "OffsetY"};
+    struct camera_handle_s *ihandle = (struct camera_handle_s *)arg;
+    AlliedTrackStage_s *ts = &(ihandle->tracking);
+    allied_numa_pin_thread(ihandle->numa_node);
+    pthread_mutex_lock(&(ts->lock));
+    while (true)
+    {
+        while (!ts->quit && !ts->measured)
+        {
+            pthread_cond_wait(&(ts->wake), &(ts->lock));
+        }
+        if (ts->quit)
+        {
+            break;
+        }
+        AlliedTrackMeasure_s measure = ts->measure;
+        AlliedTracking_t config = ts->next;
+        AlliedTrackLimits_s limits = ts->limits;
+        VmbInt64_t offset[2] = {ts->status.offset_x, ts->status.offset_y};
+        ts->measured = false;
+        if (config.measure_only)
+        {
+            continue;
+        }
+        pthread_mutex_unlock(&(ts->lock));
+        // offsets that put the point on the target
+        double point[2] = {measure.x, measure.y};
+        double target[2] = {config.target_x, config.target_y};
+        double ideal[2];
+        for (int i = 0; i < 2; i++)
+        {
+            target[i] = target[i] < 0 ? (limits.size[i] - 1) / 2.0 : target[i];
+            ideal[i] = point[i] - target[i];
+        }
+        VmbInt64_t next[2] = {offset[0], offset[1]};
+        if (hypot(ideal[0] - offset[0], ideal[1] - offset[1]) > config.deadband)
+        {
+            for (int i = 0; i < 2; i++)
+            {
+                next[i] = allied_track_align(offset[i] + config.damping * (ideal[i] - offset[i]), &limits, i);
+            }
+        }
+        if (next[0] == offset[0] && next[1] == offset[1])
+        {
+            pthread_mutex_lock(&(ts->lock));
+            continue;
+        }
+        // only the offsets that changed are written, the payload size does not change so the frames are kept
+        atomic_store_explicit(&(ts->writing), true, memory_order_release);
+        VmbError_t err = VmbErrorSuccess;
+        double start = allied_now_ms();
+        for (int i = 0; i < 2 && err == VmbErrorSuccess; i++)
+        {
+            if (next[i] != offset[i])
+            {
+                err = ALLIEDCALL(VmbFeatureIntSet, ihandle->handle, features[i], next[i]);
+                offset[i] = err == VmbErrorSuccess ? next[i] : offset[i];
+            }
+        }
+        double update_ms = allied_now_ms() - start;
+        pthread_mutex_lock(&(ts->lock));
+        AlliedTrackingStatus_t *status = &(ts->status);
+        status->offset_x = (VmbUint32_t)offset[0];
+        status->offset_y = (VmbUint32_t)offset[1];
+        status->update_ms = update_ms;
+        status->error = err;
+        atomic_store_explicit(&(ts->settle_until), atomic_load(&(ts->last_id)) + config.settle_frames, memory_order_release);
+        atomic_store_explicit(&(ts->writing), false, memory_order_release);
+        if (err == VmbErrorSuccess)
+        {
+            status->updates++;
+            ts->await[0] = offset[0];
+            ts->await[1] = offset[1];
+            ts->await_from = measure;
+            atomic_store_explicit(&(ts->awaiting), true, memory_order_release);
+        }
+    }
+    pthread_mutex_unlock(&(ts->lock));
+    return NULL;
 }
 
-VmbError_t allied_get_camera_id(AlliedCameraHandle_t handle, char **id)
+static void allied_track_stop(struct camera_handle_s *ihandle)
 {
-    assert(handle);
-    assert(id);
-    if (atomic_load(&is_init) == false)
+    AlliedTrackStage_s *ts = &(ihandle->tracking);
+    if (!ts->running)
     {
-        return VmbErrorNotInitialized;
+        return;
     }
-    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    VmbCameraInfo_t info;
-    ALLIEDEXIT(VmbCameraInfoQueryByHandle, ihandle->handle, &info, sizeof(info));
-    *id = strdup(info.cameraIdString);
-    return VmbErrorSuccess;
+    pthread_mutex_lock(&(ts->lock));
+    ts->quit = true;
+    ts->next_enabled = false;
+    allied_spot_finder_destroy(&(ts->next_finder));
+    atomic_store_explicit(&(ts->dirty), true, memory_order_release);
+    pthread_cond_signal(&(ts->wake));
+    pthread_mutex_unlock(&(ts->lock));
+    pthread_join(ts->thread, NULL);
+    ts->running = false;
+    ts->quit = false;
+    ts->measured = false;
+    atomic_store(&(ts->awaiting), false);
 }
 
-VmbError_t allied_get_link_speed(AlliedCameraHandle_t handle, VmbInt64_t *speed)
+VmbError_t allied_set_tracking(AlliedCameraHandle_t handle, const AlliedTracking_t *config)
 {
+    static const char *const features[2] = {"OffsetX", "OffsetY"};
+    static const char *const sizes[2] = {"Width", "Height"};
     assert(handle);
-    assert(speed);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ALLIEDCALL(VmbFeatureIntGet, ihandle->handle, "DeviceLinkSpeed", speed);
-}
-
-VmbError_t allied_get_throughput_limit(AlliedCameraHandle_t handle, VmbInt64_t *speed)
-{
-    assert(handle);
-    assert(speed);
-    if (atomic_load(&is_init) == false)
+    AlliedTrackStage_s *ts = &(ihandle->tracking);
+    if (config == NULL)
     {
-        return VmbErrorNotInitialized;
+        allied_track_stop(ihandle);
+        return VmbErrorSuccess;
     }
-    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ALLIEDCALL(VmbFeatureIntGet, ihandle->handle, "DeviceLinkThroughputLimit", speed);
-}
-
-VmbError_t allied_set_throughput_limit(AlliedCameraHandle_t handle, VmbInt64_t speed)
-{
-    assert(handle);
-    if (atomic_load(&is_init) == false)
+    if (config->max_spots > ALLIED_TRACK_MAX_SPOTS || config->follow > AlliedTrackMean || !(config->deadband >= 0) ||
+        !(config->damping >= 0 && config->damping <= 1))
     {
-        return VmbErrorNotInitialized;
+        return VmbErrorBadParameter;
     }
-    if (speed <= 0)
+    AlliedTracking_t resolved = *config;
+    resolved.max_spots = resolved.max_spots == 0 ? 1 : resolved.max_spots;
+    resolved.deadband = resolved.deadband == 0 ? 1 : resolved.deadband;
+    resolved.damping = resolved.damping == 0 ? 1 : resolved.damping;
+    // resolve the limits and read the starting point on the calling thread
+    AlliedTrackLimits_s limits = {0};
+    VmbInt64_t offset[2] = {0};
+    VmbError_t err = VmbErrorSuccess;
+    for (int i = 0; i < 2 && err == VmbErrorSuccess; i++)
     {
-        return VmbErrorInvalidValue;
+        err = allied_get_feature_int_range(handle, features[i], &(limits.min[i]), &(limits.max[i]), &(limits.increment[i]));
+        if (err == VmbErrorSuccess)
+        {
+            err = allied_get_feature_int(handle, features[i], &(offset[i]));
+        }
+        if (err == VmbErrorSuccess)
+        {
+            err = allied_get_feature_int(handle, sizes[i], &(limits.size[i]));
+        }
+        limits.increment[i] = limits.increment[i] > 0 ? limits.increment[i] : 1;
+        limits.max[i] = limits.min[i] + (limits.max[i] - limits.min[i]) / limits.increment[i] * limits.increment[i];
     }
-    VmbError_t err;
-    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    VmbInt64_t minval = 0, maxval = 0;
-    err = allied_get_throughput_limit_range(handle, &minval, &maxval, NULL);
     if (err != VmbErrorSuccess)
     {
         return err;
     }
-    if ((speed > maxval) || (speed < minval))
+    AlliedSpotFinder_t finder = NULL;
+    err = allied_spot_finder_create(&finder, &(resolved.spots));
+    if (err != VmbErrorSuccess)
     {
-        return VmbErrorInvalidValue;
+        return err;
     }
-    return ALLIEDCALL(VmbFeatureIntSet, ihandle->handle, "DeviceLinkThroughputLimit", speed);
+    pthread_mutex_lock(&(ts->lock));
+    allied_spot_finder_destroy(&(ts->next_finder));
+    ts->next = resolved;
+    ts->next_finder = finder;
+    ts->next_enabled = true;
+    ts->limits = limits;
+    ts->measured = false;
+    ts->status.offset_x = (VmbUint32_t)offset[0];
+    ts->status.offset_y = (VmbUint32_t)offset[1];
+    atomic_store(&(ts->awaiting), false);
+    atomic_store_explicit(&(ts->dirty), true, memory_order_release);
+    pthread_mutex_unlock(&(ts->lock));
+    if (!ts->running)
+    {
+        if (pthread_create(&(ts->thread), NULL, &allied_track_thread, ihandle) != 0)
+        {
+            pthread_mutex_lock(&(ts->lock));
+            ts->next_enabled = false;
+            pthread_mutex_unlock(&(ts->lock));
+            return VmbErrorResources;
+        }
+        ts->running = true;
+    }
+    return VmbErrorSuccess;
 }
 
-VmbError_t allied_get_throughput_limit_range(AlliedCameraHandle_t handle, VmbInt64_t *_Nonnull minval, VmbInt64_t *_Nonnull maxval, VmbInt64_t *_Nullable step)
+VmbError_t allied_get_tracking_status(AlliedCameraHandle_t handle, AlliedTrackingStatus_t *status)
 {
     assert(handle);
-    assert(minval);
-    assert(maxval);
+    assert(status);
     if (atomic_load(&is_init) == false)
     {
         return VmbErrorNotInitialized;
     }
-    VmbInt64_t _step = 0;
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    ALLIEDEXIT(VmbFeatureIntRangeQuery, ihandle->handle, "DeviceLinkThroughputLimit", minval, maxval);
-    if (step == NULL)
-    {
-        return VmbErrorSuccess;
-    }
-    ALLIEDEXIT(VmbFeatureIntIncrementQuery, ihandle->handle, "DeviceLinkThroughputLimit", &_step);
-    *step = _step;
+    AlliedTrackStage_s *ts = &(ihandle->tracking);
+    pthread_mutex_lock(&(ts->lock));
+    *status = ts->status;
+    pthread_mutex_unlock(&(ts->lock));
+    status->enabled = ts->running;
     return VmbErrorSuccess;
 }
 
-bool allied_camera_streaming(AlliedCameraHandle_t handle)
-{
-    assert(handle);
-    _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ihandle->streaming;
-}
-
-bool allied_camera_acquiring(AlliedCameraHandle_t handle)
+VmbError_t allied_pin_thread(AlliedCameraHandle_t handle)
 {
     assert(handle);
+    if (atomic_load(&is_init) == false)
+    {
+        return VmbErrorNotInitialized;
+    }
     _AlliedCameraHandle_s *ihandle = (_AlliedCameraHandle_s *)handle;
-    return ihandle->acquiring;
+    if (ihandle->numa_node < 0)
+    {
+        return VmbErrorNotAvailable;
+    }
+    return allied_numa_pin_thread(ihandle->numa_node);
 }
 
 const char *allied_strerr(VmbError_t status)
@@ -0,0 +1,266 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_beam.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Laser beam profiling for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details The row kernel weighs every pixel by its value above the background in fixed point, `(v << 8) - background`, or 0 at or below
+ * the cutoff, adds the weights to the column projection, and sums the weights and the weights times the column in 64-bit integers. The
+ * column projection is accumulated in doubles, which is exact for integers and is not a reduction, so the loop vectorizes (this file is
+ * built with -O3, see the Makefile). A pixel costs its weight, one product and one addition to its column: the moments along the axes
+ * follow from the projections once the rows are done, and only the mixed moment needs the first moment of every row. The profile stage
+ * that attaches profiles to frames lives with the other frame stages in alliedcam.c.
+ */
+
+#include "alliedcam_beam.h"
+#include "alliedcam_kernels.h"
+#include "alliedcam_dispatch.h"
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <assert.h>
+
+/**
+ * @brief Fractional bits of the fixed point weights.
+ *
+ */
+#define ALLIED_BEAM_FRACTION 8
+
+typedef void (*AlliedBeamRowKernel)(const void *row, VmbUint32_t width, VmbUint32_t cutoff, VmbUint32_t base, double *columns, VmbUint64_t *sums, VmbUint32_t *peak);
+
+/**
+ * @brief Beam profile kernels of a CPU level.
+ *
+ */
+typedef struct
+{
+    AlliedBeamRowKernel row[2]; // Adds the weights of a row to the column projection, and stores their sum and first moment, by source container (8, 16 bits).
+} AlliedBeamKernels_s;
+
+/**
+ * @brief Instantiate a beam profile row kernel.
+ *
+ * @param NAME Suffix of the kernel name.
+ * @param TARGET Target attribute of the CPU level, or nothing.
+ * @param TS Source container type.
+ */
+#define ALLIED_BEAM_KERNEL(NAME, TARGET, TS)                                                                             \
+    TARGET static void allied_beam_row_##NAME(const void *row, VmbUint32_t width, VmbUint32_t cutoff, VmbUint32_t base, \
+                                              double *restrict columns, VmbUint64_t *sums, VmbUint32_t *peak)            \
+    {                                                                                                                    \
+        const TS *restrict s = (const TS *)row;                                                                          \
+        VmbUint64_t s0 = 0, sx = 0;                                                                                      \
+        VmbUint32_t top = *peak;                                                                                         \
+        for (size_t x = 0; x < width; x++)                                                                               \
+        {                                                                                                                \
+            VmbUint32_t v = s[x];                                                                                        \
+            VmbUint32_t w = ((v << ALLIED_BEAM_FRACTION) - base) & -(VmbUint32_t)(v > cutoff);                           \
+            s0 += w;                                                                                                     \
+            sx += (VmbUint64_t)w * (VmbUint32_t)x;                                                                       \
+            top = v > top ? v : top;                                                                                     \
+            columns[x] += (double)(VmbInt32_t)w;                                                                         \
+        }                                                                                                                \
+        sums[0] = s0;                                                                                                    \
+        sums[1] = sx;                                                                                                    \
+        *peak = top;                                                                                                     \
+    }
+
+#define ALLIED_BEAM_LEVEL(LEVEL, TARGET)                                                      \
+    ALLIED_BEAM_KERNEL(8_##LEVEL, TARGET, VmbUint8_t)                                         \
+    ALLIED_BEAM_KERNEL(16_##LEVEL, TARGET, VmbUint16_t)                                       \
+    static const AlliedBeamKernels_s beam_##LEVEL = {                                         \
+        .row = {&allied_beam_row_8_##LEVEL, &allied_beam_row_16_##LEVEL},                     \
+    };
+
+ALLIED_KERNEL_LEVELS(ALLIED_BEAM_LEVEL)
+
+static const AlliedBeamKernels_s *beam_kernels = &beam_scalar;
+
+ALLIED_KERNEL_BINDER(allied_beam_bind, beam_kernels, &beam)
+
+static double allied_beam_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec * 1e-3;
+}
+
+/**
+ * @brief Mean and standard deviation of the `border` outermost rows and columns of a region.
+ *
+ */
+static VmbError_t allied_beam_border(const AlliedImage_t *region, VmbUint32_t border, double *mean, double *stddev)
+{
+    const VmbUint32_t strips[4][4] = {
+        {0, 0, region->width, border},
+        {0, region->height - border, region->width, border},
+        {0, border, border, region->height - 2 * border},
+        {region->width - border, border, border, region->height - 2 * border},
+    };
+    size_t pixel_size = allied_image_pixel_size(region->format);
+    double count = 0, sum = 0, sumsq = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        AlliedImage_t strip = *region;
+        strip.data = (VmbUchar_t *)region->data + (size_t)strips[i][1] * region->stride + (size_t)strips[i][0] * pixel_size;
+        strip.width = strips[i][2];
+        strip.height = strips[i][3];
+        AlliedImageStats_t stats;
+        VmbError_t err = allied_image_stats(&strip, &stats);
+        if (err != VmbErrorSuccess)
+        {
+            return err;
+        }
+        count += (double)stats.count;
+        sum += (double)stats.sum;
+        sumsq += (double)stats.sumsq;
+    }
+    *mean = sum / count;
+    double variance = sumsq / count - *mean * *mean;
+    *stddev = variance > 0 ? sqrt(variance) : 0;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_beam_profile(const AlliedImage_t *image, const AlliedBeamConfig_t *config, AlliedBeamProfile_t *profile, double *columns, double *rows)
+{
+    assert(image);
+    assert(profile);
+    assert(columns);
+    assert(rows);
+    double start = allied_beam_now_us();
+    AlliedBeamConfig_t c = {0};
+    if (config != NULL)
+    {
+        c = *config;
+    }
+    if (c.background > AlliedBeamBackgroundBorder || !(c.level >= 0 && c.level <= 65535) || !(c.threshold >= 0) || !(c.sigma >= 0))
+    {
+        return VmbErrorBadParameter;
+    }
+    const AlliedImageKernels_s *kernels = allied_image_kernels(image->format);
+    if (kernels == NULL)
+    {
+        return VmbErrorNotSupported;
+    }
+    size_t row_size = (size_t)image->width * kernels->pixel_size;
+    size_t stride = image->stride == 0 ? row_size : image->stride;
+    if (image->data == NULL || stride < row_size || c.x >= image->width || c.y >= image->height)
+    {
+        return VmbErrorBadParameter;
+    }
+    VmbUint32_t width = c.width == 0 ? image->width - c.x : c.width;
+    VmbUint32_t height = c.height == 0 ? image->height - c.y : c.height;
+    if (width > image->width - c.x || height > image->height - c.y)
+    {
+        return VmbErrorBadParameter;
+    }
+    AlliedImage_t region = {
+        .data = (VmbUchar_t *)image->data + (size_t)c.y * stride + (size_t)c.x * kernels->pixel_size,
+        .width = width,
+        .height = height,
+        .stride = stride,
+        .format = image->format,
+    };
+    // background and cutoff
+    double background = 0, threshold = c.threshold;
+    if (c.background == AlliedBeamBackgroundLevel)
+    {
+        background = c.level;
+    }
+    else if (c.background == AlliedBeamBackgroundBorder)
+    {
+        VmbUint32_t border = c.border == 0 ? 4 : c.border;
+        if (width <= 2 * border || height <= 2 * border)
+        {
+            return VmbErrorBadParameter;
+        }
+        double stddev = 0;
+        VmbError_t err = allied_beam_border(&region, border, &background, &stddev);
+        if (err != VmbErrorSuccess)
+        {
+            return err;
+        }
+        threshold += c.sigma * stddev;
+    }
+    threshold += background;
+    VmbUint32_t max = (1u << kernels->bits) - 1;
+    VmbUint32_t cutoff = threshold >= max ? max : (VmbUint32_t)threshold;
+    VmbUint32_t base = (VmbUint32_t)llround(background * (1 << ALLIED_BEAM_FRACTION));
+    allied_dispatch_init();
+    AlliedBeamRowKernel kernel = beam_kernels->row[kernels->pixel_size == 1 ? 0 : 1];
+    memset(columns, 0, sizeof(double) * width);
+    // a single pass over the pixels: the projections, and the mixed moment from the first moment of every row
+    double s0 = 0, sxy = 0;
+    VmbUint32_t peak = 0;
+    for (VmbUint32_t y = 0; y < height; y++)
+    {
+        VmbUint64_t sums[2];
+        kernel((const VmbUchar_t *)region.data + (size_t)y * stride, width, cutoff, base, columns, sums, &peak);
+        rows[y] = (double)sums[0];
+        s0 += (double)sums[0];
+        sxy += (double)sums[1] * y;
+    }
+    // the moments along the axes follow from the projections
+    double sx = 0, sxx = 0, sy = 0, syy = 0;
+    for (VmbUint32_t x = 0; x < width; x++)
+    {
+        sx += columns[x] * x;
+        sxx += columns[x] * ((double)x * x);
+        columns[x] /= (1 << ALLIED_BEAM_FRACTION);
+    }
+    for (VmbUint32_t y = 0; y < height; y++)
+    {
+        sy += rows[y] * y;
+        syy += rows[y] * ((double)y * y);
+        rows[y] /= (1 << ALLIED_BEAM_FRACTION);
+    }
+    memset(profile, 0, sizeof(AlliedBeamProfile_t));
+    profile->x = c.x;
+    profile->y = c.y;
+    profile->width = width;
+    profile->height = height;
+    profile->background = background;
+    profile->threshold = threshold;
+    profile->peak = peak;
+    profile->total = s0 / (1 << ALLIED_BEAM_FRACTION);
+    profile->columns = columns;
+    profile->rows = rows;
+    if (s0 > 0)
+    {
+        double cx = sx / s0, cy = sy / s0;
+        double vx = sxx / s0 - cx * cx;
+        double vy = syy / s0 - cy * cy;
+        double cxy = sxy / s0 - cx * cy;
+        vx = vx > 0 ? vx : 0;
+        vy = vy > 0 ? vy : 0;
+        // principal axes, ISO 11146-2
+        double mean = (vx + vy) / 2;
+        double spread = sqrt((vx - vy) * (vx - vy) / 4 + cxy * cxy);
+        double major = mean + spread;
+        double minor = mean - spread > 0 ? mean - spread : 0;
+        profile->centroid_x = cx + c.x;
+        profile->centroid_y = cy + c.y;
+        profile->var_x = vx;
+        profile->var_y = vy;
+        profile->cov_xy = cxy;
+        profile->d4s_x = 4 * sqrt(vx);
+        profile->d4s_y = 4 * sqrt(vy);
+        profile->d4s_major = 4 * sqrt(major);
+        profile->d4s_minor = 4 * sqrt(minor);
+        profile->ellipticity = major > 0 ? sqrt(minor / major) : 1;
+        profile->orientation = spread > 0 ? 0.5 * atan2(2 * cxy, vx - vy) : 0;
+        profile->orientation = profile->orientation <= -M_PI / 2 ? profile->orientation + M_PI : profile->orientation;
+    }
+    else
+    {
+        profile->centroid_x = NAN;
+        profile->centroid_y = NAN;
+    }
+    profile->elapsed_us = allied_beam_now_us() - start;
+    return VmbErrorSuccess;
+}
@@ -0,0 +1,520 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_bin.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Software binning and decimation for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details A row of bins is computed in two passes: the `bin_y` source rows are summed column by column into a 32-bit row, then
+ * every `bin_x` adjacent sums are added and scaled into the output container. The column pass depends only on the source container,
+ * the row pass only on the output container and the bin width; bin widths up to {@link ALLIED_BIN_UNROLLED} are instantiated with
+ * the width as a constant, so the compiler vectorizes the strided loads. Means are taken with a shift when the bin size is a power
+ * of two, and with a float reciprocal corrected to the exact quotient otherwise. This file is built with -O3 (see the Makefile).
+ */
+
+#include "alliedcam_bin.h"
+#include "alliedcam_kernels.h"
+#include "alliedcam_dispatch.h"
+#include "alliedcam_pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/**
+ * @brief Maximum number of pixels in a bin, so that a bin of 16-bit pixels sums in 32 bits.
+ *
+ */
+#define ALLIED_BIN_MAX_PIXELS 65536
+
+/**
+ * @brief Bin widths and decimation steps with a dedicated kernel. Wider bins and larger steps use a generic kernel.
+ *
+ */
+#define ALLIED_BIN_UNROLLED 4
+#define ALLIED_BIN_WIDTH_SLOT(w) ((w) <= ALLIED_BIN_UNROLLED ? (w) - 1 : ALLIED_BIN_UNROLLED)
+
+/**
+ * @brief Conversion of a bin sum to an output pixel.
+ *
+ */
+typedef enum
+{
+    AlliedBinScaleSum = 0, // Sum, saturated to `clamp`.
+    AlliedBinScaleShift,   // Mean of a power of two pixels.
+    AlliedBinScaleFloat,   // Mean through a float reciprocal, sums below 2^24.
+    AlliedBinScaleDivide,  // Mean through an integer division.
+} AlliedBinScaleKind_t;
+
+typedef struct
+{
+    AlliedBinScaleKind_t kind; // Conversion.
+    VmbUint32_t clamp;         // Largest output value of a sum.
+    VmbUint32_t count;         // Pixels per bin.
+    VmbUint32_t shift;         // log2(count), for AlliedBinScaleShift.
+    float inv;                 // 1 / count, for AlliedBinScaleFloat.
+} AlliedBinScale_s;
+
+typedef void (*AlliedBinColumnsKernel)(const VmbUchar_t *src, size_t stride, VmbUint32_t rows, VmbUint32_t width, VmbUint32_t *acc);
+typedef void (*AlliedBinRowKernel)(const VmbUint32_t *acc, VmbUint32_t width, VmbUint32_t bin_x, const AlliedBinScale_s *scale, void *dst);
+typedef void (*AlliedDecimateRowKernel)(const void *src, VmbUint32_t width, VmbUint32_t step, void *dst);
+
+/**
+ * @brief Binning kernels of a CPU level.
+ *
+ */
+typedef struct
+{
+    AlliedBinColumnsKernel columns[2];                             // Column sums, for 8 and 16-bit sources.
+    AlliedBinRowKernel row[3][ALLIED_BIN_UNROLLED + 1];            // Bin sums to pixels, for 8, 16 and 32-bit outputs, by bin width.
+    AlliedDecimateRowKernel decimate[2][ALLIED_BIN_UNROLLED + 1]; // Decimation of a row, for 8 and 16-bit pixels, by step.
+} AlliedBinKernels_s;
+
+/**
+ * @brief Instantiate the column sums for a source container.
+ *
+ */
+#define ALLIED_BIN_COLUMNS(NAME, TARGET, T)                                                                                                   \
+    TARGET static void allied_bin_columns_##NAME(const VmbUchar_t *src, size_t stride, VmbUint32_t rows, VmbUint32_t width, VmbUint32_t *acc) \
+    {                                                                                                                                         \
+        VmbUint32_t *restrict a = acc;                                                                                                        \
+        const T *restrict r0 = (const T *)src;                                                                                                \
+        VmbUint32_t j = 1;                                                                                                                    \
+        if (rows == 1)                                                                                                                        \
+        {                                                                                                                                     \
+            for (size_t x = 0; x < width; x++)                                                                                                \
+            {                                                                                                                                 \
+                a[x] = r0[x];                                                                                                                 \
+            }                                                                                                                                 \
+        }                                                                                                                                     \
+        else                                                                                                                                  \
+        {                                                                                                                                     \
+            const T *restrict r1 = (const T *)(src + stride);                                                                                 \
+            for (size_t x = 0; x < width; x++)                                                                                                \
+            {                                                                                                                                 \
+                a[x] = (VmbUint32_t)r0[x] + r1[x];                                                                                            \
+            }                                                                                                                                 \
+            j = 2;                                                                                                                            \
+        }                                                                                                                                     \
+        /* remaining rows are added in pairs, to halve the passes over the sums */                                                            \
+        for (; j + 2 <= rows; j += 2)                                                                                                         \
+        {                                                                                                                                     \
+            const T *restrict p = (const T *)(src + j * stride);                                                                              \
+            const T *restrict q = (const T *)(src + (j + 1) * stride);                                                                        \
+            for (size_t x = 0; x < width; x++)                                                                                                \
+            {                                                                                                                                 \
+                a[x] += (VmbUint32_t)p[x] + q[x];                                                                                             \
+            }                                                                                                                                 \
+        }                                                                                                                                     \
+        if (j < rows)                                                                                                                         \
+        {                                                                                                                                     \
+            const T *restrict p = (const T *)(src + j * stride);                                                                              \
+            for (size_t x = 0; x < width; x++)                                                                                                \
+            {                                                                                                                                 \
+                a[x] += p[x];                                                                                                                 \
+            }                                                                                                                                 \
+        }                                                                                                                                     \
+    }
+
+/**
+ * @brief Instantiate the bin sums of a row for an output container and a bin width.
+ *
+ * @param NAME Suffix of the kernel name.
+ * @param TARGET Target attribute of the CPU level, or nothing.
+ * @param TO Output container type.
+ * @param BX Bin width, or 0 for a bin width given at run time.
+ */
+#define ALLIED_BIN_ROW(NAME, TARGET, TO, BX)                                                               \
+    TARGET static void allied_bin_row_##NAME(const VmbUint32_t *acc, VmbUint32_t width, VmbUint32_t bin_x, \
+                                             const AlliedBinScale_s *scale, void *dst)                     \
+    {                                                                                                      \
+        const VmbUint32_t *restrict a = acc;                                                               \
+        TO *restrict d = (TO *)dst;                                                                        \
+        const size_t bx = (BX) ? (BX) : bin_x;                                                             \
+        const VmbUint32_t count = scale->count, clamp = scale->clamp, shift = scale->shift;                \
+        const float inv = scale->inv;                                                                      \
+        switch (scale->kind)                                                                               \
+        {                                                                                                  \
+        case AlliedBinScaleSum:                                                                            \
+            for (size_t x = 0; x < width; x++)                                                             \
+            {                                                                                              \
+                VmbUint32_t s = 0;                                                                         \
+                for (size_t i = 0; i < bx; i++)                                                            \
+                {                                                                                          \
+                    s += a[x * bx + i];                                                                    \
+                }                                                                                          \
+                d[x] = (TO)(s > clamp ? clamp : s);                                                        \
+            }                                                                                              \
+            break;                                                                                         \
+        case AlliedBinScaleShift:                                                                          \
+            for (size_t x = 0; x < width; x++)                                                             \
+            {                                                                                              \
+                VmbUint32_t s = 0;                                                                         \
+                for (size_t i = 0; i < bx; i++)                                                            \
+                {                                                                                          \
+                    s += a[x * bx + i];                                                                    \
+                }                                                                                          \
+                d[x] = (TO)(s >> shift);                                                                   \
+            }                                                                                              \
+            break;                                                                                         \
+        case AlliedBinScaleFloat:                                                                          \
+            for (size_t x = 0; x < width; x++)                                                             \
+            {                                                                                              \
+                VmbUint32_t s = 0;                                                                         \
+                for (size_t i = 0; i < bx; i++)                                                            \
+                {                                                                                          \
+                    s += a[x * bx + i];                                                                    \
+                }                                                                                          \
+                /* the estimate is off by at most one, sums are exact in float */                          \
+                VmbInt32_t q = (VmbInt32_t)((float)(VmbInt32_t)s * inv);                                   \
+                q -= (VmbUint32_t)q * count > s;                                                           \
+                q += (VmbUint32_t)(q + 1) * count <= s;                                                    \
+                d[x] = (TO)q;                                                                              \
+            }                                                                                              \
+            break;                                                                                         \
+        default:                                                                                           \
+            for (size_t x = 0; x < width; x++)                                                             \
+            {                                                                                              \
+                VmbUint32_t s = 0;                                                                         \
+                for (size_t i = 0; i < bx; i++)                                                            \
+                {                                                                                          \
+                    s += a[x * bx + i];                                                                    \
+                }                                                                                          \
+                d[x] = (TO)(s / count);                                                                    \
+            }                                                                                              \
+            break;                                                                                         \
+        }                                                                                                  \
+    }
+
+/**
+ * @brief Instantiate the decimation of a row for a pixel container and a step.
+ *
+ * @param NAME Suffix of the kernel name.
+ * @param TARGET Target attribute of the CPU level, or nothing.
+ * @param T Pixel container type.
+ * @param STEP Horizontal step, or 0 for a step given at run time.
+ */
+#define ALLIED_DECIMATE_ROW(NAME, TARGET, T, STEP)                                                                 \
+    TARGET static void allied_decimate_row_##NAME(const void *src, VmbUint32_t width, VmbUint32_t step, void *dst) \
+    {                                                                                                              \
+        const T *restrict s = (const T *)src;                                                                      \
+        T *restrict d = (T *)dst;                                                                                  \
+        const size_t st = (STEP) ? (STEP) : step;                                                                  \
+        for (size_t x = 0; x < width; x++)                                                                         \
+        {                                                                                                          \
+            d[x] = s[x * st];                                                                                      \
+        }                                                                                                          \
+    }
+
+#define ALLIED_BIN_ROWS(LEVEL, TARGET, NAME, TO)         \
+    ALLIED_BIN_ROW(NAME##_1_##LEVEL, TARGET, TO, 1)      \
+    ALLIED_BIN_ROW(NAME##_2_##LEVEL, TARGET, TO, 2)      \
+    ALLIED_BIN_ROW(NAME##_3_##LEVEL, TARGET, TO, 3)      \
+    ALLIED_BIN_ROW(NAME##_4_##LEVEL, TARGET, TO, 4)      \
+    ALLIED_BIN_ROW(NAME##_any_##LEVEL, TARGET, TO, 0)    \
+    ALLIED_DECIMATE_ROW(NAME##_2_##LEVEL, TARGET, TO, 2) \
+    ALLIED_DECIMATE_ROW(NAME##_3_##LEVEL, TARGET, TO, 3) \
+    ALLIED_DECIMATE_ROW(NAME##_4_##LEVEL, TARGET, TO, 4) \
+    ALLIED_DECIMATE_ROW(NAME##_any_##LEVEL, TARGET, TO, 0)
+
+#define ALLIED_BIN_ROW_TABLE(NAME, LEVEL)     \
+    {                                         \
+        &allied_bin_row_##NAME##_1_##LEVEL,   \
+        &allied_bin_row_##NAME##_2_##LEVEL,   \
+        &allied_bin_row_##NAME##_3_##LEVEL,   \
+        &allied_bin_row_##NAME##_4_##LEVEL,   \
+        &allied_bin_row_##NAME##_any_##LEVEL, \
+    }
+
+#define ALLIED_DECIMATE_ROW_TABLE(NAME, LEVEL)     \
+    {                                              \
+        NULL,                                      \
+        &allied_decimate_row_##NAME##_2_##LEVEL,   \
+        &allied_decimate_row_##NAME##_3_##LEVEL,   \
+        &allied_decimate_row_##NAME##_4_##LEVEL,   \
+        &allied_decimate_row_##NAME##_any_##LEVEL, \
+    }
+
+#define ALLIED_BIN_LEVEL(LEVEL, TARGET)                                             \
+    ALLIED_BIN_COLUMNS(8_##LEVEL, TARGET, VmbUint8_t)                               \
+    ALLIED_BIN_COLUMNS(16_##LEVEL, TARGET, VmbUint16_t)                             \
+    ALLIED_BIN_ROWS(LEVEL, TARGET, 8, VmbUint8_t)                                   \
+    ALLIED_BIN_ROWS(LEVEL, TARGET, 16, VmbUint16_t)                                 \
+    ALLIED_BIN_ROW(32_1_##LEVEL, TARGET, VmbUint32_t, 1)                            \
+    ALLIED_BIN_ROW(32_2_##LEVEL, TARGET, VmbUint32_t, 2)                            \
+    ALLIED_BIN_ROW(32_3_##LEVEL, TARGET, VmbUint32_t, 3)                            \
+    ALLIED_BIN_ROW(32_4_##LEVEL, TARGET, VmbUint32_t, 4)                            \
+    ALLIED_BIN_ROW(32_any_##LEVEL, TARGET, VmbUint32_t, 0)                          \
+    static const AlliedBinKernels_s bin_##LEVEL = {                                 \
+        .columns = {&allied_bin_columns_8_##LEVEL, &allied_bin_columns_16_##LEVEL}, \
+        .row = {                                                                    \
+            ALLIED_BIN_ROW_TABLE(8, LEVEL),                                         \
+            ALLIED_BIN_ROW_TABLE(16, LEVEL),                                        \
+            ALLIED_BIN_ROW_TABLE(32, LEVEL),                                        \
+        },                                                                          \
+        .decimate = {                                                               \
+            ALLIED_DECIMATE_ROW_TABLE(8, LEVEL),                                    \
+            ALLIED_DECIMATE_ROW_TABLE(16, LEVEL),                                   \
+        },                                                                          \
+    };
+
+ALLIED_KERNEL_LEVELS(ALLIED_BIN_LEVEL)
+
+static const AlliedBinKernels_s *bin_kernels = &bin_scalar;
+
+ALLIED_KERNEL_BINDER(allied_bin_bind, bin_kernels, &bin)
+
+typedef struct
+{
+    AlliedBinColumnsKernel columns;          // Column sums, NULL to decimate.
+    AlliedBinRowKernel row;                  // Bin sums to pixels.
+    AlliedDecimateRowKernel decimate;        // Decimation of a row, NULL to copy rows.
+    AlliedBinScale_s scale;                  // Conversion of the bin sums.
+    const VmbUchar_t *src;                   // First source row.
+    size_t src_stride;                       // Bytes between source rows.
+    VmbUchar_t *dst;                         // First destination row.
+    size_t dst_stride;                       // Bytes between destination rows.
+    size_t pixel_size;                       // Bytes per source pixel.
+    VmbUint32_t width;                       // Output width in pixels.
+    VmbUint32_t height;                      // Output height in pixels.
+    VmbUint32_t step_x;                      // Bin width, or horizontal step.
+    VmbUint32_t step_y;                      // Bin height, or vertical step.
+    VmbError_t err[ALLIED_POOL_MAX_THREADS]; // Result of every task.
+} AlliedBinJob_s;
+
+static void allied_bin_task(void *arg, VmbUint32_t index, VmbUint32_t count)
+{
+    AlliedBinJob_s *job = (AlliedBinJob_s *)arg;
+    VmbUint32_t first = (VmbUint32_t)((VmbUint64_t)job->height * index / count);
+    VmbUint32_t last = (VmbUint32_t)((VmbUint64_t)job->height * (index + 1) / count);
+    VmbUint32_t *acc = NULL;
+    if (job->columns != NULL)
+    {
+        acc = (VmbUint32_t *)malloc(sizeof(VmbUint32_t) * job->width * job->step_x);
+        if (acc == NULL)
+        {
+            job->err[index] = VmbErrorResources;
+            return;
+        }
+    }
+    for (VmbUint32_t y = first; y < last; y++)
+    {
+        const VmbUchar_t *src = job->src + (size_t)y * job->step_y * job->src_stride;
+        VmbUchar_t *dst = job->dst + (size_t)y * job->dst_stride;
+        if (job->columns != NULL)
+        {
+            job->columns(src, job->src_stride, job->step_y, job->width * job->step_x, acc);
+            job->row(acc, job->width, job->step_x, &(job->scale), dst);
+        }
+        else if (job->decimate != NULL)
+        {
+            job->decimate(src, job->width, job->step_x, dst);
+        }
+        else
+        {
+            memcpy(dst, src, job->width * job->pixel_size);
+        }
+    }
+    free(acc);
+    job->err[index] = VmbErrorSuccess;
+}
+
+/**
+ * @brief Run a binning or decimation job on up to `threads` threads.
+ *
+ */
+static VmbError_t allied_bin_run(AlliedBinJob_s *job, VmbUint32_t threads)
+{
+    if (job->width == 0 || job->height == 0)
+    {
+        return VmbErrorSuccess;
+    }
+    VmbUint32_t tasks = 1;
+    if (threads > 1)
+    {
+        tasks = allied_pool_threads(threads);
+        tasks = job->height < tasks ? job->height : tasks;
+    }
+    allied_pool_run(tasks, &allied_bin_task, job);
+    for (VmbUint32_t i = 0; i < tasks; i++)
+    {
+        if (job->err[i] != VmbErrorSuccess)
+        {
+            return job->err[i];
+        }
+    }
+    return VmbErrorSuccess;
+}
+
+/**
+ * @brief Validate a monochrome source image, and fill the source of a job.
+ *
+ */
+static VmbError_t allied_bin_source(const AlliedImage_t *src, const AlliedImageKernels_s **kernels, AlliedBinJob_s *job)
+{
+    allied_dispatch_init();
+    *kernels = allied_image_kernels(src->format);
+    if (*kernels == NULL || (*kernels)->bayer)
+    {
+        return VmbErrorNotSupported;
+    }
+    size_t row = (size_t)src->width * (*kernels)->pixel_size;
+    job->src_stride = src->stride == 0 ? row : src->stride;
+    if (src->data == NULL || job->src_stride < row)
+    {
+        return VmbErrorBadParameter;
+    }
+    job->src = (const VmbUchar_t *)src->data;
+    job->pixel_size = (*kernels)->pixel_size;
+    return VmbErrorSuccess;
+}
+
+/**
+ * @brief Set up the binning part of a job.
+ *
+ */
+static VmbError_t allied_bin_setup(const AlliedImage_t *src, const AlliedBinOptions_t *opts, AlliedBinJob_s *job, const AlliedImageKernels_s **kernels)
+{
+    VmbError_t err = allied_bin_source(src, kernels, job);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    if (opts->bin_x == 0 || opts->bin_y == 0 || (VmbUint64_t)opts->bin_x * opts->bin_y > ALLIED_BIN_MAX_PIXELS)
+    {
+        return VmbErrorBadParameter;
+    }
+    job->columns = bin_kernels->columns[(*kernels)->pixel_size == 1 ? 0 : 1];
+    job->step_x = opts->bin_x;
+    job->step_y = opts->bin_y;
+    job->width = src->width / opts->bin_x;
+    job->height = src->height / opts->bin_y;
+    job->scale.count = opts->bin_x * opts->bin_y;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_bin(const AlliedImage_t *src, const AlliedBinOptions_t *opts, AlliedImage_t *dst)
+{
+    assert(src);
+    assert(opts);
+    assert(dst);
+    AlliedBinJob_s job = {0};
+    const AlliedImageKernels_s *kernels;
+    VmbError_t err = allied_bin_setup(src, opts, &job, &kernels);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    if (opts->mode > AlliedBinMean || opts->depth > AlliedBinWiden16)
+    {
+        return VmbErrorBadParameter;
+    }
+    bool wide = opts->depth == AlliedBinWiden16;
+    size_t out_size = wide ? 2 : kernels->pixel_size;
+    size_t row = (size_t)job.width * out_size;
+    job.dst_stride = dst->stride == 0 ? row : dst->stride;
+    if (dst->data == NULL || job.dst_stride < row)
+    {
+        return VmbErrorBadParameter;
+    }
+    job.dst = (VmbUchar_t *)dst->data;
+    job.row = bin_kernels->row[out_size == 1 ? 0 : 1][ALLIED_BIN_WIDTH_SLOT(opts->bin_x)];
+    VmbUint32_t maxval = (1u << kernels->bits) - 1;
+    if (opts->mode == AlliedBinSum)
+    {
+        job.scale.kind = AlliedBinScaleSum;
+        job.scale.clamp = wide ? 0xffff : maxval;
+    }
+    else if ((job.scale.count & (job.scale.count - 1)) == 0)
+    {
+        job.scale.kind = AlliedBinScaleShift;
+        while ((1u << job.scale.shift) < job.scale.count)
+        {
+            job.scale.shift++;
+        }
+    }
+    else if ((VmbUint64_t)maxval * job.scale.count < (1u << 24))
+    {
+        job.scale.kind = AlliedBinScaleFloat;
+        job.scale.inv = 1.0f / job.scale.count;
+    }
+    else
+    {
+        job.scale.kind = AlliedBinScaleDivide;
+    }
+    err = allied_bin_run(&job, opts->threads);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    dst->width = job.width;
+    dst->height = job.height;
+    dst->format = wide ? VmbPixelFormatMono16 : src->format;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_bin_sum32(const AlliedImage_t *src, const AlliedBinOptions_t *opts, VmbUint32_t *dst, size_t dst_stride)
+{
+    assert(src);
+    assert(opts);
+    assert(dst);
+    AlliedBinJob_s job = {0};
+    const AlliedImageKernels_s *kernels;
+    VmbError_t err = allied_bin_setup(src, opts, &job, &kernels);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    dst_stride = dst_stride == 0 ? job.width : dst_stride;
+    if (dst_stride < job.width)
+    {
+        return VmbErrorBadParameter;
+    }
+    job.dst = (VmbUchar_t *)dst;
+    job.dst_stride = dst_stride * sizeof(VmbUint32_t);
+    job.row = bin_kernels->row[2][ALLIED_BIN_WIDTH_SLOT(opts->bin_x)];
+    job.scale.kind = AlliedBinScaleSum;
+    job.scale.clamp = 0xffffffffu;
+    return allied_bin_run(&job, opts->threads);
+}
+
+VmbError_t allied_decimate(const AlliedImage_t *src, VmbUint32_t step_x, VmbUint32_t step_y, VmbUint32_t threads, AlliedImage_t *dst)
+{
+    assert(src);
+    assert(dst);
+    AlliedBinJob_s job = {0};
+    const AlliedImageKernels_s *kernels;
+    VmbError_t err = allied_bin_source(src, &kernels, &job);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    if (step_x == 0 || step_y == 0)
+    {
+        return VmbErrorBadParameter;
+    }
+    job.step_x = step_x;
+    job.step_y = step_y;
+    job.width = (src->width + step_x - 1) / step_x;
+    job.height = (src->height + step_y - 1) / step_y;
+    size_t row = (size_t)job.width * kernels->pixel_size;
+    job.dst_stride = dst->stride == 0 ? row : dst->stride;
+    if (dst->data == NULL || job.dst_stride < row)
+    {
+        return VmbErrorBadParameter;
+    }
+    job.dst = (VmbUchar_t *)dst->data;
+    job.decimate = bin_kernels->decimate[kernels->pixel_size == 1 ? 0 : 1][ALLIED_BIN_WIDTH_SLOT(step_x)];
+    err = allied_bin_run(&job, threads);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    dst->width = job.width;
+    dst->height = job.height;
+    dst->format = src->format;
+    return VmbErrorSuccess;
+}
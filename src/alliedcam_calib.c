@@ -0,0 +1,847 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_calib.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Dark, bias and flat-field calibration for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details Master frames are averaged by adding every frame to 32-bit sums with the accumulation kernel of the image table, and
+ * folding the sums into doubles before they can overflow. The correction is one fused kernel per row, instantiated for the source
+ * container, the map storage, the presence of a flat and the output type, and once per CPU level. The kernels convert to float,
+ * subtract, multiply and convert back in one pass, so a frame is read once and written once. This file is built with -O3
+ * (see the Makefile).
+ */
+
+#include "alliedcam_calib.h"
+#include "alliedcam_kernels.h"
+#include "alliedcam_dispatch.h"
+#include "alliedcam_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <sys/types.h>
+
+/**
+ * @brief Scale of the gains in fixed point maps.
+ *
+ */
+#define ALLIED_CALIB_GAIN_ONE 16384
+
+/**
+ * @brief Largest gain of fixed point maps.
+ *
+ */
+#define ALLIED_CALIB_GAIN_MAX (65535.0f / ALLIED_CALIB_GAIN_ONE)
+
+/**
+ * @brief Magic and version of master frame files.
+ *
+ */
+#define ALLIED_MASTER_MAGIC "ALLIEDMF"
+#define ALLIED_MASTER_VERSION 1
+
+struct allied_master_builder_s
+{
+    AlliedMasterKind_t kind;        // Kind of the master.
+    AlliedCalibGeometry_t geometry; // Geometry of the frames.
+    bool bayer;                     // Bayer color filter frames.
+    VmbUint32_t *sum;               // Sums of the frames since the last fold.
+    double *total;                  // Folded sums, NULL until the first fold.
+    VmbUint32_t pending;            // Frames in `sum`.
+    VmbUint32_t limit;              // Frames that `sum` holds without overflow.
+    VmbUint32_t frames;             // Frames added.
+};
+
+/**
+ * @brief Constants of the correction kernels.
+ *
+ */
+typedef struct
+{
+    float offset_scale; // Offset map value to ADU.
+    float gain_scale;   // Gain map value to gain.
+    float pedestal;     // Added to every pixel.
+    float out_scale;    // ADU to 16-bit output value, 2^(16 - bits).
+} AlliedCalibScale_s;
+
+struct allied_calib_s
+{
+    AlliedCalibGeometry_t geometry; // Geometry of the masters.
+    AlliedCalibOutput_t output;     // Pixel type of calibrated images.
+    VmbPixelFormat_t out_format;    // Format of calibrated images.
+    bool fixed;                     // Maps are in 16-bit fixed point.
+    void *offset;                   // Offset map, packed rows.
+    void *gain;                     // Gain map, packed rows. NULL without a flat.
+    AlliedCalibScale_s scale;       // Constants of the kernels.
+    VmbUint32_t threads;            // Maximum number of threads.
+};
+
+typedef void (*AlliedCalibRowKernel)(const void *src, const void *offset, const void *gain, const AlliedCalibScale_s *scale, VmbUint32_t width, void *dst);
+
+/**
+ * @brief Calibration kernels of a CPU level.
+ *
+ */
+typedef struct
+{
+    AlliedCalibRowKernel row[2][2][2][2]; // By source container (8, 16 bits), map storage (fixed, float), flat (without, with) and output (16 bits, float).
+} AlliedCalibKernels_s;
+
+#define ALLIED_CALIB_CLAMP_16(v) ((VmbUint16_t)((v) < 0.0f ? 0.0f : ((v) > 65535.0f ? 65535.0f : (v) + 0.5f)))
+#define ALLIED_CALIB_STORE_16(v, k) ALLIED_CALIB_CLAMP_16((v) * (k))
+#define ALLIED_CALIB_STORE_f(v, k) (v)
+
+/**
+ * @brief Instantiate the correction of a row.
+ *
+ * @param NAME Suffix of the kernel name.
+ * @param TARGET Target attribute of the CPU level, or nothing.
+ * @param TS Source container type.
+ * @param TM Map type.
+ * @param TD Output type.
+ * @param OUT `16` or `f`, selects the conversion to the output type.
+ * @param FLAT 1 to multiply by the gain map.
+ */
+#define ALLIED_CALIB_ROW(NAME, TARGET, TS, TM, TD, OUT, FLAT)                                                 \
+    TARGET static void allied_calib_row_##NAME(const void *src, const void *offset, const void *gain,         \
+                                               const AlliedCalibScale_s *scale, VmbUint32_t width, void *dst) \
+    {                                                                                                         \
+        const TS *restrict s = (const TS *)src;                                                               \
+        const TM *restrict o = (const TM *)offset;                                                            \
+        const TM *restrict g = (const TM *)gain;                                                              \
+        TD *restrict d = (TD *)dst;                                                                           \
+        const float os = scale->offset_scale, gs = scale->gain_scale, ped = scale->pedestal;                  \
+        for (size_t x = 0; x < width; x++)                                                                    \
+        {                                                                                                     \
+            float v = (float)s[x] - (float)o[x] * os;                                                         \
+            if (FLAT)                                                                                         \
+            {                                                                                                 \
+                v *= (float)g[x] * gs;                                                                        \
+            }                                                                                                 \
+            v += ped;                                                                                         \
+            d[x] = ALLIED_CALIB_STORE_##OUT(v, scale->out_scale);                                             \
+        }                                                                                                     \
+    }
+
+#define ALLIED_CALIB_ROWS(LEVEL, TARGET, SN, TS, MN, TM)                           \
+    ALLIED_CALIB_ROW(SN##_##MN##_0_16_##LEVEL, TARGET, TS, TM, VmbUint16_t, 16, 0) \
+    ALLIED_CALIB_ROW(SN##_##MN##_1_16_##LEVEL, TARGET, TS, TM, VmbUint16_t, 16, 1) \
+    ALLIED_CALIB_ROW(SN##_##MN##_0_f_##LEVEL, TARGET, TS, TM, float, f, 0)         \
+    ALLIED_CALIB_ROW(SN##_##MN##_1_f_##LEVEL, TARGET, TS, TM, float, f, 1)
+
+#define ALLIED_CALIB_ROW_TABLE(SN, MN, LEVEL)                                                        \
+    {                                                                                                \
+        {&allied_calib_row_##SN##_##MN##_0_16_##LEVEL, &allied_calib_row_##SN##_##MN##_0_f_##LEVEL}, \
+        {&allied_calib_row_##SN##_##MN##_1_16_##LEVEL, &allied_calib_row_##SN##_##MN##_1_f_##LEVEL}, \
+    }
+
+#define ALLIED_CALIB_LEVEL(LEVEL, TARGET)                                                         \
+    ALLIED_CALIB_ROWS(LEVEL, TARGET, 8, VmbUint8_t, fixed, VmbUint16_t)                           \
+    ALLIED_CALIB_ROWS(LEVEL, TARGET, 8, VmbUint8_t, float, float)                                 \
+    ALLIED_CALIB_ROWS(LEVEL, TARGET, 16, VmbUint16_t, fixed, VmbUint16_t)                         \
+    ALLIED_CALIB_ROWS(LEVEL, TARGET, 16, VmbUint16_t, float, float)                               \
+    static const AlliedCalibKernels_s calib_##LEVEL = {                                           \
+        .row = {                                                                                  \
+            {ALLIED_CALIB_ROW_TABLE(8, fixed, LEVEL), ALLIED_CALIB_ROW_TABLE(8, float, LEVEL)},   \
+            {ALLIED_CALIB_ROW_TABLE(16, fixed, LEVEL), ALLIED_CALIB_ROW_TABLE(16, float, LEVEL)}, \
+        },                                                                                        \
+    };
+
+ALLIED_KERNEL_LEVELS(ALLIED_CALIB_LEVEL)
+
+static const AlliedCalibKernels_s *calib_kernels = &calib_scalar;
+
+ALLIED_KERNEL_BINDER(allied_calib_bind, calib_kernels, &calib)
+
+static bool allied_calib_same_geometry(const AlliedCalibGeometry_t *a, const AlliedCalibGeometry_t *b)
+{
+    return a->offset_x == b->offset_x && a->offset_y == b->offset_y && a->width == b->width && a->height == b->height &&
+           a->binning == b->binning && a->format == b->format;
+}
+
+static size_t allied_calib_pixels(const AlliedCalibGeometry_t *geometry)
+{
+    return (size_t)geometry->width * geometry->height;
+}
+
+/**
+ * @brief 16-bit format with the color filter pattern of a format.
+ *
+ */
+static VmbPixelFormat_t allied_calib_format16(VmbPixelFormat_t format)
+{
+    switch (format)
+    {
+    case VmbPixelFormatBayerGR8:
+    case VmbPixelFormatBayerGR10:
+    case VmbPixelFormatBayerGR12:
+    case VmbPixelFormatBayerGR16:
+        return VmbPixelFormatBayerGR16;
+    case VmbPixelFormatBayerRG8:
+    case VmbPixelFormatBayerRG10:
+    case VmbPixelFormatBayerRG12:
+    case VmbPixelFormatBayerRG16:
+        return VmbPixelFormatBayerRG16;
+    case VmbPixelFormatBayerGB8:
+    case VmbPixelFormatBayerGB10:
+    case VmbPixelFormatBayerGB12:
+    case VmbPixelFormatBayerGB16:
+        return VmbPixelFormatBayerGB16;
+    case VmbPixelFormatBayerBG8:
+    case VmbPixelFormatBayerBG10:
+    case VmbPixelFormatBayerBG12:
+    case VmbPixelFormatBayerBG16:
+        return VmbPixelFormatBayerBG16;
+    default:
+        return VmbPixelFormatMono16;
+    }
+}
+
+VmbError_t allied_master_builder_create(AlliedMasterBuilder_t *builder, AlliedMasterKind_t kind, const AlliedCalibGeometry_t *geometry)
+{
+    assert(builder);
+    assert(geometry);
+    *builder = NULL;
+    if (kind > AlliedMasterFlat || geometry->width == 0 || geometry->height == 0)
+    {
+        return VmbErrorBadParameter;
+    }
+    const AlliedImageKernels_s *kernels = allied_image_kernels(geometry->format);
+    if (kernels == NULL)
+    {
+        return VmbErrorNotSupported;
+    }
+    struct allied_master_builder_s *b = (struct allied_master_builder_s *)calloc(1, sizeof(struct allied_master_builder_s));
+    if (b == NULL)
+    {
+        return VmbErrorResources;
+    }
+    b->sum = (VmbUint32_t *)calloc(allied_calib_pixels(geometry), sizeof(VmbUint32_t));
+    if (b->sum == NULL)
+    {
+        free(b);
+        return VmbErrorResources;
+    }
+    b->kind = kind;
+    b->geometry = *geometry;
+    b->bayer = kernels->bayer;
+    b->limit = 0xffffffffu / ((1u << kernels->bits) - 1);
+    *builder = b;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_master_builder_destroy(AlliedMasterBuilder_t *builder)
+{
+    assert(builder);
+    if (*builder == NULL)
+    {
+        return VmbErrorSuccess;
+    }
+    free((*builder)->sum);
+    free((*builder)->total);
+    free(*builder);
+    *builder = NULL;
+    return VmbErrorSuccess;
+}
+
+/**
+ * @brief Fold the 32-bit sums of a builder into the double totals.
+ *
+ */
+static VmbError_t allied_master_fold(struct allied_master_builder_s *b)
+{
+    size_t count = allied_calib_pixels(&(b->geometry));
+    if (b->total == NULL)
+    {
+        b->total = (double *)calloc(count, sizeof(double));
+        if (b->total == NULL)
+        {
+            return VmbErrorResources;
+        }
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        b->total[i] += b->sum[i];
+    }
+    memset(b->sum, 0, count * sizeof(VmbUint32_t));
+    b->pending = 0;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_master_builder_add(AlliedMasterBuilder_t builder, const AlliedImage_t *image)
+{
+    assert(builder);
+    assert(image);
+    if (image->width != builder->geometry.width || image->height != builder->geometry.height || image->format != builder->geometry.format)
+    {
+        return VmbErrorBadParameter;
+    }
+    if (builder->pending == builder->limit)
+    {
+        VmbError_t err = allied_master_fold(builder);
+        if (err != VmbErrorSuccess)
+        {
+            return err;
+        }
+    }
+    VmbError_t err = allied_image_accumulate(image, builder->sum, 0);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    builder->pending++;
+    builder->frames++;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_master_builder_add_frame(AlliedMasterBuilder_t builder, const VmbFrame_t *frame)
+{
+    assert(builder);
+    assert(frame);
+    if (frame->offsetX != builder->geometry.offset_x || frame->offsetY != builder->geometry.offset_y)
+    {
+        return VmbErrorBadParameter;
+    }
+    AlliedImage_t image;
+    VmbError_t err = allied_image_from_frame(frame, &image);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    return allied_master_builder_add(builder, &image);
+}
+
+/**
+ * @brief Normalize a flat to a mean of 1, separately for every color of a Bayer pattern.
+ *
+ */
+static VmbError_t allied_master_normalize(float *data, const AlliedCalibGeometry_t *geometry, bool bayer)
+{
+    double sum[4] = {0};
+    size_t count[4] = {0};
+    for (VmbUint32_t y = 0; y < geometry->height; y++)
+    {
+        const float *row = data + (size_t)y * geometry->width;
+        for (VmbUint32_t x = 0; x < geometry->width; x++)
+        {
+            VmbUint32_t phase = bayer ? ((y & 1) << 1) | (x & 1) : 0;
+            sum[phase] += row[x];
+            count[phase]++;
+        }
+    }
+    float inv[4];
+    for (VmbUint32_t p = 0; p < 4; p++)
+    {
+        if (count[p] != 0 && !(sum[p] > 0))
+        {
+            return VmbErrorInvalidValue;
+        }
+        inv[p] = count[p] == 0 ? 1.0f : (float)(count[p] / sum[p]);
+    }
+    for (VmbUint32_t y = 0; y < geometry->height; y++)
+    {
+        float *row = data + (size_t)y * geometry->width;
+        for (VmbUint32_t x = 0; x < geometry->width; x++)
+        {
+            row[x] *= inv[bayer ? ((y & 1) << 1) | (x & 1) : 0];
+        }
+    }
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_master_builder_finish(AlliedMasterBuilder_t builder, const AlliedMaster_t *offset, AlliedMaster_t *master)
+{
+    assert(builder);
+    assert(master);
+    if (builder->frames == 0)
+    {
+        return VmbErrorInvalidCall;
+    }
+    bool flat = builder->kind == AlliedMasterFlat;
+    if (flat && offset != NULL && (offset->data == NULL || offset->kind == AlliedMasterFlat || !allied_calib_same_geometry(&(offset->geometry), &(builder->geometry))))
+    {
+        return VmbErrorBadParameter;
+    }
+    size_t count = allied_calib_pixels(&(builder->geometry));
+    float *data = (float *)malloc(count * sizeof(float));
+    if (data == NULL)
+    {
+        return VmbErrorResources;
+    }
+    double inv = 1.0 / builder->frames;
+    for (size_t i = 0; i < count; i++)
+    {
+        double total = builder->total == NULL ? 0 : builder->total[i];
+        data[i] = (float)((total + builder->sum[i]) * inv);
+    }
+    if (flat)
+    {
+        if (offset != NULL)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                data[i] -= offset->data[i];
+            }
+        }
+        VmbError_t err = allied_master_normalize(data, &(builder->geometry), builder->bayer);
+        if (err != VmbErrorSuccess)
+        {
+            free(data);
+            return err;
+        }
+    }
+    memset(master, 0, sizeof(*master));
+    master->kind = builder->kind;
+    master->geometry = builder->geometry;
+    master->frames = builder->frames;
+    master->data = data;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_master_capture(AlliedCameraHandle_t handle, AlliedMasterKind_t kind, VmbUint32_t frames, const AlliedMaster_t *offset, int timeout_ms, AlliedMaster_t *master)
+{
+    assert(handle);
+    assert(master);
+    if (frames == 0)
+    {
+        return VmbErrorBadParameter;
+    }
+    AlliedCalibGeometry_t geometry;
+    VmbError_t err = allied_calib_geometry(handle, &geometry);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    double exposure = 0, gain = 0, temp_start = NAN, temp_end = NAN;
+    allied_get_exposure_us(handle, &exposure);
+    allied_get_gain(handle, &gain);
+    if (allied_get_temperature(handle, &temp_start) != VmbErrorSuccess)
+    {
+        temp_start = NAN;
+    }
+    AlliedMasterBuilder_t builder;
+    err = allied_master_builder_create(&builder, kind, &geometry);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    AlliedSubscription_t config = {.queue_depth = 4, .policy = AlliedBackpressureDropNewest};
+    AlliedSubscriber_t sub;
+    err = allied_subscribe(handle, &config, &sub);
+    if (err != VmbErrorSuccess)
+    {
+        allied_master_builder_destroy(&builder);
+        return err;
+    }
+    for (VmbUint32_t i = 0; i < frames && err == VmbErrorSuccess; i++)
+    {
+        AlliedFrameView_t view;
+        err = allied_subscriber_pop(sub, &view, timeout_ms);
+        if (err != VmbErrorSuccess)
+        {
+            break;
+        }
+        err = allied_master_builder_add_frame(builder, view.frame);
+        allied_frame_release(view.frame);
+    }
+    allied_unsubscribe(&sub);
+    if (err == VmbErrorSuccess)
+    {
+        err = allied_master_builder_finish(builder, offset, master);
+    }
+    allied_master_builder_destroy(&builder);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    if (allied_get_temperature(handle, &temp_end) != VmbErrorSuccess)
+    {
+        temp_end = temp_start;
+    }
+    master->exposure_us = exposure;
+    master->gain_db = gain;
+    master->temperature = isnan(temp_start) ? temp_end : 0.5 * (temp_start + temp_end);
+    return VmbErrorSuccess;
+}
+
+void allied_master_free(AlliedMaster_t *master)
+{
+    assert(master);
+    free(master->data);
+    memset(master, 0, sizeof(*master));
+}
+
+/**
+ * @brief Header of a master frame file, followed by `width * height` floats.
+ *
+ */
+typedef struct
+{
+    char magic[8];         // ALLIED_MASTER_MAGIC
+    VmbUint32_t version;   // ALLIED_MASTER_VERSION
+    VmbUint32_t kind;      // AlliedMasterKind_t
+    VmbUint32_t offset_x;  // Geometry.
+    VmbUint32_t offset_y;  // Geometry.
+    VmbUint32_t width;     // Geometry.
+    VmbUint32_t height;    // Geometry.
+    VmbUint32_t binning;   // Geometry.
+    VmbUint32_t format;    // Geometry.
+    VmbUint32_t frames;    // Number of frames averaged.
+    VmbUint32_t reserved;  // Zero.
+    double exposure_us;    // Exposure time.
+    double gain_db;        // Gain.
+    double temperature;    // Sensor temperature.
+} AlliedMasterFile_s;
+
+VmbError_t allied_master_save(const AlliedMaster_t *master, const char *path)
+{
+    assert(master);
+    assert(path);
+    if (master->data == NULL)
+    {
+        return VmbErrorBadParameter;
+    }
+    AlliedMasterFile_s header = {
+        .version = ALLIED_MASTER_VERSION,
+        .kind = master->kind,
+        .offset_x = master->geometry.offset_x,
+        .offset_y = master->geometry.offset_y,
+        .width = master->geometry.width,
+        .height = master->geometry.height,
+        .binning = master->geometry.binning,
+        .format = master->geometry.format,
+        .frames = master->frames,
+        .exposure_us = master->exposure_us,
+        .gain_db = master->gain_db,
+        .temperature = master->temperature,
+    };
+    memcpy(header.magic, ALLIED_MASTER_MAGIC, sizeof(header.magic));
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL)
+    {
+        return VmbErrorIO;
+    }
+    size_t count = allied_calib_pixels(&(master->geometry));
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 && fwrite(master->data, sizeof(float), count, fp) == count;
+    ok = fclose(fp) == 0 && ok;
+    return ok ? VmbErrorSuccess : VmbErrorIO;
+}
+
+VmbError_t allied_master_load(const char *path, AlliedMaster_t *master)
+{
+    assert(path);
+    assert(master);
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+    {
+        return VmbErrorIO;
+    }
+    AlliedMasterFile_s header;
+    if (fread(&header, sizeof(header), 1, fp) != 1)
+    {
+        fclose(fp);
+        return VmbErrorIO;
+    }
+    if (memcmp(header.magic, ALLIED_MASTER_MAGIC, sizeof(header.magic)) != 0 || header.version != ALLIED_MASTER_VERSION ||
+        header.kind > AlliedMasterFlat || header.width == 0 || header.height == 0)
+    {
+        fclose(fp);
+        return VmbErrorInvalidValue;
+    }
+    // the size of the file must match the header, before the header sizes an allocation
+    off_t end = -1;
+    if (fseeko(fp, 0, SEEK_END) == 0)
+    {
+        end = ftello(fp);
+    }
+    if (end < 0 || fseeko(fp, (off_t)sizeof(header), SEEK_SET) != 0)
+    {
+        fclose(fp);
+        return VmbErrorIO;
+    }
+    if ((VmbUint64_t)end != sizeof(header) + (VmbUint64_t)header.width * header.height * sizeof(float))
+    {
+        fclose(fp);
+        return VmbErrorInvalidValue;
+    }
+    AlliedMaster_t m = {
+        .kind = (AlliedMasterKind_t)header.kind,
+        .geometry = {header.offset_x, header.offset_y, header.width, header.height, header.binning, header.format},
+        .exposure_us = header.exposure_us,
+        .gain_db = header.gain_db,
+        .temperature = header.temperature,
+        .frames = header.frames,
+    };
+    size_t count = allied_calib_pixels(&(m.geometry));
+    m.data = (float *)malloc(count * sizeof(float));
+    if (m.data == NULL)
+    {
+        fclose(fp);
+        return VmbErrorResources;
+    }
+    if (fread(m.data, sizeof(float), count, fp) != count)
+    {
+        free(m.data);
+        fclose(fp);
+        return VmbErrorIO;
+    }
+    fclose(fp);
+    *master = m;
+    return VmbErrorSuccess;
+}
+
+/**
+ * @brief Check that a master of a calibration is of the right kind and geometry, and take its geometry if it is the first one.
+ *
+ */
+static bool allied_calib_check_master(const AlliedMaster_t *master, AlliedMasterKind_t kind, const AlliedCalibGeometry_t **geometry)
+{
+    if (master == NULL)
+    {
+        return true;
+    }
+    if (master->kind != kind || master->data == NULL)
+    {
+        return false;
+    }
+    if (*geometry == NULL)
+    {
+        *geometry = &(master->geometry);
+        return true;
+    }
+    return allied_calib_same_geometry(*geometry, &(master->geometry));
+}
+
+VmbError_t allied_calib_create(AlliedCalibration_t *calib, const AlliedCalibConfig_t *config)
+{
+    assert(calib);
+    assert(config);
+    *calib = NULL;
+    const AlliedCalibGeometry_t *geometry = NULL;
+    if (!allied_calib_check_master(config->bias, AlliedMasterBias, &geometry) ||
+        !allied_calib_check_master(config->dark, AlliedMasterDark, &geometry) ||
+        !allied_calib_check_master(config->flat, AlliedMasterFlat, &geometry) || geometry == NULL)
+    {
+        return VmbErrorBadParameter;
+    }
+    if (config->output > AlliedCalibOutputFloat || config->maps > AlliedCalibMapsFloat || !(config->exposure_us >= 0) || !isfinite(config->pedestal))
+    {
+        return VmbErrorBadParameter;
+    }
+    // the dark current is scaled from the dark exposure time to the frame exposure time
+    const AlliedMaster_t *bias = config->bias, *dark = config->dark;
+    double dark_scale = 1;
+    if (dark != NULL && config->exposure_us > 0 && config->exposure_us != dark->exposure_us)
+    {
+        if (bias == NULL || !(dark->exposure_us > 0))
+        {
+            return VmbErrorBadParameter;
+        }
+        dark_scale = config->exposure_us / dark->exposure_us;
+    }
+    allied_dispatch_init();
+    const AlliedImageKernels_s *kernels = allied_image_kernels(geometry->format);
+    if (kernels == NULL)
+    {
+        return VmbErrorNotSupported;
+    }
+    size_t count = allied_calib_pixels(geometry);
+    bool fixed = config->maps == AlliedCalibMapsFixed || (config->maps == AlliedCalibMapsAuto && kernels->bits <= 12);
+    if (fixed && config->flat != NULL)
+    {
+        // fixed point gains saturate at 4, flats that fall off further need float maps
+        float gain_max = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            float gain = config->flat->data[i] >= (float)ALLIED_CALIB_FLAT_MIN ? 1.0f / config->flat->data[i] : 1.0f;
+            gain_max = gain > gain_max ? gain : gain_max;
+        }
+        if (gain_max > ALLIED_CALIB_GAIN_MAX && config->maps == AlliedCalibMapsFixed)
+        {
+            return VmbErrorBadParameter;
+        }
+        fixed = gain_max <= ALLIED_CALIB_GAIN_MAX;
+    }
+    struct allied_calib_s *c = (struct allied_calib_s *)calloc(1, sizeof(struct allied_calib_s));
+    if (c == NULL)
+    {
+        return VmbErrorResources;
+    }
+    c->geometry = *geometry;
+    c->output = config->output;
+    c->out_format = config->output == AlliedCalibOutput16 ? allied_calib_format16(geometry->format) : geometry->format;
+    c->fixed = fixed;
+    c->threads = config->threads;
+    c->scale.pedestal = config->pedestal;
+    // 16-bit outputs span the full scale, whatever the bit depth
+    c->scale.out_scale = (float)(1u << (16 - kernels->bits));
+    size_t map_size = count * (c->fixed ? sizeof(VmbUint16_t) : sizeof(float));
+    c->offset = malloc(map_size);
+    if (config->flat != NULL)
+    {
+        c->gain = malloc(map_size);
+    }
+    if (c->offset == NULL || (config->flat != NULL && c->gain == NULL))
+    {
+        allied_calib_destroy(&c);
+        return VmbErrorResources;
+    }
+    // fixed point offsets keep 16 bits of precision, whatever the bit depth
+    float offset_one = (float)(1u << (16 - kernels->bits));
+    c->scale.offset_scale = c->fixed ? 1.0f / offset_one : 1.0f;
+    c->scale.gain_scale = c->fixed ? 1.0f / ALLIED_CALIB_GAIN_ONE : 1.0f;
+    for (size_t i = 0; i < count; i++)
+    {
+        float offset = 0;
+        if (dark != NULL && bias != NULL)
+        {
+            offset = bias->data[i] + (float)((dark->data[i] - bias->data[i]) * dark_scale);
+        }
+        else if (dark != NULL)
+        {
+            offset = dark->data[i];
+        }
+        else if (bias != NULL)
+        {
+            offset = bias->data[i];
+        }
+        if (c->fixed)
+        {
+            float v = offset * offset_one + 0.5f;
+            ((VmbUint16_t *)c->offset)[i] = (VmbUint16_t)(v < 0.0f ? 0.0f : (v > 65535.0f ? 65535.0f : v));
+        }
+        else
+        {
+            ((float *)c->offset)[i] = offset;
+        }
+    }
+    if (config->flat != NULL)
+    {
+        const float *flat = config->flat->data;
+        for (size_t i = 0; i < count; i++)
+        {
+            float gain = flat[i] >= (float)ALLIED_CALIB_FLAT_MIN ? 1.0f / flat[i] : 1.0f;
+            if (c->fixed)
+            {
+                float v = gain * ALLIED_CALIB_GAIN_ONE + 0.5f;
+                ((VmbUint16_t *)c->gain)[i] = (VmbUint16_t)(v > 65535.0f ? 65535.0f : v);
+            }
+            else
+            {
+                ((float *)c->gain)[i] = gain;
+            }
+        }
+    }
+    *calib = c;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_calib_destroy(AlliedCalibration_t *calib)
+{
+    assert(calib);
+    if (*calib == NULL)
+    {
+        return VmbErrorSuccess;
+    }
+    free((*calib)->offset);
+    free((*calib)->gain);
+    free(*calib);
+    *calib = NULL;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_calib_get_geometry(AlliedCalibration_t calib, AlliedCalibGeometry_t *geometry)
+{
+    assert(calib);
+    assert(geometry);
+    *geometry = calib->geometry;
+    return VmbErrorSuccess;
+}
+
+size_t allied_calib_output_size(AlliedCalibration_t calib)
+{
+    assert(calib);
+    return allied_calib_pixels(&(calib->geometry)) * (calib->output == AlliedCalibOutput16 ? sizeof(VmbUint16_t) : sizeof(float));
+}
+
+typedef struct
+{
+    AlliedCalibRowKernel row;           // Correction of a row.
+    const struct allied_calib_s *calib; // Calibration.
+    const VmbUchar_t *src;              // First source row.
+    size_t src_stride;                  // Bytes between source rows.
+    VmbUchar_t *dst;                    // First destination row.
+    size_t dst_stride;                  // Bytes between destination rows.
+    size_t map_stride;                  // Bytes between map rows.
+    VmbUint32_t width;                  // Width in pixels.
+    VmbUint32_t height;                 // Height in pixels.
+} AlliedCalibJob_s;
+
+static void allied_calib_task(void *arg, VmbUint32_t index, VmbUint32_t count)
+{
+    const AlliedCalibJob_s *job = (const AlliedCalibJob_s *)arg;
+    VmbUint32_t first = (VmbUint32_t)((VmbUint64_t)job->height * index / count);
+    VmbUint32_t last = (VmbUint32_t)((VmbUint64_t)job->height * (index + 1) / count);
+    const VmbUchar_t *offset = (const VmbUchar_t *)job->calib->offset;
+    const VmbUchar_t *gain = (const VmbUchar_t *)job->calib->gain;
+    for (VmbUint32_t y = first; y < last; y++)
+    {
+        size_t map = (size_t)y * job->map_stride;
+        job->row(job->src + (size_t)y * job->src_stride, offset + map, gain == NULL ? NULL : gain + map, &(job->calib->scale), job->width,
+                 job->dst + (size_t)y * job->dst_stride);
+    }
+}
+
+VmbError_t allied_calib_apply(AlliedCalibration_t calib, const AlliedImage_t *src, AlliedImage_t *dst)
+{
+    assert(calib);
+    assert(src);
+    assert(dst);
+    if (src->width != calib->geometry.width || src->height != calib->geometry.height || src->format != calib->geometry.format)
+    {
+        return VmbErrorBadParameter;
+    }
+    allied_dispatch_init();
+    const AlliedImageKernels_s *kernels = allied_image_kernels(src->format);
+    if (kernels == NULL)
+    {
+        return VmbErrorNotSupported;
+    }
+    AlliedCalibJob_s job = {
+        .calib = calib,
+        .src = (const VmbUchar_t *)src->data,
+        .dst = (VmbUchar_t *)dst->data,
+        .map_stride = (size_t)src->width * (calib->fixed ? sizeof(VmbUint16_t) : sizeof(float)),
+        .width = src->width,
+        .height = src->height,
+    };
+    size_t src_row = (size_t)src->width * kernels->pixel_size;
+    size_t dst_row = (size_t)src->width * (calib->output == AlliedCalibOutput16 ? sizeof(VmbUint16_t) : sizeof(float));
+    job.src_stride = src->stride == 0 ? src_row : src->stride;
+    job.dst_stride = dst->stride == 0 ? dst_row : dst->stride;
+    if (job.src == NULL || job.dst == NULL || job.src_stride < src_row || job.dst_stride < dst_row)
+    {
+        return VmbErrorBadParameter;
+    }
+    job.row = calib_kernels->row[kernels->pixel_size == 1 ? 0 : 1][calib->fixed ? 0 : 1][calib->gain != NULL][calib->output];
+    VmbUint32_t tasks = 1;
+    if (calib->threads > 1)
+    {
+        tasks = allied_pool_threads(calib->threads);
+        tasks = job.height < tasks ? job.height : tasks;
+    }
+    if (job.height != 0)
+    {
+        allied_pool_run(tasks, &allied_calib_task, &job);
+    }
+    dst->width = src->width;
+    dst->height = src->height;
+    dst->format = calib->out_format;
+    return VmbErrorSuccess;
+}
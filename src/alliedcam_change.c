@@ -0,0 +1,338 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_change.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Change detection and motion-triggered delivery for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details The row kernel reads every `step`-th pixel of a row, takes its difference from the model in fixed point, `(v << 8) - model`,
+ * moves the model by the difference shifted right by `adapt`, and stores one flag per sample, set if the magnitude of the difference is
+ * above the threshold. The step is a template parameter, so that the strided reads become loads and shuffles, and the loop vectorizes in
+ * 32-bit lanes (this file is built with -O3, see the Makefile). The flags of a row are then summed per block; at the default step the
+ * detector reads 1/16 of the pixels of a frame. The stage that gates the subscribers lives with the other frame stages in
+ * alliedcam.c.
+ */
+
+#include "alliedcam_change.h"
+#include "alliedcam_kernels.h"
+#include "alliedcam_dispatch.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+
+/**
+ * @brief Fractional bits of the background model.
+ *
+ */
+#define ALLIED_CHANGE_FRACTION 8
+
+typedef void (*AlliedChangeRowKernel)(const void *row, VmbInt32_t *model, VmbUint8_t *flags, VmbUint32_t count, VmbInt32_t threshold, VmbUint32_t adapt);
+
+/**
+ * @brief Change detection kernels of a CPU level.
+ *
+ */
+typedef struct
+{
+    AlliedChangeRowKernel row[2][4]; // Compares a row to the model and updates it, by source container (8, 16 bits) and step (1, 2, 4, 8).
+} AlliedChangeKernels_s;
+
+/**
+ * @brief Instantiate a change detection row kernel.
+ *
+ * @param NAME Suffix of the kernel name.
+ * @param TARGET Target attribute of the CPU level, or nothing.
+ * @param TS Source container type.
+ * @param STEP Distance between samples, in pixels.
+ */
+#define ALLIED_CHANGE_KERNEL(NAME, TARGET, TS, STEP)                                                                          \
+    TARGET static void allied_change_row_##NAME(const void *row, VmbInt32_t *restrict model, VmbUint8_t *restrict flags,     \
+                                                VmbUint32_t count, VmbInt32_t threshold, VmbUint32_t adapt)                  \
+    {                                                                                                                        \
+        const TS *restrict s = (const TS *)row;                                                                              \
+        for (size_t i = 0; i < count; i++)                                                                                   \
+        {                                                                                                                    \
+            VmbInt32_t d = ((VmbInt32_t)s[i * STEP] << ALLIED_CHANGE_FRACTION) - model[i];                                   \
+            VmbInt32_t a = d < 0 ? -d : d;                                                                                   \
+            model[i] += d >> adapt;                                                                                          \
+            flags[i] = (VmbUint8_t)(a > threshold);                                                                          \
+        }                                                                                                                    \
+    }
+
+#define ALLIED_CHANGE_CONTAINER(SIZE, LEVEL, TARGET, TS)           \
+    ALLIED_CHANGE_KERNEL(SIZE##_1_##LEVEL, TARGET, TS, 1)          \
+    ALLIED_CHANGE_KERNEL(SIZE##_2_##LEVEL, TARGET, TS, 2)          \
+    ALLIED_CHANGE_KERNEL(SIZE##_4_##LEVEL, TARGET, TS, 4)          \
+    ALLIED_CHANGE_KERNEL(SIZE##_8_##LEVEL, TARGET, TS, 8)
+
+#define ALLIED_CHANGE_LEVEL(LEVEL, TARGET)                                                                    \
+    ALLIED_CHANGE_CONTAINER(8, LEVEL, TARGET, VmbUint8_t)                                                     \
+    ALLIED_CHANGE_CONTAINER(16, LEVEL, TARGET, VmbUint16_t)                                                   \
+    static const AlliedChangeKernels_s change_##LEVEL = {                                                     \
+        .row = {{&allied_change_row_8_1_##LEVEL, &allied_change_row_8_2_##LEVEL,                              \
+                 &allied_change_row_8_4_##LEVEL, &allied_change_row_8_8_##LEVEL},                             \
+                {&allied_change_row_16_1_##LEVEL, &allied_change_row_16_2_##LEVEL,                            \
+                 &allied_change_row_16_4_##LEVEL, &allied_change_row_16_8_##LEVEL}},                          \
+    };
+
+ALLIED_KERNEL_LEVELS(ALLIED_CHANGE_LEVEL)
+
+static const AlliedChangeKernels_s *change_kernels = &change_scalar;
+
+ALLIED_KERNEL_BINDER(allied_change_bind, change_kernels, &change)
+
+struct allied_change_s
+{
+    AlliedChangeConfig_t config; // resolved configuration, `block` in samples
+    VmbUint32_t shift;           // log2 of the step
+    VmbUint32_t width;           // width of the modeled images
+    VmbUint32_t height;          // height of the modeled images
+    VmbPixelFormat_t format;     // pixel format of the modeled images
+    bool valid;                  // the model holds an image of this geometry
+    VmbUint32_t samples_x;       // samples per row
+    VmbUint32_t samples_y;       // sampled rows
+    VmbUint32_t blocks_x;        // blocks per row of blocks
+    VmbUint32_t blocks_y;        // rows of blocks
+    VmbInt32_t *model;           // background model, samples_x x samples_y
+    VmbUint8_t *flags;           // changed samples of the current row
+    VmbUint32_t *counts;         // changed samples per block
+    size_t alloc;                // samples allocated in the model
+    size_t blocks_alloc;         // blocks allocated in the counts
+};
+
+static double allied_change_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec * 1e-3;
+}
+
+VmbError_t allied_change_create(AlliedChangeDetector_t *det, const AlliedChangeConfig_t *config)
+{
+    assert(det);
+    AlliedChangeConfig_t c = {0};
+    if (config != NULL)
+    {
+        c = *config;
+    }
+    c.step = c.step == 0 ? 4 : c.step;
+    c.block = c.block == 0 ? 32 : c.block;
+    c.adapt = c.adapt == 0 ? 4 : c.adapt;
+    c.fraction = c.fraction == 0 ? 0.1 : c.fraction;
+    c.min_blocks = c.min_blocks == 0 ? 1 : c.min_blocks;
+    if ((c.step & (c.step - 1)) != 0 || c.step > 8 || c.block > 65536 || c.adapt > 8 || !(c.threshold >= 0 && c.threshold < 65536) ||
+        !(c.fraction > 0 && c.fraction < 1))
+    {
+        return VmbErrorBadParameter;
+    }
+    struct allied_change_s *idet = (struct allied_change_s *)malloc(sizeof(struct allied_change_s));
+    if (idet == NULL)
+    {
+        return VmbErrorResources;
+    }
+    memset(idet, 0, sizeof(struct allied_change_s));
+    idet->shift = c.step == 1 ? 0 : c.step == 2 ? 1 : c.step == 4 ? 2 : 3;
+    c.block = (c.block + c.step - 1) >> idet->shift; // in samples
+    idet->config = c;
+    *det = idet;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_change_destroy(AlliedChangeDetector_t *det)
+{
+    assert(det);
+    struct allied_change_s *idet = *det;
+    if (idet == NULL)
+    {
+        return VmbErrorSuccess;
+    }
+    free(idet->model);
+    free(idet->flags);
+    free(idet->counts);
+    free(idet);
+    *det = NULL;
+    return VmbErrorSuccess;
+}
+
+void allied_change_reset(AlliedChangeDetector_t det)
+{
+    assert(det);
+    det->valid = false;
+}
+
+/**
+ * @brief Size the model and the block counts for the geometry of an image.
+ *
+ */
+static VmbError_t allied_change_resize(struct allied_change_s *det, const AlliedImage_t *image)
+{
+    VmbUint32_t step = det->config.step;
+    VmbUint32_t sx = (image->width + step - 1) >> det->shift;
+    VmbUint32_t sy = (image->height + step - 1) >> det->shift;
+    VmbUint32_t bx = (sx + det->config.block - 1) / det->config.block;
+    VmbUint32_t by = (sy + det->config.block - 1) / det->config.block;
+    size_t samples = (size_t)sx * sy;
+    if (samples > det->alloc)
+    {
+        VmbInt32_t *model = (VmbInt32_t *)malloc(samples * sizeof(VmbInt32_t));
+        VmbUint8_t *flags = (VmbUint8_t *)malloc(sx);
+        if (model == NULL || flags == NULL)
+        {
+            free(model);
+            free(flags);
+            return VmbErrorResources;
+        }
+        free(det->model);
+        free(det->flags);
+        det->model = model;
+        det->flags = flags;
+        det->alloc = samples;
+    }
+    if ((size_t)bx * by > det->blocks_alloc)
+    {
+        VmbUint32_t *counts = (VmbUint32_t *)malloc((size_t)bx * by * sizeof(VmbUint32_t));
+        if (counts == NULL)
+        {
+            return VmbErrorResources;
+        }
+        free(det->counts);
+        det->counts = counts;
+        det->blocks_alloc = (size_t)bx * by;
+    }
+    det->width = image->width;
+    det->height = image->height;
+    det->format = image->format;
+    det->samples_x = sx;
+    det->samples_y = sy;
+    det->blocks_x = bx;
+    det->blocks_y = by;
+    return VmbErrorSuccess;
+}
+
+/**
+ * @brief Copy the samples of a row into the model, in fixed point.
+ *
+ */
+static void allied_change_seed(const VmbUchar_t *row, VmbInt32_t *model, VmbUint32_t count, VmbUint32_t step, size_t pixel_size)
+{
+    for (VmbUint32_t i = 0; i < count; i++)
+    {
+        VmbInt32_t v;
+        if (pixel_size == 1)
+        {
+            v = row[(size_t)i * step];
+        }
+        else
+        {
+            VmbUint16_t s;
+            memcpy(&s, row + (size_t)i * step * 2, sizeof(s));
+            v = s;
+        }
+        model[i] = v << ALLIED_CHANGE_FRACTION;
+    }
+}
+
+VmbError_t allied_change_detect(AlliedChangeDetector_t det, const AlliedImage_t *image, AlliedChangeResult_t *result)
+{
+    assert(det);
+    assert(image);
+    assert(result);
+    double start = allied_change_now_us();
+    const AlliedImageKernels_s *kernels = allied_image_kernels(image->format);
+    if (kernels == NULL)
+    {
+        return VmbErrorNotSupported;
+    }
+    size_t row_size = (size_t)image->width * kernels->pixel_size;
+    size_t stride = image->stride == 0 ? row_size : image->stride;
+    if (image->data == NULL || image->width == 0 || image->height == 0 || stride < row_size)
+    {
+        return VmbErrorBadParameter;
+    }
+    // the model holds images of one geometry only
+    bool build = !det->valid || image->width != det->width || image->height != det->height || image->format != det->format;
+    if (build)
+    {
+        det->valid = false;
+        VmbError_t err = allied_change_resize(det, image);
+        if (err != VmbErrorSuccess)
+        {
+            return err;
+        }
+    }
+    const AlliedChangeConfig_t *c = &(det->config);
+    double threshold = c->threshold == 0 ? (double)(1u << kernels->bits) / 32 : c->threshold;
+    VmbInt32_t limit = (VmbInt32_t)(threshold * (1 << ALLIED_CHANGE_FRACTION));
+    allied_dispatch_init();
+    AlliedChangeRowKernel kernel = change_kernels->row[kernels->pixel_size == 1 ? 0 : 1][det->shift];
+    VmbUint32_t bs = c->block;
+    memset(det->counts, 0, (size_t)det->blocks_x * det->blocks_y * sizeof(VmbUint32_t));
+    for (VmbUint32_t j = 0; j < det->samples_y; j++)
+    {
+        const VmbUchar_t *row = (const VmbUchar_t *)image->data + ((size_t)j << det->shift) * stride;
+        VmbInt32_t *model = det->model + (size_t)j * det->samples_x;
+        if (build)
+        {
+            allied_change_seed(row, model, det->samples_x, c->step, kernels->pixel_size);
+            continue;
+        }
+        kernel(row, model, det->flags, det->samples_x, limit, c->adapt);
+        VmbUint32_t *counts = det->counts + (size_t)(j / bs) * det->blocks_x;
+        for (VmbUint32_t b = 0; b < det->blocks_x; b++)
+        {
+            VmbUint32_t first = b * bs;
+            VmbUint32_t last = first + bs < det->samples_x ? first + bs : det->samples_x;
+            VmbUint32_t n = 0;
+            for (VmbUint32_t i = first; i < last; i++)
+            {
+                n += det->flags[i];
+            }
+            counts[b] += n;
+        }
+    }
+    det->valid = true;
+    memset(result, 0, sizeof(AlliedChangeResult_t));
+    result->total = det->blocks_x * det->blocks_y;
+    if (!build)
+    {
+        VmbUint64_t changed = 0;
+        VmbUint32_t bx0 = det->blocks_x, by0 = det->blocks_y, bx1 = 0, by1 = 0;
+        // the blocks on the right and bottom edges may be partial, they need as many changed samples as the others so that a few
+        // noisy samples do not trip them
+        double cutoff = c->fraction * bs * bs;
+        for (VmbUint32_t by = 0; by < det->blocks_y; by++)
+        {
+            for (VmbUint32_t bx = 0; bx < det->blocks_x; bx++)
+            {
+                VmbUint32_t n = det->counts[(size_t)by * det->blocks_x + bx];
+                changed += n;
+                if ((double)n <= cutoff)
+                {
+                    continue;
+                }
+                result->blocks++;
+                bx0 = bx < bx0 ? bx : bx0;
+                by0 = by < by0 ? by : by0;
+                bx1 = bx > bx1 ? bx : bx1;
+                by1 = by > by1 ? by : by1;
+            }
+        }
+        result->changed = result->blocks >= c->min_blocks;
+        result->score = (double)changed / ((double)det->samples_x * det->samples_y);
+        if (result->blocks > 0)
+        {
+            VmbUint32_t side = bs << det->shift; // in pixels
+            result->x = bx0 * side;
+            result->y = by0 * side;
+            result->width = ((bx1 + 1) * side < image->width ? (bx1 + 1) * side : image->width) - result->x;
+            result->height = ((by1 + 1) * side < image->height ? (by1 + 1) * side : image->height) - result->y;
+        }
+    }
+    result->elapsed_us = allied_change_now_us() - start;
+    return VmbErrorSuccess;
+}
@@ -0,0 +1,547 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_coadd.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Multi-threaded frame co-adding for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details Adding a frame is one fused kernel per row, instantiated for the source container, the value type of the sums and the window
+ * operation, and once per CPU level. The operations are:
+ * - add: the frame is added to the sum (running sums);
+ * - open: the frame is added to the sum, and starts a pane (the window is filling);
+ * - fill: the frame is added to the sum and to its pane;
+ * - roll: the frame replaces the oldest pane, and the sum moves by the difference, in one pass.
+ * Integer sums wrap modulo 2^32 in the roll, which leaves the sum exact as long as the window can not overflow. This file is built with -O3
+ * (see the Makefile).
+ */
+
+#include "alliedcam_coadd.h"
+#include "alliedcam_kernels.h"
+#include "alliedcam_dispatch.h"
+#include "alliedcam_pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <assert.h>
+
+/**
+ * @brief Time a detaching accumulator waits for a frame before checking whether to stop, in ms.
+ *
+ */
+#define ALLIED_COADD_POLL_MS 100
+
+/**
+ * @brief Operation of the row kernels, see the file description.
+ *
+ */
+typedef enum
+{
+    AlliedCoaddAdd = 0,
+    AlliedCoaddOpen,
+    AlliedCoaddFill,
+    AlliedCoaddRoll,
+    AlliedCoaddOps,
+} AlliedCoaddOp_s;
+
+struct allied_coadd_s
+{
+    AlliedCalibGeometry_t geometry; // Geometry of the frames.
+    AlliedCoaddConfig_t config;     // Configuration, with the defaults resolved.
+    VmbUint32_t pixel_size;         // Bytes per source pixel.
+    VmbUint32_t limit;              // Frames an integer sum holds without overflow.
+    void *sum;                      // Sum, packed rows.
+    void *panes;                    // Partial sums of the window, NULL for a running sum.
+    VmbUint64_t *pane_first;        // Frame ID of the first frame of every pane.
+    VmbUint32_t npanes;             // Number of panes.
+    VmbUint64_t count;              // Frames added since the last reset.
+    VmbUint32_t frames;             // Frames in the sum.
+    VmbUint64_t first_id;           // Frame ID of the first frame in the sum.
+    VmbUint64_t last_id;            // Frame ID of the last frame in the sum.
+    VmbUint64_t added;              // Frames added since the accumulator was created.
+    VmbUint64_t emitted;            // Sums emitted.
+    VmbUint32_t since_emit;         // Frames added since the last emission.
+    pthread_mutex_t lock;           // Lock of the sums and counters.
+    AlliedSubscriber_t sub;         // Subscription of the attached camera, NULL if not attached.
+    pthread_t thread;               // Thread that feeds the accumulator from the subscription.
+    atomic_bool running;            // The feeding thread runs.
+    _Atomic VmbError_t error;       // Result of the last frame added from the camera.
+};
+
+typedef void (*AlliedCoaddRowKernel)(const void *src, void *sum, void *pane, VmbUint32_t width);
+
+/**
+ * @brief Co-adding kernels of a CPU level.
+ *
+ */
+typedef struct
+{
+    AlliedCoaddRowKernel row[2][2][AlliedCoaddOps]; // By source container (8, 16 bits), value type (integer, float) and operation.
+} AlliedCoaddKernels_s;
+
+/**
+ * @brief Instantiate the row kernels of a source container and value type.
+ *
+ * @param NAME Suffix of the kernel names.
+ * @param TARGET Target attribute of the CPU level, or nothing.
+ * @param TS Source container type.
+ * @param TA Value type of the sums.
+ */
+#define ALLIED_COADD_ROWS(NAME, TARGET, TS, TA)                                                               \
+    TARGET static void allied_coadd_add_##NAME(const void *src, void *sum, void *pane, VmbUint32_t width)  \
+    {                                                                                                       \
+        const TS *restrict s = (const TS *)src;                                                             \
+        TA *restrict a = (TA *)sum;                                                                         \
+        (void)pane;                                                                                         \
+        for (size_t x = 0; x < width; x++)                                                                  \
+        {                                                                                                   \
+            a[x] += (TA)s[x];                                                                               \
+        }                                                                                                   \
+    }                                                                                                       \
+    TARGET static void allied_coadd_open_##NAME(const void *src, void *sum, void *pane, VmbUint32_t width) \
+    {                                                                                                       \
+        const TS *restrict s = (const TS *)src;                                                             \
+        TA *restrict a = (TA *)sum;                                                                         \
+        TA *restrict p = (TA *)pane;                                                                        \
+        for (size_t x = 0; x < width; x++)                                                                  \
+        {                                                                                                   \
+            TA v = (TA)s[x];                                                                                \
+            a[x] += v;                                                                                      \
+            p[x] = v;                                                                                       \
+        }                                                                                                   \
+    }                                                                                                       \
+    TARGET static void allied_coadd_fill_##NAME(const void *src, void *sum, void *pane, VmbUint32_t width) \
+    {                                                                                                       \
+        const TS *restrict s = (const TS *)src;                                                             \
+        TA *restrict a = (TA *)sum;                                                                         \
+        TA *restrict p = (TA *)pane;                                                                        \
+        for (size_t x = 0; x < width; x++)                                                                  \
+        {                                                                                                   \
+            TA v = (TA)s[x];                                                                                \
+            a[x] += v;                                                                                      \
+            p[x] += v;                                                                                      \
+        }                                                                                                   \
+    }                                                                                                       \
+    TARGET static void allied_coadd_roll_##NAME(const void *src, void *sum, void *pane, VmbUint32_t width) \
+    {                                                                                                       \
+        const TS *restrict s = (const TS *)src;                                                             \
+        TA *restrict a = (TA *)sum;                                                                         \
+        TA *restrict p = (TA *)pane;                                                                        \
+        for (size_t x = 0; x < width; x++)                                                                  \
+        {                                                                                                   \
+            TA v = (TA)s[x];                                                                                \
+            a[x] += v - p[x];                                                                               \
+            p[x] = v;                                                                                       \
+        }                                                                                                   \
+    }
+
+#define ALLIED_COADD_ROW_TABLE(NAME)                                                                                      \
+    {                                                                                                                     \
+        &allied_coadd_add_##NAME, &allied_coadd_open_##NAME, &allied_coadd_fill_##NAME, &allied_coadd_roll_##NAME, \
+    }
+
+#define ALLIED_COADD_LEVEL(LEVEL, TARGET)                                                             \
+    ALLIED_COADD_ROWS(8_u32_##LEVEL, TARGET, VmbUint8_t, VmbUint32_t)                                 \
+    ALLIED_COADD_ROWS(8_f_##LEVEL, TARGET, VmbUint8_t, float)                                         \
+    ALLIED_COADD_ROWS(16_u32_##LEVEL, TARGET, VmbUint16_t, VmbUint32_t)                               \
+    ALLIED_COADD_ROWS(16_f_##LEVEL, TARGET, VmbUint16_t, float)                                       \
+    static const AlliedCoaddKernels_s coadd_##LEVEL = {                                               \
+        .row = {                                                                                      \
+            {ALLIED_COADD_ROW_TABLE(8_u32_##LEVEL), ALLIED_COADD_ROW_TABLE(8_f_##LEVEL)},             \
+            {ALLIED_COADD_ROW_TABLE(16_u32_##LEVEL), ALLIED_COADD_ROW_TABLE(16_f_##LEVEL)},           \
+        },                                                                                            \
+    };
+
+ALLIED_KERNEL_LEVELS(ALLIED_COADD_LEVEL)
+
+static const AlliedCoaddKernels_s *coadd_kernels = &coadd_scalar;
+
+ALLIED_KERNEL_BINDER(allied_coadd_bind, coadd_kernels, &coadd)
+
+static size_t allied_coadd_pixels(const struct allied_coadd_s *acc)
+{
+    return (size_t)acc->geometry.width * acc->geometry.height;
+}
+
+VmbError_t allied_coadd_create(AlliedCoadd_t *acc, const AlliedCalibGeometry_t *geometry, const AlliedCoaddConfig_t *config)
+{
+    assert(acc);
+    assert(geometry);
+    *acc = NULL;
+    AlliedCoaddConfig_t c = {0};
+    if (config != NULL)
+    {
+        c = *config;
+    }
+    c.pane = c.pane == 0 ? 1 : c.pane;
+    if (geometry->width == 0 || geometry->height == 0 || c.type > AlliedCoaddFloat || c.window % c.pane != 0)
+    {
+        return VmbErrorBadParameter;
+    }
+    const AlliedImageKernels_s *kernels = allied_image_kernels(geometry->format);
+    if (kernels == NULL)
+    {
+        return VmbErrorNotSupported;
+    }
+    VmbUint32_t limit = c.type == AlliedCoaddUint32 ? 0xffffffffu / ((1u << kernels->bits) - 1) : 0xffffffffu;
+    if (c.window > limit)
+    {
+        return VmbErrorBadParameter;
+    }
+    struct allied_coadd_s *a = (struct allied_coadd_s *)calloc(1, sizeof(struct allied_coadd_s));
+    if (a == NULL)
+    {
+        return VmbErrorResources;
+    }
+    a->geometry = *geometry;
+    a->config = c;
+    a->pixel_size = kernels->pixel_size;
+    a->limit = limit;
+    a->npanes = c.window / c.pane;
+    size_t pixels = allied_coadd_pixels(a);
+    // the values of both types are 32 bits wide
+    a->sum = calloc(pixels, sizeof(VmbUint32_t));
+    if (a->npanes > 0)
+    {
+        a->panes = malloc(pixels * a->npanes * sizeof(VmbUint32_t));
+        a->pane_first = (VmbUint64_t *)calloc(a->npanes, sizeof(VmbUint64_t));
+    }
+    if (a->sum == NULL || (a->npanes > 0 && (a->panes == NULL || a->pane_first == NULL)))
+    {
+        free(a->sum);
+        free(a->panes);
+        free(a->pane_first);
+        free(a);
+        return VmbErrorResources;
+    }
+    pthread_mutex_init(&(a->lock), NULL);
+    atomic_init(&(a->running), false);
+    atomic_init(&(a->error), VmbErrorSuccess);
+    *acc = a;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_coadd_destroy(AlliedCoadd_t *acc)
+{
+    assert(acc);
+    if (*acc == NULL)
+    {
+        return VmbErrorSuccess;
+    }
+    allied_coadd_detach(*acc);
+    pthread_mutex_destroy(&((*acc)->lock));
+    free((*acc)->sum);
+    free((*acc)->panes);
+    free((*acc)->pane_first);
+    free(*acc);
+    *acc = NULL;
+    return VmbErrorSuccess;
+}
+
+/**
+ * @brief Adding job, shared by the tasks of the worker pool.
+ *
+ */
+typedef struct
+{
+    AlliedCoaddRowKernel row; // Row kernel.
+    const VmbUchar_t *src;    // First row of the source.
+    size_t src_stride;        // Bytes between source rows.
+    VmbUint32_t *sum;         // Sum.
+    VmbUint32_t *pane;        // Pane of the frame, NULL for a running sum.
+    VmbUint32_t width;        // Width in pixels.
+    VmbUint32_t height;       // Height in pixels.
+} AlliedCoaddJob_s;
+
+static void allied_coadd_task(void *arg, VmbUint32_t index, VmbUint32_t count)
+{
+    const AlliedCoaddJob_s *job = (const AlliedCoaddJob_s *)arg;
+    VmbUint32_t first = (VmbUint32_t)((VmbUint64_t)job->height * index / count);
+    VmbUint32_t last = (VmbUint32_t)((VmbUint64_t)job->height * (index + 1) / count);
+    for (VmbUint32_t y = first; y < last; y++)
+    {
+        size_t at = (size_t)y * job->width;
+        job->row(job->src + (size_t)y * job->src_stride, job->sum + at, job->pane == NULL ? NULL : job->pane + at, job->width);
+    }
+}
+
+/**
+ * @brief Describe the sum of an accumulator. Called with the lock held.
+ *
+ */
+static void allied_coadd_describe(const struct allied_coadd_s *a, const void *data, AlliedCoaddSum_t *sum)
+{
+    sum->data = data;
+    sum->width = a->geometry.width;
+    sum->height = a->geometry.height;
+    sum->type = a->config.type;
+    sum->frames = a->frames;
+    sum->first_id = a->first_id;
+    sum->last_id = a->last_id;
+}
+
+/**
+ * @brief Clear the sum of an accumulator. Called with the lock held; the panes are overwritten when they are opened.
+ *
+ */
+static void allied_coadd_clear(struct allied_coadd_s *a)
+{
+    memset(a->sum, 0, allied_coadd_pixels(a) * sizeof(VmbUint32_t));
+    a->count = 0;
+    a->frames = 0;
+    a->first_id = a->last_id = 0;
+    a->since_emit = 0;
+}
+
+/**
+ * @brief Add an image with a frame ID. The image is validated by the caller.
+ *
+ */
+static VmbError_t allied_coadd_add_id(struct allied_coadd_s *a, const AlliedImage_t *image, bool has_id, VmbUint64_t id)
+{
+    size_t src_row = (size_t)image->width * a->pixel_size;
+    AlliedCoaddJob_s job = {
+        .src = (const VmbUchar_t *)image->data,
+        .src_stride = image->stride == 0 ? src_row : image->stride,
+        .sum = (VmbUint32_t *)a->sum,
+        .width = image->width,
+        .height = image->height,
+    };
+    if (job.src == NULL || job.src_stride < src_row)
+    {
+        return VmbErrorBadParameter;
+    }
+    allied_dispatch_init();
+    pthread_mutex_lock(&(a->lock));
+    if (a->npanes == 0 && a->frames == a->limit)
+    {
+        pthread_mutex_unlock(&(a->lock));
+        return VmbErrorInvalidCall;
+    }
+    const AlliedCoaddConfig_t *c = &(a->config);
+    id = has_id ? id : a->count;
+    AlliedCoaddOp_s op = AlliedCoaddAdd;
+    if (a->npanes > 0)
+    {
+        VmbUint32_t p = (VmbUint32_t)((a->count / c->pane) % a->npanes);
+        job.pane = (VmbUint32_t *)a->panes + (size_t)p * allied_coadd_pixels(a);
+        if (a->count % c->pane != 0)
+        {
+            op = AlliedCoaddFill;
+        }
+        else
+        {
+            op = a->count < c->window ? AlliedCoaddOpen : AlliedCoaddRoll;
+            a->pane_first[p] = id;
+        }
+        if (op == AlliedCoaddRoll)
+        {
+            a->frames -= c->pane;
+            a->first_id = a->pane_first[(p + 1) % a->npanes];
+        }
+    }
+    if (a->frames == 0)
+    {
+        a->first_id = id;
+    }
+    job.row = coadd_kernels->row[a->pixel_size == 1 ? 0 : 1][c->type][op];
+    VmbUint32_t tasks = 1;
+    if (c->threads > 1)
+    {
+        tasks = allied_pool_threads(c->threads);
+        tasks = job.height < tasks ? job.height : tasks;
+    }
+    allied_pool_run(tasks, &allied_coadd_task, &job);
+    a->count++;
+    a->frames++;
+    a->last_id = id;
+    a->added++;
+    if (c->emit_every > 0 && ++(a->since_emit) >= c->emit_every)
+    {
+        a->since_emit = 0;
+        a->emitted++;
+        if (c->callback != NULL)
+        {
+            AlliedCoaddSum_t sum;
+            allied_coadd_describe(a, a->sum, &sum);
+            c->callback(a, &sum, c->user_data);
+        }
+        if (c->reset_on_emit)
+        {
+            allied_coadd_clear(a);
+        }
+    }
+    pthread_mutex_unlock(&(a->lock));
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_coadd_add(AlliedCoadd_t acc, const AlliedImage_t *image)
+{
+    assert(acc);
+    assert(image);
+    if (image->width != acc->geometry.width || image->height != acc->geometry.height || image->format != acc->geometry.format)
+    {
+        return VmbErrorBadParameter;
+    }
+    return allied_coadd_add_id(acc, image, false, 0);
+}
+
+VmbError_t allied_coadd_add_frame(AlliedCoadd_t acc, const VmbFrame_t *frame)
+{
+    assert(acc);
+    assert(frame);
+    if (frame->offsetX != acc->geometry.offset_x || frame->offsetY != acc->geometry.offset_y)
+    {
+        return VmbErrorBadParameter;
+    }
+    AlliedImage_t image;
+    VmbError_t err = allied_image_from_frame(frame, &image);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    if (image.width != acc->geometry.width || image.height != acc->geometry.height || image.format != acc->geometry.format)
+    {
+        return VmbErrorBadParameter;
+    }
+    return allied_coadd_add_id(acc, &image, true, frame->frameID);
+}
+
+VmbError_t allied_coadd_read(AlliedCoadd_t acc, void *dst, size_t stride, AlliedCoaddSum_t *sum)
+{
+    assert(acc);
+    assert(dst);
+    size_t row = (size_t)acc->geometry.width * sizeof(VmbUint32_t);
+    stride = stride == 0 ? row : stride;
+    if (stride < row)
+    {
+        return VmbErrorBadParameter;
+    }
+    pthread_mutex_lock(&(acc->lock));
+    if (stride == row)
+    {
+        memcpy(dst, acc->sum, row * acc->geometry.height);
+    }
+    else
+    {
+        for (VmbUint32_t y = 0; y < acc->geometry.height; y++)
+        {
+            memcpy((VmbUchar_t *)dst + (size_t)y * stride, (const VmbUchar_t *)acc->sum + (size_t)y * row, row);
+        }
+    }
+    if (sum != NULL)
+    {
+        allied_coadd_describe(acc, dst, sum);
+    }
+    pthread_mutex_unlock(&(acc->lock));
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_coadd_reset(AlliedCoadd_t acc)
+{
+    assert(acc);
+    pthread_mutex_lock(&(acc->lock));
+    allied_coadd_clear(acc);
+    pthread_mutex_unlock(&(acc->lock));
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_coadd_status(AlliedCoadd_t acc, AlliedCoaddStatus_t *status)
+{
+    assert(acc);
+    assert(status);
+    memset(status, 0, sizeof(AlliedCoaddStatus_t));
+    pthread_mutex_lock(&(acc->lock));
+    status->frames = acc->frames;
+    status->added = acc->added;
+    status->emitted = acc->emitted;
+    pthread_mutex_unlock(&(acc->lock));
+    status->attached = atomic_load(&(acc->running));
+    status->error = atomic_load(&(acc->error));
+    if (status->attached)
+    {
+        allied_subscriber_counts(acc->sub, NULL, NULL, &(status->dropped));
+    }
+    return VmbErrorSuccess;
+}
+
+/**
+ * @brief Thread that feeds an accumulator from its subscription.
+ *
+ */
+static void *allied_coadd_thread(void *arg)
+{
+    struct allied_coadd_s *a = (struct allied_coadd_s *)arg;
+    while (atomic_load(&(a->running)))
+    {
+        AlliedFrameView_t view;
+        if (allied_subscriber_pop(a->sub, &view, ALLIED_COADD_POLL_MS) != VmbErrorSuccess)
+        {
+            continue;
+        }
+        AlliedImage_t image;
+        VmbError_t err = allied_image_from_view(&view, &image);
+        if (err == VmbErrorSuccess && (view.frame->offsetX + view.offset_x != a->geometry.offset_x ||
+                                       view.frame->offsetY + view.offset_y != a->geometry.offset_y || image.width != a->geometry.width ||
+                                       image.height != a->geometry.height || image.format != a->geometry.format))
+        {
+            err = VmbErrorBadParameter;
+        }
+        if (err == VmbErrorSuccess)
+        {
+            err = allied_coadd_add_id(a, &image, true, view.frame->frameID);
+        }
+        // requeued as soon as it is added
+        allied_frame_release(view.frame);
+        atomic_store(&(a->error), err);
+    }
+    return NULL;
+}
+
+VmbError_t allied_coadd_attach(AlliedCoadd_t acc, AlliedCameraHandle_t handle, const AlliedSubscription_t *subscription)
+{
+    assert(acc);
+    assert(handle);
+    if (acc->sub != NULL)
+    {
+        return VmbErrorInvalidCall;
+    }
+    AlliedSubscription_t config = {.queue_depth = 4, .policy = AlliedBackpressureDropNewest};
+    if (subscription != NULL)
+    {
+        config = *subscription;
+        config.callback = NULL;
+    }
+    VmbError_t err = allied_subscribe(handle, &config, &(acc->sub));
+    if (err != VmbErrorSuccess)
+    {
+        acc->sub = NULL;
+        return err;
+    }
+    atomic_store(&(acc->error), VmbErrorSuccess);
+    atomic_store(&(acc->running), true);
+    if (pthread_create(&(acc->thread), NULL, &allied_coadd_thread, acc) != 0)
+    {
+        atomic_store(&(acc->running), false);
+        allied_unsubscribe(&(acc->sub));
+        return VmbErrorResources;
+    }
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_coadd_detach(AlliedCoadd_t acc)
+{
+    assert(acc);
+    if (acc->sub == NULL)
+    {
+        return VmbErrorSuccess;
+    }
+    atomic_store(&(acc->running), false);
+    pthread_join(acc->thread, NULL);
+    allied_unsubscribe(&(acc->sub));
+    return VmbErrorSuccess;
+}
@@ -0,0 +1,399 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_copy.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Frame copy-out functions for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "alliedcam_copy.h"
+#include "alliedcam_pool.h"
+#include "alliedcam_frame.h"
+#include "alliedcam_dispatch.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+
+/**
+ * @brief Copy `rows` rows of `row` bytes each between two strided buffers.
+ *
+ * @param dst Destination
+ * @param dst_stride Bytes between destination rows
+ * @param src Source
+ * @param src_stride Bytes between source rows
+ * @param row Bytes per row
+ * @param rows Number of rows
+ * @param streaming Use non-temporal stores
+ */
+typedef void (*AlliedRowCopy)(VmbUchar_t *dst, size_t dst_stride, const VmbUchar_t *src, size_t src_stride, size_t row, size_t rows, bool streaming);
+
+static void allied_copy_rows_scalar(VmbUchar_t *dst, size_t dst_stride, const VmbUchar_t *src, size_t src_stride, size_t row, size_t rows, bool streaming)
+{
+    (void)streaming;
+    for (size_t r = 0; r < rows; r++)
+    {
+        memcpy(dst + r * dst_stride, src + r * src_stride, row);
+    }
+}
+
+#ifdef ALLIED_X86
+// Row copies share one shape per vector width: an unaligned lead-in vector that brings
+// the destination to a vector boundary for streaming stores, an unrolled body, and an
+// overlapping trailing vector instead of a scalar tail. Rows shorter than a vector use memcpy.
+ALLIED_TARGET_SSE41 static void allied_copy_rows_sse41(VmbUchar_t *dst, size_t dst_stride, const VmbUchar_t *src, size_t src_stride, size_t row, size_t rows, bool streaming)
+{
+    for (size_t r = 0; r < rows; r++)
+    {
+        VmbUchar_t *d = dst + r * dst_stride;
+        const VmbUchar_t *s = src + r * src_stride;
+        size_t i = 0;
+        if (row < 16)
+        {
+            memcpy(d, s, row);
+            continue;
+        }
+        if (streaming && row >= 64)
+        {
+            i = (16 - ((uintptr_t)d & 15)) & 15;
+            _mm_storeu_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+            for (; i + 64 <= row; i += 64)
+            {
+                __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+                __m128i b = _mm_loadu_si128((const __m128i *)(s + i + 16));
+                __m128i c = _mm_loadu_si128((const __m128i *)(s + i + 32));
+                __m128i e = _mm_loadu_si128((const __m128i *)(s + i + 48));
+                _mm_stream_si128((__m128i *)(d + i), a);
+                _mm_stream_si128((__m128i *)(d + i + 16), b);
+                _mm_stream_si128((__m128i *)(d + i + 32), c);
+                _mm_stream_si128((__m128i *)(d + i + 48), e);
+            }
+            for (; i + 16 <= row; i += 16)
+            {
+                _mm_stream_si128((__m128i *)(d + i), _mm_loadu_si128((const __m128i *)(s + i)));
+            }
+        }
+        else
+        {
+            for (; i + 64 <= row; i += 64)
+            {
+                __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+                __m128i b = _mm_loadu_si128((const __m128i *)(s + i + 16));
+                __m128i c = _mm_loadu_si128((const __m128i *)(s + i + 32));
+                __m128i e = _mm_loadu_si128((const __m128i *)(s + i + 48));
+                _mm_storeu_si128((__m128i *)(d + i), a);
+                _mm_storeu_si128((__m128i *)(d + i + 16), b);
+                _mm_storeu_si128((__m128i *)(d + i + 32), c);
+                _mm_storeu_si128((__m128i *)(d + i + 48), e);
+            }
+            for (; i + 16 <= row; i += 16)
+            {
+                _mm_storeu_si128((__m128i *)(d + i), _mm_loadu_si128((const __m128i *)(s + i)));
+            }
+        }
+        if (i < row)
+        {
+            _mm_storeu_si128((__m128i *)(d + row - 16), _mm_loadu_si128((const __m128i *)(s + row - 16)));
+        }
+    }
+    if (streaming)
+    {
+        _mm_sfence();
+    }
+}
+
+ALLIED_TARGET_AVX2 static void allied_copy_rows_avx2(VmbUchar_t *dst, size_t dst_stride, const VmbUchar_t *src, size_t src_stride, size_t row, size_t rows, bool streaming)
+{
+    for (size_t r = 0; r < rows; r++)
+    {
+        VmbUchar_t *d = dst + r * dst_stride;
+        const VmbUchar_t *s = src + r * src_stride;
+        size_t i = 0;
+        if (row < 32)
+        {
+            memcpy(d, s, row);
+            continue;
+        }
+        if (streaming && row >= 128)
+        {
+            i = (32 - ((uintptr_t)d & 31)) & 31;
+            _mm256_storeu_si256((__m256i *)d, _mm256_loadu_si256((const __m256i *)s));
+            for (; i + 128 <= row; i += 128)
+            {
+                __m256i a = _mm256_loadu_si256((const __m256i *)(s + i));
+                __m256i b = _mm256_loadu_si256((const __m256i *)(s + i + 32));
+                __m256i c = _mm256_loadu_si256((const __m256i *)(s + i + 64));
+                __m256i e = _mm256_loadu_si256((const __m256i *)(s + i + 96));
+                _mm256_stream_si256((__m256i *)(d + i), a);
+                _mm256_stream_si256((__m256i *)(d + i + 32), b);
+                _mm256_stream_si256((__m256i *)(d + i + 64), c);
+                _mm256_stream_si256((__m256i *)(d + i + 96), e);
+            }
+            for (; i + 32 <= row; i += 32)
+            {
+                _mm256_stream_si256((__m256i *)(d + i), _mm256_loadu_si256((const __m256i *)(s + i)));
+            }
+        }
+        else
+        {
+            for (; i + 128 <= row; i += 128)
+            {
+                __m256i a = _mm256_loadu_si256((const __m256i *)(s + i));
+                __m256i b = _mm256_loadu_si256((const __m256i *)(s + i + 32));
+                __m256i c = _mm256_loadu_si256((const __m256i *)(s + i + 64));
+                __m256i e = _mm256_loadu_si256((const __m256i *)(s + i + 96));
+                _mm256_storeu_si256((__m256i *)(d + i), a);
+                _mm256_storeu_si256((__m256i *)(d + i + 32), b);
+                _mm256_storeu_si256((__m256i *)(d + i + 64), c);
+                _mm256_storeu_si256((__m256i *)(d + i + 96), e);
+            }
+            for (; i + 32 <= row; i += 32)
+            {
+                _mm256_storeu_si256((__m256i *)(d + i), _mm256_loadu_si256((const __m256i *)(s + i)));
+            }
+        }
+        if (i < row)
+        {
+            _mm256_storeu_si256((__m256i *)(d + row - 32), _mm256_loadu_si256((const __m256i *)(s + row - 32)));
+        }
+    }
+    if (streaming)
+    {
+        _mm_sfence();
+    }
+    _mm256_zeroupper();
+}
+
+ALLIED_TARGET_AVX512 static void allied_copy_rows_avx512(VmbUchar_t *dst, size_t dst_stride, const VmbUchar_t *src, size_t src_stride, size_t row, size_t rows, bool streaming)
+{
+    for (size_t r = 0; r < rows; r++)
+    {
+        VmbUchar_t *d = dst + r * dst_stride;
+        const VmbUchar_t *s = src + r * src_stride;
+        size_t i = 0;
+        if (row < 64)
+        {
+            memcpy(d, s, row);
+            continue;
+        }
+        if (streaming && row >= 256)
+        {
+            i = (64 - ((uintptr_t)d & 63)) & 63;
+            _mm512_storeu_si512((void *)d, _mm512_loadu_si512((const void *)s));
+            for (; i + 256 <= row; i += 256)
+            {
+                __m512i a = _mm512_loadu_si512((const void *)(s + i));
+                __m512i b = _mm512_loadu_si512((const void *)(s + i + 64));
+                __m512i c = _mm512_loadu_si512((const void *)(s + i + 128));
+                __m512i e = _mm512_loadu_si512((const void *)(s + i + 192));
+                _mm512_stream_si512((void *)(d + i), a);
+                _mm512_stream_si512((void *)(d + i + 64), b);
+                _mm512_stream_si512((void *)(d + i + 128), c);
+                _mm512_stream_si512((void *)(d + i + 192), e);
+            }
+            for (; i + 64 <= row; i += 64)
+            {
+                _mm512_stream_si512((void *)(d + i), _mm512_loadu_si512((const void *)(s + i)));
+            }
+        }
+        else
+        {
+            for (; i + 256 <= row; i += 256)
+            {
+                __m512i a = _mm512_loadu_si512((const void *)(s + i));
+                __m512i b = _mm512_loadu_si512((const void *)(s + i + 64));
+                __m512i c = _mm512_loadu_si512((const void *)(s + i + 128));
+                __m512i e = _mm512_loadu_si512((const void *)(s + i + 192));
+                _mm512_storeu_si512((void *)(d + i), a);
+                _mm512_storeu_si512((void *)(d + i + 64), b);
+                _mm512_storeu_si512((void *)(d + i + 128), c);
+                _mm512_storeu_si512((void *)(d + i + 192), e);
+            }
+            for (; i + 64 <= row; i += 64)
+            {
+                _mm512_storeu_si512((void *)(d + i), _mm512_loadu_si512((const void *)(s + i)));
+            }
+        }
+        if (i < row)
+        {
+            _mm512_storeu_si512((void *)(d + row - 64), _mm512_loadu_si512((const void *)(s + row - 64)));
+        }
+    }
+    if (streaming)
+    {
+        _mm_sfence();
+    }
+    _mm256_zeroupper();
+}
+#endif // ALLIED_X86
+
+static AlliedRowCopy copy_rows = &allied_copy_rows_scalar;
+
+ALLIED_KERNEL_BINDER(allied_copy_bind, copy_rows, &allied_copy_rows)
+
+typedef struct
+{
+    VmbUchar_t *dst;       // destination
+    size_t dst_stride;     // bytes between destination rows
+    const VmbUchar_t *src; // source
+    size_t src_stride;     // bytes between source rows
+    size_t row;            // bytes per row
+    size_t rows;           // number of rows, 1 for a flat copy
+    bool streaming;        // use non-temporal stores
+} AlliedCopyJob_s;
+
+static void allied_copy_task(void *arg, VmbUint32_t index, VmbUint32_t count)
+{
+    const AlliedCopyJob_s *job = (const AlliedCopyJob_s *)arg;
+    if (job->rows == 1) // flat copy, split the bytes on cache line boundaries
+    {
+        size_t chunk = ((job->row / count) + 63) & ~(size_t)63;
+        size_t start = chunk * index;
+        if (start >= job->row)
+        {
+            return;
+        }
+        size_t len = job->row - start < chunk ? job->row - start : chunk;
+        if (job->streaming)
+        {
+            copy_rows(job->dst + start, 0, job->src + start, 0, len, 1, true);
+        }
+        else
+        {
+            memcpy(job->dst + start, job->src + start, len);
+        }
+        return;
+    }
+    size_t start = job->rows * index / count;
+    size_t end = job->rows * (index + 1) / count;
+    copy_rows(job->dst + start * job->dst_stride, job->dst_stride,
+              job->src + start * job->src_stride, job->src_stride,
+              job->row, end - start, job->streaming);
+}
+
+static void allied_copy_run(AlliedCopyJob_s *job, const AlliedCopyOptions_t *opts)
+{
+    allied_dispatch_init();
+    size_t total = job->row * job->rows;
+    AlliedCopyMode_t mode = opts != NULL ? opts->mode : AlliedCopyAuto;
+    job->streaming = mode == AlliedCopyStreaming || (mode == AlliedCopyAuto && total >= ALLIED_COPY_STREAMING_THRESHOLD);
+    VmbUint32_t threads = 1;
+    if (opts != NULL && opts->threads > 1)
+    {
+        size_t chunks = total / ALLIED_COPY_THREAD_CHUNK;
+        threads = allied_pool_threads(opts->threads);
+        threads = chunks < threads ? (VmbUint32_t)chunks : threads;
+        threads = job->rows > 1 && job->rows < threads ? (VmbUint32_t)job->rows : threads;
+        threads = threads > 0 ? threads : 1;
+    }
+    if (threads == 1) // nothing to split, skip the pool
+    {
+        if (job->rows == 1 && !job->streaming)
+        {
+            memcpy(job->dst, job->src, job->row);
+        }
+        else
+        {
+            copy_rows(job->dst, job->dst_stride, job->src, job->src_stride, job->row, job->rows, job->streaming);
+        }
+        return;
+    }
+    allied_pool_run(threads, &allied_copy_task, job);
+}
+
+size_t allied_frame_image_size(const VmbFrame_t *frame)
+{
+    assert(frame);
+    VmbUint64_t bits = allied_format_bits(frame->pixelFormat);
+    return (size_t)(((VmbUint64_t)frame->width * frame->height * bits + 7) / 8);
+}
+
+VmbError_t allied_copy_buffer(void *dst, const void *src, size_t size, const AlliedCopyOptions_t *opts)
+{
+    assert(dst);
+    assert(src);
+    if (size == 0)
+    {
+        return VmbErrorSuccess;
+    }
+    AlliedCopyJob_s job = {
+        .dst = (VmbUchar_t *)dst,
+        .src = (const VmbUchar_t *)src,
+        .row = size,
+        .rows = 1,
+    };
+    allied_copy_run(&job, opts);
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_copy_frame(const VmbFrame_t *frame, void *dst, size_t size, const AlliedCopyOptions_t *opts)
+{
+    assert(frame);
+    assert(dst);
+    size_t needed = allied_frame_image_size(frame);
+    if (needed == 0)
+    {
+        return VmbErrorNoData;
+    }
+    if (size < needed)
+    {
+        return VmbErrorMoreData;
+    }
+    const VmbUchar_t *data = allied_frame_data(frame, needed);
+    if (data == NULL)
+    {
+        return VmbErrorBadParameter;
+    }
+    return allied_copy_buffer(dst, data, needed, opts);
+}
+
+VmbError_t allied_copy_frame_roi(const VmbFrame_t *frame, VmbUint32_t x, VmbUint32_t y, VmbUint32_t width, VmbUint32_t height, void *dst, size_t dst_stride, const AlliedCopyOptions_t *opts)
+{
+    assert(frame);
+    assert(dst);
+    VmbUint64_t bits = allied_format_bits(frame->pixelFormat);
+    if (bits == 0)
+    {
+        return VmbErrorNotSupported;
+    }
+    if (width == 0 || height == 0)
+    {
+        return VmbErrorSuccess;
+    }
+    if ((VmbUint64_t)x + width > frame->width || (VmbUint64_t)y + height > frame->height)
+    {
+        return VmbErrorInvalidValue;
+    }
+    // packed rows can only be cut on byte boundaries
+    if (((VmbUint64_t)frame->width * bits) % 8 != 0 || (x * bits) % 8 != 0 || (width * bits) % 8 != 0)
+    {
+        return VmbErrorNotSupported;
+    }
+    size_t src_stride = (size_t)((VmbUint64_t)frame->width * bits / 8);
+    size_t row = (size_t)(width * bits / 8);
+    dst_stride = dst_stride == 0 ? row : dst_stride;
+    if (dst_stride < row)
+    {
+        return VmbErrorBadParameter;
+    }
+    const VmbUchar_t *data = allied_frame_data(frame, src_stride * frame->height);
+    if (data == NULL)
+    {
+        return VmbErrorBadParameter;
+    }
+    AlliedCopyJob_s job = {
+        .dst = (VmbUchar_t *)dst,
+        .dst_stride = dst_stride,
+        .src = data + (size_t)y * src_stride + (size_t)(x * bits / 8),
+        .src_stride = src_stride,
+        .row = row,
+        .rows = height,
+    };
+    allied_copy_run(&job, opts);
+    return VmbErrorSuccess;
+}
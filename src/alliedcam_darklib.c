@@ -0,0 +1,467 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_darklib.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Temperature- and exposure-indexed dark library.
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details Entries are kept in an array of pointers, so that an entry does not move when the array grows; selection scans the entry
+ * headers under a read lock, and a dark is made from the selected entries outside of it, since entries are never modified or removed.
+ */
+
+#include "alliedcam_darklib.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <pthread.h>
+
+struct allied_dark_library_s
+{
+    AlliedDarkLibraryOptions_t opts; // options, with the defaults resolved
+    AlliedMaster_t **entries;        // entries, owned
+    VmbUint32_t count;               // number of entries
+    VmbUint32_t capacity;            // size of the entry array
+    pthread_rwlock_t lock;           // protects the entry array
+};
+
+/**
+ * @brief Dark considered for a selection.
+ *
+ */
+typedef struct
+{
+    VmbInt32_t index; // library index, -1 if none
+    double dt;        // temperature of the dark minus the requested temperature
+    double de;        // log ratio of the exposure times
+} AlliedDarkCandidate_s;
+
+static bool allied_dark_same_geometry(const AlliedCalibGeometry_t *a, const AlliedCalibGeometry_t *b)
+{
+    return a->offset_x == b->offset_x && a->offset_y == b->offset_y && a->width == b->width && a->height == b->height &&
+           a->binning == b->binning && a->format == b->format;
+}
+
+/**
+ * @brief Temperature difference of an entry, 0 if either temperature is unknown.
+ *
+ */
+static double allied_dark_dt(double entry, double query)
+{
+    return isfinite(entry) && isfinite(query) ? entry - query : 0;
+}
+
+VmbError_t allied_dark_library_create(AlliedDarkLibrary_t *library, const AlliedDarkLibraryOptions_t *opts)
+{
+    assert(library);
+    *library = NULL;
+    AlliedDarkLibraryOptions_t o = {0};
+    if (opts != NULL)
+    {
+        o = *opts;
+    }
+    if (!(o.temperature_tolerance >= 0) || !(o.exposure_tolerance >= 0) || !(o.gain_tolerance >= 0) || !(o.doubling_temperature >= 0))
+    {
+        return VmbErrorBadParameter;
+    }
+    o.temperature_tolerance = o.temperature_tolerance > 0 ? o.temperature_tolerance : 0.5;
+    o.exposure_tolerance = o.exposure_tolerance > 0 ? o.exposure_tolerance : 0.01;
+    o.gain_tolerance = o.gain_tolerance > 0 ? o.gain_tolerance : 0.05;
+    o.doubling_temperature = o.doubling_temperature > 0 ? o.doubling_temperature : 6.3;
+    struct allied_dark_library_s *lib = (struct allied_dark_library_s *)calloc(1, sizeof(struct allied_dark_library_s));
+    if (lib == NULL)
+    {
+        return VmbErrorResources;
+    }
+    if (pthread_rwlock_init(&(lib->lock), NULL) != 0)
+    {
+        free(lib);
+        return VmbErrorResources;
+    }
+    lib->opts = o;
+    *library = lib;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_dark_library_destroy(AlliedDarkLibrary_t *library)
+{
+    assert(library);
+    struct allied_dark_library_s *lib = *library;
+    if (lib == NULL)
+    {
+        return VmbErrorSuccess;
+    }
+    for (VmbUint32_t i = 0; i < lib->count; i++)
+    {
+        allied_master_free(lib->entries[i]);
+        free(lib->entries[i]);
+    }
+    free(lib->entries);
+    pthread_rwlock_destroy(&(lib->lock));
+    free(lib);
+    *library = NULL;
+    return VmbErrorSuccess;
+}
+
+/**
+ * @brief Take ownership of a master as a new entry.
+ *
+ */
+static VmbError_t allied_dark_library_insert(struct allied_dark_library_s *lib, AlliedMaster_t *entry, VmbUint32_t *index)
+{
+    pthread_rwlock_wrlock(&(lib->lock));
+    if (lib->count == lib->capacity)
+    {
+        VmbUint32_t capacity = lib->capacity == 0 ? 16 : 2 * lib->capacity;
+        AlliedMaster_t **entries = (AlliedMaster_t **)realloc(lib->entries, capacity * sizeof(AlliedMaster_t *));
+        if (entries == NULL)
+        {
+            pthread_rwlock_unlock(&(lib->lock));
+            return VmbErrorResources;
+        }
+        lib->entries = entries;
+        lib->capacity = capacity;
+    }
+    if (index != NULL)
+    {
+        *index = lib->count;
+    }
+    lib->entries[lib->count++] = entry;
+    pthread_rwlock_unlock(&(lib->lock));
+    return VmbErrorSuccess;
+}
+
+/**
+ * @brief Check that a master can be a library entry.
+ *
+ */
+static bool allied_dark_library_check(const AlliedMaster_t *master)
+{
+    if (master->data == NULL || master->kind == AlliedMasterFlat || master->geometry.width == 0 || master->geometry.height == 0)
+    {
+        return false;
+    }
+    // scaling the dark current to another exposure time needs the exposure time of the dark
+    return master->kind == AlliedMasterBias || master->exposure_us > 0;
+}
+
+VmbError_t allied_dark_library_add(AlliedDarkLibrary_t library, const AlliedMaster_t *master, VmbUint32_t *index)
+{
+    assert(library);
+    assert(master);
+    if (!allied_dark_library_check(master))
+    {
+        return VmbErrorBadParameter;
+    }
+    size_t size = (size_t)master->geometry.width * master->geometry.height * sizeof(float);
+    AlliedMaster_t *entry = (AlliedMaster_t *)malloc(sizeof(AlliedMaster_t));
+    float *data = (float *)malloc(size);
+    if (entry == NULL || data == NULL)
+    {
+        free(entry);
+        free(data);
+        return VmbErrorResources;
+    }
+    memcpy(data, master->data, size);
+    *entry = *master;
+    entry->data = data;
+    VmbError_t err = allied_dark_library_insert(library, entry, index);
+    if (err != VmbErrorSuccess)
+    {
+        allied_master_free(entry);
+        free(entry);
+    }
+    return err;
+}
+
+VmbError_t allied_dark_library_add_file(AlliedDarkLibrary_t library, const char *path, VmbUint32_t *index)
+{
+    assert(library);
+    assert(path);
+    AlliedMaster_t *entry = (AlliedMaster_t *)malloc(sizeof(AlliedMaster_t));
+    if (entry == NULL)
+    {
+        return VmbErrorResources;
+    }
+    VmbError_t err = allied_master_load(path, entry);
+    if (err != VmbErrorSuccess)
+    {
+        free(entry);
+        return err;
+    }
+    err = allied_dark_library_check(entry) ? allied_dark_library_insert(library, entry, index) : VmbErrorBadParameter;
+    if (err != VmbErrorSuccess)
+    {
+        allied_master_free(entry);
+        free(entry);
+    }
+    return err;
+}
+
+VmbUint32_t allied_dark_library_count(AlliedDarkLibrary_t library)
+{
+    assert(library);
+    pthread_rwlock_rdlock(&(library->lock));
+    VmbUint32_t count = library->count;
+    pthread_rwlock_unlock(&(library->lock));
+    return count;
+}
+
+VmbError_t allied_dark_library_entry(AlliedDarkLibrary_t library, VmbUint32_t index, const AlliedMaster_t **master)
+{
+    assert(library);
+    assert(master);
+    *master = NULL;
+    pthread_rwlock_rdlock(&(library->lock));
+    if (index < library->count)
+    {
+        *master = library->entries[index];
+    }
+    pthread_rwlock_unlock(&(library->lock));
+    return *master == NULL ? VmbErrorBadParameter : VmbErrorSuccess;
+}
+
+/**
+ * @brief Whether candidate a is closer than candidate b on one side of the requested temperature. Darks within the temperature tolerance
+ * of each other are ranked by exposure time instead.
+ *
+ */
+static bool allied_dark_closer(const AlliedDarkCandidate_s *a, const AlliedDarkCandidate_s *b, double tolerance)
+{
+    if (b->index < 0)
+    {
+        return true;
+    }
+    double da = fabs(a->dt), db = fabs(b->dt);
+    if (fabs(da - db) > tolerance)
+    {
+        return da < db;
+    }
+    return a->de < b->de || (a->de == b->de && da < db);
+}
+
+VmbError_t allied_dark_library_select(AlliedDarkLibrary_t library, const AlliedDarkQuery_t *query, AlliedDarkSelection_t *selection)
+{
+    assert(library);
+    assert(query);
+    assert(selection);
+    const AlliedDarkLibraryOptions_t *o = &(library->opts);
+    AlliedDarkSelection_t sel = {.dark = {-1, -1}, .bias = -1};
+    *selection = sel;
+    if (!(query->exposure_us > 0))
+    {
+        return VmbErrorBadParameter;
+    }
+    AlliedDarkCandidate_s near = {.index = -1}, lower = {.index = -1}, upper = {.index = -1};
+    AlliedDarkCandidate_s lower2 = {.index = -1}, upper2 = {.index = -1}; // next closest on each side, at another temperature
+    double bias_dt = INFINITY, exposure[3] = {0};
+    pthread_rwlock_rdlock(&(library->lock));
+    for (VmbUint32_t i = 0; i < library->count; i++)
+    {
+        const AlliedMaster_t *e = library->entries[i];
+        if (e->kind != AlliedMasterBias || !allied_dark_same_geometry(&(e->geometry), &(query->geometry)) ||
+            fabs(e->gain_db - query->gain_db) > o->gain_tolerance)
+        {
+            continue;
+        }
+        double dt = fabs(allied_dark_dt(e->temperature, query->temperature));
+        if (dt < bias_dt)
+        {
+            bias_dt = dt;
+            sel.bias = (VmbInt32_t)i;
+        }
+    }
+    for (VmbUint32_t i = 0; i < library->count; i++)
+    {
+        const AlliedMaster_t *e = library->entries[i];
+        if (e->kind != AlliedMasterDark || !allied_dark_same_geometry(&(e->geometry), &(query->geometry)) ||
+            fabs(e->gain_db - query->gain_db) > o->gain_tolerance)
+        {
+            continue;
+        }
+        bool same_exposure = fabs(e->exposure_us - query->exposure_us) <= o->exposure_tolerance * query->exposure_us;
+        // without a bias, the dark current can not be told from the offset, and is not scaled
+        if (sel.bias < 0 && !same_exposure)
+        {
+            continue;
+        }
+        AlliedDarkCandidate_s c = {
+            .index = (VmbInt32_t)i,
+            .dt = allied_dark_dt(e->temperature, query->temperature),
+            .de = same_exposure ? 0 : fabs(log(e->exposure_us / query->exposure_us)),
+        };
+        AlliedDarkCandidate_s *side = fabs(c.dt) <= o->temperature_tolerance ? &near : (c.dt < 0 ? &lower : &upper);
+        AlliedDarkCandidate_s *second = side == &lower ? &lower2 : side == &upper ? &upper2 : NULL;
+        if (allied_dark_closer(&c, side, side == &near ? INFINITY : o->temperature_tolerance))
+        {
+            if (second != NULL && side->index >= 0 && fabs(side->dt - c.dt) > o->temperature_tolerance)
+            {
+                *second = *side;
+            }
+            *side = c;
+        }
+        else if (second != NULL && fabs(side->dt - c.dt) > o->temperature_tolerance && allied_dark_closer(&c, second, o->temperature_tolerance))
+        {
+            *second = c;
+        }
+    }
+    // exposure times are read under the lock, the entries themselves do not move
+    const AlliedDarkCandidate_s *picked[3] = {&near, &lower, &upper};
+    for (int k = 0; k < 3; k++)
+    {
+        if (picked[k]->index >= 0)
+        {
+            exposure[k] = library->entries[picked[k]->index]->exposure_us;
+        }
+    }
+    pthread_rwlock_unlock(&(library->lock));
+    // the dark current of a dark is scaled to the requested exposure time if there is a bias to take it from
+    double t = query->exposure_us;
+    bool bias = sel.bias >= 0;
+    double D = o->doubling_temperature;
+    if (near.index >= 0)
+    {
+        sel.dark[0] = near.index;
+        sel.exact = near.de == 0;
+        sel.coeff[0] = sel.exact || !bias ? 1 : t / exposure[0];
+    }
+    else if (lower.index >= 0 && upper.index >= 0)
+    {
+        // dark current doubling every D degrees is matched exactly at both ends and in between
+        double w = (exp2(-lower.dt / D) - 1) / (exp2((upper.dt - lower.dt) / D) - 1);
+        sel.dark[0] = lower.index;
+        sel.dark[1] = upper.index;
+        sel.coeff[0] = (1 - w) * (bias ? t / exposure[1] : 1);
+        sel.coeff[1] = w * (bias ? t / exposure[2] : 1);
+    }
+    else if (lower.index >= 0 || upper.index >= 0)
+    {
+        const AlliedDarkCandidate_s *c = lower.index >= 0 ? &lower : &upper;
+        const AlliedDarkCandidate_s *c2 = lower.index >= 0 ? &lower2 : &upper2;
+        sel.dark[0] = c->index;
+        sel.extrapolated = true;
+        if (bias)
+        {
+            sel.coeff[0] = t / exposure[lower.index >= 0 ? 1 : 2] * exp2(-c->dt / D);
+        }
+        else if (c2->index >= 0)
+        {
+            // without a bias the offset is unknown, two darks fix both the offset and the dark current: the blend of the interpolation,
+            // with weights past [0, 1], still sums to 1 and follows the doubling law
+            double w = (exp2(-c->dt / D) - 1) / (exp2((c2->dt - c->dt) / D) - 1);
+            sel.dark[1] = c2->index;
+            sel.coeff[0] = 1 - w;
+            sel.coeff[1] = w;
+        }
+        else
+        {
+            // a single dark without a bias can not be scaled
+            sel.coeff[0] = 1;
+        }
+    }
+    else
+    {
+        return VmbErrorNotFound;
+    }
+    if (sel.exact || !bias || (sel.coeff[0] == 1 && sel.dark[1] < 0))
+    {
+        // the darks carry the offset themselves
+        sel.bias = -1;
+        sel.bias_coeff = 0;
+    }
+    else
+    {
+        sel.bias_coeff = 1 - sel.coeff[0] - sel.coeff[1];
+    }
+    *selection = sel;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_dark_library_build(AlliedDarkLibrary_t library, const AlliedDarkQuery_t *query, const AlliedDarkSelection_t *selection, AlliedMaster_t *dark)
+{
+    assert(library);
+    assert(query);
+    assert(selection);
+    assert(dark);
+    const AlliedMaster_t *src[3] = {NULL};
+    VmbInt32_t indices[3] = {selection->dark[0], selection->dark[1], selection->bias};
+    AlliedMasterKind_t kinds[3] = {AlliedMasterDark, AlliedMasterDark, AlliedMasterBias};
+    bool valid = indices[0] >= 0;
+    pthread_rwlock_rdlock(&(library->lock));
+    for (int k = 0; k < 3 && valid; k++)
+    {
+        if (indices[k] < 0)
+        {
+            continue;
+        }
+        valid = (VmbUint32_t)indices[k] < library->count;
+        if (valid)
+        {
+            src[k] = library->entries[indices[k]];
+            valid = src[k]->kind == kinds[k] && allied_dark_same_geometry(&(src[k]->geometry), &(query->geometry));
+        }
+    }
+    pthread_rwlock_unlock(&(library->lock));
+    if (!valid)
+    {
+        return VmbErrorBadParameter;
+    }
+    size_t count = (size_t)query->geometry.width * query->geometry.height;
+    float *data = (float *)malloc(count * sizeof(float));
+    if (data == NULL)
+    {
+        return VmbErrorResources;
+    }
+    const float *d0 = src[0]->data;
+    float c0 = (float)selection->coeff[0];
+    if (src[1] == NULL && src[2] == NULL)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            data[i] = c0 * d0[i];
+        }
+    }
+    else
+    {
+        // absent terms read the first dark with a zero coefficient
+        const float *d1 = src[1] == NULL ? d0 : src[1]->data;
+        const float *b = src[2] == NULL ? d0 : src[2]->data;
+        float c1 = src[1] == NULL ? 0.0f : (float)selection->coeff[1];
+        float cb = src[2] == NULL ? 0.0f : (float)selection->bias_coeff;
+        for (size_t i = 0; i < count; i++)
+        {
+            data[i] = c0 * d0[i] + c1 * d1[i] + cb * b[i];
+        }
+    }
+    memset(dark, 0, sizeof(*dark));
+    dark->kind = AlliedMasterDark;
+    dark->geometry = query->geometry;
+    dark->exposure_us = query->exposure_us;
+    dark->gain_db = query->gain_db;
+    dark->temperature = query->temperature;
+    dark->frames = src[0]->frames + (src[1] == NULL ? 0 : src[1]->frames);
+    dark->data = data;
+    return VmbErrorSuccess;
+}
+
+bool allied_dark_library_equivalent(AlliedDarkLibrary_t library, const AlliedDarkQuery_t *a, const AlliedDarkQuery_t *b)
+{
+    assert(library);
+    assert(a);
+    assert(b);
+    const AlliedDarkLibraryOptions_t *o = &(library->opts);
+    if (!allied_dark_same_geometry(&(a->geometry), &(b->geometry)) || fabs(a->gain_db - b->gain_db) > o->gain_tolerance ||
+        fabs(a->exposure_us - b->exposure_us) > o->exposure_tolerance * fmax(a->exposure_us, b->exposure_us))
+    {
+        return false;
+    }
+    if (isfinite(a->temperature) != isfinite(b->temperature))
+    {
+        return false;
+    }
+    return !isfinite(a->temperature) || fabs(a->temperature - b->temperature) <= o->temperature_tolerance;
+}
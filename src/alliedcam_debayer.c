@@ -0,0 +1,525 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_debayer.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Native debayering of Bayer images for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details Every source row is widened once to 32 bits in a small ring of rows, with two mirrored pixels on each side, so the
+ * interpolation loops have no border cases. A row is interpolated into three color planes, which are then stored interleaved,
+ * optionally through the fused white balance and color matrix. The loops are written once and instantiated for every CPU
+ * level; this file is built with -O3 so the compiler vectorizes each copy (see the Makefile).
+ */
+
+#include "alliedcam_debayer.h"
+#include "alliedcam_kernels.h"
+#include "alliedcam_dispatch.h"
+#include "alliedcam_pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+
+#define ALLIED_DEBAYER_PAD 2         // Mirrored pixels on each side of a widened row.
+#define ALLIED_DEBAYER_RAW_ROWS 5    // Widened source rows kept around the current row.
+#define ALLIED_DEBAYER_GREEN_ROWS 3  // Interpolated green rows kept around the current row.
+#define ALLIED_DEBAYER_DEPTHS 4      // 8, 10, 12 and 16 bits.
+
+typedef void (*AlliedDebayerConvertKernel)(const void *src, VmbUint32_t width, VmbInt32_t *dst);
+typedef void (*AlliedDebayerStoreKernel)(const VmbInt32_t *r, const VmbInt32_t *g, const VmbInt32_t *b, VmbUint32_t width, const float *ccm, void *dst);
+typedef void (*AlliedDebayerBilinearKernel)(const VmbInt32_t *a, const VmbInt32_t *c, const VmbInt32_t *b, VmbUint32_t width, VmbUint32_t cx,
+                                            VmbInt32_t *same, VmbInt32_t *green, VmbInt32_t *other);
+typedef void (*AlliedDebayerGreenKernel)(const VmbInt32_t *aa, const VmbInt32_t *a, const VmbInt32_t *c, const VmbInt32_t *b, const VmbInt32_t *bb,
+                                         VmbUint32_t width, VmbUint32_t cx, VmbInt32_t maxval, VmbInt32_t *green);
+typedef void (*AlliedDebayerChromaKernel)(const VmbInt32_t *a, const VmbInt32_t *c, const VmbInt32_t *b, const VmbInt32_t *ga, const VmbInt32_t *gc,
+                                          const VmbInt32_t *gb, VmbUint32_t width, VmbUint32_t cx, VmbInt32_t maxval, VmbInt32_t *same, VmbInt32_t *other);
+
+/**
+ * @brief Debayering kernels of a CPU level.
+ *
+ */
+typedef struct
+{
+    AlliedDebayerConvertKernel convert[ALLIED_DEBAYER_DEPTHS]; // Widen a source row, and mirror its borders.
+    AlliedDebayerStoreKernel store[ALLIED_DEBAYER_DEPTHS];     // Store three color planes interleaved.
+    AlliedDebayerBilinearKernel bilinear;                      // Bilinear interpolation of a row.
+    AlliedDebayerGreenKernel green;                            // Edge-aware green interpolation of a row.
+    AlliedDebayerChromaKernel chroma;                          // Color difference interpolation of red and blue of a row.
+} AlliedDebayerKernels_s;
+
+#define ALLIED_CLAMP(v, hi) ((v) < 0 ? 0 : (v) > (hi) ? (hi) : (v))
+#define ALLIED_ABS(v) ((v) < 0 ? -(v) : (v))
+
+// Pixel x of a row whose own color (red or blue) sits at the chroma sites, the other color in the rows above and below.
+#define ALLIED_BILINEAR_CHROMA(x)                            \
+    same[x] = c[x];                                          \
+    green[x] = (c[x - 1] + c[x + 1] + a[x] + b[x] + 2) >> 2; \
+    other[x] = (a[x - 1] + a[x + 1] + b[x - 1] + b[x + 1] + 2) >> 2;
+#define ALLIED_BILINEAR_GREEN(x)              \
+    green[x] = c[x];                          \
+    same[x] = (c[x - 1] + c[x + 1] + 1) >> 1; \
+    other[x] = (a[x] + b[x] + 1) >> 1;
+
+#define ALLIED_EDGE_GREEN(x)                                                 \
+    {                                                                        \
+        VmbInt32_t lap_h = 2 * c[x] - c[x - 2] - c[x + 2];                   \
+        VmbInt32_t lap_v = 2 * c[x] - aa[x] - bb[x];                         \
+        VmbInt32_t dh = ALLIED_ABS(c[x - 1] - c[x + 1]) + ALLIED_ABS(lap_h); \
+        VmbInt32_t dv = ALLIED_ABS(a[x] - b[x]) + ALLIED_ABS(lap_v);         \
+        VmbInt32_t gh = 2 * (c[x - 1] + c[x + 1]) + lap_h;                   \
+        VmbInt32_t gv = 2 * (a[x] + b[x]) + lap_v;                           \
+        VmbInt32_t g = dh < dv ? 2 * gh : dv < dh ? 2 * gv : gh + gv;        \
+        g = (g + 4) >> 3;                                                    \
+        green[x] = ALLIED_CLAMP(g, maxval);                                  \
+    }                                                                        \
+    green[x + 1] = c[x + 1];
+
+#define ALLIED_CHROMA_CHROMA(x)                                                                                              \
+    {                                                                                                                        \
+        VmbInt32_t d = (a[x - 1] - ga[x - 1] + a[x + 1] - ga[x + 1] + b[x - 1] - gb[x - 1] + b[x + 1] - gb[x + 1] + 2) >> 2; \
+        VmbInt32_t o = gc[x] + d;                                                                                            \
+        same[x] = c[x];                                                                                                      \
+        other[x] = ALLIED_CLAMP(o, maxval);                                                                                  \
+    }
+#define ALLIED_CHROMA_GREEN(x)                                                           \
+    {                                                                                    \
+        VmbInt32_t s = gc[x] + ((c[x - 1] - gc[x - 1] + c[x + 1] - gc[x + 1] + 1) >> 1); \
+        VmbInt32_t o = gc[x] + ((a[x] - ga[x] + b[x] - gb[x] + 1) >> 1);                 \
+        same[x] = ALLIED_CLAMP(s, maxval);                                               \
+        other[x] = ALLIED_CLAMP(o, maxval);                                              \
+    }
+
+/**
+ * @brief Instantiate the interpolation kernels of a CPU level. Rows are widened and mirrored, `cx` is the column of the first chroma site.
+ *
+ */
+#define ALLIED_DEBAYER_INTERPOLATE(LEVEL, TARGET)                                                                                                 \
+    TARGET static void allied_debayer_bilinear_##LEVEL(const VmbInt32_t *restrict a, const VmbInt32_t *restrict c, const VmbInt32_t *restrict b,  \
+                                                       VmbUint32_t width, VmbUint32_t cx,                                                         \
+                                                       VmbInt32_t *restrict same, VmbInt32_t *restrict green, VmbInt32_t *restrict other)         \
+    {                                                                                                                                             \
+        if (cx == 0)                                                                                                                              \
+        {                                                                                                                                         \
+            for (int x = 0; x < (int)width; x += 2)                                                                                               \
+            {                                                                                                                                     \
+                ALLIED_BILINEAR_CHROMA(x)                                                                                                         \
+                ALLIED_BILINEAR_GREEN(x + 1)                                                                                                      \
+            }                                                                                                                                     \
+        }                                                                                                                                         \
+        else                                                                                                                                      \
+        {                                                                                                                                         \
+            for (int x = 0; x < (int)width; x += 2)                                                                                               \
+            {                                                                                                                                     \
+                ALLIED_BILINEAR_GREEN(x)                                                                                                          \
+                ALLIED_BILINEAR_CHROMA(x + 1)                                                                                                     \
+            }                                                                                                                                     \
+        }                                                                                                                                         \
+    }                                                                                                                                             \
+                                                                                                                                                  \
+    TARGET static void allied_debayer_green_##LEVEL(const VmbInt32_t *restrict aa, const VmbInt32_t *restrict a, const VmbInt32_t *restrict c,    \
+                                                    const VmbInt32_t *restrict b, const VmbInt32_t *restrict bb, VmbUint32_t width,               \
+                                                    VmbUint32_t cx, VmbInt32_t maxval, VmbInt32_t *restrict green)                                \
+    {                                                                                                                                             \
+        if (cx == 0)                                                                                                                              \
+        {                                                                                                                                         \
+            for (int x = 0; x < (int)width; x += 2)                                                                                               \
+            {                                                                                                                                     \
+                ALLIED_EDGE_GREEN(x)                                                                                                              \
+            }                                                                                                                                     \
+        }                                                                                                                                         \
+        else                                                                                                                                      \
+        {                                                                                                                                         \
+            green[0] = c[0];                                                                                                                      \
+            for (int x = 1; x < (int)width; x += 2)                                                                                               \
+            {                                                                                                                                     \
+                ALLIED_EDGE_GREEN(x)                                                                                                              \
+            }                                                                                                                                     \
+        }                                                                                                                                         \
+        /* mirror the borders, over the green pixel stored past the end of a row starting with green */                                           \
+        green[-1] = green[1];                                                                                                                     \
+        green[width] = green[width - 2];                                                                                                          \
+    }                                                                                                                                             \
+                                                                                                                                                  \
+    TARGET static void allied_debayer_chroma_##LEVEL(const VmbInt32_t *restrict a, const VmbInt32_t *restrict c, const VmbInt32_t *restrict b,    \
+                                                     const VmbInt32_t *restrict ga, const VmbInt32_t *restrict gc, const VmbInt32_t *restrict gb, \
+                                                     VmbUint32_t width, VmbUint32_t cx, VmbInt32_t maxval,                                        \
+                                                     VmbInt32_t *restrict same, VmbInt32_t *restrict other)                                       \
+    {                                                                                                                                             \
+        if (cx == 0)                                                                                                                              \
+        {                                                                                                                                         \
+            for (int x = 0; x < (int)width; x += 2)                                                                                               \
+            {                                                                                                                                     \
+                ALLIED_CHROMA_CHROMA(x)                                                                                                           \
+                ALLIED_CHROMA_GREEN(x + 1)                                                                                                        \
+            }                                                                                                                                     \
+        }                                                                                                                                         \
+        else                                                                                                                                      \
+        {                                                                                                                                         \
+            for (int x = 0; x < (int)width; x += 2)                                                                                               \
+            {                                                                                                                                     \
+                ALLIED_CHROMA_GREEN(x)                                                                                                            \
+                ALLIED_CHROMA_CHROMA(x + 1)                                                                                                       \
+            }                                                                                                                                     \
+        }                                                                                                                                         \
+    }
+
+/**
+ * @brief Instantiate the row conversion kernels of a pixel type and bit depth for a CPU level.
+ *
+ */
+#define ALLIED_DEBAYER_PIXELS(NAME, TARGET, T, BITS)                                                                                         \
+    TARGET static void allied_debayer_convert_##NAME(const void *src, VmbUint32_t width, VmbInt32_t *restrict dst)                           \
+    {                                                                                                                                        \
+        const T *s = (const T *)src;                                                                                                         \
+        for (size_t x = 0; x < width; x++)                                                                                                   \
+        {                                                                                                                                    \
+            dst[x] = s[x];                                                                                                                   \
+        }                                                                                                                                    \
+        dst[-1] = s[1];                                                                                                                      \
+        dst[-2] = s[2];                                                                                                                      \
+        dst[width] = s[width - 2];                                                                                                           \
+        dst[width + 1] = s[width - 3];                                                                                                       \
+    }                                                                                                                                        \
+                                                                                                                                             \
+    TARGET static void allied_debayer_store_##NAME(const VmbInt32_t *restrict r, const VmbInt32_t *restrict g, const VmbInt32_t *restrict b, \
+                                                   VmbUint32_t width, const float *restrict ccm, void *dst)                                  \
+    {                                                                                                                                        \
+        T *restrict d = (T *)dst;                                                                                                            \
+        if (ccm == NULL)                                                                                                                     \
+        {                                                                                                                                    \
+            for (size_t x = 0; x < width; x++)                                                                                               \
+            {                                                                                                                                \
+                d[3 * x] = (T)r[x];                                                                                                          \
+                d[3 * x + 1] = (T)g[x];                                                                                                      \
+                d[3 * x + 2] = (T)b[x];                                                                                                      \
+            }                                                                                                                                \
+            return;                                                                                                                          \
+        }                                                                                                                                    \
+        const float m0 = ccm[0], m1 = ccm[1], m2 = ccm[2], m3 = ccm[3], m4 = ccm[4], m5 = ccm[5];                                            \
+        const float m6 = ccm[6], m7 = ccm[7], m8 = ccm[8];                                                                                   \
+        const VmbInt32_t hi = (VmbInt32_t)((1u << (BITS)) - 1);                                                                              \
+        for (size_t x = 0; x < width; x++)                                                                                                   \
+        {                                                                                                                                    \
+            float rf = (float)r[x], gf = (float)g[x], bf = (float)b[x];                                                                      \
+            VmbInt32_t o0 = (VmbInt32_t)(m0 * rf + m1 * gf + m2 * bf + 0.5f);                                                                \
+            VmbInt32_t o1 = (VmbInt32_t)(m3 * rf + m4 * gf + m5 * bf + 0.5f);                                                                \
+            VmbInt32_t o2 = (VmbInt32_t)(m6 * rf + m7 * gf + m8 * bf + 0.5f);                                                                \
+            d[3 * x] = (T)ALLIED_CLAMP(o0, hi);                                                                                              \
+            d[3 * x + 1] = (T)ALLIED_CLAMP(o1, hi);                                                                                          \
+            d[3 * x + 2] = (T)ALLIED_CLAMP(o2, hi);                                                                                          \
+        }                                                                                                                                    \
+    }
+
+#define ALLIED_DEBAYER_LEVEL(LEVEL, TARGET)                    \
+    ALLIED_DEBAYER_INTERPOLATE(LEVEL, TARGET)                  \
+    ALLIED_DEBAYER_PIXELS(8_##LEVEL, TARGET, VmbUint8_t, 8)    \
+    ALLIED_DEBAYER_PIXELS(10_##LEVEL, TARGET, VmbUint16_t, 10) \
+    ALLIED_DEBAYER_PIXELS(12_##LEVEL, TARGET, VmbUint16_t, 12) \
+    ALLIED_DEBAYER_PIXELS(16_##LEVEL, TARGET, VmbUint16_t, 16) \
+    static const AlliedDebayerKernels_s debayer_##LEVEL = {    \
+        .convert = {                                           \
+            &allied_debayer_convert_8_##LEVEL,                 \
+            &allied_debayer_convert_10_##LEVEL,                \
+            &allied_debayer_convert_12_##LEVEL,                \
+            &allied_debayer_convert_16_##LEVEL,                \
+        },                                                     \
+        .store = {                                             \
+            &allied_debayer_store_8_##LEVEL,                   \
+            &allied_debayer_store_10_##LEVEL,                  \
+            &allied_debayer_store_12_##LEVEL,                  \
+            &allied_debayer_store_16_##LEVEL,                  \
+        },                                                     \
+        .bilinear = &allied_debayer_bilinear_##LEVEL,          \
+        .green = &allied_debayer_green_##LEVEL,                \
+        .chroma = &allied_debayer_chroma_##LEVEL,              \
+    };
+
+ALLIED_KERNEL_LEVELS(ALLIED_DEBAYER_LEVEL)
+
+static const AlliedDebayerKernels_s *debayer_kernels = &debayer_scalar;
+
+ALLIED_KERNEL_BINDER(allied_debayer_bind, debayer_kernels, &debayer)
+
+typedef struct
+{
+    const AlliedDebayerKernels_s *kernels;   // Kernels of the bound CPU level.
+    VmbUint32_t depth;                       // Index of the bit depth in the kernel tables.
+    const VmbUchar_t *src;                   // First source row.
+    size_t src_stride;                       // Bytes between source rows.
+    VmbUchar_t *dst;                         // First destination row.
+    size_t dst_stride;                       // Bytes between destination rows.
+    VmbUint32_t width;                       // Width in pixels.
+    VmbUint32_t height;                      // Height in pixels.
+    VmbUint32_t red_row;                     // Parity of the rows with red pixels.
+    VmbUint32_t red_col;                     // Parity of the columns with red pixels.
+    VmbInt32_t maxval;                       // Maximum pixel value.
+    AlliedDebayerMethod_t method;            // Interpolation method.
+    bool bgr;                                // Store BGR.
+    const float *ccm;                        // Fused white balance and color matrix, NULL for none.
+    VmbUint32_t bands;                       // Number of bands.
+    VmbError_t err[ALLIED_POOL_MAX_THREADS]; // Result of every task.
+} AlliedDebayerJob_s;
+
+/**
+ * @brief Row memory of a task. Rows are tagged with the (unmirrored) source row they hold.
+ *
+ */
+typedef struct
+{
+    VmbInt32_t *raw[ALLIED_DEBAYER_RAW_ROWS];        // Widened source rows.
+    VmbInt32_t raw_tag[ALLIED_DEBAYER_RAW_ROWS];     // Row held by every slot.
+    VmbInt32_t *green[ALLIED_DEBAYER_GREEN_ROWS];    // Interpolated green rows.
+    VmbInt32_t green_tag[ALLIED_DEBAYER_GREEN_ROWS]; // Row held by every slot.
+    VmbInt32_t *planes[3];                           // Interpolated row: own chroma, green, other chroma.
+} AlliedDebayerRows_s;
+
+static inline VmbUint32_t allied_debayer_mirror(VmbInt32_t k, VmbUint32_t n)
+{
+    return k < 0 ? (VmbUint32_t)-k : (VmbUint32_t)k >= n ? (VmbUint32_t)(2 * (VmbInt32_t)n - 2 - k) : (VmbUint32_t)k;
+}
+
+static const VmbInt32_t *allied_debayer_raw(const AlliedDebayerJob_s *job, AlliedDebayerRows_s *rows, VmbInt32_t k)
+{
+    VmbUint32_t slot = (VmbUint32_t)(k + 2 * ALLIED_DEBAYER_RAW_ROWS) % ALLIED_DEBAYER_RAW_ROWS;
+    if (rows->raw_tag[slot] != k)
+    {
+        const VmbUchar_t *src = job->src + allied_debayer_mirror(k, job->height) * job->src_stride;
+        job->kernels->convert[job->depth](src, job->width, rows->raw[slot]);
+        rows->raw_tag[slot] = k;
+    }
+    return rows->raw[slot];
+}
+
+/**
+ * @brief Column of the first chroma site of a row, and whether the row holds red.
+ *
+ */
+static inline VmbUint32_t allied_debayer_cx(const AlliedDebayerJob_s *job, VmbInt32_t k, bool *red)
+{
+    *red = (VmbUint32_t)(k & 1) == job->red_row;
+    return *red ? job->red_col : 1 - job->red_col;
+}
+
+static const VmbInt32_t *allied_debayer_green(const AlliedDebayerJob_s *job, AlliedDebayerRows_s *rows, VmbInt32_t k)
+{
+    VmbUint32_t slot = (VmbUint32_t)(k + 2 * ALLIED_DEBAYER_GREEN_ROWS) % ALLIED_DEBAYER_GREEN_ROWS;
+    if (rows->green_tag[slot] != k)
+    {
+        const VmbInt32_t *aa = allied_debayer_raw(job, rows, k - 2);
+        const VmbInt32_t *a = allied_debayer_raw(job, rows, k - 1);
+        const VmbInt32_t *c = allied_debayer_raw(job, rows, k);
+        const VmbInt32_t *b = allied_debayer_raw(job, rows, k + 1);
+        const VmbInt32_t *bb = allied_debayer_raw(job, rows, k + 2);
+        bool red;
+        VmbUint32_t cx = allied_debayer_cx(job, k, &red);
+        job->kernels->green(aa, a, c, b, bb, job->width, cx, job->maxval, rows->green[slot]);
+        rows->green_tag[slot] = k;
+    }
+    return rows->green[slot];
+}
+
+static void allied_debayer_row(const AlliedDebayerJob_s *job, AlliedDebayerRows_s *rows, VmbInt32_t y)
+{
+    const AlliedDebayerKernels_s *kernels = job->kernels;
+    bool red;
+    VmbUint32_t cx = allied_debayer_cx(job, y, &red);
+    VmbInt32_t *same = rows->planes[0];
+    const VmbInt32_t *green = rows->planes[1];
+    VmbInt32_t *other = rows->planes[2];
+    if (job->method == AlliedDebayerEdgeAware)
+    {
+        const VmbInt32_t *ga = allied_debayer_green(job, rows, y - 1);
+        const VmbInt32_t *gc = allied_debayer_green(job, rows, y);
+        const VmbInt32_t *gb = allied_debayer_green(job, rows, y + 1);
+        const VmbInt32_t *a = allied_debayer_raw(job, rows, y - 1);
+        const VmbInt32_t *c = allied_debayer_raw(job, rows, y);
+        const VmbInt32_t *b = allied_debayer_raw(job, rows, y + 1);
+        kernels->chroma(a, c, b, ga, gc, gb, job->width, cx, job->maxval, same, other);
+        green = gc;
+    }
+    else
+    {
+        const VmbInt32_t *a = allied_debayer_raw(job, rows, y - 1);
+        const VmbInt32_t *c = allied_debayer_raw(job, rows, y);
+        const VmbInt32_t *b = allied_debayer_raw(job, rows, y + 1);
+        kernels->bilinear(a, c, b, job->width, cx, same, rows->planes[1], other);
+    }
+    const VmbInt32_t *r = red ? same : other;
+    const VmbInt32_t *b = red ? other : same;
+    if (job->bgr)
+    {
+        const VmbInt32_t *t = r;
+        r = b;
+        b = t;
+    }
+    kernels->store[job->depth](r, green, b, job->width, job->ccm, job->dst + (size_t)y * job->dst_stride);
+}
+
+static void allied_debayer_task(void *arg, VmbUint32_t index, VmbUint32_t count)
+{
+    AlliedDebayerJob_s *job = (AlliedDebayerJob_s *)arg;
+    size_t padded = job->width + 2 * ALLIED_DEBAYER_PAD;
+    VmbInt32_t *mem = malloc(sizeof(VmbInt32_t) * (padded * (ALLIED_DEBAYER_RAW_ROWS + ALLIED_DEBAYER_GREEN_ROWS) + 3 * (size_t)job->width));
+    if (mem == NULL)
+    {
+        job->err[index] = VmbErrorResources;
+        return;
+    }
+    AlliedDebayerRows_s rows;
+    VmbInt32_t *next = mem;
+    for (int i = 0; i < ALLIED_DEBAYER_RAW_ROWS; i++, next += padded)
+    {
+        rows.raw[i] = next + ALLIED_DEBAYER_PAD;
+        rows.raw_tag[i] = INT_MIN;
+    }
+    for (int i = 0; i < ALLIED_DEBAYER_GREEN_ROWS; i++, next += padded)
+    {
+        rows.green[i] = next + ALLIED_DEBAYER_PAD;
+        rows.green_tag[i] = INT_MIN;
+    }
+    for (int i = 0; i < 3; i++, next += job->width)
+    {
+        rows.planes[i] = next;
+    }
+    VmbUint32_t first = job->bands * index / count;
+    VmbUint32_t last = job->bands * (index + 1) / count;
+    VmbUint32_t y1 = last * ALLIED_DEBAYER_BAND_ROWS < job->height ? last * ALLIED_DEBAYER_BAND_ROWS : job->height;
+    for (VmbUint32_t y = first * ALLIED_DEBAYER_BAND_ROWS; y < y1; y++)
+    {
+        allied_debayer_row(job, &rows, (VmbInt32_t)y);
+    }
+    free(mem);
+    job->err[index] = VmbErrorSuccess;
+}
+
+/**
+ * @brief Phase of a Bayer pixel format: parity of the red rows and columns.
+ *
+ */
+static bool allied_debayer_phase(VmbPixelFormat_t format, VmbUint32_t *red_row, VmbUint32_t *red_col)
+{
+    switch (format)
+    {
+    case VmbPixelFormatBayerRG8:
+    case VmbPixelFormatBayerRG10:
+    case VmbPixelFormatBayerRG12:
+    case VmbPixelFormatBayerRG16:
+        *red_row = 0;
+        *red_col = 0;
+        return true;
+    case VmbPixelFormatBayerGR8:
+    case VmbPixelFormatBayerGR10:
+    case VmbPixelFormatBayerGR12:
+    case VmbPixelFormatBayerGR16:
+        *red_row = 0;
+        *red_col = 1;
+        return true;
+    case VmbPixelFormatBayerGB8:
+    case VmbPixelFormatBayerGB10:
+    case VmbPixelFormatBayerGB12:
+    case VmbPixelFormatBayerGB16:
+        *red_row = 1;
+        *red_col = 0;
+        return true;
+    case VmbPixelFormatBayerBG8:
+    case VmbPixelFormatBayerBG10:
+    case VmbPixelFormatBayerBG12:
+    case VmbPixelFormatBayerBG16:
+        *red_row = 1;
+        *red_col = 1;
+        return true;
+    default:
+        return false;
+    }
+}
+
+VmbPixelFormat_t allied_debayer_format(VmbPixelFormat_t format, bool bgr)
+{
+    VmbUint32_t red_row, red_col;
+    if (!allied_debayer_phase(format, &red_row, &red_col))
+    {
+        return 0;
+    }
+    switch (allied_image_bits(format))
+    {
+    case 8:
+        return bgr ? VmbPixelFormatBgr8 : VmbPixelFormatRgb8;
+    case 10:
+        return bgr ? VmbPixelFormatBgr10 : VmbPixelFormatRgb10;
+    case 12:
+        return bgr ? VmbPixelFormatBgr12 : VmbPixelFormatRgb12;
+    default:
+        return bgr ? VmbPixelFormatBgr16 : VmbPixelFormatRgb16;
+    }
+}
+
+VmbError_t allied_debayer(const AlliedImage_t *src, AlliedImage_t *dst, const AlliedDebayerOptions_t *opts)
+{
+    assert(src);
+    assert(dst);
+    allied_dispatch_init();
+    const AlliedDebayerOptions_t defaults = {.method = AlliedDebayerBilinear};
+    opts = opts != NULL ? opts : &defaults;
+    AlliedDebayerJob_s job = {
+        .kernels = debayer_kernels,
+        .width = src->width,
+        .height = src->height,
+        .method = opts->method,
+        .bgr = opts->bgr,
+    };
+    const AlliedImageKernels_s *kernels = allied_image_kernels(src->format);
+    if (kernels == NULL || !allied_debayer_phase(src->format, &job.red_row, &job.red_col))
+    {
+        return VmbErrorNotSupported;
+    }
+    if (src->data == NULL || dst->data == NULL || src->width < 4 || src->height < 4 || (src->width | src->height) & 1 ||
+        opts->method > AlliedDebayerEdgeAware)
+    {
+        return VmbErrorBadParameter;
+    }
+    size_t src_row = (size_t)src->width * kernels->pixel_size;
+    size_t dst_row = 3 * src_row;
+    job.src_stride = src->stride == 0 ? src_row : src->stride;
+    job.dst_stride = dst->stride == 0 ? dst_row : dst->stride;
+    if (job.src_stride < src_row || job.dst_stride < dst_row)
+    {
+        return VmbErrorBadParameter;
+    }
+    job.src = (const VmbUchar_t *)src->data;
+    job.dst = (VmbUchar_t *)dst->data;
+    job.maxval = (VmbInt32_t)((1u << kernels->bits) - 1);
+    job.depth = kernels->bits == 8 ? 0 : kernels->bits == 10 ? 1 : kernels->bits == 12 ? 2 : 3;
+    float ccm[9];
+    if (opts->color_correction)
+    {
+        // white balance folded into the columns of the matrix
+        for (int i = 0; i < 9; i++)
+        {
+            ccm[i] = opts->matrix[i] * opts->white_balance[i % 3];
+        }
+        job.ccm = ccm;
+    }
+    job.bands = (src->height + ALLIED_DEBAYER_BAND_ROWS - 1) / ALLIED_DEBAYER_BAND_ROWS;
+    VmbUint32_t threads = 1;
+    if (opts->threads > 1)
+    {
+        threads = allied_pool_threads(opts->threads);
+        threads = job.bands < threads ? job.bands : threads;
+    }
+    allied_pool_run(threads, &allied_debayer_task, &job);
+    for (VmbUint32_t i = 0; i < threads; i++)
+    {
+        if (job.err[i] != VmbErrorSuccess)
+        {
+            return job.err[i];
+        }
+    }
+    dst->width = src->width;
+    dst->height = src->height;
+    dst->format = allied_debayer_format(src->format, opts->bgr);
+    return VmbErrorSuccess;
+}
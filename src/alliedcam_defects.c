@@ -0,0 +1,760 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_defects.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Defective pixel detection and correction.
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details Pixel positions are packed as `y << 16 | x`, so that sorting the packed positions sorts the defects in row order. A map keeps the
+ * positions and the neighbours of its defects in blocks of {@link ALLIED_DEFECT_LANES}, neighbour-major, so that the correction kernel
+ * gathers one neighbour of every defect of a block at a time, and runs the sorting network on whole vectors of defects (this file is built
+ * with -O3, see the Makefile). The last block is padded with copies of the last defect, which are corrected to the same value.
+ *
+ * The detector keeps the running median and MAD of every pixel. The first pass seeds the medians, the second the deviations, and later passes
+ * move each estimate by a step that grows with the deviation, towards the new sample. A count of samples in a row equal to the median tells
+ * frozen pixels apart from noisy ones whose MAD estimate happens to be small. Detection of a band of rows runs once the band below
+ * it has been sampled, so that every neighbour has been sampled in the same pass.
+ */
+
+#include "alliedcam_defects.h"
+#include "alliedcam_kernels.h"
+#include "alliedcam_dispatch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+/**
+ * @brief Defects corrected together by the correction kernel.
+ *
+ */
+#define ALLIED_DEFECT_LANES 16
+
+/**
+ * @brief Neighbours of a defect.
+ *
+ */
+#define ALLIED_DEFECT_NEIGHBOURS 8
+
+/**
+ * @brief Samples in a row equal to the running median after which a pixel is frozen. Noise makes a long run unlikely.
+ *
+ */
+#define ALLIED_DEFECT_FROZEN 8
+
+#define ALLIED_DEFECT_POS(x, y) ((VmbUint32_t)(y) << 16 | (VmbUint32_t)(x))
+#define ALLIED_DEFECT_X(pos) ((pos) & 0xffffu)
+#define ALLIED_DEFECT_Y(pos) ((pos) >> 16)
+
+struct allied_defect_map_s
+{
+    AlliedCalibGeometry_t geometry; // Geometry of the images.
+    VmbUint32_t pixel_size;         // Bytes per pixel.
+    VmbUint32_t count;              // Number of defects.
+    VmbUint32_t blocks;             // Number of blocks of the correction kernel.
+    VmbUint32_t *pos;               // Sorted packed positions, padded to whole blocks.
+    VmbUint8_t *kind;               // Kinds of the defects.
+    VmbUint32_t *nb;                // Packed positions of the neighbours, by block, then neighbour, then lane.
+};
+
+struct allied_defect_detector_s
+{
+    AlliedCalibGeometry_t geometry;    // Geometry of the images.
+    AlliedDefectDetection_t config;    // Configuration, with the defaults resolved.
+    VmbUint32_t pixel_size;            // Bytes per pixel.
+    VmbUint32_t step;                  // Distance to the nearest neighbour of the same color.
+    VmbUint16_t *med;                  // Running median of every pixel.
+    VmbUint16_t *mad;                  // Running median absolute deviation of every pixel.
+    VmbUint8_t *same;                  // Samples in a row equal to the running median, for every pixel.
+    VmbUint64_t frames;                // Frames handed to the detector.
+    VmbUint32_t cursor;                // First row of the next sample.
+    VmbUint32_t passes;                // Completed passes.
+    VmbUint32_t *found;                // Packed positions of the defects found in the current pass.
+    VmbUint8_t *found_kind;            // Kinds of the defects found in the current pass.
+    VmbUint32_t nfound;                // Defects found in the current pass.
+    VmbUint32_t *done;                 // Packed positions of the defects of the last completed pass.
+    VmbUint8_t *done_kind;             // Kinds of the defects of the last completed pass.
+    VmbUint32_t ndone;                 // Defects of the last completed pass.
+    bool has_done;                     // A detection pass has completed.
+};
+
+typedef void (*AlliedDefectCorrectKernel)(VmbUchar_t *data, size_t stride, const VmbUint32_t *pos, const VmbUint32_t *nb, VmbUint32_t blocks);
+typedef void (*AlliedDefectUpdateKernel)(const void *src, VmbUint16_t *med, VmbUint16_t *mad, VmbUint8_t *same, VmbUint32_t width, VmbUint32_t pass);
+
+/**
+ * @brief Defect kernels of a CPU level.
+ *
+ */
+typedef struct
+{
+    AlliedDefectCorrectKernel correct[2]; // Correction, by container (8, 16 bits).
+    AlliedDefectUpdateKernel update[2];   // Update of the running statistics of a row, by container (8, 16 bits).
+} AlliedDefectKernels_s;
+
+/**
+ * @brief Compare and exchange two rows of lanes, or two values if `N` is 1.
+ *
+ */
+#define ALLIED_DEFECT_CE(v, a, b, N)                               \
+    for (int l = 0; l < (N); l++)                                  \
+    {                                                              \
+        VmbUint32_t lo = v[a][l] < v[b][l] ? v[a][l] : v[b][l];    \
+        VmbUint32_t hi = v[a][l] < v[b][l] ? v[b][l] : v[a][l];    \
+        v[a][l] = lo;                                              \
+        v[b][l] = hi;                                              \
+    }
+
+/**
+ * @brief Batcher odd-even merge sort of 8 rows of lanes, 19 comparators.
+ *
+ */
+#define ALLIED_DEFECT_SORT8(v, N)   \
+    ALLIED_DEFECT_CE(v, 0, 1, N)    \
+    ALLIED_DEFECT_CE(v, 2, 3, N)    \
+    ALLIED_DEFECT_CE(v, 4, 5, N)    \
+    ALLIED_DEFECT_CE(v, 6, 7, N)    \
+    ALLIED_DEFECT_CE(v, 0, 2, N)    \
+    ALLIED_DEFECT_CE(v, 1, 3, N)    \
+    ALLIED_DEFECT_CE(v, 4, 6, N)    \
+    ALLIED_DEFECT_CE(v, 5, 7, N)    \
+    ALLIED_DEFECT_CE(v, 1, 2, N)    \
+    ALLIED_DEFECT_CE(v, 5, 6, N)    \
+    ALLIED_DEFECT_CE(v, 0, 4, N)    \
+    ALLIED_DEFECT_CE(v, 1, 5, N)    \
+    ALLIED_DEFECT_CE(v, 2, 6, N)    \
+    ALLIED_DEFECT_CE(v, 3, 7, N)    \
+    ALLIED_DEFECT_CE(v, 2, 4, N)    \
+    ALLIED_DEFECT_CE(v, 3, 5, N)    \
+    ALLIED_DEFECT_CE(v, 1, 2, N)    \
+    ALLIED_DEFECT_CE(v, 3, 4, N)    \
+    ALLIED_DEFECT_CE(v, 5, 6, N)
+
+#define ALLIED_DEFECT_AT(T, data, stride, pos) ((T *)((data) + (size_t)ALLIED_DEFECT_Y(pos) * (stride) + (size_t)ALLIED_DEFECT_X(pos) * sizeof(T)))
+
+/**
+ * @brief Instantiate the defect kernels for a pixel container.
+ *
+ * @param NAME Suffix of the kernel names.
+ * @param TARGET Target attribute of the CPU level, or nothing.
+ * @param T Pixel container type.
+ */
+#define ALLIED_DEFECT_KERNELS(NAME, TARGET, T)                                                                                      \
+    TARGET static void allied_defect_correct_##NAME(VmbUchar_t *data, size_t stride, const VmbUint32_t *pos, const VmbUint32_t *nb, \
+                                                    VmbUint32_t blocks)                                                             \
+    {                                                                                                                               \
+        for (VmbUint32_t b = 0; b < blocks; b++)                                                                                    \
+        {                                                                                                                           \
+            const VmbUint32_t *p = pos + (size_t)b * ALLIED_DEFECT_LANES;                                                           \
+            const VmbUint32_t *n = nb + (size_t)b * ALLIED_DEFECT_NEIGHBOURS * ALLIED_DEFECT_LANES;                                 \
+            VmbUint32_t v[ALLIED_DEFECT_NEIGHBOURS][ALLIED_DEFECT_LANES];                                                           \
+            for (int k = 0; k < ALLIED_DEFECT_NEIGHBOURS; k++)                                                                      \
+            {                                                                                                                       \
+                for (int l = 0; l < ALLIED_DEFECT_LANES; l++)                                                                       \
+                {                                                                                                                   \
+                    v[k][l] = *ALLIED_DEFECT_AT(const T, data, stride, n[k * ALLIED_DEFECT_LANES + l]);                             \
+                }                                                                                                                   \
+            }                                                                                                                       \
+            ALLIED_DEFECT_SORT8(v, ALLIED_DEFECT_LANES)                                                                             \
+            for (int l = 0; l < ALLIED_DEFECT_LANES; l++)                                                                           \
+            {                                                                                                                       \
+                *ALLIED_DEFECT_AT(T, data, stride, p[l]) = (T)((v[3][l] + v[4][l] + 1) >> 1);                                       \
+            }                                                                                                                       \
+        }                                                                                                                           \
+    }                                                                                                                               \
+                                                                                                                                    \
+    TARGET static void allied_defect_update_##NAME(const void *src, VmbUint16_t *med, VmbUint16_t *mad, VmbUint8_t *same,           \
+                                                   VmbUint32_t width, VmbUint32_t pass)                                             \
+    {                                                                                                                               \
+        const T *restrict s = (const T *)src;                                                                                       \
+        VmbUint16_t *restrict m = med;                                                                                              \
+        VmbUint16_t *restrict a = mad;                                                                                              \
+        VmbUint8_t *restrict r = same;                                                                                              \
+        if (pass == 0)                                                                                                              \
+        {                                                                                                                           \
+            for (VmbUint32_t x = 0; x < width; x++)                                                                                 \
+            {                                                                                                                       \
+                m[x] = s[x];                                                                                                        \
+                a[x] = 0;                                                                                                           \
+                r[x] = 0;                                                                                                           \
+            }                                                                                                                       \
+            return;                                                                                                                 \
+        }                                                                                                                           \
+        if (pass == 1)                                                                                                              \
+        {                                                                                                                           \
+            for (VmbUint32_t x = 0; x < width; x++)                                                                                 \
+            {                                                                                                                       \
+                VmbInt32_t d = (VmbInt32_t)s[x] - m[x];                                                                             \
+                a[x] = (VmbUint16_t)((d < 0 ? -d : d) >> 1);                                                                        \
+                m[x] = (VmbUint16_t)(m[x] + d / 2);                                                                                 \
+                r[x] = d == 0;                                                                                                      \
+            }                                                                                                                       \
+            return;                                                                                                                 \
+        }                                                                                                                           \
+        for (VmbUint32_t x = 0; x < width; x++)                                                                                     \
+        {                                                                                                                           \
+            VmbInt32_t dev = a[x];                                                                                                  \
+            VmbInt32_t step = (dev >> 2) + 1;                                                                                       \
+            VmbInt32_t d = (VmbInt32_t)s[x] - m[x];                                                                                 \
+            VmbUint32_t run = r[x];                                                                                                 \
+            r[x] = (VmbUint8_t)(d != 0 ? 0 : (run < 255 ? run + 1 : 255));                                                          \
+            d = d > step ? step : (d < -step ? -step : d);                                                                          \
+            VmbInt32_t mv = m[x] + d;                                                                                               \
+            VmbInt32_t e = (VmbInt32_t)s[x] - mv;                                                                                   \
+            e = (e < 0 ? -e : e) - dev;                                                                                             \
+            e = e > step ? step : (e < -step ? -step : e);                                                                          \
+            m[x] = (VmbUint16_t)mv;                                                                                                 \
+            a[x] = (VmbUint16_t)(dev + e);                                                                                          \
+        }                                                                                                                           \
+    }
+
+#define ALLIED_DEFECT_LEVEL(LEVEL, TARGET)                                                  \
+    ALLIED_DEFECT_KERNELS(8_##LEVEL, TARGET, VmbUint8_t)                                    \
+    ALLIED_DEFECT_KERNELS(16_##LEVEL, TARGET, VmbUint16_t)                                  \
+    static const AlliedDefectKernels_s defects_##LEVEL = {                                  \
+        .correct = {&allied_defect_correct_8_##LEVEL, &allied_defect_correct_16_##LEVEL},   \
+        .update = {&allied_defect_update_8_##LEVEL, &allied_defect_update_16_##LEVEL},      \
+    };
+
+ALLIED_KERNEL_LEVELS(ALLIED_DEFECT_LEVEL)
+
+static const AlliedDefectKernels_s *defect_kernels = &defects_scalar;
+
+ALLIED_KERNEL_BINDER(allied_defects_bind, defect_kernels, &defects)
+
+/**
+ * @brief Check a geometry, and get the pixel size and neighbour distance of its format.
+ *
+ */
+static VmbError_t allied_defect_geometry(const AlliedCalibGeometry_t *geometry, VmbUint32_t *pixel_size, VmbUint32_t *step, VmbUint32_t *bits)
+{
+    if (geometry->width == 0 || geometry->height == 0 || geometry->width > 0xffff || geometry->height > 0xffff)
+    {
+        return VmbErrorBadParameter;
+    }
+    allied_dispatch_init();
+    const AlliedImageKernels_s *kernels = allied_image_kernels(geometry->format);
+    if (kernels == NULL)
+    {
+        return VmbErrorNotSupported;
+    }
+    *pixel_size = kernels->pixel_size;
+    *step = kernels->bayer ? 2 : 1;
+    if (bits != NULL)
+    {
+        *bits = kernels->bits;
+    }
+    return VmbErrorSuccess;
+}
+
+/**
+ * @brief Coordinate of a neighbour, mirrored into the image. -1 if the image is too small to hold it.
+ *
+ */
+static VmbInt32_t allied_defect_mirror(VmbInt32_t c, VmbInt32_t size)
+{
+    if (c < 0)
+    {
+        c = -c;
+    }
+    else if (c >= size)
+    {
+        c = 2 * (size - 1) - c;
+    }
+    return c >= 0 && c < size ? c : -1;
+}
+
+static bool allied_defect_find(const VmbUint32_t *pos, VmbUint32_t count, VmbUint32_t p)
+{
+    VmbUint32_t lo = 0, hi = count;
+    while (lo < hi)
+    {
+        VmbUint32_t mid = lo + (hi - lo) / 2;
+        if (pos[mid] < p)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo < count && pos[lo] == p;
+}
+
+/**
+ * @brief Make a map from sorted, distinct packed positions.
+ *
+ */
+static VmbError_t allied_defect_map_build(const AlliedCalibGeometry_t *geometry, const VmbUint32_t *pos, const VmbUint8_t *kind, VmbUint32_t count,
+                                          AlliedDefectMap_t *map)
+{
+    VmbUint32_t pixel_size, step;
+    VmbError_t err = allied_defect_geometry(geometry, &pixel_size, &step, NULL);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    struct allied_defect_map_s *m = (struct allied_defect_map_s *)calloc(1, sizeof(struct allied_defect_map_s));
+    if (m == NULL)
+    {
+        return VmbErrorResources;
+    }
+    m->geometry = *geometry;
+    m->pixel_size = pixel_size;
+    m->count = count;
+    m->blocks = (count + ALLIED_DEFECT_LANES - 1) / ALLIED_DEFECT_LANES;
+    size_t padded = (size_t)m->blocks * ALLIED_DEFECT_LANES;
+    m->pos = (VmbUint32_t *)malloc((padded > 0 ? padded : 1) * sizeof(VmbUint32_t));
+    m->kind = (VmbUint8_t *)malloc((count > 0 ? count : 1) * sizeof(VmbUint8_t));
+    m->nb = (VmbUint32_t *)malloc((padded > 0 ? padded : 1) * ALLIED_DEFECT_NEIGHBOURS * sizeof(VmbUint32_t));
+    if (m->pos == NULL || m->kind == NULL || m->nb == NULL)
+    {
+        allied_defect_map_destroy(&m);
+        return VmbErrorResources;
+    }
+    if (count > 0)
+    {
+        memcpy(m->pos, pos, count * sizeof(VmbUint32_t));
+        memcpy(m->kind, kind, count * sizeof(VmbUint8_t));
+    }
+    VmbInt32_t width = (VmbInt32_t)geometry->width, height = (VmbInt32_t)geometry->height, p = (VmbInt32_t)step;
+    for (size_t i = 0; i < padded; i++)
+    {
+        VmbUint32_t at = pos[i < count ? i : count - 1];
+        m->pos[i] = at;
+        VmbInt32_t x = (VmbInt32_t)ALLIED_DEFECT_X(at), y = (VmbInt32_t)ALLIED_DEFECT_Y(at);
+        VmbUint32_t ring[ALLIED_DEFECT_NEIGHBOURS];
+        int valid = 0;
+        for (VmbInt32_t dy = -1; dy <= 1; dy++)
+        {
+            for (VmbInt32_t dx = -1; dx <= 1; dx++)
+            {
+                VmbInt32_t nx = allied_defect_mirror(x + dx * p, width), ny = allied_defect_mirror(y + dy * p, height);
+                if ((dx == 0 && dy == 0) || nx < 0 || ny < 0)
+                {
+                    continue;
+                }
+                VmbUint32_t np = ALLIED_DEFECT_POS(nx, ny);
+                // neighbours that are defects would pull the median towards the defect
+                if (np != at && !allied_defect_find(pos, count, np))
+                {
+                    ring[valid++] = np;
+                }
+            }
+        }
+        size_t block = i / ALLIED_DEFECT_LANES, lane = i % ALLIED_DEFECT_LANES;
+        VmbUint32_t *n = m->nb + block * ALLIED_DEFECT_NEIGHBOURS * ALLIED_DEFECT_LANES + lane;
+        for (int k = 0; k < ALLIED_DEFECT_NEIGHBOURS; k++)
+        {
+            // missing neighbours are filled with the ones found, a defect with none is left as is
+            n[k * ALLIED_DEFECT_LANES] = valid > 0 ? ring[k % valid] : at;
+        }
+    }
+    *map = m;
+    return VmbErrorSuccess;
+}
+
+static int allied_defect_compare(const void *a, const void *b)
+{
+    VmbUint64_t x = *(const VmbUint64_t *)a, y = *(const VmbUint64_t *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+VmbError_t allied_defect_map_create(AlliedDefectMap_t *map, const AlliedCalibGeometry_t *geometry, const AlliedDefect_t *defects, VmbUint32_t count)
+{
+    assert(map);
+    assert(geometry);
+    *map = NULL;
+    if (count > 0 && defects == NULL)
+    {
+        return VmbErrorBadParameter;
+    }
+    // position and kind sort together, and duplicates keep the first kind in sort order
+    VmbUint64_t *keys = (VmbUint64_t *)malloc((count > 0 ? count : 1) * sizeof(VmbUint64_t));
+    VmbUint32_t *pos = (VmbUint32_t *)malloc((count > 0 ? count : 1) * sizeof(VmbUint32_t));
+    VmbUint8_t *kind = (VmbUint8_t *)malloc((count > 0 ? count : 1) * sizeof(VmbUint8_t));
+    if (keys == NULL || pos == NULL || kind == NULL)
+    {
+        free(keys);
+        free(pos);
+        free(kind);
+        return VmbErrorResources;
+    }
+    VmbError_t err = VmbErrorSuccess;
+    for (VmbUint32_t i = 0; i < count && err == VmbErrorSuccess; i++)
+    {
+        if (defects[i].x >= geometry->width || defects[i].y >= geometry->height || defects[i].kind > AlliedDefectStuck)
+        {
+            err = VmbErrorBadParameter;
+            break;
+        }
+        keys[i] = (VmbUint64_t)ALLIED_DEFECT_POS(defects[i].x, defects[i].y) << 8 | defects[i].kind;
+    }
+    VmbUint32_t n = 0;
+    if (err == VmbErrorSuccess)
+    {
+        qsort(keys, count, sizeof(VmbUint64_t), &allied_defect_compare);
+        for (VmbUint32_t i = 0; i < count; i++)
+        {
+            VmbUint32_t p = (VmbUint32_t)(keys[i] >> 8);
+            if (n == 0 || pos[n - 1] != p)
+            {
+                pos[n] = p;
+                kind[n] = (VmbUint8_t)(keys[i] & 0xff);
+                n++;
+            }
+        }
+        err = allied_defect_map_build(geometry, pos, kind, n, map);
+    }
+    free(keys);
+    free(pos);
+    free(kind);
+    return err;
+}
+
+VmbError_t allied_defect_map_copy(AlliedDefectMap_t map, AlliedDefectMap_t *copy)
+{
+    assert(map);
+    assert(copy);
+    return allied_defect_map_build(&(map->geometry), map->pos, map->kind, map->count, copy);
+}
+
+VmbError_t allied_defect_map_destroy(AlliedDefectMap_t *map)
+{
+    assert(map);
+    if (*map == NULL)
+    {
+        return VmbErrorSuccess;
+    }
+    free((*map)->pos);
+    free((*map)->kind);
+    free((*map)->nb);
+    free(*map);
+    *map = NULL;
+    return VmbErrorSuccess;
+}
+
+VmbUint32_t allied_defect_map_count(AlliedDefectMap_t map)
+{
+    assert(map);
+    return map->count;
+}
+
+VmbError_t allied_defect_map_get(AlliedDefectMap_t map, VmbUint32_t index, AlliedDefect_t *defect)
+{
+    assert(map);
+    assert(defect);
+    if (index >= map->count)
+    {
+        return VmbErrorBadParameter;
+    }
+    defect->x = ALLIED_DEFECT_X(map->pos[index]);
+    defect->y = ALLIED_DEFECT_Y(map->pos[index]);
+    defect->kind = (AlliedDefectKind_t)map->kind[index];
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_defect_map_geometry(AlliedDefectMap_t map, AlliedCalibGeometry_t *geometry)
+{
+    assert(map);
+    assert(geometry);
+    *geometry = map->geometry;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_defect_map_correct(AlliedDefectMap_t map, AlliedImage_t *image)
+{
+    assert(map);
+    assert(image);
+    if (image->width != map->geometry.width || image->height != map->geometry.height || image->format != map->geometry.format || image->data == NULL)
+    {
+        return VmbErrorBadParameter;
+    }
+    size_t row = (size_t)image->width * map->pixel_size;
+    size_t stride = image->stride == 0 ? row : image->stride;
+    if (stride < row)
+    {
+        return VmbErrorBadParameter;
+    }
+    if (map->blocks > 0)
+    {
+        allied_dispatch_init();
+        defect_kernels->correct[map->pixel_size == 1 ? 0 : 1]((VmbUchar_t *)image->data, stride, map->pos, map->nb, map->blocks);
+    }
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_defect_map_export(AlliedDefectMap_t map, const char *path)
+{
+    assert(map);
+    assert(path);
+    static const char *names[] = {"hot", "cold", "stuck"};
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL)
+    {
+        return VmbErrorIO;
+    }
+    const AlliedCalibGeometry_t *g = &(map->geometry);
+    VmbUint32_t binning = g->binning > 0 ? g->binning : 1;
+    bool ok = fprintf(fp, "# x y kind, sensor pixels, binning %u\n", binning) > 0;
+    for (VmbUint32_t i = 0; i < map->count && ok; i++)
+    {
+        VmbUint32_t x = (g->offset_x + ALLIED_DEFECT_X(map->pos[i])) * binning;
+        VmbUint32_t y = (g->offset_y + ALLIED_DEFECT_Y(map->pos[i])) * binning;
+        ok = fprintf(fp, "%u %u %s\n", x, y, names[map->kind[i]]) > 0;
+    }
+    ok = fclose(fp) == 0 && ok;
+    return ok ? VmbErrorSuccess : VmbErrorIO;
+}
+
+VmbError_t allied_defect_detector_create(AlliedDefectDetector_t *detector, const AlliedCalibGeometry_t *geometry, const AlliedDefectDetection_t *detection)
+{
+    assert(detector);
+    assert(geometry);
+    *detector = NULL;
+    AlliedDefectDetection_t c = {0};
+    if (detection != NULL)
+    {
+        c = *detection;
+    }
+    if (!(c.sigma >= 0))
+    {
+        return VmbErrorBadParameter;
+    }
+    VmbUint32_t pixel_size, step, bits;
+    VmbError_t err = allied_defect_geometry(geometry, &pixel_size, &step, &bits);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    c.sample_interval = c.sample_interval > 0 ? c.sample_interval : 4;
+    c.rows_per_sample = c.rows_per_sample > 0 ? (c.rows_per_sample < 4 ? 4 : c.rows_per_sample) : 64;
+    c.passes = c.passes > 0 ? c.passes : 8;
+    c.sigma = c.sigma > 0 ? c.sigma : 6;
+    c.min_delta = c.min_delta > 0 ? c.min_delta : (((1u << bits) - 1) >> 8) + 1;
+    c.max_defects = c.max_defects > 0 ? c.max_defects : 65536;
+    struct allied_defect_detector_s *d = (struct allied_defect_detector_s *)calloc(1, sizeof(struct allied_defect_detector_s));
+    if (d == NULL)
+    {
+        return VmbErrorResources;
+    }
+    size_t count = (size_t)geometry->width * geometry->height;
+    d->med = (VmbUint16_t *)malloc(count * sizeof(VmbUint16_t));
+    d->mad = (VmbUint16_t *)malloc(count * sizeof(VmbUint16_t));
+    d->same = (VmbUint8_t *)malloc(count * sizeof(VmbUint8_t));
+    d->found = (VmbUint32_t *)malloc(c.max_defects * sizeof(VmbUint32_t));
+    d->found_kind = (VmbUint8_t *)malloc(c.max_defects * sizeof(VmbUint8_t));
+    d->done = (VmbUint32_t *)malloc(c.max_defects * sizeof(VmbUint32_t));
+    d->done_kind = (VmbUint8_t *)malloc(c.max_defects * sizeof(VmbUint8_t));
+    if (d->med == NULL || d->mad == NULL || d->same == NULL || d->found == NULL || d->found_kind == NULL || d->done == NULL || d->done_kind == NULL)
+    {
+        allied_defect_detector_destroy(&d);
+        return VmbErrorResources;
+    }
+    d->geometry = *geometry;
+    d->config = c;
+    d->pixel_size = pixel_size;
+    d->step = step;
+    *detector = d;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_defect_detector_destroy(AlliedDefectDetector_t *detector)
+{
+    assert(detector);
+    struct allied_defect_detector_s *d = *detector;
+    if (d == NULL)
+    {
+        return VmbErrorSuccess;
+    }
+    free(d->med);
+    free(d->mad);
+    free(d->same);
+    free(d->found);
+    free(d->found_kind);
+    free(d->done);
+    free(d->done_kind);
+    free(d);
+    *detector = NULL;
+    return VmbErrorSuccess;
+}
+
+/**
+ * @brief Median of 8 values, the mean of the middle two.
+ *
+ */
+static VmbUint32_t allied_defect_median8(VmbUint32_t v[ALLIED_DEFECT_NEIGHBOURS][1])
+{
+    ALLIED_DEFECT_SORT8(v, 1)
+    return (v[3][0] + v[4][0] + 1) >> 1;
+}
+
+/**
+ * @brief Compare the running medians of a band of rows with their neighbours, and record the defects.
+ *
+ */
+static void allied_defect_detect(struct allied_defect_detector_s *d, VmbUint32_t first, VmbUint32_t last)
+{
+    const AlliedDefectDetection_t *c = &(d->config);
+    VmbInt32_t width = (VmbInt32_t)d->geometry.width, height = (VmbInt32_t)d->geometry.height, p = (VmbInt32_t)d->step;
+    // 1.4826 MAD estimates the standard deviation of normal noise
+    double scale = c->sigma * 1.4826;
+    VmbInt32_t min_delta = (VmbInt32_t)c->min_delta;
+    for (VmbInt32_t y = (VmbInt32_t)first; y < (VmbInt32_t)last && d->nfound < c->max_defects; y++)
+    {
+        VmbInt32_t ys[3] = {allied_defect_mirror(y - p, height), y, allied_defect_mirror(y + p, height)};
+        for (int k = 0; k < 3; k++)
+        {
+            ys[k] = ys[k] < 0 ? y : ys[k];
+        }
+        const VmbUint16_t *m0 = d->med + (size_t)ys[0] * width, *m1 = d->med + (size_t)y * width, *m2 = d->med + (size_t)ys[2] * width;
+        const VmbUint8_t *r1 = d->same + (size_t)y * width;
+        for (VmbInt32_t x = 0; x < width; x++)
+        {
+            VmbInt32_t xm = allied_defect_mirror(x - p, width), xp = allied_defect_mirror(x + p, width);
+            xm = xm < 0 ? x : xm;
+            xp = xp < 0 ? x : xp;
+            VmbInt32_t med = m1[x];
+            bool frozen = c->stuck_mad > 0 && r1[x] >= ALLIED_DEFECT_FROZEN;
+            // most pixels are within half the threshold of the mean of their four nearest neighbours
+            VmbInt32_t dev4 = 4 * med - (m1[xm] + m1[xp] + m0[x] + m2[x]);
+            if (!frozen && (dev4 < 0 ? -dev4 : dev4) <= 2 * min_delta)
+            {
+                continue;
+            }
+            VmbUint32_t nm[ALLIED_DEFECT_NEIGHBOURS][1], na[ALLIED_DEFECT_NEIGHBOURS][1];
+            VmbInt32_t xs[3] = {xm, x, xp};
+            int k = 0;
+            for (int j = 0; j < 3; j++)
+            {
+                for (int i = 0; i < 3; i++)
+                {
+                    if (i == 1 && j == 1)
+                    {
+                        continue;
+                    }
+                    size_t at = (size_t)ys[j] * width + xs[i];
+                    nm[k][0] = d->med[at];
+                    na[k][0] = d->mad[at];
+                    k++;
+                }
+            }
+            VmbInt32_t nmed = (VmbInt32_t)allied_defect_median8(nm);
+            VmbUint32_t nmad = allied_defect_median8(na);
+            // the neighbours are sorted: a pixel within twice the spread of the inner six follows the scene, e.g. a steep gradient at an edge
+            VmbInt32_t spread = 2 * (VmbInt32_t)(nm[6][0] - nm[1][0]);
+            double threshold = fmax(fmax(min_delta, spread), scale * (nmad > 0 ? nmad : 1));
+            VmbInt32_t delta = med - nmed;
+            int kind = -1;
+            if (frozen && nmad >= c->stuck_mad)
+            {
+                kind = AlliedDefectStuck;
+            }
+            else if (delta > threshold)
+            {
+                kind = AlliedDefectHot;
+            }
+            else if (-delta > threshold)
+            {
+                kind = AlliedDefectCold;
+            }
+            if (kind >= 0 && d->nfound < c->max_defects)
+            {
+                d->found[d->nfound] = ALLIED_DEFECT_POS(x, y);
+                d->found_kind[d->nfound] = (VmbUint8_t)kind;
+                d->nfound++;
+            }
+        }
+    }
+}
+
+VmbError_t allied_defect_detector_add(AlliedDefectDetector_t detector, const AlliedImage_t *image, bool *updated)
+{
+    assert(detector);
+    assert(image);
+    struct allied_defect_detector_s *d = detector;
+    if (updated != NULL)
+    {
+        *updated = false;
+    }
+    size_t row = (size_t)image->width * d->pixel_size;
+    size_t stride = image->stride == 0 ? row : image->stride;
+    if (image->width != d->geometry.width || image->height != d->geometry.height || image->format != d->geometry.format || image->data == NULL ||
+        stride < row)
+    {
+        return VmbErrorBadParameter;
+    }
+    if (d->frames++ % d->config.sample_interval != 0)
+    {
+        return VmbErrorSuccess;
+    }
+    allied_dispatch_init();
+    AlliedDefectUpdateKernel update = defect_kernels->update[d->pixel_size == 1 ? 0 : 1];
+    VmbUint32_t width = d->geometry.width, height = d->geometry.height, rows = d->config.rows_per_sample;
+    VmbUint32_t first = d->cursor, last = first + rows < height ? first + rows : height;
+    for (VmbUint32_t y = first; y < last; y++)
+    {
+        size_t at = (size_t)y * width;
+        update((const VmbUchar_t *)image->data + (size_t)y * stride, d->med + at, d->mad + at, d->same + at, width, d->passes);
+    }
+    // the last warm-up pass is the first to detect, so a map is ready after `passes` passes
+    bool detecting = d->passes + 1 >= d->config.passes;
+    if (detecting)
+    {
+        if (first > 0)
+        {
+            allied_defect_detect(d, first - rows, first);
+        }
+        if (last == height)
+        {
+            allied_defect_detect(d, first, last);
+        }
+    }
+    d->cursor = last;
+    if (last == height)
+    {
+        d->cursor = 0;
+        d->passes++;
+        if (detecting)
+        {
+            // found is filled in row order, and is sorted
+            VmbUint32_t *pos = d->done;
+            VmbUint8_t *kind = d->done_kind;
+            d->done = d->found;
+            d->done_kind = d->found_kind;
+            d->ndone = d->nfound;
+            d->found = pos;
+            d->found_kind = kind;
+            d->nfound = 0;
+            d->has_done = true;
+            if (updated != NULL)
+            {
+                *updated = true;
+            }
+        }
+    }
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_defect_detector_map(AlliedDefectDetector_t detector, AlliedDefectMap_t *map)
+{
+    assert(detector);
+    assert(map);
+    *map = NULL;
+    if (!detector->has_done)
+    {
+        return VmbErrorNotAvailable;
+    }
+    return allied_defect_map_build(&(detector->geometry), detector->done, detector->done_kind, detector->ndone, map);
+}
+
+VmbUint32_t allied_defect_detector_passes(AlliedDefectDetector_t detector)
+{
+    assert(detector);
+    return detector->passes;
+}
@@ -0,0 +1,193 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_dispatch.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Internal CPU feature dispatch for pixel processing kernels.
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "alliedcam_dispatch.h"
+#include <stdlib.h>
+#include <strings.h>
+#include <pthread.h>
+
+#ifdef ALLIED_X86
+#include <cpuid.h>
+#endif
+
+/**
+ * @brief Binders of all kernel families. Add new kernel families here.
+ *
+ */
+static const AlliedKernelBinder binders[] = {
+    &allied_copy_bind,
+    &allied_unpack_bind,
+    &allied_image_bind,
+    &allied_debayer_bind,
+    &allied_stats_bind,
+    &allied_bin_bind,
+    &allied_calib_bind,
+    &allied_defects_bind,
+    &allied_coadd_bind,
+    &allied_stack_bind,
+    &allied_moments_bind,
+    &allied_register_bind,
+    &allied_focus_bind,
+    &allied_track_bind,
+    &allied_beam_bind,
+    &allied_photometry_bind,
+    &allied_change_bind,
+};
+
+static const char *level_names[AlliedCpuLevelCount] = {
+    "scalar",
+    "sse4.1",
+    "avx2",
+    "avx512",
+};
+
+static VmbUint32_t cpu_features = 0;
+static AlliedCpuLevel_t cpu_detected = AlliedCpuScalar;
+static AlliedCpuLevel_t cpu_active = AlliedCpuScalar;
+static pthread_once_t dispatch_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t dispatch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static VmbUint32_t allied_cpu_detect(void)
+{
+    VmbUint32_t features = 0;
+#ifdef ALLIED_X86
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    {
+        return 0;
+    }
+    features |= (edx & bit_SSE2) ? AlliedCpuFeatureSse2 : 0;
+    features |= (ecx & bit_SSSE3) ? AlliedCpuFeatureSsse3 : 0;
+    features |= (ecx & bit_SSE4_1) ? AlliedCpuFeatureSse41 : 0;
+    // AVX state must be enabled by the OS as well
+    VmbUint64_t xcr0 = 0;
+    if (ecx & bit_OSXSAVE)
+    {
+        unsigned int lo, hi;
+        __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        xcr0 = ((VmbUint64_t)hi << 32) | lo;
+    }
+    bool ymm = (xcr0 & 0x6) == 0x6;   // SSE and AVX state
+    bool zmm = (xcr0 & 0xe6) == 0xe6; // opmask and upper ZMM state
+    if (!ymm)
+    {
+        return features;
+    }
+    features |= (ecx & bit_AVX) ? AlliedCpuFeatureAvx : 0;
+    features |= (ecx & bit_FMA) ? AlliedCpuFeatureFma : 0;
+    features |= (ecx & bit_F16C) ? AlliedCpuFeatureF16c : 0;
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+    {
+        features |= (ebx & bit_AVX2) ? AlliedCpuFeatureAvx2 : 0;
+        features |= (ebx & bit_BMI2) ? AlliedCpuFeatureBmi2 : 0;
+        if (zmm)
+        {
+            features |= (ebx & bit_AVX512F) ? AlliedCpuFeatureAvx512f : 0;
+            features |= (ebx & bit_AVX512BW) ? AlliedCpuFeatureAvx512bw : 0;
+            features |= (ebx & bit_AVX512DQ) ? AlliedCpuFeatureAvx512dq : 0;
+            features |= (ebx & bit_AVX512VL) ? AlliedCpuFeatureAvx512vl : 0;
+        }
+    }
+#endif
+    return features;
+}
+
+static AlliedCpuLevel_t allied_cpu_classify(VmbUint32_t features)
+{
+    const VmbUint32_t sse41 = AlliedCpuFeatureSse2 | AlliedCpuFeatureSsse3 | AlliedCpuFeatureSse41;
+    const VmbUint32_t avx2 = sse41 | AlliedCpuFeatureAvx | AlliedCpuFeatureAvx2 | AlliedCpuFeatureFma | AlliedCpuFeatureF16c | AlliedCpuFeatureBmi2;
+    const VmbUint32_t avx512 = avx2 | AlliedCpuFeatureAvx512f | AlliedCpuFeatureAvx512bw | AlliedCpuFeatureAvx512dq | AlliedCpuFeatureAvx512vl;
+    if ((features & avx512) == avx512)
+    {
+        return AlliedCpuAvx512;
+    }
+    if ((features & avx2) == avx2)
+    {
+        return AlliedCpuAvx2;
+    }
+    if ((features & sse41) == sse41)
+    {
+        return AlliedCpuSse41;
+    }
+    return AlliedCpuScalar;
+}
+
+static void allied_dispatch_bind(AlliedCpuLevel_t level)
+{
+    for (size_t i = 0; i < sizeof(binders) / sizeof(binders[0]); i++)
+    {
+        binders[i](level);
+    }
+    cpu_active = level;
+}
+
+static void allied_dispatch_detect(void)
+{
+    cpu_features = allied_cpu_detect();
+    cpu_detected = allied_cpu_classify(cpu_features);
+    AlliedCpuLevel_t level = cpu_detected;
+    const char *env = getenv("ALLIED_CPU_LEVEL");
+    for (int i = 0; env != NULL && i < AlliedCpuLevelCount; i++)
+    {
+        if (strcasecmp(env, level_names[i]) == 0 && (AlliedCpuLevel_t)i < level)
+        {
+            level = (AlliedCpuLevel_t)i;
+        }
+    }
+    allied_dispatch_bind(level);
+}
+
+void allied_dispatch_init(void)
+{
+    pthread_once(&dispatch_once, &allied_dispatch_detect);
+}
+
+VmbUint32_t allied_cpu_features(void)
+{
+    allied_dispatch_init();
+    return cpu_features;
+}
+
+AlliedCpuLevel_t allied_cpu_detected_level(void)
+{
+    allied_dispatch_init();
+    return cpu_detected;
+}
+
+AlliedCpuLevel_t allied_cpu_level(void)
+{
+    allied_dispatch_init();
+    return cpu_active;
+}
+
+VmbError_t allied_set_cpu_level(AlliedCpuLevel_t level)
+{
+    allied_dispatch_init();
+    if (level >= AlliedCpuLevelCount || level > cpu_detected)
+    {
+        return VmbErrorNotSupported;
+    }
+    pthread_mutex_lock(&dispatch_lock);
+    allied_dispatch_bind(level);
+    pthread_mutex_unlock(&dispatch_lock);
+    return VmbErrorSuccess;
+}
+
+const char *allied_cpu_level_name(AlliedCpuLevel_t level)
+{
+    if (level >= AlliedCpuLevelCount)
+    {
+        return "unknown";
+    }
+    return level_names[level];
+}
@@ -0,0 +1,210 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_dispatch.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Internal CPU feature dispatch for pixel processing kernels.
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details Every kernel family lives in its own module, with one function per instruction set level compiled with
+ * the matching `ALLIED_TARGET_*` attribute (instantiated with {@link ALLIED_KERNEL_LEVELS}), and a binder that points the
+ * module's kernel pointer to the variant for a level (defined with {@link ALLIED_KERNEL_BINDER}). The binders are listed in alliedcam_dispatch.c, and run once when the CPU is detected, and again when the
+ * level is forced with {@link allied_set_cpu_level}. Public entry points call {@link allied_dispatch_init} before
+ * using a kernel pointer.
+ */
+
+#ifndef ALLIEDCAM_DISPATCH_H_
+#define ALLIEDCAM_DISPATCH_H_
+
+#include "alliedcam_cpu.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * @brief Defined when x86 kernel variants are compiled.
+ *
+ */
+#define ALLIED_X86
+#include <immintrin.h>
+#define ALLIED_TARGET_SSE41 __attribute__((target("sse2,ssse3,sse4.1")))
+#define ALLIED_TARGET_AVX2 __attribute__((target("avx2,fma,f16c,bmi2")))
+#define ALLIED_TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx512dq,avx512vl,avx2,fma,f16c,bmi2")))
+#endif
+
+/**
+ * @brief Instantiate a kernel family once per level: `LEVEL_MACRO(level, target)` is expanded for the scalar level and, on x86,
+ * for every instruction set level with its `ALLIED_TARGET_*` attribute. `LEVEL_MACRO` defines the `<family>_<level>` variant.
+ *
+ */
+#ifdef ALLIED_X86
+#define ALLIED_KERNEL_LEVELS(LEVEL_MACRO)     \
+    LEVEL_MACRO(scalar, )                     \
+    LEVEL_MACRO(sse41, ALLIED_TARGET_SSE41)   \
+    LEVEL_MACRO(avx2, ALLIED_TARGET_AVX2)     \
+    LEVEL_MACRO(avx512, ALLIED_TARGET_AVX512)
+#else
+#define ALLIED_KERNEL_LEVELS(LEVEL_MACRO) \
+    LEVEL_MACRO(scalar, )
+#endif
+
+/**
+ * @brief Variant of a kernel family for a level, `PREFIX` followed by the level name. Pass `&name` to take the address of variants
+ * that are structures or functions.
+ *
+ */
+#ifdef ALLIED_X86
+#define ALLIED_KERNEL_SELECT(PREFIX, level)          \
+    ((level) == AlliedCpuAvx512 ? PREFIX##_avx512 \
+     : (level) == AlliedCpuAvx2 ? PREFIX##_avx2   \
+     : (level) == AlliedCpuSse41 ? PREFIX##_sse41 \
+                                 : PREFIX##_scalar)
+#else
+#define ALLIED_KERNEL_SELECT(PREFIX, level) \
+    ((void)(level), PREFIX##_scalar)
+#endif
+
+/**
+ * @brief Define the binder `NAME` of a kernel family, which points `POINTER` to the variant of `PREFIX` for a level (see {@link ALLIED_KERNEL_SELECT}).
+ *
+ */
+#define ALLIED_KERNEL_BINDER(NAME, POINTER, PREFIX)    \
+    void NAME(AlliedCpuLevel_t level)                  \
+    {                                                  \
+        POINTER = ALLIED_KERNEL_SELECT(PREFIX, level); \
+    }
+
+/**
+ * @brief Bind the kernels of a family to a level.
+ *
+ * @param level Kernel level, never higher than the detected level
+ */
+typedef void (*AlliedKernelBinder)(AlliedCpuLevel_t level);
+
+/**
+ * @brief Detect the CPU and bind all kernel families. Cheap after the first call.
+ *
+ */
+void allied_dispatch_init(void);
+
+/**
+ * @brief Bind the frame copy kernels.
+ *
+ * @param level Kernel level
+ */
+void allied_copy_bind(AlliedCpuLevel_t level);
+
+/**
+ * @brief Bind the unpacking kernels.
+ *
+ * @param level Kernel level
+ */
+void allied_unpack_bind(AlliedCpuLevel_t level);
+
+/**
+ * @brief Bind the image kernel tables.
+ *
+ * @param level Kernel level
+ */
+void allied_image_bind(AlliedCpuLevel_t level);
+
+/**
+ * @brief Bind the debayering kernels.
+ *
+ * @param level Kernel level
+ */
+void allied_debayer_bind(AlliedCpuLevel_t level);
+
+/**
+ * @brief Bind the statistics kernels.
+ *
+ * @param level Kernel level
+ */
+void allied_stats_bind(AlliedCpuLevel_t level);
+
+/**
+ * @brief Bind the binning and decimation kernels.
+ *
+ * @param level Kernel level
+ */
+void allied_bin_bind(AlliedCpuLevel_t level);
+
+/**
+ * @brief Bind the calibration kernels.
+ *
+ * @param level Kernel level
+ */
+void allied_calib_bind(AlliedCpuLevel_t level);
+
+/**
+ * @brief Bind the defect correction kernels.
+ *
+ * @param level Kernel level
+ */
+void allied_defects_bind(AlliedCpuLevel_t level);
+
+/**
+ * @brief Bind the co-adding kernels.
+ *
+ * @param level Kernel level
+ */
+void allied_coadd_bind(AlliedCpuLevel_t level);
+
+/**
+ * @brief Bind the robust stacking kernels.
+ *
+ * @param level Kernel level
+ */
+void allied_stack_bind(AlliedCpuLevel_t level);
+
+/**
+ * @brief Bind the temporal moment kernels.
+ *
+ * @param level Kernel level
+ */
+void allied_moments_bind(AlliedCpuLevel_t level);
+
+/**
+ * @brief Bind the registration and shift-and-add kernels.
+ *
+ * @param level Kernel level
+ */
+void allied_register_bind(AlliedCpuLevel_t level);
+
+/**
+ * @brief Bind the sharpness metric kernels.
+ *
+ * @param level Kernel level
+ */
+void allied_focus_bind(AlliedCpuLevel_t level);
+
+/**
+ * @brief Bind the spot finding kernels.
+ *
+ * @param level Kernel level
+ */
+void allied_track_bind(AlliedCpuLevel_t level);
+
+/**
+ * @brief Bind the beam profile kernels.
+ *
+ * @param level Kernel level
+ */
+void allied_beam_bind(AlliedCpuLevel_t level);
+
+/**
+ * @brief Bind the photometry kernels.
+ *
+ * @param level Kernel level
+ */
+void allied_photometry_bind(AlliedCpuLevel_t level);
+
+/**
+ * @brief Bind the change detection kernels.
+ *
+ * @param level Kernel level
+ */
+void allied_change_bind(AlliedCpuLevel_t level);
+
+#endif /* ALLIEDCAM_DISPATCH_H_ */
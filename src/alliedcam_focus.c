@@ -0,0 +1,649 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_focus.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Sharpness metrics and best-frame selection for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details The metric kernels score one row of the inside of a region, and are instantiated per metric, source container, neighbour step
+ * (1, or 2 for Bayer) and CPU level. The differences fit in 32 bits and their squares are summed in 64 bits, so that the sums are exact
+ * and the loops vectorize without reordering floating point additions (this file is built with -O3, see the Makefile). The Tenengrad
+ * threshold is a compare and select on the squared magnitude.
+ *
+ * The selector is a binary min-heap of `count` entries, with the lowest score at the root. Entries keep their copy buffers when they are
+ * evicted or reset, so that a run of copies allocates only until every entry has held its largest frame.
+ */
+
+#include "alliedcam_focus.h"
+#include "alliedcam_kernels.h"
+#include "alliedcam_dispatch.h"
+#include "alliedcam_pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <assert.h>
+
+/**
+ * @brief Time a detaching selector waits for a frame before checking whether to stop, in ms.
+ *
+ */
+#define ALLIED_BEST_POLL_MS 100
+
+/**
+ * @brief Sums of a metric over rows.
+ *
+ */
+typedef struct
+{
+    VmbInt64_t sum;    // Sum of the Laplacian.
+    VmbUint64_t sum2;  // Sum of the squared Laplacian, gradient or difference.
+    VmbUint64_t count; // Pixels scored.
+} AlliedFocusSums_s;
+
+/**
+ * @brief Row kernel of a metric.
+ *
+ * @param row First pixel scored in the row. The neighbours of every pixel scored are inside the image.
+ * @param stride Bytes between the starts of consecutive rows.
+ * @param width Pixels scored in the row.
+ * @param t2 Smallest squared gradient magnitude counted by Tenengrad.
+ * @param sums Sums to add to.
+ */
+typedef void (*AlliedFocusRowKernel)(const void *row, size_t stride, VmbUint32_t width, VmbUint64_t t2, AlliedFocusSums_s *sums);
+
+/**
+ * @brief Sharpness kernels of a CPU level.
+ *
+ */
+typedef struct
+{
+    AlliedFocusRowKernel row[2][2][3]; // By source container (8, 16 bits), neighbour step (1, 2) and metric.
+} AlliedFocusKernels_s;
+
+/**
+ * @brief Instantiate the row kernels of a source container and neighbour step.
+ *
+ * @param NAME Suffix of the kernel names.
+ * @param TARGET Target attribute of the CPU level, or nothing.
+ * @param TS Source container type.
+ * @param D Neighbour step, in pixels.
+ */
+#define ALLIED_FOCUS_ROWS(NAME, TARGET, TS, D)                                                                                  \
+    TARGET static void allied_focus_laplacian_##NAME(const void *row, size_t stride, VmbUint32_t width, VmbUint64_t t2,       \
+                                                     AlliedFocusSums_s *sums)                                                 \
+    {                                                                                                                         \
+        const TS *restrict p = (const TS *)row;                                                                               \
+        const TS *restrict a = (const TS *)((const VmbUchar_t *)row - (D) * stride);                                          \
+        const TS *restrict b = (const TS *)((const VmbUchar_t *)row + (D) * stride);                                          \
+        VmbInt64_t s = 0;                                                                                                     \
+        VmbUint64_t s2 = 0;                                                                                                   \
+        (void)t2;                                                                                                             \
+        for (size_t x = 0; x < width; x++)                                                                                    \
+        {                                                                                                                     \
+            VmbInt32_t l = (VmbInt32_t)a[x] + (VmbInt32_t)b[x] + (VmbInt32_t)(p - (D))[x] + (VmbInt32_t)p[x + (D)] -            \
+                           4 * (VmbInt32_t)p[x];                                                                              \
+            s += l;                                                                                                           \
+            s2 += (VmbUint64_t)((VmbInt64_t)l * l);                                                                           \
+        }                                                                                                                     \
+        sums->sum += s;                                                                                                       \
+        sums->sum2 += s2;                                                                                                     \
+        sums->count += width;                                                                                                 \
+    }                                                                                                                         \
+    TARGET static void allied_focus_tenengrad_##NAME(const void *row, size_t stride, VmbUint32_t width, VmbUint64_t t2,       \
+                                                     AlliedFocusSums_s *sums)                                                 \
+    {                                                                                                                         \
+        const TS *restrict p = (const TS *)row;                                                                               \
+        const TS *restrict a = (const TS *)((const VmbUchar_t *)row - (D) * stride);                                          \
+        const TS *restrict b = (const TS *)((const VmbUchar_t *)row + (D) * stride);                                          \
+        VmbUint64_t s2 = 0;                                                                                                   \
+        for (size_t x = 0; x < width; x++)                                                                                    \
+        {                                                                                                                     \
+            VmbInt32_t gx = ((VmbInt32_t)a[x + (D)] + 2 * (VmbInt32_t)p[x + (D)] + (VmbInt32_t)b[x + (D)]) -                  \
+                            ((VmbInt32_t)(a - (D))[x] + 2 * (VmbInt32_t)(p - (D))[x] + (VmbInt32_t)(b - (D))[x]);                   \
+            VmbInt32_t gy = ((VmbInt32_t)(b - (D))[x] + 2 * (VmbInt32_t)b[x] + (VmbInt32_t)b[x + (D)]) -                        \
+                            ((VmbInt32_t)(a - (D))[x] + 2 * (VmbInt32_t)a[x] + (VmbInt32_t)a[x + (D)]);                         \
+            VmbUint64_t g2 = (VmbUint64_t)((VmbInt64_t)gx * gx + (VmbInt64_t)gy * gy);                                        \
+            s2 += g2 >= t2 ? g2 : 0;                                                                                          \
+        }                                                                                                                     \
+        sums->sum2 += s2;                                                                                                     \
+        sums->count += width;                                                                                                 \
+    }                                                                                                                         \
+    TARGET static void allied_focus_brenner_##NAME(const void *row, size_t stride, VmbUint32_t width, VmbUint64_t t2,         \
+                                                   AlliedFocusSums_s *sums)                                                   \
+    {                                                                                                                         \
+        const TS *restrict p = (const TS *)row;                                                                               \
+        VmbUint64_t s2 = 0;                                                                                                   \
+        (void)stride;                                                                                                         \
+        (void)t2;                                                                                                             \
+        for (size_t x = 0; x < width; x++)                                                                                    \
+        {                                                                                                                     \
+            VmbInt32_t d = (VmbInt32_t)p[x + 2 * (D)] - (VmbInt32_t)p[x];                                                     \
+            s2 += (VmbUint64_t)((VmbInt64_t)d * d);                                                                           \
+        }                                                                                                                     \
+        sums->sum2 += s2;                                                                                                     \
+        sums->count += width;                                                                                                 \
+    }
+
+#define ALLIED_FOCUS_ROW_TABLE(NAME)                                                                      \
+    {                                                                                                     \
+        &allied_focus_laplacian_##NAME, &allied_focus_tenengrad_##NAME, &allied_focus_brenner_##NAME, \
+    }
+
+#define ALLIED_FOCUS_LEVEL(LEVEL, TARGET)                                                   \
+    ALLIED_FOCUS_ROWS(8_1_##LEVEL, TARGET, VmbUint8_t, 1)                                   \
+    ALLIED_FOCUS_ROWS(8_2_##LEVEL, TARGET, VmbUint8_t, 2)                                   \
+    ALLIED_FOCUS_ROWS(16_1_##LEVEL, TARGET, VmbUint16_t, 1)                                 \
+    ALLIED_FOCUS_ROWS(16_2_##LEVEL, TARGET, VmbUint16_t, 2)                                 \
+    static const AlliedFocusKernels_s focus_##LEVEL = {                                     \
+        .row = {                                                                            \
+            {ALLIED_FOCUS_ROW_TABLE(8_1_##LEVEL), ALLIED_FOCUS_ROW_TABLE(8_2_##LEVEL)},     \
+            {ALLIED_FOCUS_ROW_TABLE(16_1_##LEVEL), ALLIED_FOCUS_ROW_TABLE(16_2_##LEVEL)},   \
+        },                                                                                  \
+    };
+
+ALLIED_KERNEL_LEVELS(ALLIED_FOCUS_LEVEL)
+
+static const AlliedFocusKernels_s *focus_kernels = &focus_scalar;
+
+ALLIED_KERNEL_BINDER(allied_focus_bind, focus_kernels, &focus)
+
+/**
+ * @brief Scoring job, shared by the tasks of the worker pool.
+ *
+ */
+typedef struct
+{
+    AlliedFocusRowKernel row;                        // Row kernel.
+    const VmbUchar_t *first;                         // First pixel scored.
+    size_t stride;                                   // Bytes between rows.
+    VmbUint32_t width;                               // Pixels scored per row.
+    VmbUint32_t height;                              // Rows scored.
+    VmbUint64_t t2;                                  // Tenengrad threshold, squared.
+    AlliedFocusSums_s sums[ALLIED_POOL_MAX_THREADS]; // Sums, by task.
+} AlliedFocusJob_s;
+
+static void allied_focus_task(void *arg, VmbUint32_t index, VmbUint32_t count)
+{
+    AlliedFocusJob_s *job = (AlliedFocusJob_s *)arg;
+    VmbUint32_t first = (VmbUint32_t)((VmbUint64_t)job->height * index / count);
+    VmbUint32_t last = (VmbUint32_t)((VmbUint64_t)job->height * (index + 1) / count);
+    AlliedFocusSums_s sums = {0};
+    for (VmbUint32_t y = first; y < last; y++)
+    {
+        job->row(job->first + (size_t)y * job->stride, job->stride, job->width, job->t2, &sums);
+    }
+    job->sums[index] = sums;
+}
+
+VmbError_t allied_focus_score(const AlliedImage_t *image, const AlliedFocusConfig_t *config, double *score)
+{
+    assert(image);
+    assert(score);
+    AlliedFocusConfig_t c = {0};
+    if (config != NULL)
+    {
+        c = *config;
+    }
+    if (c.metric > AlliedFocusBrenner || !(c.threshold >= 0) || image->data == NULL)
+    {
+        return VmbErrorBadParameter;
+    }
+    const AlliedImageKernels_s *kernels = allied_image_kernels(image->format);
+    if (kernels == NULL)
+    {
+        return VmbErrorNotSupported;
+    }
+    size_t row = (size_t)image->width * kernels->pixel_size;
+    size_t stride = image->stride == 0 ? row : image->stride;
+    if (stride < row || c.x >= image->width || c.y >= image->height)
+    {
+        return VmbErrorBadParameter;
+    }
+    VmbUint32_t width = c.width == 0 ? image->width - c.x : c.width;
+    VmbUint32_t height = c.height == 0 ? image->height - c.y : c.height;
+    if (width > image->width - c.x || height > image->height - c.y)
+    {
+        return VmbErrorBadParameter;
+    }
+    VmbUint32_t d = kernels->bayer ? 2 : 1;
+    // pixels left out on every side of the region: the neighbours of the pixels scored stay inside it
+    VmbUint32_t left = c.metric == AlliedFocusBrenner ? 0 : d;
+    VmbUint32_t right = c.metric == AlliedFocusBrenner ? 2 * d : d;
+    VmbUint32_t top = c.metric == AlliedFocusBrenner ? 0 : d;
+    if (width <= left + right || height <= 2 * top)
+    {
+        return VmbErrorBadParameter;
+    }
+    allied_dispatch_init();
+    AlliedFocusJob_s job = {
+        .row = focus_kernels->row[kernels->pixel_size == 1 ? 0 : 1][d - 1][c.metric],
+        .first = (const VmbUchar_t *)image->data + (size_t)(c.y + top) * stride + (size_t)(c.x + left) * kernels->pixel_size,
+        .stride = stride,
+        .width = width - left - right,
+        .height = height - 2 * top,
+        .t2 = (VmbUint64_t)ceil(c.threshold * c.threshold),
+    };
+    VmbUint32_t tasks = 1;
+    if (c.threads > 1)
+    {
+        tasks = allied_pool_threads(c.threads);
+        tasks = job.height < tasks ? job.height : tasks;
+    }
+    allied_pool_run(tasks, &allied_focus_task, &job);
+    double sum = 0, sum2 = 0, count = 0;
+    for (VmbUint32_t i = 0; i < tasks; i++)
+    {
+        sum += (double)job.sums[i].sum;
+        sum2 += (double)job.sums[i].sum2;
+        count += (double)job.sums[i].count;
+    }
+    *score = sum2 / count;
+    if (c.metric == AlliedFocusLaplacian)
+    {
+        double mean = sum / count;
+        *score = fmax(*score - mean * mean, 0);
+    }
+    return VmbErrorSuccess;
+}
+
+/**
+ * @brief Entry of the selector heap.
+ *
+ */
+typedef struct
+{
+    AlliedBestFrame_t frame; // Held frame.
+    VmbFrame_t *retained;    // Frame referenced in retain mode, NULL otherwise.
+    void *copy;              // Copy buffer, kept across evictions and resets.
+    size_t capacity;         // Bytes of the copy buffer.
+} AlliedBestEntry_s;
+
+struct allied_best_s
+{
+    AlliedBestConfig_t config;  // Configuration.
+    AlliedBestEntry_s *heap;    // Min-heap of `config.count` entries, by score.
+    AlliedBestEntry_s **order;  // Entries sorted by rank, for the iteration.
+    VmbUint32_t held;           // Entries in the heap.
+    VmbUint64_t offered;        // Frames offered since the last reset.
+    VmbUint64_t selected;       // Frames selected since the last reset.
+    pthread_mutex_t lock;       // Lock of the heap and counters.
+    AlliedSubscriber_t sub;     // Subscription of the attached camera, NULL if not attached.
+    pthread_t thread;           // Thread that feeds the selector from the subscription.
+    atomic_bool running;        // The feeding thread runs.
+    _Atomic VmbError_t error;   // Result of the last frame from the camera.
+};
+
+VmbError_t allied_best_create(AlliedBest_t *best, const AlliedBestConfig_t *config)
+{
+    assert(best);
+    assert(config);
+    *best = NULL;
+    if (config->count == 0 || config->count > ALLIED_BEST_MAX_COUNT || config->mode > AlliedBestCopy ||
+        config->focus.metric > AlliedFocusBrenner || !(config->focus.threshold >= 0))
+    {
+        return VmbErrorBadParameter;
+    }
+    struct allied_best_s *b = (struct allied_best_s *)calloc(1, sizeof(struct allied_best_s));
+    if (b == NULL)
+    {
+        return VmbErrorResources;
+    }
+    b->config = *config;
+    b->heap = (AlliedBestEntry_s *)calloc(config->count, sizeof(AlliedBestEntry_s));
+    b->order = (AlliedBestEntry_s **)calloc(config->count, sizeof(AlliedBestEntry_s *));
+    if (b->heap == NULL || b->order == NULL)
+    {
+        free(b->heap);
+        free(b->order);
+        free(b);
+        return VmbErrorResources;
+    }
+    pthread_mutex_init(&(b->lock), NULL);
+    atomic_init(&(b->running), false);
+    atomic_init(&(b->error), VmbErrorSuccess);
+    *best = b;
+    return VmbErrorSuccess;
+}
+
+/**
+ * @brief Release the held frames. Called with the lock held.
+ *
+ */
+static void allied_best_clear(struct allied_best_s *b)
+{
+    for (VmbUint32_t i = 0; i < b->held; i++)
+    {
+        if (b->heap[i].retained != NULL)
+        {
+            allied_frame_release(b->heap[i].retained);
+            b->heap[i].retained = NULL;
+        }
+    }
+    b->held = 0;
+    b->offered = 0;
+    b->selected = 0;
+}
+
+VmbError_t allied_best_destroy(AlliedBest_t *best)
+{
+    assert(best);
+    if (*best == NULL)
+    {
+        return VmbErrorSuccess;
+    }
+    struct allied_best_s *b = *best;
+    allied_best_detach(b);
+    allied_best_clear(b);
+    for (VmbUint32_t i = 0; i < b->config.count; i++)
+    {
+        free(b->heap[i].copy);
+    }
+    pthread_mutex_destroy(&(b->lock));
+    free(b->heap);
+    free(b->order);
+    free(b);
+    *best = NULL;
+    return VmbErrorSuccess;
+}
+
+static void allied_best_swap(AlliedBestEntry_s *a, AlliedBestEntry_s *b)
+{
+    AlliedBestEntry_s t = *a;
+    *a = *b;
+    *b = t;
+}
+
+/**
+ * @brief Move an entry towards the root until its parent scores lower.
+ *
+ */
+static void allied_best_sift_up(AlliedBestEntry_s *heap, VmbUint32_t i)
+{
+    while (i > 0)
+    {
+        VmbUint32_t parent = (i - 1) / 2;
+        if (heap[parent].frame.score <= heap[i].frame.score)
+        {
+            break;
+        }
+        allied_best_swap(&heap[parent], &heap[i]);
+        i = parent;
+    }
+}
+
+/**
+ * @brief Move an entry towards the leaves until its children score higher.
+ *
+ */
+static void allied_best_sift_down(AlliedBestEntry_s *heap, VmbUint32_t count, VmbUint32_t i)
+{
+    for (;;)
+    {
+        VmbUint32_t lowest = i;
+        VmbUint32_t l = 2 * i + 1;
+        VmbUint32_t r = l + 1;
+        if (l < count && heap[l].frame.score < heap[lowest].frame.score)
+        {
+            lowest = l;
+        }
+        if (r < count && heap[r].frame.score < heap[lowest].frame.score)
+        {
+            lowest = r;
+        }
+        if (lowest == i)
+        {
+            break;
+        }
+        allied_best_swap(&heap[lowest], &heap[i]);
+        i = lowest;
+    }
+}
+
+VmbError_t allied_best_offer(AlliedBest_t best, const AlliedFrameView_t *view, double score, bool *selected)
+{
+    assert(best);
+    assert(view);
+    if (selected != NULL)
+    {
+        *selected = false;
+    }
+    AlliedImage_t image;
+    VmbError_t err = allied_image_from_view(view, &image);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    size_t row = (size_t)image.width * allied_image_pixel_size(image.format);
+    if (row == 0)
+    {
+        return VmbErrorNotSupported;
+    }
+    pthread_mutex_lock(&(best->lock));
+    best->offered++;
+    bool full = best->held == best->config.count;
+    if (full && !(score > best->heap[0].frame.score))
+    {
+        pthread_mutex_unlock(&(best->lock));
+        return VmbErrorSuccess;
+    }
+    // the evicted root, or the next free entry, takes the frame
+    AlliedBestEntry_s *e = full ? &(best->heap[0]) : &(best->heap[best->held]);
+    if (best->config.mode == AlliedBestCopy)
+    {
+        size_t size = row * image.height;
+        if (size > e->capacity)
+        {
+            void *copy = realloc(e->copy, size);
+            if (copy == NULL)
+            {
+                pthread_mutex_unlock(&(best->lock));
+                return VmbErrorResources;
+            }
+            e->copy = copy;
+            e->capacity = size;
+        }
+        size_t stride = image.stride == 0 ? row : image.stride;
+        for (VmbUint32_t y = 0; y < image.height; y++)
+        {
+            memcpy((VmbUchar_t *)e->copy + (size_t)y * row, (const VmbUchar_t *)image.data + (size_t)y * stride, row);
+        }
+        image.data = e->copy;
+        image.stride = row;
+    }
+    else
+    {
+        err = allied_frame_retain(view->frame);
+        if (err != VmbErrorSuccess)
+        {
+            pthread_mutex_unlock(&(best->lock));
+            return err;
+        }
+        if (e->retained != NULL)
+        {
+            allied_frame_release(e->retained);
+        }
+        e->retained = view->frame;
+    }
+    e->frame.image = image;
+    e->frame.score = score;
+    e->frame.frame_id = view->frame->frameID;
+    e->frame.timestamp = view->frame->timestamp;
+    e->frame.offset_x = view->frame->offsetX + view->offset_x;
+    e->frame.offset_y = view->frame->offsetY + view->offset_y;
+    if (full)
+    {
+        allied_best_sift_down(best->heap, best->held, 0);
+    }
+    else
+    {
+        allied_best_sift_up(best->heap, best->held++);
+    }
+    best->selected++;
+    pthread_mutex_unlock(&(best->lock));
+    if (selected != NULL)
+    {
+        *selected = true;
+    }
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_best_add(AlliedBest_t best, const AlliedFrameView_t *view, double *score, bool *selected)
+{
+    assert(best);
+    assert(view);
+    if (selected != NULL)
+    {
+        *selected = false;
+    }
+    AlliedImage_t image;
+    VmbError_t err = allied_image_from_view(view, &image);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    double s;
+    err = allied_focus_score(&image, &(best->config.focus), &s);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    if (score != NULL)
+    {
+        *score = s;
+    }
+    return allied_best_offer(best, view, s, selected);
+}
+
+static int allied_best_compare(const void *a, const void *b)
+{
+    double sa = (*(AlliedBestEntry_s *const *)a)->frame.score;
+    double sb = (*(AlliedBestEntry_s *const *)b)->frame.score;
+    return sa < sb ? 1 : (sa > sb ? -1 : 0);
+}
+
+VmbError_t allied_best_foreach(AlliedBest_t best, AlliedBestCallback callback, void *user_data)
+{
+    assert(best);
+    assert(callback);
+    VmbError_t err = VmbErrorSuccess;
+    pthread_mutex_lock(&(best->lock));
+    for (VmbUint32_t i = 0; i < best->held; i++)
+    {
+        best->order[i] = &(best->heap[i]);
+    }
+    qsort(best->order, best->held, sizeof(AlliedBestEntry_s *), &allied_best_compare);
+    for (VmbUint32_t i = 0; i < best->held && err == VmbErrorSuccess; i++)
+    {
+        best->order[i]->frame.rank = i;
+        err = callback(&(best->order[i]->frame), user_data);
+    }
+    pthread_mutex_unlock(&(best->lock));
+    return err;
+}
+
+VmbError_t allied_best_reset(AlliedBest_t best)
+{
+    assert(best);
+    pthread_mutex_lock(&(best->lock));
+    allied_best_clear(best);
+    pthread_mutex_unlock(&(best->lock));
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_best_status(AlliedBest_t best, AlliedBestStatus_t *status)
+{
+    assert(best);
+    assert(status);
+    memset(status, 0, sizeof(AlliedBestStatus_t));
+    pthread_mutex_lock(&(best->lock));
+    status->held = best->held;
+    status->lowest = best->held > 0 ? best->heap[0].frame.score : 0;
+    status->offered = best->offered;
+    status->selected = best->selected;
+    pthread_mutex_unlock(&(best->lock));
+    status->attached = atomic_load(&(best->running));
+    status->error = atomic_load(&(best->error));
+    if (status->attached)
+    {
+        allied_subscriber_counts(best->sub, NULL, NULL, &(status->dropped));
+    }
+    return VmbErrorSuccess;
+}
+
+/**
+ * @brief Thread that feeds a selector from its subscription.
+ *
+ */
+static void *allied_best_thread(void *arg)
+{
+    struct allied_best_s *b = (struct allied_best_s *)arg;
+    while (atomic_load(&(b->running)))
+    {
+        AlliedFrameView_t view;
+        if (allied_subscriber_pop(b->sub, &view, ALLIED_BEST_POLL_MS) != VmbErrorSuccess)
+        {
+            continue;
+        }
+        VmbError_t err = allied_best_add(b, &view, NULL, NULL);
+        // a selected frame holds its own reference
+        allied_frame_release(view.frame);
+        atomic_store(&(b->error), err);
+    }
+    return NULL;
+}
+
+VmbError_t allied_best_attach(AlliedBest_t best, AlliedCameraHandle_t handle, const AlliedSubscription_t *subscription)
+{
+    assert(best);
+    assert(handle);
+    if (best->sub != NULL)
+    {
+        return VmbErrorInvalidCall;
+    }
+    AlliedSubscription_t config = {.queue_depth = 4, .policy = AlliedBackpressureDropNewest};
+    if (subscription != NULL)
+    {
+        config = *subscription;
+        config.callback = NULL;
+    }
+    // retained frames and the queue come out of the capture pool, which must keep at least one frame for the driver
+    VmbUint32_t frames = allied_get_num_frames(handle);
+    if (best->config.mode == AlliedBestRetain && frames > 0 && (VmbUint64_t)best->config.count + config.queue_depth >= frames)
+    {
+        return VmbErrorBadParameter;
+    }
+    VmbError_t err = allied_subscribe(handle, &config, &(best->sub));
+    if (err != VmbErrorSuccess)
+    {
+        best->sub = NULL;
+        return err;
+    }
+    atomic_store(&(best->error), VmbErrorSuccess);
+    atomic_store(&(best->running), true);
+    if (pthread_create(&(best->thread), NULL, &allied_best_thread, best) != 0)
+    {
+        atomic_store(&(best->running), false);
+        allied_unsubscribe(&(best->sub));
+        return VmbErrorResources;
+    }
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_best_detach(AlliedBest_t best)
+{
+    assert(best);
+    if (best->sub == NULL)
+    {
+        return VmbErrorSuccess;
+    }
+    atomic_store(&(best->running), false);
+    pthread_join(best->thread, NULL);
+    allied_unsubscribe(&(best->sub));
+    return VmbErrorSuccess;
+}
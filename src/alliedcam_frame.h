@@ -0,0 +1,49 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_frame.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Internal helpers to access the image data of a frame.
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef ALLIEDCAM_FRAME_H_
+#define ALLIEDCAM_FRAME_H_
+
+#include <stddef.h>
+#include <VmbC/VmbCTypeDefinitions.h>
+
+/**
+ * @brief Effective bits per pixel of a pixel format.
+ *
+ * @param format Pixel format
+ * @return VmbUint32_t Bits per pixel
+ */
+static inline VmbUint32_t allied_format_bits(VmbPixelFormat_t format)
+{
+    return (format >> 16) & 0xff;
+}
+
+/**
+ * @brief Get the image data of a frame, and check that it lies inside the frame buffer.
+ *
+ * @param frame Frame
+ * @param size Size of the image data, in bytes
+ * @return const VmbUchar_t* Image data, NULL if it does not fit in the frame buffer
+ */
+static inline const VmbUchar_t *allied_frame_data(const VmbFrame_t *frame, size_t size)
+{
+    const VmbUchar_t *buffer = (const VmbUchar_t *)frame->buffer;
+    const VmbUchar_t *data = frame->imageData != NULL ? frame->imageData : buffer;
+    if (buffer == NULL || data < buffer || (size_t)(data - buffer) + size > frame->bufferSize)
+    {
+        return NULL;
+    }
+    return data;
+}
+
+#endif /* ALLIEDCAM_FRAME_H_ */
@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_histogram.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Internal single-pass image statistics with caller-owned histogram memory.
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef ALLIEDCAM_HISTOGRAM_H_
+#define ALLIEDCAM_HISTOGRAM_H_
+
+#include "alliedcam_stats.h"
+
+/**
+ * @brief Number of histograms filled in turn, so that runs of equal pixels do not wait on the previous increment of the same bin.
+ *
+ */
+#define ALLIED_STATS_LANES 4
+
+/**
+ * @brief Number of 32-bit counters needed by {@link allied_stats_run}.
+ *
+ */
+#define ALLIED_STATS_SCRATCH (ALLIED_STATS_LANES * ALLIED_STATS_BINS)
+
+/**
+ * @brief Compute the statistics of an image, see {@link allied_stats_compute}.
+ *
+ * @param image Image.
+ * @param config Region, sub-sampling and percentiles.
+ * @param stats Statistics.
+ * @param scratch At least {@link ALLIED_STATS_SCRATCH} counters. The contents are overwritten.
+ * @return VmbError_t `VmbErrorSuccess` if successful, otherwise an error code.
+ */
+VmbError_t allied_stats_run(const AlliedImage_t *image, const AlliedStatsConfig_t *config, AlliedFrameStats_t *stats, VmbUint32_t *scratch);
+
+#endif /* ALLIEDCAM_HISTOGRAM_H_ */
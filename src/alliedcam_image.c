@@ -0,0 +1,233 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_image.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Image processing kernels for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "alliedcam_image.h"
+#include "alliedcam_bin.h"
+#include "alliedcam_kernels.h"
+#include "alliedcam_frame.h"
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+/**
+ * @brief Look up the kernels of a source image, and make a copy of the image with the stride set.
+ *
+ */
+static VmbError_t allied_image_source(const AlliedImage_t *src, AlliedImage_t *img, const AlliedImageKernels_s **kernels)
+{
+    *kernels = allied_image_kernels(src->format);
+    if (*kernels == NULL)
+    {
+        return VmbErrorNotSupported;
+    }
+    if (src->data == NULL)
+    {
+        return VmbErrorBadParameter;
+    }
+    size_t row = (size_t)src->width * (*kernels)->pixel_size;
+    *img = *src;
+    img->stride = src->stride == 0 ? row : src->stride;
+    if (img->stride < row)
+    {
+        return VmbErrorBadParameter;
+    }
+    return VmbErrorSuccess;
+}
+
+/**
+ * @brief Set the size and format of a destination image, and make a copy of the image with the stride set.
+ *
+ */
+static VmbError_t allied_image_dest(AlliedImage_t *dst, const AlliedImageKernels_s *kernels, VmbUint32_t width, VmbUint32_t height, AlliedImage_t *img)
+{
+    if (dst->data == NULL)
+    {
+        return VmbErrorBadParameter;
+    }
+    size_t row = (size_t)width * kernels->pixel_size;
+    if (dst->stride != 0 && dst->stride < row)
+    {
+        return VmbErrorBadParameter;
+    }
+    dst->width = width;
+    dst->height = height;
+    dst->format = kernels->format;
+    *img = *dst;
+    img->stride = dst->stride == 0 ? row : dst->stride;
+    return VmbErrorSuccess;
+}
+
+bool allied_image_supported(VmbPixelFormat_t format)
+{
+    return allied_image_kernels(format) != NULL;
+}
+
+size_t allied_image_pixel_size(VmbPixelFormat_t format)
+{
+    const AlliedImageKernels_s *kernels = allied_image_kernels(format);
+    return kernels == NULL ? 0 : kernels->pixel_size;
+}
+
+VmbUint32_t allied_image_bits(VmbPixelFormat_t format)
+{
+    const AlliedImageKernels_s *kernels = allied_image_kernels(format);
+    return kernels == NULL ? 0 : kernels->bits;
+}
+
+VmbError_t allied_image_from_frame(const VmbFrame_t *frame, AlliedImage_t *image)
+{
+    assert(frame);
+    assert(image);
+    const AlliedImageKernels_s *kernels = allied_image_kernels(frame->pixelFormat);
+    if (kernels == NULL)
+    {
+        return VmbErrorNotSupported;
+    }
+    size_t stride = (size_t)frame->width * kernels->pixel_size;
+    const VmbUchar_t *data = allied_frame_data(frame, stride * frame->height);
+    if (data == NULL)
+    {
+        return VmbErrorBadParameter;
+    }
+    image->data = (void *)data;
+    image->width = frame->width;
+    image->height = frame->height;
+    image->stride = stride;
+    image->format = frame->pixelFormat;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_image_from_view(const AlliedFrameView_t *view, AlliedImage_t *image)
+{
+    assert(view);
+    assert(image);
+    if (!allied_image_supported(view->format))
+    {
+        return VmbErrorNotSupported;
+    }
+    image->data = view->data;
+    image->width = view->width;
+    image->height = view->height;
+    image->stride = view->stride;
+    image->format = view->format;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_image_stats(const AlliedImage_t *image, AlliedImageStats_t *stats)
+{
+    assert(image);
+    assert(stats);
+    const AlliedImageKernels_s *kernels;
+    AlliedImage_t img;
+    VmbError_t err = allied_image_source(image, &img, &kernels);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    memset(stats, 0, sizeof(*stats));
+    stats->count = (VmbUint64_t)img.width * img.height;
+    if (stats->count == 0)
+    {
+        return VmbErrorSuccess;
+    }
+    kernels->stats(&img, stats);
+    stats->mean = (double)stats->sum / stats->count;
+    double var = (double)stats->sumsq / stats->count - stats->mean * stats->mean;
+    stats->stddev = var > 0 ? sqrt(var) : 0;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_image_lut(const AlliedImage_t *src, const VmbUint16_t *lut, size_t lut_size, AlliedImage_t *dst)
+{
+    assert(src);
+    assert(lut);
+    assert(dst);
+    const AlliedImageKernels_s *kernels;
+    AlliedImage_t in, out;
+    VmbError_t err = allied_image_source(src, &in, &kernels);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    if (lut_size < ((size_t)1 << kernels->bits))
+    {
+        return VmbErrorMoreData;
+    }
+    err = allied_image_dest(dst, kernels, in.width, in.height, &out);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    kernels->lut(&in, lut, &out);
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_image_crop(const AlliedImage_t *src, VmbUint32_t x, VmbUint32_t y, VmbUint32_t width, VmbUint32_t height, AlliedImage_t *dst)
+{
+    assert(src);
+    assert(dst);
+    const AlliedImageKernels_s *kernels;
+    AlliedImage_t in, out;
+    VmbError_t err = allied_image_source(src, &in, &kernels);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    if ((VmbUint64_t)x + width > in.width || (VmbUint64_t)y + height > in.height)
+    {
+        return VmbErrorInvalidValue;
+    }
+    if (kernels->bayer && ((x | y) & 1))
+    {
+        return VmbErrorInvalidValue;
+    }
+    err = allied_image_dest(dst, kernels, width, height, &out);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    kernels->crop(&in, x, y, &out);
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_image_bin(const AlliedImage_t *src, VmbUint32_t bin_x, VmbUint32_t bin_y, AlliedBinMode_t mode, AlliedImage_t *dst)
+{
+    assert(src);
+    assert(dst);
+    AlliedBinOptions_t opts = {
+        .bin_x = bin_x,
+        .bin_y = bin_y,
+        .mode = mode,
+    };
+    return allied_bin(src, &opts, dst);
+}
+
+VmbError_t allied_image_accumulate(const AlliedImage_t *src, VmbUint32_t *acc, size_t acc_stride)
+{
+    assert(src);
+    assert(acc);
+    const AlliedImageKernels_s *kernels;
+    AlliedImage_t in;
+    VmbError_t err = allied_image_source(src, &in, &kernels);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    acc_stride = acc_stride == 0 ? in.width : acc_stride;
+    if (acc_stride < in.width)
+    {
+        return VmbErrorBadParameter;
+    }
+    kernels->accumulate(&in, acc, acc_stride);
+    return VmbErrorSuccess;
+}
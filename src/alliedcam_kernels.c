@@ -0,0 +1,181 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_kernels.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Image kernels specialized per pixel format, bit depth and CPU level.
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details The kernel bodies are written once, in {@link ALLIED_IMAGE_KERNELS}, against a pixel type `T` and a bit depth `BITS` that are
+ * compile time constants. The macro is expanded for every container and depth, and for every CPU level with the matching target
+ * attribute, so the compiler vectorizes each copy for its instruction set (this file is built with -O3, see the Makefile). The per-format
+ * tables map the low bits of the pixel format to the kernels, and {@link allied_image_kernels} looks a format up in the table bound to
+ * the current CPU level.
+ */
+
+#include "alliedcam_kernels.h"
+#include "alliedcam_dispatch.h"
+#include <string.h>
+
+/**
+ * @brief Pixels summed in 32 bits before the sum is folded into 64 bits.
+ *
+ */
+#define ALLIED_STATS_CHUNK 16384
+
+/**
+ * @brief Number of slots in a format table. The low bits of every supported pixel format are distinct.
+ *
+ */
+#define ALLIED_FORMAT_SLOTS 64
+#define ALLIED_FORMAT_SLOT(format) ((format) & (ALLIED_FORMAT_SLOTS - 1))
+
+/**
+ * @brief Instantiate the image kernels for a pixel type and bit depth.
+ *
+ * @param NAME Suffix of the kernel names.
+ * @param TARGET Target attribute of the CPU level, or nothing.
+ * @param T Pixel container type.
+ * @param BITS Significant bits per pixel.
+ * @param SQ Type of the partial sums of squares, wide enough for {@link ALLIED_STATS_CHUNK} squared pixels.
+ */
+#define ALLIED_IMAGE_KERNELS(NAME, TARGET, T, BITS, SQ)                                                                  \
+    TARGET static void allied_stats_##NAME(const AlliedImage_t *img, AlliedImageStats_t *stats)                          \
+    {                                                                                                                    \
+        T lo = (T)~(T)0, hi = 0;                                                                                         \
+        VmbUint64_t sum = 0, sumsq = 0;                                                                                  \
+        for (VmbUint32_t y = 0; y < img->height; y++)                                                                    \
+        {                                                                                                                \
+            const T *row = ALLIED_IMAGE_ROW(const T, img, y);                                                            \
+            for (VmbUint32_t x0 = 0; x0 < img->width; x0 += ALLIED_STATS_CHUNK)                                          \
+            {                                                                                                            \
+                VmbUint32_t n = img->width - x0 < ALLIED_STATS_CHUNK ? img->width - x0 : ALLIED_STATS_CHUNK;             \
+                const T *px = row + x0;                                                                                  \
+                T clo = lo, chi = hi;                                                                                    \
+                VmbUint32_t s = 0;                                                                                       \
+                SQ q = 0;                                                                                                \
+                for (VmbUint32_t x = 0; x < n; x++)                                                                      \
+                {                                                                                                        \
+                    T v = px[x];                                                                                         \
+                    clo = v < clo ? v : clo;                                                                             \
+                    chi = v > chi ? v : chi;                                                                             \
+                    s += v;                                                                                              \
+                    q += (SQ)v * v;                                                                                      \
+                }                                                                                                        \
+                lo = clo;                                                                                                \
+                hi = chi;                                                                                                \
+                sum += s;                                                                                                \
+                sumsq += q;                                                                                              \
+            }                                                                                                            \
+        }                                                                                                                \
+        stats->min = lo;                                                                                                 \
+        stats->max = hi;                                                                                                 \
+        stats->sum = sum;                                                                                                \
+        stats->sumsq = sumsq;                                                                                            \
+    }                                                                                                                    \
+                                                                                                                         \
+    TARGET static void allied_lut_##NAME(const AlliedImage_t *src, const VmbUint16_t *lut, AlliedImage_t *dst)           \
+    {                                                                                                                    \
+        const VmbUint32_t mask = (1u << (BITS)) - 1;                                                                     \
+        for (VmbUint32_t y = 0; y < src->height; y++)                                                                    \
+        {                                                                                                                \
+            const T *s = ALLIED_IMAGE_ROW(const T, src, y);                                                              \
+            T *d = ALLIED_IMAGE_ROW(T, dst, y);                                                                          \
+            for (VmbUint32_t x = 0; x < src->width; x++)                                                                 \
+            {                                                                                                            \
+                VmbUint32_t v = lut[s[x] & mask];                                                                        \
+                d[x] = (T)(v > mask ? mask : v);                                                                         \
+            }                                                                                                            \
+        }                                                                                                                \
+    }                                                                                                                    \
+                                                                                                                         \
+    TARGET static void allied_crop_##NAME(const AlliedImage_t *src, VmbUint32_t x, VmbUint32_t y, AlliedImage_t *dst)    \
+    {                                                                                                                    \
+        for (VmbUint32_t r = 0; r < dst->height; r++)                                                                    \
+        {                                                                                                                \
+            memcpy(ALLIED_IMAGE_ROW(T, dst, r), ALLIED_IMAGE_ROW(const T, src, y + r) + x, dst->width * sizeof(T));      \
+        }                                                                                                                \
+    }                                                                                                                    \
+                                                                                                                         \
+    TARGET static void allied_accumulate_##NAME(const AlliedImage_t *src, VmbUint32_t *acc, size_t acc_stride)           \
+    {                                                                                                                    \
+        for (VmbUint32_t y = 0; y < src->height; y++)                                                                    \
+        {                                                                                                                \
+            const T *s = ALLIED_IMAGE_ROW(const T, src, y);                                                              \
+            VmbUint32_t *a = acc + y * acc_stride;                                                                       \
+            for (VmbUint32_t x = 0; x < src->width; x++)                                                                 \
+            {                                                                                                            \
+                a[x] += s[x];                                                                                            \
+            }                                                                                                            \
+        }                                                                                                                \
+    }
+
+/**
+ * @brief Instantiate the image kernels of every supported bit depth for a CPU level.
+ *
+ */
+#define ALLIED_IMAGE_DEPTHS(LEVEL, TARGET)                                    \
+    ALLIED_IMAGE_KERNELS(8_##LEVEL, TARGET, VmbUint8_t, 8, VmbUint32_t)       \
+    ALLIED_IMAGE_KERNELS(10_##LEVEL, TARGET, VmbUint16_t, 10, VmbUint64_t)    \
+    ALLIED_IMAGE_KERNELS(12_##LEVEL, TARGET, VmbUint16_t, 12, VmbUint64_t)    \
+    ALLIED_IMAGE_KERNELS(14_##LEVEL, TARGET, VmbUint16_t, 14, VmbUint64_t)    \
+    ALLIED_IMAGE_KERNELS(16_##LEVEL, TARGET, VmbUint16_t, 16, VmbUint64_t)
+
+#define ALLIED_FORMAT_ENTRY(FORMAT, BITS, LEVEL, BAYER)                                          \
+    [ALLIED_FORMAT_SLOT(FORMAT)] = {                                                             \
+        .format = (FORMAT),                                                                      \
+        .bits = (BITS),                                                                          \
+        .pixel_size = (BITS) > 8 ? 2 : 1,                                                        \
+        .bayer = (BAYER),                                                                        \
+        .stats = &allied_stats_##BITS##_##LEVEL,                                                 \
+        .lut = &allied_lut_##BITS##_##LEVEL,                                                     \
+        .crop = &allied_crop_##BITS##_##LEVEL,                                                   \
+        .accumulate = &allied_accumulate_##BITS##_##LEVEL,                                       \
+    }
+
+#define ALLIED_BAYER_ENTRIES(BITS, LEVEL)                                                        \
+    ALLIED_FORMAT_ENTRY(VmbPixelFormatBayerGR##BITS, BITS, LEVEL, true),                         \
+    ALLIED_FORMAT_ENTRY(VmbPixelFormatBayerRG##BITS, BITS, LEVEL, true),                         \
+    ALLIED_FORMAT_ENTRY(VmbPixelFormatBayerGB##BITS, BITS, LEVEL, true),                         \
+    ALLIED_FORMAT_ENTRY(VmbPixelFormatBayerBG##BITS, BITS, LEVEL, true)
+
+/**
+ * @brief Format table of a CPU level, indexed by {@link ALLIED_FORMAT_SLOT}.
+ *
+ */
+#define ALLIED_FORMAT_TABLE(LEVEL)                                                               \
+    static const AlliedImageKernels_s formats_##LEVEL[ALLIED_FORMAT_SLOTS] = {                   \
+        ALLIED_FORMAT_ENTRY(VmbPixelFormatMono8, 8, LEVEL, false),                               \
+        ALLIED_FORMAT_ENTRY(VmbPixelFormatMono10, 10, LEVEL, false),                             \
+        ALLIED_FORMAT_ENTRY(VmbPixelFormatMono12, 12, LEVEL, false),                             \
+        ALLIED_FORMAT_ENTRY(VmbPixelFormatMono14, 14, LEVEL, false),                             \
+        ALLIED_FORMAT_ENTRY(VmbPixelFormatMono16, 16, LEVEL, false),                             \
+        ALLIED_BAYER_ENTRIES(8, LEVEL),                                                          \
+        ALLIED_BAYER_ENTRIES(10, LEVEL),                                                         \
+        ALLIED_BAYER_ENTRIES(12, LEVEL),                                                         \
+        ALLIED_BAYER_ENTRIES(16, LEVEL),                                                         \
+    };
+
+#define ALLIED_IMAGE_LEVEL(LEVEL, TARGET) \
+    ALLIED_IMAGE_DEPTHS(LEVEL, TARGET)    \
+    ALLIED_FORMAT_TABLE(LEVEL)
+
+ALLIED_KERNEL_LEVELS(ALLIED_IMAGE_LEVEL)
+
+static const AlliedImageKernels_s *format_table = formats_scalar;
+
+ALLIED_KERNEL_BINDER(allied_image_bind, format_table, formats)
+
+const AlliedImageKernels_s *allied_image_kernels(VmbPixelFormat_t format)
+{
+    allied_dispatch_init();
+    const AlliedImageKernels_s *kernels = &format_table[ALLIED_FORMAT_SLOT(format)];
+    if (kernels->format != format || kernels->stats == NULL)
+    {
+        return NULL;
+    }
+    return kernels;
+}
@@ -0,0 +1,56 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_kernels.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Internal table of image kernels specialized per pixel format.
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details The kernels are instantiated by macros in alliedcam_kernels.c, once per pixel container and bit depth, and once per CPU level.
+ * Arguments are validated by the callers; kernels assume the images are well formed, and the strides are set.
+ */
+
+#ifndef ALLIEDCAM_KERNELS_H_
+#define ALLIEDCAM_KERNELS_H_
+
+#include "alliedcam_image.h"
+
+/**
+ * @brief Row `y` of an image with the stride set, as a pointer to `T`.
+ *
+ */
+#define ALLIED_IMAGE_ROW(T, img, y) ((T *)((VmbUchar_t *)(img)->data + (size_t)(y) * (img)->stride))
+
+typedef void (*AlliedStatsKernel)(const AlliedImage_t *img, AlliedImageStats_t *stats);
+typedef void (*AlliedLutKernel)(const AlliedImage_t *src, const VmbUint16_t *lut, AlliedImage_t *dst);
+typedef void (*AlliedCropKernel)(const AlliedImage_t *src, VmbUint32_t x, VmbUint32_t y, AlliedImage_t *dst);
+typedef void (*AlliedAccumulateKernel)(const AlliedImage_t *src, VmbUint32_t *acc, size_t acc_stride);
+
+/**
+ * @brief Kernels of one pixel format.
+ *
+ */
+typedef struct
+{
+    VmbPixelFormat_t format;           // Pixel format.
+    VmbUint32_t bits;                  // Significant bits per pixel.
+    VmbUint32_t pixel_size;            // Bytes per pixel.
+    bool bayer;                        // Bayer color filter image.
+    AlliedStatsKernel stats;           // Pixel statistics.
+    AlliedLutKernel lut;               // Lookup table.
+    AlliedCropKernel crop;             // Region copy.
+    AlliedAccumulateKernel accumulate; // Accumulation into 32 bits.
+} AlliedImageKernels_s;
+
+/**
+ * @brief Get the kernels of a pixel format at the bound CPU level.
+ *
+ * @param format Pixel format
+ * @return const AlliedImageKernels_s* Kernels, NULL if the format is not supported
+ */
+const AlliedImageKernels_s *allied_image_kernels(VmbPixelFormat_t format);
+
+#endif /* ALLIEDCAM_KERNELS_H_ */
@@ -0,0 +1,493 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_numa.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Host topology discovery and NUMA placement helpers.
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#define _GNU_SOURCE
+#include "alliedcam_numa.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+#include <VmbC/VmbC.h>
+
+#ifdef __linux__
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#ifndef ALLIED_SYSFS_PCI
+#define ALLIED_SYSFS_PCI "/sys/bus/pci/devices"
+#endif // !ALLIED_SYSFS_PCI
+
+#ifndef ALLIED_SYSFS_NET
+#define ALLIED_SYSFS_NET "/sys/class/net"
+#endif // !ALLIED_SYSFS_NET
+
+#ifndef ALLIED_SYSFS_NODE
+#define ALLIED_SYSFS_NODE "/sys/devices/system/node"
+#endif // !ALLIED_SYSFS_NODE
+
+#ifdef __linux__
+/**
+ * @brief Read the first line of a sysfs file, stripping the trailing newline.
+ *
+ * @param path Path to the file
+ * @param buf Buffer to store the line
+ * @param len Size of the buffer
+ * @return true if the file was read
+ */
+static bool sysfs_read(const char *path, char *buf, size_t len)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        return false;
+    }
+    bool ok = fgets(buf, len, fp) != NULL;
+    fclose(fp);
+    if (ok)
+    {
+        buf[strcspn(buf, "\r\n")] = '\0';
+    }
+    return ok;
+}
+
+/**
+ * @brief Check if a string starts with a PCI address (`dddd:bb:dd.f`), and canonicalize it.
+ *
+ * @param str String to check
+ * @param bdf Buffer of at least 13 bytes to store the canonical address
+ * @return true if the string starts with a PCI address that exists on this host
+ */
+static bool parse_pci_address(const char *str, char *bdf)
+{
+    unsigned int dom = 0, bus, dev, fn;
+    char tail;
+    if (!isxdigit((unsigned char)str[0]))
+    {
+        return false;
+    }
+    if (sscanf(str, "%4x:%2x:%2x.%1x%c", &dom, &bus, &dev, &fn, &tail) < 4)
+    {
+        dom = 0;
+        if (sscanf(str, "%2x:%2x.%1x%c", &bus, &dev, &fn, &tail) < 3)
+        {
+            return false;
+        }
+    }
+    char path[PATH_MAX];
+    snprintf(bdf, 13, "%04x:%02x:%02x.%1x", dom & 0xffff, bus & 0xff, dev & 0x1f, fn & 0x7);
+    snprintf(path, sizeof(path), ALLIED_SYSFS_PCI "/%s", bdf);
+    return access(path, F_OK) == 0;
+}
+
+/**
+ * @brief Find a PCI address anywhere inside a string.
+ *
+ * @param str String to scan
+ * @param bdf Buffer of at least 13 bytes to store the canonical address
+ * @return true if found
+ */
+static bool find_pci_address(const char *str, char *bdf)
+{
+    if (str == NULL)
+    {
+        return false;
+    }
+    for (const char *p = str; *p; p++)
+    {
+        if ((p == str || !isxdigit((unsigned char)p[-1])) && parse_pci_address(p, bdf))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Resolve a sysfs device link to the closest upstream PCI device.
+ *
+ * @param link Path to a sysfs `device` link
+ * @param bdf Buffer of at least 13 bytes to store the canonical address
+ * @return true if a PCI device was found
+ */
+static bool pci_from_device_link(const char *link, char *bdf)
+{
+    char real[PATH_MAX];
+    if (realpath(link, real) == NULL)
+    {
+        return false;
+    }
+    // walk up the path, the last PCI component is the closest PCI device (e.g. the USB host controller)
+    char *slash;
+    while ((slash = strrchr(real, '/')) != NULL)
+    {
+        if (parse_pci_address(slash + 1, bdf))
+        {
+            return true;
+        }
+        *slash = '\0';
+    }
+    return false;
+}
+
+/**
+ * @brief Extract the hex digits of a MAC address from a string.
+ *
+ * @param str String to scan
+ * @param mac Buffer of at least 13 bytes to store the 12 lowercase hex digits
+ * @return true if 12 consecutive hex digits (ignoring `:` and `-`) were found
+ */
+static bool extract_mac(const char *str, char *mac)
+{
+    if (str == NULL)
+    {
+        return false;
+    }
+    int n = 0;
+    for (const char *p = str; *p && n < 12; p++)
+    {
+        if (isxdigit((unsigned char)*p))
+        {
+            mac[n++] = tolower((unsigned char)*p);
+        }
+        else if (*p != ':' && *p != '-')
+        {
+            n = 0;
+        }
+    }
+    mac[n] = '\0';
+    return n == 12;
+}
+
+/**
+ * @brief Find the PCI device of a network interface, by name or by MAC address.
+ *
+ * @param str Interface name, or a string containing the MAC address
+ * @param bdf Buffer of at least 13 bytes to store the canonical address
+ * @return true if found
+ */
+static bool pci_from_netdev(const char *str, char *bdf)
+{
+    char path[PATH_MAX];
+    if (str == NULL || *str == '\0' || strchr(str, '/') != NULL)
+    {
+        return false;
+    }
+    snprintf(path, sizeof(path), ALLIED_SYSFS_NET "/%s/device", str);
+    if (pci_from_device_link(path, bdf))
+    {
+        return true;
+    }
+    char mac[13], ifmac[32], ifmac_hex[13];
+    if (!extract_mac(str, mac))
+    {
+        return false;
+    }
+    DIR *dir = opendir(ALLIED_SYSFS_NET);
+    if (dir == NULL)
+    {
+        return false;
+    }
+    bool found = false;
+    struct dirent *ent;
+    while (!found && (ent = readdir(dir)) != NULL)
+    {
+        if (ent->d_name[0] == '.')
+        {
+            continue;
+        }
+        snprintf(path, sizeof(path), ALLIED_SYSFS_NET "/%s/address", ent->d_name);
+        if (!sysfs_read(path, ifmac, sizeof(ifmac)) || !extract_mac(ifmac, ifmac_hex))
+        {
+            continue;
+        }
+        if (strcmp(mac, ifmac_hex) == 0)
+        {
+            snprintf(path, sizeof(path), ALLIED_SYSFS_NET "/%s/device", ent->d_name);
+            found = pci_from_device_link(path, bdf);
+        }
+    }
+    closedir(dir);
+    return found;
+}
+
+/**
+ * @brief Parse a Linux cpulist string (e.g. `0-3,8-11`) into a CPU set.
+ *
+ * @param list cpulist string
+ * @param set CPU set to fill
+ * @return Number of CPUs in the set
+ */
+static int parse_cpulist(const char *list, cpu_set_t *set)
+{
+    CPU_ZERO(set);
+    const char *p = list;
+    while (*p)
+    {
+        char *end;
+        long lo = strtol(p, &end, 10), hi = lo;
+        if (end == p)
+        {
+            break;
+        }
+        p = end;
+        if (*p == '-')
+        {
+            hi = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (long cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; cpu++)
+        {
+            CPU_SET(cpu, set);
+        }
+        if (*p == ',')
+        {
+            p++;
+        }
+        else if (*p)
+        {
+            break;
+        }
+    }
+    return CPU_COUNT(set);
+}
+
+/**
+ * @brief Get the CPU set of a NUMA node.
+ *
+ * @param node NUMA node
+ * @param set CPU set to fill
+ * @return Number of CPUs in the set
+ */
+static int node_cpuset(int node, cpu_set_t *set)
+{
+    char path[PATH_MAX], list[1024];
+    snprintf(path, sizeof(path), ALLIED_SYSFS_NODE "/node%d/cpulist", node);
+    if (!sysfs_read(path, list, sizeof(list)))
+    {
+        CPU_ZERO(set);
+        return 0;
+    }
+    return parse_cpulist(list, set);
+}
+#endif // __linux__
+
+VmbError_t allied_numa_discover(VmbHandle_t handle, AlliedTopology_t *topo)
+{
+    assert(topo);
+    memset(topo, 0, sizeof(AlliedTopology_t));
+    topo->numa_node = -1;
+    VmbCameraInfo_t info;
+    VmbError_t err = VmbCameraInfoQueryByHandle(handle, &info, sizeof(info));
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    VmbUint32_t count = 0;
+    err = VmbInterfacesList(NULL, 0, &count, sizeof(VmbInterfaceInfo_t));
+    if (err != VmbErrorSuccess || count == 0)
+    {
+        return err == VmbErrorSuccess ? VmbErrorNotFound : err;
+    }
+    VmbInterfaceInfo_t *ifaces = (VmbInterfaceInfo_t *)malloc(count * sizeof(VmbInterfaceInfo_t));
+    if (ifaces == NULL)
+    {
+        return VmbErrorResources;
+    }
+    VmbUint32_t found = 0;
+    err = VmbInterfacesList(ifaces, count, &found, sizeof(VmbInterfaceInfo_t));
+    if (err != VmbErrorSuccess && err != VmbErrorMoreData)
+    {
+        free(ifaces);
+        return err;
+    }
+    found = found > count ? count : found;
+    const VmbInterfaceInfo_t *iface = NULL;
+    for (VmbUint32_t i = 0; i < found; i++)
+    {
+        if (ifaces[i].interfaceHandle == info.interfaceHandle)
+        {
+            iface = &ifaces[i];
+            break;
+        }
+    }
+    if (iface == NULL)
+    {
+        free(ifaces);
+        return VmbErrorNotFound;
+    }
+    if (iface->interfaceIdString != NULL)
+    {
+        strncpy(topo->interface_id, iface->interfaceIdString, sizeof(topo->interface_id) - 1);
+    }
+    topo->interface_type = iface->interfaceType;
+#ifdef __linux__
+    char bdf[13] = {0};
+    bool has_pci = find_pci_address(iface->interfaceIdString, bdf) ||
+                   find_pci_address(iface->interfaceName, bdf) ||
+                   pci_from_netdev(iface->interfaceName, bdf) ||
+                   pci_from_netdev(iface->interfaceIdString, bdf);
+    free(ifaces);
+    if (!has_pci)
+    {
+        return VmbErrorNotFound;
+    }
+    strncpy(topo->pci_address, bdf, sizeof(topo->pci_address) - 1);
+    char path[PATH_MAX], value[32];
+    snprintf(path, sizeof(path), ALLIED_SYSFS_PCI "/%s/numa_node", bdf);
+    if (sysfs_read(path, value, sizeof(value)))
+    {
+        topo->numa_node = atoi(value);
+    }
+    if (topo->numa_node < 0) // single node machine, or firmware does not report locality
+    {
+        topo->numa_node = -1;
+        return VmbErrorSuccess;
+    }
+    snprintf(path, sizeof(path), ALLIED_SYSFS_NODE "/node%d/cpulist", topo->numa_node);
+    sysfs_read(path, topo->cpulist, sizeof(topo->cpulist));
+    return VmbErrorSuccess;
+#else
+    free(ifaces);
+    return VmbErrorNotSupported;
+#endif
+}
+
+/**
+ * @brief NUMA node the calling thread is pinned to, -1 if it is not pinned.
+ *
+ */
+static _Thread_local int thread_node = -1;
+
+#ifdef __linux__
+/**
+ * @brief CPUs the calling thread ran on before it was first pinned, restored when it is unpinned.
+ *
+ */
+static _Thread_local cpu_set_t thread_cpus;
+static _Thread_local bool thread_saved = false;
+#endif
+
+VmbError_t allied_numa_pin_thread(int node)
+{
+#ifdef __linux__
+    if (node < 0)
+    {
+        if (thread_node < 0)
+        {
+            return VmbErrorSuccess;
+        }
+        if (pthread_setaffinity_np(pthread_self(), sizeof(thread_cpus), &thread_cpus) != 0)
+        {
+            return VmbErrorInvalidAccess;
+        }
+        thread_node = -1;
+        return VmbErrorSuccess;
+    }
+    cpu_set_t set;
+    if (node_cpuset(node, &set) == 0)
+    {
+        return VmbErrorNotFound;
+    }
+    if (!thread_saved)
+    {
+        if (pthread_getaffinity_np(pthread_self(), sizeof(thread_cpus), &thread_cpus) != 0)
+        {
+            return VmbErrorInvalidAccess;
+        }
+        thread_saved = true;
+    }
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+    {
+        return VmbErrorInvalidAccess;
+    }
+    thread_node = node;
+    return VmbErrorSuccess;
+#else
+    return node < 0 ? VmbErrorSuccess : VmbErrorNotSupported;
+#endif
+}
+
+int allied_numa_thread_node(void)
+{
+    return thread_node;
+}
+
+void *allied_numa_alloc(size_t alignment, size_t size, int node, bool *mapped)
+{
+    assert(mapped);
+    *mapped = false;
+#ifdef __linux__
+    long pagesize = sysconf(_SC_PAGESIZE);
+    if (node >= 0 && pagesize > 0 && alignment <= (size_t)pagesize)
+    {
+        // fresh anonymous pages, so that placement is decided by the first touch below
+        void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr != MAP_FAILED)
+        {
+#ifdef SYS_mbind
+            // MPOL_PREFERRED: fall back to other nodes instead of failing when the node is full
+            unsigned long nodemask[(1024 + 8 * sizeof(unsigned long) - 1) / (8 * sizeof(unsigned long))] = {0};
+            if (node < 1024)
+            {
+                nodemask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+                (void)syscall(SYS_mbind, ptr, size, 1 /* MPOL_PREFERRED */, nodemask, 1024 + 1, 0);
+            }
+#endif
+            // touch the pages from a CPU on the node, in case mbind is unavailable (e.g. seccomp)
+            cpu_set_t old, set;
+            bool pinned = node_cpuset(node, &set) > 0 &&
+                          pthread_getaffinity_np(pthread_self(), sizeof(old), &old) == 0 &&
+                          pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+            for (size_t ofst = 0; ofst < size; ofst += pagesize)
+            {
+                ((volatile char *)ptr)[ofst] = 0;
+            }
+            if (pinned)
+            {
+                pthread_setaffinity_np(pthread_self(), sizeof(old), &old);
+            }
+            *mapped = true;
+            return ptr;
+        }
+    }
+#endif
+    (void)node;
+    size = ((size + alignment - 1) / alignment) * alignment; // aligned_alloc requires a multiple of alignment
+    return aligned_alloc(alignment, size);
+}
+
+void allied_numa_free(void *ptr, size_t size, bool mapped)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+#ifdef __linux__
+    if (mapped)
+    {
+        munmap(ptr, size);
+        return;
+    }
+#endif
+    (void)size;
+    (void)mapped;
+    free(ptr);
+}
@@ -0,0 +1,65 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_numa.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Internal host topology helpers (NUMA node discovery, thread pinning, node-local allocation).
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef ALLIEDCAM_NUMA_H_
+#define ALLIEDCAM_NUMA_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "alliedcam.h"
+
+/**
+ * @brief Discover the PCIe device and NUMA node the camera is attached through.
+ *
+ * @param handle Internal VmbHandle_t to the camera
+ * @param topo Pointer to store the topology. `numa_node` is set to -1 if it can not be determined.
+ * @return VmbError_t
+ */
+VmbError_t allied_numa_discover(VmbHandle_t handle, AlliedTopology_t *topo);
+
+/**
+ * @brief Pin the calling thread to the CPUs of a NUMA node.
+ *
+ * @param node NUMA node. If negative, a pinned thread gets back the CPUs it ran on before it was first pinned.
+ * @return VmbError_t
+ */
+VmbError_t allied_numa_pin_thread(int node);
+
+/**
+ * @brief Get the NUMA node the calling thread was pinned to with {@link allied_numa_pin_thread}.
+ *
+ * @return int NUMA node, -1 if the thread is not pinned.
+ */
+int allied_numa_thread_node(void);
+
+/**
+ * @brief Allocate memory on a NUMA node. The memory must be freed with {@link allied_numa_free}.
+ *
+ * @param alignment Alignment of the allocation, in bytes
+ * @param size Size of the allocation, in bytes
+ * @param node NUMA node. If negative, the memory is allocated using `aligned_alloc`.
+ * @param mapped Pointer to store whether the memory was mapped (must be passed back to {@link allied_numa_free})
+ * @return void* Pointer to the memory, NULL on failure
+ */
+void *allied_numa_alloc(size_t alignment, size_t size, int node, bool *mapped);
+
+/**
+ * @brief Free memory allocated by {@link allied_numa_alloc}.
+ *
+ * @param ptr Pointer to the memory
+ * @param size Size of the allocation, in bytes
+ * @param mapped Value returned by {@link allied_numa_alloc}
+ */
+void allied_numa_free(void *ptr, size_t size, bool mapped);
+
+#endif /* ALLIEDCAM_NUMA_H_ */
@@ -0,0 +1,640 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_photometry.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Multi-aperture photometry for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details The tables hold, for every aperture, the byte offsets of its pixels from the start of the image followed by those of its
+ * annulus, and the weights of the aperture pixels. The kernels read every pixel as the 32-bit word that holds it, shifted and masked, so
+ * that the reads are 32-bit gathers whatever the container, and multiply and sum in integers, so that the loops vectorize (this file is
+ * built with -O3, see the Makefile). A word can reach up to 3 bytes past the last pixel it holds: apertures whose words would reach past
+ * the end of the image, and 16-bit images that are not 2-byte aligned, are read one pixel at a time instead. The photometry stage that
+ * attaches fluxes to frames lives with the other frame stages in alliedcam.c.
+ */
+
+#include "alliedcam_photometry.h"
+#include "alliedcam_kernels.h"
+#include "alliedcam_dispatch.h"
+#include "alliedcam_pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <assert.h>
+
+/**
+ * @brief Sky clipping iterations, each dropping the pixels outside the clipping range of the last sky level.
+ *
+ */
+#define ALLIED_PHOTOMETRY_CLIP_ITERATIONS 5
+
+/**
+ * @brief 32-bit word of an image, which may alias the 8 or 16-bit pixels it holds.
+ *
+ */
+typedef VmbUint32_t AlliedPhotWord __attribute__((may_alias));
+
+/**
+ * @brief Aperture kernel: weighted sum and highest value of the pixels of an aperture.
+ *
+ * @param base Image data, rounded down to 4 bytes.
+ * @param offsets Byte offsets of the pixels from the image data.
+ * @param weights Weights of the pixels.
+ * @param count Number of pixels.
+ * @param align Byte offset of the image data from `base`.
+ * @param mask Mask of the pixel container.
+ * @param sum Pointer to store the weighted sum.
+ * @param peak Pointer to store the highest value.
+ */
+typedef void (*AlliedPhotApertureKernel)(const AlliedPhotWord *base, const VmbUint32_t *offsets, const VmbUint16_t *weights, VmbUint32_t count,
+                                         VmbUint32_t align, VmbUint32_t mask, VmbUint64_t *sum, VmbUint32_t *peak);
+
+/**
+ * @brief Sky kernel: sum, sum of squares and number of the pixels of an annulus in `[lo, hi]`.
+ *
+ */
+typedef void (*AlliedPhotSkyKernel)(const AlliedPhotWord *base, const VmbUint32_t *offsets, VmbUint32_t count, VmbUint32_t align, VmbUint32_t mask,
+                                    VmbUint32_t lo, VmbUint32_t hi, VmbUint64_t *sums);
+
+/**
+ * @brief Photometry kernels of a CPU level.
+ *
+ */
+typedef struct
+{
+    AlliedPhotApertureKernel aperture; // Weighted sum of an aperture.
+    AlliedPhotSkyKernel sky;           // Clipped sums of an annulus.
+} AlliedPhotKernels_s;
+
+/**
+ * @brief Instantiate the photometry kernels of a CPU level.
+ *
+ * @param LEVEL CPU level.
+ * @param TARGET Target attribute of the CPU level, or nothing.
+ */
+#define ALLIED_PHOT_LEVEL(LEVEL, TARGET)                                                                                                     \
+    TARGET static void allied_phot_aperture_##LEVEL(const AlliedPhotWord *base, const VmbUint32_t *restrict offsets,                         \
+                                                    const VmbUint16_t *restrict weights, VmbUint32_t count, VmbUint32_t align,               \
+                                                    VmbUint32_t mask, VmbUint64_t *sum, VmbUint32_t *peak)                                   \
+    {                                                                                                                                        \
+        VmbUint64_t s = 0;                                                                                                                   \
+        VmbUint32_t top = 0;                                                                                                                 \
+        for (size_t i = 0; i < count; i++)                                                                                                   \
+        {                                                                                                                                    \
+            VmbUint32_t b = offsets[i] + align;                                                                                              \
+            VmbUint32_t v = (base[b >> 2] >> ((b & 3) * 8)) & mask;                                                                          \
+            s += (VmbUint32_t)weights[i] * v;                                                                                                \
+            top = v > top ? v : top;                                                                                                         \
+        }                                                                                                                                    \
+        *sum = s;                                                                                                                            \
+        *peak = top;                                                                                                                         \
+    }                                                                                                                                        \
+    TARGET static void allied_phot_sky_##LEVEL(const AlliedPhotWord *base, const VmbUint32_t *restrict offsets, VmbUint32_t count,           \
+                                               VmbUint32_t align, VmbUint32_t mask, VmbUint32_t lo, VmbUint32_t hi, VmbUint64_t *sums)       \
+    {                                                                                                                                        \
+        VmbUint64_t s = 0, s2 = 0, n = 0;                                                                                                    \
+        for (size_t i = 0; i < count; i++)                                                                                                   \
+        {                                                                                                                                    \
+            VmbUint32_t b = offsets[i] + align;                                                                                              \
+            VmbUint32_t v = (base[b >> 2] >> ((b & 3) * 8)) & mask;                                                                          \
+            VmbUint32_t keep = (VmbUint32_t)(v >= lo) & (VmbUint32_t)(v <= hi);                                                              \
+            v &= -keep;                                                                                                                      \
+            s += v;                                                                                                                          \
+            s2 += (VmbUint64_t)v * v;                                                                                                        \
+            n += keep;                                                                                                                       \
+        }                                                                                                                                    \
+        sums[0] = s;                                                                                                                         \
+        sums[1] = s2;                                                                                                                        \
+        sums[2] = n;                                                                                                                         \
+    }                                                                                                                                        \
+    static const AlliedPhotKernels_s phot_##LEVEL = {                                                                                        \
+        .aperture = &allied_phot_aperture_##LEVEL,                                                                                           \
+        .sky = &allied_phot_sky_##LEVEL,                                                                                                     \
+    };
+
+ALLIED_KERNEL_LEVELS(ALLIED_PHOT_LEVEL)
+
+static const AlliedPhotKernels_s *phot_kernels = &phot_scalar;
+
+ALLIED_KERNEL_BINDER(allied_photometry_bind, phot_kernels, &phot)
+
+/**
+ * @brief Tables of an aperture.
+ *
+ */
+typedef struct
+{
+    size_t first;           // First entry of the aperture pixels.
+    VmbUint32_t pixels;     // Aperture pixels, followed by the sky pixels.
+    VmbUint32_t sky_pixels; // Sky pixels.
+    VmbUint32_t last;       // Largest byte offset of the pixels.
+    VmbUint32_t flags;      // Flags known from the geometry.
+    double area;            // Sum of the weights, in pixels.
+} AlliedPhotTable_s;
+
+struct allied_photometry_s
+{
+    AlliedAperture_t *apertures;     // Apertures.
+    VmbUint32_t count;               // Number of apertures.
+    AlliedPhotometryConfig_t config; // Configuration, with the defaults resolved.
+    AlliedPhotTable_s *tables;       // Tables, by aperture.
+    size_t *work;                    // Entries before every aperture, and the total.
+    VmbUint32_t *offsets;            // Byte offsets of the pixels, by entry.
+    VmbUint16_t *weights;            // Weights of the pixels out of `subsample`², by entry. 1 for sky pixels.
+    size_t entries;                  // Entries in use.
+    size_t capacity;                 // Entries allocated.
+    bool built;                      // The tables match the geometry below.
+    VmbUint32_t width;               // Width of the tables.
+    VmbUint32_t height;              // Height of the tables.
+    size_t stride;                   // Row stride of the tables, in bytes.
+    VmbUint32_t pixel_size;          // Bytes per pixel of the tables.
+    VmbUint32_t offset_x;            // Horizontal offset of the tables.
+    VmbUint32_t offset_y;            // Vertical offset of the tables.
+    VmbUint32_t binning;             // Binning of the tables.
+    VmbUint64_t builds;              // Table builds.
+};
+
+VmbError_t allied_photometry_create(AlliedPhotometry_t *phot, const AlliedAperture_t *apertures, VmbUint32_t count, const AlliedPhotometryConfig_t *config)
+{
+    assert(phot);
+    assert(apertures);
+    *phot = NULL;
+    AlliedPhotometryConfig_t c = {0};
+    if (config != NULL)
+    {
+        c = *config;
+    }
+    if (count == 0 || count > ALLIED_PHOTOMETRY_MAX_APERTURES || c.subsample > 16 || !(c.sky_clip >= 0) || !(c.gain >= 0))
+    {
+        return VmbErrorBadParameter;
+    }
+    for (VmbUint32_t i = 0; i < count; i++)
+    {
+        const AlliedAperture_t *a = &(apertures[i]);
+        if (!isfinite(a->x) || !isfinite(a->y) || !(a->radius > 0 && a->radius < 65536) ||
+            (a->sky_outer != 0 && !(a->sky_inner >= a->radius && a->sky_outer > a->sky_inner && a->sky_outer < 65536)))
+        {
+            return VmbErrorBadParameter;
+        }
+    }
+    c.subsample = c.subsample == 0 ? 5 : c.subsample;
+    struct allied_photometry_s *p = (struct allied_photometry_s *)calloc(1, sizeof(struct allied_photometry_s));
+    if (p == NULL)
+    {
+        return VmbErrorResources;
+    }
+    p->apertures = (AlliedAperture_t *)malloc(sizeof(AlliedAperture_t) * count);
+    p->tables = (AlliedPhotTable_s *)calloc(count, sizeof(AlliedPhotTable_s));
+    p->work = (size_t *)calloc((size_t)count + 1, sizeof(size_t));
+    if (p->apertures == NULL || p->tables == NULL || p->work == NULL)
+    {
+        allied_photometry_destroy(&p);
+        return VmbErrorResources;
+    }
+    memcpy(p->apertures, apertures, sizeof(AlliedAperture_t) * count);
+    p->count = count;
+    p->config = c;
+    *phot = p;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_photometry_destroy(AlliedPhotometry_t *phot)
+{
+    assert(phot);
+    if (*phot == NULL)
+    {
+        return VmbErrorSuccess;
+    }
+    free((*phot)->apertures);
+    free((*phot)->tables);
+    free((*phot)->work);
+    free((*phot)->offsets);
+    free((*phot)->weights);
+    free(*phot);
+    *phot = NULL;
+    return VmbErrorSuccess;
+}
+
+VmbUint32_t allied_photometry_count(AlliedPhotometry_t phot)
+{
+    assert(phot);
+    return phot->count;
+}
+
+VmbUint64_t allied_photometry_builds(AlliedPhotometry_t phot)
+{
+    assert(phot);
+    return phot->builds;
+}
+
+/**
+ * @brief Append an entry to the tables, growing them as needed.
+ *
+ */
+static VmbError_t allied_phot_append(struct allied_photometry_s *p, VmbUint32_t offset, VmbUint16_t weight)
+{
+    if (p->entries == p->capacity)
+    {
+        size_t n = p->capacity < 1024 ? 1024 : p->capacity * 2;
+        VmbUint32_t *offsets = (VmbUint32_t *)realloc(p->offsets, n * sizeof(VmbUint32_t));
+        if (offsets == NULL)
+        {
+            return VmbErrorResources;
+        }
+        p->offsets = offsets;
+        VmbUint16_t *weights = (VmbUint16_t *)realloc(p->weights, n * sizeof(VmbUint16_t));
+        if (weights == NULL)
+        {
+            return VmbErrorResources;
+        }
+        p->weights = weights;
+        p->capacity = n;
+    }
+    p->offsets[p->entries] = offset;
+    p->weights[p->entries] = weight;
+    p->entries++;
+    return VmbErrorSuccess;
+}
+
+/**
+ * @brief Weight of a pixel in a circle: the number of the `n` x `n` samples of the pixel inside the circle.
+ *
+ * @param dx Horizontal distance of the pixel center from the circle center.
+ * @param dy Vertical distance of the pixel center from the circle center.
+ * @param r Radius of the circle.
+ * @param n Samples per pixel side.
+ */
+static VmbUint32_t allied_phot_weight(double dx, double dy, double r, VmbUint32_t n)
+{
+    double ax = fabs(dx), ay = fabs(dy);
+    double nx = ax > 0.5 ? ax - 0.5 : 0, ny = ay > 0.5 ? ay - 0.5 : 0;
+    if (nx * nx + ny * ny >= r * r)
+    {
+        return 0;
+    }
+    if ((ax + 0.5) * (ax + 0.5) + (ay + 0.5) * (ay + 0.5) <= r * r)
+    {
+        return n * n;
+    }
+    VmbUint32_t inside = 0;
+    for (VmbUint32_t j = 0; j < n; j++)
+    {
+        double sy = dy - 0.5 + (j + 0.5) / n;
+        for (VmbUint32_t i = 0; i < n; i++)
+        {
+            double sx = dx - 0.5 + (i + 0.5) / n;
+            inside += sx * sx + sy * sy < r * r;
+        }
+    }
+    return inside;
+}
+
+/**
+ * @brief Build the tables of every aperture for a geometry.
+ *
+ */
+static VmbError_t allied_phot_build(struct allied_photometry_s *p, VmbUint32_t width, VmbUint32_t height, size_t stride, VmbUint32_t pixel_size,
+                                    VmbUint32_t offset_x, VmbUint32_t offset_y, VmbUint32_t binning)
+{
+    p->built = false;
+    p->entries = 0;
+    VmbUint32_t n = p->config.subsample;
+    for (VmbUint32_t k = 0; k < p->count; k++)
+    {
+        const AlliedAperture_t *a = &(p->apertures[k]);
+        AlliedPhotTable_s *t = &(p->tables[k]);
+        memset(t, 0, sizeof(AlliedPhotTable_s));
+        t->first = p->entries;
+        p->work[k] = p->entries;
+        // the pixel of a bin is centered on the middle of the sensor pixels it sums
+        double cx = (a->x - (binning - 1) * 0.5) / binning - offset_x;
+        double cy = (a->y - (binning - 1) * 0.5) / binning - offset_y;
+        double r = a->radius / binning;
+        double reach = a->sky_outer > 0 ? a->sky_outer / binning : r;
+        double x0 = floor(cx - reach - 0.5), x1 = ceil(cx + reach + 0.5);
+        double y0 = floor(cy - reach - 0.5), y1 = ceil(cy + reach + 0.5);
+        if (cx - r < -0.5 || cy - r < -0.5 || cx + r > width - 0.5 || cy + r > height - 0.5)
+        {
+            t->flags |= AlliedApertureClipped;
+        }
+        if (x1 < 0 || y1 < 0 || x0 >= width || y0 >= height)
+        {
+            t->flags |= AlliedApertureOutside | (a->sky_outer > 0 ? AlliedApertureNoSky : 0);
+            continue;
+        }
+        VmbUint32_t left = x0 < 0 ? 0 : (VmbUint32_t)x0, right = x1 >= width ? width - 1 : (VmbUint32_t)x1;
+        VmbUint32_t top = y0 < 0 ? 0 : (VmbUint32_t)y0, bottom = y1 >= height ? height - 1 : (VmbUint32_t)y1;
+        double weights = 0;
+        // aperture pixels first, then the annulus
+        for (int pass = 0; pass < (a->sky_outer > 0 ? 2 : 1); pass++)
+        {
+            double ri = a->sky_inner / binning, ro = a->sky_outer / binning;
+            for (VmbUint32_t y = top; y <= bottom; y++)
+            {
+                for (VmbUint32_t x = left; x <= right; x++)
+                {
+                    double dx = x - cx, dy = y - cy;
+                    VmbUint32_t w = 1;
+                    if (pass == 0)
+                    {
+                        w = allied_phot_weight(dx, dy, r, n);
+                    }
+                    else
+                    {
+                        double d2 = dx * dx + dy * dy;
+                        w = d2 >= ri * ri && d2 < ro * ro;
+                    }
+                    if (w == 0)
+                    {
+                        continue;
+                    }
+                    VmbUint32_t offset = (VmbUint32_t)((size_t)y * stride + (size_t)x * pixel_size);
+                    VmbError_t err = allied_phot_append(p, offset, (VmbUint16_t)w);
+                    if (err != VmbErrorSuccess)
+                    {
+                        return err;
+                    }
+                    t->last = offset > t->last ? offset : t->last;
+                    if (pass == 0)
+                    {
+                        t->pixels++;
+                        weights += w;
+                    }
+                    else
+                    {
+                        t->sky_pixels++;
+                    }
+                }
+            }
+        }
+        t->area = weights / (n * n);
+        if (t->pixels == 0)
+        {
+            t->flags |= AlliedApertureOutside;
+        }
+        if (a->sky_outer > 0 && t->sky_pixels == 0)
+        {
+            t->flags |= AlliedApertureNoSky;
+        }
+    }
+    p->work[p->count] = p->entries;
+    p->width = width;
+    p->height = height;
+    p->stride = stride;
+    p->pixel_size = pixel_size;
+    p->offset_x = offset_x;
+    p->offset_y = offset_y;
+    p->binning = binning;
+    p->built = true;
+    p->builds++;
+    return VmbErrorSuccess;
+}
+
+/**
+ * @brief Photometry job of the worker pool.
+ *
+ */
+typedef struct
+{
+    const struct allied_photometry_s *phot;          // Engine.
+    const VmbUchar_t *data;                          // Image data.
+    const AlliedPhotWord *base;                      // Image data, rounded down to 4 bytes.
+    VmbUint32_t align;                               // Byte offset of the image data from `base`.
+    VmbUint32_t mask;                                // Mask of the pixel container.
+    VmbUint32_t max;                                 // Largest pixel value of the pixel format.
+    size_t end;                                      // Bytes from `base` that can be read.
+    bool gather;                                     // The image can be read as words.
+    AlliedApertureFlux_t *fluxes;                    // Destination of the fluxes.
+    VmbUint32_t bounds[ALLIED_POOL_MAX_THREADS + 1]; // First aperture of every task, and the count.
+} AlliedPhotJob_s;
+
+/**
+ * @brief Read the pixels of a table one at a time.
+ *
+ */
+static inline VmbUint32_t allied_phot_pixel(const VmbUchar_t *data, VmbUint32_t offset, VmbUint32_t pixel_size)
+{
+    if (pixel_size == 1)
+    {
+        return data[offset];
+    }
+    VmbUint16_t v;
+    memcpy(&v, data + offset, sizeof(v));
+    return v;
+}
+
+static void allied_phot_aperture_bytes(const VmbUchar_t *data, const VmbUint32_t *offsets, const VmbUint16_t *weights, VmbUint32_t count,
+                                       VmbUint32_t pixel_size, VmbUint64_t *sum, VmbUint32_t *peak)
+{
+    VmbUint64_t s = 0;
+    VmbUint32_t top = 0;
+    for (VmbUint32_t i = 0; i < count; i++)
+    {
+        VmbUint32_t v = allied_phot_pixel(data, offsets[i], pixel_size);
+        s += (VmbUint32_t)weights[i] * v;
+        top = v > top ? v : top;
+    }
+    *sum = s;
+    *peak = top;
+}
+
+static void allied_phot_sky_bytes(const VmbUchar_t *data, const VmbUint32_t *offsets, VmbUint32_t count, VmbUint32_t pixel_size, VmbUint32_t lo,
+                                  VmbUint32_t hi, VmbUint64_t *sums)
+{
+    memset(sums, 0, sizeof(VmbUint64_t) * 3);
+    for (VmbUint32_t i = 0; i < count; i++)
+    {
+        VmbUint32_t v = allied_phot_pixel(data, offsets[i], pixel_size);
+        if (v >= lo && v <= hi)
+        {
+            sums[0] += v;
+            sums[1] += (VmbUint64_t)v * v;
+            sums[2]++;
+        }
+    }
+}
+
+/**
+ * @brief Measure one aperture.
+ *
+ */
+static void allied_phot_measure_one(const AlliedPhotJob_s *job, VmbUint32_t k)
+{
+    const struct allied_photometry_s *p = job->phot;
+    const AlliedPhotTable_s *t = &(p->tables[k]);
+    AlliedApertureFlux_t *f = &(job->fluxes[k]);
+    memset(f, 0, sizeof(AlliedApertureFlux_t));
+    f->flags = t->flags;
+    if (t->pixels == 0)
+    {
+        f->flux = NAN;
+        f->error = NAN;
+        return;
+    }
+    const VmbUint32_t *offsets = p->offsets + t->first;
+    const VmbUint16_t *weights = p->weights + t->first;
+    // the word of the last pixel must lie inside the image
+    bool gather = job->gather && (((size_t)t->last + job->align) | 3) < job->end;
+    VmbUint64_t sum = 0;
+    VmbUint32_t peak = 0;
+    if (gather)
+    {
+        phot_kernels->aperture(job->base, offsets, weights, t->pixels, job->align, job->mask, &sum, &peak);
+    }
+    else
+    {
+        allied_phot_aperture_bytes(job->data, offsets, weights, t->pixels, p->pixel_size, &sum, &peak);
+    }
+    double n2 = (double)p->config.subsample * p->config.subsample;
+    f->sum = (double)sum / n2;
+    f->area = t->area;
+    f->peak = peak;
+    f->flags |= peak >= job->max ? AlliedApertureSaturated : 0;
+    // iteratively clipped sky level
+    double sky = 0, sky_var = 0;
+    VmbUint32_t kept = 0;
+    if (t->sky_pixels > 0)
+    {
+        VmbUint32_t lo = 0, hi = job->mask;
+        for (int i = 0; i <= ALLIED_PHOTOMETRY_CLIP_ITERATIONS; i++)
+        {
+            VmbUint64_t sums[3];
+            if (gather)
+            {
+                phot_kernels->sky(job->base, offsets + t->pixels, t->sky_pixels, job->align, job->mask, lo, hi, sums);
+            }
+            else
+            {
+                allied_phot_sky_bytes(job->data, offsets + t->pixels, t->sky_pixels, p->pixel_size, lo, hi, sums);
+            }
+            if (sums[2] == 0 || (i > 0 && sums[2] == kept))
+            {
+                break;
+            }
+            kept = (VmbUint32_t)sums[2];
+            sky = (double)sums[0] / kept;
+            sky_var = (double)sums[1] / kept - sky * sky;
+            sky_var = sky_var > 0 ? sky_var : 0;
+            if (p->config.sky_clip == 0)
+            {
+                break;
+            }
+            double range = p->config.sky_clip * sqrt(sky_var);
+            double l = ceil(sky - range), h = floor(sky + range);
+            lo = l < 0 ? 0 : (VmbUint32_t)l;
+            hi = h > job->mask ? job->mask : (h < 0 ? 0 : (VmbUint32_t)h);
+        }
+        if (kept == 0)
+        {
+            f->flags |= AlliedApertureNoSky;
+        }
+    }
+    f->sky = sky;
+    f->sky_stddev = sqrt(sky_var);
+    f->sky_pixels = kept;
+    f->flux = f->sum - sky * f->area;
+    double variance = 0;
+    if (kept > 0)
+    {
+        variance = f->area * sky_var + f->area * f->area * sky_var / kept;
+    }
+    if (p->config.gain > 0 && f->flux > 0)
+    {
+        variance += f->flux / p->config.gain;
+    }
+    f->error = sqrt(variance);
+}
+
+static void allied_phot_task(void *arg, VmbUint32_t index, VmbUint32_t count)
+{
+    (void)count;
+    AlliedPhotJob_s *job = (AlliedPhotJob_s *)arg;
+    for (VmbUint32_t k = job->bounds[index]; k < job->bounds[index + 1]; k++)
+    {
+        allied_phot_measure_one(job, k);
+    }
+}
+
+VmbError_t allied_photometry_measure(AlliedPhotometry_t phot, const AlliedImage_t *image, VmbUint32_t offset_x, VmbUint32_t offset_y, VmbUint32_t binning,
+                                     AlliedApertureFlux_t *fluxes)
+{
+    assert(phot);
+    assert(image);
+    assert(fluxes);
+    const AlliedImageKernels_s *kernels = allied_image_kernels(image->format);
+    if (kernels == NULL)
+    {
+        return VmbErrorNotSupported;
+    }
+    size_t row = (size_t)image->width * kernels->pixel_size;
+    size_t stride = image->stride == 0 ? row : image->stride;
+    if (image->data == NULL || image->width == 0 || image->height == 0 || stride < row)
+    {
+        return VmbErrorBadParameter;
+    }
+    // offsets are 32-bit, with room for the word of the last pixel
+    size_t bytes = stride * (image->height - 1) + row;
+    if (bytes > UINT32_MAX - 8)
+    {
+        return VmbErrorNotSupported;
+    }
+    binning = binning == 0 ? 1 : binning;
+    if (!phot->built || phot->width != image->width || phot->height != image->height || phot->stride != stride ||
+        phot->pixel_size != kernels->pixel_size || phot->offset_x != offset_x || phot->offset_y != offset_y || phot->binning != binning)
+    {
+        VmbError_t err = allied_phot_build(phot, image->width, image->height, stride, kernels->pixel_size, offset_x, offset_y, binning);
+        if (err != VmbErrorSuccess)
+        {
+            return err;
+        }
+    }
+    allied_dispatch_init();
+    const VmbUchar_t *data = (const VmbUchar_t *)image->data;
+    VmbUint32_t align = (VmbUint32_t)((uintptr_t)data & 3);
+    AlliedPhotJob_s job = {
+        .phot = phot,
+        .data = data,
+        .base = (const AlliedPhotWord *)(data - align),
+        .align = align,
+        .mask = kernels->pixel_size == 1 ? 0xff : 0xffff,
+        .max = (1u << kernels->bits) - 1,
+        .end = bytes + align,
+        .gather = kernels->pixel_size == 1 || (align & 1) == 0,
+        .fluxes = fluxes,
+    };
+    // runs of apertures with about the same number of entries
+    VmbUint32_t tasks = 1;
+    if (phot->config.threads > 1)
+    {
+        tasks = allied_pool_threads(phot->config.threads);
+        tasks = phot->count < tasks ? phot->count : tasks;
+    }
+    size_t total = phot->work[phot->count];
+    job.bounds[0] = 0;
+    for (VmbUint32_t i = 1; i < tasks; i++)
+    {
+        size_t target = total * i / tasks;
+        VmbUint32_t lo = job.bounds[i - 1], hi = phot->count;
+        while (lo < hi)
+        {
+            VmbUint32_t mid = lo + (hi - lo) / 2;
+            if (phot->work[mid] < target)
+            {
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+        job.bounds[i] = lo;
+    }
+    job.bounds[tasks] = phot->count;
+    allied_pool_run(tasks, &allied_phot_task, &job);
+    return VmbErrorSuccess;
+}
@@ -0,0 +1,198 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_pool.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Internal worker pool for splitting per-frame work across threads.
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "alliedcam_pool.h"
+#include "alliedcam_numa.h"
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+typedef struct
+{
+    pthread_mutex_t run_lock; // held by the thread whose job runs on the pool
+    pthread_mutex_t lock;     // protects the job description and the counters below
+    pthread_cond_t start;     // signaled when a job is posted
+    pthread_cond_t done;      // signaled when a task finishes or a worker leaves the job
+    VmbUint32_t workers;      // number of worker threads started
+    int node;                 // NUMA node the workers are pinned to, that of the thread that started them, -1 if none
+    unsigned long generation; // job number, bumped for every job
+    AlliedPoolTask task;      // current task
+    void *arg;                // argument of the current task
+    VmbUint32_t count;        // number of tasks in the current job
+    atomic_uint next;         // next task index to run
+    VmbUint32_t finished;     // number of tasks finished
+    VmbUint32_t active;       // number of workers inside the current job
+} AlliedPool_s;
+
+/**
+ * @brief Pools, each running one job at a time. Jobs of different threads (e.g. the delivery threads of different cameras) take
+ * different pools, so that they do not wait for each other.
+ *
+ */
+static AlliedPool_s pools[ALLIED_POOL_MAX_POOLS] = {
+    [0 ... ALLIED_POOL_MAX_POOLS - 1] = {
+        .run_lock = PTHREAD_MUTEX_INITIALIZER,
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .start = PTHREAD_COND_INITIALIZER,
+        .done = PTHREAD_COND_INITIALIZER,
+    },
+};
+
+/**
+ * @brief Set on pool threads, so that nested jobs run inline.
+ *
+ */
+static _Thread_local bool pool_worker = false;
+
+static void allied_pool_inline(VmbUint32_t count, AlliedPoolTask task, void *arg)
+{
+    for (VmbUint32_t i = 0; i < count; i++)
+    {
+        task(arg, i, count);
+    }
+}
+
+static void allied_pool_drain(AlliedPool_s *pool, AlliedPoolTask task, void *arg, VmbUint32_t count)
+{
+    VmbUint32_t index;
+    while ((index = atomic_fetch_add_explicit(&(pool->next), 1, memory_order_relaxed)) < count)
+    {
+        task(arg, index, count);
+        pthread_mutex_lock(&(pool->lock));
+        if (++pool->finished == count)
+        {
+            pthread_cond_broadcast(&(pool->done));
+        }
+        pthread_mutex_unlock(&(pool->lock));
+    }
+}
+
+static void *allied_pool_worker(void *data)
+{
+    AlliedPool_s *pool = (AlliedPool_s *)data;
+    pool_worker = true;
+    allied_numa_pin_thread(pool->node);
+    pthread_mutex_lock(&(pool->lock));
+    unsigned long seen = pool->generation;
+    for (;;)
+    {
+        while (pool->generation == seen)
+        {
+            pthread_cond_wait(&(pool->start), &(pool->lock));
+        }
+        // always join the latest job, the caller waits for us before posting the next one
+        seen = pool->generation;
+        AlliedPoolTask task = pool->task;
+        void *arg = pool->arg;
+        VmbUint32_t count = pool->count;
+        pool->active++;
+        pthread_mutex_unlock(&(pool->lock));
+        allied_pool_drain(pool, task, arg, count);
+        pthread_mutex_lock(&(pool->lock));
+        if (--pool->active == 0)
+        {
+            pthread_cond_broadcast(&(pool->done));
+        }
+    }
+    return NULL;
+}
+
+VmbUint32_t allied_pool_threads(VmbUint32_t requested)
+{
+    if (requested == 0)
+    {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        requested = ncpu > 0 ? (VmbUint32_t)ncpu : 1;
+    }
+    return requested < ALLIED_POOL_MAX_THREADS ? requested : ALLIED_POOL_MAX_THREADS;
+}
+
+void allied_pool_run(VmbUint32_t count, AlliedPoolTask task, void *arg)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    if (count == 1 || pool_worker)
+    {
+        allied_pool_inline(count, task, arg);
+        return;
+    }
+    // take an idle pool with workers on the node of the caller, or without workers yet, then any idle pool; when every pool is busy,
+    // waiting for one would stall the caller by a whole job
+    int node = allied_numa_thread_node();
+    AlliedPool_s *pool = NULL;
+    for (int pass = 0; pass < 2 && pool == NULL; pass++)
+    {
+        for (VmbUint32_t i = 0; i < ALLIED_POOL_MAX_POOLS && pool == NULL; i++)
+        {
+            if (pthread_mutex_trylock(&(pools[i].run_lock)) != 0)
+            {
+                continue;
+            }
+            if (pass == 0 && pools[i].workers > 0 && pools[i].node != node)
+            {
+                pthread_mutex_unlock(&(pools[i].run_lock));
+                continue;
+            }
+            pool = &(pools[i]);
+        }
+    }
+    if (pool == NULL)
+    {
+        allied_pool_inline(count, task, arg);
+        return;
+    }
+    if (pool->workers == 0)
+    {
+        pool->node = node;
+    }
+    // start workers on demand, the caller is the first thread of the job
+    VmbUint32_t wanted = (count < ALLIED_POOL_MAX_THREADS ? count : ALLIED_POOL_MAX_THREADS) - 1;
+    while (pool->workers < wanted)
+    {
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        int ret = pthread_create(&thread, &attr, &allied_pool_worker, pool);
+        pthread_attr_destroy(&attr);
+        if (ret != 0)
+        {
+            break; // run with what we have
+        }
+        pool->workers++;
+    }
+    pthread_mutex_lock(&(pool->lock));
+    while (pool->active > 0) // a late worker may still hold the previous job
+    {
+        pthread_cond_wait(&(pool->done), &(pool->lock));
+    }
+    pool->task = task;
+    pool->arg = arg;
+    pool->count = count;
+    pool->finished = 0;
+    atomic_store_explicit(&(pool->next), 0, memory_order_relaxed);
+    pool->generation++;
+    pthread_cond_broadcast(&(pool->start));
+    pthread_mutex_unlock(&(pool->lock));
+    allied_pool_drain(pool, task, arg, count);
+    pthread_mutex_lock(&(pool->lock));
+    while (pool->finished < count || pool->active > 0)
+    {
+        pthread_cond_wait(&(pool->done), &(pool->lock));
+    }
+    pthread_mutex_unlock(&(pool->lock));
+    pthread_mutex_unlock(&(pool->run_lock));
+}
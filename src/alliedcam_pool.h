@@ -0,0 +1,64 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_pool.h
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Internal worker pool for splitting per-frame work across threads.
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef ALLIEDCAM_POOL_H_
+#define ALLIEDCAM_POOL_H_
+
+#include <VmbC/VmbCommonTypes.h>
+
+#ifndef ALLIED_POOL_MAX_THREADS
+/**
+ * @brief Maximum number of threads that take part in a pool job, including the caller.
+ *
+ */
+#define ALLIED_POOL_MAX_THREADS 64
+#endif
+
+#ifndef ALLIED_POOL_MAX_POOLS
+/**
+ * @brief Maximum number of jobs that run on the pool concurrently, each with its own worker threads.
+ *
+ */
+#define ALLIED_POOL_MAX_POOLS 4
+#endif
+
+/**
+ * @brief Task executed by the pool. Called once for every index in `[0, count)`.
+ *
+ * @param arg Argument passed to {@link allied_pool_run}
+ * @param index Index of this task
+ * @param count Number of tasks in the job
+ */
+typedef void (*AlliedPoolTask)(void *arg, VmbUint32_t index, VmbUint32_t count);
+
+/**
+ * @brief Resolve a requested thread count.
+ *
+ * @param requested Requested number of threads, 0 for one thread per online CPU
+ * @return VmbUint32_t Number of threads, between 1 and `ALLIED_POOL_MAX_THREADS`
+ */
+VmbUint32_t allied_pool_threads(VmbUint32_t requested);
+
+/**
+ * @brief Run `count` tasks on the pool and wait for all of them to finish. The calling thread takes part in the job.
+ * Jobs from different threads run concurrently, on up to `ALLIED_POOL_MAX_POOLS` sets of workers; a job submitted while every set is
+ * busy, or from inside a task, runs inline on the calling thread instead of waiting. Workers are pinned to the NUMA node of the thread
+ * that started them (see {@link allied_numa_pin_thread}), and jobs prefer the workers of their own node.
+ *
+ * @param count Number of tasks, at most `ALLIED_POOL_MAX_THREADS` run concurrently
+ * @param task Task
+ * @param arg Argument passed to the task
+ */
+void allied_pool_run(VmbUint32_t count, AlliedPoolTask task, void *arg);
+
+#endif /* ALLIEDCAM_POOL_H_ */
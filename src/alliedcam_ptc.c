@@ -0,0 +1,522 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_ptc.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Per-pixel temporal mean and variance maps, and photon transfer characterization for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details The Welford update of a row is instantiated per source container and CPU level, and takes the reciprocal of the sample count
+ * as a constant of the row. This file is built with -O3 (see the Makefile).
+ */
+
+#include "alliedcam_ptc.h"
+#include "alliedcam_exposure.h"
+#include "alliedcam_kernels.h"
+#include "alliedcam_dispatch.h"
+#include "alliedcam_pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <assert.h>
+
+/**
+ * @brief Fraction of the full well below which steps are used for the gain and linearity fits.
+ *
+ */
+#define ALLIED_PTC_FIT_LIMIT 0.8
+
+/**
+ * @brief Fraction of the full well below which the linearity of a step is not computed, as the relative deviation is dominated by noise.
+ *
+ */
+#define ALLIED_PTC_LINEARITY_FLOOR 0.02
+
+struct allied_moments_s
+{
+    VmbUint32_t width;       // Width in pixels.
+    VmbUint32_t height;      // Height in pixels.
+    VmbPixelFormat_t format; // Pixel format.
+    VmbUint32_t pixel_size;  // Bytes per pixel.
+    VmbUint32_t threads;     // Maximum number of threads.
+    VmbUint32_t frames;      // Images added.
+    float *mean;             // Running means, packed rows.
+    float *m2;               // Sums of squared deviations from the running means, packed rows.
+};
+
+typedef void (*AlliedMomentsRowKernel)(const void *src, float *mean, float *m2, float inv, VmbUint32_t width);
+
+/**
+ * @brief Moment kernels of a CPU level.
+ *
+ */
+typedef struct
+{
+    AlliedMomentsRowKernel row[2]; // Welford update of a row, by source container (8, 16 bits).
+} AlliedMomentsKernels_s;
+
+/**
+ * @brief Instantiate the Welford update of a row.
+ *
+ * @param NAME Suffix of the kernel name.
+ * @param TARGET Target attribute of the CPU level, or nothing.
+ * @param TS Source container type.
+ */
+#define ALLIED_MOMENTS_ROW(NAME, TARGET, TS)                                                                                 \
+    TARGET static void allied_moments_row_##NAME(const void *src, float *mean, float *m2, float inv, VmbUint32_t width)      \
+    {                                                                                                                        \
+        const TS *restrict s = (const TS *)src;                                                                              \
+        float *restrict m = mean;                                                                                            \
+        float *restrict q = m2;                                                                                              \
+        for (size_t x = 0; x < width; x++)                                                                                   \
+        {                                                                                                                    \
+            float v = (float)s[x];                                                                                           \
+            float d = v - m[x];                                                                                              \
+            float mn = m[x] + d * inv;                                                                                       \
+            q[x] += d * (v - mn);                                                                                            \
+            m[x] = mn;                                                                                                       \
+        }                                                                                                                    \
+    }
+
+#define ALLIED_MOMENTS_LEVEL(LEVEL, TARGET)                                                      \
+    ALLIED_MOMENTS_ROW(8_##LEVEL, TARGET, VmbUint8_t)                                            \
+    ALLIED_MOMENTS_ROW(16_##LEVEL, TARGET, VmbUint16_t)                                          \
+    static const AlliedMomentsKernels_s moments_##LEVEL = {                                      \
+        .row = {&allied_moments_row_8_##LEVEL, &allied_moments_row_16_##LEVEL},                  \
+    };
+
+ALLIED_KERNEL_LEVELS(ALLIED_MOMENTS_LEVEL)
+
+static const AlliedMomentsKernels_s *moments_kernels = &moments_scalar;
+
+ALLIED_KERNEL_BINDER(allied_moments_bind, moments_kernels, &moments)
+
+VmbError_t allied_moments_create(AlliedMoments_t *moments, VmbUint32_t width, VmbUint32_t height, VmbPixelFormat_t format, VmbUint32_t threads)
+{
+    assert(moments);
+    *moments = NULL;
+    if (width == 0 || height == 0)
+    {
+        return VmbErrorBadParameter;
+    }
+    const AlliedImageKernels_s *kernels = allied_image_kernels(format);
+    if (kernels == NULL)
+    {
+        return VmbErrorNotSupported;
+    }
+    struct allied_moments_s *m = (struct allied_moments_s *)calloc(1, sizeof(struct allied_moments_s));
+    if (m == NULL)
+    {
+        return VmbErrorResources;
+    }
+    m->mean = (float *)calloc((size_t)width * height, sizeof(float));
+    m->m2 = (float *)calloc((size_t)width * height, sizeof(float));
+    if (m->mean == NULL || m->m2 == NULL)
+    {
+        free(m->mean);
+        free(m->m2);
+        free(m);
+        return VmbErrorResources;
+    }
+    m->width = width;
+    m->height = height;
+    m->format = format;
+    m->pixel_size = kernels->pixel_size;
+    m->threads = threads;
+    *moments = m;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_moments_destroy(AlliedMoments_t *moments)
+{
+    assert(moments);
+    if (*moments == NULL)
+    {
+        return VmbErrorSuccess;
+    }
+    free((*moments)->mean);
+    free((*moments)->m2);
+    free(*moments);
+    *moments = NULL;
+    return VmbErrorSuccess;
+}
+
+/**
+ * @brief Moment update job, shared by the tasks of the worker pool.
+ *
+ */
+typedef struct
+{
+    AlliedMomentsRowKernel row; // Row kernel.
+    const VmbUchar_t *src;      // First row of the source.
+    size_t src_stride;          // Bytes between source rows.
+    float *mean;                // Running means.
+    float *m2;                  // Sums of squared deviations.
+    float inv;                  // Reciprocal of the sample count, including the new image.
+    VmbUint32_t width;          // Width in pixels.
+    VmbUint32_t height;         // Height in pixels.
+} AlliedMomentsJob_s;
+
+static void allied_moments_task(void *arg, VmbUint32_t index, VmbUint32_t count)
+{
+    const AlliedMomentsJob_s *job = (const AlliedMomentsJob_s *)arg;
+    VmbUint32_t first = (VmbUint32_t)((VmbUint64_t)job->height * index / count);
+    VmbUint32_t last = (VmbUint32_t)((VmbUint64_t)job->height * (index + 1) / count);
+    for (VmbUint32_t y = first; y < last; y++)
+    {
+        size_t at = (size_t)y * job->width;
+        job->row(job->src + (size_t)y * job->src_stride, job->mean + at, job->m2 + at, job->inv, job->width);
+    }
+}
+
+VmbError_t allied_moments_add(AlliedMoments_t moments, const AlliedImage_t *image)
+{
+    assert(moments);
+    assert(image);
+    size_t row = (size_t)moments->width * moments->pixel_size;
+    size_t stride = image->stride == 0 ? row : image->stride;
+    if (image->width != moments->width || image->height != moments->height || image->format != moments->format || image->data == NULL ||
+        stride < row)
+    {
+        return VmbErrorBadParameter;
+    }
+    allied_dispatch_init();
+    AlliedMomentsJob_s job = {
+        .row = moments_kernels->row[moments->pixel_size == 1 ? 0 : 1],
+        .src = (const VmbUchar_t *)image->data,
+        .src_stride = stride,
+        .mean = moments->mean,
+        .m2 = moments->m2,
+        .inv = 1.0f / (float)(moments->frames + 1),
+        .width = moments->width,
+        .height = moments->height,
+    };
+    VmbUint32_t tasks = 1;
+    if (moments->threads > 1)
+    {
+        tasks = allied_pool_threads(moments->threads);
+        tasks = job.height < tasks ? job.height : tasks;
+    }
+    allied_pool_run(tasks, &allied_moments_task, &job);
+    moments->frames++;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_moments_reset(AlliedMoments_t moments)
+{
+    assert(moments);
+    size_t pixels = (size_t)moments->width * moments->height;
+    memset(moments->mean, 0, pixels * sizeof(float));
+    memset(moments->m2, 0, pixels * sizeof(float));
+    moments->frames = 0;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_moments_maps(AlliedMoments_t moments, float *mean, float *variance, size_t stride)
+{
+    assert(moments);
+    size_t row = (size_t)moments->width * sizeof(float);
+    stride = stride == 0 ? row : stride;
+    if (stride < row)
+    {
+        return VmbErrorBadParameter;
+    }
+    if (moments->frames < 2)
+    {
+        return VmbErrorInvalidCall;
+    }
+    float inv = 1.0f / (float)(moments->frames - 1);
+    for (VmbUint32_t y = 0; y < moments->height; y++)
+    {
+        size_t at = (size_t)y * moments->width;
+        if (mean != NULL)
+        {
+            memcpy((VmbUchar_t *)mean + (size_t)y * stride, moments->mean + at, row);
+        }
+        if (variance != NULL)
+        {
+            float *out = (float *)((VmbUchar_t *)variance + (size_t)y * stride);
+            for (VmbUint32_t x = 0; x < moments->width; x++)
+            {
+                out[x] = moments->m2[at + x] * inv;
+            }
+        }
+    }
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_moments_summary(AlliedMoments_t moments, AlliedMomentsSummary_t *summary)
+{
+    assert(moments);
+    assert(summary);
+    if (moments->frames < 2)
+    {
+        return VmbErrorInvalidCall;
+    }
+    size_t pixels = (size_t)moments->width * moments->height;
+    double sum = 0, sumsq = 0, m2 = 0;
+    for (size_t i = 0; i < pixels; i++)
+    {
+        sum += moments->mean[i];
+        sumsq += (double)moments->mean[i] * moments->mean[i];
+        m2 += moments->m2[i];
+    }
+    summary->frames = moments->frames;
+    summary->mean = sum / pixels;
+    summary->variance = m2 / pixels / (moments->frames - 1);
+    double fpn = sumsq / pixels - summary->mean * summary->mean;
+    summary->fpn = fpn > 0 ? sqrt(fpn) : 0;
+    return VmbErrorSuccess;
+}
+
+static double allied_ptc_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Least squares line fit of the points selected by `use`.
+ *
+ * @return true At least two distinct abscissae were selected.
+ */
+static bool allied_ptc_fit(const double *x, const double *y, const bool *use, VmbUint32_t count, double *slope, double *intercept)
+{
+    double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (VmbUint32_t i = 0; i < count; i++)
+    {
+        if (use[i])
+        {
+            n++;
+            sx += x[i];
+            sy += y[i];
+            sxx += x[i] * x[i];
+            sxy += x[i] * y[i];
+        }
+    }
+    double det = n * sxx - sx * sx;
+    if (n < 2 || !(fabs(det) > 0))
+    {
+        return false;
+    }
+    *slope = (n * sxy - sx * sy) / det;
+    *intercept = (sy - *slope * sx) / n;
+    return true;
+}
+
+/**
+ * @brief Derive the characterization from the measured steps.
+ *
+ */
+static VmbError_t allied_ptc_analyze(AlliedPtcResult_t *r)
+{
+    VmbUint32_t n = r->count;
+    AlliedPtcPoint_t *p = r->points;
+    r->offset_adu = p[0].mean;
+    r->read_noise_adu = sqrt(p[0].variance);
+    VmbUint32_t peak = 0;
+    for (VmbUint32_t i = 0; i < n; i++)
+    {
+        p[i].signal = p[i].mean - r->offset_adu;
+        peak = p[i].variance > p[peak].variance ? i : peak;
+    }
+    r->full_well_adu = p[peak].signal;
+    if (!(r->full_well_adu > 0))
+    {
+        return VmbErrorNotAvailable;
+    }
+    double exposure[ALLIED_PTC_MAX_STEPS], signal[ALLIED_PTC_MAX_STEPS], shot[ALLIED_PTC_MAX_STEPS];
+    bool use[ALLIED_PTC_MAX_STEPS];
+    for (VmbUint32_t i = 0; i < n; i++)
+    {
+        // the variance peaks at the full well; a sweep that does not reach it has no saturated step
+        p[i].saturated = peak < n - 1 && i >= peak;
+        exposure[i] = p[i].exposure_us;
+        signal[i] = p[i].signal;
+        shot[i] = p[i].variance - p[0].variance;
+        use[i] = !p[i].saturated && p[i].signal <= ALLIED_PTC_FIT_LIMIT * r->full_well_adu;
+    }
+    double k, k0, a, b;
+    if (!allied_ptc_fit(signal, shot, use, n, &k, &k0) || !(k > 0) || !allied_ptc_fit(exposure, signal, use, n, &a, &b))
+    {
+        return VmbErrorNotAvailable;
+    }
+    // the shot noise variance in ADU^2 is the signal in ADU times the conversion factor in ADU/e-
+    r->gain_e_per_adu = 1 / k;
+    r->read_noise_e = r->read_noise_adu * r->gain_e_per_adu;
+    r->full_well_e = r->full_well_adu * r->gain_e_per_adu;
+    r->linearity_error = 0;
+    for (VmbUint32_t i = 0; i < n; i++)
+    {
+        double fit = a * exposure[i] + b;
+        p[i].linearity = 0;
+        if (!p[i].saturated && fit > ALLIED_PTC_LINEARITY_FLOOR * r->full_well_adu)
+        {
+            p[i].linearity = (signal[i] - fit) / fit * 100;
+            r->linearity_error = fmax(r->linearity_error, fabs(p[i].linearity));
+        }
+    }
+    return VmbErrorSuccess;
+}
+
+/**
+ * @brief Release the frames queued for the sweep, which may have been exposed before the last exposure change.
+ *
+ * @param last Frame ID of the newest frame seen so far, updated.
+ */
+static void allied_ptc_flush(AlliedSubscriber_t sub, VmbUint64_t *last)
+{
+    AlliedFrameView_t view;
+    while (allied_subscriber_pop(sub, &view, 0) == VmbErrorSuccess)
+    {
+        *last = view.frame->frameID > *last ? view.frame->frameID : *last;
+        allied_frame_release(view.frame);
+    }
+}
+
+/**
+ * @brief Measure the temporal moments of the region at the current exposure time. Frames up to the newest frame seen before the exposure
+ * change are skipped, then `settle_frames` more, to cover the frames in flight in the camera.
+ *
+ * @param last Frame ID of the newest frame seen so far, updated.
+ */
+static VmbError_t allied_ptc_measure(AlliedSubscriber_t sub, const AlliedPtcConfig_t *c, AlliedMoments_t moments, AlliedMomentsSummary_t *summary, VmbUint64_t *last)
+{
+    VmbError_t err = VmbErrorSuccess;
+    VmbUint64_t stale = *last;
+    allied_moments_reset(moments);
+    for (VmbUint32_t i = 0; i < c->settle_frames + c->frames && err == VmbErrorSuccess;)
+    {
+        AlliedFrameView_t view;
+        err = allied_subscriber_pop(sub, &view, c->timeout_ms);
+        if (err != VmbErrorSuccess)
+        {
+            break;
+        }
+        *last = view.frame->frameID > *last ? view.frame->frameID : *last;
+        if (view.frame->frameID <= stale)
+        {
+            allied_frame_release(view.frame);
+            continue;
+        }
+        if (i++ >= c->settle_frames)
+        {
+            AlliedImage_t image;
+            err = allied_image_from_view(&view, &image);
+            if (err == VmbErrorSuccess && (image.width < c->x + c->width || image.height < c->y + c->height))
+            {
+                err = VmbErrorBadParameter;
+            }
+            if (err == VmbErrorSuccess)
+            {
+                size_t stride = image.stride == 0 ? (size_t)image.width * allied_image_pixel_size(image.format) : image.stride;
+                image.data = (VmbUchar_t *)image.data + (size_t)c->y * stride + (size_t)c->x * allied_image_pixel_size(image.format);
+                image.stride = stride;
+                image.width = c->width;
+                image.height = c->height;
+                err = allied_moments_add(moments, &image);
+            }
+        }
+        allied_frame_release(view.frame);
+    }
+    if (err == VmbErrorSuccess)
+    {
+        err = allied_moments_summary(moments, summary);
+    }
+    return err;
+}
+
+VmbError_t allied_ptc_sweep(AlliedCameraHandle_t handle, const AlliedPtcConfig_t *config, AlliedPtcResult_t *result)
+{
+    assert(handle);
+    assert(config);
+    assert(result);
+    memset(result, 0, sizeof(AlliedPtcResult_t));
+    AlliedPtcConfig_t c = *config;
+    c.steps = c.steps == 0 ? 24 : c.steps;
+    c.frames = c.frames == 0 ? 32 : c.frames;
+    c.settle_frames = c.settle_frames == 0 ? 3 : c.settle_frames;
+    if (c.steps < 4 || c.steps > ALLIED_PTC_MAX_STEPS || c.frames < 2)
+    {
+        return VmbErrorBadParameter;
+    }
+    AlliedAutoExposureStatus_t ae;
+    if (allied_get_auto_exposure_status(handle, &ae) == VmbErrorSuccess && ae.enabled)
+    {
+        return VmbErrorInvalidCall;
+    }
+    AlliedCalibGeometry_t geometry;
+    double cam_min = 0, cam_max = 0, original = 0;
+    VmbError_t err = allied_calib_geometry(handle, &geometry);
+    if (err == VmbErrorSuccess)
+    {
+        err = allied_get_exposure_range_us(handle, &cam_min, &cam_max, NULL);
+    }
+    if (err == VmbErrorSuccess)
+    {
+        err = allied_get_exposure_us(handle, &original);
+    }
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    c.exposure_min_us = c.exposure_min_us == 0 ? cam_min : c.exposure_min_us;
+    c.width = c.width == 0 && c.x < geometry.width ? geometry.width - c.x : c.width;
+    c.height = c.height == 0 && c.y < geometry.height ? geometry.height - c.y : c.height;
+    if (!(c.exposure_min_us > 0) || !(c.exposure_max_us > c.exposure_min_us) || c.width == 0 || c.height == 0 ||
+        c.x + c.width > geometry.width || c.y + c.height > geometry.height)
+    {
+        return VmbErrorBadParameter;
+    }
+    AlliedMoments_t moments;
+    err = allied_moments_create(&moments, c.width, c.height, geometry.format, c.threads);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    AlliedSubscription_t subscription = {.queue_depth = 4, .policy = AlliedBackpressureDropNewest};
+    AlliedSubscriber_t sub;
+    err = allied_subscribe(handle, &subscription, &sub);
+    if (err != VmbErrorSuccess)
+    {
+        allied_moments_destroy(&moments);
+        return err;
+    }
+    double start = allied_ptc_now();
+    VmbUint64_t last = 0; // newest frame ID seen by the sweep
+    for (VmbUint32_t i = 0; i < c.steps && err == VmbErrorSuccess; i++)
+    {
+        double exposure = c.exposure_min_us * pow(c.exposure_max_us / c.exposure_min_us, (double)i / (c.steps - 1));
+        err = allied_set_exposure_us(handle, exposure);
+        if (err == VmbErrorSuccess)
+        {
+            // the camera rounds the exposure time to its steps
+            allied_get_exposure_us(handle, &exposure);
+            // frames queued meanwhile were exposed at the previous exposure time
+            allied_ptc_flush(sub, &last);
+            AlliedMomentsSummary_t summary;
+            err = allied_ptc_measure(sub, &c, moments, &summary, &last);
+            if (err == VmbErrorSuccess)
+            {
+                result->points[i].exposure_us = exposure;
+                result->points[i].mean = summary.mean;
+                result->points[i].variance = summary.variance;
+                result->count++;
+            }
+        }
+    }
+    allied_unsubscribe(&sub);
+    allied_moments_destroy(&moments);
+    allied_set_exposure_us(handle, original);
+    result->elapsed_s = allied_ptc_now() - start;
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    return allied_ptc_analyze(result);
+}
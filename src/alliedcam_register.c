@@ -0,0 +1,1328 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_register.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Sub-pixel frame registration and shift-and-add stacking for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details Spectra are interleaved complex floats. The normalized cross-power spectrum is formed in the same pass as the column transforms
+ * of the frame, and stored conjugated, so that the forward transform gives the correlation surface in its real part. The FFT and the
+ * shift-and-add row kernels are instantiated per CPU level. This file is built with -O3 (see the Makefile).
+ */
+
+#include "alliedcam_register.h"
+#include "alliedcam_kernels.h"
+#include "alliedcam_dispatch.h"
+#include "alliedcam_pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <assert.h>
+
+/**
+ * @brief Time a detaching accumulator waits for a frame before checking whether to stop, in ms.
+ *
+ */
+#define ALLIED_SHIFTADD_POLL_MS 100
+
+/**
+ * @brief Columns transformed together by a task, gathered into contiguous rows.
+ *
+ */
+#define ALLIED_REGISTER_TILE 8
+
+/**
+ * @brief Width (standard deviation) of the correlation peak, in pixels, set by a Gaussian low-pass of the cross-power spectrum. A sampled
+ * Gaussian peak is located exactly by a parabola through the logarithms of three samples, and the low-pass drops the noisiest frequencies.
+ *
+ */
+#define ALLIED_REGISTER_PEAK_SIGMA 1.0
+
+/**
+ * @brief Cross-power magnitude added before normalizing the cross-power spectrum, relative to the mean power of the reference spectrum.
+ * Frequencies where the regions hold little power, such as those past the width of a smooth spot, carry mostly noise; unit normalization
+ * would weigh them as much as the others, and bias the peak.
+ *
+ */
+#define ALLIED_REGISTER_FLOOR 0.1
+
+/**
+ * @brief Largest number of output pixels a drizzle drop touches on an axis.
+ *
+ */
+#define ALLIED_DRIZZLE_TAPS 8
+
+/**
+ * @brief Cached FFT plan of one transform size.
+ *
+ */
+typedef struct
+{
+    VmbUint32_t n;    // Transform size, a power of two.
+    VmbUint32_t *rev; // Bit-reversed indices.
+    float *twiddle;   // Complex twiddle factors of every stage, contiguous: stage `len` holds exp(-2 pi i k / len) at `len / 2 - 1 + k`.
+} AlliedFftPlan_s;
+
+struct allied_register_s
+{
+    AlliedCalibGeometry_t geometry; // Geometry of the frames.
+    AlliedRegisterConfig_t config;  // Configuration, with the defaults resolved.
+    VmbUint32_t pixel_size;         // Bytes per source pixel.
+    VmbUint32_t tasks;              // Largest number of pool tasks.
+    AlliedFftPlan_s row_plan;       // Plan of the row transforms.
+    AlliedFftPlan_s col_plan;       // Plan of the column transforms.
+    float *wx;                      // Horizontal window.
+    float *wy;                      // Vertical window.
+    float *fwx;                     // Horizontal window of the frame, moved with the shift.
+    float *fwy;                     // Vertical window of the frame, moved with the shift.
+    float *gx;                      // Horizontal low-pass of the cross-power spectrum.
+    float *gy;                      // Vertical low-pass of the cross-power spectrum.
+    double gain;                    // Height of the correlation peak of the reference region against itself.
+    float floor;                    // Cross-power magnitude added before normalizing, from the power of the reference spectrum.
+    float *ref;                     // Spectrum of the reference region.
+    float *work;                    // Spectrum of the frame, then correlation surface.
+    float *scratch;                 // Column tiles, per task.
+    double *partial;                // Partial sums, per task.
+    bool has_reference;             // A reference was set.
+    double ref_cx;                  // Horizontal centroid of the reference.
+    double ref_cy;                  // Vertical centroid of the reference.
+};
+
+struct allied_shiftadd_s
+{
+    AlliedCalibGeometry_t geometry; // Geometry of the frames.
+    AlliedShiftAddConfig_t config;  // Configuration, with the defaults resolved.
+    VmbUint32_t pixel_size;         // Bytes per source pixel.
+    VmbUint32_t tasks;              // Largest number of pool tasks.
+    VmbUint32_t width;              // Width of the result.
+    VmbUint32_t height;             // Height of the result.
+    float *sum;                     // Weighted sums, packed rows.
+    float *weight;                  // Weights, packed rows.
+    VmbInt32_t *ix;                 // Left input column of every output column, for bilinear interpolation.
+    float *fx;                      // Horizontal interpolation fraction of every output column.
+    float *cov;                     // Horizontal drizzle weight of every output column.
+    float *tmp;                     // Horizontally drizzled input rows, per task.
+    VmbUint64_t frames;             // Frames added since the last reset.
+    VmbUint64_t skipped;            // Frames of the camera not added because of their quality.
+    AlliedShift_t last;             // Shift of the last frame of the camera.
+    pthread_mutex_t lock;           // Lock of the sums and counters.
+    AlliedRegister_t reg;           // Registration of the attached camera.
+    AlliedSubscriber_t sub;         // Subscription of the attached camera, NULL if not attached.
+    pthread_t thread;               // Thread that feeds the accumulator from the subscription.
+    atomic_bool running;            // The feeding thread runs.
+    _Atomic VmbError_t error;       // Result of the last frame from the camera.
+};
+
+typedef void (*AlliedFftKernel)(float *data, const AlliedFftPlan_s *plan);
+typedef void (*AlliedBilinearRowKernel)(const void *r0, const void *r1, float fy, const VmbInt32_t *ix, const float *fx, float *sum, float *weight, VmbUint32_t first, VmbUint32_t last);
+typedef void (*AlliedDrizzleRowKernel)(const void *src, float *tmp, const float *w, VmbUint32_t taps, VmbUint32_t scale, VmbInt64_t base, VmbUint32_t first, VmbUint32_t last);
+typedef void (*AlliedAxpyKernel)(const float *tmp, const float *cov, float a, float *sum, float *weight, VmbUint32_t first, VmbUint32_t last);
+
+/**
+ * @brief Registration and shift-and-add kernels of a CPU level.
+ *
+ */
+typedef struct
+{
+    AlliedFftKernel fft;                 // In-place forward transform.
+    AlliedBilinearRowKernel bilinear[2]; // Bilinear interpolation of an output row, by source container (8, 16 bits).
+    AlliedDrizzleRowKernel drizzle[2];   // Horizontal drizzle of an input row, by source container.
+    AlliedAxpyKernel axpy;               // Weighted add of a drizzled row and its weights.
+} AlliedRegisterKernels_s;
+
+/**
+ * @brief Instantiate the radix-2 decimation-in-time transform.
+ *
+ */
+#define ALLIED_FFT(NAME, TARGET)                                                       \
+    TARGET static void allied_fft_##NAME(float *data, const AlliedFftPlan_s *plan)     \
+    {                                                                                  \
+        float *restrict d = data;                                                      \
+        const VmbUint32_t n = plan->n;                                                 \
+        for (VmbUint32_t i = 0; i < n; i++)                                            \
+        {                                                                              \
+            VmbUint32_t j = plan->rev[i];                                              \
+            if (i < j)                                                                 \
+            {                                                                          \
+                float re = d[2 * i], im = d[2 * i + 1];                                \
+                d[2 * i] = d[2 * j];                                                   \
+                d[2 * i + 1] = d[2 * j + 1];                                           \
+                d[2 * j] = re;                                                         \
+                d[2 * j + 1] = im;                                                     \
+            }                                                                          \
+        }                                                                              \
+        for (VmbUint32_t len = 2; len <= n; len <<= 1)                                 \
+        {                                                                              \
+            const VmbUint32_t half = len / 2;                                          \
+            const float *restrict tw = plan->twiddle + 2 * (half - 1);                 \
+            for (VmbUint32_t i = 0; i < n; i += len)                                   \
+            {                                                                          \
+                float *restrict a = d + 2 * i;                                         \
+                float *restrict b = a + 2 * half;                                      \
+                for (VmbUint32_t k = 0; k < half; k++)                                 \
+                {                                                                      \
+                    float wr = tw[2 * k];                                              \
+                    float wi = tw[2 * k + 1];                                          \
+                    float tr = b[2 * k] * wr - b[2 * k + 1] * wi;                      \
+                    float ti = b[2 * k] * wi + b[2 * k + 1] * wr;                      \
+                    b[2 * k] = a[2 * k] - tr;                                          \
+                    b[2 * k + 1] = a[2 * k + 1] - ti;                                  \
+                    a[2 * k] += tr;                                                    \
+                    a[2 * k + 1] += ti;                                                \
+                }                                                                      \
+            }                                                                          \
+        }                                                                              \
+    }
+
+/**
+ * @brief Instantiate the bilinear interpolation of an output row between two source rows.
+ *
+ */
+#define ALLIED_BILINEAR_ROW(NAME, TARGET, TS)                                                                                         \
+    TARGET static void allied_bilinear_row_##NAME(const void *r0, const void *r1, float fy, const VmbInt32_t *ix, const float *fx,   \
+                                                  float *sum, float *weight, VmbUint32_t first, VmbUint32_t last)                    \
+    {                                                                                                                                 \
+        const TS *restrict a = (const TS *)r0;                                                                                        \
+        const TS *restrict b = (const TS *)r1;                                                                                        \
+        float *restrict s = sum;                                                                                                      \
+        float *restrict w = weight;                                                                                                   \
+        for (VmbUint32_t x = first; x < last; x++)                                                                                    \
+        {                                                                                                                             \
+            VmbInt32_t i = ix[x];                                                                                                     \
+            float f = fx[x];                                                                                                          \
+            float top = (float)a[i] + ((float)a[i + 1] - (float)a[i]) * f;                                                            \
+            float bottom = (float)b[i] + ((float)b[i + 1] - (float)b[i]) * f;                                                         \
+            s[x] += top + (bottom - top) * fy;                                                                                        \
+            w[x] += 1.0f;                                                                                                             \
+        }                                                                                                                             \
+    }
+
+/**
+ * @brief Instantiate the horizontal drizzle of the input pixels `first` to `last` of a row, whose drops fall inside the output row.
+ *
+ */
+#define ALLIED_DRIZZLE_ROW(NAME, TARGET, TS)                                                                                      \
+    TARGET static void allied_drizzle_row_##NAME(const void *src, float *tmp, const float *w, VmbUint32_t taps, VmbUint32_t scale, \
+                                                 VmbInt64_t base, VmbUint32_t first, VmbUint32_t last)                            \
+    {                                                                                                                             \
+        const TS *restrict s = (const TS *)src;                                                                                   \
+        for (VmbUint32_t k = 0; k < taps; k++)                                                                                    \
+        {                                                                                                                         \
+            float *restrict t = tmp + (base + (VmbInt64_t)first * scale + k);                                                     \
+            const float wk = w[k];                                                                                                \
+            for (VmbUint32_t x = first; x < last; x++)                                                                            \
+            {                                                                                                                     \
+                t[(size_t)(x - first) * scale] += wk * (float)s[x];                                                               \
+            }                                                                                                                     \
+        }                                                                                                                         \
+    }
+
+#define ALLIED_AXPY_ROW(NAME, TARGET)                                                                                          \
+    TARGET static void allied_axpy_row_##NAME(const float *tmp, const float *cov, float a, float *sum, float *weight,          \
+                                              VmbUint32_t first, VmbUint32_t last)                                             \
+    {                                                                                                                          \
+        const float *restrict t = tmp;                                                                                         \
+        const float *restrict c = cov;                                                                                         \
+        float *restrict s = sum;                                                                                               \
+        float *restrict w = weight;                                                                                            \
+        for (VmbUint32_t x = first; x < last; x++)                                                                             \
+        {                                                                                                                      \
+            s[x] += a * t[x];                                                                                                  \
+            w[x] += a * c[x];                                                                                                  \
+        }                                                                                                                      \
+    }
+
+#define ALLIED_REGISTER_LEVEL(LEVEL, TARGET)                                                           \
+    ALLIED_FFT(LEVEL, TARGET)                                                                          \
+    ALLIED_BILINEAR_ROW(8_##LEVEL, TARGET, VmbUint8_t)                                                 \
+    ALLIED_BILINEAR_ROW(16_##LEVEL, TARGET, VmbUint16_t)                                               \
+    ALLIED_DRIZZLE_ROW(8_##LEVEL, TARGET, VmbUint8_t)                                                  \
+    ALLIED_DRIZZLE_ROW(16_##LEVEL, TARGET, VmbUint16_t)                                                \
+    ALLIED_AXPY_ROW(LEVEL, TARGET)                                                                     \
+    static const AlliedRegisterKernels_s register_##LEVEL = {                                          \
+        .fft = &allied_fft_##LEVEL,                                                                    \
+        .bilinear = {&allied_bilinear_row_8_##LEVEL, &allied_bilinear_row_16_##LEVEL},                 \
+        .drizzle = {&allied_drizzle_row_8_##LEVEL, &allied_drizzle_row_16_##LEVEL},                    \
+        .axpy = &allied_axpy_row_##LEVEL,                                                              \
+    };
+
+ALLIED_KERNEL_LEVELS(ALLIED_REGISTER_LEVEL)
+
+static const AlliedRegisterKernels_s *register_kernels = &register_scalar;
+
+ALLIED_KERNEL_BINDER(allied_register_bind, register_kernels, &register)
+
+static bool allied_is_pow2(VmbUint32_t n)
+{
+    return n != 0 && (n & (n - 1)) == 0;
+}
+
+static VmbUint32_t allied_floor_pow2(VmbUint32_t n)
+{
+    VmbUint32_t p = 1;
+    while (p * 2 <= n)
+    {
+        p *= 2;
+    }
+    return p;
+}
+
+static VmbError_t allied_fft_plan_init(AlliedFftPlan_s *plan, VmbUint32_t n)
+{
+    plan->n = n;
+    plan->rev = (VmbUint32_t *)malloc(n * sizeof(VmbUint32_t));
+    plan->twiddle = (float *)malloc(2 * (size_t)n * sizeof(float));
+    if (plan->rev == NULL || plan->twiddle == NULL)
+    {
+        return VmbErrorResources;
+    }
+    VmbUint32_t bits = 0;
+    while ((1u << bits) < n)
+    {
+        bits++;
+    }
+    for (VmbUint32_t i = 0; i < n; i++)
+    {
+        VmbUint32_t r = 0;
+        for (VmbUint32_t b = 0; b < bits; b++)
+        {
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        plan->rev[i] = r;
+    }
+    for (VmbUint32_t len = 2; len <= n; len <<= 1)
+    {
+        float *tw = plan->twiddle + 2 * (len / 2 - 1);
+        for (VmbUint32_t k = 0; k < len / 2; k++)
+        {
+            tw[2 * k] = (float)cos(2 * M_PI * k / len);
+            tw[2 * k + 1] = (float)-sin(2 * M_PI * k / len);
+        }
+    }
+    return VmbErrorSuccess;
+}
+
+static void allied_fft_plan_free(AlliedFftPlan_s *plan)
+{
+    free(plan->rev);
+    free(plan->twiddle);
+}
+
+/**
+ * @brief Number of pool tasks for a handle with a thread limit.
+ *
+ */
+static VmbUint32_t allied_register_tasks(VmbUint32_t threads)
+{
+    return threads > 1 ? allied_pool_threads(threads) : 1;
+}
+
+/**
+ * @brief Check an image against a frame geometry.
+ *
+ */
+static bool allied_register_matches(const AlliedCalibGeometry_t *geometry, VmbUint32_t pixel_size, const AlliedImage_t *image)
+{
+    size_t row = (size_t)geometry->width * pixel_size;
+    return image->width == geometry->width && image->height == geometry->height && image->format == geometry->format && image->data != NULL &&
+           (image->stride == 0 || image->stride >= row);
+}
+
+VmbError_t allied_register_create(AlliedRegister_t *reg, const AlliedCalibGeometry_t *geometry, const AlliedRegisterConfig_t *config)
+{
+    assert(reg);
+    assert(geometry);
+    *reg = NULL;
+    const AlliedImageKernels_s *kernels = allied_image_kernels(geometry->format);
+    if (kernels == NULL)
+    {
+        return VmbErrorNotSupported;
+    }
+    AlliedRegisterConfig_t c = {.method = AlliedRegisterPhase};
+    if (config != NULL)
+    {
+        c = *config;
+    }
+    else
+    {
+        VmbUint32_t side = allied_floor_pow2(geometry->width < geometry->height ? geometry->width : geometry->height);
+        side = side > 1024 ? 1024 : side;
+        c.x = (geometry->width - side) / 2;
+        c.y = (geometry->height - side) / 2;
+    }
+    bool phase = c.method == AlliedRegisterPhase;
+    if (c.method != AlliedRegisterPhase && c.method != AlliedRegisterCentroid)
+    {
+        return VmbErrorBadParameter;
+    }
+    if (c.x >= geometry->width || c.y >= geometry->height)
+    {
+        return VmbErrorBadParameter;
+    }
+    if (c.width == 0)
+    {
+        c.width = phase ? allied_floor_pow2(geometry->width - c.x) : geometry->width - c.x;
+        c.width = phase && c.width > 1024 ? 1024 : c.width;
+    }
+    if (c.height == 0)
+    {
+        c.height = phase ? allied_floor_pow2(geometry->height - c.y) : geometry->height - c.y;
+        c.height = phase && c.height > 1024 ? 1024 : c.height;
+    }
+    if (c.x + c.width > geometry->width || c.y + c.height > geometry->height || c.width < 2 || c.height < 2 || c.max_shift < 0)
+    {
+        return VmbErrorBadParameter;
+    }
+    if (phase && (!allied_is_pow2(c.width) || !allied_is_pow2(c.height) || c.width < 8 || c.height < 8 || c.width > 1024 || c.height > 1024))
+    {
+        return VmbErrorBadParameter;
+    }
+    if (c.max_shift == 0)
+    {
+        c.max_shift = (c.width < c.height ? c.width : c.height) / 4.0;
+    }
+    struct allied_register_s *r = (struct allied_register_s *)calloc(1, sizeof(struct allied_register_s));
+    if (r == NULL)
+    {
+        return VmbErrorResources;
+    }
+    r->geometry = *geometry;
+    r->config = c;
+    r->pixel_size = kernels->pixel_size;
+    r->tasks = allied_register_tasks(c.threads);
+    r->partial = (double *)calloc((size_t)r->tasks * 4, sizeof(double));
+    VmbError_t err = r->partial == NULL ? VmbErrorResources : VmbErrorSuccess;
+    if (phase && err == VmbErrorSuccess)
+    {
+        size_t pixels = (size_t)c.width * c.height;
+        r->wx = (float *)malloc(c.width * sizeof(float));
+        r->wy = (float *)malloc(c.height * sizeof(float));
+        r->fwx = (float *)malloc(c.width * sizeof(float));
+        r->fwy = (float *)malloc(c.height * sizeof(float));
+        r->gx = (float *)malloc(c.width * sizeof(float));
+        r->gy = (float *)malloc(c.height * sizeof(float));
+        r->ref = (float *)malloc(pixels * 2 * sizeof(float));
+        r->work = (float *)malloc(pixels * 2 * sizeof(float));
+        r->scratch = (float *)malloc((size_t)r->tasks * ALLIED_REGISTER_TILE * c.height * 2 * sizeof(float));
+        err = r->wx == NULL || r->wy == NULL || r->fwx == NULL || r->fwy == NULL || r->gx == NULL || r->gy == NULL || r->ref == NULL || r->work == NULL || r->scratch == NULL ? VmbErrorResources : VmbErrorSuccess;
+        if (err == VmbErrorSuccess)
+        {
+            err = allied_fft_plan_init(&(r->row_plan), c.width);
+        }
+        if (err == VmbErrorSuccess)
+        {
+            err = allied_fft_plan_init(&(r->col_plan), c.height);
+        }
+        for (VmbUint32_t i = 0; err == VmbErrorSuccess && i < c.width; i++)
+        {
+            double f = (i < c.width / 2 ? (double)i : (double)i - c.width) / c.width;
+            r->wx[i] = (float)(0.5 - 0.5 * cos(2 * M_PI * (i + 0.5) / c.width));
+            r->gx[i] = (float)exp(-2 * M_PI * M_PI * ALLIED_REGISTER_PEAK_SIGMA * ALLIED_REGISTER_PEAK_SIGMA * f * f);
+        }
+        for (VmbUint32_t i = 0; err == VmbErrorSuccess && i < c.height; i++)
+        {
+            double f = (i < c.height / 2 ? (double)i : (double)i - c.height) / c.height;
+            r->wy[i] = (float)(0.5 - 0.5 * cos(2 * M_PI * (i + 0.5) / c.height));
+            r->gy[i] = (float)exp(-2 * M_PI * M_PI * ALLIED_REGISTER_PEAK_SIGMA * ALLIED_REGISTER_PEAK_SIGMA * f * f);
+        }
+    }
+    *reg = r;
+    if (err != VmbErrorSuccess)
+    {
+        allied_register_destroy(reg);
+    }
+    return err;
+}
+
+VmbError_t allied_register_destroy(AlliedRegister_t *reg)
+{
+    assert(reg);
+    if (*reg == NULL)
+    {
+        return VmbErrorSuccess;
+    }
+    struct allied_register_s *r = *reg;
+    allied_fft_plan_free(&(r->row_plan));
+    allied_fft_plan_free(&(r->col_plan));
+    free(r->wx);
+    free(r->wy);
+    free(r->fwx);
+    free(r->fwy);
+    free(r->gx);
+    free(r->gy);
+    free(r->ref);
+    free(r->work);
+    free(r->scratch);
+    free(r->partial);
+    free(r);
+    *reg = NULL;
+    return VmbErrorSuccess;
+}
+
+/**
+ * @brief Stage of a registration job.
+ *
+ */
+typedef enum
+{
+    AlliedRegisterStageExtract = 0, // Windowed region into the work buffer, with the weighted sum of the pixels.
+    AlliedRegisterStageRows,        // Mean removal and row transforms.
+    AlliedRegisterStageColumns,     // Column transforms, and the cross-power spectrum or the reference spectrum.
+    AlliedRegisterStageInverse,     // Row transforms of the cross-power spectrum.
+    AlliedRegisterStageSurface,     // Column transforms of the cross-power spectrum.
+    AlliedRegisterStageMoments,     // Sum and maximum of the region.
+    AlliedRegisterStageCentroid,    // Center of mass above the mean of the region.
+} AlliedRegisterStage_s;
+
+/**
+ * @brief Registration job, shared by the tasks of the worker pool.
+ *
+ */
+typedef struct
+{
+    struct allied_register_s *reg; // Registration.
+    AlliedRegisterStage_s stage;   // Stage.
+    const VmbUchar_t *src;         // First pixel of the region in the image.
+    size_t src_stride;             // Bytes between source rows.
+    bool reference;                // The image is the reference.
+    float mean;                    // Windowed mean, or mean of the region.
+} AlliedRegisterJob_s;
+
+static inline float allied_register_pixel(const VmbUchar_t *row, VmbUint32_t pixel_size, VmbUint32_t x)
+{
+    return pixel_size == 1 ? (float)row[x] : (float)((const VmbUint16_t *)row)[x];
+}
+
+/**
+ * @brief Transform a tile of columns, and combine it with the reference spectrum.
+ *
+ */
+static void allied_register_columns(const AlliedRegisterJob_s *job, float *tile, VmbUint32_t first, VmbUint32_t count)
+{
+    struct allied_register_s *r = job->reg;
+    const VmbUint32_t w = r->config.width, h = r->config.height;
+    for (VmbUint32_t y = 0; y < h; y++)
+    {
+        for (VmbUint32_t c = 0; c < count; c++)
+        {
+            tile[2 * ((size_t)c * h + y)] = r->work[2 * ((size_t)y * w + first + c)];
+            tile[2 * ((size_t)c * h + y) + 1] = r->work[2 * ((size_t)y * w + first + c) + 1];
+        }
+    }
+    for (VmbUint32_t c = 0; c < count; c++)
+    {
+        float *col = tile + 2 * (size_t)c * h;
+        register_kernels->fft(col, &(r->col_plan));
+        if (job->stage != AlliedRegisterStageColumns || job->reference)
+        {
+            continue;
+        }
+        for (VmbUint32_t y = 0; y < h; y++)
+        {
+            const float *ref = r->ref + 2 * ((size_t)y * w + first + c);
+            float fr = col[2 * y], fi = col[2 * y + 1];
+            // conj(F * conj(R)) / (|F * conj(R)| + floor), low-passed
+            float cr = fr * ref[0] + fi * ref[1];
+            float ci = fr * ref[1] - fi * ref[0];
+            float mag = sqrtf(cr * cr + ci * ci);
+            float inv = mag + r->floor > 1e-20f ? r->gx[first + c] * r->gy[y] / (mag + r->floor) : 0.0f;
+            col[2 * y] = cr * inv;
+            col[2 * y + 1] = ci * inv;
+        }
+    }
+    float *dst = job->stage == AlliedRegisterStageColumns && job->reference ? r->ref : r->work;
+    for (VmbUint32_t y = 0; y < h; y++)
+    {
+        for (VmbUint32_t c = 0; c < count; c++)
+        {
+            dst[2 * ((size_t)y * w + first + c)] = tile[2 * ((size_t)c * h + y)];
+            dst[2 * ((size_t)y * w + first + c) + 1] = tile[2 * ((size_t)c * h + y) + 1];
+        }
+    }
+}
+
+static void allied_register_task(void *arg, VmbUint32_t index, VmbUint32_t count)
+{
+    const AlliedRegisterJob_s *job = (const AlliedRegisterJob_s *)arg;
+    struct allied_register_s *r = job->reg;
+    const VmbUint32_t w = r->config.width, h = r->config.height;
+    if (job->stage == AlliedRegisterStageColumns || job->stage == AlliedRegisterStageSurface)
+    {
+        VmbUint32_t tiles = (w + ALLIED_REGISTER_TILE - 1) / ALLIED_REGISTER_TILE;
+        VmbUint32_t first = (VmbUint32_t)((VmbUint64_t)tiles * index / count);
+        VmbUint32_t last = (VmbUint32_t)((VmbUint64_t)tiles * (index + 1) / count);
+        float *tile = r->scratch + (size_t)index * ALLIED_REGISTER_TILE * h * 2;
+        for (VmbUint32_t t = first; t < last; t++)
+        {
+            VmbUint32_t x = t * ALLIED_REGISTER_TILE;
+            allied_register_columns(job, tile, x, w - x < ALLIED_REGISTER_TILE ? w - x : ALLIED_REGISTER_TILE);
+        }
+        return;
+    }
+    VmbUint32_t first = (VmbUint32_t)((VmbUint64_t)h * index / count);
+    VmbUint32_t last = (VmbUint32_t)((VmbUint64_t)h * (index + 1) / count);
+    double *partial = r->partial + 4 * (size_t)index;
+    const float *wx = job->reference ? r->wx : r->fwx, *wy = job->reference ? r->wy : r->fwy;
+    double s0 = 0, s1 = 0, s2 = 0;
+    for (VmbUint32_t y = first; y < last; y++)
+    {
+        const VmbUchar_t *src = job->src + (size_t)y * job->src_stride;
+        float *row = r->work + 2 * (size_t)y * w;
+        switch (job->stage)
+        {
+        case AlliedRegisterStageExtract:
+            for (VmbUint32_t x = 0; x < w; x++)
+            {
+                float wt = wx[x] * wy[y];
+                float v = allied_register_pixel(src, r->pixel_size, x) * wt;
+                row[2 * x] = v;
+                row[2 * x + 1] = 0.0f;
+                s0 += v;
+                s1 += wt;
+            }
+            break;
+        case AlliedRegisterStageRows:
+            for (VmbUint32_t x = 0; x < w; x++)
+            {
+                row[2 * x] -= job->mean * wx[x] * wy[y];
+            }
+            register_kernels->fft(row, &(r->row_plan));
+            break;
+        case AlliedRegisterStageInverse:
+            register_kernels->fft(row, &(r->row_plan));
+            break;
+        case AlliedRegisterStageMoments:
+            for (VmbUint32_t x = 0; x < w; x++)
+            {
+                float v = allied_register_pixel(src, r->pixel_size, x);
+                s0 += v;
+                s1 = v > s1 ? v : s1;
+            }
+            break;
+        case AlliedRegisterStageCentroid:
+            for (VmbUint32_t x = 0; x < w; x++)
+            {
+                float v = allied_register_pixel(src, r->pixel_size, x) - job->mean;
+                v = v > 0 ? v : 0;
+                s0 += v;
+                s1 += (double)v * x;
+                s2 += (double)v * y;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    partial[0] = s0;
+    partial[1] = s1;
+    partial[2] = s2;
+}
+
+/**
+ * @brief Run a stage of a registration job across the pool.
+ *
+ */
+static void allied_register_run(AlliedRegisterJob_s *job, AlliedRegisterStage_s stage)
+{
+    struct allied_register_s *r = job->reg;
+    VmbUint32_t units = stage == AlliedRegisterStageColumns || stage == AlliedRegisterStageSurface
+                            ? (r->config.width + ALLIED_REGISTER_TILE - 1) / ALLIED_REGISTER_TILE
+                            : r->config.height;
+    VmbUint32_t tasks = units < r->tasks ? units : r->tasks;
+    job->stage = stage;
+    memset(r->partial, 0, (size_t)r->tasks * 4 * sizeof(double));
+    allied_pool_run(tasks, &allied_register_task, job);
+}
+
+/**
+ * @brief Take the spectrum of the region into the reference or the cross-power spectrum, or the centroid of the region.
+ *
+ */
+static VmbError_t allied_register_region(struct allied_register_s *r, const AlliedImage_t *image, VmbUint32_t x, VmbUint32_t y, bool reference,
+                                         double *cx, double *cy, double *quality)
+{
+    size_t stride = image->stride == 0 ? (size_t)image->width * r->pixel_size : image->stride;
+    AlliedRegisterJob_s job = {
+        .reg = r,
+        .src = (const VmbUchar_t *)image->data + (size_t)y * stride + (size_t)x * r->pixel_size,
+        .src_stride = stride,
+        .reference = reference,
+    };
+    allied_dispatch_init();
+    if (r->config.method == AlliedRegisterPhase)
+    {
+        allied_register_run(&job, AlliedRegisterStageExtract);
+        double sum = 0, wsum = 0;
+        for (VmbUint32_t i = 0; i < r->tasks; i++)
+        {
+            sum += r->partial[4 * i];
+            wsum += r->partial[4 * i + 1];
+        }
+        job.mean = (float)(sum / wsum);
+        allied_register_run(&job, AlliedRegisterStageRows);
+        allied_register_run(&job, AlliedRegisterStageColumns);
+        return VmbErrorSuccess;
+    }
+    allied_register_run(&job, AlliedRegisterStageMoments);
+    double sum = 0, peak = 0;
+    for (VmbUint32_t i = 0; i < r->tasks; i++)
+    {
+        sum += r->partial[4 * i];
+        peak = fmax(peak, r->partial[4 * i + 1]);
+    }
+    job.mean = (float)(sum / ((double)r->config.width * r->config.height));
+    allied_register_run(&job, AlliedRegisterStageCentroid);
+    double m0 = 0, mx = 0, my = 0;
+    for (VmbUint32_t i = 0; i < r->tasks; i++)
+    {
+        m0 += r->partial[4 * i];
+        mx += r->partial[4 * i + 1];
+        my += r->partial[4 * i + 2];
+    }
+    if (!(m0 > 0))
+    {
+        return VmbErrorNotAvailable;
+    }
+    *cx = mx / m0;
+    *cy = my / m0;
+    *quality = (peak - job.mean) / peak;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_register_set_reference(AlliedRegister_t reg, const AlliedImage_t *image)
+{
+    assert(reg);
+    assert(image);
+    if (!allied_register_matches(&(reg->geometry), reg->pixel_size, image))
+    {
+        return VmbErrorBadParameter;
+    }
+    double quality;
+    VmbError_t err = allied_register_region(reg, image, reg->config.x, reg->config.y, true, &(reg->ref_cx), &(reg->ref_cy), &quality);
+    reg->has_reference = err == VmbErrorSuccess;
+    if (reg->config.method == AlliedRegisterPhase && err == VmbErrorSuccess)
+    {
+        // the power of the frames is close to that of the reference, which sets the noise floor of their cross-power
+        size_t pixels = (size_t)reg->config.width * reg->config.height;
+        double power = 0;
+        for (size_t i = 0; i < 2 * pixels; i++)
+        {
+            power += (double)reg->ref[i] * reg->ref[i];
+        }
+        reg->floor = (float)(ALLIED_REGISTER_FLOOR * power / pixels);
+        // height of the peak of the reference against itself, for the quality of the measurements
+        double gain = 0;
+        for (VmbUint32_t y = 0; y < reg->config.height; y++)
+        {
+            for (VmbUint32_t x = 0; x < reg->config.width; x++)
+            {
+                const float *ref = reg->ref + 2 * ((size_t)y * reg->config.width + x);
+                double p = (double)ref[0] * ref[0] + (double)ref[1] * ref[1];
+                gain += reg->gx[x] * reg->gy[y] * p / (p + reg->floor);
+            }
+        }
+        reg->gain = gain > 0 ? gain : 1;
+    }
+    return err;
+}
+
+/**
+ * @brief Offset of the peak through three samples from the middle one: the vertex of the parabola through their logarithms, which is exact
+ * for a Gaussian peak, or through the samples if one is not positive.
+ *
+ */
+static double allied_register_vertex(double l, double c, double r)
+{
+    if (l > 0 && r > 0)
+    {
+        l = log(l);
+        r = log(r);
+        c = log(c);
+    }
+    double den = l - 2 * c + r;
+    if (!(den < 0))
+    {
+        return 0;
+    }
+    double off = 0.5 * (l - r) / den;
+    return off < -0.5 ? -0.5 : (off > 0.5 ? 0.5 : off);
+}
+
+/**
+ * @brief Measure the shift of a frame by phase correlation of the region at (x, y) with the reference region, with the window of the frame
+ * moved by (wx, wy).
+ *
+ */
+static VmbError_t allied_register_phase(struct allied_register_s *reg, const AlliedImage_t *image, VmbUint32_t x, VmbUint32_t y, double wx,
+                                        double wy, AlliedShift_t *shift)
+{
+    for (VmbUint32_t i = 0; i < reg->config.width; i++)
+    {
+        reg->fwx[i] = (float)(0.5 - 0.5 * cos(2 * M_PI * (i + 0.5 - wx) / reg->config.width));
+    }
+    for (VmbUint32_t i = 0; i < reg->config.height; i++)
+    {
+        reg->fwy[i] = (float)(0.5 - 0.5 * cos(2 * M_PI * (i + 0.5 - wy) / reg->config.height));
+    }
+    double unused;
+    allied_register_region(reg, image, x, y, false, &unused, &unused, &unused);
+    AlliedRegisterJob_s job = {.reg = reg};
+    allied_register_run(&job, AlliedRegisterStageInverse);
+    allied_register_run(&job, AlliedRegisterStageSurface);
+    const VmbInt64_t w = reg->config.width, h = reg->config.height;
+    const VmbInt64_t limx = (VmbInt64_t)fmin(reg->config.max_shift, w / 2 - 1);
+    const VmbInt64_t limy = (VmbInt64_t)fmin(reg->config.max_shift, h / 2 - 1);
+#define SURFACE(X, Y) ((double)reg->work[2 * ((size_t)((((Y) % h) + h) % h) * w + (size_t)((((X) % w) + w) % w))])
+    VmbInt64_t px = 0, py = 0;
+    double peak = -INFINITY;
+    for (VmbInt64_t j = -limy; j <= limy; j++)
+    {
+        for (VmbInt64_t i = -limx; i <= limx; i++)
+        {
+            double v = SURFACE(i, j);
+            if (v > peak)
+            {
+                peak = v;
+                px = i;
+                py = j;
+            }
+        }
+    }
+    if (!(peak > 0))
+    {
+        return VmbErrorNotAvailable;
+    }
+    shift->dx = (double)px + allied_register_vertex(SURFACE(px - 1, py), peak, SURFACE(px + 1, py));
+    shift->dy = (double)py + allied_register_vertex(SURFACE(px, py - 1), peak, SURFACE(px, py + 1));
+#undef SURFACE
+    shift->quality = fmin(1.0, peak / reg->gain);
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_register_measure(AlliedRegister_t reg, const AlliedImage_t *image, AlliedShift_t *shift)
+{
+    assert(reg);
+    assert(image);
+    assert(shift);
+    if (!reg->has_reference)
+    {
+        return VmbErrorInvalidCall;
+    }
+    if (!allied_register_matches(&(reg->geometry), reg->pixel_size, image))
+    {
+        return VmbErrorBadParameter;
+    }
+    const AlliedRegisterConfig_t *c = &(reg->config);
+    if (c->method == AlliedRegisterCentroid)
+    {
+        double cx = 0, cy = 0, quality = 0;
+        VmbError_t err = allied_register_region(reg, image, c->x, c->y, false, &cx, &cy, &quality);
+        if (err == VmbErrorSuccess)
+        {
+            shift->dx = cx - reg->ref_cx;
+            shift->dy = cy - reg->ref_cy;
+            shift->quality = quality;
+        }
+        return err;
+    }
+    VmbError_t err = allied_register_phase(reg, image, c->x, c->y, 0, 0, shift);
+    // a window that stays put weighs the two regions differently, which pulls the peak towards zero shift: measure again with the window of
+    // the frame moved with the shift, so that both windowed regions hold the same content. The region is moved by the whole pixels of the
+    // shift if it stays inside the frame, and the window by the rest.
+    VmbInt64_t ix = (VmbInt64_t)lround(shift->dx), iy = (VmbInt64_t)lround(shift->dy);
+    VmbInt64_t x = (VmbInt64_t)c->x + ix, y = (VmbInt64_t)c->y + iy;
+    if (x < 0 || y < 0 || x + c->width > reg->geometry.width || y + c->height > reg->geometry.height)
+    {
+        ix = iy = 0;
+        x = c->x;
+        y = c->y;
+    }
+    AlliedShift_t fine;
+    if (err == VmbErrorSuccess &&
+        allied_register_phase(reg, image, (VmbUint32_t)x, (VmbUint32_t)y, shift->dx - (double)ix, shift->dy - (double)iy, &fine) == VmbErrorSuccess &&
+        fabs((double)ix + fine.dx - shift->dx) < 1 && fabs((double)iy + fine.dy - shift->dy) < 1)
+    {
+        shift->dx = (double)ix + fine.dx;
+        shift->dy = (double)iy + fine.dy;
+        shift->quality = fine.quality;
+    }
+    return err;
+}
+
+VmbError_t allied_shiftadd_create(AlliedShiftAdd_t *sa, const AlliedCalibGeometry_t *geometry, const AlliedShiftAddConfig_t *config)
+{
+    assert(sa);
+    assert(geometry);
+    *sa = NULL;
+    const AlliedImageKernels_s *kernels = allied_image_kernels(geometry->format);
+    if (kernels == NULL)
+    {
+        return VmbErrorNotSupported;
+    }
+    AlliedShiftAddConfig_t c = {.kernel = AlliedShiftAddBilinear};
+    if (config != NULL)
+    {
+        c = *config;
+    }
+    c.scale = c.scale == 0 ? 1 : c.scale;
+    c.pixfrac = c.pixfrac == 0 ? 1 : c.pixfrac;
+    if ((c.kernel != AlliedShiftAddBilinear && c.kernel != AlliedShiftAddDrizzle) || c.scale > 4 || !(c.pixfrac > 0) || c.pixfrac > 1 ||
+        geometry->width < 2 || geometry->height < 2)
+    {
+        return VmbErrorBadParameter;
+    }
+    struct allied_shiftadd_s *a = (struct allied_shiftadd_s *)calloc(1, sizeof(struct allied_shiftadd_s));
+    if (a == NULL)
+    {
+        return VmbErrorResources;
+    }
+    a->geometry = *geometry;
+    a->config = c;
+    a->pixel_size = kernels->pixel_size;
+    a->tasks = allied_register_tasks(c.threads);
+    a->width = geometry->width * c.scale;
+    a->height = geometry->height * c.scale;
+    size_t pixels = (size_t)a->width * a->height;
+    a->sum = (float *)calloc(pixels, sizeof(float));
+    a->weight = (float *)calloc(pixels, sizeof(float));
+    a->ix = (VmbInt32_t *)malloc(a->width * sizeof(VmbInt32_t));
+    a->fx = (float *)malloc(a->width * sizeof(float));
+    a->cov = (float *)malloc(a->width * sizeof(float));
+    a->tmp = (float *)malloc((size_t)a->tasks * a->width * sizeof(float));
+    if (a->sum == NULL || a->weight == NULL || a->ix == NULL || a->fx == NULL || a->cov == NULL || a->tmp == NULL)
+    {
+        free(a->sum);
+        free(a->weight);
+        free(a->ix);
+        free(a->fx);
+        free(a->cov);
+        free(a->tmp);
+        free(a);
+        return VmbErrorResources;
+    }
+    pthread_mutex_init(&(a->lock), NULL);
+    atomic_init(&(a->running), false);
+    atomic_init(&(a->error), VmbErrorSuccess);
+    *sa = a;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_shiftadd_destroy(AlliedShiftAdd_t *sa)
+{
+    assert(sa);
+    if (*sa == NULL)
+    {
+        return VmbErrorSuccess;
+    }
+    struct allied_shiftadd_s *a = *sa;
+    allied_shiftadd_detach(a);
+    pthread_mutex_destroy(&(a->lock));
+    free(a->sum);
+    free(a->weight);
+    free(a->ix);
+    free(a->fx);
+    free(a->cov);
+    free(a->tmp);
+    free(a);
+    *sa = NULL;
+    return VmbErrorSuccess;
+}
+
+/**
+ * @brief Drizzle drops of one axis: the drop of input pixel `i` covers output pixels `base + i * scale + k` with weight `w[k]`.
+ *
+ */
+typedef struct
+{
+    VmbInt64_t base;              // Output pixel of the first tap of input pixel 0.
+    VmbUint32_t taps;             // Output pixels touched per drop.
+    float w[ALLIED_DRIZZLE_TAPS]; // Overlap of the drop with each output pixel.
+} AlliedDrizzleAxis_s;
+
+static void allied_drizzle_axis(AlliedDrizzleAxis_s *axis, double shift, double pixfrac, VmbUint32_t scale)
+{
+    // the drop of input pixel i spans [(i + 0.5 - shift - pixfrac / 2) * scale, (i + 0.5 - shift + pixfrac / 2) * scale)
+    double start = (0.5 - shift - 0.5 * pixfrac) * scale;
+    double base = floor(start);
+    double phase = start - base, len = pixfrac * scale;
+    axis->base = (VmbInt64_t)base;
+    axis->taps = (VmbUint32_t)ceil(phase + len - 1e-9);
+    axis->taps = axis->taps < 1 ? 1 : (axis->taps > ALLIED_DRIZZLE_TAPS ? ALLIED_DRIZZLE_TAPS : axis->taps);
+    for (VmbUint32_t k = 0; k < axis->taps; k++)
+    {
+        double w = fmin(k + 1.0, phase + len) - fmax((double)k, phase);
+        axis->w[k] = (float)(w > 0 ? w : 0);
+    }
+}
+
+/**
+ * @brief Input pixels whose drops fall entirely inside `[0, size)` output pixels.
+ *
+ */
+static void allied_drizzle_inner(const AlliedDrizzleAxis_s *axis, VmbUint32_t scale, VmbUint32_t inputs, VmbUint32_t size, VmbUint32_t *first, VmbUint32_t *last)
+{
+    VmbInt64_t lo = axis->base >= 0 ? 0 : (-axis->base + scale - 1) / scale;
+    VmbInt64_t hi = (VmbInt64_t)size - axis->base - (VmbInt64_t)axis->taps;
+    hi = hi < 0 ? -1 : hi / scale;
+    hi = hi >= (VmbInt64_t)inputs ? (VmbInt64_t)inputs - 1 : hi;
+    *first = (VmbUint32_t)(lo > (VmbInt64_t)inputs ? inputs : lo);
+    *last = hi + 1 > (VmbInt64_t)*first ? (VmbUint32_t)(hi + 1) : *first;
+}
+
+/**
+ * @brief Shift-and-add job, shared by the tasks of the worker pool.
+ *
+ */
+typedef struct
+{
+    struct allied_shiftadd_s *sa; // Accumulator.
+    const VmbUchar_t *src;        // First row of the source.
+    size_t src_stride;            // Bytes between source rows.
+    double dx;                    // Horizontal shift.
+    double dy;                    // Vertical shift.
+    VmbUint32_t first;            // First output (bilinear) or input (drizzle) column of the inner loop.
+    VmbUint32_t last;             // End of the inner loop.
+    VmbUint32_t cov_first;        // First output column touched by a drizzled row.
+    VmbUint32_t cov_last;         // End of the output columns touched by a drizzled row.
+    AlliedDrizzleAxis_s ax;       // Horizontal drops.
+    AlliedDrizzleAxis_s ay;       // Vertical drops.
+} AlliedShiftAddJob_s;
+
+static void allied_shiftadd_bilinear_task(void *arg, VmbUint32_t index, VmbUint32_t count)
+{
+    const AlliedShiftAddJob_s *job = (const AlliedShiftAddJob_s *)arg;
+    struct allied_shiftadd_s *a = job->sa;
+    const VmbUint32_t scale = a->config.scale, ih = a->geometry.height;
+    VmbUint32_t first = (VmbUint32_t)((VmbUint64_t)a->height * index / count);
+    VmbUint32_t last = (VmbUint32_t)((VmbUint64_t)a->height * (index + 1) / count);
+    AlliedBilinearRowKernel row = register_kernels->bilinear[a->pixel_size == 1 ? 0 : 1];
+    for (VmbUint32_t y = first; y < last; y++)
+    {
+        double v = (y + 0.5) / scale - 0.5 + job->dy;
+        if (v < 0 || v > ih - 1)
+        {
+            continue;
+        }
+        VmbUint32_t i = (VmbUint32_t)v;
+        i = i > ih - 2 ? ih - 2 : i;
+        size_t at = (size_t)y * a->width;
+        row(job->src + (size_t)i * job->src_stride, job->src + (size_t)(i + 1) * job->src_stride, (float)(v - i), a->ix, a->fx, a->sum + at,
+            a->weight + at, job->first, job->last);
+    }
+}
+
+/**
+ * @brief Drizzle the input pixels `first` to `last` of a row, clipping their drops to the output row.
+ *
+ */
+static void allied_shiftadd_drizzle_edge(const AlliedShiftAddJob_s *job, const VmbUchar_t *src, float *tmp, VmbUint32_t first, VmbUint32_t last)
+{
+    struct allied_shiftadd_s *a = job->sa;
+    for (VmbUint32_t x = first; x < last; x++)
+    {
+        float v = allied_register_pixel(src, a->pixel_size, x);
+        for (VmbUint32_t k = 0; k < job->ax.taps; k++)
+        {
+            VmbInt64_t X = job->ax.base + (VmbInt64_t)x * a->config.scale + k;
+            if (X >= 0 && X < (VmbInt64_t)a->width)
+            {
+                tmp[X] += job->ax.w[k] * v;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Drizzle an input row onto a task row.
+ *
+ */
+static void allied_shiftadd_drizzle_row(const AlliedShiftAddJob_s *job, const VmbUchar_t *src, float *tmp)
+{
+    struct allied_shiftadd_s *a = job->sa;
+    memset(tmp + job->cov_first, 0, (size_t)(job->cov_last - job->cov_first) * sizeof(float));
+    if (job->last > job->first)
+    {
+        register_kernels->drizzle[a->pixel_size == 1 ? 0 : 1](src, tmp, job->ax.w, job->ax.taps, a->config.scale, job->ax.base, job->first, job->last);
+        allied_shiftadd_drizzle_edge(job, src, tmp, 0, job->first);
+        allied_shiftadd_drizzle_edge(job, src, tmp, job->last, a->geometry.width);
+    }
+    else
+    {
+        allied_shiftadd_drizzle_edge(job, src, tmp, 0, a->geometry.width);
+    }
+}
+
+static VmbInt64_t allied_floor_div(VmbInt64_t a, VmbInt64_t b)
+{
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+static void allied_shiftadd_drizzle_task(void *arg, VmbUint32_t index, VmbUint32_t count)
+{
+    const AlliedShiftAddJob_s *job = (const AlliedShiftAddJob_s *)arg;
+    struct allied_shiftadd_s *a = job->sa;
+    const VmbInt64_t scale = a->config.scale;
+    VmbInt64_t first = (VmbInt64_t)((VmbUint64_t)a->height * index / count);
+    VmbInt64_t last = (VmbInt64_t)((VmbUint64_t)a->height * (index + 1) / count);
+    // input rows whose drops reach the band of output rows
+    VmbInt64_t ylo = allied_floor_div(first - job->ay.base - (VmbInt64_t)job->ay.taps, scale) + 1;
+    VmbInt64_t yhi = allied_floor_div(last - 1 - job->ay.base, scale);
+    ylo = ylo < 0 ? 0 : ylo;
+    yhi = yhi >= (VmbInt64_t)a->geometry.height ? (VmbInt64_t)a->geometry.height - 1 : yhi;
+    float *tmp = a->tmp + (size_t)index * a->width;
+    for (VmbInt64_t y = ylo; y <= yhi; y++)
+    {
+        allied_shiftadd_drizzle_row(job, job->src + (size_t)y * job->src_stride, tmp);
+        for (VmbUint32_t k = 0; k < job->ay.taps; k++)
+        {
+            VmbInt64_t Y = job->ay.base + y * scale + k;
+            if (Y >= first && Y < last)
+            {
+                size_t at = (size_t)Y * a->width;
+                register_kernels->axpy(tmp, a->cov, job->ay.w[k], a->sum + at, a->weight + at, job->cov_first, job->cov_last);
+            }
+        }
+    }
+}
+
+VmbError_t allied_shiftadd_add(AlliedShiftAdd_t sa, const AlliedImage_t *image, const AlliedShift_t *shift)
+{
+    assert(sa);
+    assert(image);
+    assert(shift);
+    if (!allied_register_matches(&(sa->geometry), sa->pixel_size, image) || !isfinite(shift->dx) || !isfinite(shift->dy))
+    {
+        return VmbErrorBadParameter;
+    }
+    allied_dispatch_init();
+    AlliedShiftAddJob_s job = {
+        .sa = sa,
+        .src = (const VmbUchar_t *)image->data,
+        .src_stride = image->stride == 0 ? (size_t)image->width * sa->pixel_size : image->stride,
+        .dx = shift->dx,
+        .dy = shift->dy,
+    };
+    const VmbUint32_t scale = sa->config.scale, iw = sa->geometry.width;
+    VmbUint32_t tasks = sa->height < sa->tasks ? sa->height : sa->tasks;
+    pthread_mutex_lock(&(sa->lock));
+    if (sa->config.kernel == AlliedShiftAddBilinear)
+    {
+        // output columns sampling inside the frame form one run
+        job.first = sa->width;
+        job.last = 0;
+        for (VmbUint32_t x = 0; x < sa->width; x++)
+        {
+            double u = (x + 0.5) / scale - 0.5 + job.dx;
+            if (u < 0 || u > iw - 1)
+            {
+                continue;
+            }
+            VmbUint32_t i = (VmbUint32_t)u;
+            i = i > iw - 2 ? iw - 2 : i;
+            sa->ix[x] = (VmbInt32_t)i;
+            sa->fx[x] = (float)(u - i);
+            job.first = x < job.first ? x : job.first;
+            job.last = x + 1;
+        }
+        if (job.last > job.first)
+        {
+            allied_pool_run(tasks, &allied_shiftadd_bilinear_task, &job);
+        }
+    }
+    else
+    {
+        allied_drizzle_axis(&(job.ax), job.dx, sa->config.pixfrac, scale);
+        allied_drizzle_axis(&(job.ay), job.dy, sa->config.pixfrac, scale);
+        allied_drizzle_inner(&(job.ax), scale, iw, sa->width, &(job.first), &(job.last));
+        memset(sa->cov, 0, sa->width * sizeof(float));
+        job.cov_first = sa->width;
+        job.cov_last = 0;
+        for (VmbUint32_t x = 0; x < iw; x++)
+        {
+            for (VmbUint32_t k = 0; k < job.ax.taps; k++)
+            {
+                VmbInt64_t X = job.ax.base + (VmbInt64_t)x * scale + k;
+                if (X >= 0 && X < (VmbInt64_t)sa->width)
+                {
+                    sa->cov[X] += job.ax.w[k];
+                    job.cov_first = (VmbUint32_t)X < job.cov_first ? (VmbUint32_t)X : job.cov_first;
+                    job.cov_last = (VmbUint32_t)X + 1 > job.cov_last ? (VmbUint32_t)X + 1 : job.cov_last;
+                }
+            }
+        }
+        if (job.cov_last > job.cov_first)
+        {
+            allied_pool_run(tasks, &allied_shiftadd_drizzle_task, &job);
+        }
+    }
+    sa->frames++;
+    pthread_mutex_unlock(&(sa->lock));
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_shiftadd_result(AlliedShiftAdd_t sa, float *dst, float *weight, size_t stride)
+{
+    assert(sa);
+    size_t row = (size_t)sa->width * sizeof(float);
+    stride = stride == 0 ? row : stride;
+    if (stride < row)
+    {
+        return VmbErrorBadParameter;
+    }
+    pthread_mutex_lock(&(sa->lock));
+    for (VmbUint32_t y = 0; y < sa->height; y++)
+    {
+        const float *s = sa->sum + (size_t)y * sa->width;
+        const float *w = sa->weight + (size_t)y * sa->width;
+        if (dst != NULL)
+        {
+            float *out = (float *)((VmbUchar_t *)dst + (size_t)y * stride);
+            for (VmbUint32_t x = 0; x < sa->width; x++)
+            {
+                out[x] = w[x] > 0 ? s[x] / w[x] : 0.0f;
+            }
+        }
+        if (weight != NULL)
+        {
+            memcpy((VmbUchar_t *)weight + (size_t)y * stride, w, row);
+        }
+    }
+    pthread_mutex_unlock(&(sa->lock));
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_shiftadd_status(AlliedShiftAdd_t sa, AlliedShiftAddStatus_t *status)
+{
+    assert(sa);
+    assert(status);
+    memset(status, 0, sizeof(AlliedShiftAddStatus_t));
+    status->width = sa->width;
+    status->height = sa->height;
+    pthread_mutex_lock(&(sa->lock));
+    status->frames = sa->frames;
+    status->skipped = sa->skipped;
+    status->last = sa->last;
+    pthread_mutex_unlock(&(sa->lock));
+    status->attached = atomic_load(&(sa->running));
+    status->error = atomic_load(&(sa->error));
+    if (status->attached)
+    {
+        allied_subscriber_counts(sa->sub, NULL, NULL, &(status->dropped));
+    }
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_shiftadd_reset(AlliedShiftAdd_t sa)
+{
+    assert(sa);
+    pthread_mutex_lock(&(sa->lock));
+    size_t pixels = (size_t)sa->width * sa->height;
+    memset(sa->sum, 0, pixels * sizeof(float));
+    memset(sa->weight, 0, pixels * sizeof(float));
+    sa->frames = 0;
+    sa->skipped = 0;
+    pthread_mutex_unlock(&(sa->lock));
+    return VmbErrorSuccess;
+}
+
+/**
+ * @brief Thread that registers and adds the frames of a subscription.
+ *
+ */
+static void *allied_shiftadd_thread(void *arg)
+{
+    struct allied_shiftadd_s *a = (struct allied_shiftadd_s *)arg;
+    while (atomic_load(&(a->running)))
+    {
+        AlliedFrameView_t view;
+        if (allied_subscriber_pop(a->sub, &view, ALLIED_SHIFTADD_POLL_MS) != VmbErrorSuccess)
+        {
+            continue;
+        }
+        AlliedImage_t image;
+        VmbError_t err = allied_image_from_view(&view, &image);
+        if (err == VmbErrorSuccess && (view.frame->offsetX + view.offset_x != a->geometry.offset_x ||
+                                       view.frame->offsetY + view.offset_y != a->geometry.offset_y || image.width != a->geometry.width ||
+                                       image.height != a->geometry.height || image.format != a->geometry.format))
+        {
+            err = VmbErrorBadParameter;
+        }
+        AlliedShift_t shift = {.quality = 1};
+        if (err == VmbErrorSuccess)
+        {
+            err = a->reg->has_reference ? allied_register_measure(a->reg, &image, &shift) : allied_register_set_reference(a->reg, &image);
+        }
+        bool keep = err == VmbErrorSuccess && shift.quality >= a->config.min_quality;
+        if (keep)
+        {
+            err = allied_shiftadd_add(a, &image, &shift);
+        }
+        allied_frame_release(view.frame);
+        pthread_mutex_lock(&(a->lock));
+        if (err == VmbErrorSuccess)
+        {
+            a->last = shift;
+            a->skipped += keep ? 0 : 1;
+        }
+        pthread_mutex_unlock(&(a->lock));
+        atomic_store(&(a->error), err);
+    }
+    return NULL;
+}
+
+VmbError_t allied_shiftadd_attach(AlliedShiftAdd_t sa, AlliedRegister_t reg, AlliedCameraHandle_t handle, const AlliedSubscription_t *subscription)
+{
+    assert(sa);
+    assert(reg);
+    assert(handle);
+    if (sa->sub != NULL)
+    {
+        return VmbErrorInvalidCall;
+    }
+    if (reg->geometry.width != sa->geometry.width || reg->geometry.height != sa->geometry.height || reg->geometry.format != sa->geometry.format)
+    {
+        return VmbErrorBadParameter;
+    }
+    AlliedSubscription_t config = {.queue_depth = 4, .policy = AlliedBackpressureDropNewest};
+    if (subscription != NULL)
+    {
+        config = *subscription;
+        config.callback = NULL;
+    }
+    VmbError_t err = allied_subscribe(handle, &config, &(sa->sub));
+    if (err != VmbErrorSuccess)
+    {
+        sa->sub = NULL;
+        return err;
+    }
+    sa->reg = reg;
+    atomic_store(&(sa->error), VmbErrorSuccess);
+    atomic_store(&(sa->running), true);
+    if (pthread_create(&(sa->thread), NULL, &allied_shiftadd_thread, sa) != 0)
+    {
+        atomic_store(&(sa->running), false);
+        allied_unsubscribe(&(sa->sub));
+        return VmbErrorResources;
+    }
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_shiftadd_detach(AlliedShiftAdd_t sa)
+{
+    assert(sa);
+    if (sa->sub == NULL)
+    {
+        return VmbErrorSuccess;
+    }
+    atomic_store(&(sa->running), false);
+    pthread_join(sa->thread, NULL);
+    allied_unsubscribe(&(sa->sub));
+    sa->reg = NULL;
+    return VmbErrorSuccess;
+}
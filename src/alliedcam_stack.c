@@ -0,0 +1,580 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_stack.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Sigma-clipped and percentile stacking with bounded memory for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details The per-frame kernels are instantiated per source container and CPU level. The clipping kernel is branch free: every pixel
+ * computes its Welford update, and the acceptance selects between the updated and the old state, so that the loop vectorizes (this file is
+ * built with -O3, see the Makefile). Histograms are stored pixel-major, so that the counters of a pixel share cache lines. Seeding runs once
+ * per stack, one pixel at a time.
+ */
+
+#include "alliedcam_stack.h"
+#include "alliedcam_kernels.h"
+#include "alliedcam_dispatch.h"
+#include "alliedcam_pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+/**
+ * @brief Largest number of frames of a percentile stack, the range of the histogram counters.
+ *
+ */
+#define ALLIED_STACK_MAX_COUNT 0xffffu
+
+struct allied_stack_s
+{
+    AlliedCalibGeometry_t geometry; // Geometry of the frames.
+    AlliedStackConfig_t config;     // Configuration, with the defaults resolved.
+    VmbUint32_t pixel_size;         // Bytes per source pixel.
+    VmbUchar_t *seedbuf;            // Seed frames, packed rows.
+    VmbUint32_t buffered;           // Frames in the seed buffer.
+    bool seeded;                    // The seed frames have been processed.
+    VmbUint32_t frames;             // Frames added.
+    VmbUint64_t rejected;           // Samples rejected or out of the histogram range.
+    float *mean;                    // Running mean of the accepted samples, sigma clipping.
+    float *m2;                      // Sum of the squared deviations of the accepted samples from their mean, sigma clipping.
+    VmbUint32_t *count;             // Accepted samples, sigma clipping.
+    float *lo;                      // Lower edge of the histogram, percentile stacking.
+    float *scale;                   // Bins per ADU of the histogram, percentile stacking.
+    VmbUint16_t *hist;              // Histograms, `bins` counters per pixel, percentile stacking.
+    size_t memory;                  // Bytes held.
+};
+
+typedef VmbUint32_t (*AlliedStackClipKernel)(const void *src, float *mean, float *m2, VmbUint32_t *count, VmbUint32_t width, float kappa2, float min_var);
+typedef VmbUint32_t (*AlliedStackHistKernel)(const void *src, const float *lo, const float *scale, VmbUint16_t *hist, VmbUint32_t bins, VmbUint32_t width);
+
+/**
+ * @brief Stacking kernels of a CPU level.
+ *
+ */
+typedef struct
+{
+    AlliedStackClipKernel clip[2]; // Sigma clipping of a row, by source container (8, 16 bits). Returns the rejected samples.
+    AlliedStackHistKernel hist[2]; // Histogram update of a row, by source container. Returns the samples out of range.
+} AlliedStackKernels_s;
+
+/**
+ * @brief Instantiate the stacking kernels of a source container.
+ *
+ * @param NAME Suffix of the kernel names.
+ * @param TARGET Target attribute of the CPU level, or nothing.
+ * @param TS Source container type.
+ */
+#define ALLIED_STACK_KERNELS(NAME, TARGET, TS)                                                                                    \
+    TARGET static VmbUint32_t allied_stack_clip_##NAME(const void *src, float *mean, float *m2, VmbUint32_t *count,               \
+                                                       VmbUint32_t width, float kappa2, float min_var)                            \
+    {                                                                                                                             \
+        const TS *restrict s = (const TS *)src;                                                                                   \
+        float *restrict mu = mean;                                                                                                \
+        float *restrict q = m2;                                                                                                   \
+        VmbUint32_t *restrict n = count;                                                                                          \
+        VmbUint32_t rejected = 0;                                                                                                 \
+        for (size_t x = 0; x < width; x++)                                                                                        \
+        {                                                                                                                         \
+            float v = (float)s[x];                                                                                                \
+            float m = mu[x];                                                                                                      \
+            float c = (float)n[x];                                                                                                \
+            float var = q[x] / c;                                                                                                 \
+            var = var < min_var ? min_var : var;                                                                                  \
+            float d = v - m;                                                                                                      \
+            VmbUint32_t ok = d * d <= kappa2 * var;                                                                               \
+            float mn = m + d / (c + 1.0f);                                                                                        \
+            mu[x] = ok ? mn : m;                                                                                                  \
+            q[x] = ok ? q[x] + d * (v - mn) : q[x];                                                                               \
+            n[x] += ok;                                                                                                           \
+            rejected += 1 - ok;                                                                                                   \
+        }                                                                                                                         \
+        return rejected;                                                                                                          \
+    }                                                                                                                             \
+    TARGET static VmbUint32_t allied_stack_hist_##NAME(const void *src, const float *lo, const float *scale, VmbUint16_t *hist,   \
+                                                       VmbUint32_t bins, VmbUint32_t width)                                       \
+    {                                                                                                                             \
+        const TS *restrict s = (const TS *)src;                                                                                   \
+        VmbUint32_t outside = 0;                                                                                                  \
+        for (size_t x = 0; x < width; x++)                                                                                        \
+        {                                                                                                                         \
+            float b = ((float)s[x] - lo[x]) * scale[x];                                                                           \
+            VmbInt32_t i = b < 0.0f ? 0 : (b >= (float)bins ? (VmbInt32_t)bins - 1 : (VmbInt32_t)b);                              \
+            outside += b < 0.0f || b >= (float)bins;                                                                              \
+            hist[x * bins + (size_t)i]++;                                                                                         \
+        }                                                                                                                         \
+        return outside;                                                                                                           \
+    }
+
+#define ALLIED_STACK_LEVEL(LEVEL, TARGET)                                 \
+    ALLIED_STACK_KERNELS(8_##LEVEL, TARGET, VmbUint8_t)                   \
+    ALLIED_STACK_KERNELS(16_##LEVEL, TARGET, VmbUint16_t)                 \
+    static const AlliedStackKernels_s stack_##LEVEL = {                   \
+        .clip = {&allied_stack_clip_8_##LEVEL, &allied_stack_clip_16_##LEVEL}, \
+        .hist = {&allied_stack_hist_8_##LEVEL, &allied_stack_hist_16_##LEVEL}, \
+    };
+
+ALLIED_KERNEL_LEVELS(ALLIED_STACK_LEVEL)
+
+static const AlliedStackKernels_s *stack_kernels = &stack_scalar;
+
+ALLIED_KERNEL_BINDER(allied_stack_bind, stack_kernels, &stack)
+
+/**
+ * @brief Resolve the defaults of a configuration.
+ *
+ * @return VmbError_t `VmbErrorBadParameter` if the configuration is out of range.
+ */
+static VmbError_t allied_stack_resolve(const AlliedStackConfig_t *config, AlliedStackConfig_t *c)
+{
+    memset(c, 0, sizeof(AlliedStackConfig_t));
+    if (config != NULL)
+    {
+        *c = *config;
+    }
+    c->seed = c->seed == 0 ? 16 : c->seed;
+    c->kappa = c->kappa == 0 ? 3 : c->kappa;
+    c->iterations = c->iterations == 0 ? 3 : c->iterations;
+    c->min_sigma = c->min_sigma == 0 ? 1 : c->min_sigma;
+    c->bins = c->bins == 0 ? 64 : c->bins;
+    c->range = c->range == 0 ? 6 : c->range;
+    if (c->mode > AlliedStackPercentile || c->seed < 3 || c->seed > ALLIED_STACK_MAX_COUNT || !(c->kappa > 0) || !(c->min_sigma > 0) ||
+        c->bins < 4 || c->bins > 1024 || !(c->range > 0))
+    {
+        return VmbErrorBadParameter;
+    }
+    return VmbErrorSuccess;
+}
+
+size_t allied_stack_memory(const AlliedCalibGeometry_t *geometry, const AlliedStackConfig_t *config)
+{
+    assert(geometry);
+    AlliedStackConfig_t c;
+    size_t pixel_size = allied_image_pixel_size(geometry->format);
+    if (allied_stack_resolve(config, &c) != VmbErrorSuccess || pixel_size == 0)
+    {
+        return 0;
+    }
+    size_t pixels = (size_t)geometry->width * geometry->height;
+    size_t state = c.mode == AlliedStackSigmaClip ? 2 * sizeof(float) + sizeof(VmbUint32_t) : 2 * sizeof(float) + c.bins * sizeof(VmbUint16_t);
+    return sizeof(struct allied_stack_s) + pixels * (c.seed * pixel_size + state);
+}
+
+VmbError_t allied_stack_create(AlliedStack_t *stack, const AlliedCalibGeometry_t *geometry, const AlliedStackConfig_t *config)
+{
+    assert(stack);
+    assert(geometry);
+    *stack = NULL;
+    AlliedStackConfig_t c;
+    if (allied_stack_resolve(config, &c) != VmbErrorSuccess || geometry->width == 0 || geometry->height == 0)
+    {
+        return VmbErrorBadParameter;
+    }
+    const AlliedImageKernels_s *kernels = allied_image_kernels(geometry->format);
+    if (kernels == NULL)
+    {
+        return VmbErrorNotSupported;
+    }
+    struct allied_stack_s *s = (struct allied_stack_s *)calloc(1, sizeof(struct allied_stack_s));
+    if (s == NULL)
+    {
+        return VmbErrorResources;
+    }
+    s->geometry = *geometry;
+    s->config = c;
+    s->pixel_size = kernels->pixel_size;
+    size_t pixels = (size_t)geometry->width * geometry->height;
+    s->seedbuf = (VmbUchar_t *)malloc(pixels * c.seed * s->pixel_size);
+    bool ok = s->seedbuf != NULL;
+    if (c.mode == AlliedStackSigmaClip)
+    {
+        s->mean = (float *)malloc(pixels * sizeof(float));
+        s->m2 = (float *)malloc(pixels * sizeof(float));
+        s->count = (VmbUint32_t *)malloc(pixels * sizeof(VmbUint32_t));
+        ok = ok && s->mean != NULL && s->m2 != NULL && s->count != NULL;
+    }
+    else
+    {
+        s->lo = (float *)malloc(pixels * sizeof(float));
+        s->scale = (float *)malloc(pixels * sizeof(float));
+        s->hist = (VmbUint16_t *)malloc(pixels * c.bins * sizeof(VmbUint16_t));
+        ok = ok && s->lo != NULL && s->scale != NULL && s->hist != NULL;
+    }
+    if (!ok)
+    {
+        allied_stack_destroy(&s);
+        return VmbErrorResources;
+    }
+    s->memory = allied_stack_memory(geometry, &c);
+    *stack = s;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_stack_destroy(AlliedStack_t *stack)
+{
+    assert(stack);
+    if (*stack == NULL)
+    {
+        return VmbErrorSuccess;
+    }
+    struct allied_stack_s *s = *stack;
+    free(s->seedbuf);
+    free(s->mean);
+    free(s->m2);
+    free(s->count);
+    free(s->lo);
+    free(s->scale);
+    free(s->hist);
+    free(s);
+    *stack = NULL;
+    return VmbErrorSuccess;
+}
+
+/**
+ * @brief Operation of a stacking job.
+ *
+ */
+typedef enum
+{
+    AlliedStackJobSeed = 0, // Seed the estimates from the buffered frames.
+    AlliedStackJobAdd,      // Add a frame.
+} AlliedStackJobOp_s;
+
+/**
+ * @brief Stacking job, shared by the tasks of the worker pool.
+ *
+ */
+typedef struct
+{
+    struct allied_stack_s *stack;                   // Stack.
+    AlliedStackJobOp_s op;                          // Operation.
+    const VmbUchar_t *src;                          // First row of the frame to add.
+    size_t src_stride;                              // Bytes between source rows.
+    VmbUint64_t rejected[ALLIED_POOL_MAX_THREADS];  // Rejected samples, by task.
+    bool failed;                                    // A task ran out of memory.
+} AlliedStackJob_s;
+
+static int allied_stack_cmp(const void *a, const void *b)
+{
+    float x = *(const float *)a, y = *(const float *)b;
+    return (x > y) - (x < y);
+}
+
+static float allied_stack_median(float *v, VmbUint32_t n)
+{
+    qsort(v, n, sizeof(float), &allied_stack_cmp);
+    return n % 2 ? v[n / 2] : 0.5f * (v[n / 2 - 1] + v[n / 2]);
+}
+
+/**
+ * @brief Seed the estimates of one pixel from its buffered samples.
+ *
+ * @param s Stack.
+ * @param i Pixel index.
+ * @param v Samples of the pixel, overwritten.
+ * @param w Scratch of as many values.
+ * @return VmbUint32_t Rejected samples.
+ */
+static VmbUint32_t allied_stack_seed_pixel(struct allied_stack_s *s, size_t i, float *v, float *w)
+{
+    const AlliedStackConfig_t *c = &(s->config);
+    VmbUint32_t n = s->buffered;
+    memcpy(w, v, n * sizeof(float));
+    float med = allied_stack_median(w, n);
+    for (VmbUint32_t k = 0; k < n; k++)
+    {
+        w[k] = fabsf(v[k] - med);
+    }
+    // 1.4826 MAD estimates the standard deviation of normal noise
+    double sigma = fmax(1.4826 * allied_stack_median(w, n), c->min_sigma);
+    if (c->mode == AlliedStackPercentile)
+    {
+        double width = fmax(2 * c->range * sigma / c->bins, 1.0);
+        // integer samples fall in the middle of their bin when bins are one ADU wide
+        s->lo[i] = floorf((float)(med - width * c->bins / 2)) + 0.5f;
+        s->scale[i] = (float)(1 / width);
+        VmbUint16_t *h = s->hist + i * c->bins;
+        memset(h, 0, c->bins * sizeof(VmbUint16_t));
+        VmbUint32_t outside = 0;
+        for (VmbUint32_t k = 0; k < n; k++)
+        {
+            float b = (v[k] - s->lo[i]) * s->scale[i];
+            outside += b < 0.0f || b >= (float)c->bins;
+            h[b < 0.0f ? 0 : (b >= (float)c->bins ? c->bins - 1 : (VmbUint32_t)b)]++;
+        }
+        return outside;
+    }
+    double center = med, mean = med, m2 = 0;
+    VmbUint32_t accepted = 0;
+    for (VmbUint32_t it = 0; it < c->iterations; it++)
+    {
+        double limit = c->kappa * sigma, sum = 0;
+        accepted = 0;
+        for (VmbUint32_t k = 0; k < n; k++)
+        {
+            if (fabs(v[k] - center) <= limit)
+            {
+                sum += v[k];
+                accepted++;
+            }
+        }
+        if (accepted == 0)
+        {
+            break;
+        }
+        mean = sum / accepted;
+        m2 = 0;
+        for (VmbUint32_t k = 0; k < n; k++)
+        {
+            if (fabs(v[k] - center) <= limit)
+            {
+                m2 += (v[k] - mean) * (v[k] - mean);
+            }
+        }
+        center = mean;
+        sigma = fmax(sqrt(m2 / accepted), c->min_sigma);
+    }
+    if (accepted == 0)
+    {
+        mean = med;
+        m2 = 0;
+        accepted = 1;
+    }
+    s->mean[i] = (float)mean;
+    s->m2[i] = (float)m2;
+    s->count[i] = accepted;
+    return n - accepted;
+}
+
+static void allied_stack_task(void *arg, VmbUint32_t index, VmbUint32_t count)
+{
+    AlliedStackJob_s *job = (AlliedStackJob_s *)arg;
+    struct allied_stack_s *s = job->stack;
+    const AlliedStackConfig_t *c = &(s->config);
+    VmbUint32_t width = s->geometry.width;
+    VmbUint32_t first = (VmbUint32_t)((VmbUint64_t)s->geometry.height * index / count);
+    VmbUint32_t last = (VmbUint32_t)((VmbUint64_t)s->geometry.height * (index + 1) / count);
+    VmbUint64_t rejected = 0;
+    if (job->op == AlliedStackJobSeed)
+    {
+        float *v = (float *)malloc(2 * (size_t)s->buffered * sizeof(float));
+        if (v == NULL)
+        {
+            job->failed = true;
+            return;
+        }
+        float *w = v + s->buffered;
+        size_t frame = (size_t)width * s->geometry.height * s->pixel_size;
+        for (size_t i = (size_t)first * width; i < (size_t)last * width; i++)
+        {
+            const VmbUchar_t *p = s->seedbuf + i * s->pixel_size;
+            for (VmbUint32_t k = 0; k < s->buffered; k++, p += frame)
+            {
+                v[k] = s->pixel_size == 1 ? (float)*p : (float)*(const VmbUint16_t *)p;
+            }
+            rejected += allied_stack_seed_pixel(s, i, v, w);
+        }
+        free(v);
+    }
+    else
+    {
+        const AlliedStackKernels_s *k = stack_kernels;
+        int container = s->pixel_size == 1 ? 0 : 1;
+        float kappa2 = (float)(c->kappa * c->kappa), min_var = (float)(c->min_sigma * c->min_sigma);
+        for (VmbUint32_t y = first; y < last; y++)
+        {
+            const VmbUchar_t *src = job->src + (size_t)y * job->src_stride;
+            size_t at = (size_t)y * width;
+            if (c->mode == AlliedStackSigmaClip)
+            {
+                rejected += k->clip[container](src, s->mean + at, s->m2 + at, s->count + at, width, kappa2, min_var);
+            }
+            else
+            {
+                rejected += k->hist[container](src, s->lo + at, s->scale + at, s->hist + at * c->bins, c->bins, width);
+            }
+        }
+    }
+    job->rejected[index] = rejected;
+}
+
+/**
+ * @brief Run a stacking job across the worker pool.
+ *
+ */
+static void allied_stack_run(struct allied_stack_s *s, AlliedStackJob_s *job)
+{
+    VmbUint32_t tasks = 1;
+    if (s->config.threads > 1)
+    {
+        tasks = allied_pool_threads(s->config.threads);
+        tasks = s->geometry.height < tasks ? s->geometry.height : tasks;
+    }
+    job->stack = s;
+    allied_pool_run(tasks, &allied_stack_task, job);
+    for (VmbUint32_t i = 0; i < tasks; i++)
+    {
+        s->rejected += job->rejected[i];
+    }
+}
+
+/**
+ * @brief Seed the estimates from the buffered frames.
+ *
+ */
+static void allied_stack_seed(struct allied_stack_s *s)
+{
+    AlliedStackJob_s *job = (AlliedStackJob_s *)calloc(1, sizeof(AlliedStackJob_s));
+    if (job == NULL)
+    {
+        return;
+    }
+    job->op = AlliedStackJobSeed;
+    allied_stack_run(s, job);
+    s->seeded = !job->failed;
+    free(job);
+}
+
+VmbError_t allied_stack_add(AlliedStack_t stack, const AlliedImage_t *image)
+{
+    assert(stack);
+    assert(image);
+    if (image->width != stack->geometry.width || image->height != stack->geometry.height || image->format != stack->geometry.format)
+    {
+        return VmbErrorBadParameter;
+    }
+    size_t row = (size_t)image->width * stack->pixel_size;
+    size_t stride = image->stride == 0 ? row : image->stride;
+    if (image->data == NULL || stride < row)
+    {
+        return VmbErrorBadParameter;
+    }
+    if (stack->config.mode == AlliedStackPercentile && stack->frames >= ALLIED_STACK_MAX_COUNT)
+    {
+        return VmbErrorInvalidCall;
+    }
+    allied_dispatch_init();
+    const VmbUchar_t *src = (const VmbUchar_t *)image->data;
+    if (!stack->seeded)
+    {
+        VmbUchar_t *dst = stack->seedbuf + (size_t)stack->buffered * row * image->height;
+        for (VmbUint32_t y = 0; y < image->height; y++)
+        {
+            memcpy(dst + (size_t)y * row, src + (size_t)y * stride, row);
+        }
+        stack->buffered++;
+        stack->frames++;
+        if (stack->buffered == stack->config.seed)
+        {
+            allied_stack_seed(stack);
+            if (!stack->seeded)
+            {
+                return VmbErrorResources;
+            }
+        }
+        return VmbErrorSuccess;
+    }
+    AlliedStackJob_s job = {.op = AlliedStackJobAdd, .src = src, .src_stride = stride};
+    allied_stack_run(stack, &job);
+    stack->frames++;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_stack_add_frame(AlliedStack_t stack, const VmbFrame_t *frame)
+{
+    assert(stack);
+    assert(frame);
+    if (frame->offsetX != stack->geometry.offset_x || frame->offsetY != stack->geometry.offset_y)
+    {
+        return VmbErrorBadParameter;
+    }
+    AlliedImage_t image;
+    VmbError_t err = allied_image_from_frame(frame, &image);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    return allied_stack_add(stack, &image);
+}
+
+/**
+ * @brief Read a percentile from the histogram of a pixel.
+ *
+ */
+static float allied_stack_percentile(const struct allied_stack_s *s, size_t i, double rank)
+{
+    const VmbUint16_t *h = s->hist + i * s->config.bins;
+    double below = 0;
+    VmbUint32_t b = 0;
+    for (; b < s->config.bins - 1; b++)
+    {
+        if (below + h[b] >= rank && h[b] > 0)
+        {
+            break;
+        }
+        below += h[b];
+    }
+    double within = h[b] > 0 ? (rank - below) / h[b] : 0.5;
+    within = within < 0 ? 0 : (within > 1 ? 1 : within);
+    return s->lo[i] + (float)((b + within) / s->scale[i]);
+}
+
+VmbError_t allied_stack_result(AlliedStack_t stack, double percentile, float *dst, size_t stride)
+{
+    assert(stack);
+    assert(dst);
+    size_t row = (size_t)stack->geometry.width * sizeof(float);
+    stride = stride == 0 ? row : stride;
+    if (stride < row || !(percentile >= 0 && percentile <= 100))
+    {
+        return VmbErrorBadParameter;
+    }
+    if (stack->frames == 0)
+    {
+        return VmbErrorInvalidCall;
+    }
+    if (!stack->seeded)
+    {
+        allied_stack_seed(stack);
+        if (!stack->seeded)
+        {
+            return VmbErrorResources;
+        }
+    }
+    double rank = percentile / 100 * stack->frames;
+    for (VmbUint32_t y = 0; y < stack->geometry.height; y++)
+    {
+        float *out = (float *)((VmbUchar_t *)dst + (size_t)y * stride);
+        size_t at = (size_t)y * stack->geometry.width;
+        for (VmbUint32_t x = 0; x < stack->geometry.width; x++)
+        {
+            out[x] = stack->config.mode == AlliedStackSigmaClip ? stack->mean[at + x] : allied_stack_percentile(stack, at + x, rank);
+        }
+    }
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_stack_status(AlliedStack_t stack, AlliedStackStatus_t *status)
+{
+    assert(stack);
+    assert(status);
+    status->frames = stack->frames;
+    status->seeded = stack->seeded;
+    status->rejected = stack->rejected;
+    status->memory = stack->memory;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_stack_reset(AlliedStack_t stack)
+{
+    assert(stack);
+    stack->buffered = 0;
+    stack->seeded = false;
+    stack->frames = 0;
+    stack->rejected = 0;
+    return VmbErrorSuccess;
+}
@@ -0,0 +1,262 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_stats.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Per-frame image statistics for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details The image is walked once, in chunks of a row that stay in L1: the minimum, maximum, sums and saturated count of a chunk
+ * are taken in a loop the compiler vectorizes, and the same chunk is then histogrammed into {@link ALLIED_STATS_LANES} histograms
+ * in turn. Sub-sampled rows are gathered into a contiguous chunk first. The pass is instantiated per pixel type, bit depth and CPU
+ * level; this file is built with -O3 (see the Makefile).
+ */
+
+#include "alliedcam_histogram.h"
+#include "alliedcam_kernels.h"
+#include "alliedcam_dispatch.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+_Static_assert((ALLIED_STATS_BINS & (ALLIED_STATS_BINS - 1)) == 0, "ALLIED_STATS_BINS must be a power of two");
+
+/**
+ * @brief Sampled pixels per chunk. The 32-bit partial sums of a chunk can not overflow.
+ *
+ */
+#define ALLIED_HISTOGRAM_CHUNK 4096
+#define ALLIED_STATS_DEPTHS 5 // 8, 10, 12, 14 and 16 bits.
+
+/**
+ * @brief Running sums of a pass.
+ *
+ */
+typedef struct
+{
+    VmbUint32_t min;       // Minimum pixel value.
+    VmbUint32_t max;       // Maximum pixel value.
+    VmbUint64_t sum;       // Sum of the pixel values.
+    VmbUint64_t sumsq;     // Sum of the squared pixel values.
+    VmbUint64_t saturated; // Pixels at or above the saturation level.
+} AlliedStatsAcc_s;
+
+typedef void (*AlliedStatsPassKernel)(const AlliedImage_t *img, VmbUint32_t step_x, VmbUint32_t step_y, VmbUint32_t saturation,
+                                      VmbUint32_t shift, VmbUint32_t bins, VmbUint32_t *hist, AlliedStatsAcc_s *acc);
+
+/**
+ * @brief Instantiate the statistics pass for a pixel type and bit depth.
+ *
+ * @param NAME Suffix of the kernel name.
+ * @param TARGET Target attribute of the CPU level, or nothing.
+ * @param T Pixel container type.
+ * @param BITS Significant bits per pixel.
+ * @param SQ Type of the partial sums of squares.
+ * @param BLOCK Number of squared pixels summed in `SQ` before it is added to the 64-bit total, at most {@link ALLIED_HISTOGRAM_CHUNK}.
+ */
+#define ALLIED_STATS_PASS(NAME, TARGET, T, BITS, SQ, BLOCK)                                                       \
+    TARGET static void allied_stats_pass_##NAME(const AlliedImage_t *img, VmbUint32_t step_x, VmbUint32_t step_y, \
+                                                VmbUint32_t saturation, VmbUint32_t shift, VmbUint32_t bins,      \
+                                                VmbUint32_t *hist, AlliedStatsAcc_s *acc)                         \
+    {                                                                                                             \
+        const T mask = (T)((1u << (BITS)) - 1);                                                                   \
+        VmbUint32_t *h0 = hist, *h1 = hist + bins, *h2 = hist + 2 * bins, *h3 = hist + 3 * bins;                  \
+        T buf[ALLIED_HISTOGRAM_CHUNK];                                                                            \
+        T lo = (T)~(T)0, hi = 0;                                                                                  \
+        VmbUint64_t sum = 0, sumsq = 0, sat = 0;                                                                  \
+        VmbUint32_t samples = (img->width + step_x - 1) / step_x;                                                 \
+        for (VmbUint32_t y = 0; y < img->height; y += step_y)                                                     \
+        {                                                                                                         \
+            const T *row = ALLIED_IMAGE_ROW(const T, img, y);                                                     \
+            for (VmbUint32_t x0 = 0; x0 < samples; x0 += ALLIED_HISTOGRAM_CHUNK)                                  \
+            {                                                                                                     \
+                size_t n = samples - x0 < ALLIED_HISTOGRAM_CHUNK ? samples - x0 : ALLIED_HISTOGRAM_CHUNK;         \
+                const T *px = row + x0;                                                                           \
+                if (step_x > 1)                                                                                   \
+                {                                                                                                 \
+                    const T *s = row + (size_t)x0 * step_x;                                                       \
+                    for (size_t i = 0; i < n; i++)                                                                \
+                    {                                                                                             \
+                        buf[i] = s[i * step_x];                                                                   \
+                    }                                                                                             \
+                    px = buf;                                                                                     \
+                }                                                                                                 \
+                for (size_t b = 0; b < n; b += (BLOCK))                                                           \
+                {                                                                                                 \
+                    size_t e = n - b < (BLOCK) ? n : b + (BLOCK);                                                 \
+                    T clo = lo, chi = hi;                                                                         \
+                    VmbUint32_t s = 0, c = 0;                                                                     \
+                    SQ q = 0;                                                                                     \
+                    for (size_t i = b; i < e; i++)                                                                \
+                    {                                                                                             \
+                        T v = px[i];                                                                              \
+                        clo = v < clo ? v : clo;                                                                  \
+                        chi = v > chi ? v : chi;                                                                  \
+                        s += v;                                                                                   \
+                        q += (SQ)v * v;                                                                           \
+                        c += v >= saturation;                                                                     \
+                    }                                                                                             \
+                    lo = clo;                                                                                     \
+                    hi = chi;                                                                                     \
+                    sum += s;                                                                                     \
+                    sumsq += q;                                                                                   \
+                    sat += c;                                                                                     \
+                }                                                                                                 \
+                size_t i = 0;                                                                                     \
+                for (; i + 4 <= n; i += 4)                                                                        \
+                {                                                                                                 \
+                    h0[(px[i] & mask) >> shift]++;                                                                \
+                    h1[(px[i + 1] & mask) >> shift]++;                                                            \
+                    h2[(px[i + 2] & mask) >> shift]++;                                                            \
+                    h3[(px[i + 3] & mask) >> shift]++;                                                            \
+                }                                                                                                 \
+                for (; i < n; i++)                                                                                \
+                {                                                                                                 \
+                    h0[(px[i] & mask) >> shift]++;                                                                \
+                }                                                                                                 \
+            }                                                                                                     \
+        }                                                                                                         \
+        acc->min = lo;                                                                                            \
+        acc->max = hi;                                                                                            \
+        acc->sum = sum;                                                                                           \
+        acc->sumsq = sumsq;                                                                                       \
+        acc->saturated = sat;                                                                                     \
+    }
+
+#define ALLIED_STATS_LEVEL(LEVEL, TARGET)                                                       \
+    ALLIED_STATS_PASS(8_##LEVEL, TARGET, VmbUint8_t, 8, VmbUint32_t, ALLIED_HISTOGRAM_CHUNK)    \
+    ALLIED_STATS_PASS(10_##LEVEL, TARGET, VmbUint16_t, 10, VmbUint32_t, ALLIED_HISTOGRAM_CHUNK) \
+    ALLIED_STATS_PASS(12_##LEVEL, TARGET, VmbUint16_t, 12, VmbUint32_t, 256)                    \
+    ALLIED_STATS_PASS(14_##LEVEL, TARGET, VmbUint16_t, 14, VmbUint64_t, ALLIED_HISTOGRAM_CHUNK) \
+    ALLIED_STATS_PASS(16_##LEVEL, TARGET, VmbUint16_t, 16, VmbUint64_t, ALLIED_HISTOGRAM_CHUNK) \
+    static const AlliedStatsPassKernel stats_##LEVEL[ALLIED_STATS_DEPTHS] = {                   \
+        &allied_stats_pass_8_##LEVEL,                                                           \
+        &allied_stats_pass_10_##LEVEL,                                                          \
+        &allied_stats_pass_12_##LEVEL,                                                          \
+        &allied_stats_pass_14_##LEVEL,                                                          \
+        &allied_stats_pass_16_##LEVEL,                                                          \
+    };
+
+ALLIED_KERNEL_LEVELS(ALLIED_STATS_LEVEL)
+
+static const AlliedStatsPassKernel *stats_table = stats_scalar;
+
+ALLIED_KERNEL_BINDER(allied_stats_bind, stats_table, stats)
+
+VmbError_t allied_stats_run(const AlliedImage_t *image, const AlliedStatsConfig_t *config, AlliedFrameStats_t *stats, VmbUint32_t *scratch)
+{
+    const AlliedImageKernels_s *kernels = allied_image_kernels(image->format);
+    if (kernels == NULL)
+    {
+        return VmbErrorNotSupported;
+    }
+    size_t row = (size_t)image->width * kernels->pixel_size;
+    size_t stride = image->stride == 0 ? row : image->stride;
+    if (image->data == NULL || stride < row || config->num_percentiles > ALLIED_STATS_PERCENTILES)
+    {
+        return VmbErrorBadParameter;
+    }
+    VmbUint32_t x = 0, y = 0, width = image->width, height = image->height;
+    if (config->roi_width != 0 && config->roi_height != 0)
+    {
+        if (config->roi_x > image->width || config->roi_width > image->width - config->roi_x ||
+            config->roi_y > image->height || config->roi_height > image->height - config->roi_y)
+        {
+            return VmbErrorInvalidValue;
+        }
+        x = config->roi_x;
+        y = config->roi_y;
+        width = config->roi_width;
+        height = config->roi_height;
+    }
+    VmbUint32_t step_x = config->step_x > 0 ? config->step_x : ALLIED_STATS_STEP;
+    VmbUint32_t step_y = config->step_y > 0 ? config->step_y : ALLIED_STATS_STEP;
+    AlliedImage_t roi = {
+        .data = (VmbUchar_t *)image->data + (size_t)y * stride + (size_t)x * kernels->pixel_size,
+        .width = width,
+        .height = height,
+        .stride = stride,
+        .format = image->format,
+    };
+    VmbUint32_t bins_bits = 0;
+    while ((1u << bins_bits) < ALLIED_STATS_BINS)
+    {
+        bins_bits++;
+    }
+    stats->frame_id = 0;
+    stats->format = image->format;
+    stats->bits = kernels->bits;
+    stats->shift = kernels->bits > bins_bits ? kernels->bits - bins_bits : 0;
+    stats->bins = 1u << (kernels->bits - stats->shift);
+    stats->count = (VmbUint64_t)((width + step_x - 1) / step_x) * ((height + step_y - 1) / step_y);
+    VmbUint32_t saturation = config->saturation != 0 ? config->saturation : (1u << kernels->bits) - 1;
+    memset(scratch, 0, sizeof(VmbUint32_t) * ALLIED_STATS_LANES * stats->bins);
+    AlliedStatsAcc_s acc = {0};
+    if (stats->count > 0)
+    {
+        VmbUint32_t depth = kernels->bits == 8 ? 0 : kernels->bits == 10 ? 1 : kernels->bits == 12 ? 2 : kernels->bits == 14 ? 3 : 4;
+        stats_table[depth](&roi, step_x, step_y, saturation, stats->shift, stats->bins, scratch, &acc);
+    }
+    for (VmbUint32_t i = 0; i < stats->bins; i++)
+    {
+        VmbUint32_t n = 0;
+        for (VmbUint32_t lane = 0; lane < ALLIED_STATS_LANES; lane++)
+        {
+            n += scratch[lane * stats->bins + i];
+        }
+        stats->histogram[i] = n;
+    }
+    stats->min = acc.min;
+    stats->max = acc.max;
+    stats->saturated = acc.saturated;
+    stats->mean = stats->count > 0 ? (double)acc.sum / stats->count : 0;
+    double var = stats->count > 0 ? (double)acc.sumsq / stats->count - stats->mean * stats->mean : 0;
+    stats->stddev = var > 0 ? sqrt(var) : 0;
+    stats->num_percentiles = config->num_percentiles;
+    for (VmbUint32_t i = 0; i < config->num_percentiles; i++)
+    {
+        stats->percentiles[i] = allied_stats_percentile(stats, config->percentiles[i]);
+    }
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_stats_compute(const AlliedImage_t *image, const AlliedStatsConfig_t *config, AlliedFrameStats_t *stats)
+{
+    assert(image);
+    assert(stats);
+    const AlliedStatsConfig_t defaults = {0};
+    VmbUint32_t *scratch = malloc(sizeof(VmbUint32_t) * ALLIED_STATS_SCRATCH);
+    if (scratch == NULL)
+    {
+        return VmbErrorResources;
+    }
+    VmbError_t err = allied_stats_run(image, config != NULL ? config : &defaults, stats, scratch);
+    free(scratch);
+    return err;
+}
+
+VmbUint32_t allied_stats_percentile(const AlliedFrameStats_t *stats, double percentile)
+{
+    assert(stats);
+    if (stats->count == 0)
+    {
+        return 0;
+    }
+    percentile = percentile < 0 ? 0 : percentile > 100 ? 100 : percentile;
+    VmbUint64_t rank = (VmbUint64_t)ceil(percentile / 100.0 * stats->count);
+    rank = rank > 0 ? rank : 1;
+    VmbUint64_t seen = 0;
+    for (VmbUint32_t i = 0; i < stats->bins; i++)
+    {
+        seen += stats->histogram[i];
+        if (seen >= rank)
+        {
+            return i << stats->shift;
+        }
+    }
+    return (stats->bins - 1) << stats->shift;
+}
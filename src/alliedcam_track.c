@@ -0,0 +1,545 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_track.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Spot finding for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @details The row kernels count the pixels above the threshold, and sum the weights and first moments of a row, in integers, so that the
+ * loops vectorize (this file is built with -O3, see the Makefile). They are instantiated per source container and CPU level.
+ *
+ * Connected components are labelled in one pass over the rows: every run of pixels above the threshold carries its moments, and is merged
+ * with the runs of the previous row that it touches. Runs are merged into the run with the lowest index, so that the roots are found in
+ * row order, and the moments are gathered into the roots once the region is done. The tracking stage that drives the camera offsets lives
+ * with the other frame stages in alliedcam.c.
+ */
+
+#include "alliedcam_track.h"
+#include "alliedcam_kernels.h"
+#include "alliedcam_dispatch.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+/**
+ * @brief Center of mass iterations of a window, each moving the window to the last centroid.
+ *
+ */
+#define ALLIED_SPOT_ITERATIONS 3
+
+/**
+ * @brief Distance within which two followed spots are the same spot, in pixels.
+ *
+ */
+#define ALLIED_SPOT_MERGE 1.0
+
+/**
+ * @brief Run of pixels above the threshold in a row, with the moments of its component.
+ *
+ */
+typedef struct
+{
+    VmbUint32_t x0;     // First pixel.
+    VmbUint32_t x1;     // Last pixel.
+    VmbUint32_t parent; // Run the run is merged into, itself for a root.
+    VmbUint32_t pixels; // Pixels above the threshold.
+    VmbUint32_t peak;   // Highest value.
+    VmbUint64_t s0;     // Sum of the weights.
+    VmbUint64_t sx;     // Sum of the weights times the column.
+    VmbUint64_t sy;     // Sum of the weights times the row.
+} AlliedSpotRun_s;
+
+struct allied_spot_finder_s
+{
+    AlliedSpotConfig_t config; // Configuration, with the defaults resolved.
+    AlliedSpotRun_s *runs;     // Runs of the region.
+    size_t nruns;              // Capacity of the runs.
+    AlliedSpot_t *found;       // Components of the region.
+    size_t nfound;             // Capacity of the components.
+    AlliedSpot_t *tracked;     // Spots followed by the windowed center of mass.
+    VmbUint32_t ntracked;      // Spots followed.
+    VmbUint32_t ctracked;      // Capacity of the followed spots.
+    VmbUint32_t acquired;      // Threshold the followed spots were acquired with.
+};
+
+typedef VmbUint32_t (*AlliedSpotCountKernel)(const void *row, VmbUint32_t width, VmbUint32_t threshold);
+typedef void (*AlliedSpotMomentKernel)(const void *row, VmbUint32_t width, VmbUint32_t threshold, VmbUint64_t *sums);
+
+/**
+ * @brief Spot finding kernels of a CPU level.
+ *
+ */
+typedef struct
+{
+    AlliedSpotCountKernel count[2];    // Pixels of a row above the threshold, by source container (8, 16 bits).
+    AlliedSpotMomentKernel moments[2]; // Adds the sum of the weights, of the weights times the column, and the pixels above the threshold of a row.
+} AlliedSpotKernels_s;
+
+/**
+ * @brief Instantiate the spot finding kernels of a source container.
+ *
+ * @param NAME Suffix of the kernel names.
+ * @param TARGET Target attribute of the CPU level, or nothing.
+ * @param TS Source container type.
+ */
+#define ALLIED_SPOT_KERNELS(NAME, TARGET, TS)                                                                                   \
+    TARGET static VmbUint32_t allied_spot_count_##NAME(const void *row, VmbUint32_t width, VmbUint32_t threshold)               \
+    {                                                                                                                           \
+        const TS *restrict s = (const TS *)row;                                                                                 \
+        VmbUint32_t n = 0;                                                                                                      \
+        for (size_t x = 0; x < width; x++)                                                                                      \
+        {                                                                                                                       \
+            n += (VmbUint32_t)s[x] > threshold;                                                                                 \
+        }                                                                                                                       \
+        return n;                                                                                                               \
+    }                                                                                                                           \
+    TARGET static void allied_spot_moments_##NAME(const void *row, VmbUint32_t width, VmbUint32_t threshold, VmbUint64_t *sums) \
+    {                                                                                                                           \
+        const TS *restrict s = (const TS *)row;                                                                                 \
+        VmbUint64_t s0 = 0, sx = 0, n = 0;                                                                                      \
+        for (size_t x = 0; x < width; x++)                                                                                      \
+        {                                                                                                                       \
+            VmbUint32_t v = s[x];                                                                                               \
+            VmbUint32_t w = v > threshold ? v - threshold : 0;                                                                  \
+            s0 += w;                                                                                                            \
+            sx += (VmbUint64_t)w * x;                                                                                           \
+            n += v > threshold;                                                                                                 \
+        }                                                                                                                       \
+        sums[0] += s0;                                                                                                          \
+        sums[1] += sx;                                                                                                          \
+        sums[2] += n;                                                                                                           \
+    }
+
+#define ALLIED_SPOT_LEVEL(LEVEL, TARGET)                                                   \
+    ALLIED_SPOT_KERNELS(8_##LEVEL, TARGET, VmbUint8_t)                                     \
+    ALLIED_SPOT_KERNELS(16_##LEVEL, TARGET, VmbUint16_t)                                   \
+    static const AlliedSpotKernels_s spot_##LEVEL = {                                      \
+        .count = {&allied_spot_count_8_##LEVEL, &allied_spot_count_16_##LEVEL},            \
+        .moments = {&allied_spot_moments_8_##LEVEL, &allied_spot_moments_16_##LEVEL},      \
+    };
+
+ALLIED_KERNEL_LEVELS(ALLIED_SPOT_LEVEL)
+
+static const AlliedSpotKernels_s *spot_kernels = &spot_scalar;
+
+ALLIED_KERNEL_BINDER(allied_track_bind, spot_kernels, &spot)
+
+VmbError_t allied_spot_finder_create(AlliedSpotFinder_t *finder, const AlliedSpotConfig_t *config)
+{
+    assert(finder);
+    *finder = NULL;
+    AlliedSpotConfig_t c = {0};
+    if (config != NULL)
+    {
+        c = *config;
+    }
+    if (c.method > AlliedSpotWindow || !(c.threshold >= 0) || !(c.sigma >= 0))
+    {
+        return VmbErrorBadParameter;
+    }
+    c.sigma = c.sigma == 0 ? 5 : c.sigma;
+    c.min_pixels = c.min_pixels == 0 ? 3 : c.min_pixels;
+    c.window = c.window == 0 ? 16 : c.window;
+    struct allied_spot_finder_s *f = (struct allied_spot_finder_s *)calloc(1, sizeof(struct allied_spot_finder_s));
+    if (f == NULL)
+    {
+        return VmbErrorResources;
+    }
+    f->config = c;
+    *finder = f;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_spot_finder_destroy(AlliedSpotFinder_t *finder)
+{
+    assert(finder);
+    if (*finder == NULL)
+    {
+        return VmbErrorSuccess;
+    }
+    free((*finder)->runs);
+    free((*finder)->found);
+    free((*finder)->tracked);
+    free(*finder);
+    *finder = NULL;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_spot_finder_reset(AlliedSpotFinder_t finder)
+{
+    assert(finder);
+    finder->ntracked = 0;
+    return VmbErrorSuccess;
+}
+
+/**
+ * @brief Grow an array to hold at least `count` elements.
+ *
+ */
+static VmbError_t allied_spot_reserve(void **array, size_t *capacity, size_t count, size_t size)
+{
+    if (count <= *capacity)
+    {
+        return VmbErrorSuccess;
+    }
+    size_t n = *capacity < 64 ? 64 : *capacity;
+    while (n < count)
+    {
+        n *= 2;
+    }
+    void *grown = realloc(*array, n * size);
+    if (grown == NULL)
+    {
+        return VmbErrorResources;
+    }
+    *array = grown;
+    *capacity = n;
+    return VmbErrorSuccess;
+}
+
+static VmbUint32_t allied_spot_root(AlliedSpotRun_s *runs, VmbUint32_t i)
+{
+    while (runs[i].parent != i)
+    {
+        runs[i].parent = runs[runs[i].parent].parent; // path halving
+        i = runs[i].parent;
+    }
+    return i;
+}
+
+static void allied_spot_union(AlliedSpotRun_s *runs, VmbUint32_t a, VmbUint32_t b)
+{
+    a = allied_spot_root(runs, a);
+    b = allied_spot_root(runs, b);
+    if (a < b)
+    {
+        runs[b].parent = a;
+    }
+    else if (b < a)
+    {
+        runs[a].parent = b;
+    }
+}
+
+static int allied_spot_compare(const void *a, const void *b)
+{
+    double fa = ((const AlliedSpot_t *)a)->flux;
+    double fb = ((const AlliedSpot_t *)b)->flux;
+    return fa < fb ? 1 : (fa > fb ? -1 : 0);
+}
+
+/**
+ * @brief Image region, resolved against an image.
+ *
+ */
+typedef struct
+{
+    const AlliedImageKernels_s *kernels; // Kernels of the pixel format.
+    const VmbUchar_t *data;              // First pixel of the image.
+    size_t stride;                       // Bytes between rows.
+    VmbUint32_t x;                       // Horizontal offset of the region.
+    VmbUint32_t y;                       // Vertical offset of the region.
+    VmbUint32_t width;                   // Width of the region.
+    VmbUint32_t height;                  // Height of the region.
+} AlliedSpotRegion_s;
+
+static inline VmbUint32_t allied_spot_pixel(const AlliedSpotRegion_s *r, const VmbUchar_t *row, VmbUint32_t x)
+{
+    return r->kernels->pixel_size == 1 ? row[x] : ((const VmbUint16_t *)row)[x];
+}
+
+/**
+ * @brief Statistics of a part of a region.
+ *
+ */
+static VmbError_t allied_spot_stats(const AlliedSpotRegion_s *r, VmbUint32_t x, VmbUint32_t y, VmbUint32_t width, VmbUint32_t height, AlliedImageStats_t *stats)
+{
+    AlliedImage_t part = {
+        .data = (void *)(r->data + (size_t)y * r->stride + (size_t)x * r->kernels->pixel_size),
+        .width = width,
+        .height = height,
+        .stride = r->stride,
+        .format = r->kernels->format,
+    };
+    return allied_image_stats(&part, stats);
+}
+
+/**
+ * @brief Find the connected components of a region, brightest first.
+ *
+ */
+static VmbError_t allied_spot_components(struct allied_spot_finder_s *f, const AlliedSpotRegion_s *r, VmbUint32_t offset_x, VmbUint32_t offset_y,
+                                         AlliedSpot_t *spots, VmbUint32_t capacity, VmbUint32_t *count)
+{
+    const AlliedSpotConfig_t *c = &(f->config);
+    VmbUint32_t max = (1u << r->kernels->bits) - 1;
+    double threshold = c->threshold;
+    if (threshold == 0)
+    {
+        AlliedImageStats_t stats;
+        VmbError_t err = allied_spot_stats(r, r->x, r->y, r->width, r->height, &stats);
+        if (err != VmbErrorSuccess)
+        {
+            return err;
+        }
+        threshold = stats.mean + c->sigma * stats.stddev;
+    }
+    VmbUint32_t t = threshold >= max ? max : (VmbUint32_t)threshold;
+    f->acquired = t;
+    int container = r->kernels->pixel_size == 1 ? 0 : 1;
+    size_t n = 0;
+    size_t prev = 0; // first run of the previous row with runs
+    size_t prev_end = 0;
+    VmbUint32_t prev_y = 0;
+    for (VmbUint32_t y = 0; y < r->height; y++)
+    {
+        const VmbUchar_t *row = r->data + (size_t)(r->y + y) * r->stride + (size_t)r->x * r->kernels->pixel_size;
+        // most rows of a spot image are empty
+        if (spot_kernels->count[container](row, r->width, t) == 0)
+        {
+            continue;
+        }
+        size_t first = n;
+        for (VmbUint32_t x = 0; x < r->width; x++)
+        {
+            VmbUint32_t v = allied_spot_pixel(r, row, x);
+            if (v <= t)
+            {
+                continue;
+            }
+            if (allied_spot_reserve((void **)&(f->runs), &(f->nruns), n + 1, sizeof(AlliedSpotRun_s)) != VmbErrorSuccess)
+            {
+                return VmbErrorResources;
+            }
+            AlliedSpotRun_s *run = &(f->runs[n]);
+            memset(run, 0, sizeof(AlliedSpotRun_s));
+            run->x0 = x;
+            run->parent = (VmbUint32_t)n;
+            for (; x < r->width && (v = allied_spot_pixel(r, row, x)) > t; x++)
+            {
+                VmbUint64_t w = v - t;
+                run->s0 += w;
+                run->sx += w * x;
+                run->peak = v > run->peak ? v : run->peak;
+                run->pixels++;
+            }
+            run->x1 = x - 1;
+            run->sy = run->s0 * y;
+            n++;
+        }
+        // merge with the touching runs of the previous row, both sorted by column
+        if (prev_end > prev && prev_y + 1 == y)
+        {
+            size_t p = prev;
+            for (size_t i = first; i < n; i++)
+            {
+                while (p < prev_end && f->runs[p].x1 + 1 < f->runs[i].x0)
+                {
+                    p++;
+                }
+                for (size_t q = p; q < prev_end && f->runs[q].x0 <= f->runs[i].x1 + 1; q++)
+                {
+                    allied_spot_union(f->runs, (VmbUint32_t)i, (VmbUint32_t)q);
+                }
+            }
+        }
+        prev = first;
+        prev_end = n;
+        prev_y = y;
+    }
+    // gather the moments into the roots, which precede their runs
+    size_t found = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        AlliedSpotRun_s *run = &(f->runs[i]);
+        VmbUint32_t root = allied_spot_root(f->runs, (VmbUint32_t)i);
+        if (root == i)
+        {
+            found++;
+            continue;
+        }
+        AlliedSpotRun_s *to = &(f->runs[root]);
+        to->s0 += run->s0;
+        to->sx += run->sx;
+        to->sy += run->sy;
+        to->pixels += run->pixels;
+        to->peak = run->peak > to->peak ? run->peak : to->peak;
+    }
+    if (allied_spot_reserve((void **)&(f->found), &(f->nfound), found, sizeof(AlliedSpot_t)) != VmbErrorSuccess)
+    {
+        return VmbErrorResources;
+    }
+    found = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        const AlliedSpotRun_s *run = &(f->runs[i]);
+        if (run->parent != i || run->pixels < c->min_pixels)
+        {
+            continue;
+        }
+        AlliedSpot_t *s = &(f->found[found++]);
+        s->x = (double)run->sx / (double)run->s0 + r->x + offset_x;
+        s->y = (double)run->sy / (double)run->s0 + r->y + offset_y;
+        s->flux = (double)run->s0;
+        s->peak = run->peak;
+        s->pixels = run->pixels;
+    }
+    if (found == 0)
+    {
+        return VmbErrorSuccess;
+    }
+    qsort(f->found, found, sizeof(AlliedSpot_t), &allied_spot_compare);
+    *count = found < capacity ? (VmbUint32_t)found : capacity;
+    memcpy(spots, f->found, *count * sizeof(AlliedSpot_t));
+    return VmbErrorSuccess;
+}
+
+/**
+ * @brief Place a window of `size` pixels centered on `center` inside `[0, extent)`.
+ *
+ */
+static void allied_spot_place(double center, VmbUint32_t size, VmbUint32_t extent, VmbUint32_t *first, VmbUint32_t *length)
+{
+    *length = size < extent ? size : extent;
+    double start = floor(center - (*length - 1) / 2.0 + 0.5);
+    start = start < 0 ? 0 : start;
+    start = start > extent - *length ? extent - *length : start;
+    *first = (VmbUint32_t)start;
+}
+
+/**
+ * @brief Follow a spot with the windowed center of mass. Positions are relative to the region.
+ *
+ * @return bool The spot was found in its window, i.e. the window holds a pixel above the threshold the spots were acquired with.
+ */
+static bool allied_spot_follow(const struct allied_spot_finder_s *f, const AlliedSpotRegion_s *r, double *x, double *y, AlliedSpot_t *spot)
+{
+    const AlliedSpotConfig_t *c = &(f->config);
+    int container = r->kernels->pixel_size == 1 ? 0 : 1;
+    VmbUint32_t max = (1u << r->kernels->bits) - 1;
+    for (int i = 0; i < ALLIED_SPOT_ITERATIONS; i++)
+    {
+        VmbUint32_t x0, y0, w, h;
+        allied_spot_place(*x, c->window, r->width, &x0, &w);
+        allied_spot_place(*y, c->window, r->height, &y0, &h);
+        AlliedImageStats_t stats;
+        if (allied_spot_stats(r, r->x + x0, r->y + y0, w, h, &stats) != VmbErrorSuccess || stats.max <= f->acquired)
+        {
+            return false;
+        }
+        double threshold = c->threshold == 0 ? stats.mean + 0.5 * (stats.max - stats.mean) : c->threshold;
+        VmbUint32_t t = threshold >= max ? max : (VmbUint32_t)threshold;
+        VmbUint64_t s0 = 0, sx = 0, sy = 0, pixels = 0;
+        for (VmbUint32_t yy = 0; yy < h; yy++)
+        {
+            const VmbUchar_t *row = r->data + (size_t)(r->y + y0 + yy) * r->stride + (size_t)(r->x + x0) * r->kernels->pixel_size;
+            VmbUint64_t sums[3] = {0};
+            spot_kernels->moments[container](row, w, t, sums);
+            s0 += sums[0];
+            sx += sums[1];
+            sy += sums[0] * yy;
+            pixels += sums[2];
+        }
+        if (s0 == 0 || pixels < c->min_pixels)
+        {
+            return false;
+        }
+        double nx = (double)sx / (double)s0 + x0;
+        double ny = (double)sy / (double)s0 + y0;
+        bool settled = fabs(nx - *x) < 0.5 && fabs(ny - *y) < 0.5;
+        *x = nx;
+        *y = ny;
+        spot->flux = (double)s0;
+        spot->peak = stats.max;
+        spot->pixels = (VmbUint32_t)pixels;
+        if (settled)
+        {
+            break;
+        }
+    }
+    return true;
+}
+
+VmbError_t allied_spot_find(AlliedSpotFinder_t finder, const AlliedImage_t *image, VmbUint32_t offset_x, VmbUint32_t offset_y,
+                            AlliedSpot_t *spots, VmbUint32_t capacity, VmbUint32_t *count)
+{
+    assert(finder);
+    assert(image);
+    assert(spots);
+    assert(count);
+    *count = 0;
+    const AlliedSpotConfig_t *c = &(finder->config);
+    AlliedSpotRegion_s r = {.kernels = allied_image_kernels(image->format), .data = (const VmbUchar_t *)image->data, .x = c->x, .y = c->y};
+    if (r.kernels == NULL)
+    {
+        return VmbErrorNotSupported;
+    }
+    size_t row = (size_t)image->width * r.kernels->pixel_size;
+    r.stride = image->stride == 0 ? row : image->stride;
+    if (r.data == NULL || r.stride < row || c->x >= image->width || c->y >= image->height)
+    {
+        return VmbErrorBadParameter;
+    }
+    r.width = c->width == 0 ? image->width - c->x : c->width;
+    r.height = c->height == 0 ? image->height - c->y : c->height;
+    if (r.width > image->width - c->x || r.height > image->height - c->y)
+    {
+        return VmbErrorBadParameter;
+    }
+    if (capacity == 0)
+    {
+        return VmbErrorSuccess;
+    }
+    allied_dispatch_init();
+    VmbError_t err = VmbErrorSuccess;
+    if (c->method == AlliedSpotWindow && finder->ntracked > 0)
+    {
+        VmbUint32_t n = 0;
+        VmbUint32_t follow = finder->ntracked < capacity ? finder->ntracked : capacity;
+        for (VmbUint32_t i = 0; i < follow; i++)
+        {
+            AlliedSpot_t spot = {0};
+            double x = finder->tracked[i].x - offset_x - r.x;
+            double y = finder->tracked[i].y - offset_y - r.y;
+            if (!allied_spot_follow(finder, &r, &x, &y, &spot))
+            {
+                continue;
+            }
+            spot.x = x + r.x + offset_x;
+            spot.y = y + r.y + offset_y;
+            // spots that ran into each other are followed once
+            bool merged = false;
+            for (VmbUint32_t j = 0; j < n && !merged; j++)
+            {
+                merged = fabs(spots[j].x - spot.x) < ALLIED_SPOT_MERGE && fabs(spots[j].y - spot.y) < ALLIED_SPOT_MERGE;
+            }
+            if (!merged)
+            {
+                spots[n++] = spot;
+            }
+        }
+        qsort(spots, n, sizeof(AlliedSpot_t), &allied_spot_compare);
+        *count = n;
+    }
+    if (*count == 0)
+    {
+        err = allied_spot_components(finder, &r, offset_x, offset_y, spots, capacity, count);
+    }
+    if (err == VmbErrorSuccess && c->method == AlliedSpotWindow)
+    {
+        size_t ctracked = finder->ctracked;
+        err = allied_spot_reserve((void **)&(finder->tracked), &ctracked, *count, sizeof(AlliedSpot_t));
+        finder->ctracked = (VmbUint32_t)ctracked;
+        if (err == VmbErrorSuccess && *count > 0)
+        {
+            memcpy(finder->tracked, spots, *count * sizeof(AlliedSpot_t));
+        }
+        finder->ntracked = err == VmbErrorSuccess ? *count : 0;
+    }
+    return err;
+}
@@ -0,0 +1,408 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_transform.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Pixel format conversion with VmbImageTransform for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "alliedcam_transform.h"
+#include "alliedcam_pool.h"
+#include "alliedcam_frame.h"
+#include <VmbImageTransform/VmbTransform.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+
+/**
+ * @brief Rows of overlap between the bands of a Bayer image for `VmbDebayerMode2x2` and `VmbDebayerMode3x3`.
+ * Enough to make the banded conversion identical to a single-threaded one.
+ *
+ */
+#define ALLIED_TRANSFORM_HALO_SMALL 2
+
+/**
+ * @brief Rows of overlap between the bands of a Bayer image for the other debayering modes.
+ *
+ */
+#define ALLIED_TRANSFORM_HALO_LARGE 8
+
+typedef struct
+{
+    bool valid;               // Plan is built.
+    VmbPixelFormat_t format;  // Input pixel format.
+    VmbUint32_t width;        // Input width.
+    VmbUint32_t height;       // Input height.
+    VmbImage src;             // Input descriptor, without data.
+    VmbImage dst;             // Output descriptor, without data.
+    VmbTransformInfo info[3]; // Debayering, color matrix and gamma parameters.
+    VmbUint32_t info_count;   // Number of parameters in use.
+    size_t src_size;          // Input size in bytes.
+    size_t dst_size;          // Output size in bytes.
+    size_t src_row;           // Bytes per input row. 0 if rows do not end on byte boundaries, and the image cannot be split.
+    size_t dst_row;           // Bytes per output row, 0 if rows do not end on byte boundaries.
+    VmbUint32_t halo;         // Rows of overlap between bands.
+    VmbUint64_t used;         // Last use, for replacement.
+} AlliedTransformPlan_s;
+
+typedef struct
+{
+    VmbUchar_t *data; // Buffer memory.
+    size_t capacity;  // Size of the buffer memory.
+    bool held;        // Buffer is held by the application.
+} AlliedTransformBuffer_s;
+
+struct allied_transform_s
+{
+    AlliedTransformOptions_t opts;                       // Transform options.
+    pthread_mutex_t lock;                                // Serializes conversions.
+    AlliedTransformPlan_s plans[ALLIED_TRANSFORM_PLANS]; // Plan cache.
+    VmbUint64_t clock;                                   // Plan use counter.
+    VmbUint64_t built;                                   // Number of plans built.
+    AlliedTransformBuffer_s *buffers;                    // Output buffers.
+    VmbUint32_t num_buffers;                             // Number of output buffers.
+    VmbUchar_t *scratch[ALLIED_POOL_MAX_THREADS];        // Per-thread band memory for overlapping bands.
+    size_t scratch_size[ALLIED_POOL_MAX_THREADS];        // Size of every scratch buffer.
+};
+
+typedef struct
+{
+    const AlliedTransformPlan_s *plan;       // Plan.
+    const VmbUchar_t *src;                   // Input image data.
+    VmbUchar_t *dst;                         // Output image data.
+    VmbUchar_t *const *scratch;              // Per-thread band memory.
+    VmbUint32_t bands;                       // Number of bands.
+    VmbError_t err[ALLIED_POOL_MAX_THREADS]; // Result of every task.
+} AlliedTransformJob_s;
+
+static VmbError_t allied_transform_rows(const AlliedTransformPlan_s *plan, const VmbUchar_t *src, VmbUchar_t *dst, VmbUint32_t rows)
+{
+    VmbImage in = plan->src;
+    VmbImage out = plan->dst;
+    in.Data = (void *)src;
+    out.Data = dst;
+    in.ImageInfo.Height = rows;
+    out.ImageInfo.Height = rows;
+    return VmbImageTransform(&in, &out, plan->info, plan->info_count);
+}
+
+static void allied_transform_task(void *arg, VmbUint32_t index, VmbUint32_t count)
+{
+    AlliedTransformJob_s *job = (AlliedTransformJob_s *)arg;
+    const AlliedTransformPlan_s *plan = job->plan;
+    VmbError_t err = VmbErrorSuccess;
+    for (VmbUint32_t b = job->bands * index / count; b < job->bands * (index + 1) / count && err == VmbErrorSuccess; b++)
+    {
+        VmbUint32_t y0 = b * ALLIED_TRANSFORM_BAND_ROWS;
+        VmbUint32_t y1 = y0 + ALLIED_TRANSFORM_BAND_ROWS < plan->height ? y0 + ALLIED_TRANSFORM_BAND_ROWS : plan->height;
+        if (plan->halo == 0)
+        {
+            err = allied_transform_rows(plan, job->src + y0 * plan->src_row, job->dst + y0 * plan->dst_row, y1 - y0);
+            continue;
+        }
+        // convert the band with its halo in scratch memory, and keep the inner rows
+        VmbUint32_t h0 = y0 > plan->halo ? y0 - plan->halo : 0;
+        VmbUint32_t h1 = y1 + plan->halo < plan->height ? y1 + plan->halo : plan->height;
+        err = allied_transform_rows(plan, job->src + h0 * plan->src_row, job->scratch[index], h1 - h0);
+        if (err == VmbErrorSuccess)
+        {
+            memcpy(job->dst + y0 * plan->dst_row, job->scratch[index] + (y0 - h0) * plan->dst_row, (y1 - y0) * plan->dst_row);
+        }
+    }
+    job->err[index] = err;
+}
+
+static bool allied_transform_bayer(const VmbImage *image)
+{
+    VmbPixelLayout_t layout = image->ImageInfo.PixelInfo.PixelLayout;
+    return layout == VmbPixelLayoutRaw || layout == VmbPixelLayoutRawPacked;
+}
+
+static VmbError_t allied_transform_build(AlliedTransform_t transform, AlliedTransformPlan_s *plan, VmbPixelFormat_t format, VmbUint32_t width, VmbUint32_t height)
+{
+    const AlliedTransformOptions_t *opts = &transform->opts;
+    memset(plan, 0, sizeof(*plan));
+    plan->src.Size = sizeof(VmbImage);
+    plan->dst.Size = sizeof(VmbImage);
+    VmbError_t err = VmbSetImageInfoFromPixelFormat(format, width, height, &plan->src);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    err = VmbSetImageInfoFromPixelFormat(opts->format, width, height, &plan->dst);
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    bool bayer = allied_transform_bayer(&plan->src);
+    if (bayer)
+    {
+        err = VmbSetDebayerMode(opts->debayer, &plan->info[plan->info_count++]);
+    }
+    if (err == VmbErrorSuccess && opts->color_matrix)
+    {
+        err = VmbSetColorCorrectionMatrix3x3(opts->matrix, &plan->info[plan->info_count++]);
+    }
+    if (err == VmbErrorSuccess && opts->gamma > 0)
+    {
+        err = VmbSetGammaCorrection(opts->gamma, &plan->info[plan->info_count++]);
+    }
+    if (err != VmbErrorSuccess)
+    {
+        return err;
+    }
+    VmbUint64_t src_bits = (VmbUint64_t)width * allied_format_bits(format);
+    VmbUint64_t dst_bits = (VmbUint64_t)width * allied_format_bits(opts->format);
+    plan->src_size = (size_t)((src_bits * height + 7) / 8);
+    plan->dst_size = (size_t)((dst_bits * height + 7) / 8);
+    if (src_bits % 8 == 0 && dst_bits % 8 == 0)
+    {
+        plan->src_row = (size_t)(src_bits / 8);
+        plan->dst_row = (size_t)(dst_bits / 8);
+    }
+    if (bayer)
+    {
+        bool small = opts->debayer == VmbDebayerMode2x2 || opts->debayer == VmbDebayerMode3x3;
+        plan->halo = small ? ALLIED_TRANSFORM_HALO_SMALL : ALLIED_TRANSFORM_HALO_LARGE;
+    }
+    plan->format = format;
+    plan->width = width;
+    plan->height = height;
+    plan->valid = true;
+    transform->built++;
+    return VmbErrorSuccess;
+}
+
+/**
+ * @brief Find the plan for a format and size, and build it in place of the least recently used plan if it is not cached.
+ *
+ */
+static VmbError_t allied_transform_lookup(AlliedTransform_t transform, VmbPixelFormat_t format, VmbUint32_t width, VmbUint32_t height, AlliedTransformPlan_s **plan)
+{
+    AlliedTransformPlan_s *victim = &transform->plans[0];
+    for (int i = 0; i < ALLIED_TRANSFORM_PLANS; i++)
+    {
+        AlliedTransformPlan_s *p = &transform->plans[i];
+        if (p->valid && p->format == format && p->width == width && p->height == height)
+        {
+            p->used = ++transform->clock;
+            *plan = p;
+            return VmbErrorSuccess;
+        }
+        if (!p->valid || (victim->valid && p->used < victim->used))
+        {
+            victim = p;
+        }
+    }
+    VmbError_t err = allied_transform_build(transform, victim, format, width, height);
+    if (err != VmbErrorSuccess)
+    {
+        victim->valid = false;
+        return err;
+    }
+    victim->used = ++transform->clock;
+    *plan = victim;
+    return VmbErrorSuccess;
+}
+
+static VmbError_t allied_transform_reserve(VmbUchar_t **data, size_t *capacity, size_t size)
+{
+    if (*capacity >= size)
+    {
+        return VmbErrorSuccess;
+    }
+    size = (size + 63) & ~(size_t)63;
+    VmbUchar_t *mem = aligned_alloc(64, size);
+    if (mem == NULL)
+    {
+        return VmbErrorResources;
+    }
+    free(*data);
+    *data = mem;
+    *capacity = size;
+    return VmbErrorSuccess;
+}
+
+static VmbError_t allied_transform_run(AlliedTransform_t transform, const AlliedTransformPlan_s *plan, const VmbUchar_t *src, VmbUchar_t *dst)
+{
+    VmbUint32_t bands = (plan->height + ALLIED_TRANSFORM_BAND_ROWS - 1) / ALLIED_TRANSFORM_BAND_ROWS;
+    VmbUint32_t threads = 1;
+    if (transform->opts.threads > 1 && plan->src_row != 0 && plan->dst_row != 0)
+    {
+        threads = allied_pool_threads(transform->opts.threads);
+        threads = bands < threads ? bands : threads;
+    }
+    if (threads <= 1)
+    {
+        return allied_transform_rows(plan, src, dst, plan->height);
+    }
+    if (plan->halo > 0)
+    {
+        size_t size = (ALLIED_TRANSFORM_BAND_ROWS + 2 * plan->halo) * plan->dst_row;
+        for (VmbUint32_t i = 0; i < threads; i++)
+        {
+            if (allied_transform_reserve(&transform->scratch[i], &transform->scratch_size[i], size) != VmbErrorSuccess)
+            {
+                return VmbErrorResources;
+            }
+        }
+    }
+    AlliedTransformJob_s job = {
+        .plan = plan,
+        .src = src,
+        .dst = dst,
+        .scratch = transform->scratch,
+        .bands = bands,
+    };
+    allied_pool_run(threads, &allied_transform_task, &job);
+    for (VmbUint32_t i = 0; i < threads; i++)
+    {
+        if (job.err[i] != VmbErrorSuccess)
+        {
+            return job.err[i];
+        }
+    }
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_transform_create(AlliedTransform_t *transform, const AlliedTransformOptions_t *opts)
+{
+    assert(transform);
+    assert(opts);
+    AlliedTransform_t t = calloc(1, sizeof(struct allied_transform_s));
+    if (t == NULL)
+    {
+        return VmbErrorResources;
+    }
+    t->opts = *opts;
+    t->num_buffers = opts->buffers > 0 ? opts->buffers : ALLIED_TRANSFORM_BUFFERS;
+    t->buffers = calloc(t->num_buffers, sizeof(AlliedTransformBuffer_s));
+    if (t->buffers == NULL)
+    {
+        free(t);
+        return VmbErrorResources;
+    }
+    pthread_mutex_init(&t->lock, NULL);
+    *transform = t;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_transform_destroy(AlliedTransform_t *transform)
+{
+    assert(transform);
+    AlliedTransform_t t = *transform;
+    if (t == NULL)
+    {
+        return VmbErrorBadHandle;
+    }
+    pthread_mutex_lock(&t->lock);
+    for (VmbUint32_t i = 0; i < t->num_buffers; i++)
+    {
+        if (t->buffers[i].held)
+        {
+            pthread_mutex_unlock(&t->lock);
+            return VmbErrorBusy;
+        }
+    }
+    pthread_mutex_unlock(&t->lock);
+    for (VmbUint32_t i = 0; i < t->num_buffers; i++)
+    {
+        free(t->buffers[i].data);
+    }
+    for (int i = 0; i < ALLIED_POOL_MAX_THREADS; i++)
+    {
+        free(t->scratch[i]);
+    }
+    pthread_mutex_destroy(&t->lock);
+    free(t->buffers);
+    free(t);
+    *transform = NULL;
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_transform_frame(AlliedTransform_t transform, const VmbFrame_t *frame, AlliedTransformOutput_t *output)
+{
+    assert(transform);
+    assert(frame);
+    assert(output);
+    pthread_mutex_lock(&transform->lock);
+    AlliedTransformPlan_s *plan = NULL;
+    VmbError_t err = allied_transform_lookup(transform, frame->pixelFormat, frame->width, frame->height, &plan);
+    if (err != VmbErrorSuccess)
+    {
+        goto unlock;
+    }
+    const VmbUchar_t *src = allied_frame_data(frame, plan->src_size);
+    if (src == NULL)
+    {
+        err = VmbErrorBadParameter;
+        goto unlock;
+    }
+    AlliedTransformBuffer_s *buffer = NULL;
+    for (VmbUint32_t i = 0; i < transform->num_buffers && buffer == NULL; i++)
+    {
+        buffer = transform->buffers[i].held ? NULL : &transform->buffers[i];
+    }
+    if (buffer == NULL)
+    {
+        err = VmbErrorBusy;
+        goto unlock;
+    }
+    err = allied_transform_reserve(&buffer->data, &buffer->capacity, plan->dst_size);
+    if (err != VmbErrorSuccess)
+    {
+        goto unlock;
+    }
+    err = allied_transform_run(transform, plan, src, buffer->data);
+    if (err != VmbErrorSuccess)
+    {
+        goto unlock;
+    }
+    buffer->held = true;
+    output->data = buffer->data;
+    output->size = plan->dst_size;
+    output->width = plan->width;
+    output->height = plan->height;
+    output->format = transform->opts.format;
+    output->frame_id = frame->frameID;
+    output->timestamp = frame->timestamp;
+    output->buffer = (VmbUint32_t)(buffer - transform->buffers);
+unlock:
+    pthread_mutex_unlock(&transform->lock);
+    return err;
+}
+
+VmbError_t allied_transform_release(AlliedTransform_t transform, AlliedTransformOutput_t *output)
+{
+    assert(transform);
+    assert(output);
+    VmbError_t err = VmbErrorSuccess;
+    pthread_mutex_lock(&transform->lock);
+    if (output->buffer >= transform->num_buffers || !transform->buffers[output->buffer].held ||
+        transform->buffers[output->buffer].data != output->data)
+    {
+        err = VmbErrorBadParameter;
+    }
+    else
+    {
+        transform->buffers[output->buffer].held = false;
+        memset(output, 0, sizeof(*output));
+    }
+    pthread_mutex_unlock(&transform->lock);
+    return err;
+}
+
+VmbUint64_t allied_transform_plans_built(AlliedTransform_t transform)
+{
+    assert(transform);
+    pthread_mutex_lock(&transform->lock);
+    VmbUint64_t built = transform->built;
+    pthread_mutex_unlock(&transform->lock);
+    return built;
+}
@@ -0,0 +1,318 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/**
+ * @file alliedcam_unpack.c
+ * @author Sunip K. Mukherjee (sunipkmukherjee@gmail.com)
+ * @brief Unpacking of packed monochrome pixel formats for the Allied Vision Camera Simplified API
+ * @version Check Readme file for version info.
+ * @date 2023-10-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "alliedcam_unpack.h"
+#include "alliedcam_frame.h"
+#include "alliedcam_dispatch.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+
+/**
+ * @brief Unpack pixels, starting at a group boundary.
+ *
+ * @param format Pixel format
+ * @param dst Destination
+ * @param src Source, at least enough bytes for `count` pixels
+ * @param count Number of pixels
+ * @param lshift Left shift applied to the unpacked value
+ * @param rshift Right shift applied after the left shift
+ * @return size_t Number of pixels unpacked, a multiple of 8. The caller finishes the remainder.
+ */
+typedef size_t (*AlliedUnpackKernel)(VmbPixelFormat_t format, VmbUint16_t *dst, const VmbUchar_t *src, size_t count, int lshift, int rshift);
+
+static void allied_unpack_tail(VmbPixelFormat_t format, VmbUint16_t *dst, const VmbUchar_t *src, size_t count, int lshift, int rshift)
+{
+    size_t i = 0;
+    switch (format)
+    {
+    case VmbPixelFormatMono10p: // 4 pixels in 5 bytes, LSB first
+        for (; i + 4 <= count; i += 4, src += 5)
+        {
+            VmbUint64_t w = (VmbUint64_t)src[0] | ((VmbUint64_t)src[1] << 8) | ((VmbUint64_t)src[2] << 16) | ((VmbUint64_t)src[3] << 24) | ((VmbUint64_t)src[4] << 32);
+            dst[i] = (VmbUint16_t)(((w & 0x3ff) << lshift) >> rshift);
+            dst[i + 1] = (VmbUint16_t)((((w >> 10) & 0x3ff) << lshift) >> rshift);
+            dst[i + 2] = (VmbUint16_t)((((w >> 20) & 0x3ff) << lshift) >> rshift);
+            dst[i + 3] = (VmbUint16_t)((((w >> 30) & 0x3ff) << lshift) >> rshift);
+        }
+        for (size_t j = 0; i < count; i++, j++)
+        {
+            size_t bit = 10 * j;
+            VmbUint32_t v = ((VmbUint32_t)src[bit / 8] | ((VmbUint32_t)src[bit / 8 + 1] << 8)) >> (bit % 8);
+            dst[i] = (VmbUint16_t)(((v & 0x3ff) << lshift) >> rshift);
+        }
+        break;
+    case VmbPixelFormatMono12p: // 2 pixels in 3 bytes, LSB first
+        for (; i + 2 <= count; i += 2, src += 3)
+        {
+            VmbUint32_t v0 = (VmbUint32_t)src[0] | ((VmbUint32_t)(src[1] & 0xf) << 8);
+            VmbUint32_t v1 = ((VmbUint32_t)src[1] >> 4) | ((VmbUint32_t)src[2] << 4);
+            dst[i] = (VmbUint16_t)((v0 << lshift) >> rshift);
+            dst[i + 1] = (VmbUint16_t)((v1 << lshift) >> rshift);
+        }
+        if (i < count)
+        {
+            VmbUint32_t v0 = (VmbUint32_t)src[0] | ((VmbUint32_t)(src[1] & 0xf) << 8);
+            dst[i] = (VmbUint16_t)((v0 << lshift) >> rshift);
+        }
+        break;
+    case VmbPixelFormatMono12Packed: // 2 pixels in 3 bytes, high bits in the outer bytes
+        for (; i + 2 <= count; i += 2, src += 3)
+        {
+            VmbUint32_t v0 = ((VmbUint32_t)src[0] << 4) | (src[1] & 0xf);
+            VmbUint32_t v1 = ((VmbUint32_t)src[2] << 4) | (src[1] >> 4);
+            dst[i] = (VmbUint16_t)((v0 << lshift) >> rshift);
+            dst[i + 1] = (VmbUint16_t)((v1 << lshift) >> rshift);
+        }
+        if (i < count)
+        {
+            VmbUint32_t v0 = ((VmbUint32_t)src[0] << 4) | (src[1] & 0xf);
+            dst[i] = (VmbUint16_t)((v0 << lshift) >> rshift);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// the scalar level has no vector kernel: allied_unpack_tail unpacks every pixel
+static size_t allied_unpack_scalar(VmbPixelFormat_t format, VmbUint16_t *dst, const VmbUchar_t *src, size_t count, int lshift, int rshift)
+{
+    (void)format, (void)dst, (void)src, (void)count, (void)lshift, (void)rshift;
+    return 0;
+}
+
+#ifdef ALLIED_X86
+// Every 128-bit lane turns 8 pixels (10 or 12 source bytes) into eight 16-bit words:
+// a byte shuffle gathers the two bytes holding each pixel into its word, then the
+// pixel is isolated by format:
+//  - Mono12p: even words hold the pixel in bits 0-11, odd words in bits 4-15.
+//  - Mono12Packed: odd words are (b2:b1) >> 4, even words are (b0:b1) with the nibbles swapped.
+//  - Mono10p: the pixel starts at bit 0, 2, 4 or 6. A multiply moves it to bits 6-15, then >> 6.
+// The alignment shift is applied last, in the same registers.
+
+ALLIED_TARGET_SSE41 static size_t allied_unpack_sse41(VmbPixelFormat_t format, VmbUint16_t *dst, const VmbUchar_t *src, size_t count, int lshift, int rshift)
+{
+    size_t nbytes = (count * allied_format_bits(format) + 7) / 8;
+    size_t step = format == VmbPixelFormatMono10p ? 10 : 12;
+    const __m128i lcnt = _mm_cvtsi32_si128(lshift);
+    const __m128i rcnt = _mm_cvtsi32_si128(rshift);
+    const __m128i lo12 = _mm_set1_epi16(0x0fff);
+    const __m128i mid8 = _mm_set1_epi16(0x0ff0);
+    const __m128i lo4 = _mm_set1_epi16(0x000f);
+    const __m128i mul10 = _mm_setr_epi16(64, 16, 4, 1, 64, 16, 4, 1);
+    __m128i shuf;
+    switch (format)
+    {
+    case VmbPixelFormatMono10p:
+        shuf = _mm_setr_epi8(0, 1, 1, 2, 2, 3, 3, 4, 5, 6, 6, 7, 7, 8, 8, 9);
+        break;
+    case VmbPixelFormatMono12p:
+        shuf = _mm_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11);
+        break;
+    case VmbPixelFormatMono12Packed:
+        shuf = _mm_setr_epi8(1, 0, 1, 2, 4, 3, 4, 5, 7, 6, 7, 8, 10, 9, 10, 11);
+        break;
+    default:
+        return 0;
+    }
+    size_t i = 0, off = 0;
+    for (; i + 8 <= count && off + 16 <= nbytes; i += 8, off += step)
+    {
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + off)), shuf);
+        __m128i t = _mm_srli_epi16(v, 4);
+        switch (format)
+        {
+        case VmbPixelFormatMono10p:
+            v = _mm_srli_epi16(_mm_mullo_epi16(v, mul10), 6);
+            break;
+        case VmbPixelFormatMono12p:
+            v = _mm_blend_epi16(_mm_and_si128(v, lo12), t, 0xaa);
+            break;
+        default:
+            v = _mm_blend_epi16(_mm_or_si128(_mm_and_si128(t, mid8), _mm_and_si128(v, lo4)), t, 0xaa);
+            break;
+        }
+        v = _mm_srl_epi16(_mm_sll_epi16(v, lcnt), rcnt);
+        _mm_storeu_si128((__m128i *)(dst + i), v);
+    }
+    return i;
+}
+
+ALLIED_TARGET_AVX2 static size_t allied_unpack_avx2(VmbPixelFormat_t format, VmbUint16_t *dst, const VmbUchar_t *src, size_t count, int lshift, int rshift)
+{
+    size_t nbytes = (count * allied_format_bits(format) + 7) / 8;
+    size_t step = format == VmbPixelFormatMono10p ? 10 : 12;
+    const __m128i lcnt = _mm_cvtsi32_si128(lshift);
+    const __m128i rcnt = _mm_cvtsi32_si128(rshift);
+    const __m256i lo12 = _mm256_set1_epi16(0x0fff);
+    const __m256i mid8 = _mm256_set1_epi16(0x0ff0);
+    const __m256i lo4 = _mm256_set1_epi16(0x000f);
+    const __m256i mul10 = _mm256_setr_epi16(64, 16, 4, 1, 64, 16, 4, 1, 64, 16, 4, 1, 64, 16, 4, 1);
+    __m256i shuf;
+    switch (format)
+    {
+    case VmbPixelFormatMono10p:
+        shuf = _mm256_setr_epi8(0, 1, 1, 2, 2, 3, 3, 4, 5, 6, 6, 7, 7, 8, 8, 9,
+                                0, 1, 1, 2, 2, 3, 3, 4, 5, 6, 6, 7, 7, 8, 8, 9);
+        break;
+    case VmbPixelFormatMono12p:
+        shuf = _mm256_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11,
+                                0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11);
+        break;
+    case VmbPixelFormatMono12Packed:
+        shuf = _mm256_setr_epi8(1, 0, 1, 2, 4, 3, 4, 5, 7, 6, 7, 8, 10, 9, 10, 11,
+                                1, 0, 1, 2, 4, 3, 4, 5, 7, 6, 7, 8, 10, 9, 10, 11);
+        break;
+    default:
+        return 0;
+    }
+    size_t i = 0, off = 0;
+    for (; i + 16 <= count && off + step + 16 <= nbytes; i += 16, off += 2 * step)
+    {
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(src + off))),
+                                            _mm_loadu_si128((const __m128i *)(src + off + step)), 1);
+        v = _mm256_shuffle_epi8(v, shuf);
+        __m256i t = _mm256_srli_epi16(v, 4);
+        switch (format)
+        {
+        case VmbPixelFormatMono10p:
+            v = _mm256_srli_epi16(_mm256_mullo_epi16(v, mul10), 6);
+            break;
+        case VmbPixelFormatMono12p:
+            v = _mm256_blend_epi16(_mm256_and_si256(v, lo12), t, 0xaa);
+            break;
+        default:
+            v = _mm256_blend_epi16(_mm256_or_si256(_mm256_and_si256(t, mid8), _mm256_and_si256(v, lo4)), t, 0xaa);
+            break;
+        }
+        v = _mm256_srl_epi16(_mm256_sll_epi16(v, lcnt), rcnt);
+        _mm256_storeu_si256((__m256i *)(dst + i), v);
+    }
+    _mm256_zeroupper();
+    return i;
+}
+
+ALLIED_TARGET_AVX512 static size_t allied_unpack_avx512(VmbPixelFormat_t format, VmbUint16_t *dst, const VmbUchar_t *src, size_t count, int lshift, int rshift)
+{
+    size_t nbytes = (count * allied_format_bits(format) + 7) / 8;
+    size_t step = format == VmbPixelFormatMono10p ? 10 : 12;
+    const __m128i lcnt = _mm_cvtsi32_si128(lshift);
+    const __m128i rcnt = _mm_cvtsi32_si128(rshift);
+    const __m512i lo12 = _mm512_set1_epi16(0x0fff);
+    const __m512i mid8 = _mm512_set1_epi16(0x0ff0);
+    const __m512i lo4 = _mm512_set1_epi16(0x000f);
+    const __m512i mul10 = _mm512_broadcast_i32x4(_mm_setr_epi16(64, 16, 4, 1, 64, 16, 4, 1));
+    // spread the 4 * step source bytes over the four 128-bit lanes, lane k starts at byte k * step
+    const __m512i spread10 = _mm512_set_epi16(22, 21, 20, 19, 18, 17, 16, 15, 17, 16, 15, 14, 13, 12, 11, 10,
+                                              12, 11, 10, 9, 8, 7, 6, 5, 7, 6, 5, 4, 3, 2, 1, 0);
+    const __m512i spread12 = _mm512_set_epi32(12, 11, 10, 9, 9, 8, 7, 6, 6, 5, 4, 3, 3, 2, 1, 0);
+    const __mmask64 load = (1ULL << (4 * step)) - 1;
+    __m512i shuf;
+    switch (format)
+    {
+    case VmbPixelFormatMono10p:
+        shuf = _mm512_broadcast_i32x4(_mm_setr_epi8(0, 1, 1, 2, 2, 3, 3, 4, 5, 6, 6, 7, 7, 8, 8, 9));
+        break;
+    case VmbPixelFormatMono12p:
+        shuf = _mm512_broadcast_i32x4(_mm_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11));
+        break;
+    case VmbPixelFormatMono12Packed:
+        shuf = _mm512_broadcast_i32x4(_mm_setr_epi8(1, 0, 1, 2, 4, 3, 4, 5, 7, 6, 7, 8, 10, 9, 10, 11));
+        break;
+    default:
+        return 0;
+    }
+    size_t i = 0, off = 0;
+    for (; i + 32 <= count && off + 4 * step <= nbytes; i += 32, off += 4 * step)
+    {
+        __m512i v = _mm512_maskz_loadu_epi8(load, src + off); // masked, never reads past the packed data
+        v = format == VmbPixelFormatMono10p ? _mm512_permutexvar_epi16(spread10, v) : _mm512_permutexvar_epi32(spread12, v);
+        v = _mm512_shuffle_epi8(v, shuf);
+        __m512i t = _mm512_srli_epi16(v, 4);
+        switch (format)
+        {
+        case VmbPixelFormatMono10p:
+            v = _mm512_srli_epi16(_mm512_mullo_epi16(v, mul10), 6);
+            break;
+        case VmbPixelFormatMono12p:
+            v = _mm512_mask_blend_epi16(0xaaaaaaaa, _mm512_and_si512(v, lo12), t);
+            break;
+        default:
+            v = _mm512_mask_blend_epi16(0xaaaaaaaa, _mm512_or_si512(_mm512_and_si512(t, mid8), _mm512_and_si512(v, lo4)), t);
+            break;
+        }
+        v = _mm512_srl_epi16(_mm512_sll_epi16(v, lcnt), rcnt);
+        _mm512_storeu_si512((void *)(dst + i), v);
+    }
+    _mm256_zeroupper();
+    return i;
+}
+#endif // ALLIED_X86
+
+static AlliedUnpackKernel unpack_kernel = &allied_unpack_scalar;
+
+ALLIED_KERNEL_BINDER(allied_unpack_bind, unpack_kernel, &allied_unpack)
+
+bool allied_unpack_supported(VmbPixelFormat_t format)
+{
+    return format == VmbPixelFormatMono10p ||
+           format == VmbPixelFormatMono12p ||
+           format == VmbPixelFormatMono12Packed;
+}
+
+VmbError_t allied_unpack(VmbPixelFormat_t format, const void *src, size_t src_size, VmbUint16_t *dst, size_t count, AlliedUnpackAlign_t align, int shift)
+{
+    assert(src);
+    assert(dst);
+    if (!allied_unpack_supported(format))
+    {
+        return VmbErrorNotSupported;
+    }
+    int bits = (int)allied_format_bits(format);
+    int total = (align == AlliedUnpackMsb ? 16 - bits : 0) + shift;
+    if (total > 16 - bits || total < -15)
+    {
+        return VmbErrorBadParameter;
+    }
+    if (src_size < (count * bits + 7) / 8)
+    {
+        return VmbErrorBadParameter;
+    }
+    allied_dispatch_init();
+    int lshift = total > 0 ? total : 0;
+    int rshift = total < 0 ? -total : 0;
+    size_t done = unpack_kernel(format, dst, (const VmbUchar_t *)src, count, lshift, rshift);
+    // kernels stop on a multiple of 8 pixels, which is also a byte boundary
+    allied_unpack_tail(format, dst + done, (const VmbUchar_t *)src + done * bits / 8, count - done, lshift, rshift);
+    return VmbErrorSuccess;
+}
+
+VmbError_t allied_unpack_frame(const VmbFrame_t *frame, VmbUint16_t *dst, size_t count, AlliedUnpackAlign_t align, int shift)
+{
+    assert(frame);
+    assert(dst);
+    size_t pixels = (size_t)frame->width * frame->height;
+    if (count < pixels)
+    {
+        return VmbErrorMoreData;
+    }
+    size_t size = (pixels * allied_format_bits(frame->pixelFormat) + 7) / 8;
+    const VmbUchar_t *data = allied_frame_data(frame, size);
+    if (data == NULL)
+    {
+        return VmbErrorBadParameter;
+    }
+    return allied_unpack(frame->pixelFormat, data, size, dst, pixels, align, shift);
+}